@@ -30,3 +30,27 @@ void SPIR64TargetInfo::getTargetDefines(const LangOptions &Opts,
                                         MacroBuilder &Builder) const {
   DefineStd(Builder, "SPIR64", Opts);
 }
+
+void SPIRV32TargetInfo::adjust(LangOptions &Opts) {
+  SPIR32TargetInfo::adjust(Opts);
+  if (!Opts.OpenCL)
+    AddrSpaceMap = &SPIRVDefIsGenAddrSpaceMap;
+}
+
+void SPIRV32TargetInfo::getTargetDefines(const LangOptions &Opts,
+                                         MacroBuilder &Builder) const {
+  DefineStd(Builder, "SPIRV", Opts);
+  DefineStd(Builder, "SPIRV32", Opts);
+}
+
+void SPIRV64TargetInfo::adjust(LangOptions &Opts) {
+  SPIR64TargetInfo::adjust(Opts);
+  if (!Opts.OpenCL)
+    AddrSpaceMap = &SPIRVDefIsGenAddrSpaceMap;
+}
+
+void SPIRV64TargetInfo::getTargetDefines(const LangOptions &Opts,
+                                         MacroBuilder &Builder) const {
+  DefineStd(Builder, "SPIRV", Opts);
+  DefineStd(Builder, "SPIRV64", Opts);
+}
@@ -33,6 +33,20 @@ static const unsigned SPIRAddrSpaceMap[] = {
     0  // cuda_shared
 };
 
+// Outside of OpenCL, unqualified pointers may point to any storage, as with
+// OpenMP offloading, so they're generic.
+static const unsigned SPIRVDefIsGenAddrSpaceMap[] = {
+    4, // Default
+    1, // opencl_global
+    3, // opencl_local
+    2, // opencl_constant
+    0, // opencl_private
+    4, // opencl_generic
+    1, // cuda_device
+    2, // cuda_constant
+    3  // cuda_shared
+};
+
 class LLVM_LIBRARY_VISIBILITY SPIRTargetInfo : public TargetInfo {
 public:
   SPIRTargetInfo(const llvm::Triple &Triple, const TargetOptions &)
@@ -127,6 +141,33 @@ public:
   void getTargetDefines(const LangOptions &Opts,
                         MacroBuilder &Builder) const override;
 };
+
+// The SPIR-V targets, for the SPIR-V backend rather than SPIR consumers
+class LLVM_LIBRARY_VISIBILITY SPIRV32TargetInfo : public SPIR32TargetInfo {
+public:
+  SPIRV32TargetInfo(const llvm::Triple &Triple, const TargetOptions &Opts)
+      : SPIR32TargetInfo(Triple, Opts) {
+    resetDataLayout("e-m:e-p:32:32");
+  }
+
+  void adjust(LangOptions &Opts) override;
+
+  void getTargetDefines(const LangOptions &Opts,
+                        MacroBuilder &Builder) const override;
+};
+
+class LLVM_LIBRARY_VISIBILITY SPIRV64TargetInfo : public SPIR64TargetInfo {
+public:
+  SPIRV64TargetInfo(const llvm::Triple &Triple, const TargetOptions &Opts)
+      : SPIR64TargetInfo(Triple, Opts) {
+    resetDataLayout("e-m:e-p:64:64");
+  }
+
+  void adjust(LangOptions &Opts) override;
+
+  void getTargetDefines(const LangOptions &Opts,
+                        MacroBuilder &Builder) const override;
+};
 } // namespace targets
 } // namespace clang
 #endif // LLVM_CLANG_LIB_BASIC_TARGETS_SPIR_H
@@ -6580,6 +6580,9 @@ void CGOpenMPRuntime::emitTargetOutlinedFunctionHelper(
     OutlinedFnID = llvm::ConstantExpr::getBitCast(OutlinedFn, CGM.Int8PtrTy);
     OutlinedFn->setLinkage(llvm::GlobalValue::WeakAnyLinkage);
     OutlinedFn->setDSOLocal(false);
+    // SPIR-V entry points are the kernels, which the runtime enqueues.
+    if (CGM.getTriple().isSPIRV())
+      OutlinedFn->setCallingConv(llvm::CallingConv::SPIR_KERNEL);
   } else {
     std::string Name = getName({EntryFnName, "region_id"});
     OutlinedFnID = new llvm::GlobalVariable(
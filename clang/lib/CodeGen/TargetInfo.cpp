@@ -8835,6 +8835,25 @@ public:
   unsigned getOpenCLKernelCallingConv() const override;
 };
 
+class SPIRVTargetCodeGenInfo : public SPIRTargetCodeGenInfo {
+  // Whether unqualified pointers are generic, i.e. outside of OpenCL, so that
+  // variables need to be put in a storage and their address converted.
+  bool DefaultIsGeneric;
+
+public:
+  SPIRVTargetCodeGenInfo(CodeGen::CodeGenTypes &CGT, bool DefaultIsGeneric)
+    : SPIRTargetCodeGenInfo(CGT), DefaultIsGeneric(DefaultIsGeneric) {}
+
+  LangAS getASTAllocaAddressSpace() const override {
+    if (!DefaultIsGeneric)
+      return LangAS::Default;
+    return getLangASFromTargetAS(
+        getABIInfo().getDataLayout().getAllocaAddrSpace());
+  }
+  LangAS getGlobalVarAddressSpace(CodeGenModule &CGM,
+                                  const VarDecl *D) const override;
+};
+
 } // End anonymous namespace.
 
 namespace clang {
@@ -8850,6 +8869,20 @@ unsigned SPIRTargetCodeGenInfo::getOpenCLKernelCallingConv() const {
   return llvm::CallingConv::SPIR_KERNEL;
 }
 
+LangAS
+SPIRVTargetCodeGenInfo::getGlobalVarAddressSpace(CodeGenModule &CGM,
+                                                 const VarDecl *D) const {
+  assert(!CGM.getLangOpts().OpenCL &&
+         !(CGM.getLangOpts().CUDA && CGM.getLangOpts().CUDAIsDevice) &&
+         "Address space agnostic languages only");
+  LangAS AddrSpace = D ? D->getType().getAddressSpace() : LangAS::Default;
+  if (AddrSpace != LangAS::Default)
+    return AddrSpace;
+  // Variables can't be generic, so put them in global memory.
+  return getLangASFromTargetAS(
+      CGM.getContext().getTargetAddressSpace(LangAS::opencl_global));
+}
+
 static bool appendType(SmallStringEnc &Enc, QualType QType,
                        const CodeGen::CodeGenModule &CGM,
                        TypeStringCache &TSC);
@@ -9820,6 +9853,10 @@ const TargetCodeGenInfo &CodeGenModule::getTargetCodeGenInfo() {
   case llvm::Triple::spir:
   case llvm::Triple::spir64:
     return SetCGInfo(new SPIRTargetCodeGenInfo(Types));
+  case llvm::Triple::spirv32:
+  case llvm::Triple::spirv64:
+    return SetCGInfo(
+        new SPIRVTargetCodeGenInfo(Types, !getLangOpts().OpenCL));
   }
 }
 
@@ -0,0 +1,309 @@
+//===-- SPIRVCompileTime.cpp - SPIR-V backend compile-time benchmarks -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Time the SPIR-V codegen pipeline, as run by llc -filetype=obj, on synthetic
+// modules which scale along one dimension each: kernels and types, struct
+// nesting, constants, blocks, builtin calls and image accesses. Each benchmark
+// reports the number of words emitted, and the peak RSS of the process so far,
+// so run a single one with --benchmark_filter for the peak RSS of its input.
+//
+// Other arguments are parsed as LLVM options, so -time-passes -track-memory
+// report the time and memory use of each pass, summed over all the runs, and
+// the -spirv-* options can be compared.
+//
+//===----------------------------------------------------------------------===//
+
+#include "benchmark/benchmark.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <string>
+
+#ifdef LLVM_ON_UNIX
+#include <sys/resource.h>
+#endif
+
+using namespace llvm;
+
+static const char *const TargetTriple = "spirv64-unknown-unknown";
+
+static std::unique_ptr<TargetMachine> createTargetMachine() {
+  std::string error;
+  const Target *T = TargetRegistry::lookupTarget(TargetTriple, error);
+  if (!T) {
+    report_fatal_error(error);
+  }
+  return std::unique_ptr<TargetMachine>(T->createTargetMachine(
+      TargetTriple, "", "", TargetOptions(), None, None,
+      CodeGenOpt::Default));
+}
+
+static void addMaxRSSCounter(benchmark::State &state) {
+#ifdef LLVM_ON_UNIX
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    state.counters["MaxRSS_KiB"] = usage.ru_maxrss / 1024;
+#else
+    state.counters["MaxRSS_KiB"] = usage.ru_maxrss;
+#endif
+  }
+#endif
+}
+
+// Compile the module given as IR in each iteration, excluding the time to copy
+// it and set up the pipeline.
+static void compileModule(benchmark::State &state, const std::string &IR) {
+  std::unique_ptr<TargetMachine> TM = createTargetMachine();
+  LLVMContext Ctx;
+  SMDiagnostic err;
+  std::unique_ptr<Module> M = parseAssemblyString(IR, err, Ctx);
+  if (!M) {
+    err.print("SPIRVCompileTime", errs());
+    report_fatal_error("Invalid benchmark input");
+  }
+  M->setTargetTriple(TargetTriple);
+  M->setDataLayout(TM->createDataLayout());
+
+  size_t numBytes = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<Module> clone = CloneModule(*M);
+    SmallString<0> out;
+    raw_svector_ostream OS(out);
+    auto PM = make_unique<legacy::PassManager>();
+    if (TM->addPassesToEmitFile(*PM, OS, nullptr,
+                                TargetMachine::CGFT_ObjectFile)) {
+      report_fatal_error("The SPIR-V target can't emit object files");
+    }
+    state.ResumeTiming();
+    PM->run(*clone);
+    state.PauseTiming();
+    numBytes = out.size();
+    PM.reset();
+    clone.reset();
+    state.ResumeTiming();
+  }
+  state.counters["Words"] = numBytes / 4;
+  addMaxRSSCounter(state);
+}
+
+// N kernels, each reading the first element of M distinct array types, so the
+// types are created in every kernel and merged when hoisted.
+static std::string buildKernelsAndTypes(unsigned numKernels,
+                                        unsigned numTypes) {
+  std::string IR;
+  raw_string_ostream OS(IR);
+  for (unsigned k = 0; k < numKernels; ++k) {
+    OS << "define spir_kernel void @kernel" << k << "(i32 addrspace(1)* %out";
+    for (unsigned t = 0; t < numTypes; ++t) {
+      OS << ", [" << t + 1 << " x i32] addrspace(1)* %in" << t;
+    }
+    OS << ") {\nentry:\n";
+    std::string acc = "0";
+    for (unsigned t = 0; t < numTypes; ++t) {
+      OS << "  %p" << t << " = getelementptr [" << t + 1 << " x i32], ["
+         << t + 1 << " x i32] addrspace(1)* %in" << t << ", i64 0, i64 0\n";
+      OS << "  %v" << t << " = load i32, i32 addrspace(1)* %p" << t
+         << ", align 4\n";
+      OS << "  %s" << t << " = add i32 " << acc << ", %v" << t << "\n";
+      acc = "%s" + std::to_string(t);
+    }
+    OS << "  store i32 " << acc << ", i32 addrspace(1)* %out, align 4\n";
+    OS << "  ret void\n}\n";
+  }
+  return OS.str();
+}
+
+static void BM_KernelsAndTypes(benchmark::State &state) {
+  compileModule(state, buildKernelsAndTypes(state.range(0), state.range(1)));
+}
+BENCHMARK(BM_KernelsAndTypes)
+    ->Unit(benchmark::kMillisecond)
+    ->Args({1, 256})
+    ->Args({16, 16})
+    ->Args({64, 64})
+    ->Args({256, 16});
+
+// A struct nested N deep, with an i32 read at each level.
+static std::string buildDeepStruct(unsigned depth) {
+  std::string IR;
+  raw_string_ostream OS(IR);
+  OS << "%s0 = type { i32, float }\n";
+  for (unsigned d = 1; d <= depth; ++d) {
+    OS << "%s" << d << " = type { %s" << d - 1 << ", i32 }\n";
+  }
+  OS << "define spir_kernel void @kernel(i32 addrspace(1)* %out, %s" << depth
+     << " addrspace(1)* %in) {\nentry:\n";
+  std::string acc = "0";
+  std::string indices = "i32 0";
+  for (unsigned d = depth; d > 0; --d) {
+    OS << "  %p" << d << " = getelementptr %s" << depth << ", %s" << depth
+       << " addrspace(1)* %in, " << indices << ", i32 1\n";
+    OS << "  %v" << d << " = load i32, i32 addrspace(1)* %p" << d
+       << ", align 4\n";
+    OS << "  %a" << d << " = add i32 " << acc << ", %v" << d << "\n";
+    acc = "%a" + std::to_string(d);
+    indices += ", i32 0";
+  }
+  OS << "  store i32 " << acc << ", i32 addrspace(1)* %out, align 4\n";
+  OS << "  ret void\n}\n";
+  return OS.str();
+}
+
+static void BM_DeepStruct(benchmark::State &state) {
+  compileModule(state, buildDeepStruct(state.range(0)));
+}
+BENCHMARK(BM_DeepStruct)->Unit(benchmark::kMillisecond)->Range(8, 512);
+
+// N stores of distinct constants to distinct constant offsets.
+static std::string buildManyConstants(unsigned numConstants) {
+  std::string IR;
+  raw_string_ostream OS(IR);
+  OS << "define spir_kernel void @kernel(i32 addrspace(1)* %out) {\nentry:\n";
+  for (unsigned c = 0; c < numConstants; ++c) {
+    OS << "  %p" << c << " = getelementptr inbounds i32, i32 addrspace(1)* "
+       << "%out, i64 " << c << "\n";
+    OS << "  store i32 " << c * 7919 + 13 << ", i32 addrspace(1)* %p" << c
+       << ", align 4\n";
+  }
+  OS << "  ret void\n}\n";
+  return OS.str();
+}
+
+static void BM_ManyConstants(benchmark::State &state) {
+  compileModule(state, buildManyConstants(state.range(0)));
+}
+BENCHMARK(BM_ManyConstants)->Unit(benchmark::kMillisecond)->Range(64, 8192);
+
+// A chain of N if-then diamonds, each conditionally adding to a phi.
+static std::string buildManyBlocks(unsigned numDiamonds) {
+  std::string IR;
+  raw_string_ostream OS(IR);
+  OS << "define spir_kernel void @kernel(i32 addrspace(1)* %out, i32 %a0) {\n"
+     << "b0:\n";
+  for (unsigned i = 0; i < numDiamonds; ++i) {
+    OS << "  %c" << i << " = icmp sgt i32 %a" << i << ", " << i << "\n";
+    OS << "  br i1 %c" << i << ", label %t" << i << ", label %b" << i + 1
+       << "\n";
+    OS << "t" << i << ":\n";
+    OS << "  %x" << i << " = add i32 %a" << i << ", " << i + 1 << "\n";
+    OS << "  br label %b" << i + 1 << "\n";
+    OS << "b" << i + 1 << ":\n";
+    OS << "  %a" << i + 1 << " = phi i32 [ %a" << i << ", %b" << i
+       << " ], [ %x" << i << ", %t" << i << " ]\n";
+  }
+  OS << "  store i32 %a" << numDiamonds
+     << ", i32 addrspace(1)* %out, align 4\n";
+  OS << "  ret void\n}\n";
+  return OS.str();
+}
+
+static void BM_ManyBlocks(benchmark::State &state) {
+  compileModule(state, buildManyBlocks(state.range(0)));
+}
+BENCHMARK(BM_ManyBlocks)->Unit(benchmark::kMillisecond)->Range(64, 4096);
+
+// N calls to math builtins, chained through their results.
+static std::string buildManyBuiltinCalls(unsigned numCalls) {
+  static const char *const unaryBuiltins[] = {"_Z3sinf", "_Z3cosf",
+                                              "_Z4sqrtf", "_Z5floorf"};
+  std::string IR;
+  raw_string_ostream OS(IR);
+  for (const char *name : unaryBuiltins) {
+    OS << "declare spir_func float @" << name << "(float)\n";
+  }
+  OS << "declare spir_func float @_Z5clampfff(float, float, float)\n"
+     << "declare spir_func i64 @_Z13get_global_idj(i32)\n";
+  OS << "define spir_kernel void @kernel(float addrspace(1)* %out) {\n"
+     << "entry:\n"
+     << "  %id = call spir_func i64 @_Z13get_global_idj(i32 0)\n"
+     << "  %p = getelementptr inbounds float, float addrspace(1)* %out, "
+     << "i64 %id\n"
+     << "  %f0 = load float, float addrspace(1)* %p, align 4\n";
+  for (unsigned i = 0; i < numCalls; ++i) {
+    OS << "  %f" << i + 1 << " = call spir_func float @";
+    if (i % 5 == 4) {
+      OS << "_Z5clampfff(float %f" << i << ", float 0.0, float 1.0)\n";
+    } else {
+      OS << unaryBuiltins[i % 5] << "(float %f" << i << ")\n";
+    }
+  }
+  OS << "  store float %f" << numCalls << ", float addrspace(1)* %p, "
+     << "align 4\n";
+  OS << "  ret void\n}\n";
+  return OS.str();
+}
+
+static void BM_ManyBuiltinCalls(benchmark::State &state) {
+  compileModule(state, buildManyBuiltinCalls(state.range(0)));
+}
+BENCHMARK(BM_ManyBuiltinCalls)->Unit(benchmark::kMillisecond)->Range(64, 4096);
+
+// A kernel copying N pixels from one image to another.
+static std::string buildImageKernel(unsigned numPixels) {
+  std::string IR;
+  raw_string_ostream OS(IR);
+  OS << "%opencl.image2d_ro_t = type opaque\n"
+     << "%opencl.image2d_wo_t = type opaque\n"
+     << "declare spir_func <4 x float> "
+     << "@_Z11read_imagef14ocl_image2d_roDv2_i("
+     << "%opencl.image2d_ro_t addrspace(1)*, <2 x i32>)\n"
+     << "declare spir_func void "
+     << "@_Z12write_imagef14ocl_image2d_woDv2_iDv4_f("
+     << "%opencl.image2d_wo_t addrspace(1)*, <2 x i32>, <4 x float>)\n";
+  OS << "define spir_kernel void @kernel("
+     << "%opencl.image2d_ro_t addrspace(1)* %src, "
+     << "%opencl.image2d_wo_t addrspace(1)* %dst) {\nentry:\n";
+  for (unsigned i = 0; i < numPixels; ++i) {
+    const std::string coord = "<2 x i32> <i32 " + std::to_string(i % 64) +
+                              ", i32 " + std::to_string(i / 64) + ">";
+    OS << "  %v" << i << " = call spir_func <4 x float> "
+       << "@_Z11read_imagef14ocl_image2d_roDv2_i("
+       << "%opencl.image2d_ro_t addrspace(1)* %src, " << coord << ")\n";
+    OS << "  call spir_func void "
+       << "@_Z12write_imagef14ocl_image2d_woDv2_iDv4_f("
+       << "%opencl.image2d_wo_t addrspace(1)* %dst, " << coord
+       << ", <4 x float> %v" << i << ")\n";
+  }
+  OS << "  ret void\n}\n";
+  return OS.str();
+}
+
+static void BM_ImageKernel(benchmark::State &state) {
+  compileModule(state, buildImageKernel(state.range(0)));
+}
+BENCHMARK(BM_ImageKernel)->Unit(benchmark::kMillisecond)->Range(64, 4096);
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  InitializeAllTargetInfos();
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+
+  benchmark::Initialize(&argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "SPIR-V backend compile-time benchmarks\n");
+  benchmark::RunSpecifiedBenchmarks();
+  reportAndResetTimings();
+  return 0;
+}
@@ -0,0 +1,341 @@
+//===-- SPIRVHotPaths.cpp - SPIR-V backend data structure benchmarks ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Microbenchmarks of the data structures the SPIR-V backend uses for most
+// instructions it emits, so changes to them can be measured on their own
+// rather than through whole llc runs.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/SPIRVMCTargetDesc.h"
+#include "SPIRVCapabilityUtils.h"
+#include "SPIRVInstrInfo.h"
+#include "SPIRVOpenCLBIFs.h"
+#include "SPIRVStrings.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTypeRegistry.h"
+#include "benchmark/benchmark.h"
+#include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/MCCodeEmitter.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCFixup.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+using namespace llvm;
+
+static const char *const TargetTriple = "spirv64-unknown-unknown";
+
+static LLVMTargetMachine *createTargetMachine(const Target *&T) {
+  static bool initialized = false;
+  if (!initialized) {
+    InitializeAllTargetInfos();
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+    initialized = true;
+  }
+  std::string error;
+  T = TargetRegistry::lookupTarget(TargetTriple, error);
+  if (!T) {
+    report_fatal_error(error);
+  }
+  return static_cast<LLVMTargetMachine *>(
+      T->createTargetMachine(TargetTriple, "", "", TargetOptions(), None));
+}
+
+namespace {
+// A kernel's MachineFunction with a single block, which the benchmarks build
+// instructions in like the IRTranslator would.
+struct FunctionFixture {
+  LLVMContext Ctx;
+  Module M{"bench", Ctx};
+  const Target *T = nullptr;
+  std::unique_ptr<LLVMTargetMachine> TM;
+  std::unique_ptr<MachineModuleInfo> MMI;
+  MachineFunction *MF = nullptr;
+  MachineIRBuilder MIRBuilder;
+
+  FunctionFixture() : TM(createTargetMachine(T)) {
+    M.setDataLayout(TM->createDataLayout());
+    auto *F = Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                               GlobalValue::ExternalLinkage, "kernel", M);
+    F->setCallingConv(CallingConv::SPIR_KERNEL);
+    MMI = make_unique<MachineModuleInfo>(TM.get());
+    MF = &MMI->getOrCreateMachineFunction(*F);
+    MF->push_back(MF->CreateMachineBasicBlock());
+    MIRBuilder.setMF(*MF);
+    MIRBuilder.setMBB(MF->front());
+    getTypeRegistry().startFunction(*MF);
+  }
+
+  SPIRVTypeRegistry &getTypeRegistry() const {
+    return *MF->getSubtarget<SPIRVSubtarget>().getSPIRVTypeRegistry();
+  }
+
+  // Drop the instructions built so far, and the types the registry knows of
+  void reset() {
+    MF->front().clear();
+    getTypeRegistry().startFunction(*MF);
+    getTypeRegistry().resetModuleTypes();
+    MIRBuilder.setMBB(MF->front());
+  }
+};
+} // namespace
+
+// Build n IR types, cycling through the arrays, vectors, pointers and structs
+// of the integer and float types.
+static std::vector<Type *> buildTypes(LLVMContext &Ctx, unsigned n) {
+  std::vector<Type *> types;
+  for (unsigned i = 0; i < n; ++i) {
+    Type *elem = i % 2 ? Type::getFloatTy(Ctx)
+                       : IntegerType::get(Ctx, 8 << (i / 2 % 4));
+    switch (i % 4) {
+    case 0:
+      types.push_back(ArrayType::get(elem, i + 1));
+      break;
+    case 1:
+      types.push_back(VectorType::get(elem, 2 << (i / 4 % 3)));
+      break;
+    case 2:
+      types.push_back(PointerType::get(ArrayType::get(elem, i + 1), 1));
+      break;
+    default:
+      types.push_back(
+          StructType::get(Ctx, {elem, ArrayType::get(elem, i + 1)}));
+      break;
+    }
+  }
+  return types;
+}
+
+// Create the SPIR-V types for N IR types in an empty function.
+static void BM_TypeRegistryCreate(benchmark::State &state) {
+  FunctionFixture fixture;
+  const auto types = buildTypes(fixture.Ctx, state.range(0));
+  SPIRVTypeRegistry &TR = fixture.getTypeRegistry();
+  for (auto _ : state) {
+    for (Type *type : types) {
+      benchmark::DoNotOptimize(
+          TR.getOrCreateSPIRVType(type, fixture.MIRBuilder));
+    }
+    state.PauseTiming();
+    fixture.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * types.size());
+}
+BENCHMARK(BM_TypeRegistryCreate)->Range(64, 4096);
+
+// Look up the SPIR-V types of N IR types which were already created.
+static void BM_TypeRegistryLookup(benchmark::State &state) {
+  FunctionFixture fixture;
+  const auto types = buildTypes(fixture.Ctx, state.range(0));
+  SPIRVTypeRegistry &TR = fixture.getTypeRegistry();
+  for (Type *type : types) {
+    TR.getOrCreateSPIRVType(type, fixture.MIRBuilder);
+  }
+  for (auto _ : state) {
+    for (Type *type : types) {
+      benchmark::DoNotOptimize(
+          TR.getOrCreateSPIRVType(type, fixture.MIRBuilder));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * types.size());
+}
+BENCHMARK(BM_TypeRegistryLookup)->Range(64, 4096);
+
+// Request N structurally identical SPIR-V array types again, which are found
+// through the registry's type keys rather than built twice, as the hoisting
+// pass does for the duplicate definitions of N globals.
+static void BM_TypeRegistryDedup(benchmark::State &state) {
+  FunctionFixture fixture;
+  SPIRVTypeRegistry &TR = fixture.getTypeRegistry();
+  SPIRVType *elem = TR.getOpTypeInt(32, fixture.MIRBuilder);
+  const unsigned n = state.range(0);
+  for (unsigned i = 1; i <= n; ++i) {
+    TR.getOpTypeArray(i, elem, fixture.MIRBuilder);
+  }
+  for (auto _ : state) {
+    for (unsigned i = 1; i <= n; ++i) {
+      benchmark::DoNotOptimize(TR.getOpTypeArray(i, elem, fixture.MIRBuilder));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_TypeRegistryDedup)->Range(64, 4096);
+
+// Add the capabilities of a typical OpenCL kernel, with the repetition of one
+// addition per instruction needing them, then prune the implicit ones.
+static void BM_RequirementHandler(benchmark::State &state) {
+  using namespace Capability;
+  const CapabilityList caps = {Addresses,
+                               Linkage,
+                               Kernel,
+                               Int8,
+                               Int16,
+                               Int64,
+                               Float16Buffer,
+                               Float64,
+                               Vector16,
+                               GenericPointer,
+                               Groups,
+                               ImageBasic,
+                               ImageReadWrite,
+                               Sampled1D,
+                               Image1D,
+                               SampledBuffer,
+                               ImageBuffer,
+                               Int64Atomics,
+                               Pipes,
+                               DeviceEnqueue,
+                               GroupNonUniform,
+                               GroupNonUniformBallot,
+                               GroupNonUniformArithmetic,
+                               SubgroupDispatch};
+  const unsigned repeats = state.range(0);
+  for (auto _ : state) {
+    SPIRVRequirementHandler reqs;
+    for (unsigned i = 0; i < repeats; ++i) {
+      for (Capability::Capability cap : caps) {
+        reqs.addCapability(cap);
+      }
+    }
+    benchmark::DoNotOptimize(reqs.getMinimalCapabilities());
+  }
+  state.SetItemsProcessed(state.iterations() * repeats * caps.size());
+}
+BENCHMARK(BM_RequirementHandler)->Range(1, 1024);
+
+// Build an OpName per string, and read each back word by word as the MCInst
+// lowering and encoding do.
+static void BM_StringOperands(benchmark::State &state) {
+  FunctionFixture fixture;
+  std::vector<std::string> names;
+  for (unsigned i = 0; i < 256; ++i) {
+    names.push_back("_ZN4sycl6detail12kernel_param" + std::to_string(i) +
+                    std::string(i % 32, 'x'));
+  }
+  Register target =
+      fixture.MF->getRegInfo().createVirtualRegister(&SPIRV::IDRegClass);
+  for (auto _ : state) {
+    for (const std::string &name : names) {
+      auto MIB = fixture.MIRBuilder.buildInstr(SPIRV::OpName).addUse(target);
+      addStringImm(name, MIB);
+      const MachineOperand &op = MIB->getOperand(1);
+      StringRef str = getStringImm(*MIB, 1);
+      const unsigned numWords = getOperandWordCount(op);
+      uint32_t sum = 0;
+      for (unsigned w = 0; w < numWords; ++w) {
+        sum += getStringWord(str, w);
+      }
+      benchmark::DoNotOptimize(sum);
+    }
+    state.PauseTiming();
+    fixture.MF->front().clear();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * names.size());
+}
+BENCHMARK(BM_StringOperands);
+
+// The mangled names of common builtins, from the ones with a native lowering
+// to the ones called as imported functions.
+static const char *const BuiltinNames[] = {
+    "_Z13get_global_idj",
+    "_Z12get_local_idj",
+    "_Z14get_local_sizej",
+    "_Z3sinf",
+    "_Z3cosDv4_f",
+    "_Z5clampfff",
+    "_Z3maxDv4_iS_",
+    "_Z3minjj",
+    "_Z3madDv8_fS_S_",
+    "_Z6vload4jPU3AS1Kf",
+    "_Z7barrierj",
+    "_Z10atomic_addPU3AS1Vii",
+    "_Z20sub_group_reduce_addi",
+    "_Z17sub_group_shufflefj",
+    "_Z21work_group_reduce_maxf",
+    "_Z11read_imagef14ocl_image2d_roDv2_i",
+    "_Z12write_imagef14ocl_image2d_woDv2_iDv4_f",
+    "_Z22get_sub_group_local_idv",
+    "_Z25sub_group_non_uniform_alli"};
+
+// Parse the mangled names of builtin calls, and find if they're lowered
+// natively, as call lowering does for each call.
+static void BM_BuiltinNameDispatch(benchmark::State &state) {
+  for (auto _ : state) {
+    for (const char *name : BuiltinNames) {
+      auto builtin = parseOpenCLBuiltinName(name);
+      benchmark::DoNotOptimize(builtin && isLoweredOpenCLBuiltin(*builtin));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * array_lengthof(BuiltinNames));
+}
+BENCHMARK(BM_BuiltinNameDispatch);
+
+// Encode a mix of typed, untyped and literal-heavy instructions.
+static void BM_EncodeInstruction(benchmark::State &state) {
+  const Target *T = nullptr;
+  std::unique_ptr<LLVMTargetMachine> TM(createTargetMachine(T));
+  MCContext Ctx(TM->getMCAsmInfo(), TM->getMCRegisterInfo(), nullptr);
+  std::unique_ptr<MCCodeEmitter> emitter(T->createMCCodeEmitter(
+      *TM->getMCInstrInfo(), *TM->getMCRegisterInfo(), Ctx));
+  auto id = [](unsigned index) {
+    return MCOperand::createReg(Register::index2VirtReg(index));
+  };
+
+  SmallVector<MCInst, 4> insts(4);
+  insts[0].setOpcode(SPIRV::OpIAdd);
+  for (unsigned i : {10, 1, 8, 9}) {
+    insts[0].addOperand(id(i));
+  }
+  insts[1].setOpcode(SPIRV::OpStore);
+  for (unsigned i : {11, 10}) {
+    insts[1].addOperand(id(i));
+  }
+  insts[2].setOpcode(SPIRV::OpDecorate);
+  insts[2].addOperand(id(11));
+  insts[2].addOperand(MCOperand::createImm(Decoration::Alignment));
+  insts[2].addOperand(MCOperand::createImm(4));
+  insts[3].setOpcode(SPIRV::OpVectorShuffle);
+  for (unsigned i : {12, 2, 10, 10}) {
+    insts[3].addOperand(id(i));
+  }
+  for (int64_t component : {3, 2, 1, 0}) {
+    insts[3].addOperand(MCOperand::createImm(component));
+  }
+
+  SmallString<256> buffer;
+  raw_svector_ostream OS(buffer);
+  SmallVector<MCFixup, 1> fixups;
+  const unsigned numRepeats = 64;
+  for (auto _ : state) {
+    buffer.clear();
+    for (unsigned i = 0; i < numRepeats; ++i) {
+      for (const MCInst &inst : insts) {
+        emitter->encodeInstruction(inst, OS, fixups,
+                                   *TM->getMCSubtargetInfo());
+      }
+    }
+    benchmark::DoNotOptimize(buffer.data());
+  }
+  state.SetItemsProcessed(state.iterations() * numRepeats * insts.size());
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(BM_EncodeInstruction);
+
+BENCHMARK_MAIN();
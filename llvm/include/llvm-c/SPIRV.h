@@ -0,0 +1,37 @@
+/*===-- llvm-c/SPIRV.h - SPIR-V Code Generation C Interface -------*- C -*-===*\
+|*                                                                            *|
+|* Part of the LLVM Project, under the Apache License v2.0 with LLVM          *|
+|* Exceptions.                                                                *|
+|* See https://llvm.org/LICENSE.txt for license information.                  *|
+|* SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception                    *|
+|*                                                                            *|
+|*===----------------------------------------------------------------------===*|
+|*                                                                            *|
+|* This header declares the C interface to compile modules straight to SPIR-V *|
+|* binaries in memory, for online compilers embedding the SPIR-V target.      *|
+|*                                                                            *|
+\*===----------------------------------------------------------------------===*/
+
+#ifndef LLVM_C_SPIRV_H
+#define LLVM_C_SPIRV_H
+
+#include "llvm-c/TargetMachine.h"
+#include "llvm-c/Types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Compile the LLVM IR stored in \p M with the SPIR-V target machine \p T, and
+  store the SPIR-V binary in \p OutMemBuf, as little-endian words. The codegen
+  pipeline is built by the first call for \p T and reused by later ones, so
+  calls for the same target machine must not run concurrently. Returns any
+  error in ErrorMessage. Use LLVMDisposeMessage to dispose the message. */
+LLVMBool LLVMSPIRVTargetMachineEmitToMemoryBuffer(LLVMTargetMachineRef T,
+  LLVMModuleRef M, char **ErrorMessage, LLVMMemoryBufferRef *OutMemBuf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
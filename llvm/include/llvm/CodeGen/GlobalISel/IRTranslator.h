@@ -213,8 +213,8 @@ protected:
   virtual bool translateStore(const User &U, MachineIRBuilder &MIRBuilder);
 
   /// Translate an LLVM string intrinsic (memcpy, memset, ...).
-  bool translateMemFunc(const CallInst &CI, MachineIRBuilder &MIRBuilder,
-                        Intrinsic::ID ID);
+  virtual bool translateMemFunc(const CallInst &CI,
+                                MachineIRBuilder &MIRBuilder, Intrinsic::ID ID);
 
   void getStackGuard(Register DstReg, MachineIRBuilder &MIRBuilder);
 
@@ -249,7 +249,7 @@ protected:
 
   /// Translate call instruction.
   /// \pre \p U is a call instruction.
-  bool translateCall(const User &U, MachineIRBuilder &MIRBuilder);
+  virtual bool translateCall(const User &U, MachineIRBuilder &MIRBuilder);
 
   bool translateInvoke(const User &U, MachineIRBuilder &MIRBuilder);
 
@@ -325,7 +325,7 @@ protected:
                            MachineBasicBlock *DefaultMBB,
                            MachineIRBuilder &MIB);
 
-  bool translateSwitch(const User &U, MachineIRBuilder &MIRBuilder);
+  virtual bool translateSwitch(const User &U, MachineIRBuilder &MIRBuilder);
   // End switch lowering section.
 
   bool translateIndirectBr(const User &U, MachineIRBuilder &MIRBuilder);
@@ -23,11 +23,27 @@ class MCSymbol;
 class MCSectionSPIRV final : public MCSection {
   friend class MCContext;
 
+  /// One more than the largest ID used by the instructions in this section.
+  unsigned IDBound = 1;
+
+  /// SPIR-V version number, formatted as |0|Major|Minor|0|, or 0 if unknown.
+  uint32_t Version = 0;
+
   MCSectionSPIRV(SectionKind K, MCSymbol *Begin)
       : MCSection(SV_SPIRV, K, Begin) {}
 
 public:
   ~MCSectionSPIRV() = default;
+
+  unsigned getIDBound() const { return IDBound; }
+  void setIDBound(unsigned Bound) { IDBound = Bound; }
+
+  uint32_t getVersion() const { return Version; }
+  void setVersion(uint32_t Ver) { Version = Ver; }
+
+  static bool classof(const MCSection *S) {
+    return S->getVariant() == SV_SPIRV;
+  }
   void PrintSwitchToSection(const MCAsmInfo &MAI, const Triple &T,
                             raw_ostream &OS,
                             const MCExpr *Subsection) const override {}
@@ -7,9 +7,13 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/MC/MCSPIRVObjectWriter.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/MC/MCAsmLayout.h"
 #include "llvm/MC/MCAssembler.h"
 #include "llvm/MC/MCSection.h"
+#include "llvm/MC/MCSectionSPIRV.h"
 #include "llvm/MC/MCValue.h"
+#include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
 
@@ -35,39 +39,67 @@ private:
                                 const MCAsmLayout &Layout) override {}
 
   uint64_t writeObject(MCAssembler &Asm, const MCAsmLayout &Layout) override;
-  void writeHeader(const MCAssembler &Asm);
+  void writeHeader(const MCAssembler &Asm, support::endian::Writer &HW);
 };
 
-void SPIRVObjectWriter::writeHeader(const MCAssembler &Asm) {
+/// The number of bytes the module header takes.
+static const uint64_t HeaderSize = 5 * sizeof(uint32_t);
+
+void SPIRVObjectWriter::writeHeader(const MCAssembler &Asm,
+                                    support::endian::Writer &HW) {
   uint32_t MagicNumber = 0x07230203;
 
-  uint32_t Major = 1;
-  uint32_t Minor = 4;
-  uint32_t VersionNumber = 0 | (Major << 16) | (Minor << 8);
+  // The ID bound and version number are recorded on the sections by the
+  // target's AsmPrinter once all instructions have been emitted.
+  uint32_t Bound = 1;
+  uint32_t VersionNumber = 0;
+  for (const MCSection &S : Asm) {
+    if (const auto *SPIRVSection = dyn_cast<MCSectionSPIRV>(&S)) {
+      Bound = std::max(Bound, SPIRVSection->getIDBound());
+      VersionNumber = std::max(VersionNumber, SPIRVSection->getVersion());
+    }
+  }
+
+  // Default to SPIR-V 1.4 if no version was given
+  if (VersionNumber == 0) {
+    uint32_t Major = 1;
+    uint32_t Minor = 4;
+    VersionNumber = 0 | (Major << 16) | (Minor << 8);
+  }
+  VersionNumber &= 0x00ffff00; // The revision byte must be 0
 
   uint32_t GeneratorMagicNumber = 0;
-  uint32_t Bound = 900;
   uint32_t Schema = 0;
 
-  W.write<uint32_t>(MagicNumber);
-  W.write<uint32_t>(VersionNumber);
-  W.write<uint32_t>(GeneratorMagicNumber);
-  W.write<uint32_t>(Bound);
-  W.write<uint32_t>(Schema);
+  HW.write<uint32_t>(MagicNumber);
+  HW.write<uint32_t>(VersionNumber);
+  HW.write<uint32_t>(GeneratorMagicNumber);
+  HW.write<uint32_t>(Bound);
+  HW.write<uint32_t>(Schema);
 }
 
+// The size of the module is known once laid out, so the header and every
+// section are written once into a buffer allocated up front, which is then
+// written to the output with a single call rather than a write per fragment.
 uint64_t SPIRVObjectWriter::writeObject(MCAssembler &Asm,
                                         const MCAsmLayout &Layout) {
+  uint64_t Size = HeaderSize;
+  for (const MCSection &S : Asm) {
+    Size += Layout.getSectionFileSize(&S);
+  }
 
-  uint64_t StartOffset = W.OS.tell();
-
-  writeHeader(Asm);
-
+  SmallVector<char, 0> Buffer;
+  Buffer.reserve(Size);
+  raw_svector_ostream BufferOS(Buffer);
+  support::endian::Writer HW(BufferOS, support::little);
+  writeHeader(Asm, HW);
   for (const MCSection &S : Asm) {
-    Asm.writeSectionData(W.OS, &S, Layout);
+    Asm.writeSectionData(BufferOS, &S, Layout);
   }
+  assert(Buffer.size() == Size && "Section sizes differ from the layout");
 
-  return W.OS.tell() - StartOffset;
+  W.OS.write(Buffer.data(), Buffer.size());
+  return Size;
 }
 
 std::unique_ptr<MCObjectWriter>
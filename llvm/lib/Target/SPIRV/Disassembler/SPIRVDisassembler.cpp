@@ -0,0 +1,294 @@
+//===-- SPIRVDisassembler.cpp - Disassembler for SPIR-V ---------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Decode SPIR-V binaries into the same MCInsts SPIRVMCInstLower builds, so
+// SPIRVInstPrinter prints them. Words are read straight from the bytes given,
+// typically a memory-mapped MemoryBuffer, without copying the instructions.
+//
+// Each word becomes one operand: IDs are registers and everything else is an
+// immediate, with strings left packed 4 chars per word as when lowering. The
+// fixed operands follow the MCInstrDesc, with the result type swapped back
+// after the result ID. Whether the variable operands are IDs or literals
+// depends on the instruction, so is decided per opcode.
+//
+// A module header is skipped with a comment giving its version and ID bound,
+// and sets the byte order of the following instructions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/SPIRVMCTargetDesc.h"
+#include "SPIRVExtInsts.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/CodeGen/Register.h"
+#include "llvm/CodeGen/TargetOpcodes.h"
+#include "llvm/MC/MCDisassembler/MCDisassembler.h"
+#include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/SwapByteOrder.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-disassembler"
+
+typedef MCDisassembler::DecodeStatus DecodeStatus;
+
+static const uint32_t MagicNumber = 0x07230203;
+static const unsigned HeaderWords = 5;
+
+namespace {
+class SPIRVDisassembler : public MCDisassembler {
+  std::unique_ptr<const MCInstrInfo> MCII;
+
+  // The MC opcode of each SPIR-V opcode
+  DenseMap<uint16_t, unsigned> Opcodes;
+
+  // The byte order given by the last module header, little endian by default
+  mutable support::endianness Endian = support::little;
+
+  // The ext-inst sets imported so far, which decide how OpExtInsts end
+  mutable SPIRVExtInstSetTracker ExtInstSets;
+
+  uint32_t readWord(ArrayRef<uint8_t> Bytes, unsigned i) const {
+    return support::endian::read32(Bytes.data() + i * sizeof(uint32_t),
+                                   Endian);
+  }
+  bool isVariableOpID(const MCInst &MI, unsigned varIdx, unsigned numVarOps,
+                      unsigned firstVarOpIdx) const;
+
+public:
+  SPIRVDisassembler(const MCSubtargetInfo &STI, MCContext &Ctx,
+                    const MCInstrInfo *MCII);
+
+  DecodeStatus getInstruction(MCInst &MI, uint64_t &Size,
+                              ArrayRef<uint8_t> Bytes, uint64_t Address,
+                              raw_ostream &VStream,
+                              raw_ostream &CStream) const override;
+};
+} // namespace
+
+SPIRVDisassembler::SPIRVDisassembler(const MCSubtargetInfo &STI,
+                                     MCContext &Ctx, const MCInstrInfo *MCII)
+    : MCDisassembler(STI, Ctx), MCII(MCII) {
+  // Generic opcodes have no encoding, so only the target ones are mapped
+  const unsigned numOpcodes = MCII->getNumOpcodes();
+  for (unsigned opcode = TargetOpcode::GENERIC_OP_END + 1; opcode < numOpcodes;
+       ++opcode) {
+    uint16_t encoding = getSPIRVOpcodeEncoding(MCII->get(opcode).TSFlags);
+    Opcodes.try_emplace(encoding, opcode);
+  }
+}
+
+// Whether the image instruction takes an ImageOperands mask, followed by the
+// IDs it requires, as its first variable operand.
+static bool hasImageOperands(unsigned opcode) {
+  switch (opcode) {
+  case SPIRV::OpImageSampleImplicitLod:
+  case SPIRV::OpImageSampleDrefImplicitLod:
+  case SPIRV::OpImageSampleProjImplicitLod:
+  case SPIRV::OpImageSampleProjDrefImplicitLod:
+  case SPIRV::OpImageFetch:
+  case SPIRV::OpImageGather:
+  case SPIRV::OpImageDrefGather:
+  case SPIRV::OpImageRead:
+  case SPIRV::OpImageWrite:
+  case SPIRV::OpImageSparseSampleImplicitLod:
+  case SPIRV::OpImageSparseSampleDrefImplicitLod:
+  case SPIRV::OpImageSparseSampleProjImplicitLod:
+  case SPIRV::OpImageSparseSampleProjDrefImplicitLod:
+  case SPIRV::OpImageSparseFetch:
+  case SPIRV::OpImageSparseGather:
+  case SPIRV::OpImageSparseDrefGather:
+  case SPIRV::OpImageSparseRead:
+  case SPIRV::OpImageSampleFootprintNV:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Whether a word holds the null terminator of a string.
+static bool endsString(uint32_t word) {
+  return !(word & 0xff000000) || !(word & 0x00ff0000) ||
+         !(word & 0x0000ff00) || !(word & 0x000000ff);
+}
+
+// Whether variable operand varIdx of the numVarOps ones, the first of which is
+// at MC operand firstVarOpIdx, is an ID rather than a literal. The operands
+// before it are already in MI.
+bool SPIRVDisassembler::isVariableOpID(const MCInst &MI, unsigned varIdx,
+                                       unsigned numVarOps,
+                                       unsigned firstVarOpIdx) const {
+  const unsigned opcode = MI.getOpcode();
+  switch (opcode) {
+  case SPIRV::OpConstant:
+  case SPIRV::OpSpecConstant:
+  case SPIRV::OpVectorShuffle:
+  case SPIRV::OpCompositeExtract:
+  case SPIRV::OpCompositeInsert:
+  case SPIRV::OpBranchConditional:
+  case SPIRV::OpLoad:
+  case SPIRV::OpStore:
+  case SPIRV::OpCopyMemory:
+  case SPIRV::OpCopyMemorySized:
+    return false;
+  case SPIRV::OpVariable:
+  case SPIRV::OpDecorateId:
+  case SPIRV::OpExecutionModeId:
+    return true;
+  case SPIRV::OpSwitch:
+    // Pairs of a 32 bit literal and its target label
+    return varIdx % 2 == 1;
+  case SPIRV::OpSource:
+    // An optional file OpString, then the source string
+    return varIdx == 0;
+  case SPIRV::OpEntryPoint: {
+    // The interface IDs follow the name, the last fixed operand
+    for (unsigned i = firstVarOpIdx - 1; i < firstVarOpIdx + varIdx; ++i) {
+      if (endsString(MI.getOperand(i).getImm())) {
+        return true;
+      }
+    }
+    return false;
+  }
+  case SPIRV::OpExtInst: {
+    // The half stores with rounding take it as a literal last operand
+    if (varIdx + 1 == numVarOps &&
+        ExtInstSets.getSet(MI.getOperand(2).getReg()) ==
+            ExtInstSet::OpenCL_std) {
+      switch (MI.getOperand(3).getImm()) {
+      case OpenCL_std::vstore_half_r:
+      case OpenCL_std::vstore_halfn_r:
+      case OpenCL_std::vstorea_halfn_r:
+        return false;
+      default:
+        break;
+      }
+    }
+    return true;
+  }
+  default:
+    break;
+  }
+  if (hasImageOperands(opcode)) {
+    return varIdx != 0;
+  }
+  // Otherwise, the variable operands continue the last fixed one, such as the
+  // member types of OpTypeStruct or the words of a string
+  const MCInstrDesc &MCDesc = MCII->get(opcode);
+  const unsigned numFixedOps = MCDesc.getNumOperands();
+  return numFixedOps == 0 ||
+         MCDesc.OpInfo[numFixedOps - 1].OperandType == MCOI::OPERAND_REGISTER;
+}
+
+DecodeStatus SPIRVDisassembler::getInstruction(MCInst &MI, uint64_t &Size,
+                                               ArrayRef<uint8_t> Bytes,
+                                               uint64_t Address,
+                                               raw_ostream &VStream,
+                                               raw_ostream &CStream) const {
+  Size = 0;
+  if (Bytes.size() < sizeof(uint32_t)) {
+    return Fail;
+  }
+  const unsigned numAvailableWords = Bytes.size() / sizeof(uint32_t);
+
+  // Skip a module header, which gives the byte order of the module
+  uint32_t firstWord = support::endian::read32le(Bytes.data());
+  if ((firstWord == MagicNumber ||
+       firstWord == sys::getSwappedBytes(MagicNumber)) &&
+      numAvailableWords >= HeaderWords) {
+    Endian = firstWord == MagicNumber ? support::little : support::big;
+    const uint32_t version = readWord(Bytes, 1);
+    CStream << "SPIR-V " << ((version >> 16) & 0xff) << '.'
+            << ((version >> 8) & 0xff) << " module, ID bound "
+            << readWord(Bytes, 3);
+    Size = HeaderWords * sizeof(uint32_t);
+    return Fail;
+  }
+
+  // The first word holds the word count and the opcode
+  firstWord = readWord(Bytes, 0);
+  const unsigned numWords = firstWord >> 16;
+  if (numWords == 0 || numWords > numAvailableWords) {
+    Size = sizeof(uint32_t);
+    return Fail;
+  }
+  Size = numWords * sizeof(uint32_t);
+  auto found = Opcodes.find(firstWord & 0xffff);
+  if (found == Opcodes.end()) {
+    return Fail;
+  }
+  const unsigned opcode = found->second;
+  const MCInstrDesc &MCDesc = MCII->get(opcode);
+  const unsigned numFixedOps = MCDesc.getNumOperands();
+  const unsigned numOps = numWords - 1;
+  if (numOps < numFixedOps || (numOps > numFixedOps && !MCDesc.isVariadic())) {
+    return Fail;
+  }
+  MI.setOpcode(opcode);
+
+  // IDs are encoded as the register index + 1, so 0 is invalid
+  auto addOperand = [&](uint32_t word, bool isID) {
+    if (!isID) {
+      MI.addOperand(MCOperand::createImm(word));
+      return true;
+    }
+    if (word == 0) {
+      return false;
+    }
+    MI.addOperand(MCOperand::createReg(Register::index2VirtReg(word - 1)));
+    return true;
+  };
+  auto isFixedOpID = [&](unsigned i) {
+    return MCDesc.OpInfo[i].OperandType == MCOI::OPERAND_REGISTER;
+  };
+
+  // The result type comes before the result ID in the binary
+  unsigned firstOp = 0;
+  if (hasSPIRVResultType(MCDesc)) {
+    if (!addOperand(readWord(Bytes, 2), true) ||
+        !addOperand(readWord(Bytes, 1), true)) {
+      return Fail;
+    }
+    firstOp = 2;
+  }
+  for (unsigned i = firstOp; i < numFixedOps; ++i) {
+    if (!addOperand(readWord(Bytes, i + 1), isFixedOpID(i))) {
+      return Fail;
+    }
+  }
+  const unsigned numVarOps = numOps - numFixedOps;
+  for (unsigned i = 0; i < numVarOps; ++i) {
+    bool isID = isVariableOpID(MI, i, numVarOps, numFixedOps);
+    if (!addOperand(readWord(Bytes, numFixedOps + i + 1), isID)) {
+      return Fail;
+    }
+  }
+
+  if (opcode == SPIRV::OpExtInstImport) {
+    ExtInstSets.recordOpExtInstImport(MI);
+  }
+  return Success;
+}
+
+static MCDisassembler *createSPIRVDisassembler(const Target &T,
+                                               const MCSubtargetInfo &STI,
+                                               MCContext &Ctx) {
+  return new SPIRVDisassembler(STI, Ctx, T.createMCInstrInfo());
+}
+
+extern "C" void LLVMInitializeSPIRVDisassembler() {
+  for (Target *T : {&getTheSPIRV32Target(), &getTheSPIRV64Target(),
+                    &getTheSPIRVLogicalTarget()}) {
+    TargetRegistry::RegisterMCDisassembler(*T, createSPIRVDisassembler);
+  }
+}
@@ -61,13 +61,6 @@ void SPIRVInstPrinter::printOpConstantVarOps(const MCInst *MI,
   }
 }
 
-void SPIRVInstPrinter::recordOpExtInstImport(const MCInst *MI) {
-  Register reg = MI->getOperand(0).getReg();
-  auto name = getSPIRVStringOperand(*MI, 1);
-  auto set = getExtInstSetFromString(name);
-  extInstSetIDs.insert({reg, set});
-}
-
 void SPIRVInstPrinter::printInst(const MCInst *MI, raw_ostream &O,
                                  StringRef Annot, const MCSubtargetInfo &STI) {
 
@@ -77,7 +70,7 @@ void SPIRVInstPrinter::printInst(const MCInst *MI, raw_ostream &O,
   if (OpCode == SPIRV::OpDecorate) {
     printOpDecorate(MI, O);
   } else if (OpCode == SPIRV::OpExtInstImport) {
-    recordOpExtInstImport(MI);
+    extInstSets.recordOpExtInstImport(*MI);
   } else if (OpCode == SPIRV::OpExtInst) {
     printOpExtInst(MI, O);
   } else {
@@ -109,7 +102,8 @@ void SPIRVInstPrinter::printInst(const MCInst *MI, raw_ostream &O,
         }
         case SPIRV::OpExecutionMode:
         case SPIRV::OpExecutionModeId:
-        case SPIRV::OpLoopMerge: {
+        case SPIRV::OpLoopMerge:
+        case SPIRV::OpLoopControlINTEL: {
           // Print any literals after the OPERAND_UNKNOWN argument normally
           printRemainingVariableOps(MI, numFixedOps, O);
           break;
@@ -167,6 +161,17 @@ void SPIRVInstPrinter::printInst(const MCInst *MI, raw_ostream &O,
         case SPIRV::OpConstant:
           printOpConstantVarOps(MI, numFixedOps, O);
           break;
+        case SPIRV::OpSDot:
+        case SPIRV::OpUDot:
+        case SPIRV::OpSUDot:
+        case SPIRV::OpSDotAccSat:
+        case SPIRV::OpUDotAccSat:
+        case SPIRV::OpSUDotAccSat:
+          if (MI->getNumOperands() > numFixedOps) {
+            O << ' ';
+            printPackedVectorFormat(MI, firstVariableIndex, O);
+          }
+          break;
         default:
           printRemainingVariableOps(MI, numFixedOps, O);
           break;
@@ -190,7 +195,7 @@ void SPIRVInstPrinter::printOpExtInst(const MCInst *MI, raw_ostream &O) {
   O << ' ';
 
   auto setReg = MI->getOperand(2).getReg();
-  auto set = extInstSetIDs[setReg];
+  auto set = extInstSets.getSet(setReg);
   if (set == ExtInstSet::OpenCL_std) {
     auto inst = static_cast<OpenCL_std::OpenCL_std>(MI->getOperand(3).getImm());
     switch (inst) {
@@ -292,20 +297,16 @@ void SPIRVInstPrinter::printStringImm(const MCInst *MI, unsigned OpNo,
     if (MI->getOperand(strStartIndex).isReg())
       break;
 
-    std::string str = getSPIRVStringOperand(*MI, OpNo);
     if (strStartIndex != OpNo)
       O << ' '; // Add a space if we're starting a new string/argument
     O << '"';
-    for (char c : str) {
+    strStartIndex += forEachSPIRVStringChar(*MI, strStartIndex, [&O](char c) {
       if (c == '"')
-        O.write('\\'); // Escape " characters (might break for complex UTF-8)
-      O.write(c);
-    }
+        O << '\\'; // Escape " characters (might break for complex UTF-8)
+      O << c;
+    });
     O << '"';
 
-    unsigned numOpsInString = (str.size() / 4) + 1;
-    strStartIndex += numOpsInString;
-
     // Check for final Op of "OpDecorate %x %stringImm %linkageAttribute"
     if (MI->getOpcode() == SPIRV::OpDecorate &&
         MI->getOperand(1).getImm() == Decoration::LinkageAttributes) {
@@ -319,9 +320,13 @@ void SPIRVInstPrinter::printStringImm(const MCInst *MI, unsigned OpNo,
 void SPIRVInstPrinter::printExtInst(const MCInst *MI, unsigned OpNo,
                                     raw_ostream &O) {
   auto setReg = MI->getOperand(2).getReg();
-  auto set = extInstSetIDs[setReg];
+  auto set = extInstSets.getSet(setReg);
   auto op = MI->getOperand(OpNo).getImm();
-  O << getExtInstName(set, op);
+  if (set) {
+    O << getExtInstName(*set, op);
+  } else {
+    O << op; // The import named a set we don't know
+  }
 }
 
 // Methods for printing textual names of SPIR-V enums (see SPIRVEnums.h)
@@ -355,4 +360,5 @@ GEN_INSTR_PRINTER_IMPL(Scope)
 GEN_INSTR_PRINTER_IMPL(GroupOperation)
 GEN_INSTR_PRINTER_IMPL(KernelEnqueueFlags)
 GEN_INSTR_PRINTER_IMPL(KernelProfilingInfo)
+GEN_INSTR_PRINTER_IMPL(PackedVectorFormat)
 
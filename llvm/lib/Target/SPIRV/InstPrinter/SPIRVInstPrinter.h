@@ -20,8 +20,7 @@
 namespace llvm {
 class SPIRVInstPrinter : public MCInstPrinter {
 private:
-  SmallDenseMap<unsigned, ExtInstSet> extInstSetIDs;
-  void recordOpExtInstImport(const MCInst *MI);
+  SPIRVExtInstSetTracker extInstSets;
 
 public:
   using MCInstPrinter::MCInstPrinter;
@@ -88,6 +87,8 @@ public:
   void printKernelEnqueueFlags(const MCInst *MI, unsigned OpNo, raw_ostream &O);
   void printKernelProfilingInfo(const MCInst *MI, unsigned OpNo,
                                 raw_ostream &O);
+  void printPackedVectorFormat(const MCInst *MI, unsigned OpNo,
+                               raw_ostream &O);
 
   // Autogenerated by tblgen.
   void printInstruction(const MCInst *MI, raw_ostream &O);
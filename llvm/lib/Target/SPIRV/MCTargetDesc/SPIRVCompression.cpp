@@ -0,0 +1,254 @@
+//===-- SPIRVCompression.cpp - Compact SPIR-V container ---------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The container is the bytes "SPVZ", then varints of the number of words and
+// of the 5 header words, then the instructions. Each instruction starts with
+// a varint head:
+// - 0 ends the instructions: a varint count of raw words follows, for a binary
+//   ending in a truncated instruction.
+// - Otherwise head - 1 is (opcode << 5) | (min(word count, 15) << 1) | raw,
+//   followed by a varint of the word count minus 15 if it's 15 or more.
+// The operands then follow, as raw little-endian words if raw is set, or else
+// as varints of the zigzagged difference from the operand at the same index
+// of the last instruction with the same opcode, or from 0.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/SPIRVCompression.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Endian.h"
+
+using namespace llvm;
+
+namespace {
+const char ContainerMagic[] = {'S', 'P', 'V', 'Z'};
+const unsigned HeaderWords = 5;
+const unsigned LongWordCount = 15;
+
+// The operands of the last instruction with each opcode
+using LastOperandsMap = DenseMap<uint32_t, SmallVector<uint32_t, 8>>;
+} // namespace
+
+static uint32_t getReference(const SmallVectorImpl<uint32_t> &last,
+                             unsigned i) {
+  return i < last.size() ? last[i] : 0;
+}
+
+static uint32_t zigzag(uint32_t diff) {
+  return (diff << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(diff) >> 31);
+}
+
+static uint32_t unzigzag(uint32_t value) {
+  return (value >> 1) ^ (0 - (value & 1));
+}
+
+static unsigned getVarintSize(uint32_t value) {
+  unsigned size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+static void writeVarint(uint32_t value, SmallVectorImpl<char> &out) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+static void writeRaw(uint32_t word, SmallVectorImpl<char> &out) {
+  char bytes[4];
+  support::endian::write32le(bytes, word);
+  out.append(bytes, bytes + 4);
+}
+
+namespace {
+class Reader {
+  StringRef Data;
+  size_t Pos = 0;
+
+public:
+  Reader(StringRef Data, size_t Pos) : Data(Data), Pos(Pos) {}
+
+  bool atEnd() const { return Pos == Data.size(); }
+
+  Error readVarint(uint32_t &value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+      if (Pos == Data.size()) {
+        return createStringError(inconvertibleErrorCode(),
+                                 "truncated compressed SPIR-V binary");
+      }
+      const uint8_t byte = Data[Pos++];
+      if (shift == 28 && byte > 0xf) {
+        break;
+      }
+      value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return Error::success();
+      }
+    }
+    return createStringError(inconvertibleErrorCode(),
+                             "invalid varint in compressed SPIR-V binary");
+  }
+
+  Error readRaw(uint32_t &word) {
+    if (Data.size() - Pos < 4) {
+      return createStringError(inconvertibleErrorCode(),
+                               "truncated compressed SPIR-V binary");
+    }
+    word = support::endian::read32le(Data.data() + Pos);
+    Pos += 4;
+    return Error::success();
+  }
+};
+} // namespace
+
+bool llvm::isCompressedSPIRV(StringRef Data) {
+  return Data.startswith(StringRef(ContainerMagic, sizeof(ContainerMagic)));
+}
+
+void llvm::compressSPIRV(ArrayRef<uint32_t> Words,
+                         SmallVectorImpl<char> &Out) {
+  Out.append(std::begin(ContainerMagic), std::end(ContainerMagic));
+  writeVarint(Words.size(), Out);
+  const size_t numHeaderWords = std::min<size_t>(HeaderWords, Words.size());
+  for (size_t i = 0; i < numHeaderWords; ++i) {
+    writeVarint(Words[i], Out);
+  }
+
+  LastOperandsMap lastOperands;
+  size_t i = numHeaderWords;
+  while (i < Words.size()) {
+    const uint32_t opcode = Words[i] & 0xffff;
+    const uint32_t wordCount = Words[i] >> 16;
+    if (wordCount == 0 || wordCount > Words.size() - i) {
+      break;
+    }
+    ArrayRef<uint32_t> operands = Words.slice(i + 1, wordCount - 1);
+    auto &last = lastOperands[opcode];
+
+    unsigned deltaSize = 0;
+    for (unsigned j = 0; j < operands.size(); ++j) {
+      deltaSize += getVarintSize(zigzag(operands[j] - getReference(last, j)));
+    }
+    const bool raw = deltaSize > 4 * operands.size();
+    const uint32_t lenField = std::min<uint32_t>(wordCount, LongWordCount);
+    writeVarint(((opcode << 5) | (lenField << 1) | raw) + 1, Out);
+    if (lenField == LongWordCount) {
+      writeVarint(wordCount - LongWordCount, Out);
+    }
+    for (unsigned j = 0; j < operands.size(); ++j) {
+      if (raw) {
+        writeRaw(operands[j], Out);
+      } else {
+        writeVarint(zigzag(operands[j] - getReference(last, j)), Out);
+      }
+    }
+    last.assign(operands.begin(), operands.end());
+    i += wordCount;
+  }
+
+  // End the instructions, with whatever follows the last complete one
+  writeVarint(0, Out);
+  writeVarint(Words.size() - i, Out);
+  for (; i < Words.size(); ++i) {
+    writeRaw(Words[i], Out);
+  }
+}
+
+Error llvm::decompressSPIRV(StringRef Data, SmallVectorImpl<uint32_t> &Words) {
+  if (!isCompressedSPIRV(Data)) {
+    return createStringError(inconvertibleErrorCode(),
+                             "not a compressed SPIR-V binary");
+  }
+  Reader reader(Data, sizeof(ContainerMagic));
+  uint32_t numWords;
+  if (Error E = reader.readVarint(numWords)) {
+    return E;
+  }
+  // Each word takes at least a byte
+  if (numWords > Data.size()) {
+    return createStringError(inconvertibleErrorCode(),
+                             "wrong word count in compressed SPIR-V binary");
+  }
+  const size_t start = Words.size();
+  Words.reserve(start + numWords);
+  const uint32_t numHeaderWords = std::min<uint32_t>(HeaderWords, numWords);
+  for (uint32_t i = 0; i < numHeaderWords; ++i) {
+    uint32_t word;
+    if (Error E = reader.readVarint(word)) {
+      return E;
+    }
+    Words.push_back(word);
+  }
+
+  LastOperandsMap lastOperands;
+  while (true) {
+    uint32_t head;
+    if (Error E = reader.readVarint(head)) {
+      return E;
+    }
+    if (head == 0) {
+      break;
+    }
+    --head;
+    const uint32_t opcode = head >> 5;
+    const bool raw = head & 1;
+    uint32_t wordCount = (head >> 1) & 0xf;
+    if (wordCount == LongWordCount) {
+      uint32_t extra;
+      if (Error E = reader.readVarint(extra)) {
+        return E;
+      }
+      wordCount += extra;
+    }
+    if (opcode > 0xffff || wordCount == 0 || wordCount > 0xffff ||
+        wordCount > numWords - (Words.size() - start)) {
+      return createStringError(inconvertibleErrorCode(),
+                               "invalid instruction in compressed SPIR-V "
+                               "binary");
+    }
+    Words.push_back((wordCount << 16) | opcode);
+    auto &last = lastOperands[opcode];
+    const size_t operandsStart = Words.size();
+    for (unsigned j = 0; j + 1 < wordCount; ++j) {
+      uint32_t value;
+      if (Error E = raw ? reader.readRaw(value) : reader.readVarint(value)) {
+        return E;
+      }
+      Words.push_back(raw ? value : unzigzag(value) + getReference(last, j));
+    }
+    last.assign(Words.begin() + operandsStart, Words.end());
+  }
+
+  uint32_t numTailWords;
+  if (Error E = reader.readVarint(numTailWords)) {
+    return E;
+  }
+  if (numTailWords != numWords - (Words.size() - start)) {
+    return createStringError(inconvertibleErrorCode(),
+                             "wrong word count in compressed SPIR-V binary");
+  }
+  for (uint32_t i = 0; i < numTailWords; ++i) {
+    uint32_t word;
+    if (Error E = reader.readRaw(word)) {
+      return E;
+    }
+    Words.push_back(word);
+  }
+  if (!reader.atEnd()) {
+    return createStringError(inconvertibleErrorCode(),
+                             "trailing data after compressed SPIR-V binary");
+  }
+  return Error::success();
+}
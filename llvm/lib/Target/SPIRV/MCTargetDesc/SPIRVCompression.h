@@ -0,0 +1,43 @@
+//===-- SPIRVCompression.h - Compact SPIR-V container -----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// A lossless compact encoding of SPIR-V binaries, for caches and transport.
+// Most words of a binary are small IDs and literals close to the same operand
+// of the last instruction with the same opcode, so each instruction is stored
+// as a varint of its opcode and word count, then its operands as varints of
+// their zigzagged difference from those, or as raw words when that's shorter,
+// as for strings.
+//
+// Like SMOL-V, the encoding needs no table of the instructions, so binaries
+// using instructions the backend doesn't know still round-trip exactly, and
+// decoding is a single linear pass.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LIB_TARGET_SPIRV_MCTARGETDESC_SPIRVCOMPRESSION_H
+#define LLVM_LIB_TARGET_SPIRV_MCTARGETDESC_SPIRVCOMPRESSION_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+namespace llvm {
+// Whether the data starts like a compressed SPIR-V binary
+bool isCompressedSPIRV(StringRef Data);
+
+// Compress the words of a SPIR-V binary, appending the bytes to Out. Any
+// sequence of words can be compressed, valid SPIR-V or not.
+void compressSPIRV(ArrayRef<uint32_t> Words, SmallVectorImpl<char> &Out);
+
+// Decompress a binary compressed by compressSPIRV, appending its words to
+// Words, or fail if the data is truncated or corrupt.
+Error decompressSPIRV(StringRef Data, SmallVectorImpl<uint32_t> &Words);
+} // namespace llvm
+
+#endif
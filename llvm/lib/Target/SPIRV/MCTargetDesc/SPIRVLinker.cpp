@@ -0,0 +1,766 @@
+//===-- SPIRVLinker.cpp - Link SPIR-V Binaries ------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The instructions of each input are decoded with the MCInstrDesc of the
+// instruction the backend emits for their opcode: fixed register operands are
+// IDs, and other fixed operands literals. The variable operands and string
+// literals the MCInstrDesc can't describe are handled per opcode, as in
+// SPIRVInstPrinter.
+//
+// The modules are then linked in order. Every symbol exported is given an ID
+// up front, which the declarations importing it are mapped to before being
+// dropped, along with their names and decorations. The types, constants and
+// OpExtInstImports of each module are linked before its other instructions, so
+// they can be mapped to an identical definition from an earlier module rather
+// than defined again. Instructions from all modules are then emitted in the
+// order of SPIR-V's logical layout, dropping duplicate capabilities,
+// extensions and debug instructions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/SPIRVLinker.h"
+#include "MCTargetDesc/SPIRVMCTargetDesc.h"
+#include "SPIRVEnums.h"
+#include "SPIRVExtInsts.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/Support/Endian.h"
+
+#include <array>
+#include <map>
+#include <set>
+
+using namespace llvm;
+
+namespace {
+const uint32_t MagicNumber = 0x07230203;
+const unsigned HeaderWords = 5;
+
+// The sections of the logical layout, in the order they must be emitted
+enum Section {
+  CapabilitySection,
+  ExtensionSection,
+  ExtInstImportSection,
+  MemoryModelSection,
+  EntryPointSection,
+  ExecutionModeSection,
+  DebugSourceSection,
+  DebugNameSection,
+  ModuleProcessedSection,
+  AnnotationSection,
+  GlobalSection,
+  FunctionDeclSection,
+  FunctionDefSection,
+  NumSections
+};
+
+struct Instr {
+  unsigned Opcode;                // The MC opcode the backend emits it with
+  SmallVector<uint32_t, 8> Ops;   // The operand words, in encoding order
+  SmallVector<unsigned, 8> IDOps; // The indices in Ops of the IDs
+  int ResultOp = -1;              // The index in Ops of the ID defined, if any
+};
+
+struct InputModule {
+  StringRef Name;
+  uint32_t Version;
+  uint32_t Bound;
+  std::vector<Instr> Instrs;
+
+  // What decoding OpSwitch and OpExtInst needs to know about earlier IDs
+  DenseMap<uint32_t, uint32_t> ResultTypes;
+  DenseMap<uint32_t, uint32_t> IntWidths;
+  DenseSet<uint32_t> OpenCLExtInstSets;
+
+  // The linked ID of each of the module's IDs, or 0 if not mapped yet
+  std::vector<uint32_t> IDMap;
+  // The IDs with decorations, which can't be merged with identical ones
+  DenseSet<uint32_t> Decorated;
+  // The names of the symbols the module imports or exports
+  DenseMap<uint32_t, std::string> LinkageNames;
+  // The imports resolved to another module's export, and their parameters
+  DenseSet<uint32_t> Dropped;
+};
+
+using DefinitionKey = SmallVector<uint32_t, 8>;
+
+class SPIRVModuleLinker {
+public:
+  SPIRVModuleLinker(const MCInstrInfo &MCII,
+                    function_ref<bool(StringRef)> IsInternal);
+
+  Error addModule(MemoryBufferRef buffer);
+  Error link(SmallVectorImpl<uint32_t> &linked);
+
+private:
+  const MCInstrInfo &MCII;
+  function_ref<bool(StringRef)> IsInternal;
+  DenseMap<uint32_t, unsigned> EncodingToOpcode;
+  std::vector<InputModule> Modules;
+
+  uint32_t NextID = 1;
+  std::array<SmallVector<uint32_t, 0>, NumSections> SectionWords;
+  std::map<DefinitionKey, uint32_t> Definitions;
+  std::set<DefinitionKey> PreambleInstrs;
+  DenseSet<uint32_t> NamedIDs;
+  DenseSet<std::pair<uint32_t, uint32_t>> NamedMembers;
+  SmallVector<uint32_t, 2> MemoryModel;
+
+  // The linked type of each symbol exported, and of each import resolved
+  StringMap<uint32_t> ExportTypes;
+  std::vector<std::pair<std::string, uint32_t>> ImportTypes;
+
+  Error decodeOperands(const InputModule &M, Instr &I) const;
+  void recordIDInfo(InputModule &M, const Instr &I) const;
+
+  Error resolveLinkage();
+  uint32_t getLinkedID(InputModule &M, uint32_t id);
+  void recordLinkedType(InputModule &M, uint32_t id, uint32_t type);
+  void remapOperands(InputModule &M, const Instr &I,
+                     SmallVectorImpl<uint32_t> &ops);
+  void emit(SmallVectorImpl<uint32_t> &words, unsigned opcode,
+            ArrayRef<uint32_t> ops) const;
+  void linkDefinition(InputModule &M, const Instr &I, Section section);
+  Error linkPreambleInstr(InputModule &M, const Instr &I, Section section);
+  Error linkModule(InputModule &M);
+};
+} // namespace
+
+static Error makeError(StringRef moduleName, const Twine &msg) {
+  return make_error<StringError>(moduleName + ": " + msg,
+                                 inconvertibleErrorCode());
+}
+
+// Read the string literal at the start of words.
+static std::string readString(ArrayRef<uint32_t> words) {
+  std::string s;
+  for (uint32_t word : words) {
+    for (unsigned shiftAmount = 0; shiftAmount < 32; shiftAmount += 8) {
+      char c = (word >> shiftAmount) & 0xff;
+      if (c == 0) {
+        return s;
+      }
+      s += c;
+    }
+  }
+  return s;
+}
+
+// Get the number of words taken by the string literal at the start of words.
+// Its last word, with the null terminator, is the only one whose last byte is
+// null.
+static unsigned getStringWords(ArrayRef<uint32_t> words) {
+  for (unsigned i = 0; i < words.size(); ++i) {
+    if ((words[i] >> 24) == 0) {
+      return i + 1;
+    }
+  }
+  return words.size();
+}
+
+// Get the index of the StringImm among an instruction's fixed operands.
+static int getStringOperand(unsigned opcode) {
+  switch (opcode) {
+  case SPIRV::OpSourceContinued:
+  case SPIRV::OpSourceExtension:
+  case SPIRV::OpModuleProcessed:
+  case SPIRV::OpExtension:
+    return 0;
+  case SPIRV::OpName:
+  case SPIRV::OpString:
+  case SPIRV::OpExtInstImport:
+  case SPIRV::OpTypeOpaque:
+    return 1;
+  case SPIRV::OpMemberName:
+  case SPIRV::OpDecorateString:
+  case SPIRV::OpEntryPoint:
+    return 2;
+  case SPIRV::OpMemberDecorateString:
+    return 3;
+  default:
+    return -1;
+  }
+}
+
+// Get the section of the logical layout an instruction outside any function
+// belongs to.
+static Section getSection(unsigned opcode) {
+  switch (opcode) {
+  case SPIRV::OpCapability:
+    return CapabilitySection;
+  case SPIRV::OpExtension:
+    return ExtensionSection;
+  case SPIRV::OpExtInstImport:
+    return ExtInstImportSection;
+  case SPIRV::OpMemoryModel:
+    return MemoryModelSection;
+  case SPIRV::OpEntryPoint:
+    return EntryPointSection;
+  case SPIRV::OpExecutionMode:
+  case SPIRV::OpExecutionModeId:
+    return ExecutionModeSection;
+  case SPIRV::OpString:
+  case SPIRV::OpSource:
+  case SPIRV::OpSourceContinued:
+  case SPIRV::OpSourceExtension:
+    return DebugSourceSection;
+  case SPIRV::OpName:
+  case SPIRV::OpMemberName:
+    return DebugNameSection;
+  case SPIRV::OpModuleProcessed:
+    return ModuleProcessedSection;
+  case SPIRV::OpDecorate:
+  case SPIRV::OpDecorateId:
+  case SPIRV::OpDecorateString:
+  case SPIRV::OpMemberDecorate:
+  case SPIRV::OpMemberDecorateString:
+  case SPIRV::OpDecorationGroup:
+  case SPIRV::OpGroupDecorate:
+    return AnnotationSection;
+  default:
+    return GlobalSection;
+  }
+}
+
+// Check if identical definitions of the ID an instruction defines can be
+// replaced with a single one.
+static bool isMergeableDefinition(unsigned opcode) {
+  switch (opcode) {
+  case SPIRV::OpExtInstImport:
+  case SPIRV::OpTypeVoid:
+  case SPIRV::OpTypeBool:
+  case SPIRV::OpTypeInt:
+  case SPIRV::OpTypeFloat:
+  case SPIRV::OpTypeVector:
+  case SPIRV::OpTypeMatrix:
+  case SPIRV::OpTypeImage:
+  case SPIRV::OpTypeSampler:
+  case SPIRV::OpTypeSampledImage:
+  case SPIRV::OpTypeArray:
+  case SPIRV::OpTypeRuntimeArray:
+  case SPIRV::OpTypeStruct:
+  case SPIRV::OpTypeOpaque:
+  case SPIRV::OpTypePointer:
+  case SPIRV::OpTypeFunction:
+  case SPIRV::OpTypeEvent:
+  case SPIRV::OpTypeDeviceEvent:
+  case SPIRV::OpTypeReserveId:
+  case SPIRV::OpTypeQueue:
+  case SPIRV::OpTypePipe:
+  case SPIRV::OpTypePipeStorage:
+  case SPIRV::OpTypeNamedBarrier:
+  case SPIRV::OpConstantTrue:
+  case SPIRV::OpConstantFalse:
+  case SPIRV::OpConstant:
+  case SPIRV::OpConstantComposite:
+  case SPIRV::OpConstantSampler:
+  case SPIRV::OpConstantNull:
+  case SPIRV::OpUndef:
+    return true;
+  default:
+    return false;
+  }
+}
+
+SPIRVModuleLinker::SPIRVModuleLinker(const MCInstrInfo &MCII,
+                                     function_ref<bool(StringRef)> IsInternal)
+    : MCII(MCII), IsInternal(IsInternal) {
+  // Opcode 0 is OpNop, shared with pseudo and generic instructions
+  for (unsigned opcode = 0; opcode < MCII.getNumOpcodes(); ++opcode) {
+    uint32_t encoding = getSPIRVOpcodeEncoding(MCII.get(opcode).TSFlags);
+    if (encoding != 0) {
+      EncodingToOpcode.insert({encoding, opcode});
+    }
+  }
+}
+
+Error SPIRVModuleLinker::decodeOperands(const InputModule &M, Instr &I) const {
+  const MCInstrDesc &MCDesc = MCII.get(I.Opcode);
+  const unsigned numOps = I.Ops.size();
+  const unsigned numFixedOps = MCDesc.getNumOperands();
+  if (numOps < numFixedOps) {
+    uint32_t encoding = getSPIRVOpcodeEncoding(MCDesc.TSFlags);
+    return makeError(M.Name, "too few operands for opcode " + utostr(encoding));
+  }
+  if (MCDesc.getNumDefs() == 1) {
+    I.ResultOp = hasSPIRVResultType(MCDesc) ? 1 : 0;
+  }
+
+  // The result type and ID are swapped in the encoding, but as both are IDs,
+  // the fixed operands still match their MCOperandInfo in order
+  const int stringOp = getStringOperand(I.Opcode);
+  for (unsigned i = 0; i < numFixedOps; ++i) {
+    if (int(i) == stringOp) {
+      // Only OpEntryPoint has operands other than literals after a string
+      if (I.Opcode == SPIRV::OpEntryPoint) {
+        ArrayRef<uint32_t> str = makeArrayRef(I.Ops).drop_front(i);
+        for (unsigned j = i + getStringWords(str); j < numOps; ++j) {
+          I.IDOps.push_back(j);
+        }
+      }
+      return Error::success();
+    }
+    if (MCDesc.OpInfo[i].RegClass >= 0) {
+      I.IDOps.push_back(i);
+    }
+  }
+
+  switch (I.Opcode) {
+  case SPIRV::OpDecorate:
+  case SPIRV::OpMemberDecorate:
+  case SPIRV::OpExecutionMode:
+  case SPIRV::OpTypeImage:
+  case SPIRV::OpConstant:
+  case SPIRV::OpSpecConstant:
+  case SPIRV::OpLoad:
+  case SPIRV::OpStore:
+  case SPIRV::OpCopyMemory:
+  case SPIRV::OpCopyMemorySized:
+  case SPIRV::OpVectorShuffle:
+  case SPIRV::OpCompositeExtract:
+  case SPIRV::OpCompositeInsert:
+  case SPIRV::OpLoopMerge:
+  case SPIRV::OpLoopControlINTEL:
+  case SPIRV::OpBranchConditional:
+    break; // Only literals follow
+  case SPIRV::OpSource:
+    // An optional OpString for the file, then the source's string
+    if (numOps > numFixedOps) {
+      I.IDOps.push_back(numFixedOps);
+    }
+    break;
+  case SPIRV::OpImageSampleImplicitLod:
+  case SPIRV::OpImageSampleDrefImplicitLod:
+  case SPIRV::OpImageSampleProjImplicitLod:
+  case SPIRV::OpImageSampleProjDrefImplicitLod:
+  case SPIRV::OpImageFetch:
+  case SPIRV::OpImageGather:
+  case SPIRV::OpImageDrefGather:
+  case SPIRV::OpImageRead:
+  case SPIRV::OpImageWrite:
+  case SPIRV::OpImageSparseSampleImplicitLod:
+  case SPIRV::OpImageSparseSampleDrefImplicitLod:
+  case SPIRV::OpImageSparseSampleProjImplicitLod:
+  case SPIRV::OpImageSparseSampleProjDrefImplicitLod:
+  case SPIRV::OpImageSparseFetch:
+  case SPIRV::OpImageSparseGather:
+  case SPIRV::OpImageSparseDrefGather:
+  case SPIRV::OpImageSparseRead:
+  case SPIRV::OpImageSampleFootprintNV:
+    // The ImageOperands mask, then the IDs of the operands it enables
+    for (unsigned j = numFixedOps + 1; j < numOps; ++j) {
+      I.IDOps.push_back(j);
+    }
+    break;
+  case SPIRV::OpSwitch: {
+    // Each case's literal is as wide as the selector, and followed by a label
+    uint32_t type = M.ResultTypes.lookup(I.Ops[0]);
+    unsigned literalWords = M.IntWidths.lookup(type) > 32 ? 2 : 1;
+    for (unsigned j = numFixedOps + literalWords; j < numOps;
+         j += literalWords + 1) {
+      I.IDOps.push_back(j);
+    }
+    break;
+  }
+  case SPIRV::OpExtInst: {
+    // OpenCL's rounding mode variants of vstore_half end with a literal
+    unsigned numIDs = numOps;
+    uint32_t inst = I.Ops[3];
+    if (M.OpenCLExtInstSets.count(I.Ops[2]) && numOps > numFixedOps &&
+        (inst == OpenCL_std::vstore_half_r ||
+         inst == OpenCL_std::vstore_halfn_r ||
+         inst == OpenCL_std::vstorea_halfn_r)) {
+      --numIDs;
+    }
+    for (unsigned j = numFixedOps; j < numIDs; ++j) {
+      I.IDOps.push_back(j);
+    }
+    break;
+  }
+  default:
+    for (unsigned j = numFixedOps; j < numOps; ++j) {
+      I.IDOps.push_back(j);
+    }
+    break;
+  }
+  return Error::success();
+}
+
+// Record what decoding later instructions of the module needs to know about
+// the ID I defines.
+void SPIRVModuleLinker::recordIDInfo(InputModule &M, const Instr &I) const {
+  if (I.ResultOp == 1) {
+    M.ResultTypes[I.Ops[1]] = I.Ops[0];
+  }
+  if (I.Opcode == SPIRV::OpTypeInt) {
+    M.IntWidths[I.Ops[0]] = I.Ops[1];
+  } else if (I.Opcode == SPIRV::OpExtInstImport &&
+             readString(makeArrayRef(I.Ops).drop_front(1)) ==
+                 getExtInstSetName(ExtInstSet::OpenCL_std)) {
+    M.OpenCLExtInstSets.insert(I.Ops[0]);
+  }
+}
+
+Error SPIRVModuleLinker::addModule(MemoryBufferRef buffer) {
+  StringRef data = buffer.getBuffer();
+  StringRef name = buffer.getBufferIdentifier();
+  if (data.size() % sizeof(uint32_t) != 0 ||
+      data.size() < HeaderWords * sizeof(uint32_t)) {
+    return makeError(name, "not a SPIR-V binary");
+  }
+  auto endian = support::little;
+  if (support::endian::read32le(data.data()) != MagicNumber) {
+    endian = support::big;
+    if (support::endian::read32be(data.data()) != MagicNumber) {
+      return makeError(name, "not a SPIR-V binary");
+    }
+  }
+  SmallVector<uint32_t, 0> words;
+  words.reserve(data.size() / sizeof(uint32_t));
+  for (size_t i = 0; i < data.size(); i += sizeof(uint32_t)) {
+    words.push_back(support::endian::read32(data.data() + i, endian));
+  }
+
+  Modules.emplace_back();
+  InputModule &M = Modules.back();
+  M.Name = name;
+  M.Version = words[1];
+  M.Bound = words[3];
+  for (size_t i = HeaderWords; i < words.size();) {
+    const uint32_t numWords = words[i] >> 16;
+    const uint32_t encoding = words[i] & 0xffff;
+    if (numWords == 0 || i + numWords > words.size()) {
+      return makeError(name, "truncated instruction");
+    }
+    auto opcode = EncodingToOpcode.find(encoding);
+    if (opcode == EncodingToOpcode.end()) {
+      return makeError(name, "unsupported opcode " + utostr(encoding));
+    }
+
+    Instr I;
+    I.Opcode = opcode->second;
+    I.Ops.append(words.begin() + i + 1, words.begin() + i + numWords);
+    if (Error E = decodeOperands(M, I)) {
+      return E;
+    }
+    for (unsigned op : I.IDOps) {
+      if (I.Ops[op] == 0 || I.Ops[op] >= M.Bound) {
+        return makeError(name, "ID " + utostr(I.Ops[op]) + " out of bounds");
+      }
+    }
+    recordIDInfo(M, I);
+    M.Instrs.push_back(std::move(I));
+    i += numWords;
+  }
+  M.IDMap.resize(M.Bound, 0);
+  return Error::success();
+}
+
+// Give each exported symbol its linked ID, and map the imports of symbols
+// exported by another module to it, marking the declarations to drop.
+Error SPIRVModuleLinker::resolveLinkage() {
+  StringMap<uint32_t> exports;
+  SmallVector<std::pair<InputModule *, uint32_t>, 8> imports;
+  for (InputModule &M : Modules) {
+    for (const Instr &I : M.Instrs) {
+      if (I.Opcode == SPIRV::OpGroupDecorate) {
+        M.Decorated.insert(I.Ops.begin() + 1, I.Ops.end());
+      } else if (getSection(I.Opcode) == AnnotationSection) {
+        M.Decorated.insert(I.Ops[0]);
+      }
+      if (I.Opcode != SPIRV::OpDecorate ||
+          I.Ops[1] != Decoration::LinkageAttributes || I.Ops.size() < 4) {
+        continue;
+      }
+      uint32_t target = I.Ops[0];
+      std::string name = readString(makeArrayRef(I.Ops).drop_front(2));
+      M.LinkageNames[target] = name;
+      if (I.Ops.back() == LinkageType::Import) {
+        imports.push_back({&M, target});
+      } else if (!exports.insert({name, getLinkedID(M, target)}).second) {
+        return makeError(M.Name, "symbol '" + name +
+                                     "' is already exported by another module");
+      }
+    }
+  }
+
+  for (auto &import : imports) {
+    InputModule &M = *import.first;
+    auto exported = exports.find(M.LinkageNames[import.second]);
+    if (exported != exports.end()) {
+      M.IDMap[import.second] = exported->second;
+      M.Dropped.insert(import.second);
+    }
+  }
+
+  // The parameters of imported functions go with them
+  for (InputModule &M : Modules) {
+    bool inDroppedFunction = false;
+    for (const Instr &I : M.Instrs) {
+      if (I.Opcode == SPIRV::OpFunction) {
+        inDroppedFunction = M.Dropped.count(I.Ops[1]);
+      } else if (I.Opcode == SPIRV::OpFunctionParameter && inDroppedFunction) {
+        M.Dropped.insert(I.Ops[1]);
+      }
+    }
+  }
+  return Error::success();
+}
+
+uint32_t SPIRVModuleLinker::getLinkedID(InputModule &M, uint32_t id) {
+  uint32_t &linkedID = M.IDMap[id];
+  if (linkedID == 0) {
+    linkedID = NextID++;
+  }
+  return linkedID;
+}
+
+// Record the linked type of a symbol, to check an import's declaration agrees
+// with the definition it's resolved to.
+void SPIRVModuleLinker::recordLinkedType(InputModule &M, uint32_t id,
+                                         uint32_t type) {
+  auto name = M.LinkageNames.find(id);
+  if (name == M.LinkageNames.end()) {
+    return;
+  }
+  if (M.Dropped.count(id)) {
+    ImportTypes.push_back({name->second, getLinkedID(M, type)});
+  } else {
+    ExportTypes[name->second] = getLinkedID(M, type);
+  }
+}
+
+// Get I's operands with each ID replaced by its linked ID, other than its
+// result, which is left as 0.
+void SPIRVModuleLinker::remapOperands(InputModule &M, const Instr &I,
+                                      SmallVectorImpl<uint32_t> &ops) {
+  ops.assign(I.Ops.begin(), I.Ops.end());
+  for (unsigned op : I.IDOps) {
+    ops[op] = int(op) == I.ResultOp ? 0 : getLinkedID(M, I.Ops[op]);
+  }
+}
+
+void SPIRVModuleLinker::emit(SmallVectorImpl<uint32_t> &words, unsigned opcode,
+                             ArrayRef<uint32_t> ops) const {
+  uint32_t encoding = getSPIRVOpcodeEncoding(MCII.get(opcode).TSFlags);
+  words.push_back(((ops.size() + 1) << 16) | encoding);
+  words.append(ops.begin(), ops.end());
+}
+
+// Link an OpExtInstImport, or an instruction of the types, constants and
+// global variables section, mapping its result to an identical definition
+// already linked if possible.
+void SPIRVModuleLinker::linkDefinition(InputModule &M, const Instr &I,
+                                       Section section) {
+  if (I.Opcode == SPIRV::OpVariable) {
+    recordLinkedType(M, I.Ops[1], I.Ops[0]);
+  }
+  if (I.ResultOp >= 0 && M.Dropped.count(I.Ops[I.ResultOp])) {
+    return;
+  }
+
+  DefinitionKey ops;
+  remapOperands(M, I, ops);
+  if (I.ResultOp < 0) {
+    emit(SectionWords[section], I.Opcode, ops);
+    return;
+  }
+
+  // Definitions already referred to, e.g. from an OpTypeForwardPointer, keep
+  // their ID
+  uint32_t res = I.Ops[I.ResultOp];
+  bool isMergeable = isMergeableDefinition(I.Opcode) &&
+                     !M.Decorated.count(res) && M.IDMap[res] == 0;
+  DefinitionKey key;
+  if (isMergeable) {
+    key.push_back(I.Opcode);
+    key.append(ops.begin(), ops.end());
+    auto existing = Definitions.find(key);
+    if (existing != Definitions.end()) {
+      M.IDMap[res] = existing->second;
+      return;
+    }
+  }
+  ops[I.ResultOp] = getLinkedID(M, res);
+  if (isMergeable) {
+    Definitions[key] = ops[I.ResultOp];
+  }
+  emit(SectionWords[section], I.Opcode, ops);
+}
+
+// Link an instruction outside any function, other than a definition, dropping
+// it if it's a duplicate, annotates a dropped import, or exports an internal
+// symbol.
+Error SPIRVModuleLinker::linkPreambleInstr(InputModule &M, const Instr &I,
+                                           Section section) {
+  if ((section == DebugNameSection || section == AnnotationSection) &&
+      M.Dropped.count(I.Ops[0])) {
+    return Error::success();
+  }
+  if (I.Opcode == SPIRV::OpDecorate &&
+      I.Ops[1] == Decoration::LinkageAttributes &&
+      I.Ops.back() == LinkageType::Export && IsInternal &&
+      IsInternal(M.LinkageNames.lookup(I.Ops[0]))) {
+    return Error::success();
+  }
+
+  DefinitionKey ops;
+  remapOperands(M, I, ops);
+  if (I.ResultOp >= 0) {
+    ops[I.ResultOp] = getLinkedID(M, I.Ops[I.ResultOp]);
+  }
+  // Only apply a decoration group to the targets which aren't dropped
+  if (I.Opcode == SPIRV::OpGroupDecorate) {
+    unsigned numOps = 1;
+    for (unsigned i = 1; i < I.Ops.size(); ++i) {
+      if (!M.Dropped.count(I.Ops[i])) {
+        ops[numOps++] = ops[i];
+      }
+    }
+    if (numOps == 1) {
+      return Error::success();
+    }
+    ops.resize(numOps);
+  }
+
+  switch (section) {
+  case MemoryModelSection:
+    if (MemoryModel.empty()) {
+      MemoryModel.assign(ops.begin(), ops.end());
+      break;
+    }
+    if (ArrayRef<uint32_t>(MemoryModel) != ArrayRef<uint32_t>(ops)) {
+      return makeError(M.Name, "addressing or memory model differs from the "
+                               "previous modules'");
+    }
+    return Error::success();
+  case EntryPointSection:
+  case ExecutionModeSection:
+    break;
+  case DebugNameSection:
+    // Types and constants merged between modules keep their first name
+    if (I.Opcode == SPIRV::OpName && !NamedIDs.insert(ops[0]).second) {
+      return Error::success();
+    }
+    if (I.Opcode == SPIRV::OpMemberName &&
+        !NamedMembers.insert({ops[0], ops[1]}).second) {
+      return Error::success();
+    }
+    break;
+  default: {
+    DefinitionKey key;
+    key.push_back(I.Opcode);
+    key.append(ops.begin(), ops.end());
+    if (!PreambleInstrs.insert(key).second) {
+      return Error::success();
+    }
+    break;
+  }
+  }
+  emit(SectionWords[section], I.Opcode, ops);
+  return Error::success();
+}
+
+Error SPIRVModuleLinker::linkModule(InputModule &M) {
+  // Link the definitions the rest of the module can refer to first, so
+  // identical ones can be mapped to those of earlier modules
+  for (const Instr &I : M.Instrs) {
+    if (I.Opcode == SPIRV::OpFunction) {
+      break;
+    }
+    Section section = getSection(I.Opcode);
+    if (section == ExtInstImportSection || section == GlobalSection) {
+      linkDefinition(M, I, section);
+    }
+  }
+
+  bool inFunction = false;
+  bool isDropped = false;
+  bool hasBody = false;
+  SmallVector<uint32_t, 0> functionWords;
+  DefinitionKey ops;
+  for (const Instr &I : M.Instrs) {
+    if (I.Opcode == SPIRV::OpFunction) {
+      inFunction = true;
+      isDropped = M.Dropped.count(I.Ops[1]);
+      hasBody = false;
+      functionWords.clear();
+      recordLinkedType(M, I.Ops[1], I.Ops[3]);
+    }
+    if (!inFunction) {
+      Section section = getSection(I.Opcode);
+      if (section == ExtInstImportSection || section == GlobalSection) {
+        continue;
+      }
+      if (Error E = linkPreambleInstr(M, I, section)) {
+        return E;
+      }
+      continue;
+    }
+
+    if (!isDropped) {
+      remapOperands(M, I, ops);
+      if (I.ResultOp >= 0) {
+        ops[I.ResultOp] = getLinkedID(M, I.Ops[I.ResultOp]);
+      }
+      emit(functionWords, I.Opcode, ops);
+      hasBody |= I.Opcode == SPIRV::OpLabel;
+    }
+    if (I.Opcode == SPIRV::OpFunctionEnd) {
+      inFunction = false;
+      auto &sectionWords =
+          SectionWords[hasBody ? FunctionDefSection : FunctionDeclSection];
+      sectionWords.append(functionWords.begin(), functionWords.end());
+    }
+  }
+  return Error::success();
+}
+
+Error SPIRVModuleLinker::link(SmallVectorImpl<uint32_t> &linked) {
+  if (Error E = resolveLinkage()) {
+    return E;
+  }
+  uint32_t version = 0;
+  for (InputModule &M : Modules) {
+    if (Error E = linkModule(M)) {
+      return E;
+    }
+    version = std::max(version, M.Version);
+  }
+  for (const auto &import : ImportTypes) {
+    if (ExportTypes.lookup(import.first) != import.second) {
+      return make_error<StringError>("symbol '" + import.first +
+                                         "' is imported with a different type "
+                                         "than it is exported with",
+                                     inconvertibleErrorCode());
+    }
+  }
+
+  linked.append({MagicNumber, version, /*Generator=*/0, NextID, /*Schema=*/0});
+  for (const auto &words : SectionWords) {
+    linked.append(words.begin(), words.end());
+  }
+  return Error::success();
+}
+
+Error llvm::linkSPIRVModules(const MCInstrInfo &MCII,
+                             ArrayRef<MemoryBufferRef> Inputs,
+                             SmallVectorImpl<uint32_t> &Linked,
+                             function_ref<bool(StringRef)> IsInternal) {
+  SPIRVModuleLinker linker(MCII, IsInternal);
+  for (MemoryBufferRef input : Inputs) {
+    if (Error E = linker.addModule(input)) {
+      return E;
+    }
+  }
+  return linker.link(Linked);
+}
@@ -0,0 +1,41 @@
+//===-- SPIRVLinker.h - Link SPIR-V Binaries --------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Links SPIR-V binaries emitted separately, e.g. for each translation unit,
+// into a single module. This performs the same merge across modules as
+// SPIRVGlobalTypesAndRegNum does across the functions of one module: IDs are
+// renumbered into a single space, identical types and constants are defined
+// once, and the declarations importing a symbol another module exports
+// through its LinkageAttributes are dropped, so their uses refer to the
+// exported definition directly.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LIB_TARGET_SPIRV_MCTARGETDESC_SPIRVLINKER_H
+#define LLVM_LIB_TARGET_SPIRV_MCTARGETDESC_SPIRVLINKER_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace llvm {
+class MCInstrInfo;
+
+// Link the SPIR-V binaries in Inputs, appending the words of the linked module
+// to Linked. The instructions are decoded with the SPIR-V target's
+// MCInstrInfo, so any instruction the backend can emit can be linked. The
+// symbols IsInternal returns true for are no longer exported once linked.
+Error linkSPIRVModules(const MCInstrInfo &MCII,
+                       ArrayRef<MemoryBufferRef> Inputs,
+                       SmallVectorImpl<uint32_t> &Linked,
+                       function_ref<bool(StringRef)> IsInternal = nullptr);
+} // namespace llvm
+
+#endif
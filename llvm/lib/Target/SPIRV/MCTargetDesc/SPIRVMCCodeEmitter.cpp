@@ -21,7 +21,6 @@
 #include "llvm/MC/MCSubtargetInfo.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Endian.h"
-#include "llvm/Support/EndianStream.h"
 #include <cassert>
 #include <cstdint>
 
@@ -31,15 +30,31 @@ using namespace llvm;
 
 namespace {
 
+// Precomputed per-opcode encoding info: the SPIR-V opcode in the low 16 bits,
+// and whether the result type operand must be swapped before the result ID.
+enum : uint32_t { OpcodeMask = 0xffff, HasResultTypeFlag = 1u << 16 };
+
 class SPIRVMCCodeEmitter : public MCCodeEmitter {
   const MCInstrInfo &MCII;
   const MCRegisterInfo &MRI;
   bool IsLittleEndian;
+  SmallVector<uint32_t, 0> OpcodeEncodings;
 
 public:
   SPIRVMCCodeEmitter(const MCInstrInfo &mcii, const MCRegisterInfo &mri,
                      bool IsLittleEndian)
-      : MCII(mcii), MRI(mri), IsLittleEndian(IsLittleEndian) {}
+      : MCII(mcii), MRI(mri), IsLittleEndian(IsLittleEndian) {
+    // Build the table once, so encoding doesn't inspect each MCInstrDesc
+    const unsigned numOpcodes = MCII.getNumOpcodes();
+    OpcodeEncodings.reserve(numOpcodes);
+    for (unsigned opcode = 0; opcode < numOpcodes; ++opcode) {
+      const MCInstrDesc &MCDesc = MCII.get(opcode);
+      uint32_t encoding = getSPIRVOpcodeEncoding(MCDesc.TSFlags);
+      if (hasSPIRVResultType(MCDesc))
+        encoding |= HasResultTypeFlag;
+      OpcodeEncodings.push_back(encoding);
+    }
+  }
   SPIRVMCCodeEmitter(const SPIRVMCCodeEmitter &) = delete;
   void operator=(const SPIRVMCCodeEmitter &) = delete;
   ~SPIRVMCCodeEmitter() override = default;
@@ -68,14 +83,10 @@ MCCodeEmitter *llvm::createSPIRVMCCodeEmitter(const MCInstrInfo &MCII,
   return new SPIRVMCCodeEmitter(MCII, MRI, true);
 }
 
-using EndianWriter = support::endian::Writer;
-
 // Check if the instruction has a type argument for operand 1, and defines an ID
 // output register in operand 0. If so, we need to swap operands 0 and 1 so the
 // type comes first in the output, despide coming second in the MCInst
-static bool hasType(const MCInst &MI, const MCInstrInfo &MII,
-                    const MCRegisterInfo &MRI) {
-  MCInstrDesc MCDesc = MII.get(MI.getOpcode());
+bool llvm::hasSPIRVResultType(const MCInstrDesc &MCDesc) {
   // If we define an output, and have at least one other argument
   if (MCDesc.getNumDefs() == 1 && MCDesc.getNumOperands() >= 2) {
     // Check if we define an ID, and take a type as operand 1
@@ -87,12 +98,13 @@ static bool hasType(const MCInst &MI, const MCInstrInfo &MII,
   return false;
 }
 
-static void emitOperand(const MCOperand &Op, EndianWriter &OSE) {
+static void emitOperand(const MCOperand &Op,
+                        SmallVectorImpl<uint32_t> &Words) {
   if (Op.isReg()) {
     // Emit the id index starting at 1 (0 is an invalid index)
-    OSE.write<uint32_t>(Register::virtReg2Index(Op.getReg()) + 1);
+    Words.push_back(Register::virtReg2Index(Op.getReg()) + 1);
   } else if (Op.isImm()) {
-    OSE.write<uint32_t>(Op.getImm());
+    Words.push_back(Op.getImm());
   } else {
     llvm_unreachable("Error: Unexpected operand type in VReg");
   }
@@ -100,19 +112,21 @@ static void emitOperand(const MCOperand &Op, EndianWriter &OSE) {
 
 // Emit the type in operand 1 before the ID in operand 0 it defines, and all
 // remaining operands in the order they come naturally
-static void emitTypedInstrOperands(const MCInst &MI, EndianWriter &OSE) {
+static void emitTypedInstrOperands(const MCInst &MI,
+                                   SmallVectorImpl<uint32_t> &Words) {
   unsigned int numOps = MI.getNumOperands();
-  emitOperand(MI.getOperand(1), OSE);
-  emitOperand(MI.getOperand(0), OSE);
+  emitOperand(MI.getOperand(1), Words);
+  emitOperand(MI.getOperand(0), Words);
   for (unsigned int i = 2; i < numOps; ++i) {
-    emitOperand(MI.getOperand(i), OSE);
+    emitOperand(MI.getOperand(i), Words);
   }
 }
 
 // Emit operands in the order they come naturally
-static void emitUntypedInstrOperands(const MCInst &MI, EndianWriter &OSE) {
+static void emitUntypedInstrOperands(const MCInst &MI,
+                                     SmallVectorImpl<uint32_t> &Words) {
   for (const auto &Op : MI) {
-    emitOperand(Op, OSE);
+    emitOperand(Op, Words);
   }
 }
 
@@ -120,23 +134,32 @@ void SPIRVMCCodeEmitter::encodeInstruction(const MCInst &MI, raw_ostream &OS,
                                            SmallVectorImpl<MCFixup> &Fixups,
                                            const MCSubtargetInfo &STI) const {
 
+#ifndef NDEBUG
   auto features = computeAvailableFeatures(STI.getFeatureBits());
   verifyInstructionPredicates(MI, features);
+#endif
 
-  EndianWriter OSE(OS, IsLittleEndian ? support::little : support::big);
-
-  // Encode the first 32 SPIR-V bytes with the number of args and the opcode
-  uint64_t OpCode = getBinaryCodeForInstr(MI, Fixups, STI);
+  // Encode the first 32 SPIR-V bits with the number of args and the opcode
+  const uint32_t encoding = OpcodeEncodings[MI.getOpcode()];
   uint32_t numWords = MI.getNumOperands() + 1;
-  uint32_t firstWord = ((numWords << 16) | OpCode);
-  OSE.write<uint32_t>(firstWord);
+  uint32_t firstWord = ((numWords << 16) | (encoding & OpcodeMask));
+  SmallVector<uint32_t, 16> words;
+  words.push_back(firstWord);
 
   // Emit the instruction arguments (emitting the output type first if present)
-  if (hasType(MI, MCII, MRI)) {
-    emitTypedInstrOperands(MI, OSE);
+  if (encoding & HasResultTypeFlag) {
+    emitTypedInstrOperands(MI, words);
   } else {
-    emitUntypedInstrOperands(MI, OSE);
+    emitUntypedInstrOperands(MI, words);
+  }
+
+  // Write all the words at once in the target byte order
+  const auto endian = IsLittleEndian ? support::little : support::big;
+  for (uint32_t &word : words) {
+    word = support::endian::byte_swap<uint32_t>(word, endian);
   }
+  OS.write(reinterpret_cast<const char *>(words.data()),
+           words.size() * sizeof(uint32_t));
 }
 
 #define ENABLE_INSTR_PREDICATE_VERIFIER
@@ -22,6 +22,7 @@ namespace llvm {
 class MCAsmBackend;
 class MCCodeEmitter;
 class MCContext;
+class MCInstrDesc;
 class MCInstrInfo;
 class MCObjectTargetWriter;
 class MCRegisterInfo;
@@ -42,6 +43,15 @@ MCAsmBackend *createSPIRVAsmBackend(const Target &T, const MCSubtargetInfo &STI,
                                     const MCTargetOptions &Options);
 
 std::unique_ptr<MCObjectTargetWriter> createSPIRVObjectTargetWriter();
+
+// Check if the instruction defines an ID in operand 0 and takes its type as
+// operand 1. If so, the encoding must swap them so the type comes first.
+bool hasSPIRVResultType(const MCInstrDesc &MCDesc);
+
+// Return the SPIR-V opcode an instruction is encoded with.
+inline uint16_t getSPIRVOpcodeEncoding(uint64_t TSFlags) {
+  return TSFlags & 0xffff;
+}
 } // namespace llvm
 
 // Defines symbolic names for SPIR-V registers.  This defines a mapping from
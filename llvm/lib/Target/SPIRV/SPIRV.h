@@ -10,18 +10,104 @@
 #define LLVM_LIB_TARGET_SPIRV_SPIRV_H
 
 #include "MCTargetDesc/SPIRVMCTargetDesc.h"
+#include "llvm/ADT/Optional.h"
 #include "llvm/Target/TargetMachine.h"
 
 namespace llvm {
+namespace SPIRV {
+// Target indices used for operands referring to globally numbered IDs. Once
+// registers are numbered module-wide, function bodies refer to IDs with
+// MO_TargetIndex operands whose offset is the global VReg's index, so their
+// MachineRegisterInfo doesn't need to hold every global VReg.
+enum TargetIndex { TI_GlobalID = 0 };
+} // namespace SPIRV
+
 class SPIRVTargetMachine;
 class SPIRVRegisterBankInfo;
 class SPIRVSubtarget;
 class InstructionSelector;
+class MemCpyInst;
+class Constant;
+class DataLayout;
+class raw_pwrite_stream;
 
 FunctionPass *createSPIRVBasicBlockDominancePass();
 FunctionPass *createSPIRVBlockLabelerPass();
-FunctionPass *createSPIRVAddRequirementsPass();
-ModulePass *createSPIRVGlobalTypesAndRegNumPass();
+FunctionPass *createSPIRVLowerMemIntrinsicsPass();
+// With EncodeFunctions, the pass encodes each function body once numbered and
+// frees its MachineFunction, leaving the AsmPrinter to emit the words.
+ModulePass *createSPIRVGlobalTypesAndRegNumPass(bool EncodeFunctions = false);
+FunctionPass *createSPIRVStructurizerPass();
+FunctionPass *createSPIRVVectorCombinePass();
+FunctionPass *createSPIRVMinMaxCombinePass();
+FunctionPass *createSPIRVDivByConstantCombinePass();
+FunctionPass *createSPIRVStackColoringPass();
+FunctionPass *createSPIRVAtomicOptimizerPass();
+FunctionPass *createSPIRVAnnotateUniformValuesPass();
+ModulePass *createSPIRVLocalMemoryLayoutPass();
+ModulePass *createSPIRVShaderEntryPointsPass();
+FunctionPass *createSPIRVSimplifyCFGPass();
+FunctionPass *createSPIRVMachineCSEPass();
+FunctionPass *createSPIRVPreEmitSchedulerPass();
+FunctionPass *createSPIRVGenericAccessRemarksPass();
+FunctionPass *createSPIRVCoalescingRemarksPass();
+ModulePass *createSPIRVBlockProfilingPass();
+ModulePass *createSPIRVKernelResourceReportPass();
+ModulePass *createSPIRVKernelReflectionPass();
+FunctionPass *createSPIRVNarrowArithmeticPass();
+FunctionPass *createSPIRVDemoteFP64Pass();
+FunctionPass *createSPIRVNarrowIndicesPass();
+FunctionPass *createSPIRVDebugLinesPass();
+FunctionPass *createSPIRVIfConversionPass();
+FunctionPass *createSPIRVBarrierEliminationPass();
+ModulePass *createSPIRVPromoteConstantGlobalsPass();
+ModulePass *createSPIRVEntryPointSubsetPass();
+ModulePass *createSPIRVInlineSmallFunctionsPass();
+ModulePass *createSPIRVMergeFunctionsPass();
+FunctionPass *createSPIRVConstantFoldingPass();
+FunctionPass *createSPIRVByValCopyEliminationPass();
+FunctionPass *createSPIRVSplitAggregateLoadsPass();
+
+// Whether -spirv-cache-dir enables the on-disk cache of emitted object files.
+bool isSPIRVCompilationCacheEnabled();
+
+// Whether -spirv-direct-emit encodes object files straight from MachineInstrs.
+bool isSPIRVDirectEmissionEnabled();
+
+// Whether -spirv-entry-points restricts the module to some of its kernels.
+bool isSPIRVEntryPointSubsetEnabled();
+
+// Whether -spirv-executable internalizes everything but the kernels.
+bool isSPIRVExecutableModule();
+
+// A kernel argument known when the kernel is launched. With a SpecId, uses of
+// the argument become a specialization constant defaulting to Value instead.
+struct SPIRVSpecializedArg {
+  unsigned ArgNo;
+  Constant *Value;
+  Optional<uint32_t> SpecId;
+};
+
+// Add to the module a copy of the kernel named Name, without the given
+// arguments, whose uses are replaced by their values and folded. Returns
+// nullptr if the kernel or an argument can't be specialized that way.
+Function *specializeSPIRVKernel(Function &Kernel,
+                                ArrayRef<SPIRVSpecializedArg> Args,
+                                StringRef Name);
+
+// Create the pass looking up and filling the object file cache, which writes
+// the final object to Out. Codegen must emit to the stream set in CodeGenOut,
+// owned by the pass.
+ModulePass *createSPIRVCompilationCachePass(raw_pwrite_stream &Out,
+                                            SPIRVTargetMachine &TM,
+                                            raw_pwrite_stream *&CodeGenOut);
+
+// Whether a memcpy copies a whole object between pointers to the same type, so
+// can be lowered to OpCopyMemory.
+bool isSPIRVWholeObjectCopy(const MemCpyInst &MCI, const DataLayout &DL);
+
+// Whether OpSpecConstantOp can compute the SPIR-V opcode for the subtarget.
+bool isSPIRVSpecConstantOpOpcode(unsigned Opcode, const SPIRVSubtarget &ST);
 
 InstructionSelector *
 createSPIRVInstructionSelector(const SPIRVTargetMachine &TM,
@@ -30,8 +116,38 @@ createSPIRVInstructionSelector(const SPIRVTargetMachine &TM,
 
 void initializeSPIRVBasicBlockDominancePass(PassRegistry &);
 void initializeSPIRVBlockLabelerPass(PassRegistry &);
-void initializeSPIRVAddRequirementsPass(PassRegistry &);
+void initializeSPIRVLowerMemIntrinsicsPass(PassRegistry &);
 void initializeSPIRVGlobalTypesAndRegNumPass(PassRegistry &);
+void initializeSPIRVStructurizerPass(PassRegistry &);
+void initializeSPIRVVectorCombinePass(PassRegistry &);
+void initializeSPIRVMinMaxCombinePass(PassRegistry &);
+void initializeSPIRVSimplifyCFGPass(PassRegistry &);
+void initializeSPIRVMachineCSEPass(PassRegistry &);
+void initializeSPIRVPreEmitSchedulerPass(PassRegistry &);
+void initializeSPIRVGenericAccessRemarksPass(PassRegistry &);
+void initializeSPIRVCoalescingRemarksPass(PassRegistry &);
+void initializeSPIRVBlockProfilingPass(PassRegistry &);
+void initializeSPIRVKernelResourceReportPass(PassRegistry &);
+void initializeSPIRVKernelReflectionPass(PassRegistry &);
+void initializeSPIRVNarrowArithmeticPass(PassRegistry &);
+void initializeSPIRVDemoteFP64Pass(PassRegistry &);
+void initializeSPIRVNarrowIndicesPass(PassRegistry &);
+void initializeSPIRVDebugLinesPass(PassRegistry &);
+void initializeSPIRVIfConversionPass(PassRegistry &);
+void initializeSPIRVBarrierEliminationPass(PassRegistry &);
+void initializeSPIRVPromoteConstantGlobalsPass(PassRegistry &);
+void initializeSPIRVDivByConstantCombinePass(PassRegistry &);
+void initializeSPIRVStackColoringPass(PassRegistry &);
+void initializeSPIRVAtomicOptimizerPass(PassRegistry &);
+void initializeSPIRVAnnotateUniformValuesPass(PassRegistry &);
+void initializeSPIRVEntryPointSubsetPass(PassRegistry &);
+void initializeSPIRVInlineSmallFunctionsPass(PassRegistry &);
+void initializeSPIRVMergeFunctionsPass(PassRegistry &);
+void initializeSPIRVConstantFoldingPass(PassRegistry &);
+void initializeSPIRVByValCopyEliminationPass(PassRegistry &);
+void initializeSPIRVSplitAggregateLoadsPass(PassRegistry &);
+void initializeSPIRVLocalMemoryLayoutPass(PassRegistry &);
+void initializeSPIRVShaderEntryPointsPass(PassRegistry &);
 } // namespace llvm
 
 #endif
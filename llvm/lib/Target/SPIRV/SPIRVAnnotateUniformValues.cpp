@@ -0,0 +1,88 @@
+//===-- SPIRVAnnotateUniformValues.cpp - Mark uniform values ---*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Give the instructions LegacyDivergenceAnalysis finds uniform across the
+// subgroup spirv.uniform metadata, like AMDGPUAnnotateUniformValues does with
+// amdgpu.uniform. SPIRVIRTranslator then decorates their result ids Uniform,
+// or UniformId with the Subgroup scope from SPIR-V 1.4, so drivers can keep
+// them in scalar registers and load through uniform pointers with scalar
+// loads. Both decorations need the Shader capability.
+//
+// Allocas are never uniform, as each work-item has its own variable.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVEnumRequirements.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LegacyDivergenceAnalysis.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-annotate-uniform-values"
+
+STATISTIC(NumUniformValues, "Number of values annotated as uniform");
+
+namespace {
+class SPIRVAnnotateUniformValues : public FunctionPass {
+public:
+  static char ID;
+  SPIRVAnnotateUniformValues() : FunctionPass(ID) {
+    initializeSPIRVAnnotateUniformValuesPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.addRequired<LegacyDivergenceAnalysis>();
+    AU.setPreservesAll();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+bool SPIRVAnnotateUniformValues::runOnFunction(Function &F) {
+  if (skipFunction(F)) {
+    return false;
+  }
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  if (!canUseDecoration(Decoration::Uniform, *TM.getSubtargetImpl())) {
+    return false;
+  }
+  const auto &DA = getAnalysis<LegacyDivergenceAnalysis>();
+
+  MDNode *uniformMD = MDNode::get(F.getContext(), {});
+  bool changed = false;
+  for (Instruction &I : instructions(F)) {
+    if (I.getType()->isVoidTy() || isa<AllocaInst>(I) || !DA.isUniform(&I)) {
+      continue;
+    }
+    I.setMetadata("spirv.uniform", uniformMD);
+    ++NumUniformValues;
+    changed = true;
+  }
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVAnnotateUniformValues, DEBUG_TYPE,
+                      "SPIRV annotate uniform values", false, false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_DEPENDENCY(LegacyDivergenceAnalysis)
+INITIALIZE_PASS_END(SPIRVAnnotateUniformValues, DEBUG_TYPE,
+                    "SPIRV annotate uniform values", false, false)
+
+char SPIRVAnnotateUniformValues::ID = 0;
+
+FunctionPass *llvm::createSPIRVAnnotateUniformValuesPass() {
+  return new SPIRVAnnotateUniformValues();
+}
@@ -15,7 +15,10 @@
 #include "SPIRV.h"
 #include "SPIRVInstrInfo.h"
 #include "SPIRVMCInstLower.h"
+#include "SPIRVStrings.h"
 #include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/AsmPrinter.h"
 #include "llvm/CodeGen/MachineConstantPool.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
@@ -23,17 +26,44 @@
 #include "llvm/CodeGen/MachineModuleInfo.h"
 #include "llvm/MC/MCAsmInfo.h"
 #include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCSectionSPIRV.h"
 #include "llvm/MC/MCStreamer.h"
 #include "llvm/MC/MCSymbol.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetLoweringObjectFile.h"
 using namespace llvm;
 
 #define DEBUG_TYPE "asm-printer"
 
+STATISTIC(NumInstrsEmitted, "Number of SPIR-V instructions emitted");
+STATISTIC(NumBytesEmitted, "Number of SPIR-V instruction bytes emitted");
+STATISTIC(NumIDsEmitted, "Number of SPIR-V IDs emitted");
+
+static cl::opt<bool> DirectBinaryEmission(
+    "spirv-direct-emit", cl::Hidden, cl::init(false),
+    cl::desc("Encode SPIR-V object files directly from MachineInstrs into a "
+             "word buffer, bypassing MCInst lowering and encoding"));
+
+bool llvm::isSPIRVDirectEmissionEnabled() { return DirectBinaryEmission; }
+
 namespace {
 class SPIRVAsmPrinter : public AsmPrinter {
 
+  // One more than the largest ID emitted so far, for the module header.
+  unsigned IDBound = 1;
+
+  // Instruction words encoded since the last flush by -spirv-direct-emit.
+  std::vector<uint32_t> DirectWords;
+
+  bool useDirectEmission() const {
+    return DirectBinaryEmission && !OutStreamer->hasRawTextSupport();
+  }
+  void emitInstructionWords(const MachineInstr &MI);
+  void flushInstructionWords();
+
 public:
   explicit SPIRVAsmPrinter(TargetMachine &TM,
                            std::unique_ptr<MCStreamer> Streamer)
@@ -50,7 +80,9 @@ public:
   void EmitFunctionHeader() override {}
   void EmitBasicBlockStart(const MachineBasicBlock &MBB) const override {}
   void EmitBasicBlockEnd(const MachineBasicBlock &MBB) override {}
+  void EmitFunctionBodyEnd() override { flushInstructionWords(); }
   void EmitGlobalVariable(const GlobalVariable *GV) override {}
+  void EmitEndOfAsmFile(Module &M) override;
 };
 } // namespace
 
@@ -102,14 +134,76 @@ bool SPIRVAsmPrinter::PrintAsmOperand(const MachineInstr *MI, unsigned OpNo,
   return false;
 }
 
+// Encode the instruction straight into the word buffer, bypassing the MCInst.
+void SPIRVAsmPrinter::emitInstructionWords(const MachineInstr &MI) {
+  const size_t numWordsBefore = DirectWords.size();
+  encodeSPIRVInstr(MI, DirectWords, IDBound);
+  NumBytesEmitted += (DirectWords.size() - numWordsBefore) * sizeof(uint32_t);
+}
+
+// Append all words encoded so far to the current section as little-endian
+// bytes with a single write, and reuse the buffer for the next function.
+void SPIRVAsmPrinter::flushInstructionWords() {
+  if (DirectWords.empty())
+    return;
+  for (uint32_t &word : DirectWords) {
+    word = support::endian::byte_swap<uint32_t, support::little>(word);
+  }
+  OutStreamer->EmitBytes(
+      StringRef(reinterpret_cast<const char *>(DirectWords.data()),
+                DirectWords.size() * sizeof(uint32_t)));
+  DirectWords.clear();
+}
+
 void SPIRVAsmPrinter::EmitInstruction(const MachineInstr *MI) {
+  ++NumInstrsEmitted;
+  if (useDirectEmission()) {
+    emitInstructionWords(*MI);
+    return;
+  }
 
   SPIRVMCInstLower MCInstLowering;
   MCInst TmpInst;
   MCInstLowering.Lower(MI, TmpInst);
+
+  // Track the largest ID, which the code emitter encodes as the index + 1.
+  // This is done on the lowered instruction, as global ID operands in function
+  // bodies only become registers once lowered.
+  for (const MCOperand &MO : TmpInst) {
+    if (MO.isReg()) {
+      unsigned ID = Register::virtReg2Index(MO.getReg()) + 1;
+      IDBound = std::max(IDBound, ID + 1);
+    }
+  }
+  NumBytesEmitted += (TmpInst.getNumOperands() + 1) * sizeof(uint32_t);
   EmitToStreamer(*OutStreamer, TmpInst);
 }
 
+// Emit the function bodies SPIRVGlobalTypesAndRegNum already encoded, after
+// the global instructions, then record the header info the object writer needs
+// on the output section.
+void SPIRVAsmPrinter::EmitEndOfAsmFile(Module &M) {
+  const auto &SPIRVTM = static_cast<const SPIRVTargetMachine &>(TM);
+  const SPIRVSubtarget *ST = SPIRVTM.getSubtargetImpl();
+  unsigned encodedIDBound = 0;
+  std::vector<uint32_t> encodedWords =
+      ST->getSPIRVTypeRegistry()->takeEncodedFunctions(encodedIDBound);
+  flushInstructionWords();
+  if (!encodedWords.empty()) {
+    assert(useDirectEmission() && "Function bodies encoded for text output");
+    NumBytesEmitted += encodedWords.size() * sizeof(uint32_t);
+    IDBound = std::max(IDBound, encodedIDBound);
+    DirectWords = std::move(encodedWords);
+    flushInstructionWords();
+  }
+  NumIDsEmitted += IDBound - 1;
+  MCSection *Section = getObjFileLowering().getTextSection();
+  if (auto *SPIRVSection = dyn_cast<MCSectionSPIRV>(Section)) {
+    SPIRVSection->setIDBound(IDBound);
+    SPIRVSection->setVersion(ST->getTargetSPIRVVersion());
+  }
+}
+
 // Force static initialization.
 extern "C" void LLVMInitializeSPIRVAsmPrinter() {
   RegisterAsmPrinter<SPIRVAsmPrinter> X(getTheSPIRV32Target());
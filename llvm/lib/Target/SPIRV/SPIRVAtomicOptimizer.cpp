@@ -0,0 +1,226 @@
+//===-- SPIRVAtomicOptimizer.cpp - Aggregate atomics per subgroup -*- C++ -*-//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Replace the atomics every active work-item of a subgroup makes on the same
+// address with the same value by a single one, like AMDGPUAtomicOptimizer does.
+// Kernels often count or append to a shared buffer this way, and the atomics
+// on one address are serialized, so a subgroup of N work-items waits for N
+// round trips to memory.
+//
+// LegacyDivergenceAnalysis, with SPIRVTTIImpl::isSourceOfDivergence, tells
+// which pointers and values are uniform. For an integer atomicrmw add or sub
+// of a uniform value V, the active work-items are found with sub_group_ballot,
+// and the first one adds or subtracts V times their number. If the old value
+// is used, it's broadcast from the first work-item, and each one gets the
+// value it would have seen had they run in order, i.e. the old value plus V
+// times the number of active work-items before it. The and, or, min and max
+// atomics whose old value isn't used only need the first work-item to run.
+//
+// The ballot functions need the GroupNonUniformBallot capability, and the
+// atomics on private memory are left alone, as each work-item has its own.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LegacyDivergenceAnalysis.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-atomic-optimizer"
+
+STATISTIC(NumAggregatedAtomics, "Number of atomics made once per subgroup");
+
+namespace {
+class SPIRVAtomicOptimizer : public FunctionPass {
+public:
+  static char ID;
+  SPIRVAtomicOptimizer() : FunctionPass(ID) {
+    initializeSPIRVAtomicOptimizerPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.addRequired<LegacyDivergenceAnalysis>();
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+// Declare the OpenCL builtin with the given mangled name and type
+static FunctionCallee getBuiltin(Module &M, StringRef mangledName, Type *retTy,
+                                 ArrayRef<Type *> argTys) {
+  FunctionCallee callee = M.getOrInsertFunction(
+      mangledName, FunctionType::get(retTy, argTys, false));
+  cast<Function>(callee.getCallee())->setCallingConv(CallingConv::SPIR_FUNC);
+  return callee;
+}
+
+static CallInst *buildBuiltinCall(IRBuilder<> &B, StringRef mangledName,
+                                  Type *retTy, ArrayRef<Value *> args) {
+  SmallVector<Type *, 1> argTys;
+  for (Value *arg : args) {
+    argTys.push_back(arg->getType());
+  }
+  Module &M = *B.GetInsertBlock()->getModule();
+  CallInst *call =
+      B.CreateCall(getBuiltin(M, mangledName, retTy, argTys), args);
+  call->setCallingConv(CallingConv::SPIR_FUNC);
+  return call;
+}
+
+// Whether running the atomic once per subgroup gives the same result, when its
+// old value isn't used
+static bool isIdempotent(AtomicRMWInst::BinOp op) {
+  switch (op) {
+  case AtomicRMWInst::And:
+  case AtomicRMWInst::Or:
+  case AtomicRMWInst::Max:
+  case AtomicRMWInst::Min:
+  case AtomicRMWInst::UMax:
+  case AtomicRMWInst::UMin:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Make the atomic add or sub once per subgroup, for all its active work-items
+static void aggregateAddSub(AtomicRMWInst &RMW) {
+  IRBuilder<> B(&RMW);
+  Type *ty = RMW.getType();
+  Type *i32Ty = B.getInt32Ty();
+  Type *ballotTy = VectorType::get(i32Ty, 4);
+  Value *ballot = buildBuiltinCall(B, "_Z16sub_group_balloti", ballotTy,
+                                   {B.getInt32(1)});
+  Value *count = buildBuiltinCall(B, "_Z26sub_group_ballot_bit_countDv4_j",
+                                  i32Ty, {ballot});
+  Value *prefix = buildBuiltinCall(
+      B, "_Z31sub_group_ballot_exclusive_scanDv4_j", i32Ty, {ballot});
+  Value *isFirst = B.CreateICmpEQ(prefix, B.getInt32(0));
+
+  Value *V = RMW.getValOperand();
+  BasicBlock *predBB = RMW.getParent();
+  Instruction *thenTerm = SplitBlockAndInsertIfThen(isFirst, &RMW, false);
+  B.SetInsertPoint(thenTerm);
+  Value *total = B.CreateMul(V, B.CreateZExtOrTrunc(count, ty));
+  auto *aggregated = cast<AtomicRMWInst>(RMW.clone());
+  aggregated->setOperand(1, total);
+  B.Insert(aggregated);
+
+  if (!RMW.use_empty()) {
+    B.SetInsertPoint(&RMW);
+    PHINode *phi = B.CreatePHI(ty, 2);
+    phi->addIncoming(UndefValue::get(ty), predBB);
+    phi->addIncoming(aggregated, thenTerm->getParent());
+    const char *broadcastName = ty->isIntegerTy(64)
+                                    ? "_Z25sub_group_broadcast_firstm"
+                                    : "_Z25sub_group_broadcast_firstj";
+    Value *first = buildBuiltinCall(B, broadcastName, ty, {phi});
+    Value *offset = B.CreateMul(V, B.CreateZExtOrTrunc(prefix, ty));
+    Value *old = RMW.getOperation() == AtomicRMWInst::Add
+                     ? B.CreateAdd(first, offset)
+                     : B.CreateSub(first, offset);
+    old->takeName(&RMW);
+    RMW.replaceAllUsesWith(old);
+  }
+  RMW.eraseFromParent();
+}
+
+// Make the atomic whose old value isn't used only in one active work-item
+static void aggregateIdempotent(AtomicRMWInst &RMW) {
+  IRBuilder<> B(&RMW);
+  Value *isFirst = B.CreateICmpNE(
+      buildBuiltinCall(B, "_Z15sub_group_electv", B.getInt32Ty(), {}),
+      B.getInt32(0));
+  Instruction *thenTerm = SplitBlockAndInsertIfThen(isFirst, &RMW, false);
+  RMW.moveBefore(thenTerm);
+}
+
+bool SPIRVAtomicOptimizer::runOnFunction(Function &F) {
+  if (skipFunction(F)) {
+    return false;
+  }
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  const SPIRVSubtarget &ST = *TM.getSubtargetImpl();
+  if (!ST.canUseCapability(Capability::GroupNonUniformBallot) ||
+      (ST.isKernel() && !ST.canUseExtInstSet(ExtInstSet::OpenCL_std))) {
+    return false;
+  }
+  SPIRVTypeRegistry *TR = ST.getSPIRVTypeRegistry();
+  const auto &DA = getAnalysis<LegacyDivergenceAnalysis>();
+
+  SmallVector<AtomicRMWInst *, 8> candidates;
+  for (Instruction &I : instructions(F)) {
+    auto *RMW = dyn_cast<AtomicRMWInst>(&I);
+    if (!RMW || RMW->isVolatile() ||
+        !(RMW->getType()->isIntegerTy(32) || RMW->getType()->isIntegerTy(64))) {
+      continue;
+    }
+    const auto sc =
+        TR->addressSpaceToStorageClass(RMW->getPointerAddressSpace());
+    if (sc == StorageClass::Function || sc == StorageClass::Generic) {
+      continue;
+    }
+    const auto op = RMW->getOperation();
+    const bool isAddSub = op == AtomicRMWInst::Add || op == AtomicRMWInst::Sub;
+    if (!isAddSub && !(isIdempotent(op) && RMW->use_empty())) {
+      continue;
+    }
+    if (DA.isUniform(RMW->getPointerOperand()) &&
+        DA.isUniform(RMW->getValOperand())) {
+      candidates.push_back(RMW);
+    }
+  }
+  if (candidates.empty()) {
+    return false;
+  }
+
+  auto &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+  for (AtomicRMWInst *RMW : candidates) {
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "AggregatedAtomic", RMW)
+             << "atomic made once per subgroup";
+    });
+    const auto op = RMW->getOperation();
+    if (op == AtomicRMWInst::Add || op == AtomicRMWInst::Sub) {
+      aggregateAddSub(*RMW);
+    } else {
+      aggregateIdempotent(*RMW);
+    }
+  }
+  NumAggregatedAtomics += candidates.size();
+  return true;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVAtomicOptimizer, DEBUG_TYPE,
+                      "SPIRV aggregate uniform atomics per subgroup", false,
+                      false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_DEPENDENCY(LegacyDivergenceAnalysis)
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+INITIALIZE_PASS_END(SPIRVAtomicOptimizer, DEBUG_TYPE,
+                    "SPIRV aggregate uniform atomics per subgroup", false,
+                    false)
+
+char SPIRVAtomicOptimizer::ID = 0;
+
+FunctionPass *llvm::createSPIRVAtomicOptimizerPass() {
+  return new SPIRVAtomicOptimizer();
+}
@@ -0,0 +1,313 @@
+//===-- SPIRVBarrierElimination.cpp - Remove redundant barriers -*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Remove the OpControlBarriers and OpMemoryBarriers which order nothing the
+// previous barrier doesn't, and drop the memory semantics of the storage
+// classes a kernel never accesses.
+//
+// A barrier following another one in the same block with no access to memory
+// shared between work-items in between is merged into it: the earlier barrier
+// already synchronizes everything before the later one, and the later one
+// only adds its semantics. A fence is merged into the control barrier next to
+// it, as long as both have the same scopes.
+//
+// In kernels calling no other function, the semantics of the storage classes
+// which are never accessed are removed, so a barrier(CLK_LOCAL_MEM_FENCE |
+// CLK_GLOBAL_MEM_FENCE) in a kernel only using local memory becomes a
+// WorkgroupMemory barrier, and fences left with no storage class are erased.
+//
+// Only barriers whose scopes and semantics are constants are changed.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVEnums.h"
+#include "SPIRVInstrInfo.h"
+#include "SPIRVRegisterInfo.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+
+using namespace llvm;
+using namespace SPIRV;
+
+#define DEBUG_TYPE "spirv-barrier-elimination"
+
+STATISTIC(NumMergedBarriers, "Number of barriers merged into an adjacent one");
+STATISTIC(NumNarrowedBarriers, "Number of barriers with narrowed semantics");
+
+// The semantics bits giving the storage classes a barrier orders
+static const unsigned StorageSemanticsMask =
+    MemorySemantics::UniformMemory | MemorySemantics::SubgroupMemory |
+    MemorySemantics::WorkgroupMemory | MemorySemantics::CrossWorkgroupMemory |
+    MemorySemantics::AtomicCounterMemory | MemorySemantics::ImageMemory |
+    MemorySemantics::OutputMemoryKHR;
+
+// The semantics bits giving the memory order, of which at most one is set
+static const unsigned OrderingSemanticsMask =
+    MemorySemantics::Acquire | MemorySemantics::Release |
+    MemorySemantics::AcquireRelease | MemorySemantics::SequentiallyConsistent;
+
+namespace {
+class SPIRVBarrierElimination : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVBarrierElimination() : MachineFunctionPass(ID) {
+    initializeSPIRVBarrierEliminationPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+private:
+  MachineRegisterInfo *MRI;
+  const SPIRVInstrInfo *TII;
+
+  Optional<uint64_t> getConstValue(Register reg) const;
+  unsigned getAccessedMemory(const MachineInstr &MI) const;
+  void setSemantics(MachineInstr &MI, uint64_t semantics);
+  MachineInstr *mergeBarriers(MachineInstr &first, MachineInstr &second);
+};
+} // namespace
+
+static bool isBarrier(const MachineInstr &MI) {
+  return MI.getOpcode() == OpControlBarrier ||
+         MI.getOpcode() == OpMemoryBarrier;
+}
+
+// The operand indices of the memory scope and semantics, which follow the
+// execution scope of OpControlBarrier
+static unsigned getMemScopeIdx(const MachineInstr &MI) {
+  return MI.getOpcode() == OpControlBarrier ? 1 : 0;
+}
+static unsigned getSemanticsIdx(const MachineInstr &MI) {
+  return getMemScopeIdx(MI) + 1;
+}
+
+// Combine the semantics of two barriers, keeping a single memory order.
+static uint64_t mergeSemantics(uint64_t a, uint64_t b) {
+  uint64_t merged = a | b;
+  uint64_t ordering = merged & OrderingSemanticsMask;
+  if (!ordering || isPowerOf2_64(ordering)) {
+    return merged;
+  }
+  merged &= ~OrderingSemanticsMask;
+  if (ordering & MemorySemantics::SequentiallyConsistent) {
+    return merged | MemorySemantics::SequentiallyConsistent;
+  }
+  return merged | MemorySemantics::AcquireRelease;
+}
+
+Optional<uint64_t> SPIRVBarrierElimination::getConstValue(Register reg) const {
+  const MachineInstr *def = MRI->getVRegDef(reg);
+  if (!def) {
+    return None;
+  }
+  if (def->getOpcode() == OpConstantNull) {
+    return 0;
+  }
+  if (def->getOpcode() == OpConstant && def->getNumOperands() == 3) {
+    return def->getOperand(2).getImm();
+  }
+  return None;
+}
+
+// Get the storage semantics of the memory shared between work-items which the
+// instruction may access, or 0 if it only touches private memory.
+unsigned
+SPIRVBarrierElimination::getAccessedMemory(const MachineInstr &MI) const {
+  if (MI.getOpcode() == OpFunctionCall) {
+    return StorageSemanticsMask;
+  }
+  if (isBarrier(MI)) {
+    return 0;
+  }
+  unsigned accessed = 0;
+  for (const MachineOperand &MO : MI.explicit_uses()) {
+    if (!MO.isReg()) {
+      continue;
+    }
+    const MachineInstr *def = MRI->getVRegDef(MO.getReg());
+    if (!def || TII->isTypeDeclInstr(*def) || def->getNumOperands() < 2 ||
+        !def->getOperand(1).isReg()) {
+      continue;
+    }
+    const MachineInstr *typeDef = MRI->getVRegDef(def->getOperand(1).getReg());
+    if (!typeDef) {
+      continue;
+    }
+    switch (typeDef->getOpcode()) {
+    case OpTypeImage:
+    case OpTypeSampledImage:
+      accessed |= MemorySemantics::ImageMemory;
+      continue;
+    case OpTypePointer:
+      break;
+    default:
+      continue;
+    }
+    switch (typeDef->getOperand(1).getImm()) {
+    case StorageClass::Function:
+    case StorageClass::Private:
+    case StorageClass::Input:
+    case StorageClass::UniformConstant:
+    case StorageClass::PushConstant:
+      break;
+    case StorageClass::Workgroup:
+      accessed |= MemorySemantics::WorkgroupMemory;
+      break;
+    case StorageClass::CrossWorkgroup:
+      accessed |= MemorySemantics::CrossWorkgroupMemory;
+      break;
+    case StorageClass::Generic:
+      accessed |= MemorySemantics::WorkgroupMemory |
+                  MemorySemantics::CrossWorkgroupMemory;
+      break;
+    case StorageClass::Image:
+      accessed |= MemorySemantics::ImageMemory;
+      break;
+    default:
+      accessed |= StorageSemanticsMask;
+      break;
+    }
+  }
+  return accessed;
+}
+
+// Replace the semantics of the barrier with a new constant of the same type,
+// which SPIRVGlobalTypesAndRegNum merges with any identical one.
+void SPIRVBarrierElimination::setSemantics(MachineInstr &MI,
+                                           uint64_t semantics) {
+  MachineOperand &semOp = MI.getOperand(getSemanticsIdx(MI));
+  if (getConstValue(semOp.getReg()) == semantics) {
+    return;
+  }
+  const MachineInstr *oldConst = MRI->getVRegDef(semOp.getReg());
+  Register newReg = MRI->createVirtualRegister(&IDRegClass);
+  BuildMI(*MI.getParent(), MI, MI.getDebugLoc(), TII->get(OpConstant))
+      .addDef(newReg)
+      .addUse(oldConst->getOperand(1).getReg())
+      .addImm(semantics);
+  semOp.setReg(newReg);
+}
+
+// Merge two barriers with no shared memory access in between, returning the
+// one left or nullptr if they order different scopes.
+MachineInstr *SPIRVBarrierElimination::mergeBarriers(MachineInstr &first,
+                                                     MachineInstr &second) {
+  // Every operand must be a constant, and the scopes must match
+  for (MachineInstr *MI : {&first, &second}) {
+    for (const MachineOperand &MO : MI->explicit_uses()) {
+      if (!getConstValue(MO.getReg())) {
+        return nullptr;
+      }
+    }
+  }
+  auto getOpValue = [&](const MachineInstr &MI, unsigned idx) {
+    return *getConstValue(MI.getOperand(idx).getReg());
+  };
+  if (getOpValue(first, getMemScopeIdx(first)) !=
+      getOpValue(second, getMemScopeIdx(second))) {
+    return nullptr;
+  }
+  bool bothControl = first.getOpcode() == OpControlBarrier &&
+                     second.getOpcode() == OpControlBarrier;
+  if (bothControl && getOpValue(first, 0) != getOpValue(second, 0)) {
+    return nullptr;
+  }
+
+  // Keep the control barrier if there's one, as a fence can't stand for it
+  bool keepFirst = second.getOpcode() == OpMemoryBarrier ||
+                   first.getOpcode() == OpControlBarrier;
+  MachineInstr &kept = keepFirst ? first : second;
+  MachineInstr &erased = keepFirst ? second : first;
+  setSemantics(kept,
+               mergeSemantics(getOpValue(first, getSemanticsIdx(first)),
+                              getOpValue(second, getSemanticsIdx(second))));
+  erased.eraseFromParent();
+  ++NumMergedBarriers;
+  return &kept;
+}
+
+bool SPIRVBarrierElimination::runOnMachineFunction(MachineFunction &MF) {
+  if (skipFunction(MF.getFunction())) {
+    return false;
+  }
+  MRI = &MF.getRegInfo();
+  TII = static_cast<const SPIRVInstrInfo *>(MF.getSubtarget().getInstrInfo());
+
+  bool changed = false;
+  unsigned accessedInFunc = 0;
+  SmallVector<MachineInstr *, 8> barriers;
+  for (MachineBasicBlock &MBB : MF) {
+    // The last barrier of the block, if no shared memory was accessed since
+    MachineInstr *prev = nullptr;
+    for (MachineInstr &MI : make_early_inc_range(MBB)) {
+      if (isBarrier(MI)) {
+        MachineInstr *merged = prev ? mergeBarriers(*prev, MI) : nullptr;
+        if (merged) {
+          changed = true;
+          if (merged != prev) {
+            barriers.pop_back();
+            barriers.push_back(merged);
+          }
+        } else {
+          barriers.push_back(&MI);
+        }
+        prev = barriers.back();
+        continue;
+      }
+      unsigned accessed = getAccessedMemory(MI);
+      if (accessed) {
+        accessedInFunc |= accessed;
+        prev = nullptr;
+      }
+    }
+  }
+
+  // The semantics of the storage classes a kernel never accesses order
+  // nothing. Other functions may be called after accesses by their caller.
+  if (MF.getFunction().getCallingConv() != CallingConv::SPIR_KERNEL) {
+    return changed;
+  }
+  const uint64_t unusedStorage = StorageSemanticsMask & ~accessedInFunc;
+  for (MachineInstr *MI : barriers) {
+    Register semReg = MI->getOperand(getSemanticsIdx(*MI)).getReg();
+    auto semantics = getConstValue(semReg);
+    if (!semantics || !(*semantics & unusedStorage)) {
+      continue;
+    }
+    uint64_t narrowed = *semantics & ~unusedStorage;
+    // Without any storage class, the memory order is meaningless
+    if (!(narrowed & StorageSemanticsMask)) {
+      narrowed = MemorySemantics::None;
+    }
+    if (!narrowed && MI->getOpcode() == OpMemoryBarrier) {
+      MI->eraseFromParent();
+    } else {
+      setSemantics(*MI, narrowed);
+    }
+    ++NumNarrowedBarriers;
+    changed = true;
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVBarrierElimination, DEBUG_TYPE,
+                "SPIRV remove redundant barriers", false, false)
+
+char SPIRVBarrierElimination::ID = 0;
+
+FunctionPass *llvm::createSPIRVBarrierEliminationPass() {
+  return new SPIRVBarrierElimination();
+}
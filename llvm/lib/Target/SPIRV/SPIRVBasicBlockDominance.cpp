@@ -15,9 +15,16 @@
 // appear before all blocks they dominate". Also, spirv-val will reject SPIR-V
 // files that do not follow this rule.
 //
+// The order is first checked from the predecessors alone, which is enough for
+// the usual CFGs already in order, so the dominator tree is only computed for
+// the functions which need to be sorted.
+//
 //===----------------------------------------------------------------------===//
 
 #include "SPIRV.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Dominators.h"
 
 using namespace llvm;
@@ -29,57 +36,96 @@ class SPIRVBasicBlockDominance : public FunctionPass {
 public:
   static char ID;
   SPIRVBasicBlockDominance() : FunctionPass(ID) {
-    initializeSPIRVBlockLabelerPass(*PassRegistry::getPassRegistry());
+    initializeSPIRVBasicBlockDominancePass(*PassRegistry::getPassRegistry());
   }
   bool runOnFunction(Function &F) override;
-  void getAnalysisUsage(AnalysisUsage &AU) const override {
-    AU.addRequired<DominatorTreeWrapperPass>();
-    FunctionPass::getAnalysisUsage(AU);
-  }
 };
 } // namespace
 
+// Whether each block with predecessors has one placed before it, which was
+// itself checked. The immediate dominator of a block dominates all its
+// predecessors, so it then comes before it too, by induction on the order.
+static bool isOrderedByPredecessors(const Function &F) {
+  SmallPtrSet<const BasicBlock *, 16> ordered;
+  for (const BasicBlock &BB : F) {
+    if (&BB != &F.getEntryBlock() && !pred_empty(&BB) &&
+        none_of(predecessors(&BB),
+                [&](const BasicBlock *pred) { return ordered.count(pred); })) {
+      return false;
+    }
+    ordered.insert(&BB);
+  }
+  return true;
+}
+
 bool SPIRVBasicBlockDominance::runOnFunction(Function &F) {
-  DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  if (isOrderedByPredecessors(F)) {
+    return false;
+  }
+  DominatorTree DT(F);
 
-  // Build up a list of blocks in an order such that they satisfy the SPIR-V
-  // dominance constraint that "blocks appear before all blocks they dominate".
+  // Blocks appear before all blocks they dominate if and only if every
+  // reachable block appears after its immediate dominator, as dominance is the
+  // transitive closure of the immediate dominator relation. Unreachable blocks
+  // have no dominators, so impose no constraints.
   //
-  // Note that this requires n(n-1)/2 = O(n^2) comparisons. We could use fewer
-  // comparisons by iterating over the dominator tree using depth_first from
-  // llvm/ADT/DepthFirstIterator.h. However, this often results in unnecessary
-  // re-ordering of basic blocks that already satisfied the necessary dominance
-  // constraints. We chose to the O(n^2) implementation here to maintain the
-  // natural basic block ordering, and avoid any PassManager state changes that
-  // would be required if we unnecessarily shuffled the basic blocks.
+  // First check this in a single pass, as the natural basic block ordering
+  // usually already satisfies the constraint, and we want to avoid any
+  // PassManager state changes from unnecessarily shuffling the blocks.
+  SmallPtrSet<const BasicBlock *, 16> placedBlocks;
+  bool validOrder = true;
+  for (auto &BB : F) {
+    const auto *node = DT.getNode(&BB);
+    if (node && node->getIDom() &&
+        !placedBlocks.count(node->getIDom()->getBlock())) {
+      validOrder = false;
+      break;
+    }
+    placedBlocks.insert(&BB);
+  }
+  if (validOrder) {
+    return false;
+  }
+
+  // Otherwise, build up a new order in O(n) which moves as few blocks as
+  // possible. Blocks are visited in their original order, and any block
+  // whose immediate dominator has not been placed yet is deferred until just
+  // after it, along with any blocks deferred on the deferred block itself.
   SmallVector<BasicBlock *, 16> newBBOrder;
-  bool changedOrder = false;
+  DenseMap<const BasicBlock *, SmallVector<BasicBlock *, 2>> deferredBlocks;
+  placedBlocks.clear();
+  SmallVector<BasicBlock *, 8> worklist;
   for (auto &BB : F) {
-    bool inserted = false;
-    // Check all previously inserted blocks for dominance
-    for (unsigned i = 0; i < newBBOrder.size(); ++i) {
-      if (DT.dominates(&BB, newBBOrder[i])) { // This should be quite rare
-        newBBOrder.insert(newBBOrder.begin() + i, &BB);
-        inserted = true;
-        changedOrder = true;
-        break;
+    const auto *node = DT.getNode(&BB);
+    if (node && node->getIDom()) {
+      auto idom = node->getIDom()->getBlock();
+      if (!placedBlocks.count(idom)) {
+        deferredBlocks[idom].push_back(&BB);
+        continue;
       }
     }
-    // If we didn't need to insert the BB earlier to satisfy dominance rules, it
-    // can be added to the end to preserve the order it was in previously.
-    if (!inserted) {
-      newBBOrder.push_back(&BB);
+    // Place the block, followed by any blocks waiting on it (depth first, in
+    // their original order).
+    worklist.push_back(&BB);
+    while (!worklist.empty()) {
+      auto placed = worklist.pop_back_val();
+      newBBOrder.push_back(placed);
+      placedBlocks.insert(placed);
+      auto deferred = deferredBlocks.find(placed);
+      if (deferred != deferredBlocks.end()) {
+        worklist.append(deferred->second.rbegin(), deferred->second.rend());
+        deferredBlocks.erase(deferred);
+      }
     }
   }
-  // If we had to re-order anything, rebuild the basic block list
-  if (changedOrder) {
-    for (auto BB : newBBOrder) {
-      BB->removeFromParent();
-      F.getBasicBlockList().push_back(BB);
-    }
+  assert(newBBOrder.size() == F.size() && "Lost blocks while re-ordering");
+
+  // Rebuild the basic block list in the new order
+  for (auto BB : newBBOrder) {
+    BB->removeFromParent();
+    F.getBasicBlockList().push_back(BB);
   }
-  // Only return true if we had to re-order the blocks
-  return changedOrder;
+  return true;
 }
 
 INITIALIZE_PASS(SPIRVBasicBlockDominance, DEBUG_TYPE,
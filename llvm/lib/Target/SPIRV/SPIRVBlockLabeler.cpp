@@ -10,14 +10,17 @@
 // start with an OpLabel, and ends with a suitable terminator (OpBranch is
 // inserted if necessary).
 //
-// All MBB literals in OpBranchConditional, OpBranch, and OpPhi, are also fixed
-// to use the virtual registers defined by OpLabel.
+// All MBB literals in OpBranchConditional, OpBranch, OpSwitch, OpPhi,
+// OpLoopMerge, and OpSelectionMerge, are also fixed to use the virtual
+// registers defined by OpLabel.
 //
 //===----------------------------------------------------------------------===//
 
 #include "SPIRV.h"
 #include "SPIRVRegisterInfo.h"
 
+#include "llvm/ADT/IndexedMap.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/Passes.h"
@@ -32,6 +35,10 @@ using namespace SPIRV;
 
 #define DEBUG_TYPE "spirv-block-label"
 
+STATISTIC(NumLabels, "Number of OpLabels added");
+STATISTIC(NumFallthroughBranches,
+          "Number of OpBranches added for implicit fallthroughs");
+
 namespace {
 class SPIRVBlockLabeler : public MachineFunctionPass {
 public:
@@ -70,62 +77,39 @@ static Register buildLabel(MachineBasicBlock &MBB,
   return labelID;
 }
 
-// Remove one instruction, and insert another in its place
-static void replaceInstr(MachineInstr *toReplace, MachineInstrBuilder &newInstr,
-                         MachineIRBuilder &MIRBuilder) {
-  MIRBuilder.setMBB(*toReplace->getParent());
-  MIRBuilder.setInstr(*toReplace);
-  MIRBuilder.insertInstr(newInstr);
-  toReplace->removeFromParent();
-}
-
-// A unique identifier for MBBs for use as a map key
-using MBB_ID = int;
-
-static Register getLabelIDForMBB(const std::map<MBB_ID, Register> &bbNumMap,
-                                 MBB_ID bbNum) {
-  auto f = bbNumMap.find(bbNum);
-  if (f != bbNumMap.end()) {
-    return f->second;
-  } else {
-    errs() << "MBB Num: = " << bbNum << "\n";
-    llvm_unreachable("MBB number not in MBB to label map.");
-  }
-}
-
-static MBB_ID getMBBID(const MachineBasicBlock &MBB) {
-  return MBB.getNumber(); // Use MBB number as a unique identifier
-}
-
-static MBB_ID getMBBID(const MachineOperand &op) {
-  return getMBBID(*op.getMBB());
-}
-
 // Add OpLabels and terminators. Fix any instructions with MBB references
 bool SPIRVBlockLabeler::runOnMachineFunction(MachineFunction &MF) {
   MachineIRBuilder MIRBuilder;
   MIRBuilder.setMF(MF);
 
-  std::map<MBB_ID, Register> bbNumToLabelMap;
-  SmallVector<MachineInstr *, 4> branches, condBranches, phis;
+  // MBB numbers are dense, so the label IDs are indexed by them directly
+  IndexedMap<Register> bbNumToLabelMap;
+  bbNumToLabelMap.resize(MF.getNumBlockIDs());
+  SmallVector<MachineInstr *, 16> mbbRefInstrs;
 
   for (MachineBasicBlock &MBB : MF) {
     // Add the missing OpLabel in the right place
-    auto labelID = buildLabel(MBB, MIRBuilder);
-    bbNumToLabelMap.insert({getMBBID(MBB), labelID});
+    bbNumToLabelMap[MBB.getNumber()] = buildLabel(MBB, MIRBuilder);
+    ++NumLabels;
     // Record all instructions that need to refer to a MBB label ID
     for (MachineInstr &MI : MBB) {
-      if (MI.getOpcode() == OpBranch) {
-        branches.push_back(&MI);
-      } else if (MI.getOpcode() == OpBranchConditional) {
+      switch (MI.getOpcode()) {
+      case OpBranchConditional:
         // If previous optimizations generated conditionals with implicit
         // fallthrough, add the missing explicit "else" to it valid SPIR-V
         if (MI.getNumOperands() < 3) {
           MI.addOperand(MachineOperand::CreateMBB(MBB.getNextNode()));
         }
-        condBranches.push_back(&MI);
-      } else if (MI.getOpcode() == OpPhi) {
-        phis.push_back(&MI);
+        LLVM_FALLTHROUGH;
+      case OpBranch:
+      case OpSwitch:
+      case OpPhi:
+      case OpLoopMerge:
+      case OpSelectionMerge:
+        mbbRefInstrs.push_back(&MI);
+        break;
+      default:
+        break;
       }
     }
 
@@ -133,44 +117,23 @@ bool SPIRVBlockLabeler::runOnMachineFunction(MachineFunction &MF) {
     if (!MBB.getLastNonDebugInstr()->isTerminator()) {
       MIRBuilder.setMBB(MBB); // Insert at end of block
       auto MIB = MIRBuilder.buildInstr(OpBranch).addMBB(MBB.getNextNode());
-      branches.push_back(MIB);
+      mbbRefInstrs.push_back(MIB);
+      ++NumFallthroughBranches;
     }
   }
 
-  // Replace MBB references with label IDs in OpBranch instructions
-  for (const auto &branch : branches) {
-    auto bbNum = getMBBID(branch->getOperand(0));
-    Register bbID = getLabelIDForMBB(bbNumToLabelMap, bbNum);
-    auto MIB = MIRBuilder.buildInstrNoInsert(OpBranch).addUse(bbID);
-    replaceInstr(branch, MIB, MIRBuilder);
-  }
-
-  // Replace MBB references with label IDs in OpBranchConditional instructions
-  for (const auto &branch : condBranches) {
-    auto bbNum0 = getMBBID(branch->getOperand(1));
-    auto bbNum1 = getMBBID(branch->getOperand(2));
-    auto MIB = MIRBuilder.buildInstrNoInsert(OpBranchConditional)
-                   .addUse(branch->getOperand(0).getReg())
-                   .addUse(getLabelIDForMBB(bbNumToLabelMap, bbNum0))
-                   .addUse(getLabelIDForMBB(bbNumToLabelMap, bbNum1));
-    replaceInstr(branch, MIB, MIRBuilder);
-  }
-
-  // Replace MBB references with label IDs in OpPhi instructions
-  for (const auto &phi : phis) {
-    auto MIB = MIRBuilder.buildInstrNoInsert(OpPhi)
-                   .addDef(phi->getOperand(0).getReg())
-                   .addUse(phi->getOperand(1).getReg());
-
-    // PHIs require def, type, and list of (val, MBB) pairs
-    const unsigned numOps = phi->getNumOperands();
-    assert(((numOps % 2) == 0) && "Require even num operands for PHI instrs");
-    for (unsigned i = 2; i < numOps; i += 2) {
-      MIB.addUse(phi->getOperand(i).getReg());
-      auto bbNum = getMBBID(phi->getOperand(i + 1));
-      MIB.addUse(getLabelIDForMBB(bbNumToLabelMap, bbNum));
+  // Replace MBB references with label IDs in OpBranch, OpBranchConditional,
+  // OpSwitch, OpPhi, OpLoopMerge and OpSelectionMerge instructions. The
+  // operands are patched in place, keeping every other operand as it is.
+  for (MachineInstr *MI : mbbRefInstrs) {
+    for (MachineOperand &op : MI->operands()) {
+      if (!op.isMBB()) {
+        continue;
+      }
+      Register labelID = bbNumToLabelMap[op.getMBB()->getNumber()];
+      assert(labelID.isValid() && "MBB number not in MBB to label map.");
+      op.ChangeToRegister(labelID, false);
     }
-    replaceInstr(phi, MIB, MIRBuilder);
   }
 
   // Add OpFunctionEnd at the end of the last MBB
@@ -0,0 +1,250 @@
+//===-- SPIRVBlockProfiling.cpp - Count block executions on device -*- C++ -*-//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// With -spirv-profile, instrument every basic block, or every loop header, to
+// count how often it runs on the device. The counters are the elements of a
+// CrossWorkgroup array exported as __spirv_profile_counters, which the host
+// reads back after the kernels ran. Each instrumented block increments its
+// counter with a relaxed, device scope OpAtomicIAdd, and the function and block
+// of each counter are written to the -spirv-profile-map file as JSON.
+//
+// Blocks every work-item of a kernel runs once, i.e. those post-dominating the
+// entry block outside of any loop, are reached by whole subgroups. If the
+// Groups capability is available, one work-item per subgroup adds the number
+// of work-items in it instead, so there is a single atomic per subgroup.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-block-profiling"
+
+STATISTIC(NumCounters, "Number of basic block execution counters");
+STATISTIC(NumAggregatedCounters,
+          "Number of counters incremented once per subgroup");
+
+namespace {
+enum class ProfilingMode { None, Blocks, LoopHeaders };
+} // namespace
+
+static cl::opt<ProfilingMode> Profiling(
+    "spirv-profile", cl::Hidden, cl::init(ProfilingMode::None),
+    cl::desc("Count the executions of basic blocks on the device"),
+    cl::values(clEnumValN(ProfilingMode::Blocks, "blocks",
+                          "Count the executions of every basic block"),
+               clEnumValN(ProfilingMode::LoopHeaders, "loops",
+                          "Count the executions of loop headers")));
+
+static cl::opt<std::string> ProfileMapFile(
+    "spirv-profile-map", cl::Hidden, cl::value_desc("filename"),
+    cl::init("spirv-profile-map.json"),
+    cl::desc("Write the function and block of each -spirv-profile counter, as "
+             "JSON, to the given file"));
+
+static const char *CountersName = "__spirv_profile_counters";
+
+namespace {
+// A block to count the executions of, and whether all of the work-items of a
+// subgroup reach it together.
+struct ProfiledBlock {
+  BasicBlock *BB;
+  std::string name;
+  bool isUniform;
+};
+
+class SPIRVBlockProfiling : public ModulePass {
+public:
+  static char ID;
+  SPIRVBlockProfiling() : ModulePass(ID) {
+    initializeSPIRVBlockProfilingPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.addRequired<LoopInfoWrapperPass>();
+    AU.addRequired<PostDominatorTreeWrapperPass>();
+    ModulePass::getAnalysisUsage(AU);
+  }
+
+private:
+  void collectBlocks(Function &F, std::vector<ProfiledBlock> &blocks);
+  void instrumentBlock(const ProfiledBlock &block, GlobalVariable *counters,
+                       unsigned index, bool aggregate);
+};
+} // namespace
+
+void SPIRVBlockProfiling::collectBlocks(Function &F,
+                                        std::vector<ProfiledBlock> &blocks) {
+  const LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+  const PostDominatorTree &PDT =
+      getAnalysis<PostDominatorTreeWrapperPass>(F).getPostDomTree();
+  const bool isKernel = F.getCallingConv() == CallingConv::SPIR_KERNEL;
+  const BasicBlock *entry = &F.getEntryBlock();
+
+  unsigned blockIndex = 0;
+  for (BasicBlock &BB : F) {
+    const unsigned index = blockIndex++;
+    if (Profiling == ProfilingMode::LoopHeaders && !LI.isLoopHeader(&BB)) {
+      continue;
+    }
+    std::string name =
+        BB.hasName() ? BB.getName().str() : "bb" + std::to_string(index);
+    bool isUniform =
+        isKernel && !LI.getLoopFor(&BB) && PDT.dominates(&BB, entry);
+    blocks.push_back({&BB, std::move(name), isUniform});
+  }
+}
+
+// Declare the OpenCL builtin with the given mangled name, which takes and
+// returns unsigned ints.
+static FunctionCallee getBuiltin(Module &M, StringRef mangledName,
+                                 unsigned numArgs) {
+  Type *int32Ty = Type::getInt32Ty(M.getContext());
+  SmallVector<Type *, 1> argTys(numArgs, int32Ty);
+  FunctionCallee callee = M.getOrInsertFunction(
+      mangledName, FunctionType::get(int32Ty, argTys, false));
+  cast<Function>(callee.getCallee())->setCallingConv(CallingConv::SPIR_FUNC);
+  return callee;
+}
+
+void SPIRVBlockProfiling::instrumentBlock(const ProfiledBlock &block,
+                                          GlobalVariable *counters,
+                                          unsigned index, bool aggregate) {
+  Module &M = *counters->getParent();
+  // Keep the static allocas of the entry block in it if it gets split
+  BasicBlock::iterator insertPt = block.BB->getFirstInsertionPt();
+  while (isa<AllocaInst>(insertPt)) {
+    ++insertPt;
+  }
+  IRBuilder<> B(&*insertPt);
+  Value *counter = B.CreateConstInBoundsGEP2_32(counters->getValueType(),
+                                                counters, 0, index);
+  Value *increment = B.getInt32(1);
+  if (aggregate) {
+    // Count the work-items of the subgroup, and let its first one add them
+    FunctionCallee reduceAdd = getBuiltin(M, "_Z20sub_group_reduce_addj", 1);
+    FunctionCallee localId = getBuiltin(M, "_Z22get_sub_group_local_idv", 0);
+    CallInst *count = B.CreateCall(reduceAdd, {increment});
+    count->setCallingConv(CallingConv::SPIR_FUNC);
+    CallInst *id = B.CreateCall(localId);
+    id->setCallingConv(CallingConv::SPIR_FUNC);
+    Value *isFirst = B.CreateICmpEQ(id, B.getInt32(0));
+    Instruction *thenTerm =
+        SplitBlockAndInsertIfThen(isFirst, &*B.GetInsertPoint(), false);
+    B.SetInsertPoint(thenTerm);
+    increment = count;
+    ++NumAggregatedCounters;
+  }
+  B.CreateAtomicRMW(AtomicRMWInst::Add, counter, increment,
+                    AtomicOrdering::Monotonic);
+  ++NumCounters;
+}
+
+// Write the function and block of each counter, in counter order, to the
+// -spirv-profile-map file.
+static void writeProfileMap(const Module &M,
+                            ArrayRef<std::pair<StringRef, ProfiledBlock>> map) {
+  std::error_code EC;
+  raw_fd_ostream out(ProfileMapFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    report_fatal_error("Can't open the SPIR-V profile map " + ProfileMapFile +
+                       ": " + EC.message());
+  }
+
+  json::OStream J(out, 2);
+  J.object([&] {
+    J.attribute("module", M.getModuleIdentifier());
+    J.attribute("counters", CountersName);
+    J.attributeArray("blocks", [&] {
+      for (unsigned i = 0; i < map.size(); ++i) {
+        J.object([&] {
+          J.attribute("index", i);
+          J.attribute("function", map[i].first);
+          J.attribute("block", map[i].second.name);
+        });
+      }
+    });
+  });
+  out << '\n';
+}
+
+bool SPIRVBlockProfiling::runOnModule(Module &M) {
+  if (Profiling == ProfilingMode::None) {
+    return false;
+  }
+
+  // Collect every block first, as instrumenting them changes the CFG the
+  // analyses of their function describe
+  std::vector<std::pair<StringRef, ProfiledBlock>> map;
+  for (Function &F : M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    std::vector<ProfiledBlock> blocks;
+    collectBlocks(F, blocks);
+    for (ProfiledBlock &block : blocks) {
+      map.push_back({F.getName(), std::move(block)});
+    }
+  }
+  writeProfileMap(M, map);
+  if (map.empty()) {
+    return false;
+  }
+
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  const SPIRVSubtarget &ST = *TM.getSubtargetImpl();
+  const bool canAggregate = ST.canUseCapability(Capability::Groups) &&
+                            ST.canUseExtInstSet(ExtInstSet::OpenCL_std);
+  const unsigned crossWorkgroupAS =
+      ST.getSPIRVTypeRegistry()->StorageClassToAddressSpace(
+          StorageClass::CrossWorkgroup);
+
+  auto *countersTy = ArrayType::get(Type::getInt32Ty(M.getContext()),
+                                    map.size());
+  auto *counters = new GlobalVariable(
+      M, countersTy, false, GlobalValue::ExternalLinkage,
+      ConstantAggregateZero::get(countersTy), CountersName, nullptr,
+      GlobalValue::NotThreadLocal, crossWorkgroupAS);
+
+  for (unsigned i = 0; i < map.size(); ++i) {
+    const ProfiledBlock &block = map[i].second;
+    instrumentBlock(block, counters, i, canAggregate && block.isUniform);
+  }
+  return true;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVBlockProfiling, DEBUG_TYPE,
+                      "SPIRV count block executions", false, false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(PostDominatorTreeWrapperPass)
+INITIALIZE_PASS_END(SPIRVBlockProfiling, DEBUG_TYPE,
+                    "SPIRV count block executions", false, false)
+
+char SPIRVBlockProfiling::ID = 0;
+
+ModulePass *llvm::createSPIRVBlockProfilingPass() {
+  return new SPIRVBlockProfiling();
+}
@@ -0,0 +1,159 @@
+//===-- SPIRVByValCopyElimination.cpp - Elide byval copies ------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Remove the private copies kernels make of their byval struct arguments, by
+// reading them through the argument instead. Frontends copy such an argument
+// into an alloca with a memcpy, and SROA can only remove the copy when the
+// struct is split into scalars, so e.g. a struct with an array indexed at
+// runtime stays a Function storage OpVariable every work item copies the whole
+// argument into.
+//
+// An alloca is replaced by the argument when its only write is a memcpy of
+// the whole argument into it, and it's otherwise only loaded from or copied
+// from, while nothing writes the argument or lets its address escape. Both
+// then hold the same value for the whole kernel.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-byval-copy-elimination"
+
+STATISTIC(NumCopiesRemoved, "Number of private copies of byval args removed");
+STATISTIC(NumBytesSaved, "Number of bytes of private memory saved");
+
+namespace {
+class SPIRVByValCopyElimination : public FunctionPass {
+public:
+  static char ID;
+  SPIRVByValCopyElimination() : FunctionPass(ID) {
+    initializeSPIRVByValCopyEliminationPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+// Whether the memory ptr points to is only read, through loads and as the
+// source of copies, apart from the ignored instruction, calling visit on each
+// copy into other memory. The lifetime markers of ptr are collected in
+// markers, if given.
+template <typename Visit>
+static bool isOnlyRead(Value *ptr, const Instruction *ignored, Visit visit,
+                       SmallVectorImpl<IntrinsicInst *> *markers = nullptr) {
+  SmallVector<Value *, 8> worklist{ptr};
+  while (!worklist.empty()) {
+    Value *V = worklist.pop_back_val();
+    for (User *U : V->users()) {
+      if (U == ignored) {
+        continue;
+      }
+      if (isa<BitCastInst>(U) || isa<GetElementPtrInst>(U)) {
+        worklist.push_back(U);
+      } else if (auto *LI = dyn_cast<LoadInst>(U)) {
+        if (LI->isVolatile()) {
+          return false;
+        }
+      } else if (auto *MTI = dyn_cast<MemTransferInst>(U)) {
+        if (MTI->isVolatile() || MTI->getRawDest() == V) {
+          return false;
+        }
+        visit(*MTI);
+      } else if (auto *II = dyn_cast<IntrinsicInst>(U)) {
+        if (!markers || (II->getIntrinsicID() != Intrinsic::lifetime_start &&
+                         II->getIntrinsicID() != Intrinsic::lifetime_end)) {
+          return false;
+        }
+        markers->push_back(II);
+      } else {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool SPIRVByValCopyElimination::runOnFunction(Function &F) {
+  if (skipFunction(F) || F.getCallingConv() != CallingConv::SPIR_KERNEL) {
+    return false;
+  }
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  bool changed = false;
+  for (Argument &Arg : F.args()) {
+    if (!Arg.hasByValAttr()) {
+      continue;
+    }
+    const uint64_t size = DL.getTypeAllocSize(Arg.getParamByValType());
+
+    // Find the copies of the whole argument to the start of an alloca
+    SmallVector<std::pair<MemCpyInst *, AllocaInst *>, 2> copies;
+    auto findCopy = [&](MemTransferInst &MTI) {
+      auto *MCI = dyn_cast<MemCpyInst>(&MTI);
+      auto *AI = dyn_cast<AllocaInst>(MTI.getRawDest()->stripPointerCasts());
+      auto *len = dyn_cast<ConstantInt>(MTI.getLength());
+      if (!MCI || !AI || !len || len->getZExtValue() != size ||
+          MTI.getRawSource()->stripPointerCasts() != &Arg ||
+          !AI->isStaticAlloca() ||
+          AI->getType()->getAddressSpace() !=
+              Arg.getType()->getPointerAddressSpace()) {
+        return;
+      }
+      auto allocaBits = AI->getAllocationSizeInBits(DL);
+      if (allocaBits && *allocaBits == size * 8) {
+        copies.push_back({MCI, AI});
+      }
+    };
+    if (!isOnlyRead(&Arg, nullptr, findCopy)) {
+      continue;
+    }
+
+    for (const auto &copy : copies) {
+      MemCpyInst *MCI = copy.first;
+      AllocaInst *AI = copy.second;
+      SmallVector<IntrinsicInst *, 4> markers;
+      if (!isOnlyRead(AI, MCI, [](MemTransferInst &) {}, &markers)) {
+        continue;
+      }
+      MCI->eraseFromParent();
+      for (IntrinsicInst *II : markers) {
+        II->eraseFromParent();
+      }
+      Value *replacement = &Arg;
+      if (AI->getType() != Arg.getType()) {
+        replacement = new BitCastInst(&Arg, AI->getType(), "", AI);
+        replacement->takeName(AI);
+      }
+      AI->replaceAllUsesWith(replacement);
+      AI->eraseFromParent();
+      ++NumCopiesRemoved;
+      NumBytesSaved += size;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVByValCopyElimination, DEBUG_TYPE,
+                "SPIRV read byval kernel args in place", false, false)
+
+char SPIRVByValCopyElimination::ID = 0;
+
+FunctionPass *llvm::createSPIRVByValCopyEliminationPass() {
+  return new SPIRVByValCopyElimination();
+}
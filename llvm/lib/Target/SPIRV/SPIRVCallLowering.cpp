@@ -13,6 +13,7 @@
 
 #include "SPIRVCallLowering.h"
 #include "SPIRV.h"
+#include "SPIRVEnumRequirements.h"
 #include "SPIRVEnums.h"
 #include "SPIRVISelLowering.h"
 #include "SPIRVOpenCLBIFs.h"
@@ -20,11 +21,15 @@
 #include "SPIRVStrings.h"
 #include "SPIRVSubtarget.h"
 #include "SPIRVTypeRegistry.h"
-
-#include "llvm/Demangle/Demangle.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Target/TargetMachine.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "spirv-call-lowering"
+
 SPIRVCallLowering::SPIRVCallLowering(const SPIRVTargetLowering &TLI,
                                      SPIRVTypeRegistry *TR)
     : CallLowering(&TLI), TR(TR) {}
@@ -42,24 +47,270 @@ bool SPIRVCallLowering::lowerReturn(MachineIRBuilder &MIRBuilder,
   }
 }
 
-// Based on the LLVM function attributes, get a SPIR-V FunctionControl
+static cl::opt<unsigned> InlineHintThreshold(
+    "spirv-inline-hint-threshold", cl::Hidden, cl::init(32),
+    cl::desc("Maximum number of instructions in a helper function with a "
+             "single caller for it to get the Inline function control"));
+
+// Whether F is a small helper function only called from one place, which
+// would likely be inlined by the consumer anyway.
+static bool isSmallSingleCallerHelper(const Function &F) {
+  if (F.isDeclaration() || F.getCallingConv() == CallingConv::SPIR_KERNEL ||
+      !F.hasOneUse() || F.getInstructionCount() > InlineHintThreshold) {
+    return false;
+  }
+  const auto *CB = dyn_cast<CallBase>(*F.user_begin());
+  return CB && CB->getCalledFunction() == &F;
+}
+
+// Based on the LLVM function attributes, get a SPIR-V FunctionControl. The
+// memory attributes are also inferred for functions without them by the
+// FunctionAttrs pass run before selection.
 static uint32_t getFunctionControl(const Function &F) {
   uint32_t funcControl = FunctionControl::None;
-  if (F.hasFnAttribute(Attribute::AttrKind::AlwaysInline)) {
+  if (F.hasFnAttribute(Attribute::AttrKind::NoInline)) {
+    funcControl |= FunctionControl::DontInline;
+  } else if (F.hasFnAttribute(Attribute::AttrKind::AlwaysInline) ||
+             isSmallSingleCallerHelper(F)) {
     funcControl |= FunctionControl::Inline;
   }
-  if (F.hasFnAttribute(Attribute::AttrKind::ReadNone)) {
+  if (F.doesNotAccessMemory()) {
     funcControl |= FunctionControl::Const;
-  }
-  if (F.hasFnAttribute(Attribute::AttrKind::ReadOnly)) {
+  } else if (F.onlyReadsMemory()) {
     funcControl |= FunctionControl::Pure;
   }
-  if (F.hasFnAttribute(Attribute::AttrKind::NoInline)) {
-    funcControl |= FunctionControl::DontInline;
-  }
   return funcControl;
 }
 
+// Get the integer operands of kernel metadata such as reqd_work_group_size
+static SmallVector<uint32_t, 3> getMDOperandsAsUInts(const MDNode *node) {
+  SmallVector<uint32_t, 3> vals;
+  for (const auto &op : node->operands()) {
+    if (auto *val = mdconst::dyn_extract<ConstantInt>(op)) {
+      vals.push_back(val->getZExtValue());
+    }
+  }
+  return vals;
+}
+
+// Encode a vec_type_hint type as in the OpenCL SPIR-V environment spec: the
+// scalar type in the low 16 bits, and the number of components in the high 16
+// bits (0 for scalars).
+static uint32_t encodeVecTypeHint(Type *ty) {
+  if (auto *vecTy = dyn_cast<VectorType>(ty)) {
+    return (vecTy->getNumElements() << 16) |
+           encodeVecTypeHint(vecTy->getElementType());
+  } else if (ty->isHalfTy()) {
+    return 4;
+  } else if (ty->isFloatTy()) {
+    return 5;
+  } else if (ty->isDoubleTy()) {
+    return 6;
+  }
+  switch (ty->getIntegerBitWidth()) {
+  case 8:
+    return 0;
+  case 16:
+    return 1;
+  case 32:
+    return 2;
+  case 64:
+    return 3;
+  default:
+    llvm_unreachable("Unsupported vec_type_hint type");
+  }
+}
+
+static cl::opt<unsigned> DefaultLocalSize(
+    "spirv-default-local-size", cl::Hidden, cl::init(64),
+    cl::desc("Number of work-items in the work-groups of GLCompute entry "
+             "points without a reqd_work_group_size or work_group_size_hint"));
+
+static void buildExecutionMode(Register funcVReg,
+                               ExecutionMode::ExecutionMode em,
+                               ArrayRef<uint32_t> literals,
+                               const SPIRVSubtarget &ST,
+                               MachineIRBuilder &MIRBuilder) {
+  if (!canUseExecutionMode(em, ST)) {
+    return;
+  }
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpExecutionMode)
+                 .addUse(funcVReg)
+                 .addImm(em);
+  for (auto literal : literals) {
+    MIB.addImm(literal);
+  }
+}
+
+// Add the OpExecutionModes for an entry point, based on the kernel's metadata
+// and the target options.
+static void addExecutionModes(const Function &F, Register funcVReg,
+                              const SPIRVSubtarget &ST,
+                              MachineIRBuilder &MIRBuilder) {
+  namespace EM = ExecutionMode;
+  if (auto *node = F.getMetadata("reqd_work_group_size")) {
+    auto sizes = getMDOperandsAsUInts(node);
+    sizes.resize(3, 1);
+    buildExecutionMode(funcVReg, EM::LocalSize, sizes, ST, MIRBuilder);
+  } else if (!ST.isKernel()) {
+    // GLCompute entry points must give the size of their work-groups, which
+    // the hint is the best guess for
+    SmallVector<uint32_t, 3> sizes = {DefaultLocalSize};
+    if (auto *node = F.getMetadata("work_group_size_hint")) {
+      sizes = getMDOperandsAsUInts(node);
+    }
+    sizes.resize(3, 1);
+    buildExecutionMode(funcVReg, EM::LocalSize, sizes, ST, MIRBuilder);
+  }
+  if (auto *node = F.getMetadata("work_group_size_hint")) {
+    auto sizes = getMDOperandsAsUInts(node);
+    sizes.resize(3, 1);
+    buildExecutionMode(funcVReg, EM::LocalSizeHint, sizes, ST, MIRBuilder);
+  }
+  if (auto *node = F.getMetadata("intel_reqd_sub_group_size")) {
+    auto size = getMDOperandsAsUInts(node);
+    if (!size.empty()) {
+      buildExecutionMode(funcVReg, EM::SubgroupSize, size[0], ST, MIRBuilder);
+    }
+  }
+  if (auto *node = F.getMetadata("vec_type_hint")) {
+    if (node->getNumOperands() > 0) {
+      Type *hintTy = mdconst::extract<Constant>(node->getOperand(0))->getType();
+      buildExecutionMode(funcVReg, EM::VecTypeHint, encodeVecTypeHint(hintTy),
+                         ST, MIRBuilder);
+    }
+  }
+
+  // SPIR-V allows contraction by default, so only forbid it when FP op
+  // fusion was explicitly disabled (e.g. with -ffp-contract=off)
+  const auto &Options = MIRBuilder.getMF().getTarget().Options;
+  if (Options.AllowFPOpFusion == FPOpFusion::Strict) {
+    buildExecutionMode(funcVReg, EM::ContractionOff, {}, ST, MIRBuilder);
+  }
+}
+
+static void buildParamDecoration(Register paramVReg, Decoration::Decoration dec,
+                                 ArrayRef<uint32_t> literals,
+                                 MachineIRBuilder &MIRBuilder) {
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpDecorate)
+                 .addUse(paramVReg)
+                 .addImm(dec);
+  for (auto literal : literals) {
+    MIB.addImm(literal);
+  }
+}
+
+// Based on the LLVM argument attributes, decorate the OpFunctionParameter with
+// FuncParamAttr, Restrict, NonWritable and Alignment, if the subtarget
+// supports them.
+static void addParamDecorations(const Argument &Arg, Register paramVReg,
+                                const SPIRVSubtarget &ST,
+                                MachineIRBuilder &MIRBuilder) {
+  namespace FPA = FunctionParameterAttribute;
+  SmallVector<FPA::FunctionParameterAttribute, 4> attrs;
+  if (Arg.hasZExtAttr()) {
+    attrs.push_back(FPA::Zext);
+  }
+  if (Arg.hasSExtAttr()) {
+    attrs.push_back(FPA::Sext);
+  }
+  if (Arg.getType()->isPointerTy()) {
+    if (Arg.hasByValAttr()) {
+      attrs.push_back(FPA::ByVal);
+    }
+    if (Arg.hasStructRetAttr()) {
+      attrs.push_back(FPA::Sret);
+    }
+    if (Arg.hasNoAliasAttr()) {
+      attrs.push_back(FPA::NoAlias);
+    }
+    if (Arg.hasNoCaptureAttr()) {
+      attrs.push_back(FPA::NoCapture);
+    }
+    if (Arg.hasAttribute(Attribute::ReadNone)) {
+      attrs.push_back(FPA::NoReadWrite);
+    } else if (Arg.onlyReadsMemory()) {
+      attrs.push_back(FPA::NoWrite);
+    }
+  }
+
+  bool hasNoAlias = false;
+  bool hasNoWrite = false;
+  if (canUseDecoration(Decoration::FuncParamAttr, ST)) {
+    for (auto attr : attrs) {
+      if (canUseFunctionParameterAttribute(attr, ST)) {
+        buildParamDecoration(paramVReg, Decoration::FuncParamAttr, {attr},
+                             MIRBuilder);
+        hasNoAlias |= attr == FPA::NoAlias;
+        hasNoWrite |= attr == FPA::NoWrite || attr == FPA::NoReadWrite;
+      }
+    }
+  }
+  // Shaders can't use FuncParamAttr, but can still mark restrict and read-only
+  // pointers. PostOrderFunctionAttrs infers readonly for the pointers which
+  // are never written through.
+  if (Arg.hasNoAliasAttr() && !hasNoAlias && Arg.getType()->isPointerTy() &&
+      canUseDecoration(Decoration::Restrict, ST)) {
+    buildParamDecoration(paramVReg, Decoration::Restrict, {}, MIRBuilder);
+  }
+  if (Arg.onlyReadsMemory() && !hasNoWrite && Arg.getType()->isPointerTy() &&
+      canUseDecoration(Decoration::NonWritable, ST)) {
+    buildParamDecoration(paramVReg, Decoration::NonWritable, {}, MIRBuilder);
+  }
+
+  unsigned align = Arg.getParamAlignment();
+  if (align > 1 && Arg.getType()->isPointerTy() &&
+      canUseDecoration(Decoration::Alignment, ST)) {
+    buildParamDecoration(paramVReg, Decoration::Alignment, {align}, MIRBuilder);
+  }
+}
+
+static cl::opt<uint64_t> MaxBufferByteOffset(
+    "spirv-max-byte-offset", cl::Hidden, cl::init(0),
+    cl::desc("Cap the byte offsets from the global and constant buffer "
+             "arguments of kernels, decorating them with MaxByteOffset"));
+
+// Get the largest byte offset the kernel argument Arg can be accessed at, from
+// its "spirv-max-byte-offset" attribute or -spirv-max-byte-offset, or 0 if
+// it's unbounded
+static uint64_t getMaxByteOffset(const Argument &Arg) {
+  const Function &F = *Arg.getParent();
+  Attribute attr = F.getAttributes().getParamAttr(Arg.getArgNo(),
+                                                  "spirv-max-byte-offset");
+  uint64_t maxOffset = MaxBufferByteOffset;
+  if (attr.isStringAttribute() &&
+      attr.getValueAsString().getAsInteger(10, maxOffset)) {
+    report_fatal_error("Invalid spirv-max-byte-offset on an argument of " +
+                       F.getName());
+  }
+  return maxOffset;
+}
+
+// Decorate the buffer arguments of kernels with MaxByteOffset, when their size
+// is bounded by the user, so drivers can compute the addresses of their
+// accesses as 32-bit offsets on spirv64.
+static void addMaxByteOffsetDecoration(const Argument &Arg, Register paramVReg,
+                                       const SPIRVSubtarget &ST,
+                                       SPIRVTypeRegistry *TR,
+                                       MachineIRBuilder &MIRBuilder) {
+  auto *ptrTy = dyn_cast<PointerType>(Arg.getType());
+  if (!ptrTy || Arg.hasByValAttr() ||
+      !canUseDecoration(Decoration::MaxByteOffset, ST)) {
+    return;
+  }
+  const auto sc = TR->addressSpaceToStorageClass(ptrTy->getAddressSpace());
+  if (sc != StorageClass::CrossWorkgroup &&
+      sc != StorageClass::UniformConstant) {
+    return;
+  }
+  const uint64_t maxOffset = getMaxByteOffset(Arg);
+  if (maxOffset == 0 || maxOffset > UINT32_MAX) {
+    return;
+  }
+  buildParamDecoration(paramVReg, Decoration::MaxByteOffset,
+                       {static_cast<uint32_t>(maxOffset)}, MIRBuilder);
+}
+
 bool SPIRVCallLowering::lowerFormalArguments(
     MachineIRBuilder &MIRBuilder, const Function &F,
     ArrayRef<ArrayRef<Register>> VRegs) const {
@@ -99,28 +350,42 @@ bool SPIRVCallLowering::lowerFormalArguments(
       .addImm(funcControl)
       .addUse(TR->getSPIRVTypeID(funcTy));
 
-  // Add OpFunctionParameters
+  // Add OpFunctionParameters, and decorate them based on their attributes.
+  // The decorations get hoisted to the module's annotations later.
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
   const unsigned int numArgs = argTypeVRegs.size();
   for (unsigned int i = 0; i < numArgs; ++i) {
     assert(VRegs[i].size() == 1 && "Formal arg has multiple vregs");
     MIRBuilder.buildInstr(SPIRV::OpFunctionParameter)
         .addDef(VRegs[i][0])
         .addUse(argTypeVRegs[i]);
+    addParamDecorations(*F.getArg(i), VRegs[i][0], ST, MIRBuilder);
+    if (F.getCallingConv() == CallingConv::SPIR_KERNEL) {
+      addMaxByteOffsetDecoration(*F.getArg(i), VRegs[i][0], ST, TR,
+                                 MIRBuilder);
+    }
   }
 
+  // Handle entry points and function linkage
+  const bool isEntryPoint = F.getCallingConv() == CallingConv::SPIR_KERNEL;
+  const bool hasLinkage =
+      F.getLinkage() == GlobalValue::LinkageTypes::ExternalLinkage &&
+      canUseDecoration(Decoration::LinkageAttributes, ST);
+
   // Name the function
   if (F.hasName()) {
-    buildOpName(funcVReg, F.getName(), MIRBuilder);
+    buildOpName(funcVReg, F.getName(), MIRBuilder, isEntryPoint || hasLinkage);
   }
 
-  // Handle entry points and function linkage
-  if (F.getCallingConv() == CallingConv::SPIR_KERNEL) {
-    auto execModel = ExecutionModel::Kernel;
+  if (isEntryPoint) {
+    auto execModel =
+        ST.isKernel() ? ExecutionModel::Kernel : ExecutionModel::GLCompute;
     auto MIB = MIRBuilder.buildInstr(SPIRV::OpEntryPoint)
                    .addImm(execModel)
                    .addUse(funcVReg);
     addStringImm(F.getName(), MIB);
-  } else if (F.getLinkage() == GlobalValue::LinkageTypes::ExternalLinkage) {
+    addExecutionModes(F, funcVReg, ST, MIRBuilder);
+  } else if (hasLinkage) {
     auto MIB = MIRBuilder.buildInstr(SPIRV::OpDecorate)
                    .addUse(funcVReg)
                    .addImm(Decoration::LinkageAttributes);
@@ -132,6 +397,28 @@ bool SPIRVCallLowering::lowerFormalArguments(
   return true;
 }
 
+const Optional<OpenCLBuiltinName> &
+SPIRVCallLowering::getBuiltinName(StringRef name) const {
+  auto inserted = BuiltinNames.try_emplace(name);
+  if (inserted.second) {
+    auto &builtin = inserted.first->second;
+    builtin = parseOpenCLBuiltinName(name);
+    // Unmangled names starting with "__" are also builtins, with no param info
+    if (!builtin.hasValue() && name.startswith("__")) {
+      builtin = OpenCLBuiltinName();
+      builtin->name = name;
+    }
+    // Builtins without a native lowering, and other mangled functions, are
+    // called like any other function. If they are only declared, the
+    // declaration gets Import linkage, so it can be linked against a SPIR-V
+    // builtin library such as libclc
+    if (builtin.hasValue() && !isLoweredOpenCLBuiltin(*builtin)) {
+      builtin = None;
+    }
+  }
+  return inserted.first->second;
+}
+
 bool SPIRVCallLowering::lowerCall(MachineIRBuilder &MIRBuilder,
                                   CallingConv::ID CallConv,
                                   const MachineOperand &Callee,
@@ -141,45 +428,66 @@ bool SPIRVCallLowering::lowerCall(MachineIRBuilder &MIRBuilder,
 
   auto funcName = Callee.getGlobal()->getGlobalIdentifier();
 
-  size_t n;
-  int status;
-  char *demangledName = itaniumDemangle(funcName.c_str(), nullptr, &n, &status);
+  // Functions defined in the module are called like any other, even if they
+  // have the name of a builtin
+  const auto *calleeFunc = dyn_cast<Function>(Callee.getGlobal());
+  const bool isBuiltin = (!calleeFunc || calleeFunc->isDeclaration()) &&
+                         getBuiltinName(funcName).hasValue();
 
   assert(OrigRet.Regs.size() < 2 && "Call returns multiple vregs");
 
   Register resVReg = OrigRet.Regs.empty() ? Register(0) : OrigRet.Regs[0];
-  bool doubleUnderscore =
-      funcName.size() >= 2 && funcName[0] == '_' && funcName[1] == '_';
-  if (status == demangle_success || doubleUnderscore) {
+  if (isBuiltin) {
+    const auto &builtin = *getBuiltinName(funcName);
     const auto &MF = MIRBuilder.getMF();
     const auto *ST = static_cast<const SPIRVSubtarget *>(&MF.getSubtarget());
-    if (ST->canUseExtInstSet(ExtInstSet::OpenCL_std)) {
+    // Shaders only import GLSL.std.450, but still have the builtins which are
+    // loads of their builtin variables, or core instructions
+    if (ST->canUseExtInstSet(ExtInstSet::OpenCL_std) ||
+        (!ST->isKernel() && isShaderOpenCLBuiltin(builtin))) {
       // Mangled names are for OpenCL builtins, so pass off to OpenCLBIFs.cpp
       SmallVector<Register, 8> argVRegs;
       for (auto Arg : OrigArgs) {
         assert(Arg.Regs.size() == 1 && "Call arg has multiple VRegs");
         argVRegs.push_back(Arg.Regs[0]);
       }
-      return generateOpenCLBuiltinCall(
-          doubleUnderscore ? funcName : demangledName, MIRBuilder, resVReg,
-          OrigRet.Ty, argVRegs, TR);
+      return generateOpenCLBuiltinCall(builtin, MIRBuilder, resVReg,
+                                       OrigRet.Ty, argVRegs, TR);
     }
     report_fatal_error("Unable to handle this environment's built-in funcs.");
   } else {
     // Emit a regular OpFunctionCall
 
     // If it's an externally declared function, be sure to emit its type and
-    // function declaration here. It will be hoisted globally later
+    // function declaration once in the module. It will be hoisted globally
+    // later, and the call refers to it by name until then
     auto M = MIRBuilder.getMF().getFunction().getParent();
     Function *calledFunc = M->getFunction(funcName);
     if (calledFunc && calledFunc->isDeclaration()) {
-      // Emit the type info and forward function declaration to the first MBB
-      // to ensure VReg definition dependencies are valid across all MBBs
-      MachineIRBuilder firstBlockBuilder;
       auto &MF = MIRBuilder.getMF();
-      firstBlockBuilder.setMF(MF);
-      firstBlockBuilder.setMBB(*MF.getBlockNumbered(0));
-      lowerFormalArguments(firstBlockBuilder, *calledFunc, {});
+      if (TR->addExternalFunctionDecl(calledFunc)) {
+        // Emit the type info and forward function declaration to the first
+        // MBB to ensure VReg definition dependencies are valid across all MBBs
+        MachineIRBuilder firstBlockBuilder;
+        firstBlockBuilder.setMF(MF);
+        firstBlockBuilder.setMBB(*MF.getBlockNumbered(0));
+        lowerFormalArguments(firstBlockBuilder, *calledFunc, {});
+      }
+
+      // Builtins without a native lowering become calls to an imported
+      // function, which the consumer must link against a builtin library
+      if (parseOpenCLBuiltinName(funcName).hasValue()) {
+        MachineOptimizationRemarkEmitter MORE(MF, nullptr);
+        MORE.emit([&]() {
+          return MachineOptimizationRemarkMissed(DEBUG_TYPE,
+                                                 "ExternalBuiltinCall",
+                                                 MIRBuilder.getDebugLoc(),
+                                                 &MIRBuilder.getMBB())
+                 << "builtin " << ore::NV("Callee", funcName)
+                 << " lowered as a call to an imported function in kernel "
+                 << ore::NV("Kernel", MF.getFunction().getName());
+        });
+      }
     }
 
     // Make sure there's a valid return reg, even for functions returning void
@@ -13,6 +13,9 @@
 #ifndef LLVM_LIB_TARGET_SPIRV_SPIRVCALLLOWERING_H
 #define LLVM_LIB_TARGET_SPIRV_SPIRVCALLLOWERING_H
 
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "SPIRVOpenCLBIFs.h"
 #include "llvm/CodeGen/GlobalISel/CallLowering.h"
 
 namespace llvm {
@@ -25,6 +28,15 @@ private:
   // Used to create and assign function, argument, and return type information
   SPIRVTypeRegistry *TR;
 
+  // Maps callee names to their parsed builtin names (or None if they aren't
+  // builtins with a native lowering), so each builtin is only parsed once
+  // however often it's used.
+  mutable StringMap<Optional<OpenCLBuiltinName>> BuiltinNames;
+
+  // Return the cached builtin info for the given callee name, parsing it first
+  // if this is the first call to it.
+  const Optional<OpenCLBuiltinName> &getBuiltinName(StringRef name) const;
+
 public:
   SPIRVCallLowering(const SPIRVTargetLowering &TLI, SPIRVTypeRegistry *TR);
 
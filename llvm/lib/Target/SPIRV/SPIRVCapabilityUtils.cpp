@@ -10,54 +10,133 @@
 // duplicated capabilities, and redundant declarations of capabilities that are
 // already implicitly declared by others.
 //
-// This is used by both the SPIRVCapabilitiesPass and SPIRVGlobalTypesAndRegNums
-// to deduplicate capabilities at both the function-local and global scopes.
+// Capabilities and extensions are stored as bitsets using dense indices, and
+// the closure of implicitly declared capabilities is only computed once.
+//
+// SPIRVGlobalTypesAndRegNums uses a single handler to collect and deduplicate
+// the requirements of every instruction in the module.
 //
 //===----------------------------------------------------------------------===//
 
 #include "SPIRVCapabilityUtils.h"
 #include "SPIRVEnumRequirements.h"
 #include "SPIRVSubtarget.h"
+#include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
 
-// Remove a list of capabilities from dedupedCaps and add them to allCaps,
-// recursing through their implicitly declared capabilities too.
-void SPIRVRequirementHandler::pruneCapabilities(const CapabilityList &toPrune) {
-  for (const auto &cap : toPrune) {
-    allCaps.insert(cap);
-    auto foundIndex = std::find(minimalCaps.begin(), minimalCaps.end(), cap);
-    if (foundIndex != minimalCaps.end()) {
-      minimalCaps.erase(foundIndex);
+#define MAKE_CAPABILITY_INDEX_CASE(Enum, Var, Val, Caps, Exts, MinVer, MaxVer) \
+  case Enum::Var:                                                              \
+    return CapabilityIndex::Var;
+
+#define MAKE_CAPABILITY_VALUE(Enum, Var, Val, Caps, Exts, MinVer, MaxVer)      \
+  Enum::Var,
+
+#define MAKE_EXTENSION_INDEX_CASE(Enum, Var, Val)                              \
+  case Enum::Var:                                                              \
+    return ExtensionIndex::Var;
+
+#define MAKE_EXTENSION_VALUE(Enum, Var, Val) Enum::Var,
+
+unsigned getCapabilityIndex(Capability::Capability cap) {
+  switch (cap) { DEF_Capability(Capability, MAKE_CAPABILITY_INDEX_CASE) }
+  llvm_unreachable("Unknown capability");
+}
+
+Capability::Capability getCapabilityFromIndex(unsigned index) {
+  static const Capability::Capability capabilities[] = {
+      DEF_Capability(Capability, MAKE_CAPABILITY_VALUE)};
+  assert(index < CapabilityIndex::NumCaps && "Invalid capability index");
+  return capabilities[index];
+}
+
+unsigned getExtensionIndex(Extension::Extension ext) {
+  switch (ext) { DEF_Extension(Extension, MAKE_EXTENSION_INDEX_CASE) }
+  llvm_unreachable("Unknown extension");
+}
+
+Extension::Extension getExtensionFromIndex(unsigned index) {
+  static const Extension::Extension extensions[] = {
+      DEF_Extension(Extension, MAKE_EXTENSION_VALUE)};
+  assert(index < ExtensionIndex::NumExts && "Invalid extension index");
+  return extensions[index];
+}
+
+// Compute the implicitly declared capabilities of the capability with the
+// given index, recursing through the ones it directly declares first.
+static void computeImplicitCapabilities(unsigned index,
+                                        std::vector<CapabilitySet> &closures,
+                                        CapabilitySet &computed) {
+  if (computed[index])
+    return;
+  computed.set(index);
+  auto cap = getCapabilityFromIndex(index);
+  for (auto implicitCap : getCapabilityCapabilities(cap)) {
+    unsigned implicitIndex = getCapabilityIndex(implicitCap);
+    computeImplicitCapabilities(implicitIndex, closures, computed);
+    closures[index].set(implicitIndex);
+    closures[index] |= closures[implicitIndex];
+  }
+}
+
+const CapabilitySet &getImplicitCapabilities(Capability::Capability cap) {
+  static const std::vector<CapabilitySet> closures = [] {
+    std::vector<CapabilitySet> closures(CapabilityIndex::NumCaps);
+    CapabilitySet computed;
+    for (unsigned i = 0; i < CapabilityIndex::NumCaps; ++i) {
+      computeImplicitCapabilities(i, closures, computed);
     }
-    CapabilityList implicitDeclares = getCapabilityCapabilities(cap);
-    pruneCapabilities(implicitDeclares);
+    return closures;
+  }();
+  return closures[getCapabilityIndex(cap)];
+}
+
+CapabilityList SPIRVRequirementHandler::getMinimalCapabilities() const {
+  CapabilityList caps;
+  for (unsigned i = 0; i < CapabilityIndex::NumCaps; ++i) {
+    if (minimalCaps[i])
+      caps.push_back(getCapabilityFromIndex(i));
   }
+  return caps;
+}
+
+ExtensionList SPIRVRequirementHandler::getExtensions() const {
+  ExtensionList exts;
+  for (unsigned i = 0; i < ExtensionIndex::NumExts; ++i) {
+    if (allExtensions[i])
+      exts.push_back(getExtensionFromIndex(i));
+  }
+  return exts;
 }
 
 // Add a list of capabilities, ensuring allCaps captures all the implicitly
-// declared capabilities, and dedupedCaps has the minimal number of required
+// declared capabilities, and minimalCaps has the minimal number of required
 // capabilities (so all implicitly declared ones are removed)
 void SPIRVRequirementHandler::addCapabilities(const CapabilityList &toAdd) {
   for (const auto &cap : toAdd) {
-    bool isNewlyInserted = allCaps.insert(cap).second;
-    if (isNewlyInserted) { // Don't re-add if it's already been declared
-      CapabilityList implicitDeclares = getCapabilityCapabilities(cap);
-      pruneCapabilities(implicitDeclares);
-      minimalCaps.push_back(cap);
-    }
+    addCapability(cap);
   }
 }
 void SPIRVRequirementHandler::addCapability(Capability::Capability toAdd) {
-  addCapabilities({toAdd});
+  unsigned index = getCapabilityIndex(toAdd);
+  if (allCaps[index]) // Don't re-add if it's already been declared
+    return;
+  const CapabilitySet &implicitDeclares = getImplicitCapabilities(toAdd);
+  allCaps |= implicitDeclares;
+  allCaps.set(index);
+  minimalCaps &= ~implicitDeclares;
+  minimalCaps.set(index);
 }
 
-void SPIRVRequirementHandler::addExtensions(const ExtensionList &toAdd) {
-  allExtensions.insert(toAdd.begin(), toAdd.end());
+void SPIRVRequirementHandler::addExtensions(
+    ArrayRef<Extension::Extension> toAdd) {
+  for (const auto &ext : toAdd) {
+    addExtension(ext);
+  }
 }
 void SPIRVRequirementHandler::addExtension(Extension::Extension toAdd) {
-  allExtensions.insert(toAdd);
+  allExtensions.set(getExtensionIndex(toAdd));
 }
 
 void SPIRVRequirementHandler::addRequirements(const SPIRVRequirements &req) {
@@ -123,14 +202,14 @@ void SPIRVRequirementHandler::checkSatisfiable(
     isSatisfiable = false;
   }
 
-  for (auto cap : minimalCaps) {
+  for (auto cap : getMinimalCapabilities()) {
     if (!ST.canUseCapability(cap)) {
       errs() << "Capability not supported: " << getCapabilityName(cap) << "\n";
       isSatisfiable = false;
     }
   }
 
-  for (auto ext : allExtensions) {
+  for (auto ext : getExtensions()) {
     if (!ST.canUseExtension(ext)) {
       errs() << "Extension not suported: " << getExtensionName(ext) << "\n";
       isSatisfiable = false;
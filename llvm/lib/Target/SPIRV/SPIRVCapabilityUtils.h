@@ -10,8 +10,13 @@
 // duplicated capabilities, and redundant declarations of capabilities that are
 // already implicitly declared by others.
 //
-// This is used by both the SPIRVCapabilitiesPass and SPIRVGlobalTypesAndRegNums
-// to deduplicate capabilities at both the function-local and global scopes.
+// Capabilities and extensions are stored as fixed-size bitsets indexed by a
+// dense index generated from their enum definitions, and the transitive closure
+// of implicitly declared capabilities is precomputed once, so adding, pruning
+// and checking them only needs a few word operations.
+//
+// SPIRVGlobalTypesAndRegNums uses a single handler to collect and deduplicate
+// the requirements of every instruction in the module.
 //
 //===----------------------------------------------------------------------===//
 
@@ -19,38 +24,60 @@
 #define LLVM_LIB_TARGET_SPIRV_SPIRVCAPABILITYUTILS_H
 
 #include "SPIRVEnumRequirements.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/SmallVector.h"
-#include <set>
+#include "llvm/ADT/StringSet.h"
+#include <bitset>
 #include <vector>
 
 using CapabilityList = std::vector<Capability::Capability>;
 using ExtensionList = std::vector<Extension::Extension>;
 
+#define MAKE_CAPABILITY_INDEX(Enum, Var, Val, Caps, Exts, MinVer, MaxVer) Var,
+#define MAKE_EXTENSION_INDEX(Enum, Var, Val) Var,
+
+// Dense indices for every capability and extension, in definition order.
+namespace CapabilityIndex {
+enum : unsigned { DEF_Capability(Capability, MAKE_CAPABILITY_INDEX) NumCaps };
+}
+namespace ExtensionIndex {
+enum : unsigned { DEF_Extension(Extension, MAKE_EXTENSION_INDEX) NumExts };
+}
+
+using CapabilitySet = std::bitset<CapabilityIndex::NumCaps>;
+using ExtensionSet = std::bitset<ExtensionIndex::NumExts>;
+
+unsigned getCapabilityIndex(Capability::Capability cap);
+Capability::Capability getCapabilityFromIndex(unsigned index);
+unsigned getExtensionIndex(Extension::Extension ext);
+Extension::Extension getExtensionFromIndex(unsigned index);
+
+// Get all the capabilities the given one implicitly declares, either directly
+// or indirectly, not including itself.
+const CapabilitySet &getImplicitCapabilities(Capability::Capability cap);
+
 class SPIRVRequirementHandler {
 private:
-  CapabilityList minimalCaps;
-  std::set<Capability::Capability> allCaps;
-  std::set<Extension::Extension> allExtensions;
-  uint32_t minVersion; // 0 if no min version is defined
-  uint32_t maxVersion; // 0 if no max version is defined
-
-  void pruneCapabilities(const CapabilityList &toPrune);
+  CapabilitySet minimalCaps;
+  CapabilitySet allCaps;
+  ExtensionSet allExtensions;
+  uint32_t minVersion = 0; // 0 if no min version is defined
+  uint32_t maxVersion = 0; // 0 if no max version is defined
 
 public:
   uint32_t getMinVersion() const { return minVersion; }
   uint32_t getMaxVersion() const { return maxVersion; }
-  const CapabilityList &getMinimalCapabilities() const { return minimalCaps; };
-  const std::set<Extension::Extension> &getExtensions() const {
-    return allExtensions;
-  };
+  // Get the minimal capabilities and all extensions in definition order.
+  CapabilityList getMinimalCapabilities() const;
+  ExtensionList getExtensions() const;
 
   // Add a list of capabilities, ensuring allCaps captures all the implicitly
   // declared capabilities, and minimalCaps has the minimal set of required
   // capabilities (so all implicitly declared ones are removed).
   void addCapabilities(const CapabilityList &toAdd);
   void addCapability(Capability::Capability toAdd);
-  void addExtensions(const ExtensionList &toAdd);
+  void addExtensions(llvm::ArrayRef<Extension::Extension> toAdd);
   void addExtension(Extension::Extension toAdd);
 
   // Add the given requirements to the lists. If constraints conflict, or these
@@ -62,4 +89,52 @@ public:
   void checkSatisfiable(const llvm::SPIRVSubtarget &ST) const;
 };
 
+namespace llvm {
+class MachineInstr;
+}
+
+// Add all the requirements needed for the given instruction to reqs. Return
+// false if instructions with its opcode never have any.
+bool addInstrRequirements(const llvm::MachineInstr &MI,
+                          SPIRVRequirementHandler &reqs,
+                          const llvm::SPIRVSubtarget &ST);
+
+// Add the requirements of instructions to a handler, skipping the opcodes
+// which never have any, and the instructions with the same opcode, subtarget,
+// immediates and result type as one already added, as they'd add nothing new.
+// Shaders only moving 8-bit or 16-bit data get the storage-only capabilities
+// rather than Int8, Int16 or Float16.
+class SPIRVInstrRequirementsCollector {
+private:
+  SPIRVRequirementHandler &reqs;
+  // The opcodes addInstrRequirements found to have no requirements
+  llvm::BitVector noReqsOpcodes;
+  // The keys of the instructions whose requirements were added
+  llvm::StringSet<> addedKeys;
+  // The subtarget of the last instruction added
+  const llvm::SPIRVSubtarget *ST = nullptr;
+  // Masks of the 8-bit and 16-bit scalar types declared, used as values other
+  // than by loads and conversions, and reachable from pointers in each storage
+  // class, so loads and stores alone can use the storage-only capabilities
+  unsigned declaredNarrowTypes = 0;
+  unsigned narrowValueTypes = 0;
+  unsigned narrowStorageBufferTypes = 0;
+  unsigned narrowUniformTypes = 0;
+  unsigned narrowPushConstantTypes = 0;
+  unsigned narrowInputOutputTypes = 0;
+  unsigned narrowOtherStorageTypes = 0;
+
+  void addNarrowTypeUses(const llvm::MachineInstr &MI);
+
+public:
+  SPIRVInstrRequirementsCollector(SPIRVRequirementHandler &reqs)
+      : reqs(reqs) {}
+
+  void addInstr(const llvm::MachineInstr &MI, const llvm::SPIRVSubtarget &ST);
+
+  // Add the capabilities of the 8-bit and 16-bit types, which depend on how
+  // the whole module uses them. Call once every instruction was added.
+  void addNarrowTypeRequirements();
+};
+
 #endif
@@ -0,0 +1,312 @@
+//===-- SPIRVCoalescingRemarks.cpp - Report global access patterns -*- C++ -*-//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Classify the loads and stores through CrossWorkgroup pointers by how their
+// addresses change between adjacent work-items, i.e. with get_global_id(0) or
+// get_local_id(0), as drivers only coalesce the accesses of a subgroup into
+// few memory transactions when they are to consecutive addresses:
+//  - uniform: every work-item accesses the same address
+//  - unit-stride: adjacent work-items access adjacent elements
+//  - strided: adjacent work-items are a constant or invariant stride apart
+//  - irregular: the address depends on the id otherwise, e.g. through a load
+//
+// The strided and irregular accesses get an analysis remark with their stride
+// and alignment, and each function one summing its accesses of each kind, e.g.
+// for -pass-remarks-analysis=spirv-coalescing-remarks. The addresses are
+// differentiated on their SCEV, assuming the ids of adjacent work-items don't
+// wrap when truncated or extended.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVOpenCLBIFs.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-coalescing-remarks"
+
+STATISTIC(NumUniformAccesses, "Number of uniform global memory accesses");
+STATISTIC(NumUnitStrideAccesses,
+          "Number of unit-stride global memory accesses");
+STATISTIC(NumStridedAccesses, "Number of strided global memory accesses");
+STATISTIC(NumIrregularAccesses, "Number of irregular global memory accesses");
+
+namespace {
+// How much an address changes between adjacent work-items, in bytes
+struct Stride {
+  enum Kind { Constant, Invariant, Irregular } kind;
+  int64_t bytes;
+
+  static Stride getConstant(int64_t bytes) { return {Constant, bytes}; }
+  static Stride getInvariant() { return {Invariant, 0}; }
+  static Stride getIrregular() { return {Irregular, 0}; }
+  bool isZero() const { return kind == Constant && bytes == 0; }
+};
+
+class SPIRVCoalescingRemarks : public FunctionPass {
+public:
+  static char ID;
+  SPIRVCoalescingRemarks() : FunctionPass(ID) {
+    initializeSPIRVCoalescingRemarksPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+    AU.setPreservesAll();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+
+private:
+  Stride getStride(const SCEV *S) const;
+  void findWorkItemIds(Function &F);
+
+  // The calls to get_global_id(0) and get_local_id(0)
+  SmallPtrSet<const Value *, 4> ids;
+  // The values computed from the ids, which SCEV can't see through when they
+  // appear as unknowns, such as loads indexed by them
+  SmallPtrSet<const Value *, 32> dependsOnIds;
+};
+} // namespace
+
+// Whether the call is to get_global_id, get_local_id or their linear variants
+// in the first dimension, which adjacent work-items differ by one in
+static bool isFirstDimIdCall(const CallInst &CI) {
+  const Function *callee = CI.getCalledFunction();
+  if (!callee || !callee->isDeclaration()) {
+    return false;
+  }
+  auto builtin = parseOpenCLBuiltinName(callee->getName());
+  if (!builtin) {
+    return false;
+  }
+  if (builtin->name == "get_global_linear_id" ||
+      builtin->name == "get_local_linear_id") {
+    return true;
+  }
+  if (builtin->name != "get_global_id" && builtin->name != "get_local_id") {
+    return false;
+  }
+  const auto *dim = dyn_cast<ConstantInt>(CI.getArgOperand(0));
+  return dim && dim->isZero();
+}
+
+void SPIRVCoalescingRemarks::findWorkItemIds(Function &F) {
+  ids.clear();
+  dependsOnIds.clear();
+  SmallVector<const Value *, 16> worklist;
+  for (const Instruction &I : instructions(F)) {
+    const auto *CI = dyn_cast<CallInst>(&I);
+    if (CI && isFirstDimIdCall(*CI)) {
+      ids.insert(CI);
+      worklist.push_back(CI);
+    }
+  }
+  while (!worklist.empty()) {
+    const Value *V = worklist.pop_back_val();
+    for (const User *U : V->users()) {
+      if (isa<Instruction>(U) && dependsOnIds.insert(U).second) {
+        worklist.push_back(U);
+      }
+    }
+  }
+}
+
+static Stride addStrides(Stride a, Stride b) {
+  if (a.kind == Stride::Irregular || b.kind == Stride::Irregular) {
+    return Stride::getIrregular();
+  }
+  if (a.kind == Stride::Invariant || b.kind == Stride::Invariant) {
+    return Stride::getInvariant();
+  }
+  return Stride::getConstant(a.bytes + b.bytes);
+}
+
+Stride SPIRVCoalescingRemarks::getStride(const SCEV *S) const {
+  if (isa<SCEVConstant>(S)) {
+    return Stride::getConstant(0);
+  }
+  if (const auto *U = dyn_cast<SCEVUnknown>(S)) {
+    if (ids.count(U->getValue())) {
+      return Stride::getConstant(1);
+    }
+    return dependsOnIds.count(U->getValue()) ? Stride::getIrregular()
+                                             : Stride::getConstant(0);
+  }
+  if (const auto *castExpr = dyn_cast<SCEVCastExpr>(S)) {
+    return getStride(castExpr->getOperand());
+  }
+  if (const auto *add = dyn_cast<SCEVAddExpr>(S)) {
+    Stride sum = Stride::getConstant(0);
+    for (const SCEV *op : add->operands()) {
+      sum = addStrides(sum, getStride(op));
+    }
+    return sum;
+  }
+  if (const auto *mul = dyn_cast<SCEVMulExpr>(S)) {
+    // Only one factor may vary, scaled by the others
+    Optional<Stride> varying;
+    int64_t scale = 1;
+    bool invariantScale = false;
+    for (const SCEV *op : mul->operands()) {
+      Stride opStride = getStride(op);
+      if (!opStride.isZero()) {
+        if (varying) {
+          return Stride::getIrregular();
+        }
+        varying = opStride;
+      } else if (const auto *C = dyn_cast<SCEVConstant>(op)) {
+        scale *= C->getAPInt().getSExtValue();
+      } else {
+        invariantScale = true;
+      }
+    }
+    if (!varying) {
+      return Stride::getConstant(0);
+    }
+    if (varying->kind == Stride::Irregular) {
+      return *varying;
+    }
+    if (varying->kind == Stride::Invariant || invariantScale) {
+      return Stride::getInvariant();
+    }
+    return Stride::getConstant(varying->bytes * scale);
+  }
+  if (const auto *rec = dyn_cast<SCEVAddRecExpr>(S)) {
+    // Work-items whose loops step differently don't access memory in step
+    for (unsigned i = 1; i < rec->getNumOperands(); ++i) {
+      if (!getStride(rec->getOperand(i)).isZero()) {
+        return Stride::getIrregular();
+      }
+    }
+    return getStride(rec->getStart());
+  }
+  const bool varies = SCEVExprContains(S, [&](const SCEV *E) {
+    const auto *U = dyn_cast<SCEVUnknown>(E);
+    return U && (ids.count(U->getValue()) ||
+                 dependsOnIds.count(U->getValue()));
+  });
+  return varies ? Stride::getIrregular() : Stride::getConstant(0);
+}
+
+bool SPIRVCoalescingRemarks::runOnFunction(Function &F) {
+  auto &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+  if (!ORE.allowExtraAnalysis(DEBUG_TYPE)) {
+    return false;
+  }
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  SPIRVTypeRegistry *TR = TM.getSubtargetImpl()->getSPIRVTypeRegistry();
+  const unsigned globalAS =
+      TR->StorageClassToAddressSpace(StorageClass::CrossWorkgroup);
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  findWorkItemIds(F);
+
+  unsigned numUniform = 0, numUnitStride = 0, numStrided = 0, numIrregular = 0;
+  for (Instruction &I : instructions(F)) {
+    Value *ptr = nullptr;
+    Type *accessTy = nullptr;
+    unsigned align = 0;
+    if (auto *LI = dyn_cast<LoadInst>(&I)) {
+      ptr = LI->getPointerOperand();
+      accessTy = LI->getType();
+      align = LI->getAlignment();
+    } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+      ptr = SI->getPointerOperand();
+      accessTy = SI->getValueOperand()->getType();
+      align = SI->getAlignment();
+    } else {
+      continue;
+    }
+    if (ptr->getType()->getPointerAddressSpace() != globalAS) {
+      continue;
+    }
+    if (!align) {
+      align = DL.getABITypeAlignment(accessTy);
+    }
+    const int64_t size = DL.getTypeStoreSize(accessTy);
+    const StringRef access = isa<LoadInst>(I) ? "load" : "store";
+
+    const Stride stride = getStride(SE.getSCEV(ptr));
+    if (stride.isZero()) {
+      ++numUniform;
+    } else if (stride.kind == Stride::Constant &&
+               std::abs(stride.bytes) == size) {
+      ++numUnitStride;
+    } else if (stride.kind == Stride::Irregular) {
+      ++numIrregular;
+      ORE.emit([&]() {
+        return OptimizationRemarkAnalysis(DEBUG_TYPE, "IrregularAccess", &I)
+               << "global " << access << " of " << ore::NV("Size", size)
+               << " bytes, aligned to " << ore::NV("Align", align)
+               << ", has an irregular address across work-items";
+      });
+    } else {
+      ++numStrided;
+      ORE.emit([&]() {
+        OptimizationRemarkAnalysis R(DEBUG_TYPE, "StridedAccess", &I);
+        R << "global " << access << " of " << ore::NV("Size", size)
+          << " bytes, aligned to " << ore::NV("Align", align) << ", is ";
+        if (stride.kind == Stride::Constant) {
+          R << "strided by " << ore::NV("Stride", stride.bytes) << " bytes";
+        } else {
+          R << "strided by a value unknown at compile time";
+        }
+        return R << " across work-items";
+      });
+    }
+  }
+  const unsigned numAccesses =
+      numUniform + numUnitStride + numStrided + numIrregular;
+  if (numAccesses == 0) {
+    return false;
+  }
+  NumUniformAccesses += numUniform;
+  NumUnitStrideAccesses += numUnitStride;
+  NumStridedAccesses += numStrided;
+  NumIrregularAccesses += numIrregular;
+
+  ORE.emit([&]() {
+    return OptimizationRemarkAnalysis(DEBUG_TYPE, "GlobalAccesses",
+                                      F.getSubprogram(), &F.getEntryBlock())
+           << ore::NV("Function", &F) << " makes "
+           << ore::NV("NumAccesses", numAccesses) << " global accesses: "
+           << ore::NV("NumUniform", numUniform) << " uniform, "
+           << ore::NV("NumUnitStride", numUnitStride) << " unit-stride, "
+           << ore::NV("NumStrided", numStrided) << " strided and "
+           << ore::NV("NumIrregular", numIrregular) << " irregular";
+  });
+  return false;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVCoalescingRemarks, DEBUG_TYPE,
+                      "SPIRV report global access patterns", false, true)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+INITIALIZE_PASS_END(SPIRVCoalescingRemarks, DEBUG_TYPE,
+                    "SPIRV report global access patterns", false, true)
+
+char SPIRVCoalescingRemarks::ID = 0;
+
+FunctionPass *llvm::createSPIRVCoalescingRemarksPass() {
+  return new SPIRVCoalescingRemarks();
+}
@@ -0,0 +1,363 @@
+//===-- SPIRVCompilationCache.cpp - Cache SPIR-V Object Files ---*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// An opt-in on-disk cache of the SPIR-V binaries emitted for each module,
+// enabled with -spirv-cache-dir. The key hashes the module's bitcode with the
+// triple, CPU, feature string, optimization level and SPIR-V version, which
+// together determine the subtarget's available capabilities and extensions.
+//
+// The pass runs before any other module pass. On a hit, it writes the cached
+// binary to the output, and drops the module's function bodies so the rest of
+// the pipeline has nothing to select. Codegen emits into a buffer owned by the
+// pass rather than the real output, so its doFinalization, which runs after
+// the AsmPrinter's has written the object, can discard the buffer on a hit or
+// copy it to both the output and the cache on a miss.
+//
+// With -spirv-cache-functions, a module which misses is compiled one function
+// at a time instead, so only the functions which changed since it was last
+// compiled are compiled again. Each fragment is a clone of the module with only
+// the body of one function, and the definitions of the global variables it's
+// the first to refer to. It's keyed like a module, and the cached binaries are
+// linked into the output, resolving the symbols each fragment imports to the
+// fragment defining them. Local symbols are made external so fragments can
+// refer to each other's, and are no longer exported once linked.
+//
+// Entries are named like the LTO cache's, so the directory can be bounded with
+// a CachePruning policy given in -spirv-cache-policy.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/SPIRVLinker.h"
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-compilation-cache"
+
+STATISTIC(NumCacheHits, "Number of modules emitted from the cache");
+STATISTIC(NumCacheMisses, "Number of modules compiled and added to the cache");
+STATISTIC(NumFragmentHits, "Number of functions emitted from the cache");
+STATISTIC(NumFragmentMisses,
+          "Number of functions compiled and added to the cache");
+
+static cl::opt<std::string> CacheDir(
+    "spirv-cache-dir", cl::Hidden, cl::init(""),
+    cl::desc("Directory caching the SPIR-V object files emitted for each "
+             "module, reused when the same module is compiled again"));
+
+static cl::opt<std::string> CachePolicy(
+    "spirv-cache-policy", cl::Hidden, cl::init(""),
+    cl::desc("Pruning policy for -spirv-cache-dir, in the same format as the "
+             "LTO cache policy (e.g. cache_size_bytes=1g:prune_after=24h)"));
+
+static cl::opt<bool> CacheFunctions(
+    "spirv-cache-functions", cl::Hidden, cl::init(false),
+    cl::desc("With -spirv-cache-dir, compile and cache each function of a "
+             "module separately, so only the functions which changed are "
+             "compiled again"));
+
+namespace {
+class SPIRVCompilationCache : public ModulePass {
+public:
+  static char ID;
+  SPIRVCompilationCache(raw_pwrite_stream &Out, SPIRVTargetMachine &TM)
+      : ModulePass(ID), Out(Out), TM(TM), CodeGenOut(CodeGenBuffer) {}
+
+  StringRef getPassName() const override { return "SPIRV compilation cache"; }
+  bool doInitialization(Module &M) override;
+  bool runOnModule(Module &M) override;
+  bool doFinalization(Module &M) override;
+
+  raw_pwrite_stream &getCodeGenStream() { return CodeGenOut; }
+
+private:
+  raw_pwrite_stream &Out;
+  SPIRVTargetMachine &TM;
+  SmallVector<char, 0> CodeGenBuffer;
+  raw_svector_ostream CodeGenOut;
+  SmallString<128> EntryPath;
+  bool IsHit = false;
+
+  // The binaries of each function, linked into the output instead of
+  // codegen's when compiling one function at a time
+  std::vector<SmallVector<char, 0>> Fragments;
+  StringSet<> InternalNames;
+  bool UseFragments = false;
+
+  std::string computeKey(Module &M) const;
+  SmallString<128> getEntryPath(StringRef key) const;
+  void addEntry(StringRef path, StringRef object);
+  void prune();
+  void compile(Module &M, SmallVectorImpl<char> &object);
+  void compileFragments(Module &M);
+  void linkFragments(SmallVectorImpl<char> &object);
+};
+} // namespace
+
+std::string SPIRVCompilationCache::computeKey(Module &M) const {
+  SmallVector<char, 0> bitcode;
+  raw_svector_ostream bitcodeOS(bitcode);
+  WriteBitcodeToFile(M, bitcodeOS);
+
+  SHA1 hasher;
+  hasher.update(StringRef(bitcode.data(), bitcode.size()));
+  hasher.update(TM.getTargetTriple().str());
+  hasher.update(TM.getTargetCPU());
+  hasher.update(TM.getTargetFeatureString());
+  hasher.update(utostr(TM.getOptLevel()));
+  hasher.update(utostr(TM.getSubtargetImpl()->getTargetSPIRVVersion()));
+  return toHex(hasher.result());
+}
+
+SmallString<128> SPIRVCompilationCache::getEntryPath(StringRef key) const {
+  SmallString<128> path;
+  sys::path::append(path, CacheDir, "llvmcache-" + key);
+  return path;
+}
+
+// Nothing the pipeline generates for M is used, so give it nothing to do.
+static void deleteBodies(Module &M) {
+  for (Function &F : M) {
+    if (!F.isDeclaration()) {
+      F.deleteBody();
+    }
+  }
+}
+
+// The pipeline may be run again on other modules, so forget the last one.
+bool SPIRVCompilationCache::doInitialization(Module &M) {
+  CodeGenBuffer.clear();
+  EntryPath.clear();
+  IsHit = false;
+  Fragments.clear();
+  InternalNames.clear();
+  UseFragments = false;
+  return false;
+}
+
+bool SPIRVCompilationCache::runOnModule(Module &M) {
+  if (sys::fs::create_directories(CacheDir)) {
+    return false; // Compile as usual if the cache can't be used
+  }
+  EntryPath = getEntryPath(computeKey(M));
+
+  auto cached = MemoryBuffer::getFile(EntryPath, /*FileSize=*/-1,
+                                      /*RequiresNullTerminator=*/false);
+  if (!cached) {
+    ++NumCacheMisses;
+    bool hasDefinitions =
+        any_of(M, [](const Function &F) { return !F.isDeclaration(); });
+    if (!CacheFunctions || !hasDefinitions) {
+      return false;
+    }
+    compileFragments(M);
+    UseFragments = true;
+    deleteBodies(M);
+    return true;
+  }
+  ++NumCacheHits;
+  IsHit = true;
+  Out << (*cached)->getBuffer();
+  deleteBodies(M);
+  return true;
+}
+
+// Write the new object file to a temporary first, so other processes never
+// see a partially written entry.
+void SPIRVCompilationCache::addEntry(StringRef path, StringRef object) {
+  SmallString<128> tempModel;
+  sys::path::append(tempModel, CacheDir, "SPIRV-%%%%%%.tmp.o");
+  auto temp = sys::fs::TempFile::create(tempModel);
+  if (!temp) {
+    consumeError(temp.takeError());
+    return;
+  }
+  {
+    raw_fd_ostream tempOS(temp->FD, /*shouldClose=*/false);
+    tempOS << object;
+  }
+  if (Error E = temp->keep(path)) {
+    consumeError(std::move(E));
+    consumeError(temp->discard());
+  }
+}
+
+void SPIRVCompilationCache::prune() {
+  if (CachePolicy.empty()) {
+    return;
+  }
+  auto policy = parseCachePruningPolicy(CachePolicy);
+  if (!policy) {
+    report_fatal_error("Invalid -spirv-cache-policy: " +
+                       toString(policy.takeError()));
+  }
+  pruneCache(CacheDir, *policy);
+}
+
+// Run the pipeline without this pass on M, emitting into object.
+void SPIRVCompilationCache::compile(Module &M, SmallVectorImpl<char> &object) {
+  raw_svector_ostream objectOS(object);
+  legacy::PassManager PM;
+  auto fileType = TargetMachine::CGFT_ObjectFile;
+  if (TM.LLVMTargetMachine::addPassesToEmitFile(PM, objectOS, nullptr,
+                                                fileType)) {
+    report_fatal_error("Unable to emit SPIR-V for a function fragment");
+  }
+  PM.run(M);
+}
+
+// Give each global variable to the first function referring to it, directly or
+// through the initializers of the global variables it refers to. That
+// function's fragment is the only one defining it.
+static void
+findGlobalOwners(Module &M,
+                 DenseMap<const GlobalVariable *, const Function *> &owners) {
+  for (const Function &F : M) {
+    SmallVector<const Constant *, 16> worklist;
+    SmallPtrSet<const Constant *, 16> visited;
+    for (const Instruction &I : instructions(F)) {
+      for (const Value *op : I.operands()) {
+        if (const auto *C = dyn_cast<Constant>(op)) {
+          worklist.push_back(C);
+        }
+      }
+    }
+    while (!worklist.empty()) {
+      const Constant *C = worklist.pop_back_val();
+      if (!visited.insert(C).second) {
+        continue;
+      }
+      if (const auto *GV = dyn_cast<GlobalVariable>(C)) {
+        if (owners.insert({GV, &F}).second && GV->hasInitializer()) {
+          worklist.push_back(GV->getInitializer());
+        }
+        continue;
+      }
+      if (isa<GlobalValue>(C)) {
+        continue;
+      }
+      for (const Value *op : C->operands()) {
+        worklist.push_back(cast<Constant>(op));
+      }
+    }
+  }
+}
+
+void SPIRVCompilationCache::compileFragments(Module &M) {
+  DenseMap<const GlobalVariable *, const Function *> owners;
+  findGlobalOwners(M, owners);
+
+  // Fragments refer to the symbols defined by others through their linkage
+  // names, so every symbol needs an external one
+  for (GlobalObject &GO : M.global_objects()) {
+    if (!GO.hasName()) {
+      GO.setName("__spirv_fragment_symbol");
+    }
+    if (GO.hasLocalLinkage()) {
+      GO.setLinkage(GlobalValue::ExternalLinkage);
+      InternalNames.insert(GO.getName());
+    }
+  }
+
+  for (Function &F : M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    ValueToValueMapTy VMap;
+    std::unique_ptr<Module> fragment =
+        CloneModule(M, VMap, [&](const GlobalValue *GV) {
+          if (const auto *GVar = dyn_cast<GlobalVariable>(GV)) {
+            return owners.lookup(GVar) == &F;
+          }
+          return GV == &F || !isa<Function>(GV);
+        });
+
+    SmallString<128> path = getEntryPath(computeKey(*fragment));
+    Fragments.emplace_back();
+    SmallVector<char, 0> &object = Fragments.back();
+    auto cached = MemoryBuffer::getFile(path, /*FileSize=*/-1,
+                                        /*RequiresNullTerminator=*/false);
+    if (cached) {
+      ++NumFragmentHits;
+      StringRef buffer = (*cached)->getBuffer();
+      object.append(buffer.begin(), buffer.end());
+      continue;
+    }
+    ++NumFragmentMisses;
+    compile(*fragment, object);
+    addEntry(path, StringRef(object.data(), object.size()));
+  }
+}
+
+void SPIRVCompilationCache::linkFragments(SmallVectorImpl<char> &object) {
+  std::vector<MemoryBufferRef> inputs;
+  for (const auto &fragment : Fragments) {
+    StringRef buffer(fragment.data(), fragment.size());
+    inputs.push_back(MemoryBufferRef(buffer, "SPIR-V fragment"));
+  }
+  SmallVector<uint32_t, 0> linked;
+  auto isInternal = [&](StringRef name) { return InternalNames.count(name); };
+  if (Error E = linkSPIRVModules(*TM.getMCInstrInfo(), inputs, linked,
+                                 isInternal)) {
+    report_fatal_error("Unable to link the SPIR-V function fragments: " +
+                       toString(std::move(E)));
+  }
+  raw_svector_ostream objectOS(object);
+  support::endian::write<uint32_t>(objectOS, linked, support::little);
+}
+
+bool SPIRVCompilationCache::doFinalization(Module &M) {
+  if (IsHit) {
+    return false;
+  }
+  SmallVector<char, 0> linked;
+  StringRef object(CodeGenBuffer.data(), CodeGenBuffer.size());
+  if (UseFragments) {
+    linkFragments(linked);
+    object = StringRef(linked.data(), linked.size());
+  }
+  Out << object;
+  if (!EntryPath.empty()) {
+    addEntry(EntryPath, object);
+    prune();
+  }
+  return false;
+}
+
+char SPIRVCompilationCache::ID = 0;
+
+bool llvm::isSPIRVCompilationCacheEnabled() { return !CacheDir.empty(); }
+
+ModulePass *llvm::createSPIRVCompilationCachePass(
+    raw_pwrite_stream &Out, SPIRVTargetMachine &TM,
+    raw_pwrite_stream *&CodeGenOut) {
+  auto *cache = new SPIRVCompilationCache(Out, TM);
+  CodeGenOut = &cache->getCodeGenStream();
+  return cache;
+}
@@ -0,0 +1,734 @@
+//===-- SPIRVConstantFolding.cpp - Fold ops on constants --------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Fold the selected instructions without side effects whose operands are all
+// constants into new constants: scalar arithmetic, bitwise and logical ops,
+// comparisons, conversions and bitcasts, selects, and the extraction from and
+// construction of constant composites. Selection and the combines keep
+// building such instructions from the constants legalization spreads across
+// the function, e.g. when splitting vectors or computing offsets, and each is
+// then re-executed by every invocation.
+//
+// The new constants are defined right before the instruction they replace,
+// so SPIRVGlobalTypesAndRegNum hoists them with the others and merges them
+// with any identical constant of the module. When an operand is a
+// specialization constant, the instruction becomes an OpSpecConstantOp or
+// OpSpecConstantComposite instead, if SPIR-V allows it for the opcode.
+//
+// Only the values SPIR-V defines are folded: divisions by zero, overflowing
+// signed divisions, shifts by the width or more and out of range float to
+// integer conversions are left as they are, as are the results with
+// decorations, which may change how they're computed.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVInstrInfo.h"
+#include "SPIRVSubtarget.h"
+#include "MCTargetDesc/SPIRVMCTargetDesc.h"
+
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/APSInt.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+
+using namespace llvm;
+using namespace SPIRV;
+
+#define DEBUG_TYPE "spirv-constant-folding"
+
+STATISTIC(NumFolded, "Number of instructions folded to constants");
+STATISTIC(NumSpecFolded,
+          "Number of instructions folded to specialization constants");
+
+namespace {
+// The scalar types constants are folded for
+enum ScalarKind { NoScalar, IntScalar, FloatScalar, BoolScalar };
+
+class SPIRVConstantFolding : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVConstantFolding() : MachineFunctionPass(ID) {
+    initializeSPIRVConstantFoldingPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  MachineRegisterInfo *MRI;
+  const SPIRVInstrInfo *TII;
+  const SPIRVSubtarget *ST;
+
+  ScalarKind getScalarKind(Register typeReg, unsigned &width) const;
+  bool getConstant(Register reg, APInt &bits) const;
+  bool isSpecConstant(Register reg) const;
+  bool hasDecorations(Register reg) const;
+
+  bool foldInt(const MachineInstr &MI, unsigned width, APInt &res) const;
+  bool foldFloat(const MachineInstr &MI, unsigned width, APInt &res) const;
+  bool foldComparison(const MachineInstr &MI, APInt &res) const;
+  Register foldComposite(MachineInstr &MI) const;
+  Register buildConstant(MachineInstr &MI, const APInt &bits,
+                         ScalarKind kind) const;
+  Register buildSpecConstant(MachineInstr &MI) const;
+  void replaceResult(MachineInstr &MI, Register newReg);
+  bool fold(MachineInstr &MI);
+};
+} // namespace
+
+ScalarKind SPIRVConstantFolding::getScalarKind(Register typeReg,
+                                               unsigned &width) const {
+  const MachineInstr *type = MRI->getVRegDef(typeReg);
+  if (!type) {
+    return NoScalar;
+  }
+  switch (type->getOpcode()) {
+  case OpTypeBool:
+    width = 1;
+    return BoolScalar;
+  case OpTypeInt:
+    width = type->getOperand(1).getImm();
+    return width && width <= 64 ? IntScalar : NoScalar;
+  case OpTypeFloat:
+    width = type->getOperand(1).getImm();
+    return width == 16 || width == 32 || width == 64 ? FloatScalar : NoScalar;
+  default:
+    return NoScalar;
+  }
+}
+
+// Get the bits of a scalar constant, as wide as its type
+bool SPIRVConstantFolding::getConstant(Register reg, APInt &bits) const {
+  const MachineInstr *def = MRI->getVRegDef(reg);
+  if (!def) {
+    return false;
+  }
+  unsigned width = 0;
+  switch (def->getOpcode()) {
+  case OpConstantTrue:
+  case OpConstantFalse:
+    bits = APInt(1, def->getOpcode() == OpConstantTrue);
+    return true;
+  case OpConstantNull:
+    if (getScalarKind(def->getOperand(1).getReg(), width) == NoScalar) {
+      return false;
+    }
+    bits = APInt(width, 0);
+    return true;
+  case OpConstant: {
+    if (getScalarKind(def->getOperand(1).getReg(), width) == NoScalar ||
+        def->getNumOperands() != (width > 32 ? 4u : 3u)) {
+      return false;
+    }
+    bits = TII->getConstantBits(*def, width);
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+bool SPIRVConstantFolding::isSpecConstant(Register reg) const {
+  const MachineInstr *def = MRI->getVRegDef(reg);
+  if (!def) {
+    return false;
+  }
+  switch (def->getOpcode()) {
+  case OpSpecConstantTrue:
+  case OpSpecConstantFalse:
+  case OpSpecConstant:
+  case OpSpecConstantComposite:
+  case OpSpecConstantOp:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool SPIRVConstantFolding::hasDecorations(Register reg) const {
+  for (const MachineInstr &use : MRI->use_nodbg_instructions(reg)) {
+    if (TII->isDecorationInstr(use)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Fold the integer and bitwise ops and the integer conversions
+bool SPIRVConstantFolding::foldInt(const MachineInstr &MI, unsigned width,
+                                   APInt &res) const {
+  SmallVector<APInt, 2> ops;
+  for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+    APInt bits;
+    if (!MI.getOperand(i).isReg() || !getConstant(MI.getOperand(i).getReg(),
+                                                  bits)) {
+      return false;
+    }
+    ops.push_back(bits);
+  }
+  const unsigned opcode = MI.getOpcode();
+  switch (opcode) {
+  case OpSNegate:
+  case OpNot:
+  case OpUConvert:
+  case OpSConvert:
+  case OpBitcast:
+    if (ops.size() != 1) {
+      return false;
+    }
+    break;
+  default:
+    if (ops.size() != 2) {
+      return false;
+    }
+    if (opcode == OpShiftLeftLogical || opcode == OpShiftRightLogical ||
+        opcode == OpShiftRightArithmetic) {
+      // The shift amount may be of another width, and shifting by the width
+      // or more is undefined
+      if (ops[1].uge(width)) {
+        return false;
+      }
+      ops[1] = APInt(width, ops[1].getZExtValue());
+    } else if (ops[0].getBitWidth() != width || ops[1].getBitWidth() != width) {
+      return false;
+    }
+    break;
+  }
+
+  const APInt &a = ops[0];
+  switch (opcode) {
+  case OpUConvert:
+    res = a.zextOrTrunc(width);
+    return true;
+  case OpSConvert:
+    res = a.sextOrTrunc(width);
+    return true;
+  case OpBitcast:
+    if (a.getBitWidth() != width) {
+      return false;
+    }
+    res = a;
+    return true;
+  case OpSNegate:
+    res = -a;
+    return a.getBitWidth() == width;
+  case OpNot:
+    res = ~a;
+    return a.getBitWidth() == width;
+  default:
+    break;
+  }
+
+  const APInt &b = ops[1];
+  switch (opcode) {
+  case OpIAdd:
+    res = a + b;
+    return true;
+  case OpISub:
+    res = a - b;
+    return true;
+  case OpIMul:
+    res = a * b;
+    return true;
+  case OpBitwiseAnd:
+    res = a & b;
+    return true;
+  case OpBitwiseOr:
+    res = a | b;
+    return true;
+  case OpBitwiseXor:
+    res = a ^ b;
+    return true;
+  case OpShiftLeftLogical:
+    res = a.shl(b);
+    return true;
+  case OpShiftRightLogical:
+    res = a.lshr(b);
+    return true;
+  case OpShiftRightArithmetic:
+    res = a.ashr(b);
+    return true;
+  default:
+    break;
+  }
+
+  // The divisions by zero and of the minimum signed value by -1 are undefined
+  if (b.isNullValue()) {
+    return false;
+  }
+  switch (opcode) {
+  case OpUDiv:
+    res = a.udiv(b);
+    return true;
+  case OpUMod:
+    res = a.urem(b);
+    return true;
+  default:
+    break;
+  }
+  if (a.isMinSignedValue() && b.isAllOnesValue()) {
+    return false;
+  }
+  switch (opcode) {
+  case OpSDiv:
+    res = a.sdiv(b);
+    return true;
+  case OpSRem:
+    res = a.srem(b);
+    return true;
+  case OpSMod:
+    // The sign of the result is the sign of the divisor
+    res = a.srem(b);
+    if (!res.isNullValue() && res.isNegative() != b.isNegative()) {
+      res += b;
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+static const fltSemantics &getFloatSemantics(unsigned width) {
+  switch (width) {
+  case 16:
+    return APFloat::IEEEhalf();
+  case 32:
+    return APFloat::IEEEsingle();
+  default:
+    return APFloat::IEEEdouble();
+  }
+}
+
+// Fold the float arithmetic and the conversions to and from floats
+bool SPIRVConstantFolding::foldFloat(const MachineInstr &MI, unsigned width,
+                                     APInt &res) const {
+  const unsigned opcode = MI.getOpcode();
+  SmallVector<APFloat, 2> ops;
+  unsigned opWidth = 0;
+  ScalarKind opKind = NoScalar;
+  APInt opBits;
+  for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+    const MachineOperand &op = MI.getOperand(i);
+    if (!op.isReg() || !getConstant(op.getReg(), opBits)) {
+      return false;
+    }
+    const MachineInstr *def = MRI->getVRegDef(op.getReg());
+    opKind = getScalarKind(def->getOperand(1).getReg(), opWidth);
+    if (opKind == FloatScalar) {
+      ops.push_back(APFloat(getFloatSemantics(opWidth), opBits));
+    }
+  }
+  const APFloat::roundingMode rm = APFloat::rmNearestTiesToEven;
+  const fltSemantics &sem = getFloatSemantics(width);
+  bool losesInfo;
+
+  // The conversions from integers, whose operand isn't a float
+  if (opcode == OpConvertSToF || opcode == OpConvertUToF) {
+    if (MI.getNumOperands() != 3 || opKind != IntScalar) {
+      return false;
+    }
+    APFloat val(sem);
+    val.convertFromAPInt(opBits, opcode == OpConvertSToF, rm);
+    res = val.bitcastToAPInt();
+    return true;
+  }
+  if (ops.size() != MI.getNumOperands() - 2 || ops.empty()) {
+    return false;
+  }
+
+  APFloat val = ops[0];
+  switch (opcode) {
+  case OpConvertFToS:
+  case OpConvertFToU: {
+    // Out of range values, infinities and NaNs have no defined result
+    APSInt intVal(width, opcode == OpConvertFToU);
+    bool isExact;
+    if (val.convertToInteger(intVal, APFloat::rmTowardZero, &isExact) &
+        APFloat::opInvalidOp) {
+      return false;
+    }
+    res = intVal;
+    return true;
+  }
+  case OpFConvert:
+    val.convert(sem, rm, &losesInfo);
+    break;
+  case OpFNegate:
+    val.changeSign();
+    break;
+  case OpFAdd:
+    val.add(ops[1], rm);
+    break;
+  case OpFSub:
+    val.subtract(ops[1], rm);
+    break;
+  case OpFMul:
+    val.multiply(ops[1], rm);
+    break;
+  case OpFDiv:
+    val.divide(ops[1], rm);
+    break;
+  case OpFRem:
+    // The sign of the result is the sign of the dividend, like fmod's
+    val.mod(ops[1]);
+    break;
+  default:
+    return false;
+  }
+  if (&val.getSemantics() != &sem) {
+    return false;
+  }
+  res = val.bitcastToAPInt();
+  return true;
+}
+
+// Fold the comparisons, logical ops and selects with a boolean result
+bool SPIRVConstantFolding::foldComparison(const MachineInstr &MI,
+                                          APInt &res) const {
+  if (MI.getNumOperands() < 3 || MI.getNumOperands() > 4) {
+    return false;
+  }
+  SmallVector<APInt, 2> ops;
+  unsigned width = 0;
+  ScalarKind kind = NoScalar;
+  for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+    const MachineOperand &op = MI.getOperand(i);
+    APInt bits;
+    if (!op.isReg() || !getConstant(op.getReg(), bits)) {
+      return false;
+    }
+    const MachineInstr *def = MRI->getVRegDef(op.getReg());
+    kind = def->getOpcode() == OpConstantTrue ||
+                   def->getOpcode() == OpConstantFalse
+               ? BoolScalar
+               : getScalarKind(def->getOperand(1).getReg(), width);
+    ops.push_back(bits);
+  }
+  const unsigned opcode = MI.getOpcode();
+  if (opcode == OpLogicalNot) {
+    if (ops.size() != 1 || kind != BoolScalar) {
+      return false;
+    }
+    res = ~ops[0];
+    return true;
+  }
+  if (ops.size() != 2 || ops[0].getBitWidth() != ops[1].getBitWidth()) {
+    return false;
+  }
+  const APInt &a = ops[0], &b = ops[1];
+  bool val;
+  if (kind == FloatScalar) {
+    const fltSemantics &sem = getFloatSemantics(width);
+    const APFloat::cmpResult cmp = APFloat(sem, a).compare(APFloat(sem, b));
+    const bool unordered = cmp == APFloat::cmpUnordered;
+    const bool lt = cmp == APFloat::cmpLessThan;
+    const bool eq = cmp == APFloat::cmpEqual;
+    const bool gt = cmp == APFloat::cmpGreaterThan;
+    switch (opcode) {
+    case OpFOrdEqual:
+      val = eq;
+      break;
+    case OpFUnordEqual:
+      val = unordered || eq;
+      break;
+    case OpFOrdNotEqual:
+      val = lt || gt;
+      break;
+    case OpFUnordNotEqual:
+      val = !eq;
+      break;
+    case OpFOrdLessThan:
+      val = lt;
+      break;
+    case OpFUnordLessThan:
+      val = unordered || lt;
+      break;
+    case OpFOrdGreaterThan:
+      val = gt;
+      break;
+    case OpFUnordGreaterThan:
+      val = unordered || gt;
+      break;
+    case OpFOrdLessThanEqual:
+      val = lt || eq;
+      break;
+    case OpFUnordLessThanEqual:
+      val = !gt;
+      break;
+    case OpFOrdGreaterThanEqual:
+      val = gt || eq;
+      break;
+    case OpFUnordGreaterThanEqual:
+      val = !lt;
+      break;
+    default:
+      return false;
+    }
+  } else if (kind == BoolScalar) {
+    switch (opcode) {
+    case OpLogicalEqual:
+      val = a == b;
+      break;
+    case OpLogicalNotEqual:
+      val = a != b;
+      break;
+    case OpLogicalAnd:
+      val = a.getBoolValue() && b.getBoolValue();
+      break;
+    case OpLogicalOr:
+      val = a.getBoolValue() || b.getBoolValue();
+      break;
+    default:
+      return false;
+    }
+  } else if (kind == IntScalar) {
+    switch (opcode) {
+    case OpIEqual:
+      val = a.eq(b);
+      break;
+    case OpINotEqual:
+      val = a.ne(b);
+      break;
+    case OpUGreaterThan:
+      val = a.ugt(b);
+      break;
+    case OpSGreaterThan:
+      val = a.sgt(b);
+      break;
+    case OpUGreaterThanEqual:
+      val = a.uge(b);
+      break;
+    case OpSGreaterThanEqual:
+      val = a.sge(b);
+      break;
+    case OpULessThan:
+      val = a.ult(b);
+      break;
+    case OpSLessThan:
+      val = a.slt(b);
+      break;
+    case OpULessThanEqual:
+      val = a.ule(b);
+      break;
+    case OpSLessThanEqual:
+      val = a.sle(b);
+      break;
+    default:
+      return false;
+    }
+  } else {
+    return false;
+  }
+  res = APInt(1, val);
+  return true;
+}
+
+// Fold the extraction from and construction of constant composites, and the
+// selects with a constant condition, into the register of their value
+Register SPIRVConstantFolding::foldComposite(MachineInstr &MI) const {
+  switch (MI.getOpcode()) {
+  case OpSelect: {
+    APInt cond;
+    if (MI.getNumOperands() != 5 || !getConstant(MI.getOperand(2).getReg(),
+                                                 cond)) {
+      return Register();
+    }
+    return MI.getOperand(cond.getBoolValue() ? 3 : 4).getReg();
+  }
+  case OpCompositeExtract: {
+    Register reg = MI.getOperand(2).getReg();
+    for (unsigned i = 3; i < MI.getNumOperands(); ++i) {
+      const MachineInstr *def = MRI->getVRegDef(reg);
+      const int64_t idx = MI.getOperand(i).getImm();
+      if (def && def->getOpcode() == OpConstantNull) {
+        // The elements of a null composite are null values of their type
+        Register newReg = MRI->createVirtualRegister(&IDRegClass);
+        BuildMI(*MI.getParent(), MI, MI.getDebugLoc(),
+                TII->get(OpConstantNull))
+            .addDef(newReg)
+            .addUse(MI.getOperand(1).getReg());
+        return newReg;
+      }
+      if (!def || def->getOpcode() != OpConstantComposite || idx < 0 ||
+          idx + 2 >= def->getNumOperands()) {
+        return Register();
+      }
+      reg = def->getOperand(idx + 2).getReg();
+    }
+    return reg == MI.getOperand(2).getReg() ? Register() : reg;
+  }
+  case OpCompositeConstruct: {
+    for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+      const MachineInstr *def = MRI->getVRegDef(MI.getOperand(i).getReg());
+      if (!def || !TII->isConstantInstr(*def) || def->getOpcode() == OpUndef ||
+          isSpecConstant(MI.getOperand(i).getReg())) {
+        return Register();
+      }
+    }
+    Register newReg = MRI->createVirtualRegister(&IDRegClass);
+    auto MIB = BuildMI(*MI.getParent(), MI, MI.getDebugLoc(),
+                       TII->get(OpConstantComposite))
+                   .addDef(newReg)
+                   .addUse(MI.getOperand(1).getReg());
+    for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+      MIB.addUse(MI.getOperand(i).getReg());
+    }
+    return newReg;
+  }
+  default:
+    break;
+  }
+  return Register();
+}
+
+// Build the constant of the type of MI's result with the given bits
+Register SPIRVConstantFolding::buildConstant(MachineInstr &MI,
+                                             const APInt &bits,
+                                             ScalarKind kind) const {
+  Register newReg = MRI->createVirtualRegister(&IDRegClass);
+  const Register typeReg = MI.getOperand(1).getReg();
+  if (kind == BoolScalar) {
+    const unsigned opcode =
+        bits.getBoolValue() ? OpConstantTrue : OpConstantFalse;
+    BuildMI(*MI.getParent(), MI, MI.getDebugLoc(), TII->get(opcode))
+        .addDef(newReg)
+        .addUse(typeReg);
+    return newReg;
+  }
+  // The literal is as wide as the type, lowest-order word first
+  const uint64_t val = bits.getZExtValue();
+  auto MIB = BuildMI(*MI.getParent(), MI, MI.getDebugLoc(),
+                     TII->get(OpConstant))
+                 .addDef(newReg)
+                 .addUse(typeReg)
+                 .addImm(val & 0xffffffff);
+  if (bits.getBitWidth() > 32) {
+    MIB.addImm(val >> 32);
+  }
+  return newReg;
+}
+
+// Replace MI by its computation on specialization constants, if SPIR-V allows
+// it, or return no register
+Register SPIRVConstantFolding::buildSpecConstant(MachineInstr &MI) const {
+  bool usesSpecConstant = false;
+  for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+    const MachineOperand &op = MI.getOperand(i);
+    if (!op.isReg()) {
+      continue;
+    }
+    const MachineInstr *def = MRI->getVRegDef(op.getReg());
+    if (!def || !TII->isConstantInstr(*def) || def->getOpcode() == OpUndef) {
+      return Register();
+    }
+    usesSpecConstant |= isSpecConstant(op.getReg());
+  }
+  if (!usesSpecConstant) {
+    return Register();
+  }
+  Register newReg = MRI->createVirtualRegister(&IDRegClass);
+  if (MI.getOpcode() == OpCompositeConstruct) {
+    auto MIB = BuildMI(*MI.getParent(), MI, MI.getDebugLoc(),
+                       TII->get(OpSpecConstantComposite))
+                   .addDef(newReg)
+                   .addUse(MI.getOperand(1).getReg());
+    for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+      MIB.addUse(MI.getOperand(i).getReg());
+    }
+    return newReg;
+  }
+  if (!isSPIRVSpecConstantOpOpcode(MI.getOpcode(), *ST)) {
+    return Register();
+  }
+  // The SPIR-V opcode of the computation is a literal operand
+  auto MIB = BuildMI(*MI.getParent(), MI, MI.getDebugLoc(),
+                     TII->get(OpSpecConstantOp))
+                 .addDef(newReg)
+                 .addUse(MI.getOperand(1).getReg())
+                 .addImm(getSPIRVOpcodeEncoding(MI.getDesc().TSFlags));
+  for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+    MIB.add(MI.getOperand(i));
+  }
+  return newReg;
+}
+
+// Move the uses of MI's result to newReg, dropping the names of the result
+void SPIRVConstantFolding::replaceResult(MachineInstr &MI, Register newReg) {
+  const Register oldReg = MI.getOperand(0).getReg();
+  TII->eraseAnnotations(oldReg, *MRI);
+  MRI->replaceRegWith(oldReg, newReg);
+  MI.eraseFromParent();
+}
+
+bool SPIRVConstantFolding::fold(MachineInstr &MI) {
+  if (MI.getNumDefs() != 1 || MI.getNumOperands() < 3 ||
+      !MI.getOperand(1).isReg() || !TII->isSideEffectFreeInstr(MI) ||
+      hasDecorations(MI.getOperand(0).getReg())) {
+    return false;
+  }
+  if (Register newReg = foldComposite(MI)) {
+    replaceResult(MI, newReg);
+    ++NumFolded;
+    return true;
+  }
+
+  unsigned width = 0;
+  const ScalarKind kind = getScalarKind(MI.getOperand(1).getReg(), width);
+  APInt res;
+  bool folded = false;
+  if (kind == IntScalar) {
+    folded = foldInt(MI, width, res) || foldFloat(MI, width, res);
+  } else if (kind == FloatScalar) {
+    folded = foldFloat(MI, width, res) || foldInt(MI, width, res);
+  } else if (kind == BoolScalar) {
+    folded = foldComparison(MI, res);
+  }
+  if (folded && res.getBitWidth() == width) {
+    replaceResult(MI, buildConstant(MI, res, kind));
+    ++NumFolded;
+    return true;
+  }
+
+  if (Register newReg = buildSpecConstant(MI)) {
+    replaceResult(MI, newReg);
+    ++NumSpecFolded;
+    return true;
+  }
+  return false;
+}
+
+bool SPIRVConstantFolding::runOnMachineFunction(MachineFunction &MF) {
+  if (skipFunction(MF.getFunction())) {
+    return false;
+  }
+  MRI = &MF.getRegInfo();
+  ST = &MF.getSubtarget<SPIRVSubtarget>();
+  TII = static_cast<const SPIRVInstrInfo *>(ST->getInstrInfo());
+
+  // Visit the definitions before their uses, so chains fold in one pass
+  bool changed = false;
+  ReversePostOrderTraversal<MachineFunction *> RPOT(&MF);
+  for (MachineBasicBlock *MBB : RPOT) {
+    for (MachineInstr &MI : make_early_inc_range(*MBB)) {
+      changed |= fold(MI);
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVConstantFolding, DEBUG_TYPE,
+                "SPIRV fold instructions on constants", false, false)
+
+char SPIRVConstantFolding::ID = 0;
+
+FunctionPass *llvm::createSPIRVConstantFoldingPass() {
+  return new SPIRVConstantFolding();
+}
@@ -0,0 +1,214 @@
+//===-- SPIRVDebugLines.cpp - Emit OpLine source locations ------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Implementation of SPIRVDebugLines, which attributes the instructions of each
+// function to their source location with OpLine, so profilers and debuggers
+// can map them back to the source. An OpLine applies to every instruction up
+// to the next one or the end of the block, so one is only added where the
+// location changes. Each file name is an OpString, which is interned in the
+// debug section of the module once SPIRVGlobalTypesAndRegNum hoists it.
+//
+// The level follows the compile units of the module, and can be overridden
+// with -spirv-debug-lines:
+//  - line-tables-only: only lines are given, and instructions without a
+//    location keep the previous one, which keeps the size small.
+//  - full: lines and columns are given, and OpNoLine ends the location
+//    before instructions without one.
+//
+// This must run after SPIRVBlockLabeler, as OpLines go after the OpLabel.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVInstrInfo.h"
+#include "SPIRVRegisterInfo.h"
+#include "SPIRVStrings.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Path.h"
+
+using namespace llvm;
+using namespace SPIRV;
+
+#define DEBUG_TYPE "spirv-debug-lines"
+
+STATISTIC(NumLines, "Number of OpLines added");
+STATISTIC(NumNoLines, "Number of OpNoLines added");
+
+namespace {
+enum class DebugLinesLevel { None, LineTablesOnly, Full };
+} // namespace
+
+static cl::opt<DebugLinesLevel> DebugLines(
+    "spirv-debug-lines", cl::Hidden,
+    cl::desc("Emit the source location of instructions with OpLine, rather "
+             "than following the compile units of the module"),
+    cl::values(clEnumValN(DebugLinesLevel::None, "none", "No OpLines"),
+               clEnumValN(DebugLinesLevel::LineTablesOnly, "line-tables-only",
+                          "OpLines with lines only"),
+               clEnumValN(DebugLinesLevel::Full, "full",
+                          "OpLines with lines and columns, and OpNoLines")));
+
+namespace {
+class SPIRVDebugLines : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVDebugLines() : MachineFunctionPass(ID) {
+    initializeSPIRVDebugLinesPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+};
+
+// The location an OpLine gives, with a null file when none is active.
+struct LineLoc {
+  const DIFile *file = nullptr;
+  unsigned line = 0;
+  unsigned col = 0;
+  bool operator==(const LineLoc &other) const {
+    return file == other.file && line == other.line && col == other.col;
+  }
+};
+} // namespace
+
+// Get the level of the given module, following the most detailed compile unit
+// unless -spirv-debug-lines is given.
+static DebugLinesLevel getDebugLinesLevel(const Module &M) {
+  if (DebugLines.getNumOccurrences()) {
+    return DebugLines;
+  }
+  DebugLinesLevel level = DebugLinesLevel::None;
+  for (const DICompileUnit *CU : M.debug_compile_units()) {
+    switch (CU->getEmissionKind()) {
+    case DICompileUnit::FullDebug:
+      return DebugLinesLevel::Full;
+    case DICompileUnit::LineTablesOnly:
+    case DICompileUnit::DebugDirectivesOnly:
+      level = DebugLinesLevel::LineTablesOnly;
+      break;
+    default:
+      break;
+    }
+  }
+  return level;
+}
+
+// Whether an OpLine may go right before the instruction. OpPhis and
+// OpVariables must come first in their block, and merge instructions must
+// immediately precede their branch.
+static bool canHaveLine(const MachineInstr &MI, const SPIRVInstrInfo &TII) {
+  switch (MI.getOpcode()) {
+  case OpFunction:
+  case OpFunctionParameter:
+  case OpFunctionEnd:
+  case OpLabel:
+  case OpPhi:
+  case OpVariable:
+  case OpLoopMerge:
+  case OpLoopControlINTEL:
+  case OpSelectionMerge:
+    return false;
+  default:
+    return !MI.isTerminator() && !TII.isHeaderInstr(MI);
+  }
+}
+
+static std::string getFilePath(const DIFile *file) {
+  SmallString<128> path = file->getDirectory();
+  if (path.empty() || sys::path::is_absolute(file->getFilename())) {
+    return file->getFilename().str();
+  }
+  sys::path::append(path, file->getFilename());
+  return path.str().str();
+}
+
+bool SPIRVDebugLines::runOnMachineFunction(MachineFunction &MF) {
+  const Module &M = *MF.getFunction().getParent();
+  const DebugLinesLevel level = getDebugLinesLevel(M);
+  if (level == DebugLinesLevel::None) {
+    return false;
+  }
+  const auto &TII = static_cast<const SPIRVInstrInfo &>(
+      *MF.getSubtarget().getInstrInfo());
+  MachineIRBuilder MIRBuilder;
+  MIRBuilder.setMF(MF);
+
+  // The OpString of each file, built before the entry block's OpLabel with the
+  // other function-local header instructions
+  MachineBasicBlock &entry = MF.front();
+  auto stringsPos = entry.begin();
+  while (stringsPos != entry.end() && stringsPos->getOpcode() != OpLabel) {
+    ++stringsPos;
+  }
+  StringMap<Register> fileStrings;
+  auto getFileString = [&](const DIFile *file) {
+    std::string path = getFilePath(file);
+    auto it = fileStrings.find(path);
+    if (it != fileStrings.end()) {
+      return it->second;
+    }
+    MIRBuilder.setInsertPt(entry, stringsPos);
+    Register str = MIRBuilder.getMRI()->createVirtualRegister(&IDRegClass);
+    auto MIB = MIRBuilder.buildInstr(OpString).addDef(str);
+    addStringImm(path, MIB);
+    fileStrings[path] = str;
+    return str;
+  };
+
+  bool changed = false;
+  for (MachineBasicBlock &MBB : MF) {
+    // No location is active at the start of a block
+    LineLoc current;
+    for (MachineInstr &MI : MBB) {
+      if (!canHaveLine(MI, TII)) {
+        continue;
+      }
+      LineLoc loc;
+      if (const DILocation *DL = MI.getDebugLoc().get()) {
+        loc = {DL->getFile(), DL->getLine(),
+               level == DebugLinesLevel::Full ? DL->getColumn() : 0};
+      }
+      if (!loc.file && level == DebugLinesLevel::LineTablesOnly) {
+        continue;
+      }
+      if (loc == current) {
+        continue;
+      }
+      current = loc;
+      changed = true;
+      if (!loc.file) {
+        MIRBuilder.setInstr(MI);
+        MIRBuilder.buildInstr(OpNoLine);
+        ++NumNoLines;
+        continue;
+      }
+      Register file = getFileString(loc.file);
+      MIRBuilder.setInstr(MI);
+      MIRBuilder.buildInstr(OpLine)
+          .addUse(file)
+          .addImm(loc.line)
+          .addImm(loc.col);
+      ++NumLines;
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVDebugLines, DEBUG_TYPE, "SPIRV emit source locations",
+                false, false)
+
+char SPIRVDebugLines::ID = 0;
+
+FunctionPass *llvm::createSPIRVDebugLinesPass() {
+  return new SPIRVDebugLines();
+}
@@ -0,0 +1,223 @@
+//===-- SPIRVDemoteFP64.cpp - Compute float math in float -------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// With -spirv-demote-fp64, compute in float the double arithmetic whose
+// operands are floats or double constants, such as the x * 0.5 of OpenCL C
+// code forgetting the f suffix. Consumer GPUs often execute double arithmetic
+// at a small fraction of the float rate, so such accidental literals can
+// dominate a kernel's run time.
+//
+// The constants are rounded to float, as -cl-single-precision-constant makes
+// the frontend do, so this is only an opt-in mode. Expressions truncated back
+// to float and comparisons are demoted, when their leaves are extensions of
+// floats or constants. Each demotion gets a remark, e.g. for
+// -pass-remarks=spirv-demote-fp64.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+using namespace PatternMatch;
+
+#define DEBUG_TYPE "spirv-demote-fp64"
+
+STATISTIC(NumDemotedOps, "Number of double operations computed in float");
+
+static cl::opt<bool> DemoteFP64(
+    "spirv-demote-fp64", cl::Hidden, cl::init(false),
+    cl::desc("Compute the double arithmetic of floats and double constants "
+             "in float, rounding the constants to float"));
+
+// The depth of the expressions to rewrite, to bound the compile time
+static const unsigned MaxDemotionDepth = 8;
+
+namespace {
+class SPIRVDemoteFP64 : public FunctionPass {
+public:
+  static char ID;
+  SPIRVDemoteFP64() : FunctionPass(ID) {
+    initializeSPIRVDemoteFP64Pass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+    AU.setPreservesCFG();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+// Get the float, or vector of floats, type with as many elements as ty
+static Type *getFloatTypeLike(Type *ty) {
+  Type *floatTy = Type::getFloatTy(ty->getContext());
+  if (auto *VT = dyn_cast<VectorType>(ty)) {
+    return VectorType::get(floatTy, VT->getNumElements());
+  }
+  return floatTy;
+}
+
+static bool isDemotableOp(const Value *V) {
+  if (isa<UnaryOperator>(V)) {
+    return cast<UnaryOperator>(V)->getOpcode() == Instruction::FNeg;
+  }
+  const auto *BO = dyn_cast<BinaryOperator>(V);
+  if (!BO) {
+    return false;
+  }
+  switch (BO->getOpcode()) {
+  case Instruction::FAdd:
+  case Instruction::FSub:
+  case Instruction::FMul:
+  case Instruction::FDiv:
+  case Instruction::FRem:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Whether the double value V can be computed in float, its leaves being
+// extensions of floats or constants. The operations must only be used by the
+// expression, as they're replaced.
+static bool canDemote(Value *V, Type *floatTy, unsigned depth) {
+  if (isa<Constant>(V)) {
+    return true;
+  }
+  Value *src;
+  if (match(V, m_FPExt(m_Value(src)))) {
+    return src->getType() == floatTy;
+  }
+  if (!isDemotableOp(V) || !V->hasOneUse() || depth == MaxDemotionDepth) {
+    return false;
+  }
+  for (Value *op : cast<Instruction>(V)->operands()) {
+    if (!canDemote(op, floatTy, depth + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static Value *buildDemoted(Value *V, Type *floatTy, IRBuilder<> &B,
+                           unsigned &numOps) {
+  if (auto *C = dyn_cast<Constant>(V)) {
+    return ConstantExpr::getFPTrunc(C, floatTy);
+  }
+  Value *src;
+  if (match(V, m_FPExt(m_Value(src)))) {
+    return src;
+  }
+  auto *I = cast<Instruction>(V);
+  Value *demoted;
+  if (auto *UO = dyn_cast<UnaryOperator>(I)) {
+    Value *op = buildDemoted(UO->getOperand(0), floatTy, B, numOps);
+    demoted = B.CreateFNeg(op, I->getName() + ".demoted");
+  } else {
+    Value *lhs = buildDemoted(I->getOperand(0), floatTy, B, numOps);
+    Value *rhs = buildDemoted(I->getOperand(1), floatTy, B, numOps);
+    demoted = B.CreateBinOp(cast<BinaryOperator>(I)->getOpcode(), lhs, rhs,
+                            I->getName() + ".demoted");
+  }
+  if (auto *demotedI = dyn_cast<Instruction>(demoted)) {
+    demotedI->copyFastMathFlags(I);
+  }
+  ++numOps;
+  return demoted;
+}
+
+// Demote the double expression truncated to float by T, if possible
+static Value *demoteTrunc(FPTruncInst &T, unsigned &numOps) {
+  Value *src = T.getOperand(0);
+  if (!src->getType()->getScalarType()->isDoubleTy() || !isDemotableOp(src) ||
+      !canDemote(src, T.getDestTy(), 0)) {
+    return nullptr;
+  }
+  IRBuilder<> B(&T);
+  return buildDemoted(src, T.getDestTy(), B, numOps);
+}
+
+// Demote the comparison of doubles, if both can be computed in float and one
+// of them is a float, not a constant
+static Value *demoteCmp(FCmpInst &C, unsigned &numOps) {
+  Type *ty = C.getOperand(0)->getType();
+  if (!ty->getScalarType()->isDoubleTy() ||
+      (isa<Constant>(C.getOperand(0)) && isa<Constant>(C.getOperand(1)))) {
+    return nullptr;
+  }
+  Type *floatTy = getFloatTypeLike(ty);
+  if (!canDemote(C.getOperand(0), floatTy, 0) ||
+      !canDemote(C.getOperand(1), floatTy, 0)) {
+    return nullptr;
+  }
+  IRBuilder<> B(&C);
+  Value *lhs = buildDemoted(C.getOperand(0), floatTy, B, numOps);
+  Value *rhs = buildDemoted(C.getOperand(1), floatTy, B, numOps);
+  ++numOps;
+  auto *demoted = B.CreateFCmp(C.getPredicate(), lhs, rhs, C.getName());
+  if (auto *demotedI = dyn_cast<Instruction>(demoted)) {
+    demotedI->copyFastMathFlags(&C);
+  }
+  return demoted;
+}
+
+bool SPIRVDemoteFP64::runOnFunction(Function &F) {
+  if (!DemoteFP64 || skipFunction(F)) {
+    return false;
+  }
+  auto &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+
+  SmallVector<Instruction *, 16> roots;
+  for (Instruction &I : instructions(F)) {
+    if ((isa<FPTruncInst>(I) && I.getType()->getScalarType()->isFloatTy()) ||
+        isa<FCmpInst>(I)) {
+      roots.push_back(&I);
+    }
+  }
+
+  bool changed = false;
+  for (Instruction *I : roots) {
+    unsigned numOps = 0;
+    Value *demoted = isa<FPTruncInst>(I)
+                         ? demoteTrunc(*cast<FPTruncInst>(I), numOps)
+                         : demoteCmp(*cast<FCmpInst>(I), numOps);
+    if (!demoted) {
+      continue;
+    }
+    NumDemotedOps += numOps;
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "DemotedToFloat", I)
+             << "computed " << ore::NV("NumOps", numOps)
+             << " double operations in float";
+    });
+    I->replaceAllUsesWith(demoted);
+    RecursivelyDeleteTriviallyDeadInstructions(I);
+    changed = true;
+  }
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVDemoteFP64, DEBUG_TYPE,
+                      "SPIRV compute float math in float", false, false)
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+INITIALIZE_PASS_END(SPIRVDemoteFP64, DEBUG_TYPE,
+                    "SPIRV compute float math in float", false, false)
+
+char SPIRVDemoteFP64::ID = 0;
+
+FunctionPass *llvm::createSPIRVDemoteFP64Pass() {
+  return new SPIRVDemoteFP64();
+}
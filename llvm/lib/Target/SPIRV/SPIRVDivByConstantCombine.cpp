@@ -0,0 +1,283 @@
+//===-- SPIRVDivByConstantCombine.cpp - Divide by constants ----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Rewrite the scalar G_UDIV, G_SDIV, G_UREM and G_SREM by constants into the
+// multiply-high and shift sequences of Hacker's Delight, which DAGCombiner uses
+// for other targets. Several drivers don't strength-reduce OpUDiv and friends,
+// which cost tens of cycles each, while index math often divides by constant
+// image widths, tile sizes and moduli.
+//
+// Powers of 2 are divided with shifts, and remainders are computed from the
+// quotient. The G_UMULH and G_SMULH built are selected to OpenCL.std's mul_hi,
+// or the high half of OpUMulExtended and OpSMulExtended.
+//
+// This runs right before legalization, so the new vregs are given their SPIR-V
+// types the same way the legalizer's are. The subtarget decides whether it
+// runs, see SPIRVSubtarget::expandsDivByConstant.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVLegalizerInfo.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/IR/Constants.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-div-by-constant-combine"
+
+STATISTIC(NumDivsExpanded, "Number of divisions by constants expanded");
+STATISTIC(NumRemsExpanded, "Number of remainders by constants expanded");
+
+namespace {
+class SPIRVDivByConstantCombine : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVDivByConstantCombine() : MachineFunctionPass(ID) {
+    initializeSPIRVDivByConstantCombinePass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  MachineRegisterInfo *MRI;
+
+  // Build the quotient of the numerator by the constant divisor, into dst if
+  // given. Return an invalid register if the divisor is better left alone.
+  Register buildUDiv(Register num, const APInt &divisor, Register dst,
+                     MachineIRBuilder &MIRBuilder);
+  Register buildSDiv(Register num, const APInt &divisor, Register dst,
+                     MachineIRBuilder &MIRBuilder);
+  bool combine(MachineInstr &MI);
+};
+} // namespace
+
+Register SPIRVDivByConstantCombine::buildUDiv(Register num,
+                                              const APInt &divisor,
+                                              Register dst,
+                                              MachineIRBuilder &MIRBuilder) {
+  const LLT ty = MRI->getType(num);
+  auto getDst = [&](bool isLast) {
+    if (isLast && dst.isValid()) {
+      return dst;
+    }
+    return MRI->createGenericVirtualRegister(ty);
+  };
+  if (divisor.isPowerOf2()) {
+    return MIRBuilder
+        .buildLShr(getDst(true), num,
+                   MIRBuilder.buildConstant(ty, divisor.logBase2()))
+        .getReg(0);
+  }
+
+  // An even divisor needing the add fixup can instead shift its factors of 2
+  // out of the numerator first
+  APInt::mu magics = divisor.magicu();
+  unsigned preShift = 0;
+  if (magics.a && !divisor[0]) {
+    preShift = divisor.countTrailingZeros();
+    magics = divisor.lshr(preShift).magicu(preShift);
+    assert(!magics.a && "Should not need the add fixup after shifting");
+  }
+  const unsigned postShift = magics.a ? magics.s - 1 : magics.s;
+
+  Register q = num;
+  if (preShift) {
+    q = MIRBuilder
+            .buildLShr(getDst(false), q, MIRBuilder.buildConstant(ty, preShift))
+            .getReg(0);
+  }
+  bool isLast = !magics.a && !postShift;
+  q = MIRBuilder
+          .buildInstr(TargetOpcode::G_UMULH, {getDst(isLast)},
+                      {q, MIRBuilder.buildConstant(ty, magics.m)})
+          .getReg(0);
+  if (magics.a) {
+    // q + ((num - q) >> 1), which can't overflow
+    Register npq = MIRBuilder.buildSub(getDst(false), num, q).getReg(0);
+    npq = MIRBuilder
+              .buildLShr(getDst(false), npq, MIRBuilder.buildConstant(ty, 1))
+              .getReg(0);
+    q = MIRBuilder.buildAdd(getDst(!postShift), npq, q).getReg(0);
+  }
+  if (postShift) {
+    q = MIRBuilder
+            .buildLShr(getDst(true), q, MIRBuilder.buildConstant(ty, postShift))
+            .getReg(0);
+  }
+  return q;
+}
+
+Register SPIRVDivByConstantCombine::buildSDiv(Register num,
+                                              const APInt &divisor,
+                                              Register dst,
+                                              MachineIRBuilder &MIRBuilder) {
+  const LLT ty = MRI->getType(num);
+  const unsigned width = ty.getSizeInBits();
+  auto getDst = [&](bool isLast) {
+    if (isLast && dst.isValid()) {
+      return dst;
+    }
+    return MRI->createGenericVirtualRegister(ty);
+  };
+  // Dividing by 1 or -1 is already cheap, and the magic numbers don't handle
+  // the divisors whose absolute value doesn't fit
+  if (divisor.isOneValue() || divisor.isAllOnesValue() ||
+      divisor.isMinSignedValue()) {
+    return Register();
+  }
+
+  if (divisor.abs().isPowerOf2()) {
+    // Round towards 0 by adding 2^k - 1 to negative numerators before the
+    // arithmetic shift
+    const unsigned k = divisor.abs().logBase2();
+    const bool isNegative = divisor.isNegative();
+    Register sign =
+        MIRBuilder
+            .buildAShr(getDst(false), num,
+                       MIRBuilder.buildConstant(ty, width - 1))
+            .getReg(0);
+    Register bias =
+        MIRBuilder
+            .buildLShr(getDst(false), sign,
+                       MIRBuilder.buildConstant(ty, width - k))
+            .getReg(0);
+    Register sum = MIRBuilder.buildAdd(getDst(false), num, bias).getReg(0);
+    Register q = MIRBuilder
+                     .buildAShr(getDst(!isNegative), sum,
+                                MIRBuilder.buildConstant(ty, k))
+                     .getReg(0);
+    if (isNegative) {
+      q = MIRBuilder
+              .buildSub(getDst(true), MIRBuilder.buildConstant(ty, 0), q)
+              .getReg(0);
+    }
+    return q;
+  }
+
+  const APInt::ms magics = divisor.magic();
+  Register q = MIRBuilder
+                   .buildInstr(TargetOpcode::G_SMULH, {getDst(false)},
+                               {num, MIRBuilder.buildConstant(ty, magics.m)})
+                   .getReg(0);
+  // Correct the product when the magic number's sign differs from the
+  // divisor's, as it then overflowed
+  if (divisor.isStrictlyPositive() && magics.m.isNegative()) {
+    q = MIRBuilder.buildAdd(getDst(false), q, num).getReg(0);
+  } else if (divisor.isNegative() && magics.m.isStrictlyPositive()) {
+    q = MIRBuilder.buildSub(getDst(false), q, num).getReg(0);
+  }
+  if (magics.s) {
+    q = MIRBuilder
+            .buildAShr(getDst(false), q, MIRBuilder.buildConstant(ty, magics.s))
+            .getReg(0);
+  }
+  // Add 1 to negative quotients to round them towards 0
+  Register signBit =
+      MIRBuilder
+          .buildLShr(getDst(false), q, MIRBuilder.buildConstant(ty, width - 1))
+          .getReg(0);
+  return MIRBuilder.buildAdd(getDst(true), q, signBit).getReg(0);
+}
+
+bool SPIRVDivByConstantCombine::combine(MachineInstr &MI) {
+  const unsigned opcode = MI.getOpcode();
+  const bool isSigned =
+      opcode == TargetOpcode::G_SDIV || opcode == TargetOpcode::G_SREM;
+  const bool isRem =
+      opcode == TargetOpcode::G_UREM || opcode == TargetOpcode::G_SREM;
+  Register dst = MI.getOperand(0).getReg();
+  Register num = MI.getOperand(1).getReg();
+  const LLT ty = MRI->getType(dst);
+  if (!ty.isScalar() || ty.getSizeInBits() < 8) {
+    return false;
+  }
+  const MachineInstr *divisorDef = MRI->getVRegDef(MI.getOperand(2).getReg());
+  if (!divisorDef || divisorDef->getOpcode() != TargetOpcode::G_CONSTANT) {
+    return false;
+  }
+  const APInt &divisor = divisorDef->getOperand(1).getCImm()->getValue();
+  if (divisor.isNullValue() || (!isSigned && divisor.isOneValue())) {
+    return false;
+  }
+
+  MachineIRBuilder MIRBuilder(MI);
+  if (isRem && !isSigned && divisor.isPowerOf2()) {
+    MIRBuilder.buildAnd(dst, num, MIRBuilder.buildConstant(ty, divisor - 1));
+  } else {
+    // Remainders are num - (num / divisor) * divisor
+    Register qDst = isRem ? Register() : dst;
+    Register q = isSigned ? buildSDiv(num, divisor, qDst, MIRBuilder)
+                          : buildUDiv(num, divisor, qDst, MIRBuilder);
+    if (!q.isValid()) {
+      return false;
+    }
+    if (isRem) {
+      auto prod =
+          MIRBuilder.buildMul(ty, q, MIRBuilder.buildConstant(ty, divisor));
+      MIRBuilder.buildSub(dst, num, prod);
+    }
+  }
+  MI.eraseFromParent();
+  if (isRem) {
+    ++NumRemsExpanded;
+  } else {
+    ++NumDivsExpanded;
+  }
+  return true;
+}
+
+bool SPIRVDivByConstantCombine::runOnMachineFunction(MachineFunction &MF) {
+  const auto &ST = MF.getSubtarget<SPIRVSubtarget>();
+  if (!ST.expandsDivByConstant()) {
+    return false;
+  }
+  MRI = &MF.getRegInfo();
+  SPIRVTypeRegistry *TR = ST.getSPIRVTypeRegistry();
+
+  SmallVector<MachineInstr *, 8> candidates;
+  for (auto &MBB : MF) {
+    for (auto &MI : MBB) {
+      switch (MI.getOpcode()) {
+      case TargetOpcode::G_UDIV:
+      case TargetOpcode::G_SDIV:
+      case TargetOpcode::G_UREM:
+      case TargetOpcode::G_SREM:
+        candidates.push_back(&MI);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  const unsigned firstNewVRegIdx = MRI->getNumVirtRegs();
+  bool changed = false;
+  for (MachineInstr *MI : candidates) {
+    changed |= combine(*MI);
+  }
+  if (changed) {
+    TR->checkFunction(MF);
+    assignLegalizedVRegTypes(MF, *TR, firstNewVRegIdx);
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVDivByConstantCombine, DEBUG_TYPE,
+                "SPIRV expand divisions by constants", false, false)
+
+char SPIRVDivByConstantCombine::ID = 0;
+
+FunctionPass *llvm::createSPIRVDivByConstantCombinePass() {
+  return new SPIRVDivByConstantCombine();
+}
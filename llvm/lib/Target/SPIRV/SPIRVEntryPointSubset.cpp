@@ -0,0 +1,109 @@
+//===-- SPIRVEntryPointSubset.cpp - Keep only some kernels ------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// With -spirv-entry-points=foo,bar, compile only the given kernels and what
+// they use. Device images often hold hundreds of kernels while a launch only
+// needs a few, so a JIT compiling them lazily would otherwise translate and
+// number the whole module each time.
+//
+// Every other global is given internal linkage, so the GlobalDCE pass run
+// right after removes the other kernels and whatever only they use, before the
+// compilation cache computes its key and before IR translation. The kernels a
+// kept one calls are kept, but no longer exported.
+//
+// With -spirv-executable, the module is final, so every kernel is kept but
+// nothing else is exported. Exported functions get LinkageAttributes Export
+// decorations, need the Linkage capability, and drivers must keep them, even
+// when only inlined or never called.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-entry-point-subset"
+
+STATISTIC(NumDroppedKernels, "Number of kernels not kept as entry points");
+STATISTIC(NumInternalized, "Number of functions no longer exported");
+
+static cl::list<std::string>
+    EntryPoints("spirv-entry-points", cl::CommaSeparated, cl::Hidden,
+                cl::desc("Only compile the given kernels and the functions "
+                         "and variables they use"),
+                cl::value_desc("kernel,..."));
+
+static cl::opt<bool> ExecutableModule(
+    "spirv-executable", cl::Hidden, cl::init(false),
+    cl::desc("Compile a module which won't be linked, exporting only kernels"));
+
+namespace {
+class SPIRVEntryPointSubset : public ModulePass {
+public:
+  static char ID;
+  SPIRVEntryPointSubset() : ModulePass(ID) {
+    initializeSPIRVEntryPointSubsetPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+};
+} // namespace
+
+static bool isKernel(const GlobalValue &GV) {
+  const auto *F = dyn_cast<Function>(&GV);
+  return F && F->getCallingConv() == CallingConv::SPIR_KERNEL;
+}
+
+bool SPIRVEntryPointSubset::runOnModule(Module &M) {
+  if (EntryPoints.empty()) {
+    if (!ExecutableModule) {
+      return false;
+    }
+    for (const Function &F : M) {
+      if (!F.isDeclaration() && !F.hasLocalLinkage() && !isKernel(F)) {
+        ++NumInternalized;
+      }
+    }
+    return internalizeModule(M, isKernel);
+  }
+  StringSet<> kept;
+  for (const std::string &name : EntryPoints) {
+    const Function *F = M.getFunction(name);
+    if (!F || F->isDeclaration() ||
+        F->getCallingConv() != CallingConv::SPIR_KERNEL) {
+      report_fatal_error("-spirv-entry-points: no kernel named " + name);
+    }
+    kept.insert(name);
+  }
+  for (const Function &F : M) {
+    if (!F.isDeclaration() && F.getCallingConv() == CallingConv::SPIR_KERNEL &&
+        !kept.count(F.getName())) {
+      ++NumDroppedKernels;
+    }
+  }
+  return internalizeModule(
+      M, [&](const GlobalValue &GV) { return kept.count(GV.getName()); });
+}
+
+INITIALIZE_PASS(SPIRVEntryPointSubset, DEBUG_TYPE,
+                "SPIRV keep only the requested entry points", false, false)
+
+char SPIRVEntryPointSubset::ID = 0;
+
+ModulePass *llvm::createSPIRVEntryPointSubsetPass() {
+  return new SPIRVEntryPointSubset();
+}
+
+bool llvm::isSPIRVEntryPointSubsetEnabled() { return !EntryPoints.empty(); }
+
+bool llvm::isSPIRVExecutableModule() { return ExecutableModule; }
@@ -14,14 +14,21 @@
 #include "SPIRVEnumRequirements.h"
 #include "SPIRVSubtarget.h"
 #include <algorithm>
+#include <initializer_list>
 
+// The array backing a static initializer_list lives as long as it does, and
+// unlike an array, it may be empty
 #define MAKE_CAPABILITY_CASE(Enum, Var, Val, Caps, Exts, MinVer, MaxVer)       \
-  case Enum::Var:                                                              \
-    return Caps;
+  case Enum::Var: {                                                            \
+    static const std::initializer_list<::Capability::Capability> caps = Caps;  \
+    return caps;                                                               \
+  }
 
 #define MAKE_EXTENSION_CASE(Enum, Var, Val, Caps, Exts, MinVer, MaxVer)        \
-  case Enum::Var:                                                              \
-    return Exts;
+  case Enum::Var: {                                                            \
+    static const std::initializer_list<::Extension::Extension> exts = Exts;    \
+    return exts;                                                               \
+  }
 
 #define MAKE_MIN_VERSION_CASE(Enum, Var, Val, Caps, Exts, MinVer, MaxVer)      \
   case Enum::Var:                                                              \
@@ -32,7 +39,7 @@
     return MaxVer;
 
 #define DEF_CAPABILITY_FUNC_BODY(EnumName, DefEnumCommand)                     \
-  const std::vector<Capability::Capability> get##EnumName##Capabilities(       \
+  llvm::ArrayRef<Capability::Capability> get##EnumName##Capabilities(          \
       EnumName::EnumName e) {                                                  \
     using namespace Capability;                                                \
     switch (e) { DefEnumCommand(EnumName, MAKE_CAPABILITY_CASE) }              \
@@ -40,7 +47,7 @@
   }
 
 #define DEF_EXTENSION_FUNC_BODY(EnumName, DefEnumCommand)                      \
-  const std::vector<Extension::Extension> get##EnumName##Extensions(           \
+  llvm::ArrayRef<Extension::Extension> get##EnumName##Extensions(              \
       EnumName::EnumName e) {                                                  \
     using namespace Extension;                                                 \
     switch (e) { DefEnumCommand(EnumName, MAKE_EXTENSION_CASE) }               \
@@ -78,6 +85,9 @@
         } else {                                                               \
           return {false, {}, {}, 0, 0};                                        \
         }                                                                      \
+      } else if (reqMinVer && targetVer && minVerOK && maxVerOK) {             \
+        /* Extensions merged into core aren't needed from their min version */ \
+        return {true, {}, {}, reqMinVer, reqMaxVer};                           \
       }                                                                        \
     } else if (minVerOK && maxVerOK) {                                         \
       for (auto cap : reqCaps) { /* Only need 1 of the capabilities to work */ \
@@ -142,4 +152,5 @@ GEN_ENUM_REQS_IMPL(Scope)
 GEN_ENUM_REQS_IMPL(GroupOperation)
 GEN_ENUM_REQS_IMPL(KernelEnqueueFlags)
 GEN_ENUM_REQS_IMPL(KernelProfilingInfo)
+GEN_ENUM_REQS_IMPL(PackedVectorFormat)
 
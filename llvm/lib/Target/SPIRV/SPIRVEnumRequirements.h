@@ -15,6 +15,7 @@
 #define LLVM_LIB_TARGET_SPIRV_ENUMREQUIREMENTS_H
 
 #include "SPIRVEnums.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/Optional.h"
 
 namespace llvm {
@@ -25,13 +26,13 @@ class SPIRVRequirements {
 public:
   const bool isSatisfiable;
   const llvm::Optional<Capability::Capability> cap;
-  const std::vector<Extension::Extension> exts;
+  const llvm::ArrayRef<Extension::Extension> exts;
   const uint32_t minVer; // 0 if no min version is required
   const uint32_t maxVer; // 0 if no max version is required
 
   SPIRVRequirements(bool isSatisfiable = false,
                     llvm::Optional<Capability::Capability> cap = {},
-                    std::vector<Extension::Extension> exts = {},
+                    llvm::ArrayRef<Extension::Extension> exts = {},
                     uint32_t minVer = 0, uint32_t maxVer = 0)
       : isSatisfiable(isSatisfiable), cap(cap), exts(exts), minVer(minVer),
         maxVer(maxVer) {}
@@ -39,12 +40,13 @@ public:
       : SPIRVRequirements(true, {cap}) {}
 };
 
+// The returned lists are static tables, so the queries don't allocate
 #define DEF_CAPABILITY_FUNC_HEADER(EnumName)                                   \
-  const std::vector<Capability::Capability> get##EnumName##Capabilities(       \
+  llvm::ArrayRef<Capability::Capability> get##EnumName##Capabilities(          \
       EnumName::EnumName e);
 
 #define DEF_EXTENSION_FUNC_HEADER(EnumName)                                    \
-  const std::vector<Extension::Extension> get##EnumName##Extensions(           \
+  llvm::ArrayRef<Extension::Extension> get##EnumName##Extensions(              \
       EnumName::EnumName e);
 
 #define DEF_MIN_VERSION_FUNC_HEADER(EnumName)                                  \
@@ -98,5 +100,6 @@ GEN_ENUM_REQS_HEADER(Scope)
 GEN_ENUM_REQS_HEADER(GroupOperation)
 GEN_ENUM_REQS_HEADER(KernelEnqueueFlags)
 GEN_ENUM_REQS_HEADER(KernelProfilingInfo)
+GEN_ENUM_REQS_HEADER(PackedVectorFormat)
 
 #endif
@@ -22,7 +22,7 @@ GEN_ENUM_IMPL(ExecutionMode)
 GEN_ENUM_IMPL(StorageClass)
 
 // Dim must be implemented manually, as "1D" is not a valid C++ naming token
-std::string getDimName(Dim::Dim dim) {
+llvm::StringRef getDimName(Dim::Dim dim) {
   switch (dim) {
   case Dim::DIM_1D:
     return "1D";
@@ -42,6 +42,7 @@ std::string getDimName(Dim::Dim dim) {
     return "UNKNOWN_Dim";
   }
 }
+DEF_PRINT_NAME_FUNC_BODY(Dim)
 
 GEN_ENUM_IMPL(SamplerAddressingMode)
 GEN_ENUM_IMPL(SamplerFilterMode)
@@ -74,6 +75,8 @@ GEN_ENUM_IMPL(GroupOperation)
 GEN_ENUM_IMPL(KernelEnqueueFlags)
 GEN_MASK_ENUM_IMPL(KernelProfilingInfo)
 
+GEN_ENUM_IMPL(PackedVectorFormat)
+
 namespace MS = MemorySemantics;
 namespace SC = StorageClass;
 MS::MemorySemantics getMemSemanticsForStorageClass(SC::StorageClass sc) {
@@ -24,11 +24,12 @@
 #define LLVM_LIB_TARGET_SPIRV_ENUMS_H
 
 #include "SPIRVExtensions.h"
-#include <string>
-#include <vector>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
 
 // Macros to define an enum and the functions to return its name and its
-// required capabilities, extensions, and SPIR-V versions
+// required capabilities, extensions, and SPIR-V versions. Names are string
+// literals, so none of these allocate.
 
 #define LIST(...) __VA_ARGS__
 
@@ -41,8 +42,14 @@
 #define MAKE_MASK_ENUM_NAME_CASE(Enum, Var, Val, Caps, Exts, MinVer, MaxVer)   \
   if (e == Enum::Var) {                                                        \
     return #Var;                                                               \
+  }
+
+#define MAKE_MASK_ENUM_PRINT_CASE(Enum, Var, Val, Caps, Exts, MinVer, MaxVer)  \
+  if (e == Enum::Var) {                                                        \
+    O << #Var;                                                                 \
+    return;                                                                    \
   } else if ((Enum::Var != 0) && (e & Enum::Var)) {                            \
-    nameString += sep + #Var;                                                  \
+    O << sep << #Var;                                                          \
     sep = "|";                                                                 \
   }
 
@@ -55,23 +62,34 @@
   enum EnumName : uint32_t { DefEnumCommand(EnumName, MAKE_ENUM) };            \
   }
 
+// For bitmasks, get##EnumName##Name only names single values, while
+// print##EnumName##Name also prints combinations of them e.g. DontInline|Const
 #define DEF_NAME_FUNC_HEADER(EnumName)                                         \
-  std::string get##EnumName##Name(EnumName::EnumName e);
+  llvm::StringRef get##EnumName##Name(EnumName::EnumName e);                   \
+  void print##EnumName##Name(EnumName::EnumName e, llvm::raw_ostream &O);
+
+#define DEF_PRINT_NAME_FUNC_BODY(EnumName)                                     \
+  void print##EnumName##Name(EnumName::EnumName e, llvm::raw_ostream &O) {     \
+    O << get##EnumName##Name(e);                                               \
+  }
 
 // Use this for enums that can only take a single value
 #define DEF_NAME_FUNC_BODY(EnumName, DefEnumCommand)                           \
-  std::string get##EnumName##Name(EnumName::EnumName e) {                      \
+  llvm::StringRef get##EnumName##Name(EnumName::EnumName e) {                  \
     switch (e) { DefEnumCommand(EnumName, MAKE_NAME_CASE) }                    \
     return "UNKNOWN_ENUM";                                                     \
-  }
+  }                                                                            \
+  DEF_PRINT_NAME_FUNC_BODY(EnumName)
 
 // Use this for bitmasks that can take multiple values e.g. DontInline|Const
 #define DEF_MASK_NAME_FUNC_BODY(EnumName, DefEnumCommand)                      \
-  std::string get##EnumName##Name(EnumName::EnumName e) {                      \
-    std::string nameString = "";                                               \
-    std::string sep = "";                                                      \
+  llvm::StringRef get##EnumName##Name(EnumName::EnumName e) {                  \
     DefEnumCommand(EnumName, MAKE_MASK_ENUM_NAME_CASE);                        \
-    return nameString;                                                         \
+    return "";                                                                 \
+  }                                                                            \
+  void print##EnumName##Name(EnumName::EnumName e, llvm::raw_ostream &O) {     \
+    const char *sep = "";                                                      \
+    DefEnumCommand(EnumName, MAKE_MASK_ENUM_PRINT_CASE);                       \
   }
 
 #define DEF_BUILTIN_LINK_STR_FUNC_BODY()                                       \
@@ -98,7 +116,7 @@
     if (OpNo < MI->getNumOperands()) {                                         \
       EnumName::EnumName e =                                                   \
           static_cast<EnumName::EnumName>(MI->getOperand(OpNo).getImm());      \
-      O << get##EnumName##Name(e);                                             \
+      print##EnumName##Name(e, O);                                             \
     }                                                                          \
   }
 
@@ -138,10 +156,19 @@
 #define VAR_PTR_SB VariablePointersStorageBuffer
 
 #define DRAW_PARAMS SPV_KHR_shader_draw_parameters
-#define SPV_16_BIT SPV_KHR_16bit_storeage
+#define SPV_16_BIT SPV_KHR_16bit_storage
 #define SPV_VAR_PTR SPV_KHR_variable_pointers
+#define SPV_VK_MM SPV_KHR_vulkan_memory_model
 #define SPV_PDC SPV_KHR_post_depth_coverage
 #define SPV_FLT_CTRL SPV_KHR_float_controls
+#define SAFA SPV_EXT_shader_atomic_float_add
+#define SAFMM SPV_EXT_shader_atomic_float_min_max
+#define INTEL_SG SPV_INTEL_subgroups
+#define INTEL_MBIO SPV_INTEL_media_block_io
+#define IDP SPV_KHR_integer_dot_product
+#define INTEL_ULC SPV_INTEL_unstructured_loop_controls
+#define INTEL_FLC SPV_INTEL_fpga_loop_controls
+#define INTEL_FMA SPV_INTEL_fpga_memory_attributes
 
 #define DEF_Capability(N, X)                                                   \
   X(N, Matrix, 0, {}, {}, 0, 0)                                                \
@@ -256,23 +283,35 @@
   X(N, ANUIE(UniformTexelBuffer), 5311, LIST({SampledBuffer, SNUE}), {}, 0, 0) \
   X(N, ANUIE(StorageTexelBuffer), 5312, LIST({ImageBuffer, SNUE}), {}, 0, 0)   \
   X(N, RayTracingNV, 5340, {Shader}, {}, 0, 0)                                 \
-  X(N, SubgroupShuffleINTEL, 5568, {}, {}, 0, 0)                               \
-  X(N, SubgroupBufferBlockIOINTEL, 5569, {}, {}, 0, 0)                         \
-  X(N, SubgroupImageBlockIOINTEL, 5570, {}, {}, 0, 0)                          \
-  X(N, SubgroupImageMediaBlockIOINTEL, 5579, {}, {}, 0, 0)                     \
+  X(N, SubgroupShuffleINTEL, 5568, {}, {INTEL_SG}, 0, 0)                       \
+  X(N, SubgroupBufferBlockIOINTEL, 5569, {}, {INTEL_SG}, 0, 0)                 \
+  X(N, SubgroupImageBlockIOINTEL, 5570, {}, {INTEL_SG}, 0, 0)                  \
+  X(N, SubgroupImageMediaBlockIOINTEL, 5579, {}, {INTEL_MBIO}, 0, 0)           \
   X(N, SubgroupAvcMotionEstimationINTEL, 5696, {}, {}, 0, 0)                   \
   X(N, SubgroupAvcMotionEstimationIntraINTEL, 5697, {}, {}, 0, 0)              \
   X(N, SubgroupAvcMotionEstimationChromaINTEL, 5698, {}, {}, 0, 0)             \
   X(N, GroupNonUniformPartitionedNV, 5297, {}, {}, 0, 0)                       \
-  X(N, VulkanMemoryModelKHR, 5345, {}, {}, 0, 0)                               \
-  X(N, VulkanMemoryModelDeviceScopeKHR, 5346, {}, {}, 0, 0)                    \
+  X(N, VulkanMemoryModelKHR, 5345, {}, {SPV_VK_MM}, 0x10500, 0)                \
+  X(N, VulkanMemoryModelDeviceScopeKHR, 5346, {}, {SPV_VK_MM}, 0x10500, 0)     \
   X(N, ImageFootprintNV, 5282, {}, {}, 0, 0)                                   \
   X(N, FragmentBarycentricNV, 5284, {}, {}, 0, 0)                              \
   X(N, ComputeDerivativeGroupQuadsNV, 5288, {}, {}, 0, 0)                      \
   X(N, ComputeDerivativeGroupLinearNV, 5350, {}, {}, 0, 0)                     \
   X(N, FragmentDensityEXT, 5291, {Shader}, {}, 0, 0)                           \
   X(N, PhysicalStorageBufferAddressesEXT, 5347, {Shader}, {}, 0, 0)            \
-  X(N, CooperativeMatrixNV, 5357, {Shader}, {}, 0, 0)
+  X(N, CooperativeMatrixNV, 5357, {Shader}, {SPV_NV_cooperative_matrix}, 0, 0) \
+  X(N, AtomicFloat32AddEXT, 6033, {}, {SAFA}, 0, 0)                            \
+  X(N, AtomicFloat64AddEXT, 6034, {}, {SAFA}, 0, 0)                            \
+  X(N, AtomicFloat16MinMaxEXT, 5616, {}, {SAFMM}, 0, 0)                        \
+  X(N, AtomicFloat32MinMaxEXT, 5612, {}, {SAFMM}, 0, 0)                        \
+  X(N, AtomicFloat64MinMaxEXT, 5613, {}, {SAFMM}, 0, 0)                        \
+  X(N, DotProductInputAllKHR, 6016, {}, {IDP}, 0x10600, 0)                     \
+  X(N, DotProductInput4x8BitKHR, 6017, {}, {IDP}, 0x10600, 0)                  \
+  X(N, DotProductInput4x8BitPackedKHR, 6018, {}, {IDP}, 0x10600, 0)            \
+  X(N, DotProductKHR, 6019, {}, {IDP}, 0x10600, 0)                             \
+  X(N, UnstructuredLoopControlsINTEL, 5886, {}, {INTEL_ULC}, 0, 0)             \
+  X(N, FPGALoopControlsINTEL, 5888, {}, {INTEL_FLC}, 0, 0)                     \
+  X(N, FPGAMemoryAttributesINTEL, 5824, {}, {INTEL_FMA}, 0, 0)
 GEN_ENUM_HEADER(Capability)
 
 #define DEF_SourceLanguage(N, X)                                               \
@@ -625,7 +664,19 @@ GEN_ENUM_HEADER(FunctionParameterAttribute)
   X(N, CountBuffer, 5634, {}, {}, 0, 0)                                        \
   X(N, UserSemantic, 5635, {}, {}, 0, 0)                                       \
   X(N, RestrictPointerEXT, 5355, {PSB(AddressesEXT)}, {}, 0, 0)                \
-  X(N, AliasedPointerEXT, 5356, {PSB(AddressesEXT)}, {}, 0, 0)
+  X(N, AliasedPointerEXT, 5356, {PSB(AddressesEXT)}, {}, 0, 0)                 \
+  X(N, RegisterINTEL, 5825, {FPGAMemoryAttributesINTEL}, {}, 0, 0)             \
+  X(N, MemoryINTEL, 5826, {FPGAMemoryAttributesINTEL}, {}, 0, 0)               \
+  X(N, NumbanksINTEL, 5827, {FPGAMemoryAttributesINTEL}, {}, 0, 0)             \
+  X(N, BankwidthINTEL, 5828, {FPGAMemoryAttributesINTEL}, {}, 0, 0)            \
+  X(N, MaxPrivateCopiesINTEL, 5829, {FPGAMemoryAttributesINTEL}, {}, 0, 0)     \
+  X(N, SinglepumpINTEL, 5830, {FPGAMemoryAttributesINTEL}, {}, 0, 0)           \
+  X(N, DoublepumpINTEL, 5831, {FPGAMemoryAttributesINTEL}, {}, 0, 0)           \
+  X(N, MaxReplicatesINTEL, 5832, {FPGAMemoryAttributesINTEL}, {}, 0, 0)        \
+  X(N, SimpleDualPortINTEL, 5833, {FPGAMemoryAttributesINTEL}, {}, 0, 0)       \
+  X(N, MergeINTEL, 5834, {FPGAMemoryAttributesINTEL}, {}, 0, 0)                \
+  X(N, BankBitsINTEL, 5835, {FPGAMemoryAttributesINTEL}, {}, 0, 0)             \
+  X(N, ForcePow2DepthINTEL, 5836, {FPGAMemoryAttributesINTEL}, {}, 0, 0)
 GEN_ENUM_HEADER(Decoration)
 
 #define SBK SubgroupBallotKHR
@@ -736,13 +787,21 @@ GEN_ENUM_HEADER(SelectionControl)
   X(N, None, 0x0, {}, {}, 0, 0)                                                \
   X(N, Unroll, 0x1, {}, {}, 0, 0)                                              \
   X(N, DontUnroll, 0x2, {}, {}, 0, 0)                                          \
-  X(N, DependencyInfinite, 0x4, {}, {}, 0, 0)                                  \
-  X(N, DependencyLength, 0x8, {}, {}, 0, 0)                                    \
-  X(N, MinIterations, 0x10, {}, {}, 0, 0)                                      \
-  X(N, MaxIterations, 0x20, {}, {}, 0, 0)                                      \
-  X(N, IterationMultiple, 0x40, {}, {}, 0, 0)                                  \
-  X(N, PeelCount, 0x80, {}, {}, 0, 0)                                          \
-  X(N, PartialCount, 0x100, {}, {}, 0, 0)
+  X(N, DependencyInfinite, 0x4, {}, {}, 0x10100, 0)                            \
+  X(N, DependencyLength, 0x8, {}, {}, 0x10100, 0)                              \
+  X(N, MinIterations, 0x10, {}, {}, 0x10400, 0)                                \
+  X(N, MaxIterations, 0x20, {}, {}, 0x10400, 0)                                \
+  X(N, IterationMultiple, 0x40, {}, {}, 0x10400, 0)                            \
+  X(N, PeelCount, 0x80, {}, {}, 0x10400, 0)                                    \
+  X(N, PartialCount, 0x100, {}, {}, 0x10400, 0)                                \
+  X(N, InitiationIntervalINTEL, 0x10000, {FPGALoopControlsINTEL}, {}, 0, 0)    \
+  X(N, MaxConcurrencyINTEL, 0x20000, {FPGALoopControlsINTEL}, {}, 0, 0)        \
+  X(N, DependencyArrayINTEL, 0x40000, {FPGALoopControlsINTEL}, {}, 0, 0)       \
+  X(N, PipelineEnableINTEL, 0x80000, {FPGALoopControlsINTEL}, {}, 0, 0)        \
+  X(N, LoopCoalesceINTEL, 0x100000, {FPGALoopControlsINTEL}, {}, 0, 0)         \
+  X(N, MaxInterleavingINTEL, 0x200000, {FPGALoopControlsINTEL}, {}, 0, 0)      \
+  X(N, SpeculatedIterationsINTEL, 0x400000, {FPGALoopControlsINTEL}, {}, 0, 0) \
+  X(N, NoFusionINTEL, 0x800000, {FPGALoopControlsINTEL}, {}, 0, 0)
 GEN_ENUM_HEADER(LoopControl)
 
 #define DEF_FunctionControl(N, X)                                              \
@@ -813,6 +872,10 @@ GEN_ENUM_HEADER(KernelEnqueueFlags)
   X(N, CmdExecTime, 0x1, {Kernel}, {}, 0, 0)
 GEN_ENUM_HEADER(KernelProfilingInfo)
 
+#define DEF_PackedVectorFormat(N, X)                                           \
+  X(N, PackedVectorFormat4x8BitKHR, 0, {}, {IDP}, 0x10600, 0)
+GEN_ENUM_HEADER(PackedVectorFormat)
+
 MemorySemantics::MemorySemantics
 getMemSemanticsForStorageClass(StorageClass::StorageClass sc);
 
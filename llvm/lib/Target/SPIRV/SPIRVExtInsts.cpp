@@ -11,6 +11,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "SPIRVExtInsts.h"
+#include "SPIRVStringReader.h"
+#include "llvm/CodeGen/Register.h"
+#include "llvm/MC/MCInst.h"
 #include "llvm/Support/ErrorHandling.h"
 #include <map>
 
@@ -28,15 +31,44 @@ const char *getExtInstSetName(ExtInstSet e) {
   return "UNKNOWN_EXT_INST_SET";
 }
 
-ExtInstSet getExtInstSetFromString(const std::string &nameStr) {
-  for (auto set : {ExtInstSet::GLSL_std_450, ExtInstSet::OpenCL_std}) {
+Optional<ExtInstSet> lookupExtInstSet(const std::string &nameStr) {
+  for (unsigned i = 0; i < NumExtInstSets; ++i) {
+    auto set = static_cast<ExtInstSet>(i);
     if (nameStr == getExtInstSetName(set)) {
       return set;
     }
   }
+  return None;
+}
+
+ExtInstSet getExtInstSetFromString(const std::string &nameStr) {
+  if (auto set = lookupExtInstSet(nameStr)) {
+    return *set;
+  }
   llvm_unreachable("UNKNOWN_EXT_INST_SET");
 }
 
+void SPIRVExtInstSetTracker::recordOpExtInstImport(const MCInst &MI) {
+  if (auto set = lookupExtInstSet(getSPIRVStringOperand(MI, 1))) {
+    unsigned index = Register::virtReg2Index(MI.getOperand(0).getReg());
+    if (index >= extInstSetIDs.size()) {
+      extInstSetIDs.resize(index + 1);
+    }
+    extInstSetIDs[index] = *set;
+  }
+}
+
+Optional<ExtInstSet> SPIRVExtInstSetTracker::getSet(unsigned reg) const {
+  if (!Register::isVirtualRegister(reg)) {
+    return None;
+  }
+  unsigned index = Register::virtReg2Index(reg);
+  if (index >= extInstSetIDs.size()) {
+    return None;
+  }
+  return extInstSetIDs[index];
+}
+
 const char *getExtInstName(ExtInstSet set, uint32_t inst) {
   switch (set) {
   case ExtInstSet::OpenCL_std:
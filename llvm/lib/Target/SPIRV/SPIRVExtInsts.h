@@ -14,18 +14,41 @@
 #define LLVM_LIB_TARGET_SPIRV_SPIRVEXTINSTS_H
 
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
 #include <cstdint>
 #include <string>
 
+namespace llvm {
+class MCInst;
+} // namespace llvm
+
 enum class ExtInstSet : std::uint32_t {
   OpenCL_std,
   GLSL_std_450,
   SPV_AMD_shader_trinary_minmax
 };
 
+// The number of ExtInstSet values, which are numbered contiguously from 0.
+constexpr unsigned NumExtInstSets =
+    unsigned(ExtInstSet::SPV_AMD_shader_trinary_minmax) + 1;
+
 const char *getExtInstSetName(ExtInstSet e);
 ExtInstSet getExtInstSetFromString(const std::string &nameStr);
 
+// Get the set with the given name, or None if it isn't one we know.
+llvm::Optional<ExtInstSet> lookupExtInstSet(const std::string &nameStr);
+
+// The set each OpExtInstImport result ID refers to, recorded while walking the
+// MCInsts of a module in order, so the OpExtInsts after them can be decoded.
+class SPIRVExtInstSetTracker {
+  // Indexed by the virtual register index of the result IDs, which are dense
+  llvm::SmallVector<llvm::Optional<ExtInstSet>, 8> extInstSetIDs;
+
+public:
+  void recordOpExtInstImport(const llvm::MCInst &MI);
+  llvm::Optional<ExtInstSet> getSet(unsigned reg) const;
+};
+
 const char *getExtInstName(ExtInstSet set, std::uint32_t instNum);
 
 #define MAKE_EXT_INST_ENUM(EnumName, Varname, Val) Varname = Val,
@@ -52,7 +52,7 @@
   X(N, SPV_AMD_gpu_shader_half_float, 6)                                       \
   X(N, SPV_KHR_shader_draw_parameters, 7)                                      \
   X(N, SPV_KHR_subgroup_vote, 8)                                               \
-  X(N, SPV_KHR_16bit_storeage, 9)                                              \
+  X(N, SPV_KHR_16bit_storage, 9)                                               \
   X(N, SPV_KHR_device_group, 10)                                               \
   X(N, SPV_KHR_multiview, 11)                                                  \
   X(N, SPV_NVX_multiview_per_view_attributes, 12)                              \
@@ -99,7 +99,10 @@
   X(N, SPV_KHR_shader_clock, 54)                                               \
   X(N, SPV_INTEL_unstructured_loop_controls, 55)                               \
   X(N, SPV_EXT_demote_to_helper_invocation, 56)                                \
-  X(N, SPV_INTEL_fpga_reg, 57)
+  X(N, SPV_INTEL_fpga_reg, 57)                                                 \
+  X(N, SPV_EXT_shader_atomic_float_add, 58)                                    \
+  X(N, SPV_EXT_shader_atomic_float_min_max, 59)                               \
+  X(N, SPV_KHR_integer_dot_product, 60)
 GEN_EXTENSION_HEADER(Extension)
 
 #endif
@@ -0,0 +1,112 @@
+//===-- SPIRVGenericAccessRemarks.cpp - Report Generic accesses -*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Count the memory accesses through pointers to the Generic storage class left
+// once InferAddressSpaces ran. Drivers must dispatch on the actual storage
+// class of every such access at runtime, so each function with some gets an
+// analysis remark with their number, e.g. for -pass-remarks-analysis.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-generic-access-remarks"
+
+STATISTIC(NumGenericAccesses,
+          "Number of memory accesses through Generic pointers");
+
+namespace {
+class SPIRVGenericAccessRemarks : public FunctionPass {
+public:
+  static char ID;
+  SPIRVGenericAccessRemarks() : FunctionPass(ID) {
+    initializeSPIRVGenericAccessRemarksPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+    AU.setPreservesAll();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+// Get the pointer operands of I which it reads or writes memory through.
+static SmallVector<const Value *, 2> getAccessedPointers(const Instruction &I) {
+  SmallVector<const Value *, 2> ptrs;
+  if (const auto *LI = dyn_cast<LoadInst>(&I)) {
+    ptrs.push_back(LI->getPointerOperand());
+  } else if (const auto *SI = dyn_cast<StoreInst>(&I)) {
+    ptrs.push_back(SI->getPointerOperand());
+  } else if (const auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+    ptrs.push_back(RMW->getPointerOperand());
+  } else if (const auto *CmpXchg = dyn_cast<AtomicCmpXchgInst>(&I)) {
+    ptrs.push_back(CmpXchg->getPointerOperand());
+  } else if (const auto *MT = dyn_cast<MemTransferInst>(&I)) {
+    ptrs.push_back(MT->getRawDest());
+    ptrs.push_back(MT->getRawSource());
+  } else if (const auto *MS = dyn_cast<MemSetInst>(&I)) {
+    ptrs.push_back(MS->getRawDest());
+  }
+  return ptrs;
+}
+
+bool SPIRVGenericAccessRemarks::runOnFunction(Function &F) {
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  SPIRVTypeRegistry *TR = TM.getSubtargetImpl()->getSPIRVTypeRegistry();
+  const unsigned genericAS =
+      TR->StorageClassToAddressSpace(StorageClass::Generic);
+
+  unsigned numAccesses = 0;
+  for (const Instruction &I : instructions(F)) {
+    for (const Value *ptr : getAccessedPointers(I)) {
+      if (ptr->getType()->getPointerAddressSpace() == genericAS) {
+        ++numAccesses;
+      }
+    }
+  }
+  if (numAccesses == 0) {
+    return false;
+  }
+  NumGenericAccesses += numAccesses;
+
+  auto &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+  ORE.emit([&]() {
+    return OptimizationRemarkAnalysis(DEBUG_TYPE, "GenericAccesses",
+                                      F.getSubprogram(), &F.getEntryBlock())
+           << ore::NV("NumAccesses", numAccesses)
+           << " memory accesses through Generic pointers remain in "
+           << ore::NV("Function", &F);
+  });
+  return false;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVGenericAccessRemarks, DEBUG_TYPE,
+                      "SPIRV report Generic accesses", false, true)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+INITIALIZE_PASS_END(SPIRVGenericAccessRemarks, DEBUG_TYPE,
+                    "SPIRV report Generic accesses", false, true)
+
+char SPIRVGenericAccessRemarks::ID = 0;
+
+FunctionPass *llvm::createSPIRVGenericAccessRemarksPass() {
+  return new SPIRVGenericAccessRemarks();
+}
@@ -16,7 +16,19 @@
 //
 // This pass also re-numbers the registers globally, and patches up any
 // references to previously local registers that were hoisted, or function IDs
-// which require globally scoped registers.
+// which require globally scoped registers. The final IDs are then compacted
+// into a dense range, which keeps the module's ID bound as small as possible.
+//
+// When the object file is encoded directly, each function body is encoded into
+// words once its IDs are final and its MachineFunction is freed, so only the
+// meta function holding the global instructions stays as MIR. The AsmPrinter
+// emits it first, then the encoded bodies at the end of the module.
+//
+// With -spirv-entry-point-images, or when the type registry asks for them, a
+// separate binary is also cut from the finished module for each OpEntryPoint.
+// It holds only the functions the entry point can reach, and the global
+// instructions they refer to, with its own capabilities and a dense range of
+// IDs. All the translation, selection and hoisting work is shared.
 //
 // This pass breaks all notion of register def/use, and generated MachineInstrs
 // that are technically invalid as a result. As such, it must be the last pass,
@@ -26,22 +38,95 @@
 
 #include "SPIRV.h"
 #include "SPIRVCapabilityUtils.h"
+#include "SPIRVMCInstLower.h"
 #include "SPIRVEnumRequirements.h"
 #include "SPIRVStrings.h"
 #include "SPIRVSubtarget.h"
 #include "SPIRVTypeRegistry.h"
 
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Parallel.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/Timer.h"
+#include <array>
+#include <map>
 
 using namespace llvm;
 
 #define DEBUG_TYPE "spirv-global-types-vreg"
 
+STATISTIC(NumTypesHoisted, "Number of unique types hoisted");
+STATISTIC(NumTypesDeduped, "Number of duplicate types merged when hoisting");
+STATISTIC(NumConstsHoisted, "Number of unique constants hoisted");
+STATISTIC(NumConstsDeduped,
+          "Number of duplicate constants merged when hoisting");
+STATISTIC(NumDeadGlobals, "Number of unreferenced hoisted globals removed");
+STATISTIC(NumGlobalIDs, "Number of global IDs after compaction");
+STATISTIC(NumWordsDeduped,
+          "Number of words saved by merging duplicate global instructions");
+STATISTIC(NumDecorationGroups,
+          "Number of OpDecorationGroups sharing repeated decorations");
+STATISTIC(NumEntryPointImages, "Number of per-entry-point binaries built");
+STATISTIC(NumFunctionsEncoded,
+          "Number of functions encoded and freed once numbered");
+
+static const char TimerGroupName[] = "spirv-global-types";
+static const char TimerGroupDescription[] =
+    "SPIRV Hoist OpType etc. & Number VRegs Globally";
+
+namespace {
+// Time a phase of the pass for -time-passes, and trace it for -ftime-trace
+struct PhaseTimer {
+  NamedRegionTimer Timer;
+  TimeTraceScope Trace;
+  PhaseTimer(StringRef name, StringRef description, const Module &M)
+      : Timer(name, description, TimerGroupName, TimerGroupDescription,
+              TimePassesIsEnabled),
+        Trace(description, M.getName()) {}
+};
+} // namespace
+
+static cl::opt<bool> ParallelRegNumbering(
+    "spirv-parallel-reg-numbering", cl::Hidden, cl::init(true),
+    cl::desc("Number the registers of each function globally in parallel"));
+
+static cl::opt<std::string> SizeReportFile(
+    "spirv-size-report", cl::Hidden, cl::value_desc("filename"),
+    cl::desc("Write the number of words in each section of the final SPIR-V "
+             "module and each function, as JSON, to the given file"));
+
+static cl::opt<bool> UseDecorationGroups(
+    "spirv-decoration-groups", cl::Hidden, cl::init(false),
+    cl::desc("Decorate the IDs sharing the same decorations through an "
+             "OpDecorationGroup, when it takes fewer words"));
+
+static cl::opt<bool> VerifyModule(
+    "spirv-verify-module", cl::Hidden, cl::init(false),
+    cl::desc("Check the structure of the final SPIR-V module in process, "
+             "aborting the compilation if it is invalid"));
+
+static cl::opt<std::string> EntryPointImagesPrefix(
+    "spirv-entry-point-images", cl::Hidden, cl::value_desc("prefix"),
+    cl::desc("Also write a SPIR-V binary holding only what each entry point "
+             "can reach to <prefix>.<entry point name>.spv"));
+
 namespace {
 struct SPIRVGlobalTypesAndRegNum : public ModulePass {
   static char ID;
 
-  SPIRVGlobalTypesAndRegNum() : ModulePass(ID) {
+  SPIRVGlobalTypesAndRegNum(bool EncodeFunctions = false)
+      : ModulePass(ID), EncodeFunctions(EncodeFunctions) {
     initializeSPIRVGlobalTypesAndRegNumPass(*PassRegistry::getPassRegistry());
   }
 
@@ -54,6 +139,10 @@ public:
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.addRequired<MachineModuleInfo>();
   }
+
+private:
+  // Whether to encode the function bodies and free their MachineFunctions
+  const bool EncodeFunctions;
 };
 } // namespace
 
@@ -75,6 +164,13 @@ enum MetaBlockType {
   NUM_META_BLOCKS           // Total number of sections requiring basic blocks
 };
 
+// The name of each MetaBlockType in size reports.
+static const char *const MetaBlockNames[NUM_META_BLOCKS] = {
+    "capabilities",  "extensions",          "ext_inst_imports",
+    "memory_model",  "entry_points",        "execution_modes",
+    "debug_strings", "debug_names",         "debug_module_processed",
+    "annotations",   "types_consts_vars",   "ext_func_decls"};
+
 // Set the builder's MBB to one of the sections from the MetaBlockType enum.
 static void setMetaBlock(MachineIRBuilder &MetaBuilder, MetaBlockType block) {
   const auto &MF = MetaBuilder.getMF();
@@ -104,88 +200,182 @@ static void setMetaBlock(MachineIRBuilder &MetaBuilder, MetaBlockType block) {
   } /* close for loop */                                                       \
   } /* close outer block */
 
+// Once registers are numbered globally, the register operands in each function
+// are replaced with global ID operands: MO_TargetIndex operands whose offset is
+// the global VReg's index. This avoids functions' MachineRegisterInfo needing
+// to grow to the number of global IDs, as it does for real VReg operands.
+static void changeToGlobalIDOperand(MachineOperand &op, Register globalReg) {
+  op.ChangeToTargetIndex(SPIRV::TI_GlobalID, globalReg.virtRegIndex());
+}
+
+// True if the operand is either a VReg or a global ID operand.
+static bool isIDOperand(const MachineOperand &op) {
+  return op.isReg() ||
+         (op.isTargetIndex() && op.getIndex() == SPIRV::TI_GlobalID);
+}
+
+// Get the VReg an operand refers to, whether it's a VReg or a global ID.
+static Register getIDReg(const MachineOperand &op) {
+  if (op.isTargetIndex()) {
+    assert(op.getIndex() == SPIRV::TI_GlobalID && "Unexpected target index");
+    return Register::index2VirtReg(op.getOffset());
+  }
+  return op.getReg();
+}
+
 // Helper to get VReg defined by an instruction.
 static Register getDef(const MachineInstr &MI) {
-  return MI.defs().begin()->getReg();
-}
-
-// If the given instruction has a duplicate, return the VReg it defines.
-static Optional<Register> getDuplicateDef(MachineInstr &testInstr,
-                                          MachineBasicBlock &MBB) {
-  assert(testInstr.getMF() && "testInstr should belong to a function.");
-  auto const &MRI = testInstr.getMF()->getRegInfo();
-  const unsigned int numTestDefs = testInstr.getNumDefs();
-  const bool hasDef = numTestDefs > 0;
-  assert((!hasDef || numTestDefs == 1) && "Multiple defs in getDuplicateDef");
-  const unsigned int numTestOperands = testInstr.getNumOperands();
-  for (const auto &MI : MBB) {
-    if (MI.getOpcode() == testInstr.getOpcode() &&
-        MI.getNumOperands() == numTestOperands &&
-        MI.getNumDefs() == numTestDefs) {
-      bool allMatch = true;
-      for (unsigned i = hasDef ? 1 : 0; i < numTestOperands && allMatch; ++i) {
-        auto Op = MI.getOperand(i);
-        auto testOp = testInstr.getOperand(i);
-        if (Op.getType() == testOp.getType()) {
-          if (Op.isImm()) {
-            allMatch = Op.getImm() == testOp.getImm();
-          } else if (Op.isReg()) {
-            MachineInstr *testOpDef = MRI.getVRegDef(testOp.getReg());
-            if (!testOpDef) {
-              assert(testOpDef && "No definition found for vreg");
-            }
-            auto dupeOp = getDuplicateDef(*testOpDef, MBB);
-            allMatch = dupeOp.hasValue() && Op.getReg() == dupeOp.getValue();
-          } else {
-            llvm_unreachable("Unknown operand type in getDuplicateDef");
-          }
-        } else {
-          allMatch = false;
-        }
+  return getIDReg(*MI.defs().begin());
+}
+
+// Maps a local VReg id to the corresponding VReg id in the global meta-function
+using LocalToGlobalRegTable = DenseMap<Register, Register>;
+
+// Structural key identifying a meta instruction for deduplication purposes:
+// the opcode followed by a (kind, value) pair for each operand, where register
+// operands are always given as the global register in the meta-function.
+using MetaInstrKey = SmallVector<int64_t, 8>;
+
+struct MetaInstrKeyInfo {
+  static inline MetaInstrKey getEmptyKey() { return {-1}; }
+  static inline MetaInstrKey getTombstoneKey() { return {-2}; }
+  static unsigned getHashValue(const MetaInstrKey &key) {
+    return hash_combine_range(key.begin(), key.end());
+  }
+  static bool isEqual(const MetaInstrKey &lhs, const MetaInstrKey &rhs) {
+    return lhs == rhs;
+  }
+};
+
+// Maps the key of each instruction hoisted into a meta block to the global
+// VReg it defines (or 0 if it has no def), so duplicates are found in O(1).
+using MetaInstrTable = DenseMap<MetaInstrKey, Register, MetaInstrKeyInfo>;
+
+// One hash-consing table per section of the meta-function, and the number of
+// words saved by not hoisting the duplicates found in them.
+struct MetaInstrTables : std::array<MetaInstrTable, NUM_META_BLOCKS> {
+  unsigned numWordsDeduped = 0;
+};
+
+// The module-level state of the global sections: the hash-consing tables of
+// each section, the instruction defining each global ID defined in them, and
+// the allocator giving out global IDs. The instructions are kept in the blocks
+// of the meta function, as MachineInstrs must belong to a MachineFunction, but
+// they only have global ID operands, so its MachineRegisterInfo has no VRegs.
+struct GlobalSections {
+  MetaInstrTables dedupTables;
+  DenseMap<Register, MachineInstr *> defs;
+  // The number of global IDs given out so far, densely from 0.
+  unsigned numIDs = 0;
+
+  Register createID() { return Register::index2VirtReg(numIDs++); }
+  MachineInstr *getDef(Register id) const { return defs.lookup(id); }
+};
+
+// Add a global ID operand referring to the given global VReg.
+static void addGlobalID(MachineInstrBuilder &MIB, Register globalReg) {
+  MIB.addTargetIndex(SPIRV::TI_GlobalID, globalReg.virtRegIndex());
+}
+
+// Start building a meta instruction defining a new global ID, recording it as
+// the ID's definition.
+static MachineInstrBuilder buildMetaDef(unsigned opcode,
+                                        MachineIRBuilder &MetaBuilder,
+                                        GlobalSections &sections) {
+  Register def = sections.createID();
+  auto MIB = MetaBuilder.buildInstr(opcode);
+  addGlobalID(MIB, def);
+  sections.defs.insert({def, MIB});
+  return MIB;
+}
+
+// The number of words the given instruction is encoded in.
+static unsigned getInstrWordCount(const MachineInstr &MI) {
+  unsigned numWords = 1;
+  for (const MachineOperand &op : MI.operands()) {
+    numWords += getOperandWordCount(op);
+  }
+  return numWords;
+}
+
+// Build the deduplication key for the given instruction, ignoring operands
+// before startOpIndex (e.g. the def). If an alias table is given, register
+// operands are local and get translated to their global equivalents.
+static MetaInstrKey
+getMetaInstrKey(const MachineInstr &MI, unsigned int startOpIndex,
+                const LocalToGlobalRegTable *localToMetaVRegAliasMap) {
+  MetaInstrKey key;
+  key.push_back(MI.getOpcode());
+  const unsigned int numOperands = MI.getNumOperands();
+  for (unsigned int i = startOpIndex; i < numOperands; ++i) {
+    const MachineOperand &op = MI.getOperand(i);
+    if (op.isImm()) {
+      key.push_back(MachineOperand::MO_Immediate);
+      key.push_back(op.getImm());
+    } else if (isIDOperand(op)) {
+      Register reg = getIDReg(op);
+      if (localToMetaVRegAliasMap) {
+        auto metaReg = localToMetaVRegAliasMap->find(reg);
+        assert(metaReg != localToMetaVRegAliasMap->end() &&
+               "No reg alias found");
+        reg = metaReg->second;
       }
-      if (allMatch) {
-        return hasDef ? getDef(MI) : Register(0);
+      key.push_back(MachineOperand::MO_Register);
+      key.push_back(reg);
+    } else if (isStringOperand(op)) {
+      StringRef str = op.getSymbolName();
+      const unsigned numWords = getStringWordCount(str);
+      key.push_back(MachineOperand::MO_ExternalSymbol);
+      key.push_back(numWords);
+      for (unsigned w = 0; w < numWords; ++w) {
+        key.push_back(getStringWord(str, w));
       }
+    } else {
+      errs() << MI << "\n";
+      llvm_unreachable("Unknown operand type in getMetaInstrKey");
     }
   }
-  return {};
+  return key;
 }
 
-// Maps a local VReg id to the corresponding VReg id in the global meta-function
-using LocalToGlobalRegTable = DenseMap<Register, Register>;
-
 // Construct a copy of the given instruction in the meta basic block using the
 // given builder. The register defined by this instruction (if any) will be
 // mapped to the local equivalent of this register in the function it was
 // extracted from via the localToMetaVRegAliasMap (so the global version can be
 // used later) The original instruction is removed from its basic block
-// Duplicate instructions are not created, but get mapped to the original.
+// Duplicate instructions are not created, but get mapped to the original, which
+// is looked up in the given block's hash-consing table.
 static Register hoistMetaInstr(MachineInstr &toHoist,
                                MachineIRBuilder &MetaBuilder,
                                LocalToGlobalRegTable &localToMetaVRegAliasMap,
-                               const TargetRegisterClass &defRegClass,
-                               MetaBlockType mbType, bool allowDupes = false) {
+                               GlobalSections &sections, MetaBlockType mbType,
+                               bool allowDupes = false) {
   // Start building in the right block
   setMetaBlock(MetaBuilder, mbType);
 
   // Don't add anything if there is already a duplicate instruction in the block
-  bool hasDef = toHoist.getNumDefs() > 0;
+  const unsigned int numDefs = toHoist.getNumDefs();
+  assert(numDefs <= 1 && "Multiple defs in hoistMetaInstr");
+  bool hasDef = numDefs > 0;
+  MetaInstrKey key;
+  MetaInstrTables &dedupTables = sections.dedupTables;
   if (!allowDupes) {
-    auto dupeDef = getDuplicateDef(toHoist, MetaBuilder.getMBB());
-    if (dupeDef.hasValue()) {
+    key = getMetaInstrKey(toHoist, numDefs, &localToMetaVRegAliasMap);
+    auto dupe = dedupTables[mbType].find(key);
+    if (dupe != dedupTables[mbType].end()) {
+      dedupTables.numWordsDeduped += getInstrWordCount(toHoist);
       if (hasDef) {
-        localToMetaVRegAliasMap.insert({getDef(toHoist), dupeDef.getValue()});
+        localToMetaVRegAliasMap.insert({getDef(toHoist), dupe->second});
       }
-      return dupeDef.getValue();
+      return dupe->second;
     }
   }
 
-  // Start building the hoisted instruction with a new register as a definition
-  auto MIB = MetaBuilder.buildInstr(toHoist.getOpcode());
+  // Start building the hoisted instruction with a new global ID as a definition
+  auto MIB = hasDef ? buildMetaDef(toHoist.getOpcode(), MetaBuilder, sections)
+                    : MetaBuilder.buildInstr(toHoist.getOpcode());
   if (hasDef) {
-    auto metaDef = MetaBuilder.getMRI()->createVirtualRegister(&defRegClass);
-    MIB.addDef(metaDef);
-    localToMetaVRegAliasMap.insert({getDef(toHoist), metaDef});
+    localToMetaVRegAliasMap.insert({getDef(toHoist), getDef(*MIB)});
   }
 
   // Copy through the instruction's operands and ensure the correct
@@ -199,13 +389,19 @@ static Register hoistMetaInstr(MachineInstr &toHoist,
     } else if (op.isReg()) {
       Register metaReg = localToMetaVRegAliasMap[op.getReg()];
       assert(metaReg && "No reg alias found");
-      MIB.addUse(metaReg);
+      addGlobalID(MIB, metaReg);
+    } else if (isStringOperand(op)) {
+      addStringImm(op.getSymbolName(), MIB);
     } else {
       errs() << toHoist << "\n";
       llvm_unreachable("Unexpected operand type when copying spirv meta instr");
     }
   }
-  return hasDef ? getDef(*MIB) : Register(0);
+  Register metaDef = hasDef ? getDef(*MIB) : Register(0);
+  if (!allowDupes) {
+    dedupTables[mbType].insert({std::move(key), metaDef});
+  }
+  return metaDef;
 }
 
 // Retrieve an unsigned int from an MDNode with a list of them as operands
@@ -230,12 +426,21 @@ static void addHeaderOps(Module &M, MachineIRBuilder &MIRBuilder,
   // Add OpMemoryModel
   using namespace AddressingModel;
   auto addr = ptrSize == 32 ? Physical32 : ptrSize == 64 ? Physical64 : Logical;
-  auto mem = MemoryModel::OpenCL;
+  auto mem = ST.getMemoryModel();
   MIRBuilder.buildInstr(SPIRV::OpMemoryModel).addImm(addr).addImm(mem);
 
   // Update required capabilities for this memory model
   reqs.addRequirements(getMemoryModelRequirements(mem, ST));
   reqs.addRequirements(getAddressingModelRequirements(addr, ST));
+  if (ST.usesVulkanMemoryModel()) {
+    // Atomics and barriers get Device scope, which needs its own capability
+    // with this memory model
+    using namespace Capability;
+    reqs.addRequirements(getCapabilityRequirements(VulkanMemoryModelKHR, ST));
+    reqs.addCapability(VulkanMemoryModelDeviceScopeKHR);
+    reqs.addRequirements(
+        getCapabilityRequirements(VulkanMemoryModelDeviceScopeKHR, ST));
+  }
 
   // Get the OpenCL version number from metadata
   unsigned openCLVersion = 0;
@@ -246,10 +451,10 @@ static void addHeaderOps(Module &M, MachineIRBuilder &MIRBuilder,
     unsigned minorNum = getMetadataUInt(versionMD, 1);
     unsigned revNum = getMetadataUInt(versionMD, 2);
     openCLVersion = 0 | (majorNum << 16) | (minorNum << 8) | revNum;
-    setMetaBlock(MIRBuilder, MB_DebugSourceAndStrings);
   }
 
   // Build the OpSource
+  setMetaBlock(MIRBuilder, MB_DebugSourceAndStrings);
   auto srcLang = SourceLanguage::OpenCL_C;
   MIRBuilder.buildInstr(SPIRV::OpSource).addImm(srcLang).addImm(openCLVersion);
   reqs.addRequirements(getSourceLanguageRequirements(srcLang, ST));
@@ -259,6 +464,10 @@ static void addHeaderOps(Module &M, MachineIRBuilder &MIRBuilder,
 // add meta-instructions to. It should have a series of empty basic blocks, one
 // for each required SPIR-V module section, so that subsequent users of the
 // MachineIRBuilder can hoist instructions into the right places easily.
+//
+// Only the instructions themselves live in the meta function. Their global IDs,
+// the definition of each one, and the deduplication tables are kept in the
+// GlobalSections, so the meta function's MachineRegisterInfo is never used.
 static void initMetaBlockBuilder(Module &M, MachineModuleInfo &MMI,
                                  MachineIRBuilder &MetaBuilder) {
 
@@ -286,6 +495,173 @@ static void initMetaBlockBuilder(Module &M, MachineModuleInfo &MMI,
 
 using LocalAliasTables = SmallVectorImpl<LocalToGlobalRegTable *>;
 
+// The instructions of a function which the later phases of this pass need to
+// visit, in their original order. Filled in by a single classification walk so
+// each phase only visits its own candidates rather than the whole module.
+struct FunctionWorklists {
+  // The OpFunction defining the function itself.
+  MachineInstr *funcDef = nullptr;
+  // OpTypeXXX, OpConstantXXX, OpString, and external OpFunction declarations.
+  SmallVector<MachineInstr *, 16> hoistable;
+  // OpExtInst instructions referring to an ExtInstSet enum.
+  SmallVector<MachineInstr *, 4> extInsts;
+  // OpVariables which are not function-local.
+  SmallVector<MachineInstr *, 4> globalVars;
+  // OpName, OpMemberName, OpEntryPoint, OpExecutionMode(Id), and decoration
+  // instructions.
+  SmallVector<MachineInstr *, 16> globalRegInstrs;
+  // Operands still referring to a GlobalValue function: the callees of
+  // OpFunctionCalls, and the invoke functions of device enqueue instructions.
+  SmallVector<MachineOperand *, 8> funcRefs;
+};
+
+// Worklists for each MachineFunction, indexed by MFIndex (0 is the meta
+// function, which never has any).
+using ModuleWorklists = SmallVector<FunctionWorklists, 8>;
+
+// Get the Invoke operand of a device enqueue instruction, or nullptr for other
+// instructions.
+static MachineOperand *getBlockInvokeOperand(MachineInstr &MI) {
+  switch (MI.getOpcode()) {
+  case SPIRV::OpEnqueueKernel:
+    return &MI.getOperand(8);
+  case SPIRV::OpGetKernelNDrangeSubGroupCount:
+  case SPIRV::OpGetKernelNDrangeMaxSubGroupSize:
+    return &MI.getOperand(3);
+  case SPIRV::OpGetKernelWorkGroupSize:
+  case SPIRV::OpGetKernelPreferredWorkGroupSizeMultiple:
+    return &MI.getOperand(2);
+  default:
+    return nullptr;
+  }
+}
+
+// Walk every instruction in the module once, adding its requirements to reqs
+// and recording it in the worklist of any phase that needs to process it.
+static void classifyInstructions(Module &M, MachineModuleInfo &MMI,
+                                 const SPIRVInstrInfo &TII,
+                                 ModuleWorklists &worklists,
+                                 SPIRVRequirementHandler &reqs) {
+  using namespace SPIRV;
+  SPIRVInstrRequirementsCollector reqsCollector(reqs);
+  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
+  TimeTraceScope trace("Classify Function", MF->getName());
+  const auto &ST = static_cast<const SPIRVSubtarget &>(MF->getSubtarget());
+  FunctionWorklists &lists = worklists[MFIndex];
+  for (MachineBasicBlock &MBB : *MF) {
+    for (MachineInstr &MI : MBB) {
+      reqsCollector.addInstr(MI, ST);
+      const unsigned Opc = MI.getOpcode();
+      if (TII.isTypeDeclInstr(MI) || TII.isConstantInstr(MI) ||
+          Opc == OpString) {
+        lists.hoistable.push_back(&MI);
+      } else if (Opc == OpFunction) {
+        // The first OpFunction must be the actual definition of this function.
+        // Any other OpFunctions are declarations of external functions with no
+        // bodies that are only put here to be hoisted.
+        if (lists.funcDef) {
+          lists.hoistable.push_back(&MI);
+        } else {
+          lists.funcDef = &MI;
+        }
+      } else if (Opc == OpExtInst) {
+        lists.extInsts.push_back(&MI);
+      } else if (Opc == OpVariable &&
+                 MI.getOperand(2).getImm() != StorageClass::Function) {
+        lists.globalVars.push_back(&MI);
+      } else if (Opc == OpName || Opc == OpMemberName || Opc == OpEntryPoint ||
+                 Opc == OpExecutionMode || Opc == OpExecutionModeId ||
+                 TII.isDecorationInstr(MI)) {
+        lists.globalRegInstrs.push_back(&MI);
+      } else if (Opc == OpFunctionCall) {
+        lists.funcRefs.push_back(&MI.getOperand(2));
+      } else if (MachineOperand *invoke = getBlockInvokeOperand(MI)) {
+        lists.funcRefs.push_back(invoke);
+      }
+    }
+  }
+  END_FOR_MF_IN_MODULE()
+  reqsCollector.addNarrowTypeRequirements();
+}
+
+// The functions an entry point can reach, and the requirements of a binary
+// holding only them.
+struct EntryPointSubset {
+  // The MFIndex of the entry point's function.
+  unsigned MFIndex;
+  // The MFIndices of the entry point's function and all its callees.
+  BitVector functions;
+  SPIRVRequirementHandler reqs;
+};
+
+// Find the functions reachable from each function with an OpEntryPoint through
+// the call graph, and collect their requirements on top of headerReqs. This
+// must run before hoisting, as the requirements are found from the functions'
+// own MIR, and while the callees are still referred to by their Functions.
+static void
+collectEntryPointSubsets(const ModuleWorklists &worklists,
+                         const SPIRVRequirementHandler &headerReqs,
+                         SmallVectorImpl<EntryPointSubset> &subsets) {
+  DenseMap<const Function *, unsigned> funcIndices;
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    if (const MachineInstr *funcDef = worklists[MFIndex].funcDef) {
+      funcIndices.insert({&funcDef->getMF()->getFunction(), MFIndex});
+    }
+  }
+
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    const FunctionWorklists &lists = worklists[MFIndex];
+    if (!lists.funcDef ||
+        none_of(lists.globalRegInstrs, [](const MachineInstr *MI) {
+          return MI->getOpcode() == SPIRV::OpEntryPoint;
+        })) {
+      continue;
+    }
+    EntryPointSubset subset{MFIndex, BitVector(worklists.size()), headerReqs};
+    SmallVector<unsigned, 8> toVisit{MFIndex};
+    subset.functions.set(MFIndex);
+    while (!toVisit.empty()) {
+      const unsigned index = toVisit.pop_back_val();
+      for (const MachineOperand *funcRef : worklists[index].funcRefs) {
+        const auto *callee = dyn_cast<Function>(funcRef->getGlobal());
+        auto calleeIndex =
+            callee ? funcIndices.find(callee) : funcIndices.end();
+        if (calleeIndex != funcIndices.end() &&
+            !subset.functions.test(calleeIndex->second)) {
+          subset.functions.set(calleeIndex->second);
+          toVisit.push_back(calleeIndex->second);
+        }
+      }
+    }
+
+    SPIRVInstrRequirementsCollector reqsCollector(subset.reqs);
+    for (unsigned index : subset.functions.set_bits()) {
+      const MachineFunction &MF = *worklists[index].funcDef->getMF();
+      const auto &ST = static_cast<const SPIRVSubtarget &>(MF.getSubtarget());
+      for (const MachineBasicBlock &MBB : MF) {
+        for (const MachineInstr &MI : MBB) {
+          reqsCollector.addInstr(MI, ST);
+        }
+      }
+    }
+    reqsCollector.addNarrowTypeRequirements();
+    subsets.push_back(std::move(subset));
+  }
+}
+
+// Get the SpecId the given OpSpecConstant, OpSpecConstantTrue or
+// OpSpecConstantFalse is decorated with, or -1 if it has none.
+static int64_t getSpecId(const MachineInstr &MI) {
+  const auto &MRI = MI.getMF()->getRegInfo();
+  for (const MachineInstr &use : MRI.use_instructions(getDef(MI))) {
+    if (use.getOpcode() == SPIRV::OpDecorate &&
+        use.getOperand(1).getImm() == Decoration::SpecId) {
+      return use.getOperand(2).getImm();
+    }
+  }
+  return -1;
+}
+
 // Move all OpType, OpConstant etc. instructions into the meta block,
 // avoiding creating duplicates, and mapping the global registers to the
 // equivalent function-local ones via functionLocalAliasTables.
@@ -294,76 +670,113 @@ using LocalAliasTables = SmallVectorImpl<LocalToGlobalRegTable *>;
 // can only hoist instructions which never refer to function-local registers.
 // OpTypeXXX, OpConstantXXX, and external OpFunction declarations only refer to
 // other hoistable instructions vregs, so can be hoisted here.
-//
-// OpCapability instructions are removed and added to the minCaps and
-// allCaps lists instead of hoisting right now. This allows capabilities added
-// later, such as the Linkage capability for files with no OpEntryPoints, and
-// still get deduplicated before the global OpCapability instructions are added.
-static void hoistInstrsToMetablock(Module &M, MachineModuleInfo &MMI,
-                                   MachineIRBuilder &MIRBuilder,
+static void hoistInstrsToMetablock(MachineIRBuilder &MIRBuilder,
                                    const LocalAliasTables &localAliasTables,
-                                   SPIRVRequirementHandler &reqs) {
+                                   const ModuleWorklists &worklists,
+                                   GlobalSections &sections) {
 
   const auto TII = static_cast<const SPIRVInstrInfo *>(&MIRBuilder.getTII());
-  const auto ID = SPIRV::IDRegClass;
-  const auto TYPE = SPIRV::TYPERegClass;
-
-  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
-  auto locToGlobMap = localAliasTables[MFIndex];
-
-  // Iterate through and hoist any instructions we can at this stage.
-  bool hasSeenFirstOpFunction = false;
-  SmallVector<MachineInstr *, 16> toRemove;
-  for (MachineBasicBlock &MBB : *MF) {
-    for (MachineInstr &MI : MBB) {
+  MetaInstrTables &dedupTables = sections.dedupTables;
+
+  // Global type registers for each module-wide type ID from the registries.
+  using RegistryAndTypeID = std::pair<const SPIRVTypeRegistry *, unsigned>;
+  DenseMap<RegistryAndTypeID, Register> moduleTypeToMetaReg;
+
+  // Global registers of the specialization constants with each SpecId. These
+  // are identified by SpecId rather than by their operands, which only give
+  // the default value.
+  DenseMap<int64_t, Register> specIdToMetaReg;
+
+  // Count the types and constants in the meta block, to track how many of the
+  // functions' ones get merged with an existing one
+  const auto &MetaMBB = *MIRBuilder.getMF().getBlockNumbered(MB_TypeConstVars);
+  auto countMetaInstrs = [&](unsigned &numTypes, unsigned &numConsts) {
+    for (const MachineInstr &MI : MetaMBB) {
       if (TII->isTypeDeclInstr(MI)) {
-        hoistMetaInstr(MI, MIRBuilder, *locToGlobMap, TYPE, MB_TypeConstVars);
-        toRemove.push_back(&MI);
+        ++numTypes;
       } else if (TII->isConstantInstr(MI)) {
-        hoistMetaInstr(MI, MIRBuilder, *locToGlobMap, ID, MB_TypeConstVars);
-        toRemove.push_back(&MI);
-      } else if (MI.getOpcode() == SPIRV::OpExtension) {
-        // Here, OpExtension just has a single enum operand, not a string
-        auto ext = Extension::Extension(MI.getOperand(0).getImm());
-        reqs.addExtension(ext);
-        toRemove.push_back(&MI);
-      } else if (MI.getOpcode() == SPIRV::OpCapability) {
-        auto cap = Capability::Capability(MI.getOperand(0).getImm());
-        reqs.addCapability(cap);
-        toRemove.push_back(&MI);
-      } else if (MI.getOpcode() == SPIRV::OpFunction) {
-        // Only hoist OpFunctions if they're declaring external functions.
-        // The first OpFunction must be the actual definition of this funciton.
-        // Any other OpFunctions are declarations of external functions with no
-        // bodies that are only put here to be hoisted
-        if (hasSeenFirstOpFunction) {
-          hoistMetaInstr(MI, MIRBuilder, *locToGlobMap, ID, MB_ExtFuncDecs);
-          toRemove.push_back(&MI);
+        ++numConsts;
+      }
+    }
+  };
+  unsigned numOldTypes = 0, numOldConsts = 0;
+  countMetaInstrs(numOldTypes, numOldConsts);
+
+  unsigned numTypes = 0, numConsts = 0;
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    const auto &hoistable = worklists[MFIndex].hoistable;
+    if (hoistable.empty())
+      continue;
+    auto locToGlobMap = localAliasTables[MFIndex];
+    const MachineFunction *MF = hoistable.front()->getMF();
+    TimeTraceScope trace("Hoist Function Types and Constants", MF->getName());
+    const auto &ST = static_cast<const SPIRVSubtarget &>(MF->getSubtarget());
+    const SPIRVTypeRegistry *TR = ST.getSPIRVTypeRegistry();
+
+    for (MachineInstr *MI : hoistable) {
+      if (TII->isTypeDeclInstr(*MI)) {
+        ++numTypes;
+        // Types interned by the registry can be merged by ID directly.
+        auto typeID = TR->getModuleTypeID(MI);
+        if (typeID.hasValue()) {
+          auto metaReg = moduleTypeToMetaReg.find({TR, typeID.getValue()});
+          if (metaReg != moduleTypeToMetaReg.end()) {
+            dedupTables.numWordsDeduped += getInstrWordCount(*MI);
+            locToGlobMap->insert({getDef(*MI), metaReg->second});
+            continue;
+          }
+        }
+        Register metaReg = hoistMetaInstr(*MI, MIRBuilder, *locToGlobMap,
+                                          sections, MB_TypeConstVars);
+        if (typeID.hasValue()) {
+          moduleTypeToMetaReg.insert({{TR, typeID.getValue()}, metaReg});
+        }
+      } else if (TII->isConstantInstr(*MI)) {
+        ++numConsts;
+        const unsigned Opc = MI->getOpcode();
+        if (Opc == SPIRV::OpSpecConstant || Opc == SPIRV::OpSpecConstantTrue ||
+            Opc == SPIRV::OpSpecConstantFalse) {
+          int64_t specId = getSpecId(*MI);
+          auto metaReg = specIdToMetaReg.find(specId);
+          if (specId >= 0 && metaReg != specIdToMetaReg.end()) {
+            dedupTables.numWordsDeduped += getInstrWordCount(*MI);
+            locToGlobMap->insert({getDef(*MI), metaReg->second});
+            continue;
+          }
+          Register newReg = hoistMetaInstr(*MI, MIRBuilder, *locToGlobMap,
+                                           sections, MB_TypeConstVars, true);
+          if (specId >= 0) {
+            specIdToMetaReg.insert({specId, newReg});
+          }
+          continue;
         }
-        hasSeenFirstOpFunction = true;
+        hoistMetaInstr(*MI, MIRBuilder, *locToGlobMap, sections,
+                       MB_TypeConstVars);
+      } else if (MI->getOpcode() == SPIRV::OpString) {
+        // The file names of OpLines, interned once for the whole module
+        hoistMetaInstr(*MI, MIRBuilder, *locToGlobMap, sections,
+                       MB_DebugSourceAndStrings);
+      } else {
+        // External function declarations are never merged, as their operands
+        // don't distinguish different callees.
+        assert(MI->getOpcode() == SPIRV::OpFunction && "Unexpected instr");
+        hoistMetaInstr(*MI, MIRBuilder, *locToGlobMap, sections,
+                       MB_ExtFuncDecs, true);
       }
     }
-  }
-  for (MachineInstr *MI : toRemove) {
-    MI->removeFromParent();
-  }
-  END_FOR_MF_IN_MODULE()
-}
-
-// True when all the operands of an instruction are an exact match (after the
-// given starting index).
-static bool allOpsMatch(const MachineInstr &A, const MachineInstr &B,
-                        unsigned int startOpIndex = 0) {
-  const unsigned int numAOps = A.getNumOperands();
-  if (numAOps == B.getNumOperands() && A.getNumDefs() == B.getNumDefs()) {
-    bool allOpsMatch = true;
-    for (unsigned i = startOpIndex; i < numAOps && allOpsMatch; ++i) {
-      allOpsMatch = A.getOperand(i).isIdenticalTo(B.getOperand(i));
+    for (MachineInstr *MI : hoistable) {
+      MI->removeFromParent();
     }
-    if (allOpsMatch)
-      return true;
   }
-  return false;
+
+  unsigned numNewTypes = 0, numNewConsts = 0;
+  countMetaInstrs(numNewTypes, numNewConsts);
+  numNewTypes -= numOldTypes;
+  numNewConsts -= numOldConsts;
+  NumTypesHoisted += numNewTypes;
+  NumTypesDeduped += numTypes - numNewTypes;
+  NumConstsHoisted += numNewConsts;
+  NumConstsDeduped += numConsts - numNewConsts;
 }
 
 // Machine function index and local VReg id used as a composite key
@@ -372,183 +785,330 @@ using FuncIdxAndVReg = std::pair<unsigned, Register>;
 // A list of OpDecorate instructions
 using DecorationList = std::vector<MachineInstr *>;
 
-// True when the given lists of OpDecorations have at least 1 instruction with
-// matching arguments for LinkageAttributes, BuiltIns, or DescriptorSets.
-static bool decorationsAreDuplicates(const DecorationList &decsA,
-                                     const DecorationList &decsB) {
+using VRegDecorationsLists = DenseMap<FuncIdxAndVReg, DecorationList>;
+
+// Maps the keys of each global OpVariable hoisted so far (see
+// getOpVariableKeys) to its VReg in the meta function.
+using OpVariableIndex = DenseMap<MetaInstrKey, Register, MetaInstrKeyInfo>;
+
+// Get the keys identifying an OpVariable with the given type, storage class,
+// decorations and IR global variable: one for each LinkageAttributes or BuiltIn
+// decoration, one for each DescriptorSet combined with the variable's Binding,
+// and one for the global variable it declares. Each function referring to a
+// global variable declares its own OpVariable, only the first of which has the
+// initializer (see SPIRVIRTranslator::buildGlobalValue), and internal ones may
+// have no decorations and, with -spirv-strip-names, no name either.
+// OpVariables sharing any key are duplicates, and those without keys are never
+// merged.
+static SmallVector<MetaInstrKey, 2>
+getOpVariableKeys(Register globalTypeVReg, int64_t storageClass,
+                  const DecorationList &decs, const GlobalVariable *GV) {
   namespace D = Decoration;
-  for (const auto *decAInstr : decsA) {
-    auto d = decAInstr->getOperand(1).getImm();
-    if (d == D::LinkageAttributes || d == D::BuiltIn || d == D::DescriptorSet) {
-      for (const auto decBInstr : decsB) {
-        if (allOpsMatch(*decAInstr, *decBInstr, 1)) {
-          return true;
-        }
-      }
+  const MachineInstr *binding = nullptr;
+  for (const auto *decInstr : decs) {
+    if (decInstr->getOperand(1).getImm() == D::Binding) {
+      binding = decInstr;
     }
   }
-  return false;
-}
-
-using VRegDecorationsLists = DenseMap<FuncIdxAndVReg, DecorationList>;
 
-// Check the metablock's existing OpVariables to see if any have matching
-// decorations. Return VReg of the duplicate if found, or 0 otherwise.
-static Optional<Register>
-getDuplicateOpVariable(const MachineInstr &localMI, const unsigned MFIndex,
-                       const LocalToGlobalRegTable &localToGlobalVRegs,
-                       const VRegDecorationsLists &vregToDecorsMap,
-                       MachineIRBuilder &MIRBuilder) {
-
-  setMetaBlock(MIRBuilder, MB_TypeConstVars);
-
-  Register localVReg = localMI.getOperand(0).getReg();
-  auto localDecs = vregToDecorsMap.find({MFIndex, localVReg});
-  if (localDecs != vregToDecorsMap.end() && !localDecs->second.empty()) {
-    auto localTypeVReg = localMI.getOperand(1).getReg();
-    auto globalTypeVReg = localToGlobalVRegs.find(localTypeVReg)->second;
-
-    const auto &MBB = MIRBuilder.getMBB();
-    for (const auto &globalMI : MBB) {
-      if (globalMI.getOpcode() == SPIRV::OpVariable &&
-          globalMI.getOperand(1).getReg() == globalTypeVReg &&
-          globalMI.getOperand(2).getImm() == localMI.getOperand(2).getImm()) {
-
-        Register globalVReg = globalMI.getOperand(0).getReg();
-        auto globDecs = vregToDecorsMap.find({0, globalVReg});
-        if (globDecs != vregToDecorsMap.end() && !globDecs->second.empty()) {
-          // Can only count as a duplicate if it has decorations to match
-          if (decorationsAreDuplicates(localDecs->second, globDecs->second)) {
-            return globalVReg;
-          }
-        }
+  SmallVector<MetaInstrKey, 2> keys;
+  for (const auto *decInstr : decs) {
+    auto d = decInstr->getOperand(1).getImm();
+    if (d == D::LinkageAttributes || d == D::BuiltIn || d == D::DescriptorSet) {
+      MetaInstrKey key = getMetaInstrKey(*decInstr, 1, nullptr);
+      if (d == D::DescriptorSet && binding) {
+        auto bindingKey = getMetaInstrKey(*binding, 1, nullptr);
+        key.append(bindingKey.begin(), bindingKey.end());
       }
+      key.push_back(globalTypeVReg);
+      key.push_back(storageClass);
+      keys.push_back(std::move(key));
     }
   }
-  return {};
+  if (GV) {
+    keys.push_back({SPIRV::OpVariable, reinterpret_cast<intptr_t>(GV),
+                    globalTypeVReg, storageClass});
+  }
+  return keys;
 }
 
 // Move any non function-local OpVariable instructions to the global meta block.
 // We need to examine decorations such as linkage names to check whether the
 // OpVariables are duplicates or not, as it is possible to declare multiple
-// OpVariables with the same types and initializers.
+// OpVariables with the same types and initializers. Hoisted OpVariables are
+// indexed by their identifying decorations, so each lookup is O(1).
 //
 // This must be called before global register numbering, but after OpTypeXXX
 // instructions have been hoisted. Type IDs and constant initializers get
 // handled via local reg alias tables. OpDecorate instructions have not been
 // hoisted at this stage, so we need to examine every function for them.
-static void hoistGlobalOpVariables(Module &M, MachineModuleInfo &MMI,
-                                   MachineIRBuilder &MIRBuilder,
-                                   const LocalAliasTables &localAliasTables) {
+static void hoistGlobalOpVariables(MachineIRBuilder &MIRBuilder,
+                                   const LocalAliasTables &localAliasTables,
+                                   const ModuleWorklists &worklists,
+                                   GlobalSections &sections) {
 
   using namespace SPIRV;
-  DenseMap<FuncIdxAndVReg, DecorationList> vregToDecorationMap;
+  VRegDecorationsLists vregToDecorationMap;
+  OpVariableIndex globalVarIndex;
 
   // Fill in the map between VRegs and their decorations so we can tell whether
   // OpVariables are duplicates later by comparing decorations.
-  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
-  for (MachineBasicBlock &MBB : *MF) {
-    for (MachineInstr &MI : MBB) {
-      const Register Opc = MI.getOpcode();
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    for (MachineInstr *MI : worklists[MFIndex].globalRegInstrs) {
+      const unsigned Opc = MI->getOpcode();
       if (Opc == OpDecorate || Opc == OpDecorateId || Opc == OpDecorateString) {
-        Register target = MI.getOperand(0).getReg();
+        Register target = MI->getOperand(0).getReg();
         auto key = FuncIdxAndVReg(MFIndex, target);
-        auto info = vregToDecorationMap.try_emplace(key, DecorationList({&MI}));
+        auto info = vregToDecorationMap.try_emplace(key, DecorationList({MI}));
         if (!info.second) {
-          info.first->second.push_back(&MI);
+          info.first->second.push_back(MI);
         }
       }
     }
   }
-  END_FOR_MF_IN_MODULE()
 
   // Hoist OpVariables to the global metablock, or simply delete them if their
   // decorations indicate a duplicate has already been hoisted.
-  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
-  auto locToGlobMap = localAliasTables[MFIndex];
-  SmallVector<MachineInstr *, 8> toRemove;
-  for (MachineBasicBlock &MBB : *MF) {
-    for (MachineInstr &MI : MBB) {
-      if (MI.getOpcode() == OpVariable &&
-          MI.getOperand(2).getImm() != StorageClass::Function) {
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    auto locToGlobMap = localAliasTables[MFIndex];
+    for (MachineInstr *MI : worklists[MFIndex].globalVars) {
+      Register localVReg = MI->getOperand(0).getReg();
+      SmallVector<MetaInstrKey, 2> keys;
+      auto localDecs = vregToDecorationMap.find({MFIndex, localVReg});
+      const auto &ST =
+          static_cast<const SPIRVSubtarget &>(MI->getMF()->getSubtarget());
+      const GlobalVariable *GV =
+          ST.getSPIRVTypeRegistry()->getGlobalVariable(MI);
+      if (localDecs != vregToDecorationMap.end() || GV) {
+        Register localTypeVReg = MI->getOperand(1).getReg();
+        Register globalTypeVReg = locToGlobMap->find(localTypeVReg)->second;
+        keys = getOpVariableKeys(
+            globalTypeVReg, MI->getOperand(2).getImm(),
+            localDecs != vregToDecorationMap.end() ? localDecs->second
+                                                   : DecorationList(),
+            GV);
+      }
 
-        // Not function local, so extract it
-        Register localVReg = MI.getOperand(0).getReg();
-        auto dupe = getDuplicateOpVariable(MI, MFIndex, *locToGlobMap,
-                                           vregToDecorationMap, MIRBuilder);
-        if (dupe.hasValue()) {
-          locToGlobMap->insert({localVReg, dupe.getValue()});
-        } else {
-          auto globVReg = hoistMetaInstr(MI, MIRBuilder, *locToGlobMap,
-                                         IDRegClass, MB_TypeConstVars, true);
-          auto localKey = FuncIdxAndVReg(MFIndex, localVReg);
-          auto globalKey = FuncIdxAndVReg(0, globVReg);
-          vregToDecorationMap[globalKey] = vregToDecorationMap[localKey];
+      // Use the first hoisted OpVariable matching any of the keys.
+      Register dupe;
+      for (const auto &key : keys) {
+        auto found = globalVarIndex.find(key);
+        if (found != globalVarIndex.end()) {
+          dupe = found->second;
+          break;
+        }
+      }
+      if (dupe.isValid()) {
+        locToGlobMap->insert({localVReg, dupe});
+      } else {
+        auto globVReg = hoistMetaInstr(*MI, MIRBuilder, *locToGlobMap,
+                                       sections, MB_TypeConstVars, true);
+        for (auto &key : keys) {
+          globalVarIndex.insert({std::move(key), globVReg});
         }
-        toRemove.push_back(&MI);
       }
     }
+    for (MachineInstr *MI : worklists[MFIndex].globalVars) {
+      MI->removeFromParent();
+    }
   }
-  for (MachineInstr *MI : toRemove) {
-    MI->removeFromParent();
+}
+
+// True for instructions which only annotate their target ID (operand 0), so
+// don't keep it alive on their own.
+static bool isNameOrDecoration(const MachineInstr &MI,
+                               const SPIRVInstrInfo &TII) {
+  const unsigned Opc = MI.getOpcode();
+  return Opc == SPIRV::OpName || Opc == SPIRV::OpMemberName ||
+         TII.isDecorationInstr(MI);
+}
+
+// Remove the OpExtInstImport, OpTypeXXX, OpConstantXXX and global OpVariable
+// instructions from the meta function which nothing in the module refers to
+// any more, along with any names or decorations targeting them.
+//
+// This is a mark and sweep over the meta function, seeded from all the IDs the
+// functions refer to, all external function declarations, and the targets of
+// LinkageAttributes decorations (which are visible from outside the module).
+// Names and decorations only keep the IDs they refer to alive when their
+// target is live. It must run after all these instructions have been hoisted,
+// but before registers are numbered globally.
+static void removeDeadGlobals(MachineIRBuilder &MIRBuilder,
+                              const LocalAliasTables &localAliasTables,
+                              ModuleWorklists &worklists,
+                              GlobalSections &sections) {
+  const auto TII = static_cast<const SPIRVInstrInfo *>(&MIRBuilder.getTII());
+  MachineFunction &MetaMF = MIRBuilder.getMF();
+
+  SmallPtrSet<const MachineInstr *, 32> live;
+  SmallVector<const MachineInstr *, 32> toVisit;
+  auto markLive = [&](const MachineInstr *MI) {
+    if (MI && live.insert(MI).second) {
+      toVisit.push_back(MI);
+      return true;
+    }
+    return false;
+  };
+  // Mark the meta instruction defining the global alias of a local VReg.
+  auto markAlias = [&](const LocalToGlobalRegTable &aliases, Register reg) {
+    auto metaReg = aliases.find(reg);
+    if (metaReg == aliases.end())
+      return false;
+    return markLive(sections.getDef(metaReg->second));
+  };
+  auto propagate = [&]() {
+    while (!toVisit.empty()) {
+      const MachineInstr *MI = toVisit.pop_back_val();
+      for (const MachineOperand &op : MI->uses()) {
+        if (isIDOperand(op)) {
+          markLive(sections.getDef(getIDReg(op)));
+        }
+      }
+    }
+  };
+
+  // Seed from the functions' instructions and linkage decorations.
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    const MachineInstr *funcDef = worklists[MFIndex].funcDef;
+    if (!funcDef)
+      continue;
+    const auto &aliases = *localAliasTables[MFIndex];
+    for (const MachineBasicBlock &MBB : *funcDef->getMF()) {
+      for (const MachineInstr &MI : MBB) {
+        if (isNameOrDecoration(MI, *TII)) {
+          if (MI.getOpcode() == SPIRV::OpDecorate &&
+              MI.getOperand(1).getImm() == Decoration::LinkageAttributes) {
+            markAlias(aliases, MI.getOperand(0).getReg());
+          }
+          continue;
+        }
+        for (const MachineOperand &op : MI.operands()) {
+          if (op.isReg()) {
+            markAlias(aliases, op.getReg());
+          }
+        }
+      }
+    }
+  }
+
+  // External function declarations, and any global instructions without a
+  // def (which can't be referred to) are always kept.
+  for (auto block : {MB_ExtInstImports, MB_TypeConstVars, MB_ExtFuncDecs}) {
+    for (const MachineInstr &MI : *MetaMF.getBlockNumbered(block)) {
+      if (block == MB_ExtFuncDecs || MI.getNumDefs() == 0) {
+        markLive(&MI);
+      }
+    }
+  }
+  propagate();
+
+  // Names and decorations of live IDs keep any other IDs they use alive too,
+  // which may in turn make more of them live.
+  auto isLiveTarget = [&](const MachineInstr &MI,
+                          const LocalToGlobalRegTable &aliases) {
+    auto metaReg = aliases.find(MI.getOperand(0).getReg());
+    return metaReg == aliases.end() ||
+           live.count(sections.getDef(metaReg->second));
+  };
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+      const auto &aliases = *localAliasTables[MFIndex];
+      for (const MachineInstr *MI : worklists[MFIndex].globalRegInstrs) {
+        if (isNameOrDecoration(*MI, *TII) && isLiveTarget(*MI, aliases)) {
+          for (unsigned i = 1, e = MI->getNumOperands(); i < e; ++i) {
+            const MachineOperand &op = MI->getOperand(i);
+            if (op.isReg() && markAlias(aliases, op.getReg())) {
+              changed = true;
+            }
+          }
+        }
+      }
+    }
+    propagate();
+  }
+
+  // Drop the names and decorations of dead IDs, then the dead IDs themselves.
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    const auto &aliases = *localAliasTables[MFIndex];
+    auto &globalRegInstrs = worklists[MFIndex].globalRegInstrs;
+    auto firstDead = std::stable_partition(
+        globalRegInstrs.begin(), globalRegInstrs.end(), [&](MachineInstr *MI) {
+          return !isNameOrDecoration(*MI, *TII) || isLiveTarget(*MI, aliases);
+        });
+    for (auto it = firstDead; it != globalRegInstrs.end(); ++it) {
+      (*it)->eraseFromParent();
+    }
+    globalRegInstrs.erase(firstDead, globalRegInstrs.end());
+  }
+  for (auto block : {MB_ExtInstImports, MB_TypeConstVars}) {
+    MachineBasicBlock &MBB = *MetaMF.getBlockNumbered(block);
+    for (auto I = MBB.begin(), E = MBB.end(); I != E;) {
+      MachineInstr &MI = *I++;
+      if (!live.count(&MI)) {
+        if (MI.getNumDefs() != 0) {
+          sections.defs.erase(getDef(MI));
+        }
+        MI.eraseFromParent();
+        ++NumDeadGlobals;
+      }
+    }
   }
-  END_FOR_MF_IN_MODULE()
 }
 
-static void addOpExtInstImports(Module &M, MachineModuleInfo &MMI,
-                                MachineIRBuilder &MIRBuilder,
-                                const LocalAliasTables &localAliasTables) {
+static void addOpExtInstImports(MachineIRBuilder &MIRBuilder,
+                                const LocalAliasTables &localAliasTables,
+                                const ModuleWorklists &worklists,
+                                GlobalSections &sections) {
 
-  std::set<ExtInstSet> usedExtInstSets;
+  // The sets are numbered densely, so index tables by them
+  std::array<bool, NumExtInstSets> usedExtInstSets{};
   SmallVector<std::pair<MachineInstr *, LocalToGlobalRegTable *>, 8>
       extInstInstrs;
 
   // Record all OpExtInst instuctions and the instruction sets they use
-  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
-  for (MachineBasicBlock &MBB : *MF) {
-    for (MachineInstr &MI : MBB) {
-      if (MI.getOpcode() == SPIRV::OpExtInst) {
-        auto set = static_cast<ExtInstSet>(MI.getOperand(2).getImm());
-        usedExtInstSets.insert(set);
-        extInstInstrs.push_back({&MI, localAliasTables[MFIndex]});
-      }
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    for (MachineInstr *MI : worklists[MFIndex].extInsts) {
+      auto set = static_cast<ExtInstSet>(MI->getOperand(2).getImm());
+      usedExtInstSets[unsigned(set)] = true;
+      extInstInstrs.push_back({MI, localAliasTables[MFIndex]});
     }
   }
-  END_FOR_MF_IN_MODULE()
 
-  std::map<ExtInstSet, Register> setEnumToGlobalIDReg;
+  std::array<Register, NumExtInstSets> setEnumToGlobalIDReg;
 
   setMetaBlock(MIRBuilder, MB_ExtInstImports);
-  auto MetaMRI = MIRBuilder.getMRI();
-  for (const auto set : usedExtInstSets) {
-    auto setReg = MetaMRI->createVirtualRegister(&SPIRV::IDRegClass);
-    auto MIB = MIRBuilder.buildInstr(SPIRV::OpExtInstImport).addDef(setReg);
-    addStringImm(getExtInstSetName(set), MIB);
-    setEnumToGlobalIDReg.insert({set, setReg});
+  for (unsigned set = 0; set < NumExtInstSets; ++set) {
+    if (!usedExtInstSets[set])
+      continue;
+    auto MIB = buildMetaDef(SPIRV::OpExtInstImport, MIRBuilder, sections);
+    addStringImm(getExtInstSetName(static_cast<ExtInstSet>(set)), MIB);
+    setEnumToGlobalIDReg[set] = getDef(*MIB);
   }
 
-  // Replace all OpFunctionCalls with new ones referring to funcID vregs
+  // Replace all OpFunctionCalls with new ones referring to funcID vregs. The
+  // instructions are grouped by function, so one builder is reused for them.
+  MachineIRBuilder FuncBuilder;
   for (const auto &entry : extInstInstrs) {
     auto *MI = entry.first;
     auto *aliasTable = entry.second;
 
     auto extInstSet = static_cast<ExtInstSet>(MI->getOperand(2).getImm());
 
-    MachineIRBuilder MIRBuilder;
-    MIRBuilder.setMF(*MI->getMF());
-    auto MRI = MIRBuilder.getMRI();
+    if (FuncBuilder.getMRI() != &MI->getMF()->getRegInfo())
+      FuncBuilder.setMF(*MI->getMF());
+    auto MRI = FuncBuilder.getMRI();
 
     // Ensure the mapping between local and global vregs is maintained for the
     // later reg numbering phase
     auto localReg = MRI->createVirtualRegister(&SPIRV::IDRegClass);
-    auto globalReg = setEnumToGlobalIDReg[extInstSet];
+    auto globalReg = setEnumToGlobalIDReg[unsigned(extInstSet)];
     aliasTable->insert({localReg, globalReg});
 
     // Create a new copy of the OpExtInst but with the IDVReg for the imported
     // instruction set rather than an enum, then delete the old instruction.
-    MIRBuilder.setMBB(*MI->getParent());
-    MIRBuilder.setInstr(*MI);
-    auto MIB = MIRBuilder.buildInstr(SPIRV::OpExtInst)
+    FuncBuilder.setInstr(*MI);
+    auto MIB = FuncBuilder.buildInstr(SPIRV::OpExtInst)
                    .addDef(MI->getOperand(0).getReg())
                    .addUse(MI->getOperand(1).getReg())
                    .addUse(localReg);
@@ -561,43 +1121,36 @@ static void addOpExtInstImports(Module &M, MachineModuleInfo &MMI,
   }
 }
 
-// We need to add dummy registers whenever we need to reference a VReg that
-// might be beyond the number of virtual registers declared in the function so
-// far. This stops addUse and setReg from crashing when we use the new index.
-static void addDummyVRegsUpToIndex(unsigned index, MachineRegisterInfo &MRI) {
-  while (index >= MRI.getNumVirtRegs()) {
-    MRI.createVirtualRegister(&SPIRV::IDRegClass);
-  }
-}
-
 // Create a copy of the given instruction in the specified basic block of the
 // global metadata function. We assume global register numbering has already
-// occurred by this point, so we can directly copy VReg arguments (with padding
-// to avoid crashed). We can also directly compare VReg arguments directly when
-// detecting duplicates, rather than having to use local-to-global alias tables.
+// occurred by this point, so we can directly copy global ID arguments. We can
+// also directly use the global VRegs in the key when detecting duplicates,
+// rather than using local-to-global alias tables.
 static void hoistMetaInstrWithGlobalRegs(MachineInstr &MI,
                                          MachineIRBuilder &MIRBuilder,
+                                         MetaInstrTables &dedupTables,
                                          MetaBlockType mbType) {
 
   setMetaBlock(MIRBuilder, mbType);
-  auto &MBB = MIRBuilder.getMBB();
-  for (const auto &I : MBB) {
-    if (allOpsMatch(MI, I))
-      return; // Found a duplicate, so don't add it
+  assert(MI.getNumDefs() == 0 && "Unexpected def in global reg meta instr");
+  auto key = getMetaInstrKey(MI, 0, nullptr);
+  if (!dedupTables[mbType].insert({std::move(key), Register(0)}).second) {
+    // Found a duplicate, so don't add it
+    dedupTables.numWordsDeduped += getInstrWordCount(MI);
+    return;
   }
 
   // No duplicates, so add it
-  auto &MetaMRI = MIRBuilder.getMF().getRegInfo();
   const unsigned numOperands = MI.getNumOperands();
   auto MIB = MIRBuilder.buildInstr(MI.getOpcode());
   for (unsigned i = 0; i < numOperands; ++i) {
     MachineOperand op = MI.getOperand(i);
     if (op.isImm()) {
       MIB.addImm(op.getImm());
-    } else if (op.isReg()) {
-      // Add dummy regs to stop addUse crashing if Reg > max regs in func so far
-      addDummyVRegsUpToIndex(op.getReg().virtRegIndex(), MetaMRI);
-      MIB.addUse(op.getReg());
+    } else if (isIDOperand(op)) {
+      addGlobalID(MIB, getIDReg(op));
+    } else if (isStringOperand(op)) {
+      addStringImm(op.getSymbolName(), MIB);
     } else {
       errs() << MI << "\n";
       llvm_unreachable("Unexpected operand type when copying spirv meta instr");
@@ -612,132 +1165,238 @@ static void hoistMetaInstrWithGlobalRegs(MachineInstr &MI,
 // This pass extracts and deduplicates these instructions assuming global VReg
 // numbers rather than using function-local alias tables like before.
 static void
-extractInstructionsWithGlobalRegsToMetablock(Module &M, MachineModuleInfo &MMI,
-                                             MachineIRBuilder &MIRBuilder) {
-  const auto TII = static_cast<const SPIRVInstrInfo *>(&MIRBuilder.getTII());
+extractInstructionsWithGlobalRegsToMetablock(MachineIRBuilder &MIRBuilder,
+                                             const ModuleWorklists &worklists,
+                                             MetaInstrTables &dedupTables) {
   setMetaBlock(MIRBuilder, MB_DebugNames);
-  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
-  for (MachineBasicBlock &MBB : *MF) {
-    SmallVector<MachineInstr *, 16> toRemove;
-    for (MachineInstr &MI : MBB) {
-      const unsigned OpCode = MI.getOpcode();
+  for (const FunctionWorklists &lists : worklists) {
+    for (MachineInstr *MI : lists.globalRegInstrs) {
+      const unsigned OpCode = MI->getOpcode();
       if (OpCode == SPIRV::OpName || OpCode == SPIRV::OpMemberName) {
-        hoistMetaInstrWithGlobalRegs(MI, MIRBuilder, MB_DebugNames);
-        toRemove.push_back(&MI);
+        hoistMetaInstrWithGlobalRegs(*MI, MIRBuilder, dedupTables,
+                                     MB_DebugNames);
       } else if (OpCode == SPIRV::OpEntryPoint) {
-        hoistMetaInstrWithGlobalRegs(MI, MIRBuilder, MB_EntryPoints);
-        toRemove.push_back(&MI);
-      } else if (TII->isDecorationInstr(MI)) {
-        hoistMetaInstrWithGlobalRegs(MI, MIRBuilder, MB_Annotations);
-        toRemove.push_back(&MI);
+        hoistMetaInstrWithGlobalRegs(*MI, MIRBuilder, dedupTables,
+                                     MB_EntryPoints);
+      } else if (OpCode == SPIRV::OpExecutionMode ||
+                 OpCode == SPIRV::OpExecutionModeId) {
+        hoistMetaInstrWithGlobalRegs(*MI, MIRBuilder, dedupTables,
+                                     MB_ExecutionModes);
+      } else {
+        hoistMetaInstrWithGlobalRegs(*MI, MIRBuilder, dedupTables,
+                                     MB_Annotations);
       }
-    }
-    for (MachineInstr *MI : toRemove) {
       MI->removeFromParent();
     }
   }
-  END_FOR_MF_IN_MODULE()
+}
+
+// Visit states of functions when walking the call graph.
+enum CallGraphVisitState { CG_Unvisited, CG_Visiting, CG_Done };
+
+// Add the imported IDs used by all the callees of the given function to its
+// own set of used imports, recursing through the callees first. Recursion isn't
+// allowed by SPIR-V environments, so functions already being visited are just
+// skipped rather than iterating to a fixed point.
+static void
+addCalleeImports(unsigned MFIndex, const ModuleWorklists &worklists,
+                 const DenseMap<const Function *, unsigned> &funcIndices,
+                 SmallVectorImpl<BitVector> &usedImports,
+                 SmallVectorImpl<CallGraphVisitState> &visitStates) {
+  if (visitStates[MFIndex] != CG_Unvisited)
+    return;
+  visitStates[MFIndex] = CG_Visiting;
+  for (const MachineOperand *funcRef : worklists[MFIndex].funcRefs) {
+    const auto *callee = dyn_cast<Function>(funcRef->getGlobal());
+    auto calleeIndex = callee ? funcIndices.find(callee) : funcIndices.end();
+    if (calleeIndex != funcIndices.end()) {
+      addCalleeImports(calleeIndex->second, worklists, funcIndices, usedImports,
+                       visitStates);
+      usedImports[MFIndex] |= usedImports[calleeIndex->second];
+    }
+  }
+  visitStates[MFIndex] = CG_Done;
 }
 
 // After all OpEntryPoint and OpDecorate instructions have been globally
-// extracted, we need to add all IDs with Import linkage as interface arguments
-// to all OpEntryPoints.
+// extracted, we need to add the IDs with Import linkage and the BuiltIn
+// variables as interface arguments to the OpEntryPoints using them. From
+// SPIR-V 1.4, all the global variables they use are part of the interface.
 //
-// Currently, this adds all Import linked IDs to all EntryPoints, rather than
-// walking the function CFG to see exactly which ones are used, so it may
-// declare more interface variables than strictly necessary.
-static void addEntryPointLinkageInterfaces(Module &M, MachineModuleInfo &MMI,
-                                           MachineIRBuilder &MIRBuilder) {
-  // Find all IDs with Import linkage by examining OpDecorates
+// Each entry point only gets the IDs used by its function, or transitively by
+// the functions it calls. The IDs used directly by each function are found in
+// a single walk, and unions over callees are cached per function, so this stays
+// linear in the size of the module. This must run before assignFunctionCallIDs,
+// as OpFunctionCalls still refer to their callees' Functions here.
+static void addEntryPointLinkageInterfaces(MachineIRBuilder &MIRBuilder,
+                                           const ModuleWorklists &worklists,
+                                           const SPIRVSubtarget &ST) {
+  // Find all IDs with Import linkage or a BuiltIn by examining OpDecorates
   setMetaBlock(MIRBuilder, MB_Annotations);
   auto &decMBB = MIRBuilder.getMBB();
   SmallVector<Register, 4> inputLinkedIDs;
+  DenseMap<Register, unsigned> importIndices;
+  auto addInterfaceID = [&](Register target) {
+    if (importIndices.try_emplace(target, inputLinkedIDs.size()).second) {
+      inputLinkedIDs.push_back(target);
+    }
+  };
   for (MachineInstr &MI : decMBB) {
     const unsigned OpCode = MI.getOpcode();
     const unsigned numOps = MI.getNumOperands();
-    if (OpCode == SPIRV::OpDecorate &&
-        MI.getOperand(1).getImm() == Decoration::LinkageAttributes &&
-        MI.getOperand(numOps - 1).getImm() == LinkageType::Import) {
-      const Register target = MI.getOperand(0).getReg();
-      inputLinkedIDs.push_back(target);
+    if (OpCode != SPIRV::OpDecorate) {
+      continue;
+    }
+    const int64_t dec = MI.getOperand(1).getImm();
+    if ((dec == Decoration::LinkageAttributes &&
+         MI.getOperand(numOps - 1).getImm() == LinkageType::Import) ||
+        dec == Decoration::BuiltIn) {
+      addInterfaceID(getIDReg(MI.getOperand(0)));
     }
   }
-
-  // Add any Import linked IDs as interface args to all OpEntryPoints
-  if (!inputLinkedIDs.empty()) {
-    setMetaBlock(MIRBuilder, MB_EntryPoints);
-    auto &entryMBB = MIRBuilder.getMBB();
-    for (MachineInstr &MI : entryMBB) {
-      for (unsigned id : inputLinkedIDs) {
-        MI.addOperand(MachineOperand::CreateReg(id, false));
+  if (ST.getTargetSPIRVVersion() >= 0x10400) {
+    setMetaBlock(MIRBuilder, MB_TypeConstVars);
+    for (MachineInstr &MI : MIRBuilder.getMBB()) {
+      if (MI.getOpcode() == SPIRV::OpVariable &&
+          MI.getOperand(2).getImm() != StorageClass::Function) {
+        addInterfaceID(getDef(MI));
+      }
+    }
+  }
+  if (inputLinkedIDs.empty())
+    return;
+
+  // Find the imported IDs each function uses directly.
+  DenseMap<const Function *, unsigned> funcIndices;
+  DenseMap<Register, unsigned> funcIDToIndex;
+  SmallVector<BitVector, 8> usedImports(worklists.size(),
+                                        BitVector(inputLinkedIDs.size()));
+  for (unsigned MFIndex = 1; MFIndex < worklists.size(); ++MFIndex) {
+    const MachineInstr *funcDef = worklists[MFIndex].funcDef;
+    if (!funcDef)
+      continue;
+    const MachineFunction *MF = funcDef->getMF();
+    funcIndices.insert({&MF->getFunction(), MFIndex});
+    funcIDToIndex.insert({getDef(*funcDef), MFIndex});
+    for (const MachineBasicBlock &MBB : *MF) {
+      for (const MachineInstr &MI : MBB) {
+        for (const MachineOperand &op : MI.operands()) {
+          if (isIDOperand(op)) {
+            auto importIndex = importIndices.find(getIDReg(op));
+            if (importIndex != importIndices.end()) {
+              usedImports[MFIndex].set(importIndex->second);
+            }
+          }
+        }
       }
     }
   }
+
+  // Add the IDs reachable from each OpEntryPoint's function as interface args
+  SmallVector<CallGraphVisitState, 8> visitStates(worklists.size(),
+                                                  CG_Unvisited);
+  setMetaBlock(MIRBuilder, MB_EntryPoints);
+  auto &entryMBB = MIRBuilder.getMBB();
+  for (MachineInstr &MI : entryMBB) {
+    auto funcIndex = funcIDToIndex.find(getIDReg(MI.getOperand(1)));
+    if (funcIndex == funcIDToIndex.end())
+      continue;
+    addCalleeImports(funcIndex->second, worklists, funcIndices, usedImports,
+                     visitStates);
+    for (unsigned importIndex : usedImports[funcIndex->second].set_bits()) {
+      MI.addOperand(MachineOperand::CreateTargetIndex(
+          SPIRV::TI_GlobalID, inputLinkedIDs[importIndex].virtRegIndex()));
+    }
+  }
 }
 
 // Starting with the metablock, number all registers in all functions
 // globally from 0 onwards. Local registers aliasing results of OpType,
 // OpConstant etc. that were extracted to the metablock are now assigned
 // the correct global registers instead of the function-local ones.
+//
+// Register operands outside the metablock are replaced by global ID operands.
+//
+// Each function is given a contiguous range of global IDs as big as its number
+// of VRegs, so local VReg N is simply the Nth ID in the range. Aliased and
+// unused VRegs leave holes, but these are removed by compactRegisterIDs later.
+// This makes rewriting each function independent of the others, so functions
+// are renumbered in parallel, with deterministic results.
+//
+// The ranges start after the IDs given out to the meta function so far, and
+// new IDs are given out after all of them.
 static void numberRegistersGlobally(Module &M, MachineModuleInfo &MMI,
-                                    MachineIRBuilder &MIRBuilder,
-                                    const LocalAliasTables &regAliasTables) {
+                                    const LocalAliasTables &regAliasTables,
+                                    GlobalSections &sections) {
 
   // Use raw index 0 - inf, and convert with index2VirtReg later
-  unsigned int RegBaseIndex = 0;
-  BEGIN_FOR_MF_IN_MODULE(M, MMI)
-  if (MFIndex == 0) {
-    RegBaseIndex = MIRBuilder.getMF().getRegInfo().getNumVirtRegs();
-  } else {
-    auto &MRI = MF->getRegInfo();
-    auto localToMetaVRegAliasMap = regAliasTables[MFIndex];
+  unsigned int RegBaseIndex = sections.numIDs;
+  // Each function along with its MFIndex, and the start of its ID range.
+  SmallVector<std::pair<MachineFunction *, unsigned>, 8> funcs;
+  SmallVector<unsigned, 8> regBaseIndices;
+  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
+  funcs.push_back({MF, MFIndex});
+  regBaseIndices.push_back(RegBaseIndex);
+  RegBaseIndex += MF->getRegInfo().getNumVirtRegs();
+  END_FOR_MF_IN_MODULE()
+
+  auto numberFunction = [&](size_t i) {
+    MachineFunction *MF = funcs[i].first;
+    const auto *localToMetaVRegAliasMap = regAliasTables[funcs[i].second];
+    const unsigned baseIndex = regBaseIndices[i];
     for (MachineBasicBlock &MBB : *MF) {
       for (MachineInstr &MI : MBB) {
         for (MachineOperand &op : MI.operands()) {
           if (op.isReg()) {
-            Register newReg;
+            unsigned newIndex;
             auto VR = localToMetaVRegAliasMap->find(op.getReg());
             if (VR == localToMetaVRegAliasMap->end()) {
-              // Stops setReg crashing if reg index > max regs in func
-              addDummyVRegsUpToIndex(RegBaseIndex, MRI);
-
-              newReg = Register::index2VirtReg(RegBaseIndex);
-              ++RegBaseIndex;
-              localToMetaVRegAliasMap->insert({op.getReg(), newReg});
+              newIndex = baseIndex + op.getReg().virtRegIndex();
             } else {
-              newReg = VR->second;
+              newIndex = VR->second.virtRegIndex();
             }
-            op.setReg(newReg);
+            op.ChangeToTargetIndex(SPIRV::TI_GlobalID, newIndex);
           }
         }
       }
     }
+  };
+  // The time trace profiler can only be used by the thread it was started on,
+  // so functions are numbered in turn when tracing
+  if (ParallelRegNumbering && !timeTraceProfilerEnabled()) {
+    parallel::for_each_n(parallel::par, size_t(0), funcs.size(),
+                         numberFunction);
+  } else {
+    for (size_t i = 0, e = funcs.size(); i != e; ++i) {
+      TimeTraceScope trace("Number Function Registers",
+                           funcs[i].first->getName());
+      numberFunction(i);
+    }
   }
-  END_FOR_MF_IN_MODULE()
+  sections.numIDs = RegBaseIndex;
 }
 
 // After all OpFunction declarations for external functions have been extracted
 // to global scope, they need their OpFunctionParameter and OpFunctionEnd
 // instructions added too to make the SPIR-V declarations legal.
 static void
-addMissingExternalFunctionDeclarations(MachineIRBuilder &MIRBuilder) {
+addMissingExternalFunctionDeclarations(MachineIRBuilder &MIRBuilder,
+                                       GlobalSections &sections) {
   setMetaBlock(MIRBuilder, MB_ExtFuncDecs);
-  const auto MRI = MIRBuilder.getMRI();
   auto &MBB = MIRBuilder.getMBB();
   // Iterate backwards, adding OpFunctionParameters and an OpEnd below each
   // OpFunction declaration from last to first
   for (auto MI = MBB.rbegin(), E = MBB.rend(); MI != E; ++MI) {
     if (MI->getOpcode() == SPIRV::OpFunction) {
-      Register funcTypeVReg = MI->getOperand(3).getReg();
-      SPIRVType *funcType = MRI->getVRegDef(funcTypeVReg);
+      Register funcTypeVReg = getIDReg(MI->getOperand(3));
+      SPIRVType *funcType = sections.getDef(funcTypeVReg);
       assert(funcType && "Function type vreg has no def");
 
       const unsigned int numOps = funcType->getNumOperands();
       for (unsigned int i = 2; i < numOps; ++i) {
-        Register dummyDef = MRI->createVirtualRegister(&SPIRV::IDRegClass);
-        MIRBuilder.buildInstr(SPIRV::OpFunctionParameter)
-            .addDef(dummyDef)
-            .addUse(funcType->getOperand(i).getReg());
+        auto MIB =
+            buildMetaDef(SPIRV::OpFunctionParameter, MIRBuilder, sections);
+        addGlobalID(MIB, getIDReg(funcType->getOperand(i)));
       }
       MIRBuilder.buildInstr(SPIRV::OpFunctionEnd);
     }
@@ -748,7 +1407,7 @@ addMissingExternalFunctionDeclarations(MachineIRBuilder &MIRBuilder) {
   }
 }
 
-using FuncNameToIDMap = std::map<std::string, Register>;
+using FuncNameToIDMap = StringMap<Register>;
 
 // Iterate over all extracted OpDecorate instructions to look for IDs declared
 // with Import linkage, and map the imported name string to the VReg defining
@@ -768,8 +1427,8 @@ static void addExternalDeclarationsToIDMap(MachineIRBuilder &MetaBuilder,
         auto lnk = MI.getOperand(MI.getNumOperands() - 1).getImm();
         if (lnk == LinkageType::Import) {
           // Map imported function name to function ID VReg.
-          std::string name = getStringImm(MI, 2);
-          Register target = MI.getOperand(0).getReg();
+          StringRef name = getStringImm(MI, 2);
+          Register target = getIDReg(MI.getOperand(0));
           funcNameToOpID[name] = target;
         }
       }
@@ -779,58 +1438,169 @@ static void addExternalDeclarationsToIDMap(MachineIRBuilder &MetaBuilder,
 
 // Replace global value for the  Callee argument of OpFunctionCall with a
 // register number for the function ID now that all results of OpFunction are
-// globally numbered registers
-static void assignFunctionCallIDs(Module &M, MachineModuleInfo &MMI,
-                                  MachineIRBuilder &MetaBuilder) {
-  std::map<std::string, Register> funcNameToID;
-  SmallVector<MachineInstr *, 8> funcCalls;
+// globally numbered registers. Callees defined in the module are resolved by
+// their Function, and only calls to imported functions need a name lookup.
+static void assignFunctionCallIDs(MachineIRBuilder &MetaBuilder,
+                                  const ModuleWorklists &worklists) {
+  FuncNameToIDMap importedFuncIDs;
+  addExternalDeclarationsToIDMap(MetaBuilder, importedFuncIDs);
+
+  // Record all internal OpFunction declarations.
+  DenseMap<const GlobalValue *, Register> funcToID;
+  for (const FunctionWorklists &lists : worklists) {
+    if (const MachineInstr *funcDef = lists.funcDef) {
+      const Function &F = funcDef->getMF()->getFunction();
+      funcToID.insert({&F, getDef(*funcDef)});
+    }
+  }
 
-  addExternalDeclarationsToIDMap(MetaBuilder, funcNameToID);
+  // Patch the callee operand of every OpFunctionCall, and the invoke operand
+  // of every device enqueue instruction, in place to refer to the function's
+  // global ID rather than a GlobalValue.
+  for (const FunctionWorklists &lists : worklists) {
+    for (MachineOperand *calleeOp : lists.funcRefs) {
+      const GlobalValue *callee = calleeOp->getGlobal();
+      Register funcID = funcToID.lookup(callee);
+      if (!funcID.isValid()) {
+        auto funcName = callee->getGlobalIdentifier();
+        funcID = importedFuncIDs.lookup(funcName);
+        if (!funcID.isValid()) {
+          errs() << "Unknown function: " << funcName << "\n";
+          llvm_unreachable("Error: Could not find function id");
+        }
+      }
+      changeToGlobalIDOperand(*calleeOp, funcID);
+    }
+  }
+}
 
-  // Record all OpFunctionCalls, and all internal OpFunction declarations.
-  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
+// Replace the sets of OpDecorates with only literal operands shared by several
+// IDs with decorations of a single OpDecorationGroup, applied to them all by an
+// OpGroupDecorate, when that takes fewer words. The decorations of the group
+// must precede it, and the OpGroupDecorate follow it. The groups get new IDs
+// from the global sections.
+static void groupRepeatedDecorations(MachineIRBuilder &MIRBuilder,
+                                     GlobalSections &sections) {
+  setMetaBlock(MIRBuilder, MB_Annotations);
+
+  // The decorations of each target which can be shared
+  MapVector<Register, SmallVector<MachineInstr *, 4>> decsByTarget;
+  for (MachineInstr &MI : MIRBuilder.getMBB()) {
+    if (MI.getOpcode() != SPIRV::OpDecorate ||
+        !isIDOperand(MI.getOperand(0))) {
+      continue;
+    }
+    bool literalsOnly = true;
+    for (unsigned i = 1, e = MI.getNumOperands(); i < e; ++i) {
+      literalsOnly &= MI.getOperand(i).isImm();
+    }
+    if (literalsOnly) {
+      decsByTarget[getIDReg(MI.getOperand(0))].push_back(&MI);
+    }
+  }
+
+  // Find the targets with the same set of decorations, in any order
+  std::map<std::vector<int64_t>, SmallVector<Register, 8>> targetsByDecs;
+  for (const auto &entry : decsByTarget) {
+    std::vector<std::vector<int64_t>> decs;
+    for (const MachineInstr *MI : entry.second) {
+      std::vector<int64_t> literals;
+      for (unsigned i = 1, e = MI->getNumOperands(); i < e; ++i) {
+        literals.push_back(MI->getOperand(i).getImm());
+      }
+      decs.push_back(std::move(literals));
+    }
+    llvm::sort(decs);
+    std::vector<int64_t> key;
+    for (const auto &literals : decs) {
+      key.push_back(literals.size());
+      key.insert(key.end(), literals.begin(), literals.end());
+    }
+    targetsByDecs[std::move(key)].push_back(entry.first);
+  }
+
+  for (const auto &entry : targetsByDecs) {
+    const auto &targets = entry.second;
+    const auto &decs = decsByTarget[targets.front()];
+    unsigned decsWords = 0;
+    for (const MachineInstr *MI : decs) {
+      decsWords += getInstrWordCount(*MI);
+    }
+    // The group's decorations, OpDecorationGroup, and OpGroupDecorate
+    const unsigned groupWords = decsWords + 2 + 2 + targets.size();
+    if (targets.size() < 2 || groupWords >= decsWords * targets.size()) {
+      continue;
+    }
+
+    // The group's decorations are built before the OpDecorationGroup, so give
+    // out its ID first.
+    Register group = sections.createID();
+    for (const MachineInstr *MI : decs) {
+      auto MIB = MIRBuilder.buildInstr(SPIRV::OpDecorate);
+      addGlobalID(MIB, group);
+      for (unsigned i = 1, e = MI->getNumOperands(); i < e; ++i) {
+        MIB.addImm(MI->getOperand(i).getImm());
+      }
+    }
+    auto groupMIB = MIRBuilder.buildInstr(SPIRV::OpDecorationGroup);
+    addGlobalID(groupMIB, group);
+    sections.defs.insert({group, groupMIB});
+    auto MIB = MIRBuilder.buildInstr(SPIRV::OpGroupDecorate);
+    addGlobalID(MIB, group);
+    for (Register target : targets) {
+      addGlobalID(MIB, target);
+      for (MachineInstr *MI : decsByTarget[target]) {
+        MI->eraseFromParent();
+      }
+    }
+    ++NumDecorationGroups;
+  }
+}
+
+// Renumber all registers in the module into a dense range of IDs with no
+// holes from duplicates or removed instructions. IDs are given
+// out in the order registers are defined in the final module layout, so the
+// global OpTypeXXX, OpConstantXXX etc. come first, followed by the IDs of each
+// function in turn. Registers which are only ever used (never defined) are
+// numbered as they are first encountered afterwards.
+static unsigned compactRegisterIDs(Module &M, MachineModuleInfo &MMI) {
+  DenseMap<Register, Register> compactRegs;
+  unsigned int nextIndex = 0;
+  auto getCompactReg = [&](Register reg) {
+    Register nextReg = Register::index2VirtReg(nextIndex);
+    auto newReg = compactRegs.try_emplace(reg, nextReg);
+    if (newReg.second) {
+      ++nextIndex;
+    }
+    return newReg.first->second;
+  };
+
+  // Assign IDs to all defs first, starting with the meta function
+  BEGIN_FOR_MF_IN_MODULE(M, MMI)
   for (MachineBasicBlock &MBB : *MF) {
     for (MachineInstr &MI : MBB) {
-      if (MI.getOpcode() == SPIRV::OpFunction) {
-        funcNameToID[F->getGlobalIdentifier()] = getDef(MI);
-      } else if (MI.getOpcode() == SPIRV::OpFunctionCall) {
-        funcCalls.push_back(&MI);
+      for (MachineOperand &op : MI.defs()) {
+        getCompactReg(getIDReg(op));
       }
     }
   }
   END_FOR_MF_IN_MODULE()
 
-  // Replace all OpFunctionCalls with new ones referring to funcID vregs
-  for (const auto funcCall : funcCalls) {
-    auto funcName = funcCall->getOperand(2).getGlobal()->getGlobalIdentifier();
-
-    auto funcID = funcNameToID.find(funcName);
-    if (funcID == funcNameToID.end()) {
-      errs() << "Unknown function: " << funcName << "\n";
-      llvm_unreachable("Error: Could not find function id");
-    }
-    const auto MF = funcCall->getMF();
-
-    // Stops addUse crashing if funcID > max regs in func so far
-    addDummyVRegsUpToIndex(funcID->second.virtRegIndex(), MF->getRegInfo());
-
-    // Create a new copy of the OpFunctionCall but with the IDVReg for the
-    // callee rather than a GlobalValue, then delete the old instruction.
-    MachineIRBuilder MIRBuilder;
-    MIRBuilder.setMF(*MF);
-    MIRBuilder.setMBB(*funcCall->getParent());
-    MIRBuilder.setInstr(*funcCall);
-    auto MIB = MIRBuilder.buildInstr(SPIRV::OpFunctionCall)
-                   .addDef(funcCall->getOperand(0).getReg())
-                   .addUse(funcCall->getOperand(1).getReg())
-                   .addUse(funcID->second);
-    const unsigned int numOps = funcCall->getNumOperands();
-    for (unsigned int i = 3; i < numOps; ++i) {
-      MIB.addUse(funcCall->getOperand(i).getReg());
+  // Rewrite every global ID operand to use the compacted ID
+  BEGIN_FOR_MF_IN_MODULE(M, MMI)
+  for (MachineBasicBlock &MBB : *MF) {
+    for (MachineInstr &MI : MBB) {
+      for (MachineOperand &op : MI.operands()) {
+        assert(!op.isReg() && "Register operand left after global numbering");
+        if (isIDOperand(op)) {
+          op.setOffset(getCompactReg(getIDReg(op)).virtRegIndex());
+        }
+      }
     }
-
-    funcCall->removeFromParent();
   }
+  END_FOR_MF_IN_MODULE()
+  NumGlobalIDs += nextIndex;
+  return nextIndex;
 }
 
 // Create global OpCapability instructions for the required capabilities
@@ -855,6 +1625,567 @@ static void addGlobalRequirements(const SPIRVRequirementHandler &reqs,
   // TODO add a pseudo instr for version number
 }
 
+// Get the section of the module header the given instruction belongs to, or
+// None if it belongs in function bodies. OpVariable, OpUndef and the function
+// declaration instructions can appear in both.
+static Optional<MetaBlockType> getMetaBlockType(const MachineInstr &MI,
+                                               const SPIRVInstrInfo &TII) {
+  using namespace SPIRV;
+  switch (MI.getOpcode()) {
+  case OpCapability:
+    return MB_Capabilities;
+  case OpExtension:
+    return MB_Extensions;
+  case OpExtInstImport:
+    return MB_ExtInstImports;
+  case OpMemoryModel:
+    return MB_MemoryModel;
+  case OpEntryPoint:
+    return MB_EntryPoints;
+  case OpExecutionMode:
+  case OpExecutionModeId:
+    return MB_ExecutionModes;
+  case OpString:
+  case OpSource:
+  case OpSourceContinued:
+  case OpSourceExtension:
+    return MB_DebugSourceAndStrings;
+  case OpName:
+  case OpMemberName:
+    return MB_DebugNames;
+  case OpModuleProcessed:
+    return MB_DebugModuleProcessed;
+  case OpUndef:
+  case OpVariable:
+  case OpFunction:
+  case OpFunctionParameter:
+  case OpFunctionEnd:
+    return None;
+  default:
+    if (TII.isDecorationInstr(MI)) {
+      return MB_Annotations;
+    }
+    if (TII.isConstantInstr(MI) ||
+        TII.getName(MI.getOpcode()).startswith("OpType")) {
+      return MB_TypeConstVars;
+    }
+    return None;
+  }
+}
+
+// Whether the operands of the given instruction may refer to IDs defined later.
+// Functions may be referred to before their definition by any instruction.
+static bool allowsForwardReferences(unsigned opcode) {
+  using namespace SPIRV;
+  switch (opcode) {
+  case OpName:
+  case OpMemberName:
+  case OpDecorate:
+  case OpDecorateId:
+  case OpDecorateString:
+  case OpMemberDecorate:
+  case OpMemberDecorateString:
+  case OpGroupDecorate:
+  case OpEntryPoint:
+  case OpExecutionMode:
+  case OpExecutionModeId:
+  case OpTypeForwardPointer:
+  case OpPhi:
+  case OpBranch:
+  case OpBranchConditional:
+  case OpSwitch:
+  case OpLoopMerge:
+  case OpSelectionMerge:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Check the structure of the final module in a single walk over it in layout
+// order, so the module needs no external validation on the hot path: every
+// instruction is in the right section, there is one OpMemoryModel, IDs are
+// below the bound, defined once, and before their uses unless forward
+// references are allowed, and the declared capabilities and extensions cover
+// all the requirements. Aborts compilation if any check fails.
+static void verifyModule(Module &M, MachineModuleInfo &MMI,
+                         const SPIRVInstrInfo &TII,
+                         const SPIRVRequirementHandler &reqs,
+                         const SPIRVSubtarget &ST, unsigned idBound) {
+  unsigned numErrors = 0;
+  auto reportError = [&](const Twine &msg, const MachineInstr *MI) {
+    errs() << "SPIR-V verifier: " << msg << "\n";
+    if (MI) {
+      errs() << "  in: ";
+      MI->print(errs());
+    }
+    ++numErrors;
+  };
+
+  // The opcode defining each ID, and the IDs used before their definition
+  std::vector<unsigned> defOpcodes(idBound, 0);
+  BitVector defined(idBound);
+  BitVector forwardDeclared(idBound);
+  struct ForwardRef {
+    unsigned id;
+    const MachineInstr *MI;
+    bool isAllowed;
+  };
+  SmallVector<ForwardRef, 16> forwardRefs;
+  CapabilitySet declaredCaps;
+  ExtensionSet declaredExts;
+
+  BEGIN_FOR_MF_IN_MODULE(M, MMI)
+  for (const MachineBasicBlock &MBB : *MF) {
+    const bool isMeta = MFIndex == 0;
+    for (const MachineInstr &MI : MBB) {
+      const unsigned opcode = MI.getOpcode();
+      Optional<MetaBlockType> block = getMetaBlockType(MI, TII);
+      if (isMeta) {
+        const auto mbType = static_cast<MetaBlockType>(MBB.getNumber());
+        bool isFuncDecl = opcode == SPIRV::OpFunction ||
+                          opcode == SPIRV::OpFunctionParameter ||
+                          opcode == SPIRV::OpFunctionEnd;
+        bool isGlobal =
+            opcode == SPIRV::OpVariable || opcode == SPIRV::OpUndef;
+        if (block ? *block != mbType
+                  : !(isFuncDecl && mbType == MB_ExtFuncDecs) &&
+                        !(isGlobal && mbType == MB_TypeConstVars)) {
+          reportError("instruction in the wrong module section", &MI);
+        }
+      } else if (block) {
+        reportError("module-level instruction in a function body", &MI);
+      }
+
+      if (opcode == SPIRV::OpCapability) {
+        auto cap =
+            static_cast<Capability::Capability>(MI.getOperand(0).getImm());
+        declaredCaps.set(getCapabilityIndex(cap));
+        declaredCaps |= getImplicitCapabilities(cap);
+      } else if (opcode == SPIRV::OpExtension) {
+        StringRef name = getStringImm(MI, 0);
+        for (unsigned i = 0; i < ExtensionIndex::NumExts; ++i) {
+          if (name == getExtensionName(getExtensionFromIndex(i))) {
+            declaredExts.set(i);
+          }
+        }
+      }
+
+      const unsigned numDefs = MI.getNumExplicitDefs();
+      for (unsigned i = 0, e = MI.getNumOperands(); i < e; ++i) {
+        const MachineOperand &op = MI.getOperand(i);
+        if (!isIDOperand(op)) {
+          continue;
+        }
+        const unsigned id = getIDReg(op).virtRegIndex();
+        if (id >= idBound) {
+          reportError("ID %" + Twine(id + 1) + " exceeds the ID bound", &MI);
+          continue;
+        }
+        if (i < numDefs) {
+          if (defined.test(id)) {
+            reportError("ID %" + Twine(id + 1) + " is defined twice", &MI);
+          }
+          defined.set(id);
+          defOpcodes[id] = opcode;
+        } else if (opcode == SPIRV::OpTypeForwardPointer) {
+          forwardDeclared.set(id);
+        } else if (!defined.test(id) && !forwardDeclared.test(id)) {
+          forwardRefs.push_back({id, &MI, allowsForwardReferences(opcode)});
+        }
+      }
+    }
+  }
+  END_FOR_MF_IN_MODULE()
+
+  // Only forward references to functions are allowed everywhere
+  for (const ForwardRef &ref : forwardRefs) {
+    if (!defined.test(ref.id)) {
+      reportError("ID %" + Twine(ref.id + 1) + " is never defined", ref.MI);
+    } else if (!ref.isAllowed && defOpcodes[ref.id] != SPIRV::OpFunction) {
+      reportError("ID %" + Twine(ref.id + 1) + " is used before its definition",
+                  ref.MI);
+    }
+  }
+
+  const auto &metaMF = *MMI.getMachineFunction(*M.begin());
+  if (metaMF.getBlockNumbered(MB_MemoryModel)->size() != 1) {
+    reportError("the module needs exactly one OpMemoryModel", nullptr);
+  }
+
+  for (auto cap : reqs.getMinimalCapabilities()) {
+    if (!declaredCaps.test(getCapabilityIndex(cap))) {
+      reportError("capability " + StringRef(getCapabilityName(cap)) +
+                      " is required but not declared",
+                  nullptr);
+    }
+  }
+  for (auto ext : reqs.getExtensions()) {
+    if (!declaredExts.test(getExtensionIndex(ext))) {
+      reportError("extension " + StringRef(getExtensionName(ext)) +
+                      " is required but not declared",
+                  nullptr);
+    }
+  }
+
+  if (numErrors != 0) {
+    report_fatal_error("The SPIR-V module is invalid.");
+  }
+}
+
+// Write the number of words in each section of the module header and in each
+// function to the -spirv-size-report file, with the ID bound and the words
+// saved by merging duplicate global instructions.
+static void writeSizeReport(Module &M, MachineModuleInfo &MMI,
+                            unsigned idBound, unsigned numWordsDeduped) {
+  std::error_code EC;
+  raw_fd_ostream out(SizeReportFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    report_fatal_error("Can't open the SPIR-V size report " + SizeReportFile +
+                       ": " + EC.message());
+  }
+
+  const unsigned headerWords = 5;
+  unsigned totalWords = headerWords;
+  std::array<unsigned, NUM_META_BLOCKS> sectionWords{};
+  std::vector<std::pair<StringRef, unsigned>> functionWords;
+  BEGIN_FOR_MF_IN_MODULE(M, MMI)
+  unsigned numWords = 0;
+  for (const MachineBasicBlock &MBB : *MF) {
+    unsigned numBlockWords = 0;
+    for (const MachineInstr &MI : MBB) {
+      numBlockWords += getInstrWordCount(MI);
+    }
+    if (MFIndex == 0) {
+      sectionWords[MBB.getNumber()] = numBlockWords;
+    }
+    numWords += numBlockWords;
+  }
+  if (MFIndex != 0) {
+    functionWords.push_back({MF->getName(), numWords});
+  }
+  totalWords += numWords;
+  END_FOR_MF_IN_MODULE()
+
+  json::OStream J(out, 2);
+  J.object([&] {
+    J.attribute("module", M.getModuleIdentifier());
+    J.attribute("total_words", totalWords);
+    J.attribute("header_words", headerWords);
+    J.attribute("id_bound", idBound + 1);
+    J.attribute("deduped_words", numWordsDeduped);
+    J.attributeObject("sections", [&] {
+      for (unsigned i = 0; i < NUM_META_BLOCKS; ++i) {
+        J.attribute(MetaBlockNames[i], sectionWords[i]);
+      }
+    });
+    J.attributeArray("functions", [&] {
+      for (const auto &function : functionWords) {
+        J.object([&] {
+          J.attribute("name", function.first);
+          J.attribute("words", function.second);
+        });
+      }
+    });
+  });
+  out << "\n";
+}
+
+// Cut the binary of a single OpEntryPoint out of the finished module: its own
+// capabilities and extensions, the global instructions whose IDs the functions
+// of the subset refer to (transitively), the names and decorations of those
+// IDs, then the functions themselves. The IDs are renumbered densely again.
+//
+// The IDs kept are found by a mark and sweep like removeDeadGlobals, seeded
+// from the functions, the OpEntryPoint itself and its execution modes.
+static SPIRVEntryPointImage
+buildEntryPointImage(MachineFunction &MetaMF, const MachineInstr &entryPoint,
+                     const EntryPointSubset &subset,
+                     const ModuleWorklists &worklists,
+                     ArrayRef<const MachineInstr *> metaDefs,
+                     const SPIRVSubtarget &ST) {
+  const SPIRVInstrInfo &TII = *ST.getInstrInfo();
+  const unsigned idBound = metaDefs.size();
+  const Register entryFunc = getIDReg(entryPoint.getOperand(1));
+
+  BitVector live(idBound);
+  SmallVector<unsigned, 32> toVisit;
+  auto markLive = [&](const MachineOperand &op) {
+    if (!isIDOperand(op))
+      return false;
+    const unsigned id = getIDReg(op).virtRegIndex();
+    if (live.test(id))
+      return false;
+    live.set(id);
+    toVisit.push_back(id);
+    return true;
+  };
+  auto isLive = [&](const MachineOperand &op) {
+    return live.test(getIDReg(op).virtRegIndex());
+  };
+  auto propagate = [&]() {
+    while (!toVisit.empty()) {
+      if (const MachineInstr *def = metaDefs[toVisit.pop_back_val()]) {
+        for (const MachineOperand &op : def->uses()) {
+          markLive(op);
+        }
+      }
+    }
+  };
+  auto isExecutionModeOfEntry = [&](const MachineInstr &MI) {
+    return getIDReg(MI.getOperand(0)) == entryFunc;
+  };
+  // Only names and decorations of live targets are kept. An OpGroupDecorate
+  // is kept, with just its live targets, if it has any.
+  auto isKeptAnnotation = [&](const MachineInstr &MI) {
+    if (MI.getOpcode() == SPIRV::OpGroupDecorate) {
+      for (unsigned i = 1, e = MI.getNumOperands(); i < e; ++i) {
+        if (isLive(MI.getOperand(i)))
+          return true;
+      }
+      return false;
+    }
+    return !isIDOperand(MI.getOperand(0)) || isLive(MI.getOperand(0));
+  };
+
+  // Seed from the functions, the entry point and its execution modes
+  for (unsigned MFIndex : subset.functions.set_bits()) {
+    for (const MachineBasicBlock &MBB : *worklists[MFIndex].funcDef->getMF()) {
+      for (const MachineInstr &MI : MBB) {
+        for (const MachineOperand &op : MI.operands()) {
+          markLive(op);
+        }
+      }
+    }
+  }
+  for (const MachineOperand &op : entryPoint.operands()) {
+    markLive(op);
+  }
+  for (const MachineInstr &MI : *MetaMF.getBlockNumbered(MB_ExecutionModes)) {
+    if (isExecutionModeOfEntry(MI)) {
+      for (const MachineOperand &op : MI.operands()) {
+        markLive(op);
+      }
+    }
+  }
+  propagate();
+
+  // Kept names and decorations keep the other IDs they use alive too
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (auto block : {MB_DebugNames, MB_Annotations}) {
+      for (const MachineInstr &MI : *MetaMF.getBlockNumbered(block)) {
+        if (!isKeptAnnotation(MI))
+          continue;
+        if (MI.getOpcode() == SPIRV::OpGroupDecorate) {
+          changed |= markLive(MI.getOperand(0));
+          continue;
+        }
+        for (const MachineOperand &op : MI.operands()) {
+          changed |= markLive(op);
+        }
+      }
+    }
+    propagate();
+  }
+
+  // Collect the instructions of the binary in layout order. The capabilities,
+  // extensions and filtered OpGroupDecorates are built just for this binary,
+  // so they're deleted once it is encoded.
+  SmallVector<MachineInstr *, 8> builtInstrs;
+  auto buildInstr = [&](unsigned opcode) {
+    MachineInstrBuilder MIB = BuildMI(MetaMF, DebugLoc(), TII.get(opcode));
+    builtInstrs.push_back(MIB);
+    return MIB;
+  };
+  std::vector<const MachineInstr *> instrs;
+  for (const auto &cap : subset.reqs.getMinimalCapabilities()) {
+    instrs.push_back(buildInstr(SPIRV::OpCapability).addImm(cap));
+  }
+  for (const auto &ext : subset.reqs.getExtensions()) {
+    auto MIB = buildInstr(SPIRV::OpExtension);
+    addStringImm(getExtensionName(ext), MIB);
+    instrs.push_back(MIB);
+  }
+  for (unsigned block = MB_ExtInstImports; block < NUM_META_BLOCKS; ++block) {
+    bool inLiveDecl = false;
+    for (const MachineInstr &MI : *MetaMF.getBlockNumbered(block)) {
+      bool isKept;
+      switch (block) {
+      case MB_EntryPoints:
+        isKept = &MI == &entryPoint;
+        break;
+      case MB_ExecutionModes:
+        isKept = isExecutionModeOfEntry(MI);
+        break;
+      case MB_DebugNames:
+      case MB_Annotations:
+        isKept = isKeptAnnotation(MI);
+        if (isKept && MI.getOpcode() == SPIRV::OpGroupDecorate) {
+          auto MIB = buildInstr(SPIRV::OpGroupDecorate);
+          MIB.add(MI.getOperand(0));
+          for (unsigned i = 1, e = MI.getNumOperands(); i < e; ++i) {
+            if (isLive(MI.getOperand(i))) {
+              MIB.add(MI.getOperand(i));
+            }
+          }
+          instrs.push_back(MIB);
+          continue;
+        }
+        break;
+      case MB_ExtFuncDecs:
+        // Each declaration is kept whole, with its parameters and end
+        if (MI.getOpcode() == SPIRV::OpFunction) {
+          inLiveDecl = isLive(MI.getOperand(0));
+        }
+        isKept = inLiveDecl;
+        break;
+      default:
+        // Instructions without a def are kept unless they refer to a dead ID
+        isKept = true;
+        for (const MachineOperand &op : MI.operands()) {
+          if (isIDOperand(op)) {
+            isKept = isLive(op);
+            break;
+          }
+        }
+        break;
+      }
+      if (isKept) {
+        instrs.push_back(&MI);
+      }
+    }
+  }
+  for (unsigned MFIndex : subset.functions.set_bits()) {
+    for (const MachineBasicBlock &MBB : *worklists[MFIndex].funcDef->getMF()) {
+      for (const MachineInstr &MI : MBB) {
+        // The AsmPrinter doesn't emit these either
+        if (!MI.isMetaInstruction()) {
+          instrs.push_back(&MI);
+        }
+      }
+    }
+  }
+
+  // Number the IDs densely in the order they are defined, then the IDs which
+  // are only used in the order they're found, as compactRegisterIDs does
+  const unsigned noID = ~0u;
+  std::vector<unsigned> IDMap(idBound, noID);
+  unsigned numIDs = 0;
+  for (const MachineInstr *MI : instrs) {
+    for (const MachineOperand &op : MI->defs()) {
+      unsigned &newID = IDMap[getIDReg(op).virtRegIndex()];
+      if (newID == noID) {
+        newID = numIDs++;
+      }
+    }
+  }
+  for (const MachineInstr *MI : instrs) {
+    for (const MachineOperand &op : MI->operands()) {
+      if (isIDOperand(op)) {
+        unsigned &newID = IDMap[getIDReg(op).virtRegIndex()];
+        if (newID == noID) {
+          newID = numIDs++;
+        }
+      }
+    }
+  }
+
+  // Encode the header in the same way as the object writer, then the body
+  uint32_t version = ST.getTargetSPIRVVersion();
+  if (version == 0) {
+    version = (1 << 16) | (4 << 8);
+  }
+  SPIRVEntryPointImage image;
+  image.Name = getStringImm(entryPoint, 2);
+  image.Words = {0x07230203, version & 0x00ffff00, 0, numIDs + 1, 0};
+  unsigned imageIDBound = 1;
+  for (const MachineInstr *MI : instrs) {
+    encodeSPIRVInstr(*MI, image.Words, imageIDBound, IDMap);
+  }
+  assert(imageIDBound <= numIDs + 1 && "ID outside the image's bound");
+  for (MachineInstr *MI : builtInstrs) {
+    MetaMF.DeleteMachineInstr(MI);
+  }
+  return image;
+}
+
+// Build the binary of each OpEntryPoint in the module, once its IDs are final.
+static std::vector<SPIRVEntryPointImage>
+buildEntryPointImages(MachineFunction &MetaMF,
+                      ArrayRef<EntryPointSubset> subsets,
+                      const ModuleWorklists &worklists,
+                      const SPIRVSubtarget &ST, unsigned idBound) {
+  // The meta instruction defining each ID
+  std::vector<const MachineInstr *> metaDefs(idBound, nullptr);
+  for (const MachineBasicBlock &MBB : MetaMF) {
+    for (const MachineInstr &MI : MBB) {
+      for (const MachineOperand &op : MI.defs()) {
+        metaDefs[getIDReg(op).virtRegIndex()] = &MI;
+      }
+    }
+  }
+
+  DenseMap<Register, const EntryPointSubset *> funcIDToSubset;
+  for (const EntryPointSubset &subset : subsets) {
+    funcIDToSubset.insert(
+        {getDef(*worklists[subset.MFIndex].funcDef), &subset});
+  }
+
+  std::vector<SPIRVEntryPointImage> images;
+  for (const MachineInstr &MI : *MetaMF.getBlockNumbered(MB_EntryPoints)) {
+    TimeTraceScope trace("Build Entry Point Image", getStringImm(MI, 2));
+    const auto *subset = funcIDToSubset.lookup(getIDReg(MI.getOperand(1)));
+    assert(subset && "Entry point function without a subset");
+    images.push_back(
+        buildEntryPointImage(MetaMF, MI, *subset, worklists, metaDefs, ST));
+    ++NumEntryPointImages;
+  }
+  return images;
+}
+
+// Write each entry point's binary to <prefix>.<name>.spv for
+// -spirv-entry-point-images.
+static void writeEntryPointImages(ArrayRef<SPIRVEntryPointImage> images) {
+  for (const SPIRVEntryPointImage &image : images) {
+    std::string fileName = EntryPointImagesPrefix + "." + image.Name + ".spv";
+    std::error_code EC;
+    raw_fd_ostream out(fileName, EC, sys::fs::OF_None);
+    if (EC) {
+      report_fatal_error("Can't open the SPIR-V entry point image " + fileName +
+                         ": " + EC.message());
+    }
+    support::endian::Writer W(out, support::little);
+    for (uint32_t word : image.Words) {
+      W.write<uint32_t>(word);
+    }
+  }
+}
+
+// Encode the body of every function except the meta one into words, in the
+// same order as the AsmPrinter would, and free each MachineFunction as soon as
+// it's encoded. The AsmPrinter then gets an empty MachineFunction for each,
+// and takes the words from the type registry.
+static void encodeAndFreeFunctions(Module &M, MachineModuleInfo &MMI,
+                                   SPIRVTypeRegistry &TR) {
+  std::vector<uint32_t> words;
+  unsigned idBound = 1;
+  BEGIN_FOR_MF_IN_MODULE_EXCEPT_FIRST(M, MMI)
+  TimeTraceScope trace("Encode Function", MF->getName());
+  for (const MachineBasicBlock &MBB : *MF) {
+    for (const MachineInstr &MI : MBB) {
+      // The AsmPrinter doesn't emit these either
+      if (!MI.isMetaInstruction()) {
+        encodeSPIRVInstr(MI, words, idBound);
+      }
+    }
+  }
+  MMI.deleteMachineFunctionFor(*F);
+  ++NumFunctionsEncoded;
+  END_FOR_MF_IN_MODULE()
+  TR.setEncodedFunctions(std::move(words), idBound);
+}
+
 // Add a meta function containing all OpType, OpConstant etc.
 // Extract all OpType, OpConst etc. into this meta block
 // Number registers globally, including references to global OpType etc.
@@ -871,42 +2202,138 @@ bool SPIRVGlobalTypesAndRegNum::runOnModule(Module &M) {
 
   addHeaderOps(M, MIRBuilder, reqs, ST);
 
+  // Each entry point's binary starts with the requirements of the header
+  SPIRVTypeRegistry &TR = *ST.getSPIRVTypeRegistry();
+  const bool buildImages =
+      !EntryPointImagesPrefix.empty() || TR.shouldBuildEntryPointImages();
+  SPIRVRequirementHandler headerReqs;
+  if (buildImages) {
+    headerReqs = reqs;
+  }
+
+  // The alias tables live as long as the pass, so allocate them together
+  SpecificBumpPtrAllocator<LocalToGlobalRegTable> aliasMapAllocator;
   SmallVector<LocalToGlobalRegTable *, 8> aliasMaps;
   BEGIN_FOR_MF_IN_MODULE(M, MMI)
-  aliasMaps.push_back(new LocalToGlobalRegTable());
+  aliasMaps.push_back(new (aliasMapAllocator.Allocate())
+                          LocalToGlobalRegTable());
   END_FOR_MF_IN_MODULE()
 
-  addOpExtInstImports(M, MMI, MIRBuilder, aliasMaps);
+  // Walk every instruction once to collect the requirements of the module and
+  // the instructions each of the following phases needs to process. Collecting
+  // requirements here doesn't materialize function-local OpCapability instrs,
+  // so capabilities added later, such as the Linkage capability for files with
+  // no OpEntryPoints, still get deduplicated with all the others.
+  const auto TII = static_cast<const SPIRVInstrInfo *>(&MIRBuilder.getTII());
+  ModuleWorklists worklists(aliasMaps.size());
+  {
+    PhaseTimer T("classify", "Classify Instructions", M);
+    classifyInstructions(M, MMI, *TII, worklists, reqs);
+  }
+
+  SmallVector<EntryPointSubset, 4> entryPointSubsets;
+  if (buildImages) {
+    PhaseTimer T("entry-point-subsets", "Collect Entry Point Subsets", M);
+    collectEntryPointSubsets(worklists, headerReqs, entryPointSubsets);
+  }
+
+  // The hash-consing tables used to deduplicate instructions in each meta
+  // block, and the global IDs they define
+  GlobalSections sections;
+  MetaInstrTables &dedupTables = sections.dedupTables;
+
+  {
+    PhaseTimer T("hoist-types", "Hoist Types and Constants", M);
+    addOpExtInstImports(MIRBuilder, aliasMaps, worklists, sections);
+
+    // Extract type instructions to the top MetaMBB and keep track of which
+    // local VRegs the correspond to with functionLocalAliasTables
+    hoistInstrsToMetablock(MIRBuilder, aliasMaps, worklists, sections);
 
-  // Extract type instructions to the top MetaMBB and keep track of which local
-  // VRegs the correspond to with functionLocalAliasTables
-  hoistInstrsToMetablock(M, MMI, MIRBuilder, aliasMaps, reqs);
+    addMissingExternalFunctionDeclarations(MIRBuilder, sections);
+  }
 
-  addMissingExternalFunctionDeclarations(MIRBuilder);
+  {
+    PhaseTimer T("hoist-vars", "Hoist Global Variables", M);
+    hoistGlobalOpVariables(MIRBuilder, aliasMaps, worklists, sections);
 
-  hoistGlobalOpVariables(M, MMI, MIRBuilder, aliasMaps);
+    // Remove any hoisted globals which are no longer referred to
+    removeDeadGlobals(MIRBuilder, aliasMaps, worklists, sections);
+  }
 
-  // Number registers from 0 onwards, and fix references to global OpType etc
-  numberRegistersGlobally(M, MMI, MIRBuilder, aliasMaps);
+  {
+    PhaseTimer T("number-regs", "Number Registers Globally", M);
+    // Number registers from 0 onwards, and fix references to global OpType etc
+    numberRegistersGlobally(M, MMI, aliasMaps, sections);
+  }
 
-  // Extract instructions like OpName, OpEntryPoint, OpDecorate etc.
-  // which all rely on globally numbered registers, which they forward-reference
-  extractInstructionsWithGlobalRegsToMetablock(M, MMI, MIRBuilder);
+  {
+    PhaseTimer T("extract-globals", "Extract Instrs With Global Regs", M);
+    // Extract instructions like OpName, OpEntryPoint, OpDecorate etc. which
+    // all rely on globally numbered registers, which they forward-reference
+    extractInstructionsWithGlobalRegsToMetablock(MIRBuilder, worklists,
+                                                 dedupTables);
 
-  addEntryPointLinkageInterfaces(M, MMI, MIRBuilder);
+    addEntryPointLinkageInterfaces(MIRBuilder, worklists, ST);
 
-  assignFunctionCallIDs(M, MMI, MIRBuilder);
+    assignFunctionCallIDs(MIRBuilder, worklists);
+  }
 
-  // If there are no entry points, we need the Linkage capability
-  if (MIRBuilder.getMF().getBlockNumbered(MB_EntryPoints)->empty()) {
-    reqs.addCapability(Capability::Linkage);
+  if (UseDecorationGroups) {
+    PhaseTimer T("group-decorations", "Group Repeated Decorations", M);
+    groupRepeatedDecorations(MIRBuilder, sections);
   }
 
-  addGlobalRequirements(reqs, ST, MIRBuilder);
+  unsigned idBound = 0;
+  {
+    PhaseTimer T("compact-ids", "Compact Register IDs", M);
+    // Make the global IDs dense now no more instructions refer to new ones
+    idBound = compactRegisterIDs(M, MMI);
+  }
+
+  {
+    PhaseTimer T("requirements", "Add Global Requirements", M);
+    // If there are no entry points, we need the Linkage capability
+    if (MIRBuilder.getMF().getBlockNumbered(MB_EntryPoints)->empty()) {
+      reqs.addCapability(Capability::Linkage);
+    }
+
+    addGlobalRequirements(reqs, ST, MIRBuilder);
+  }
+
+  NumWordsDeduped += dedupTables.numWordsDeduped;
+  if (!SizeReportFile.empty()) {
+    writeSizeReport(M, MMI, idBound, dedupTables.numWordsDeduped);
+  }
+
+  if (VerifyModule) {
+    PhaseTimer T("verify", "Verify Module", M);
+    verifyModule(M, MMI, *TII, reqs, ST, idBound);
+  }
+
+  if (buildImages) {
+    PhaseTimer T("entry-point-images", "Build Entry Point Images", M);
+    auto images = buildEntryPointImages(MIRBuilder.getMF(), entryPointSubsets,
+                                        worklists, ST, idBound);
+    if (!EntryPointImagesPrefix.empty()) {
+      writeEntryPointImages(images);
+    }
+    if (TR.shouldBuildEntryPointImages()) {
+      TR.setEntryPointImages(std::move(images));
+    }
+  }
+
+  // The module-wide type IDs are no longer needed by any pass
+  BEGIN_FOR_MF_IN_MODULE(M, MMI)
+  const auto &FuncST = static_cast<const SPIRVSubtarget &>(MF->getSubtarget());
+  FuncST.getSPIRVTypeRegistry()->resetModuleTypes();
+  END_FOR_MF_IN_MODULE()
 
-  // Cleanup
-  for (const auto d : aliasMaps) {
-    delete d;
+  // Nothing refers to the function-local MIR any more, so it can be replaced
+  // by its much smaller encoding
+  if (EncodeFunctions) {
+    PhaseTimer T("encode", "Encode and Free Functions", M);
+    encodeAndFreeFunctions(M, MMI, TR);
   }
   return false;
 }
@@ -917,6 +2344,6 @@ INITIALIZE_PASS(SPIRVGlobalTypesAndRegNum, DEBUG_TYPE,
 
 char SPIRVGlobalTypesAndRegNum::ID = 0;
 
-ModulePass *llvm::createSPIRVGlobalTypesAndRegNumPass() {
-  return new SPIRVGlobalTypesAndRegNum();
+ModulePass *llvm::createSPIRVGlobalTypesAndRegNumPass(bool EncodeFunctions) {
+  return new SPIRVGlobalTypesAndRegNum(EncodeFunctions);
 }
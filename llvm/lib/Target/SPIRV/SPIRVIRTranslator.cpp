@@ -16,16 +16,33 @@
 #include "SPIRVIRTranslator.h"
 
 #include "SPIRV.h"
+#include "SPIRVExtInsts.h"
+#include "SPIRVOpenCLBIFs.h"
 #include "SPIRVStrings.h"
 #include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
 
+#include "llvm/ADT/StringSwitch.h"
 #include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
 #include "llvm/IR/Attributes.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Target/TargetIntrinsicInfo.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "spirv-irtranslator"
+
+static cl::opt<bool> InferAlignment(
+    "spirv-infer-alignment", cl::Hidden, cl::init(false),
+    cl::desc("Raise the Aligned memory operand of memory accesses to the known "
+             "alignment of their pointer and the DataLayout's ABI alignment"));
+
 static bool buildOpConstantNull(const Constant &C, Register Reg,
                                 MachineIRBuilder &MIRBuilder,
                                 SPIRVTypeRegistry *TR) {
@@ -74,27 +91,71 @@ bool SPIRVIRTranslator::buildGlobalValue(Register Reg, const GlobalValue *GV,
   auto globalVar = GV->getParent()->getGlobalVariable(globalIdent);
 
   Register initVReg = 0;
-  if (globalVar->hasInitializer()) {
+  if (globalVar->hasInitializer() &&
+      InitializedGlobals.insert(globalVar).second) {
     Constant *InitVal = globalVar->getInitializer();
     initVReg = getOrCreateVReg(*InitVal);
   }
 
   auto addrSpace = GV->getAddressSpace();
   auto storage = TR->addressSpaceToStorageClass(addrSpace);
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
 
+  // Shaders can't link, their external variables being given by the host
   if (GV->getLinkage() == GlobalValue::LinkageTypes::ExternalLinkage &&
-      storage != StorageClass::Function) {
+      storage != StorageClass::Function &&
+      canUseDecoration(Decoration::LinkageAttributes, ST)) {
     auto MIB = MIRBuilder.buildInstr(SPIRV::OpDecorate)
                    .addUse(Reg)
                    .addImm(Decoration::LinkageAttributes);
     addStringImm(globalIdent, MIB);
-    MIB.addImm(LinkageType::Export);
+    MIB.addImm(globalVar->isDeclaration() ? LinkageType::Import
+                                          : LinkageType::Export);
+  }
+
+  // SPIR-V 1.4 allows NonWritable on Function storage class variables, such
+  // as the constant globals SPIRVPromoteConstantGlobals didn't move. Other
+  // OpVariables of these storage classes can't take it.
+  if (globalVar->isConstant() && storage == StorageClass::Function &&
+      ST.getTargetSPIRVVersion() >= 0x10400 &&
+      canUseDecoration(Decoration::NonWritable, ST)) {
+    MIRBuilder.buildInstr(SPIRV::OpDecorate)
+        .addUse(Reg)
+        .addImm(Decoration::NonWritable);
+  }
+
+  // The structs buffers hold are Blocks, their layout decorations being added
+  // with their pointer type
+  const MachineInstr *pointeeType =
+      MIRBuilder.getMRI()->getVRegDef(resType->getOperand(2).getReg());
+  if ((storage == StorageClass::StorageBuffer ||
+       storage == StorageClass::Uniform ||
+       storage == StorageClass::PushConstant) &&
+      pointeeType && pointeeType->getOpcode() == SPIRV::OpTypeStruct) {
+    MIRBuilder.buildInstr(SPIRV::OpDecorate)
+        .addUse(resType->getOperand(2).getReg())
+        .addImm(Decoration::Block);
+  }
+  // The buffers bound to kernel arguments by SPIRVShaderEntryPoints
+  if (auto *node = globalVar->getMetadata("spirv.descriptor_binding")) {
+    auto getOperand = [&](unsigned i) {
+      return mdconst::extract<ConstantInt>(node->getOperand(i))->getZExtValue();
+    };
+    MIRBuilder.buildInstr(SPIRV::OpDecorate)
+        .addUse(Reg)
+        .addImm(Decoration::DescriptorSet)
+        .addImm(getOperand(0));
+    MIRBuilder.buildInstr(SPIRV::OpDecorate)
+        .addUse(Reg)
+        .addImm(Decoration::Binding)
+        .addImm(getOperand(1));
   }
 
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpVariable)
                  .addDef(Reg)
                  .addUse(TR->getSPIRVTypeID(resType))
                  .addImm(storage);
+  TR->addGlobalVariable(MIB, globalVar);
   if (initVReg != 0) {
     MIB.addUse(initVReg);
     // TODO should this check be here?
@@ -147,24 +208,656 @@ bool SPIRVIRTranslator::translateBitCast(const User &U,
   return IRTranslator::translateCast(TargetOpcode::G_BITCAST, U, MIRBuilder);
 }
 
+// Translate to a single OpSwitch rather than the default chains of compares and
+// branches, so drivers can pick a jump table or a binary search themselves.
+// The case targets are MBB references until SPIRVBlockLabeler gives them IDs.
+bool SPIRVIRTranslator::translateSwitch(const User &U,
+                                        MachineIRBuilder &MIRBuilder) {
+  const SwitchInst &SI = cast<SwitchInst>(U);
+  const unsigned bitWidth =
+      SI.getCondition()->getType()->getIntegerBitWidth();
+  // OpSwitch only takes integers, and literals of up to 64 bits
+  if (bitWidth == 1 || bitWidth > 64) {
+    return IRTranslator::translateSwitch(U, MIRBuilder);
+  }
+
+  MachineBasicBlock &SwitchMBB = MIRBuilder.getMBB();
+  SmallPtrSet<const BasicBlock *, 8> succs;
+  auto getSuccMBB = [&](const BasicBlock *BB) {
+    MachineBasicBlock *succMBB = &getMBB(*BB);
+    if (succs.insert(BB).second) {
+      SwitchMBB.addSuccessor(succMBB);
+      addMachineCFGPred({SI.getParent(), BB}, &SwitchMBB);
+    }
+    return succMBB;
+  };
+
+  Register sel = getOrCreateVReg(*SI.getCondition());
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpSwitch)
+                 .addUse(sel)
+                 .addMBB(getSuccMBB(SI.getDefaultDest()));
+  // Each case value is a literal as wide as the selector, lowest-order word
+  // first, followed by its target
+  for (const auto &Case : SI.cases()) {
+    uint64_t val = Case.getCaseValue()->getZExtValue();
+    MIB.addImm(val & 0xffffffff);
+    if (bitWidth > 32) {
+      MIB.addImm(val >> 32);
+    }
+    MIB.addMBB(getSuccMBB(Case.getCaseSuccessor()));
+  }
+  return true;
+}
+
+bool SPIRVIRTranslator::translateSpecConstant(const CallInst &CI) {
+  const auto specId = cast<ConstantInt>(CI.getArgOperand(0))->getZExtValue();
+  const Value *defaultVal = CI.getArgOperand(1);
+  APInt imm;
+  if (const auto *CInt = dyn_cast<ConstantInt>(defaultVal)) {
+    imm = CInt->getValue();
+  } else if (const auto *CFP = dyn_cast<ConstantFP>(defaultVal)) {
+    imm = CFP->getValueAPF().bitcastToAPInt();
+  } else {
+    errs() << CI << "\n";
+    report_fatal_error("Specialization constants need a scalar constant "
+                       "default value");
+  }
+
+  // Booleans have their own opcodes, and other scalars take the default value
+  // as 32 bit literal words, lowest-order word first
+  unsigned opcode = SPIRV::OpSpecConstant;
+  SmallVector<uint32_t, 2> literals;
+  if (imm.getBitWidth() == 1) {
+    opcode = imm.isOneValue() ? SPIRV::OpSpecConstantTrue
+                              : SPIRV::OpSpecConstantFalse;
+  } else if (imm.getBitWidth() <= 32) {
+    literals.push_back(imm.getZExtValue());
+  } else if (imm.getBitWidth() == 64) {
+    literals.push_back(imm.getZExtValue() & 0xffffffff);
+    literals.push_back(imm.getZExtValue() >> 32);
+  } else {
+    errs() << CI << "\n";
+    report_fatal_error("Unsupported specialization constant bitwidth");
+  }
+
+  // Build it alongside the other constants, as it gets hoisted with them
+  Register res = getOrCreateVRegs(CI)[0];
+  SPIRVType *type = TR->getSPIRVTypeForVReg(res);
+  auto MIB = EntryBuilder->buildInstr(opcode)
+                 .addDef(res)
+                 .addUse(TR->getSPIRVTypeID(type));
+  for (const auto literal : literals) {
+    MIB.addImm(literal);
+  }
+  EntryBuilder->buildInstr(SPIRV::OpDecorate)
+      .addUse(res)
+      .addImm(Decoration::SpecId)
+      .addImm(specId);
+  return TR->constrainRegOperands(MIB);
+}
+
+// Get the fast-math flags the function's attributes give all its float math,
+// e.g. from -cl-fast-relaxed-math, even where the instructions don't have them.
+static uint16_t getFnFastMathFlags(const Function &F) {
+  auto isSet = [&F](StringRef attr) {
+    return F.getFnAttribute(attr).getValueAsString() == "true";
+  };
+  uint16_t flags = 0;
+  if (isSet("no-nans-fp-math")) {
+    flags |= MachineInstr::FmNoNans;
+  }
+  if (isSet("no-infs-fp-math")) {
+    flags |= MachineInstr::FmNoInfs;
+  }
+  if (isSet("no-signed-zeros-fp-math")) {
+    flags |= MachineInstr::FmNsz;
+  }
+  if (isSet("unsafe-fp-math")) {
+    flags |= MachineInstr::FmArcp | MachineInstr::FmReassoc |
+             MachineInstr::FmContract | MachineInstr::FmAfn;
+  }
+  return flags;
+}
+
+// llvm.fmuladd may be fused or not, so rather than the separately rounded
+// multiply and add the generic translation gives, use OpenCL.std's fast mad if
+// the call may be contracted, or fma otherwise. GLSL.std.450's Fma already
+// leaves fusing to the implementation.
+bool SPIRVIRTranslator::translateFMulAdd(const CallInst &CI,
+                                         MachineIRBuilder &MIRBuilder) {
+  const auto &MF = MIRBuilder.getMF();
+  const auto &ST = MF.getSubtarget<SPIRVSubtarget>();
+  uint16_t flags = MachineInstr::copyFlagsFromInstruction(CI) |
+                   getFnFastMathFlags(*CI.getFunction());
+  const bool canContract = (flags & MachineInstr::FmContract) ||
+                           MF.getTarget().Options.AllowFPOpFusion ==
+                               FPOpFusion::Fast;
+
+  ExtInstSet set = ExtInstSet::GLSL_std_450;
+  uint32_t extInst = GLSL_std_450::Fma;
+  if (ST.canUseExtInstSet(ExtInstSet::OpenCL_std)) {
+    set = ExtInstSet::OpenCL_std;
+    extInst = canContract ? OpenCL_std::mad : OpenCL_std::fma;
+  }
+
+  Register res = getOrCreateVReg(CI);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpExtInst)
+                 .addDef(res)
+                 .addUse(TR->getSPIRVTypeID(TR->getSPIRVTypeForVReg(res)))
+                 .addImm(static_cast<uint32_t>(set))
+                 .addImm(extInst);
+  for (const auto &arg : CI.arg_operands()) {
+    MIB.addUse(getOrCreateVReg(*arg));
+  }
+  MIB->setFlags(flags);
+  return TR->constrainRegOperands(MIB);
+}
+
+// Whether translateBitIntrinsic handles the intrinsic. The legalizer has no
+// rules for these, so they'd otherwise be left as G_BSWAP or G_INTRINSIC.
+static bool isBitIntrinsic(Intrinsic::ID ID) {
+  switch (ID) {
+  case Intrinsic::bswap:
+  case Intrinsic::bitreverse:
+  case Intrinsic::fshl:
+  case Intrinsic::fshr:
+  case Intrinsic::uadd_sat:
+  case Intrinsic::sadd_sat:
+  case Intrinsic::usub_sat:
+  case Intrinsic::ssub_sat:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Use OpBitReverse, or OpenCL.std's rotate and saturating add and sub, where
+// the environment has them. Anything else is expanded to generic shifts, masks
+// and min/max, with byte swaps done as a shuffle of the bytes in kernels, as
+// they can always use vectors of i8.
+bool SPIRVIRTranslator::translateBitIntrinsic(const CallInst &CI,
+                                              Intrinsic::ID ID,
+                                              MachineIRBuilder &MIRBuilder) {
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  const bool hasOpenCLStd = ST.canUseExtInstSet(ExtInstSet::OpenCL_std);
+  Type *ty = CI.getType();
+  const unsigned width = ty->getScalarSizeInBits();
+  Register res = getOrCreateVReg(CI);
+  SmallVector<Register, 3> args;
+  for (const auto &arg : CI.arg_operands()) {
+    args.push_back(getOrCreateVReg(*arg));
+  }
+
+  auto createVReg = [&](Type *vregTy) {
+    Register vreg =
+        MRI->createGenericVirtualRegister(getLLTForType(*vregTy, *DL));
+    TR->assignTypeToVReg(vregTy, vreg, MIRBuilder);
+    return vreg;
+  };
+  auto getConstant = [&](const APInt &val) {
+    return getOrCreateVReg(*ConstantInt::get(ty, val));
+  };
+  auto getIntConstant = [&](uint64_t val) {
+    return getConstant(APInt(width, val));
+  };
+  // Build a generic op on two values of the call's type, defining dst if given
+  auto build = [&](unsigned opcode, Register lhs, Register rhs,
+                   Register dst = Register()) {
+    if (!dst.isValid()) {
+      dst = createVReg(ty);
+    }
+    MIRBuilder.buildInstr(opcode).addDef(dst).addUse(lhs).addUse(rhs);
+    return dst;
+  };
+  auto buildExtInst = [&](uint32_t extInst, ArrayRef<Register> ops) {
+    auto MIB = MIRBuilder.buildInstr(SPIRV::OpExtInst)
+                   .addDef(res)
+                   .addUse(TR->getSPIRVTypeID(TR->getSPIRVTypeForVReg(res)))
+                   .addImm(static_cast<uint32_t>(ExtInstSet::OpenCL_std))
+                   .addImm(extInst);
+    for (Register op : ops) {
+      MIB.addUse(op);
+    }
+    return TR->constrainRegOperands(MIB);
+  };
+  auto buildByteSwap = [&](Register src, Register dst) {
+    const unsigned numBytes = width / 8;
+    const unsigned numElts =
+        ty->isVectorTy() ? cast<VectorType>(ty)->getNumElements() : 1;
+    const unsigned totalBytes = numBytes * numElts;
+    if (ST.isKernel() && (totalBytes == 2 || totalBytes == 4 ||
+                          totalBytes == 8 || totalBytes == 16)) {
+      // Bitcast to a vector of bytes, reverse them within each element, and
+      // bitcast back
+      Type *bytesTy = VectorType::get(Type::getInt8Ty(CI.getContext()),
+                                      totalBytes);
+      Register bytes = createVReg(bytesTy);
+      Register bytesTyID = TR->getSPIRVTypeID(TR->getSPIRVTypeForVReg(bytes));
+      Register swapped = createVReg(bytesTy);
+      auto MIB = MIRBuilder.buildInstr(SPIRV::OpBitcast)
+                     .addDef(bytes)
+                     .addUse(bytesTyID)
+                     .addUse(src);
+      TR->constrainRegOperands(MIB);
+      MIB = MIRBuilder.buildInstr(SPIRV::OpVectorShuffle)
+                .addDef(swapped)
+                .addUse(bytesTyID)
+                .addUse(bytes)
+                .addUse(bytes);
+      for (unsigned elt = 0; elt < numElts; ++elt) {
+        for (unsigned byte = 0; byte < numBytes; ++byte) {
+          MIB.addImm(elt * numBytes + numBytes - 1 - byte);
+        }
+      }
+      TR->constrainRegOperands(MIB);
+      MIB = MIRBuilder.buildInstr(SPIRV::OpBitcast)
+                .addDef(dst)
+                .addUse(TR->getSPIRVTypeID(TR->getSPIRVTypeForVReg(dst)))
+                .addUse(swapped);
+      return TR->constrainRegOperands(MIB);
+    }
+    // Shift each byte to its mirrored position and mask off its neighbours,
+    // which the outermost bytes don't need
+    Register result;
+    for (unsigned byte = 0; byte < numBytes; ++byte) {
+      const unsigned dstByte = numBytes - 1 - byte;
+      Register moved;
+      if (byte < dstByte) {
+        moved = build(TargetOpcode::G_SHL, src,
+                      getIntConstant(8 * (dstByte - byte)));
+      } else {
+        moved = build(TargetOpcode::G_LSHR, src,
+                      getIntConstant(8 * (byte - dstByte)));
+      }
+      if (byte != 0 && byte != numBytes - 1) {
+        moved = build(TargetOpcode::G_AND, moved,
+                      getConstant(APInt(width, 0xff).shl(8 * dstByte)));
+      }
+      if (!result.isValid()) {
+        result = moved;
+      } else {
+        result = build(TargetOpcode::G_OR, result, moved,
+                       byte == numBytes - 1 ? dst : Register());
+      }
+    }
+    return true;
+  };
+
+  switch (ID) {
+  case Intrinsic::bswap:
+    return buildByteSwap(args[0], res);
+  case Intrinsic::bitreverse: {
+    if (ST.canUseCapability(Capability::Shader)) {
+      auto MIB = MIRBuilder.buildInstr(SPIRV::OpBitReverse)
+                     .addDef(res)
+                     .addUse(TR->getSPIRVTypeID(TR->getSPIRVTypeForVReg(res)))
+                     .addUse(args[0]);
+      return TR->constrainRegOperands(MIB);
+    }
+    // Reverse the bytes, then swap the nibbles, bit pairs and bits of each
+    Register val = args[0];
+    if (width > 8) {
+      val = createVReg(ty);
+      if (!buildByteSwap(args[0], val)) {
+        return false;
+      }
+    }
+    const std::pair<unsigned, uint8_t> steps[] = {
+        {4, 0x0f}, {2, 0x33}, {1, 0x55}};
+    for (const auto &step : steps) {
+      Register amount = getIntConstant(step.first);
+      Register mask =
+          getConstant(APInt::getSplat(width, APInt(8, step.second)));
+      Register hi = build(TargetOpcode::G_AND,
+                          build(TargetOpcode::G_LSHR, val, amount), mask);
+      Register lo = build(TargetOpcode::G_SHL,
+                          build(TargetOpcode::G_AND, val, mask), amount);
+      val = build(TargetOpcode::G_OR, hi, lo,
+                  step.first == 1 ? res : Register());
+    }
+    return true;
+  }
+  case Intrinsic::fshl:
+  case Intrinsic::fshr: {
+    const bool isLeft = ID == Intrinsic::fshl;
+    if (hasOpenCLStd && CI.getArgOperand(0) == CI.getArgOperand(1)) {
+      // Funnel shifting a value with itself is a rotate. The amount is taken
+      // modulo the width, so rotating right is rotating left by its negation
+      Register amount = args[2];
+      if (!isLeft) {
+        amount = build(TargetOpcode::G_SUB, getIntConstant(0), amount);
+      }
+      return buildExtInst(OpenCL_std::rotate, {args[0], amount});
+    }
+    // Shift the other input by one first, so neither shift is by the whole
+    // width when the amount is 0 modulo the width. All SPIR-V integer widths
+    // are powers of 2, so the inverted amount is (width - 1) ^ amount.
+    Register widthMask = getIntConstant(width - 1);
+    Register one = getIntConstant(1);
+    Register amount = build(TargetOpcode::G_AND, args[2], widthMask);
+    Register invAmount = build(TargetOpcode::G_XOR, amount, widthMask);
+    Register hi, lo;
+    if (isLeft) {
+      hi = build(TargetOpcode::G_SHL, args[0], amount);
+      lo = build(TargetOpcode::G_LSHR,
+                 build(TargetOpcode::G_LSHR, args[1], one), invAmount);
+    } else {
+      hi = build(TargetOpcode::G_SHL,
+                 build(TargetOpcode::G_SHL, args[0], one), invAmount);
+      lo = build(TargetOpcode::G_LSHR, args[1], amount);
+    }
+    build(TargetOpcode::G_OR, hi, lo, res);
+    return true;
+  }
+  case Intrinsic::uadd_sat:
+    if (hasOpenCLStd) {
+      return buildExtInst(OpenCL_std::u_add_sat, {args[0], args[1]});
+    }
+    // a + umin(b, ~a)
+    build(TargetOpcode::G_ADD, args[0],
+          build(TargetOpcode::G_UMIN, args[1],
+                build(TargetOpcode::G_XOR, args[0],
+                      getConstant(APInt::getAllOnesValue(width)))),
+          res);
+    return true;
+  case Intrinsic::usub_sat:
+    if (hasOpenCLStd) {
+      return buildExtInst(OpenCL_std::u_sub_sat, {args[0], args[1]});
+    }
+    // umax(a, b) - b
+    build(TargetOpcode::G_SUB, build(TargetOpcode::G_UMAX, args[0], args[1]),
+          args[1], res);
+    return true;
+  case Intrinsic::sadd_sat:
+  case Intrinsic::ssub_sat: {
+    const bool isAdd = ID == Intrinsic::sadd_sat;
+    if (hasOpenCLStd) {
+      return buildExtInst(isAdd ? OpenCL_std::s_add_sat : OpenCL_std::s_sub_sat,
+                          {args[0], args[1]});
+    }
+    // Clamp a to the range where adding or subtracting b can't overflow:
+    // [MIN - smin(b, 0), MAX - smax(b, 0)] for add, and
+    // [MIN + smax(b, 0), MAX + smin(b, 0)] for sub
+    Register zero = getIntConstant(0);
+    Register negPart = build(TargetOpcode::G_SMIN, args[1], zero);
+    Register posPart = build(TargetOpcode::G_SMAX, args[1], zero);
+    const unsigned boundOp = isAdd ? TargetOpcode::G_SUB : TargetOpcode::G_ADD;
+    Register lo = build(boundOp, getConstant(APInt::getSignedMinValue(width)),
+                        isAdd ? negPart : posPart);
+    Register hi = build(boundOp, getConstant(APInt::getSignedMaxValue(width)),
+                        isAdd ? posPart : negPart);
+    Register clamped = build(TargetOpcode::G_SMIN,
+                             build(TargetOpcode::G_SMAX, args[0], lo), hi);
+    build(isAdd ? TargetOpcode::G_ADD : TargetOpcode::G_SUB, clamped, args[1],
+          res);
+    return true;
+  }
+  default:
+    llvm_unreachable("Not a bit manipulation intrinsic");
+  }
+}
+
+// Get the device enqueue instruction for a function clang calls with a block,
+// or 0 for any other function.
+static unsigned getBlockEnqueueOpcode(StringRef name) {
+  if (name.startswith("__enqueue_kernel_")) {
+    return SPIRV::OpEnqueueKernel;
+  }
+  return StringSwitch<unsigned>(name)
+      .Case("__get_kernel_work_group_size_impl",
+            SPIRV::OpGetKernelWorkGroupSize)
+      .Case("__get_kernel_preferred_work_group_size_multiple_impl",
+            SPIRV::OpGetKernelPreferredWorkGroupSizeMultiple)
+      .Case("__get_kernel_max_sub_group_size_for_ndrange_impl",
+            SPIRV::OpGetKernelNDrangeMaxSubGroupSize)
+      .Case("__get_kernel_sub_group_count_for_ndrange_impl",
+            SPIRV::OpGetKernelNDrangeSubGroupCount)
+      .Default(0);
+}
+
+// A block argument is a cast of the block's invoke kernel, which must be given
+// to the instruction as a function rather than a value, followed by a pointer
+// to the block literal, whose size and alignment come from the alloca or
+// global holding it. The enqueue functions take the queue, flags and ndrange
+// first, then any events, and the local sizes last for the _varargs variants,
+// as a count and an array.
+bool SPIRVIRTranslator::translateBlockEnqueue(const CallInst &CI,
+                                              unsigned opcode,
+                                              MachineIRBuilder &MIRBuilder) {
+  using namespace SPIRV;
+  const StringRef name = CI.getCalledFunction()->getName();
+  LLVMContext &Ctx = CI.getContext();
+  const auto MRI = MIRBuilder.getMRI();
+  auto getI32VReg = [&](uint64_t val) {
+    return getOrCreateVReg(*ConstantInt::get(Type::getInt32Ty(Ctx), val));
+  };
+  auto buildTypedInstr = [&](unsigned instrOpcode, const Type *type) {
+    SPIRVType *spirvType = TR->getOrCreateSPIRVType(type, *EntryBuilder);
+    Register res = MRI->createVirtualRegister(&IDRegClass);
+    TR->assignSPIRVTypeToVReg(spirvType, res, MIRBuilder);
+    return MIRBuilder.buildInstr(instrOpcode)
+        .addDef(res)
+        .addUse(TR->getSPIRVTypeID(spirvType));
+  };
+
+  const bool isEnqueue = opcode == OpEnqueueKernel;
+  const bool hasEvents = isEnqueue && name.contains("_events");
+  const bool hasNDRange = isEnqueue ||
+                          opcode == OpGetKernelNDrangeMaxSubGroupSize ||
+                          opcode == OpGetKernelNDrangeSubGroupCount;
+  const unsigned invokeIdx = isEnqueue ? (hasEvents ? 6 : 3) : hasNDRange;
+  if (CI.getNumArgOperands() < invokeIdx + 2) {
+    report_fatal_error("Wrong number of args for " + name);
+  }
+  const auto *invoke =
+      dyn_cast<Function>(CI.getArgOperand(invokeIdx)->stripPointerCasts());
+  if (!invoke) {
+    report_fatal_error("The block of " + name + " must have a known invoke");
+  }
+  const Value *block = CI.getArgOperand(invokeIdx + 1);
+  const Value *literal = block->stripPointerCasts();
+  Type *literalTy = nullptr;
+  unsigned literalAlign = 0;
+  if (const auto *AI = dyn_cast<AllocaInst>(literal)) {
+    literalTy = AI->getAllocatedType();
+    literalAlign = AI->getAlignment();
+  } else if (const auto *GV = dyn_cast<GlobalVariable>(literal)) {
+    literalTy = GV->getValueType();
+    literalAlign = GV->getAlignment();
+  } else {
+    report_fatal_error("The block of " + name + " must have a known literal");
+  }
+  if (literalAlign == 0) {
+    literalAlign = DL->getABITypeAlignment(literalTy);
+  }
+
+  // The ndrange_t is passed by pointer, but the instructions take its value
+  Register ndrange;
+  if (hasNDRange) {
+    const Value *ndrangePtr = CI.getArgOperand(isEnqueue ? 2 : 0);
+    Type *ndrangeTy = ndrangePtr->getType()->getPointerElementType();
+    auto loadMIB = buildTypedInstr(OpLoad, ndrangeTy)
+                       .addUse(getOrCreateVReg(*ndrangePtr));
+    TR->constrainRegOperands(loadMIB);
+    ndrange = loadMIB->getOperand(0).getReg();
+  }
+
+  // Load each local size from the array the last argument points to
+  SmallVector<Register, 3> localSizes;
+  if (isEnqueue && name.endswith("_varargs")) {
+    const auto *numSizes =
+        dyn_cast<ConstantInt>(CI.getArgOperand(invokeIdx + 2));
+    if (!numSizes) {
+      report_fatal_error("The local sizes of " + name + " must be constant");
+    }
+    const Value *sizes = CI.getArgOperand(invokeIdx + 3);
+    Type *sizePtrTy = sizes->getType();
+    Register sizesVReg = getOrCreateVReg(*sizes);
+    for (uint64_t i = 0; i < numSizes->getZExtValue(); ++i) {
+      Register sizePtr = sizesVReg;
+      if (i > 0) {
+        auto ptrMIB = buildTypedInstr(OpInBoundsPtrAccessChain, sizePtrTy)
+                          .addUse(sizesVReg)
+                          .addUse(getI32VReg(i));
+        TR->constrainRegOperands(ptrMIB);
+        sizePtr = ptrMIB->getOperand(0).getReg();
+      }
+      auto loadMIB = buildTypedInstr(OpLoad, sizePtrTy->getPointerElementType())
+                         .addUse(sizePtr);
+      TR->constrainRegOperands(loadMIB);
+      localSizes.push_back(loadMIB->getOperand(0).getReg());
+    }
+  }
+
+  Register res = getOrCreateVReg(CI);
+  auto MIB = MIRBuilder.buildInstr(opcode).addDef(res).addUse(
+      TR->getSPIRVTypeID(TR->getSPIRVTypeForVReg(res)));
+  if (isEnqueue) {
+    MIB.addUse(getOrCreateVReg(*CI.getArgOperand(0)))
+        .addUse(getOrCreateVReg(*CI.getArgOperand(1)))
+        .addUse(ndrange);
+    if (hasEvents) {
+      for (unsigned i = 3; i < 6; ++i) {
+        MIB.addUse(getOrCreateVReg(*CI.getArgOperand(i)));
+      }
+    } else {
+      // No events to wait for or return, as null generic clk_event_t pointers
+      StructType *eventTy = CI.getModule()->getTypeByName("opencl.clk_event_t");
+      if (!eventTy) {
+        eventTy = StructType::create(Ctx, "opencl.clk_event_t");
+      }
+      const auto genericAS =
+          TR->StorageClassToAddressSpace(StorageClass::Generic);
+      auto *eventPtrTy =
+          PointerType::get(PointerType::get(eventTy, 0), genericAS);
+      Register noEvents =
+          getOrCreateVReg(*ConstantPointerNull::get(eventPtrTy));
+      MIB.addUse(getI32VReg(0)).addUse(noEvents).addUse(noEvents);
+    }
+  } else if (hasNDRange) {
+    MIB.addUse(ndrange);
+  }
+  MIB.addGlobalAddress(invoke)
+      .addUse(getOrCreateVReg(*block))
+      .addUse(getI32VReg(DL->getTypeAllocSize(literalTy)))
+      .addUse(getI32VReg(literalAlign));
+
+  for (Register localSize : localSizes) {
+    MIB.addUse(localSize);
+  }
+  return TR->constrainRegOperands(MIB);
+}
+
+static bool isSPIRVInstrIntrinsic(Intrinsic::ID ID) {
+  switch (ID) {
+  case Intrinsic::spirv_builtin:
+  case Intrinsic::spirv_control_barrier:
+  case Intrinsic::spirv_memory_barrier:
+  case Intrinsic::spirv_atomic:
+  case Intrinsic::spirv_atomic_cmpxchg:
+  case Intrinsic::spirv_group:
+  case Intrinsic::spirv_image_read:
+  case Intrinsic::spirv_image_write:
+  case Intrinsic::spirv_image_sample_lod:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool SPIRVIRTranslator::translateSPIRVIntrinsic(const CallInst &CI,
+                                                Intrinsic::ID ID,
+                                                MachineIRBuilder &MIRBuilder) {
+  SmallVector<Register, 8> args;
+  for (const Value *arg : CI.arg_operands()) {
+    args.push_back(getOrCreateVRegs(*arg)[0]);
+  }
+  Register ret;
+  if (!CI.getType()->isVoidTy()) {
+    ret = getOrCreateVRegs(CI)[0];
+  }
+  return generateSPIRVIntrinsicCall(ID, MIRBuilder, ret, args, TR);
+}
+
+bool SPIRVIRTranslator::translateCall(const User &U,
+                                      MachineIRBuilder &MIRBuilder) {
+  const auto *F = cast<CallInst>(U).getCalledFunction();
+  if (F && F->getIntrinsicID() == Intrinsic::spirv_spec_constant) {
+    return translateSpecConstant(cast<CallInst>(U));
+  }
+  if (F && isSPIRVInstrIntrinsic(F->getIntrinsicID())) {
+    return translateSPIRVIntrinsic(cast<CallInst>(U), F->getIntrinsicID(),
+                                   MIRBuilder);
+  }
+  if (F && F->getIntrinsicID() == Intrinsic::fmuladd) {
+    return translateFMulAdd(cast<CallInst>(U), MIRBuilder);
+  }
+  if (F && isBitIntrinsic(F->getIntrinsicID())) {
+    return translateBitIntrinsic(cast<CallInst>(U), F->getIntrinsicID(),
+                                 MIRBuilder);
+  }
+  if (unsigned opcode = F ? getBlockEnqueueOpcode(F->getName()) : 0) {
+    return translateBlockEnqueue(cast<CallInst>(U), opcode, MIRBuilder);
+  }
+
+  if (!IRTranslator::translateCall(U, MIRBuilder))
+    return false;
+
+  // Builtin calls such as OpenCL math functions are lowered straight to an
+  // OpExtInst, so give it the call's fast-math flags like the generic instrs
+  // built for intrinsics get, plus any the function's attributes imply. The
+  // selector turns these into decorations.
+  const auto &CI = cast<CallInst>(U);
+  if (isa<FPMathOperator>(CI) && !CI.getType()->isVoidTy()) {
+    Register res = getOrCreateVRegs(CI)[0];
+    MachineInstr *def = MIRBuilder.getMRI()->getVRegDef(res);
+    if (def && def->getOpcode() == SPIRV::OpExtInst) {
+      def->setFlags(MachineInstr::copyFlagsFromInstruction(CI) |
+                    getFnFastMathFlags(*CI.getFunction()));
+    }
+  }
+  return true;
+}
+
+// SPIR-V 1.4 added UniformId, whose scope makes explicit that the values
+// SPIRVAnnotateUniformValues marks are only uniform across the subgroup
+void SPIRVIRTranslator::buildUniformDecoration(Register reg) {
+  const auto &ST = EntryBuilder->getMF().getSubtarget<SPIRVSubtarget>();
+  if (ST.getTargetSPIRVVersion() < 0x10400) {
+    EntryBuilder->buildInstr(SPIRV::OpDecorate)
+        .addUse(reg)
+        .addImm(Decoration::Uniform);
+    return;
+  }
+  Register scope = getOrCreateVReg(*ConstantInt::get(
+      Type::getInt32Ty(MF->getFunction().getContext()), Scope::Subgroup));
+  EntryBuilder->buildInstr(SPIRV::OpDecorateId)
+      .addUse(reg)
+      .addImm(Decoration::UniformId)
+      .addUse(scope);
+}
+
 ArrayRef<Register> SPIRVIRTranslator::getOrCreateVRegs(const Value &Val) {
   Type *Ty = Val.getType();
-
-  // Ensure type definition appears before uses. This is especially important
-  // for values like OpConstant which get hoisted alongside types later
-  TR->getOrCreateSPIRVType(Ty, *EntryBuilder);
   const auto MRI = EntryBuilder->getMRI();
 
   ArrayRef<Register> ResVRegs;
 
+  // Values seen before already have their vregs and types, so the registry is
+  // only consulted when creating new ones
   auto VRegsIt = VMap.findVRegs(Val);
   if (VRegsIt != VMap.vregs_end()) {
     ResVRegs = *VRegsIt->second;
   } else if (Ty->isVoidTy()) {
+    TR->getOrCreateSPIRVType(Ty, *EntryBuilder);
     ResVRegs = *VMap.getVRegs(Val);
   } else {
     assert(Ty->isSized() && "Cannot create unsized vreg");
 
+    // Ensure type definition appears before uses. This is especially important
+    // for values like OpConstant which get hoisted alongside types later
+    TR->getOrCreateSPIRVType(Ty, *EntryBuilder);
+
     // Create entry for this type.
     auto *NewVRegs = VMap.getVRegs(Val);
     auto llt = getLLTForType(*Ty, *DL);
@@ -180,9 +873,19 @@ ArrayRef<Register> SPIRVIRTranslator::getOrCreateVRegs(const Value &Val) {
     // Add type and name metadata
     if (!TR->hasSPIRVTypeForVReg(ResVRegs[0])) {
       TR->assignTypeToVReg(Ty, ResVRegs[0], *EntryBuilder);
-      if (Val.hasName()) {
+      // Unoptimized code only names the variables, arguments and globals,
+      // as the names of the temporaries are most of the module
+      if (Val.hasName() && (EnableOpts || !isa<Instruction>(Val) ||
+                            isa<AllocaInst>(Val))) {
         buildOpName(ResVRegs[0], Val.getName(), *EntryBuilder);
       }
+      const auto *I = dyn_cast<Instruction>(&Val);
+      if (I && I->getMetadata("spirv.uniform")) {
+        buildUniformDecoration(ResVRegs[0]);
+      }
+      if (isa<AllocaInst>(Val) || isa<GlobalVariable>(Val)) {
+        buildMemoryAttributeDecorations(ResVRegs[0], Val);
+      }
     }
   }
   // Make sure there's always at least 1 placeholder offset to avoid crashes
@@ -193,31 +896,181 @@ ArrayRef<Register> SPIRVIRTranslator::getOrCreateVRegs(const Value &Val) {
   return ResVRegs;
 }
 
+// Get the annotation strings of the llvm.var.annotation calls on the alloca
+static void getVarAnnotations(const AllocaInst &AI,
+                              SmallVectorImpl<StringRef> &annotations) {
+  SmallVector<const Value *, 4> worklist{&AI};
+  while (!worklist.empty()) {
+    const Value *V = worklist.pop_back_val();
+    for (const User *U : V->users()) {
+      if (isa<BitCastInst>(U)) {
+        worklist.push_back(U);
+      } else if (auto *II = dyn_cast<IntrinsicInst>(U)) {
+        StringRef str;
+        if (II->getIntrinsicID() == Intrinsic::var_annotation &&
+            getConstantStringInfo(II->getArgOperand(1), str)) {
+          annotations.push_back(str);
+        }
+      }
+    }
+  }
+}
+
+void SPIRVIRTranslator::buildMemoryAttributeDecorations(Register reg,
+                                                        const Value &var) {
+  const auto &ST = EntryBuilder->getMF().getSubtarget<SPIRVSubtarget>();
+  if (!ST.canUseCapability(Capability::FPGAMemoryAttributesINTEL)) {
+    return;
+  }
+  SmallVector<StringRef, 2> annotations;
+  if (const auto *AI = dyn_cast<AllocaInst>(&var)) {
+    getVarAnnotations(*AI, annotations);
+  } else {
+    auto it = GlobalAnnotations.find(cast<GlobalVariable>(&var));
+    if (it != GlobalAnnotations.end()) {
+      annotations.append(it->second.begin(), it->second.end());
+    }
+  }
+
+  auto decorate = [&](Decoration::Decoration dec) {
+    return EntryBuilder->buildInstr(SPIRV::OpDecorate).addUse(reg).addImm(dec);
+  };
+  for (StringRef annotation : annotations) {
+    // The attributes are a list of {name} or {name:value}
+    while (annotation.consume_front("{")) {
+      StringRef attr;
+      std::tie(attr, annotation) = annotation.split('}');
+      StringRef name, value;
+      std::tie(name, value) = attr.split(':');
+      uint32_t num = 0;
+      const bool isNum = !value.getAsInteger(10, num);
+      if (name == "register") {
+        decorate(Decoration::RegisterINTEL);
+      } else if (name == "memory") {
+        auto MIB = decorate(Decoration::MemoryINTEL);
+        addStringImm(value, MIB);
+      } else if (name == "numbanks" && isNum) {
+        decorate(Decoration::NumbanksINTEL).addImm(num);
+      } else if (name == "bankwidth" && isNum) {
+        decorate(Decoration::BankwidthINTEL).addImm(num);
+      } else if (name == "private_copies" && isNum) {
+        decorate(Decoration::MaxPrivateCopiesINTEL).addImm(num);
+      } else if (name == "max_replicates" && isNum) {
+        decorate(Decoration::MaxReplicatesINTEL).addImm(num);
+      } else if (name == "force_pow2_depth" && isNum) {
+        decorate(Decoration::ForcePow2DepthINTEL).addImm(num);
+      } else if (name == "singlepump" || (name == "pump" && num == 1)) {
+        decorate(Decoration::SinglepumpINTEL);
+      } else if (name == "doublepump" || (name == "pump" && num == 2)) {
+        decorate(Decoration::DoublepumpINTEL);
+      } else if (name == "simple_dual_port") {
+        decorate(Decoration::SimpleDualPortINTEL);
+      } else if (name == "merge") {
+        // {merge:name:direction}
+        StringRef key, direction;
+        std::tie(key, direction) = value.split(':');
+        auto MIB = decorate(Decoration::MergeINTEL);
+        addStringImm(key, MIB);
+        addStringImm(direction, MIB);
+      } else if (name == "bank_bits") {
+        SmallVector<StringRef, 4> bits;
+        value.split(bits, ',');
+        auto MIB = decorate(Decoration::BankBitsINTEL);
+        for (StringRef bit : bits) {
+          uint32_t bitNum = 0;
+          bit.trim().getAsInteger(10, bitNum);
+          MIB.addImm(bitNum);
+        }
+      }
+    }
+  }
+}
+
+bool SPIRVIRTranslator::doInitialization(Module &M) {
+  InitializedGlobals.clear();
+
+  // Each entry of llvm.global.annotations annotates a global with a string
+  GlobalAnnotations.clear();
+  const GlobalVariable *annotations =
+      M.getNamedGlobal("llvm.global.annotations");
+  if (annotations && annotations->hasInitializer()) {
+    if (auto *CA = dyn_cast<ConstantArray>(annotations->getInitializer())) {
+      for (const Use &op : CA->operands()) {
+        auto *entry = dyn_cast<ConstantStruct>(op);
+        StringRef str;
+        if (!entry || entry->getNumOperands() < 2 ||
+            !getConstantStringInfo(entry->getOperand(1), str)) {
+          continue;
+        }
+        if (auto *GV = dyn_cast<GlobalVariable>(
+                entry->getOperand(0)->stripPointerCasts())) {
+          GlobalAnnotations[GV].push_back(str);
+        }
+      }
+    }
+  }
+
+  // The type registry outlives the module when a pipeline is run again on
+  // other modules, or when the last compilation stopped early, so start from
+  // an empty one.
+  if (auto *MMI = getAnalysisIfAvailable<MachineModuleInfo>()) {
+    const auto &TM = static_cast<const SPIRVTargetMachine &>(MMI->getTarget());
+    SPIRVTypeRegistry *registry = TM.getSubtargetImpl()->getSPIRVTypeRegistry();
+    registry->reset();
+    registry->resetModuleTypes();
+  }
+  return IRTranslator::doInitialization(M);
+}
+
 bool SPIRVIRTranslator::runOnMachineFunction(MachineFunction &MF) {
   // Initialize the type registry
   const auto *ST = static_cast<const SPIRVSubtarget *>(&MF.getSubtarget());
   this->TR = ST->getSPIRVTypeRegistry();
+  TR->startFunction(MF);
 
-  // Run the regular IRTranslator
-  bool success = IRTranslator::runOnMachineFunction(MF);
+  // Run the regular IRTranslator. The types of the vregs it creates are kept
+  // until instruction selection.
+  return IRTranslator::runOnMachineFunction(MF);
+}
 
-  // Clean up
-  TR->reset();
-  return success;
+// Whether the GEP GEPInst only selects into the pointer its only user, another
+// GEP, starts at. That user then builds a single access chain for both.
+static bool isFoldedIntoUserGEP(const User &GEPInst) {
+  if (!isa<GetElementPtrInst>(GEPInst) || !GEPInst.hasOneUse() ||
+      GEPInst.isUsedByMetadata() || GEPInst.getType()->isVectorTy())
+    return false;
+  auto userGEP = dyn_cast<GetElementPtrInst>(*GEPInst.user_begin());
+  if (!userGEP || userGEP->getPointerOperand() != &GEPInst ||
+      userGEP->getNumIndices() < 2)
+    return false;
+  auto firstIndex = dyn_cast<ConstantInt>(userGEP->getOperand(1));
+  return firstIndex && firstIndex->isZero();
 }
 
 bool SPIRVIRTranslator::translateGetElementPtr(const User &U,
                                                MachineIRBuilder &MIRBuilder) {
   using namespace SPIRV;
 
+  if (isFoldedIntoUserGEP(U))
+    return true;
+
+  // Collect the GEPs folded into this one, innermost first. Each one after the
+  // first skips its leading zero index, which selects the pointee of the last.
+  SmallVector<const User *, 4> chain = {&U};
+  while (isFoldedIntoUserGEP(*cast<User>(chain.back()->getOperand(0))))
+    chain.push_back(cast<User>(chain.back()->getOperand(0)));
+  std::reverse(chain.begin(), chain.end());
+  const User &innerGEP = *chain.front();
+
   // Determine which AccessChain opcode to use
-  bool isPtrAccess = false;
-  if (auto firstIndex = dyn_cast<ConstantInt>(U.getOperand(1))) {
+  bool isPtrAccess = true;
+  if (auto firstIndex = dyn_cast<ConstantInt>(innerGEP.getOperand(1))) {
     isPtrAccess = !firstIndex->isZero();
   }
-  bool isInBounds = false;
-  if (auto gepOp = dyn_cast<GEPOperator>(&U)) {
-    isInBounds = gepOp->isInBounds();
+  bool isInBounds = true;
+  for (const User *GEP : chain) {
+    auto gepOp = dyn_cast<GEPOperator>(GEP);
+    isInBounds &= gepOp && gepOp->isInBounds();
   }
   unsigned opCode = isInBounds ? OpInBoundsAccessChain : OpAccessChain;
   if (isPtrAccess) {
@@ -226,7 +1079,7 @@ bool SPIRVIRTranslator::translateGetElementPtr(const User &U,
 
   // Build the AccessChain, but don't insert until all operands have been
   // assigned vregs
-  Register baseVReg = getOrCreateVReg(*U.getOperand(0));
+  Register baseVReg = getOrCreateVReg(*innerGEP.getOperand(0));
   Register resVReg = getOrCreateVReg(U);
   SPIRVType *resType = TR->getSPIRVTypeForVReg(resVReg);
   auto MIB = MIRBuilder.buildInstrNoInsert(opCode)
@@ -234,10 +1087,15 @@ bool SPIRVIRTranslator::translateGetElementPtr(const User &U,
                  .addUse(TR->getSPIRVTypeID(resType))
                  .addUse(baseVReg);
 
-  // Create VRegs (and maybe G_CONSTANTs) for all operands
-  const unsigned int numOperands = U.getNumOperands();
-  for (unsigned int i = isPtrAccess ? 1 : 2; i < numOperands; ++i) {
-    MIB.addUse(getOrCreateVReg(*U.getOperand(i)));
+  // Create VRegs (and maybe G_CONSTANTs) for all operands. Constant indices
+  // share the vreg of the same constant used elsewhere in the function.
+  for (const User *GEP : chain) {
+    bool isInner = GEP == &innerGEP;
+    const unsigned int numOperands = GEP->getNumOperands();
+    for (unsigned int i = (isInner && isPtrAccess) ? 1 : 2; i < numOperands;
+         ++i) {
+      MIB.addUse(getOrCreateVReg(*GEP->getOperand(i)));
+    }
   }
 
   // Insert the AccessChain after operand definitions
@@ -310,12 +1168,34 @@ static unsigned int getMetadataUInt(const MDNode *mdNode, unsigned int opIndex,
   }
 }
 
+// Get the alignment to declare for an access to accessTy through ptr, given the
+// alignment stated in the IR (0 if unknown). If -spirv-infer-alignment is set,
+// this is raised to the ABI alignment of accessTy and the known alignment of
+// ptr.
+static unsigned int getAccessAlignment(unsigned int alignment, const Value *ptr,
+                                       Type *accessTy, const DataLayout &DL) {
+  if (InferAlignment) {
+    if (accessTy && accessTy->isSized()) {
+      alignment = std::max(alignment, DL.getABITypeAlignment(accessTy));
+    }
+    alignment = std::max(alignment, ptr->getPointerAlignment(DL));
+  }
+  return alignment;
+}
+
+// Add the memory operand mask and its literals for the given access. The mask is
+// omitted if it's None, unless alwaysAdd is set.
 static void addMemoryOperands(const Instruction *val, unsigned int alignment,
-                              bool isVolatile, MachineInstrBuilder &MIB) {
+                              bool isVolatile, MachineInstrBuilder &MIB,
+                              bool alwaysAdd = false,
+                              bool isNonPrivate = false) {
   uint32_t spvMemOp = MemoryOperand::None;
   if (isVolatile) {
     spvMemOp |= MemoryOperand::Volatile;
   }
+  if (isNonPrivate) {
+    spvMemOp |= MemoryOperand::NonPrivatePointerKHR;
+  }
   if (getMetadataUInt(val->getMetadata("nontemporal"), 0) == 1) {
     spvMemOp |= MemoryOperand::Nontemporal;
   }
@@ -323,7 +1203,7 @@ static void addMemoryOperands(const Instruction *val, unsigned int alignment,
     spvMemOp |= MemoryOperand::Aligned;
   }
 
-  if (spvMemOp != MemoryOperand::None) {
+  if (spvMemOp != MemoryOperand::None || alwaysAdd) {
     MIB.addImm(spvMemOp);
     if (spvMemOp & MemoryOperand::Aligned) {
       MIB.addImm(alignment);
@@ -331,6 +1211,33 @@ static void addMemoryOperands(const Instruction *val, unsigned int alignment,
   }
 }
 
+// Report a memory access without a known alignment, which the consumer has to
+// assume may be unaligned, and so may split into narrower accesses.
+static void emitMissingAlignmentRemark(OptimizationRemarkEmitter &ORE,
+                                       const Instruction &I) {
+  ORE.emit([&]() {
+    return OptimizationRemarkMissed(DEBUG_TYPE, "MissingAlignment", &I)
+           << "memory access without an Aligned memory operand in kernel "
+           << ore::NV("Kernel", I.getFunction()->getName());
+  });
+}
+
+// Whether a load or store through ptr must be ordered by the atomics and
+// barriers of other invocations. With the Vulkan memory model, only accesses
+// with the NonPrivatePointer memory operand are, so it is added to the
+// accesses to memory other invocations can see.
+static bool isNonPrivateAccess(const Value *ptr, const SPIRVSubtarget &ST,
+                               SPIRVTypeRegistry &TR) {
+  if (!ST.usesVulkanMemoryModel()) {
+    return false;
+  }
+  unsigned addrSpace = ptr->getType()->getPointerAddressSpace();
+  return addrSpace == TR.StorageClassToAddressSpace(StorageClass::Workgroup) ||
+         addrSpace ==
+             TR.StorageClassToAddressSpace(StorageClass::CrossWorkgroup) ||
+         addrSpace == TR.StorageClassToAddressSpace(StorageClass::Generic);
+}
+
 bool SPIRVIRTranslator::translateLoad(const User &U,
                                       MachineIRBuilder &MIRBuilder) {
   auto Load = dyn_cast<LoadInst>(&U);
@@ -341,7 +1248,14 @@ bool SPIRVIRTranslator::translateLoad(const User &U,
                  .addDef(ResVReg)
                  .addUse(TR->getSPIRVTypeID(ResVRegType))
                  .addUse(Ptr);
-  addMemoryOperands(Load, Load->getAlignment(), Load->isVolatile(), MIB);
+  unsigned int align = getAccessAlignment(
+      Load->getAlignment(), Load->getPointerOperand(), Load->getType(), *DL);
+  if (align == 0) {
+    emitMissingAlignmentRemark(*ORE, *Load);
+  }
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  addMemoryOperands(Load, align, Load->isVolatile(), MIB, false,
+                    isNonPrivateAccess(Load->getPointerOperand(), ST, *TR));
   return TR->constrainRegOperands(MIB);
 }
 
@@ -351,7 +1265,143 @@ bool SPIRVIRTranslator::translateStore(const User &U,
   auto Ptr = getOrCreateVReg(*Store->getPointerOperand());
   auto Obj = getOrCreateVReg(*Store->getValueOperand());
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpStore).addUse(Ptr).addUse(Obj);
-  addMemoryOperands(Store, Store->getAlignment(), Store->isVolatile(), MIB);
+  unsigned int align = getAccessAlignment(
+      Store->getAlignment(), Store->getPointerOperand(),
+      Store->getValueOperand()->getType(), *DL);
+  if (align == 0) {
+    emitMissingAlignmentRemark(*ORE, *Store);
+  }
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  addMemoryOperands(Store, align, Store->isVolatile(), MIB, false,
+                    isNonPrivateAccess(Store->getPointerOperand(), ST, *TR));
+  return TR->constrainRegOperands(MIB);
+}
+
+Register SPIRVIRTranslator::buildMemSetSource(const MemSetInst &MSI,
+                                              unsigned int alignment) {
+  const auto *val = dyn_cast<ConstantInt>(MSI.getValue());
+  const auto *len = dyn_cast<ConstantInt>(MSI.getLength());
+  if (!val || !len) {
+    return Register(0);
+  }
+  // Fill an i8 array of the copied length with the value. Non-zero fills are
+  // built with OpConstantComposite, which must fit in 65535 words, and single
+  // element arrays aren't translated as composites.
+  LLVMContext &Ctx = MSI.getContext();
+  uint64_t numBytes = len->getZExtValue();
+  auto *arrTy = ArrayType::get(val->getType(), numBytes);
+  Constant *init = nullptr;
+  if (val->isZero()) {
+    init = ConstantAggregateZero::get(arrTy);
+  } else if (numBytes < 2 || numBytes > UINT16_MAX - 3) {
+    return Register(0);
+  } else {
+    SmallVector<uint8_t, 64> bytes(numBytes, val->getZExtValue());
+    init = ConstantDataArray::get(Ctx, bytes);
+  }
+  Register initVReg = getOrCreateVReg(*init);
+
+  auto uniformConst = TR->StorageClassToAddressSpace(
+      StorageClass::UniformConstant);
+  auto *ptrTy = PointerType::get(arrTy, uniformConst);
+  Register varVReg = EntryBuilder->getMRI()->createGenericVirtualRegister(
+      getLLTForType(*ptrTy, *DL));
+  SPIRVType *varTy = TR->assignTypeToVReg(ptrTy, varVReg, *EntryBuilder);
+  auto MIB = EntryBuilder->buildInstr(SPIRV::OpVariable)
+                 .addDef(varVReg)
+                 .addUse(TR->getSPIRVTypeID(varTy))
+                 .addImm(StorageClass::UniformConstant)
+                 .addUse(initVReg);
+  if (!TR->constrainRegOperands(MIB)) {
+    return Register(0);
+  }
+  // Match the target's alignment, as a single memory operand covers both
+  if (alignment > 1) {
+    EntryBuilder->buildInstr(SPIRV::OpDecorate)
+        .addUse(varVReg)
+        .addImm(Decoration::Alignment)
+        .addImm(alignment);
+  }
+  return varVReg;
+}
+
+// Add the memory operands of OpCopyMemory or OpCopyMemorySized. Before SPIR-V
+// 1.4 a single mask covers both pointers. Otherwise the target's mask must be
+// present for the source's to follow it. A memset's source is our own aligned
+// constant, so it needs no operands of its own.
+static void addCopyMemoryOperands(const MemIntrinsic &MemI,
+                                  unsigned int dstAlign, unsigned int srcAlign,
+                                  const SPIRVSubtarget &ST,
+                                  MachineInstrBuilder &MIB) {
+  const bool isTransfer = isa<MemTransferInst>(MemI);
+  if (ST.canUseSourceMemoryOperands()) {
+    addMemoryOperands(&MemI, dstAlign, MemI.isVolatile(), MIB, isTransfer);
+    if (isTransfer) {
+      addMemoryOperands(&MemI, srcAlign, MemI.isVolatile(), MIB);
+    }
+  } else {
+    unsigned int align = isTransfer ? std::min(dstAlign, srcAlign) : dstAlign;
+    addMemoryOperands(&MemI, align, MemI.isVolatile(), MIB);
+  }
+}
+
+bool SPIRVIRTranslator::translateMemFunc(const CallInst &CI,
+                                         MachineIRBuilder &MIRBuilder,
+                                         Intrinsic::ID ID) {
+  // If the source is undef, then just emit a nop
+  if (isa<UndefValue>(CI.getArgOperand(1))) {
+    return true;
+  }
+
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  const auto &MemI = cast<MemIntrinsic>(CI);
+  unsigned int dstAlign = getAccessAlignment(MemI.getDestAlignment(),
+                                             MemI.getRawDest(), nullptr, *DL);
+
+  // Copy whole objects between pointers to the same type with OpCopyMemory,
+  // which needs no size or Addresses capability
+  const auto *MCI = dyn_cast<MemCpyInst>(&MemI);
+  if (MCI && isSPIRVWholeObjectCopy(*MCI, *DL)) {
+    unsigned int srcAlign = getAccessAlignment(
+        MCI->getSourceAlignment(), MCI->getRawSource(), nullptr, *DL);
+    const Value *dst = MCI->getRawDest()->stripPointerCastsSameRepresentation();
+    const Value *src =
+        MCI->getRawSource()->stripPointerCastsSameRepresentation();
+    auto MIB = MIRBuilder.buildInstr(SPIRV::OpCopyMemory)
+                   .addUse(getOrCreateVReg(*dst))
+                   .addUse(getOrCreateVReg(*src));
+    addCopyMemoryOperands(MemI, dstAlign, srcAlign, ST, MIB);
+    return TR->constrainRegOperands(MIB);
+  }
+
+  // Otherwise use OpCopyMemorySized, which needs physical addressing. Its
+  // copies may not overlap, so memmove is expanded into a loop beforehand, as
+  // are memsets which can't be built from a constant (see
+  // SPIRVLowerMemIntrinsics.cpp).
+  if (ID == Intrinsic::memmove ||
+      !ST.canUseCapability(Capability::Addresses)) {
+    return IRTranslator::translateMemFunc(CI, MIRBuilder, ID);
+  }
+
+  Register src;
+  unsigned int srcAlign = 0;
+  if (const auto *MSI = dyn_cast<MemSetInst>(&MemI)) {
+    src = buildMemSetSource(*MSI, dstAlign);
+    if (!src.isValid()) {
+      return IRTranslator::translateMemFunc(CI, MIRBuilder, ID);
+    }
+  } else {
+    const auto &MTI = cast<MemTransferInst>(MemI);
+    src = getOrCreateVReg(*MTI.getRawSource());
+    srcAlign = getAccessAlignment(MTI.getSourceAlignment(), MTI.getRawSource(),
+                                  nullptr, *DL);
+  }
+
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpCopyMemorySized)
+                 .addUse(getOrCreateVReg(*MemI.getRawDest()))
+                 .addUse(src)
+                 .addUse(getOrCreateVReg(*MemI.getLength()));
+  addCopyMemoryOperands(MemI, dstAlign, srcAlign, ST, MIB);
   return TR->constrainRegOperands(MIB);
 }
 
@@ -17,18 +17,39 @@
 #define LLVM_LIB_TARGET_SPIRV_SPIRVIRTRANSLATOR_H
 
 #include "SPIRVTypeRegistry.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/CodeGen/GlobalISel/IRTranslator.h"
 
 namespace llvm {
+class MemSetInst;
+
 class SPIRVIRTranslator : public IRTranslator {
 private:
   // Use to insert and keep track of SPIR-V type data
   SPIRVTypeRegistry *TR;
 
+  // Global variables whose initializers were translated by an earlier function
+  // in the module. Later functions only declare the OpVariable, which
+  // SPIRVGlobalTypesAndRegNum merges with the first one through the global
+  // variable the registry records for both, so large constant tables aren't
+  // rebuilt in every function using them.
+  SmallPtrSet<const GlobalVariable *, 8> InitializedGlobals;
+
+  // The llvm.global.annotations strings of each annotated global variable
+  DenseMap<const GlobalVariable *, SmallVector<StringRef, 1>> GlobalAnnotations;
+
   // Generate OpVariables with linkage data and their initializers if necessary
   bool buildGlobalValue(Register Reg, const GlobalValue *GV,
                         MachineIRBuilder &MIRBuilder);
 
+  // Decorate the result of an instruction with spirv.uniform metadata
+  void buildUniformDecoration(Register reg);
+
+  // Decorate the OpVariable of an alloca or global variable with the FPGA
+  // memory attributes of its clang annotations, e.g. {numbanks:4}
+  void buildMemoryAttributeDecorations(Register reg, const Value &var);
+
 protected:
   // Whenever a VReg gets created, it needs type info, and also name debug info
   // emitted before the LLVM IR value gets discarded
@@ -68,6 +89,9 @@ protected:
   // Override to ensure an explicit Bitcast is always emitted
   bool translateBitCast(const User &U, MachineIRBuilder &MIRBuilder) override;
 
+  // Translate to OpSwitch instead of chains of compares and branches
+  bool translateSwitch(const User &U, MachineIRBuilder &MIRBuilder) override;
+
   // Override to define a single struct reg rather than 2 separate regs
   bool translateOverflowIntrinsic(const CallInst &CI, unsigned Op,
                                   MachineIRBuilder &MIRBuilder) override;
@@ -76,7 +100,45 @@ protected:
   bool translateAtomicCmpXchg(const User &U,
                               MachineIRBuilder &MIRBuilder) override;
 
+  // Translate memcpy and memset to OpCopyMemorySized where possible
+  bool translateMemFunc(const CallInst &CI, MachineIRBuilder &MIRBuilder,
+                        Intrinsic::ID ID) override;
+
+  // Build a UniformConstant OpVariable filled with the given memset's value,
+  // to copy from. Return 0 if the value or length isn't constant.
+  Register buildMemSetSource(const MemSetInst &MSI, unsigned int alignment);
+
+  // Translate llvm.spirv.spec.constant to an OpSpecConstant (or the boolean
+  // OpSpecConstantTrue/False) decorated with its SpecId
+  bool translateSpecConstant(const CallInst &CI);
+
+  // Translate the other llvm.spirv.* intrinsics, which stand for SPIR-V
+  // instructions, through generateSPIRVIntrinsicCall
+  bool translateSPIRVIntrinsic(const CallInst &CI, Intrinsic::ID ID,
+                               MachineIRBuilder &MIRBuilder);
+
+  // Translate llvm.fmuladd to an OpenCL.std mad or fma, or GLSL.std.450 Fma
+  bool translateFMulAdd(const CallInst &CI, MachineIRBuilder &MIRBuilder);
+
+  // Translate llvm.bswap, llvm.bitreverse, the funnel shifts and the
+  // saturating add and sub intrinsics to native instructions or expansions
+  bool translateBitIntrinsic(const CallInst &CI, Intrinsic::ID ID,
+                             MachineIRBuilder &MIRBuilder);
+
+  // Translate the functions clang calls for enqueue_kernel and the kernel
+  // queries taking a block to the device enqueue instruction with the given
+  // opcode, invoking the block's kernel function on its literal
+  bool translateBlockEnqueue(const CallInst &CI, unsigned opcode,
+                             MachineIRBuilder &MIRBuilder);
+
+  // Override to translate SPIR-V intrinsics, and to keep the fast-math flags
+  // of builtin calls lowered to OpExtInst
+  bool translateCall(const User &U, MachineIRBuilder &MIRBuilder) override;
+
 public:
+  // Forget any state left from the last module the pipeline compiled
+  bool doInitialization(Module &M) override;
+
   // Initialize the type registry before calling parent function
   bool runOnMachineFunction(MachineFunction &MF) override;
 };
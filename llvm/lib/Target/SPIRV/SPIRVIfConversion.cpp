@@ -0,0 +1,226 @@
+//===-- SPIRVIfConversion.cpp - Convert diamonds to selects ----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Replace small if/else diamonds and if-then triangles with their speculated
+// instructions and selects of the values they merge, which become OpSelect.
+// On SIMT devices, the work-items of a subgroup taking different sides of a
+// branch run both sides one after the other with the others masked off, so
+// running both unconditionally with no branch is cheaper when they're short.
+//
+// A side is converted when its only predecessor is the branching block, it
+// branches straight to the merge block, and all its instructions can be
+// speculated without touching memory. Both sides together, plus the selects,
+// must take at most SPIRVSubtarget::getIfConversionThreshold instructions, and
+// the merged values must be scalar integers or floats so OpSelect takes them
+// in every SPIR-V version and addressing model.
+//
+// Blocks are visited in post order, and a merge block left with a single
+// predecessor is folded into it, so nested diamonds are converted from the
+// innermost out.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-if-conversion"
+
+STATISTIC(NumDiamonds, "Number of if/else diamonds converted to selects");
+STATISTIC(NumTriangles, "Number of if-then triangles converted to selects");
+
+namespace {
+class SPIRVIfConversion : public FunctionPass {
+public:
+  static char ID;
+  SPIRVIfConversion() : FunctionPass(ID) {
+    initializeSPIRVIfConversionPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+// Get the block the given side of BB's branch unconditionally branches to, if
+// BB is its only predecessor.
+static BasicBlock *getSideMerge(BasicBlock *side, const BasicBlock *BB) {
+  if (side->getSinglePredecessor() != BB || side->hasAddressTaken()) {
+    return nullptr;
+  }
+  auto *BI = dyn_cast<BranchInst>(side->getTerminator());
+  return BI && BI->isUnconditional() ? BI->getSuccessor(0) : nullptr;
+}
+
+// Get the number of instructions speculating the side would add, or None if
+// some of them can't be speculated.
+static Optional<unsigned> getSpeculationCost(const BasicBlock *side) {
+  unsigned cost = 0;
+  for (const Instruction &I : *side) {
+    if (I.isTerminator() || isa<DbgInfoIntrinsic>(I)) {
+      continue;
+    }
+    if (isa<PHINode>(I) || I.mayReadOrWriteMemory() ||
+        !isSafeToSpeculativelyExecute(&I)) {
+      return None;
+    }
+    ++cost;
+  }
+  return cost;
+}
+
+// Convert the diamond or triangle BB starts, if it's small enough. Return the
+// merge block if BB now branches to it unconditionally, or nullptr.
+static BasicBlock *convertBranch(BasicBlock &BB, unsigned threshold) {
+  auto *BI = dyn_cast<BranchInst>(BB.getTerminator());
+  if (!BI || !BI->isConditional()) {
+    return nullptr;
+  }
+  BasicBlock *trueBB = BI->getSuccessor(0);
+  BasicBlock *falseBB = BI->getSuccessor(1);
+  if (trueBB == falseBB) {
+    return nullptr;
+  }
+  BasicBlock *trueMerge = getSideMerge(trueBB, &BB);
+  BasicBlock *falseMerge = getSideMerge(falseBB, &BB);
+
+  // The sides to speculate, where BB itself stands for a missing side
+  BasicBlock *merge;
+  BasicBlock *trueSide = &BB, *falseSide = &BB;
+  if (trueMerge && trueMerge == falseMerge) {
+    merge = trueMerge;
+    trueSide = trueBB;
+    falseSide = falseBB;
+  } else if (trueMerge == falseBB) {
+    merge = falseBB;
+    trueSide = trueBB;
+  } else if (falseMerge == trueBB) {
+    merge = trueBB;
+    falseSide = falseBB;
+  } else {
+    return nullptr;
+  }
+  if (merge == &BB) {
+    return nullptr;
+  }
+
+  unsigned cost = 0;
+  for (BasicBlock *side : {trueSide, falseSide}) {
+    if (side == &BB) {
+      continue;
+    }
+    auto sideCost = getSpeculationCost(side);
+    if (!sideCost) {
+      return nullptr;
+    }
+    cost += *sideCost;
+  }
+  for (PHINode &PN : merge->phis()) {
+    Type *ty = PN.getType();
+    if (!ty->isIntegerTy() && !ty->isFloatingPointTy()) {
+      return nullptr;
+    }
+    if (PN.getIncomingValueForBlock(trueSide) !=
+        PN.getIncomingValueForBlock(falseSide)) {
+      ++cost;
+    }
+  }
+  if (cost > threshold) {
+    return nullptr;
+  }
+
+  // Hoist the sides above the branch, then select the values they merge
+  SmallVector<BasicBlock *, 2> sides;
+  for (BasicBlock *side : {trueSide, falseSide}) {
+    if (side != &BB) {
+      BB.getInstList().splice(BI->getIterator(), side->getInstList(),
+                              side->begin(),
+                              side->getTerminator()->getIterator());
+      sides.push_back(side);
+    }
+  }
+  IRBuilder<> B(BI);
+  for (PHINode &PN : merge->phis()) {
+    Value *trueVal = PN.getIncomingValueForBlock(trueSide);
+    Value *falseVal = PN.getIncomingValueForBlock(falseSide);
+    Value *merged = trueVal == falseVal
+                        ? trueVal
+                        : B.CreateSelect(BI->getCondition(), trueVal, falseVal,
+                                         PN.getName() + ".sel");
+    for (BasicBlock *side : sides) {
+      PN.removeIncomingValue(side, false);
+    }
+    if (PN.getBasicBlockIndex(&BB) >= 0) {
+      PN.setIncomingValueForBlock(&BB, merged);
+    } else {
+      PN.addIncoming(merged, &BB);
+    }
+  }
+  B.CreateBr(merge);
+  BI->eraseFromParent();
+  for (BasicBlock *side : sides) {
+    side->getTerminator()->eraseFromParent();
+    side->eraseFromParent();
+  }
+  if (sides.size() == 2) {
+    ++NumDiamonds;
+  } else {
+    ++NumTriangles;
+  }
+  return merge;
+}
+
+bool SPIRVIfConversion::runOnFunction(Function &F) {
+  if (skipFunction(F)) {
+    return false;
+  }
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  const unsigned threshold = TM.getSubtargetImpl()->getIfConversionThreshold();
+  if (threshold == 0) {
+    return false;
+  }
+
+  // The sides and merge block of each block come before it in post order, so
+  // only blocks which were already visited get removed
+  SmallVector<BasicBlock *, 32> blocks(po_begin(&F), po_end(&F));
+  bool changed = false;
+  for (BasicBlock *BB : blocks) {
+    if (BasicBlock *merge = convertBranch(*BB, threshold)) {
+      if (merge->getSinglePredecessor() == BB) {
+        MergeBlockIntoPredecessor(merge);
+      }
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVIfConversion, DEBUG_TYPE,
+                      "SPIRV convert small diamonds to selects", false, false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_END(SPIRVIfConversion, DEBUG_TYPE,
+                    "SPIRV convert small diamonds to selects", false, false)
+
+char SPIRVIfConversion::ID = 0;
+
+FunctionPass *llvm::createSPIRVIfConversionPass() {
+  return new SPIRVIfConversion();
+}
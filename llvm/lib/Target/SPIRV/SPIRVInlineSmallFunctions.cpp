@@ -0,0 +1,103 @@
+//===-- SPIRVInlineSmallFunctions.cpp - Inline tiny helpers -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Inline the internal functions of at most -spirv-inline-threshold
+// instructions, and the alwaysinline ones, into their callers. Each call left
+// becomes an OpFunctionCall and several drivers inline poorly, so a tiny
+// helper called in a hot loop would otherwise cost a call per iteration.
+//
+// Functions with noinline, which get the DontInline function control, and
+// kernels are never inlined, nor are calls from a function to itself. The
+// functions left without callers are removed.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-inline-small-functions"
+
+STATISTIC(NumInlined, "Number of calls inlined");
+STATISTIC(NumDeleted, "Number of functions removed once inlined");
+
+static cl::opt<unsigned> InlineThreshold(
+    "spirv-inline-threshold", cl::Hidden, cl::init(24),
+    cl::desc("Maximum number of instructions in an internal function for its "
+             "calls to be inlined before selection"));
+
+namespace {
+class SPIRVInlineSmallFunctions : public ModulePass {
+public:
+  static char ID;
+  SPIRVInlineSmallFunctions() : ModulePass(ID) {
+    initializeSPIRVInlineSmallFunctionsPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+};
+} // namespace
+
+static bool shouldInline(const Function &F) {
+  if (F.isDeclaration() || !F.hasLocalLinkage() || F.isVarArg() ||
+      F.getCallingConv() == CallingConv::SPIR_KERNEL ||
+      F.hasFnAttribute(Attribute::NoInline)) {
+    return false;
+  }
+  return F.hasFnAttribute(Attribute::AlwaysInline) ||
+         F.getInstructionCount() <= InlineThreshold;
+}
+
+bool SPIRVInlineSmallFunctions::runOnModule(Module &M) {
+  if (skipModule(M) || InlineThreshold == 0) {
+    return false;
+  }
+  bool changed = false;
+  for (Function &F : make_early_inc_range(M)) {
+    // The size is checked again for each function, as inlining into it may
+    // have made it too big
+    if (!shouldInline(F)) {
+      continue;
+    }
+    SmallVector<CallBase *, 8> calls;
+    for (User *U : F.users()) {
+      auto *CB = dyn_cast<CallBase>(U);
+      if (CB && CB->getCalledFunction() == &F &&
+          CB->getFunctionType() == F.getFunctionType() &&
+          CB->getFunction() != &F) {
+        calls.push_back(CB);
+      }
+    }
+    for (CallBase *CB : calls) {
+      InlineFunctionInfo IFI;
+      if (InlineFunction(CB, IFI)) {
+        ++NumInlined;
+        changed = true;
+      }
+    }
+    if (F.use_empty()) {
+      F.eraseFromParent();
+      ++NumDeleted;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVInlineSmallFunctions, DEBUG_TYPE,
+                "SPIRV inline small internal functions", false, false)
+
+char SPIRVInlineSmallFunctions::ID = 0;
+
+ModulePass *llvm::createSPIRVInlineSmallFunctionsPass() {
+  return new SPIRVInlineSmallFunctions();
+}
@@ -15,6 +15,7 @@
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
 #include "llvm/CodeGen/MachineBasicBlock.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/IR/DebugLoc.h"
 #include "llvm/Support/ErrorHandling.h"
 
@@ -66,6 +67,8 @@ bool SPIRVInstrInfo::isDecorationInstr(const MachineInstr &MI) const {
   case OpDecorateString:
   case OpMemberDecorate:
   case OpMemberDecorateString:
+  case OpDecorationGroup:
+  case OpGroupDecorate:
     return true;
   default:
     return false;
@@ -94,6 +97,136 @@ bool SPIRVInstrInfo::isHeaderInstr(const MachineInstr &MI) const {
   }
 }
 
+bool SPIRVInstrInfo::isSideEffectFreeInstr(const MachineInstr &MI) const {
+  switch (MI.getOpcode()) {
+  case OpIAdd:
+  case OpISub:
+  case OpIMul:
+  case OpUDiv:
+  case OpSDiv:
+  case OpUMod:
+  case OpSRem:
+  case OpSMod:
+  case OpFAdd:
+  case OpFSub:
+  case OpFMul:
+  case OpFDiv:
+  case OpFRem:
+  case OpFMod:
+  case OpFNegate:
+  case OpSNegate:
+  case OpShiftLeftLogical:
+  case OpShiftRightLogical:
+  case OpShiftRightArithmetic:
+  case OpBitwiseAnd:
+  case OpBitwiseOr:
+  case OpBitwiseXor:
+  case OpNot:
+  case OpLogicalAnd:
+  case OpLogicalOr:
+  case OpLogicalNot:
+  case OpLogicalEqual:
+  case OpLogicalNotEqual:
+  case OpSelect:
+  case OpIEqual:
+  case OpINotEqual:
+  case OpULessThan:
+  case OpSLessThan:
+  case OpUGreaterThan:
+  case OpSGreaterThan:
+  case OpULessThanEqual:
+  case OpSLessThanEqual:
+  case OpUGreaterThanEqual:
+  case OpSGreaterThanEqual:
+  case OpFOrdEqual:
+  case OpFUnordEqual:
+  case OpFOrdNotEqual:
+  case OpFUnordNotEqual:
+  case OpFOrdLessThan:
+  case OpFUnordLessThan:
+  case OpFOrdGreaterThan:
+  case OpFUnordGreaterThan:
+  case OpFOrdLessThanEqual:
+  case OpFUnordLessThanEqual:
+  case OpFOrdGreaterThanEqual:
+  case OpFUnordGreaterThanEqual:
+  case OpConvertFToU:
+  case OpConvertFToS:
+  case OpConvertSToF:
+  case OpConvertUToF:
+  case OpUConvert:
+  case OpSConvert:
+  case OpFConvert:
+  case OpConvertPtrToU:
+  case OpConvertUToPtr:
+  case OpPtrCastToGeneric:
+  case OpGenericCastToPtr:
+  case OpGenericCastToPtrExplicit:
+  case OpBitcast:
+  case OpAccessChain:
+  case OpInBoundsAccessChain:
+  case OpPtrAccessChain:
+  case OpInBoundsPtrAccessChain:
+  case OpCompositeExtract:
+  case OpCompositeInsert:
+  case OpCompositeConstruct:
+  case OpVectorShuffle:
+  case OpVectorExtractDynamic:
+  case OpVectorInsertDynamic:
+  case OpVectorTimesScalar:
+  case OpDot:
+  case OpSDot:
+  case OpUDot:
+  case OpSUDot:
+  case OpSDotAccSat:
+  case OpUDotAccSat:
+  case OpSUDotAccSat:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool SPIRVInstrInfo::isAnnotationInstr(const MachineInstr &MI) const {
+  return isDecorationInstr(MI) || MI.getOpcode() == OpName;
+}
+
+unsigned SPIRVInstrInfo::getNumRealUses(Register reg,
+                                        const MachineRegisterInfo &MRI) const {
+  unsigned numUses = 0;
+  for (const auto &use : MRI.use_nodbg_instructions(reg)) {
+    if (!isAnnotationInstr(use)) {
+      ++numUses;
+    }
+  }
+  return numUses;
+}
+
+void SPIRVInstrInfo::eraseAnnotations(
+    Register reg, MachineRegisterInfo &MRI,
+    SmallPtrSetImpl<const MachineInstr *> *Erased) const {
+  for (auto &use : make_early_inc_range(MRI.use_nodbg_instructions(reg))) {
+    if (isAnnotationInstr(use)) {
+      if (Erased) {
+        Erased->insert(&use);
+      }
+      use.eraseFromParent();
+    }
+  }
+}
+
+APInt SPIRVInstrInfo::getConstantBits(const MachineInstr &MI,
+                                      unsigned width) const {
+  assert(MI.getOpcode() == OpConstant && width && width <= 64 &&
+         "Expected an OpConstant of at most 64 bits");
+  // The literal words are zero extended, with the low word first
+  uint64_t val = 0;
+  for (unsigned i = 2; i < MI.getNumOperands(); ++i) {
+    val |= uint64_t(uint32_t(MI.getOperand(i).getImm())) << (32 * (i - 2));
+  }
+  return APInt(64, val).trunc(width);
+}
+
 // Analyze the branching code at the end of MBB, returning
 // true if it cannot be understood (e.g. it's a switch dispatch or isn't
 // implemented for a target).  Upon success, this returns false and returns
@@ -239,3 +372,9 @@ unsigned SPIRVInstrInfo::insertBranch(
   return instsAdded;
 }
 
+ArrayRef<std::pair<int, const char *>>
+SPIRVInstrInfo::getSerializableTargetIndices() const {
+  static const std::pair<int, const char *> TargetIndices[] = {
+      {SPIRV::TI_GlobalID, "spirv-global-id"}};
+  return makeArrayRef(TargetIndices);
+}
@@ -14,6 +14,8 @@
 #define LLVM_LIB_TARGET_SPIRV_SPIRVINSTRINFO_H
 
 #include "SPIRVRegisterInfo.h"
+#include "llvm/ADT/APInt.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/CodeGen/TargetInstrInfo.h"
 
 #define GET_INSTRINFO_HEADER
@@ -32,6 +34,20 @@ public:
   bool isConstantInstr(const MachineInstr &MI) const;
   bool isTypeDeclInstr(const MachineInstr &MI) const;
   bool isDecorationInstr(const MachineInstr &MI) const;
+  // Whether MI only computes its result from its operands, so can be moved or
+  // removed freely
+  bool isSideEffectFreeInstr(const MachineInstr &MI) const;
+  // Whether MI is a name or decoration, which only annotates its target
+  bool isAnnotationInstr(const MachineInstr &MI) const;
+  // Count the uses of reg, other than the names and decorations referring to it
+  unsigned getNumRealUses(Register reg, const MachineRegisterInfo &MRI) const;
+  // Remove the names and decorations of reg, adding them to Erased if given
+  void eraseAnnotations(Register reg, MachineRegisterInfo &MRI,
+                        SmallPtrSetImpl<const MachineInstr *> *Erased =
+                            nullptr) const;
+  // Get the value of the literal words of the OpConstant MI, truncated to the
+  // width of its type
+  APInt getConstantBits(const MachineInstr &MI, unsigned width) const;
 
   bool analyzeBranch(MachineBasicBlock &MBB, MachineBasicBlock *&TBB,
                      MachineBasicBlock *&FBB,
@@ -45,6 +61,9 @@ public:
                         MachineBasicBlock *FBB, ArrayRef<MachineOperand> Cond,
                         const DebugLoc &DL,
                         int *BytesAdded = nullptr) const override;
+
+  ArrayRef<std::pair<int, const char *>>
+  getSerializableTargetIndices() const override;
 };
 } // namespace llvm
 
@@ -0,0 +1,704 @@
+//===-- SPIRVInstrRequirements.cpp - Instruction Requirements --*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Implementation of addInstrRequirements, which adds the capabilities and
+// extensions required whenever an instruction does something that requires
+// them (e.g. an OpTypeInt instruction with a width of 64 requires the Int64
+// capability to be explicitly declared, and decorations that disable wrapping
+// on OpIAdd and other arithmetic operations require an extension).
+//
+// SPIRVGlobalTypesAndRegNums calls this on every function instruction as it
+// walks them for hoisting, collecting the requirements of the whole module in
+// a single SPIRVRequirementHandler, through a SPIRVInstrRequirementsCollector
+// so the many instructions sharing an opcode and immediates are only checked
+// once.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/CodeGen/MachineInstr.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+
+#include "SPIRV.h"
+#include "SPIRVCapabilityUtils.h"
+#include "SPIRVEnumRequirements.h"
+#include "SPIRVSubtarget.h"
+
+using namespace llvm;
+
+// Add VariablePointers to the requirements if this instruction defines a
+// pointer (Logical only).
+static void addVariablePtrInstrReqs(const MachineInstr &MI,
+                                    SPIRVRequirementHandler &reqs,
+                                    const SPIRVSubtarget &ST) {
+  if (ST.isLogicalAddressing()) {
+    auto &MRI = MI.getMF()->getRegInfo();
+    Register type = MI.getOperand(1).getReg();
+    if (MRI.getVRegDef(type)->getOpcode() == SPIRV::OpTypePointer) {
+      reqs.addCapability(Capability::VariablePointers);
+    }
+  }
+}
+
+// Add the required capabilities from a decoration instruction (including
+// BuiltIns).
+static void addOpDecorateReqs(const MachineInstr &MI, unsigned int decIndex,
+                              SPIRVRequirementHandler &reqs,
+                              const SPIRVSubtarget &ST) {
+  auto decOp = MI.getOperand(decIndex).getImm();
+  auto dec = static_cast<Decoration::Decoration>(decOp);
+  auto decReqs = getDecorationRequirements(dec, ST);
+  reqs.addRequirements(decReqs);
+  // The FPGA memory decorations need a capability which needs an extension
+  if (decReqs.cap.hasValue()) {
+    reqs.addExtensions(
+        getCapabilityRequirements(decReqs.cap.getValue(), ST).exts);
+  }
+
+  if (dec == Decoration::BuiltIn) {
+    auto builtInOp = MI.getOperand(decIndex + 1).getImm();
+    auto builtIn = static_cast<BuiltIn::BuiltIn>(builtInOp);
+    reqs.addRequirements(getBuiltInRequirements(builtIn, ST));
+  }
+}
+
+// Add requirements for image handling.
+static void addOpTypeImageReqs(const MachineInstr &MI,
+                               SPIRVRequirementHandler &reqs,
+                               const SPIRVSubtarget &ST) {
+  assert(MI.getNumOperands() >= 8 && "Insufficient operands for OpTypeImage");
+
+  using namespace Capability;
+  using namespace Dim;
+
+  // The operand indices used here are based on the OpTypeImage layout, which
+  // the MachineInstr follows as well.
+  auto imgFormatOp = MI.getOperand(7).getImm();
+  auto imgFormat = static_cast<ImageFormat::ImageFormat>(imgFormatOp);
+  reqs.addRequirements(getImageFormatRequirements(imgFormat, ST));
+
+  bool isArrayed = MI.getOperand(4).getImm() == 1;
+  bool isMultisampled = MI.getOperand(5).getImm() == 1;
+  bool noSampler = MI.getOperand(6).getImm() == 2;
+
+  // Add dimension requirements
+  auto dim = MI.getOperand(2).getImm();
+  switch (dim) {
+  case DIM_1D:
+    reqs.addRequirements(noSampler ? Image1D : Sampled1D);
+    break;
+  case DIM_2D:
+    if (isMultisampled && noSampler) {
+      reqs.addRequirements(ImageMSArray);
+    }
+    break;
+  case DIM_Cube:
+    reqs.addRequirements(Shader);
+    if (isArrayed) {
+      reqs.addRequirements(noSampler ? ImageCubeArray : SampledCubeArray);
+    }
+    break;
+  case DIM_Rect:
+    reqs.addRequirements(noSampler ? ImageRect : SampledRect);
+    break;
+  case DIM_Buffer:
+    reqs.addRequirements(noSampler ? ImageBuffer : SampledBuffer);
+    break;
+  case DIM_SubpassData:
+    reqs.addRequirements(InputAttachment);
+    break;
+  }
+
+  if (ST.isKernel()) {
+    // Has optional access qualifier
+    if (MI.getNumOperands() > 8 && MI.getOperand(8).getImm() == AQ::ReadWrite) {
+      reqs.addRequirements(ImageReadWrite);
+    } else {
+      reqs.addRequirements(ImageBasic);
+    }
+  }
+}
+
+// Add the capability and the extension or SPIR-V version it needs.
+static void addCapabilityAndReqs(Capability::Capability cap,
+                                 SPIRVRequirementHandler &reqs,
+                                 const SPIRVSubtarget &ST) {
+  reqs.addCapability(cap);
+  reqs.addRequirements(getCapabilityRequirements(cap, ST));
+}
+
+// Add the capability for the float width of an atomic float instruction, and
+// the extension that defines it.
+static void addAtomicFloatInstrReqs(const MachineInstr &MI,
+                                    SPIRVRequirementHandler &reqs,
+                                    const SPIRVSubtarget &ST) {
+  using namespace Capability;
+  auto &MRI = MI.getMF()->getRegInfo();
+  const MachineInstr *type = MRI.getVRegDef(MI.getOperand(1).getReg());
+  assert(type->getOpcode() == SPIRV::OpTypeFloat && "Expected a float type");
+  unsigned width = type->getOperand(1).getImm();
+  Capability::Capability cap;
+  if (MI.getOpcode() == SPIRV::OpAtomicFAddEXT) {
+    cap = width == 64 ? AtomicFloat64AddEXT : AtomicFloat32AddEXT;
+  } else if (width == 16) {
+    cap = AtomicFloat16MinMaxEXT;
+  } else {
+    cap = width == 64 ? AtomicFloat64MinMaxEXT : AtomicFloat32MinMaxEXT;
+  }
+  addCapabilityAndReqs(cap, reqs, ST);
+}
+
+// Add the capabilities for the operand type of an integer dot product: 32-bit
+// integers with a PackedVectorFormat, vectors of four 8-bit integers, or any
+// other integer vectors.
+static void addDotProductInstrReqs(const MachineInstr &MI,
+                                   SPIRVRequirementHandler &reqs,
+                                   const SPIRVSubtarget &ST) {
+  using namespace Capability;
+  addCapabilityAndReqs(DotProductKHR, reqs, ST);
+  auto &MRI = MI.getMF()->getRegInfo();
+  const MachineInstr *vecDef = MRI.getVRegDef(MI.getOperand(2).getReg());
+  const MachineInstr *type = MRI.getVRegDef(vecDef->getOperand(1).getReg());
+  const unsigned numFixedOps = MI.getDesc().getNumOperands();
+  if (MI.getNumOperands() > numFixedOps) {
+    auto format = MI.getOperand(numFixedOps).getImm();
+    reqs.addRequirements(getPackedVectorFormatRequirements(format, ST));
+    addCapabilityAndReqs(DotProductInput4x8BitPackedKHR, reqs, ST);
+    return;
+  }
+  assert(type->getOpcode() == SPIRV::OpTypeVector && "Expected a vector type");
+  const MachineInstr *compType = MRI.getVRegDef(type->getOperand(1).getReg());
+  if (type->getOperand(2).getImm() == 4 &&
+      compType->getOperand(1).getImm() == 8) {
+    addCapabilityAndReqs(DotProductInput4x8BitKHR, reqs, ST);
+  } else {
+    addCapabilityAndReqs(DotProductInputAllKHR, reqs, ST);
+  }
+}
+
+bool addInstrRequirements(const MachineInstr &MI, SPIRVRequirementHandler &reqs,
+                          const SPIRVSubtarget &ST) {
+  using namespace Capability;
+  switch (MI.getOpcode()) {
+  case SPIRV::OpMemoryModel: {
+    auto addr = MI.getOperand(0).getImm();
+    reqs.addRequirements(getAddressingModelRequirements(addr, ST));
+    auto mem = MI.getOperand(1).getImm();
+    reqs.addRequirements(getMemoryModelRequirements(mem, ST));
+    break;
+  }
+  case SPIRV::OpEntryPoint: {
+    auto exe = MI.getOperand(0).getImm();
+    reqs.addRequirements(getExecutionModelRequirements(exe, ST));
+    break;
+  }
+  case SPIRV::OpExecutionMode:
+  case SPIRV::OpExecutionModeId: {
+    auto exe = MI.getOperand(1).getImm();
+    reqs.addRequirements(getExecutionModeRequirements(exe, ST));
+    break;
+  }
+  case SPIRV::OpLoopMerge:
+  case SPIRV::OpLoopControlINTEL: {
+    // Check the requirements of every bit in the LoopControl mask, which
+    // OpLoopControlINTEL takes first
+    unsigned lcIdx = 2;
+    if (MI.getOpcode() == SPIRV::OpLoopControlINTEL) {
+      addCapabilityAndReqs(UnstructuredLoopControlsINTEL, reqs, ST);
+      lcIdx = 0;
+    }
+    uint32_t lc = MI.getOperand(lcIdx).getImm();
+    for (uint32_t bit = 1; bit && bit <= lc; bit <<= 1) {
+      if (lc & bit) {
+        auto bitReqs = getLoopControlRequirements(bit, ST);
+        reqs.addRequirements(bitReqs);
+        // The FPGA bits need a capability which needs an extension
+        if (bitReqs.cap.hasValue()) {
+          reqs.addExtensions(
+              getCapabilityRequirements(bitReqs.cap.getValue(), ST).exts);
+        }
+      }
+    }
+    break;
+  }
+  case SPIRV::OpTypeMatrix:
+    reqs.addCapability(Matrix);
+    break;
+  case SPIRV::OpTypeInt: {
+    unsigned bitWidth = MI.getOperand(1).getImm();
+    if (bitWidth == 64) {
+      reqs.addCapability(Int64);
+    } else if (bitWidth == 16) {
+      reqs.addCapability(Int16);
+    } else if (bitWidth == 8) {
+      reqs.addCapability(Int8);
+    }
+    break;
+  }
+  case SPIRV::OpTypeFloat: {
+    unsigned bitWidth = MI.getOperand(1).getImm();
+    if (bitWidth == 64) {
+      if (!ST.canUseCapability(Float64)) {
+        report_fatal_error("Double precision is used but the target has no "
+                           "Float64 capability. -spirv-demote-fp64 computes "
+                           "the double math of floats in float.");
+      }
+      reqs.addCapability(Float64);
+    } else if (bitWidth == 16) {
+      reqs.addCapability(Float16);
+    }
+    break;
+  }
+  case SPIRV::OpTypeVector: {
+    unsigned numComponents = MI.getOperand(2).getImm();
+    if (numComponents == 8 || numComponents == 16) {
+      reqs.addCapability(Vector16);
+    }
+    break;
+  }
+  case SPIRV::OpTypePointer: {
+    auto sc = MI.getOperand(1).getImm();
+    reqs.addRequirements(getStorageClassRequirements(sc, ST));
+    break;
+  }
+  case SPIRV::OpTypeRuntimeArray:
+  case SPIRV::OpBitReverse:
+    reqs.addCapability(Shader);
+    break;
+  case SPIRV::OpTypeOpaque:
+  case SPIRV::OpTypeEvent:
+  case SPIRV::OpGroupAsyncCopy:
+  case SPIRV::OpGroupWaitEvents:
+    reqs.addCapability(Kernel);
+    break;
+  case SPIRV::OpTypePipe:
+  case SPIRV::OpTypeReserveId:
+  case SPIRV::OpReadPipe:
+  case SPIRV::OpWritePipe:
+  case SPIRV::OpReservedReadPipe:
+  case SPIRV::OpReservedWritePipe:
+  case SPIRV::OpReserveReadPipePackets:
+  case SPIRV::OpReserveWritePipePackets:
+  case SPIRV::OpCommitReadPipe:
+  case SPIRV::OpCommitWritePipe:
+  case SPIRV::OpIsValidReserveId:
+  case SPIRV::OpGetNumPipePackets:
+  case SPIRV::OpGetMaxPipePackets:
+  case SPIRV::OpGroupReserveReadPipePackets:
+  case SPIRV::OpGroupReserveWritePipePackets:
+  case SPIRV::OpGroupCommitReadPipe:
+  case SPIRV::OpGroupCommitWritePipe:
+    reqs.addCapability(Pipes);
+    break;
+  case SPIRV::OpTypeDeviceEvent:
+  case SPIRV::OpTypeQueue:
+  case SPIRV::OpEnqueueMarker:
+  case SPIRV::OpEnqueueKernel:
+  case SPIRV::OpGetKernelNDrangeSubGroupCount:
+  case SPIRV::OpGetKernelNDrangeMaxSubGroupSize:
+  case SPIRV::OpGetKernelWorkGroupSize:
+  case SPIRV::OpGetKernelPreferredWorkGroupSizeMultiple:
+  case SPIRV::OpRetainEvent:
+  case SPIRV::OpReleaseEvent:
+  case SPIRV::OpCreateUserEvent:
+  case SPIRV::OpIsValidEvent:
+  case SPIRV::OpSetUserEventStatus:
+  case SPIRV::OpCaptureEventProfilingInfo:
+  case SPIRV::OpGetDefaultQueue:
+  case SPIRV::OpBuildNDRange:
+    reqs.addCapability(DeviceEnqueue);
+    break;
+  case SPIRV::OpDecorate:
+  case SPIRV::OpDecorateId:
+  case SPIRV::OpDecorateString:
+    addOpDecorateReqs(MI, 1, reqs, ST);
+    break;
+  case SPIRV::OpMemberDecorate:
+  case SPIRV::OpMemberDecorateString:
+    addOpDecorateReqs(MI, 2, reqs, ST);
+    break;
+  case SPIRV::OpInBoundsPtrAccessChain:
+  case SPIRV::OpCopyMemorySized:
+    reqs.addCapability(Addresses);
+    break;
+  case SPIRV::OpConstantSampler:
+    reqs.addCapability(LiteralSampler);
+    break;
+  case SPIRV::OpTypeImage:
+    addOpTypeImageReqs(MI, reqs, ST);
+    break;
+  case SPIRV::OpTypeSampler:
+    reqs.addCapability(ImageBasic);
+    break;
+  case SPIRV::OpTypeForwardPointer:
+    if (ST.isKernel()) {
+      reqs.addCapability(Addresses);
+    } else {
+      reqs.addCapability(PhysicalStorageBufferAddressesEXT);
+    }
+    break;
+  case SPIRV::OpExtInst: {
+    auto set = static_cast<ExtInstSet>(MI.getOperand(2).getImm());
+    if (set == ExtInstSet::SPV_AMD_shader_trinary_minmax) {
+      reqs.addExtension(Extension::SPV_AMD_shader_trinary_minmax);
+    }
+    break;
+  }
+  case SPIRV::OpAtomicFAddEXT:
+  case SPIRV::OpAtomicFMinEXT:
+  case SPIRV::OpAtomicFMaxEXT:
+    addAtomicFloatInstrReqs(MI, reqs, ST);
+    break;
+  case SPIRV::OpGroupAll:
+  case SPIRV::OpGroupAny:
+  case SPIRV::OpGroupBroadcast:
+    reqs.addCapability(Groups);
+    break;
+  case SPIRV::OpGroupIAdd:
+  case SPIRV::OpGroupFAdd:
+  case SPIRV::OpGroupFMin:
+  case SPIRV::OpGroupUMin:
+  case SPIRV::OpGroupSMin:
+  case SPIRV::OpGroupFMax:
+  case SPIRV::OpGroupUMax:
+  case SPIRV::OpGroupSMax: {
+    reqs.addCapability(Groups);
+    auto groupOp = MI.getOperand(3).getImm();
+    reqs.addRequirements(getGroupOperationRequirements(groupOp, ST));
+    break;
+  }
+  case SPIRV::OpSubgroupShuffleINTEL:
+  case SPIRV::OpSubgroupShuffleDownINTEL:
+  case SPIRV::OpSubgroupShuffleUpINTEL:
+  case SPIRV::OpSubgroupShuffleXorINTEL:
+    addCapabilityAndReqs(SubgroupShuffleINTEL, reqs, ST);
+    break;
+  case SPIRV::OpSubgroupBlockReadINTEL:
+  case SPIRV::OpSubgroupBlockWriteINTEL:
+    addCapabilityAndReqs(SubgroupBufferBlockIOINTEL, reqs, ST);
+    break;
+  case SPIRV::OpSubgroupImageBlockReadINTEL:
+  case SPIRV::OpSubgroupImageBlockWriteINTEL:
+    addCapabilityAndReqs(SubgroupImageBlockIOINTEL, reqs, ST);
+    break;
+  case SPIRV::OpSubgroupImageMediaBlockReadINTEL:
+  case SPIRV::OpSubgroupImageMediaBlockWriteINTEL:
+    addCapabilityAndReqs(SubgroupImageMediaBlockIOINTEL, reqs, ST);
+    break;
+  case SPIRV::OpSubgroupAllKHR:
+  case SPIRV::OpSubgroupAnyKHR:
+  case SPIRV::OpSubgroupAllEqualKHR:
+    addCapabilityAndReqs(SubgroupVoteKHR, reqs, ST);
+    break;
+  case SPIRV::OpSubgroupBallotKHR:
+  case SPIRV::OpSubgroupFirstInvocationKHR:
+  case SPIRV::OpSubgroupReadInvocationKHR:
+    addCapabilityAndReqs(SubgroupBallotKHR, reqs, ST);
+    break;
+  case SPIRV::OpGroupNonUniformElect:
+    addCapabilityAndReqs(GroupNonUniform, reqs, ST);
+    break;
+  case SPIRV::OpGroupNonUniformAll:
+  case SPIRV::OpGroupNonUniformAny:
+  case SPIRV::OpGroupNonUniformAllEqual:
+    addCapabilityAndReqs(GroupNonUniformVote, reqs, ST);
+    break;
+  case SPIRV::OpGroupNonUniformBroadcast:
+  case SPIRV::OpGroupNonUniformBroadcastFirst:
+  case SPIRV::OpGroupNonUniformBallot:
+  case SPIRV::OpGroupNonUniformInverseBallot:
+  case SPIRV::OpGroupNonUniformBallotBitExtract:
+  case SPIRV::OpGroupNonUniformBallotFindLSB:
+  case SPIRV::OpGroupNonUniformBallotFindMSB:
+    addCapabilityAndReqs(GroupNonUniformBallot, reqs, ST);
+    break;
+  case SPIRV::OpGroupNonUniformBallotBitCount: {
+    addCapabilityAndReqs(GroupNonUniformBallot, reqs, ST);
+    auto groupOp = MI.getOperand(3).getImm();
+    reqs.addRequirements(getGroupOperationRequirements(groupOp, ST));
+    break;
+  }
+  case SPIRV::OpTypeCooperativeMatrixNV:
+  case SPIRV::OpCooperativeMatrixLoadNV:
+  case SPIRV::OpCooperativeMatrixStoreNV:
+  case SPIRV::OpCooperativeMatrixMulAddNV:
+  case SPIRV::OpCooperativeMatrixLengthNV:
+    addCapabilityAndReqs(CooperativeMatrixNV, reqs, ST);
+    break;
+  case SPIRV::OpSDot:
+  case SPIRV::OpUDot:
+  case SPIRV::OpSUDot:
+  case SPIRV::OpSDotAccSat:
+  case SPIRV::OpUDotAccSat:
+  case SPIRV::OpSUDotAccSat:
+    addDotProductInstrReqs(MI, reqs, ST);
+    break;
+  case SPIRV::OpSelect:
+  case SPIRV::OpPhi:
+  case SPIRV::OpFunctionCall:
+  case SPIRV::OpPtrAccessChain:
+  case SPIRV::OpLoad:
+  case SPIRV::OpConstantNull:
+    addVariablePtrInstrReqs(MI, reqs, ST);
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+// The requirements only depend on the subtarget, the opcode, the immediates,
+// and the opcode and width of the result type.
+static void getRequirementsKey(const MachineInstr &MI, const SPIRVSubtarget &ST,
+                               SmallVectorImpl<char> &key) {
+  auto addWord = [&](uint64_t word) {
+    const char *bytes = reinterpret_cast<const char *>(&word);
+    key.append(bytes, bytes + sizeof(word));
+  };
+  addWord(reinterpret_cast<uintptr_t>(&ST));
+  addWord(MI.getOpcode());
+  for (const MachineOperand &MO : MI.operands()) {
+    if (MO.isImm()) {
+      addWord(MO.getImm());
+    }
+  }
+  if (MI.getNumOperands() > 1 && MI.getOperand(0).isReg() &&
+      MI.getOperand(0).isDef() && MI.getOperand(1).isReg()) {
+    const auto &MRI = MI.getMF()->getRegInfo();
+    if (const MachineInstr *type = MRI.getVRegDef(MI.getOperand(1).getReg())) {
+      addWord(type->getOpcode());
+      if (type->getNumOperands() > 1 && type->getOperand(1).isImm()) {
+        addWord(type->getOperand(1).getImm());
+      }
+    }
+  }
+}
+
+namespace {
+// The bits of the narrow type masks of SPIRVInstrRequirementsCollector
+enum NarrowType : unsigned {
+  NarrowInt8 = 1 << 0,
+  NarrowInt16 = 1 << 1,
+  NarrowFloat16 = 1 << 2,
+};
+} // namespace
+
+// Get the NarrowType of a scalar type instruction, or 0 for any other one.
+static unsigned getNarrowScalarType(const MachineInstr &type) {
+  const unsigned opcode = type.getOpcode();
+  if (opcode != SPIRV::OpTypeInt && opcode != SPIRV::OpTypeFloat) {
+    return 0;
+  }
+  const auto width = type.getOperand(1).getImm();
+  if (opcode == SPIRV::OpTypeFloat) {
+    return width == 16 ? static_cast<unsigned>(NarrowFloat16) : 0;
+  }
+  if (width == 8) {
+    return NarrowInt8;
+  }
+  return width == 16 ? static_cast<unsigned>(NarrowInt16) : 0;
+}
+
+// Get the NarrowType of a scalar or vector type, or 0.
+static unsigned getNarrowValueType(Register typeReg,
+                                   const MachineRegisterInfo &MRI) {
+  const MachineInstr *type = MRI.getVRegDef(typeReg);
+  if (type && type->getOpcode() == SPIRV::OpTypeVector) {
+    type = MRI.getVRegDef(type->getOperand(1).getReg());
+  }
+  return type ? getNarrowScalarType(*type) : 0;
+}
+
+// Get the mask of NarrowTypes anywhere in the memory layout of a type.
+static unsigned getNarrowMemoryTypes(Register typeReg,
+                                     const MachineRegisterInfo &MRI) {
+  const MachineInstr *type = MRI.getVRegDef(typeReg);
+  if (!type) {
+    return 0;
+  }
+  switch (type->getOpcode()) {
+  case SPIRV::OpTypeVector:
+  case SPIRV::OpTypeMatrix:
+  case SPIRV::OpTypeArray:
+  case SPIRV::OpTypeRuntimeArray:
+    return getNarrowMemoryTypes(type->getOperand(1).getReg(), MRI);
+  case SPIRV::OpTypeStruct: {
+    unsigned types = 0;
+    for (unsigned i = 1; i < type->getNumOperands(); ++i) {
+      types |= getNarrowMemoryTypes(type->getOperand(i).getReg(), MRI);
+    }
+    return types;
+  }
+  default:
+    return getNarrowScalarType(*type);
+  }
+}
+
+// Get the type of the value the instruction defines, if it has one.
+static const MachineInstr *getResultType(const MachineInstr &MI,
+                                         const MachineRegisterInfo &MRI,
+                                         const SPIRVInstrInfo &TII) {
+  if (MI.getNumOperands() < 2 || !MI.getOperand(0).isReg() ||
+      !MI.getOperand(0).isDef() || !MI.getOperand(1).isReg() ||
+      TII.isTypeDeclInstr(MI)) {
+    return nullptr;
+  }
+  const MachineInstr *type = MRI.getVRegDef(MI.getOperand(1).getReg());
+  return type && TII.isTypeDeclInstr(*type) ? type : nullptr;
+}
+
+void SPIRVInstrRequirementsCollector::addNarrowTypeUses(
+    const MachineInstr &MI) {
+  using namespace SPIRV;
+  const auto &MRI = MI.getMF()->getRegInfo();
+  const unsigned opcode = MI.getOpcode();
+  if (opcode == OpTypeInt || opcode == OpTypeFloat) {
+    declaredNarrowTypes |= getNarrowScalarType(MI);
+    return;
+  }
+  if (opcode == OpTypePointer) {
+    const unsigned types = getNarrowMemoryTypes(MI.getOperand(2).getReg(), MRI);
+    switch (MI.getOperand(1).getImm()) {
+    case StorageClass::StorageBuffer:
+      narrowStorageBufferTypes |= types;
+      break;
+    case StorageClass::Uniform:
+      narrowUniformTypes |= types;
+      break;
+    case StorageClass::PushConstant:
+      narrowPushConstantTypes |= types;
+      break;
+    case StorageClass::Input:
+    case StorageClass::Output:
+      narrowInputOutputTypes |= types;
+      break;
+    default:
+      narrowOtherStorageTypes |= types;
+      break;
+    }
+    return;
+  }
+  // The storage-only capabilities allow loading, copying and converting
+  switch (opcode) {
+  case OpLoad:
+  case OpCopyObject:
+  case OpFConvert:
+  case OpSConvert:
+  case OpUConvert:
+    return;
+  }
+  const SPIRVInstrInfo &TII = *ST->getInstrInfo();
+  const MachineInstr *resultType = getResultType(MI, MRI, TII);
+  // Instructions without results only store or return the values other
+  // instructions defined, except for branching on them
+  if (!resultType && opcode != OpSwitch) {
+    return;
+  }
+  unsigned types = 0;
+  if (resultType) {
+    types |= getNarrowValueType(resultType->getOperand(0).getReg(), MRI);
+  }
+  for (unsigned i = resultType ? 2 : 0; i < MI.getNumOperands(); ++i) {
+    const MachineOperand &op = MI.getOperand(i);
+    if (!op.isReg()) {
+      continue;
+    }
+    if (const MachineInstr *def = MRI.getVRegDef(op.getReg())) {
+      if (const MachineInstr *type = getResultType(*def, MRI, TII)) {
+        types |= getNarrowValueType(type->getOperand(0).getReg(), MRI);
+      }
+    }
+  }
+  narrowValueTypes |= types;
+}
+
+void SPIRVInstrRequirementsCollector::addNarrowTypeRequirements() {
+  using namespace Capability;
+  if (!ST) {
+    return;
+  }
+  if (ST->isKernel()) {
+    // Halves only used through pointers, as by vload_half and vstore_half,
+    // just need Float16Buffer
+    if (declaredNarrowTypes & NarrowFloat16) {
+      const bool isArith = narrowValueTypes & NarrowFloat16;
+      reqs.addCapability(isArith ? Float16 : Float16Buffer);
+    }
+    if (declaredNarrowTypes & NarrowInt16) {
+      reqs.addCapability(Int16);
+    }
+    if (declaredNarrowTypes & NarrowInt8) {
+      reqs.addCapability(Int8);
+    }
+    return;
+  }
+  for (NarrowType type : {NarrowInt8, NarrowInt16, NarrowFloat16}) {
+    if (!(declaredNarrowTypes & type)) {
+      continue;
+    }
+    const bool is8Bit = type == NarrowInt8;
+    bool needsFullCap = (narrowValueTypes | narrowOtherStorageTypes) & type;
+    SmallVector<Capability::Capability, 4> storageCaps;
+    if (narrowStorageBufferTypes & type) {
+      storageCaps.push_back(is8Bit ? StorageBuffer8BitAccess
+                                   : StorageBuffer16BitAccess);
+    }
+    if (narrowUniformTypes & type) {
+      storageCaps.push_back(is8Bit ? UniformAndStorageBuffer8BitAccess
+                                   : StorageUniform16);
+    }
+    if (narrowPushConstantTypes & type) {
+      storageCaps.push_back(is8Bit ? StoragePushConstant8
+                                   : StoragePushConstant16);
+    }
+    if (narrowInputOutputTypes & type) {
+      // There is no 8-bit counterpart of StorageInputOutput16
+      if (is8Bit) {
+        needsFullCap = true;
+      } else {
+        storageCaps.push_back(StorageInputOutput16);
+      }
+    }
+    for (Capability::Capability cap : storageCaps) {
+      if (ST->canUseCapability(cap)) {
+        addCapabilityAndReqs(cap, reqs, *ST);
+      } else {
+        needsFullCap = true;
+      }
+    }
+    if (needsFullCap || storageCaps.empty()) {
+      reqs.addCapability(is8Bit ? Int8 : type == NarrowInt16 ? Int16 : Float16);
+    }
+  }
+}
+
+void SPIRVInstrRequirementsCollector::addInstr(const MachineInstr &MI,
+                                               const SPIRVSubtarget &ST) {
+  this->ST = &ST;
+  addNarrowTypeUses(MI);
+  // Their capabilities depend on the whole module, see
+  // addNarrowTypeRequirements
+  if (getNarrowScalarType(MI)) {
+    return;
+  }
+  const unsigned opcode = MI.getOpcode();
+  if (opcode < noReqsOpcodes.size() && noReqsOpcodes[opcode]) {
+    return;
+  }
+  SmallString<64> key;
+  getRequirementsKey(MI, ST, key);
+  if (!addedKeys.insert(key).second) {
+    return;
+  }
+  if (!addInstrRequirements(MI, reqs, ST)) {
+    if (opcode >= noReqsOpcodes.size()) {
+      noReqsOpcodes.resize(opcode + 1);
+    }
+    noReqsOpcodes.set(opcode);
+  }
+}
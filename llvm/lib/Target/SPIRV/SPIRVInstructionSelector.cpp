@@ -8,8 +8,11 @@
 //
 // Implements the InstructionSelector class for SPIR-V
 //
-// TODO: Can some of this be moved to tablegen, or does the reliance on
-// SPIRVTypeRegistry prevent this?
+// TableGen patterns can't be used, as every SPIR-V instruction with a result
+// takes its type as an explicit operand, which depends on the SPIRVType that
+// SPIRVTypeRegistry assigned to the result VReg. Instead, generic opcodes that
+// map directly to a single SPIR-V instruction are matched via a static table
+// before falling back to the hand-written selection switch.
 //
 //===----------------------------------------------------------------------===//
 
@@ -22,6 +25,7 @@
 #include "SPIRVSubtarget.h"
 #include "SPIRVTargetMachine.h"
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/StringSwitch.h"
 #include "llvm/CodeGen/GlobalISel/InstructionSelector.h"
 #include "llvm/CodeGen/GlobalISel/InstructionSelectorImpl.h"
 #include "llvm/CodeGen/GlobalISel/Utils.h"
@@ -30,10 +34,15 @@
 #include "llvm/CodeGen/MachineInstr.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineOperand.h"
+#include "llvm/CodeGen/MachineOptimizationRemarkEmitter.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/Type.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
+#include <array>
 
 #include "SPIRVTypeRegistry.h"
 
@@ -59,10 +68,6 @@ public:
   static const char *getName() { return DEBUG_TYPE; }
 
 private:
-  // tblgen-erated 'select' implementation, used as the initial selector for
-  // the patterns that don't require complex C++.
-  bool selectImpl(MachineInstr &I, CodeGenCoverage &CoverageInfo) const;
-
   // All instruction-specific selection that didn't happen in "select()".
   // Is basically a large Switch/Case delegating to all other select method.
   bool spvSelect(Register resVReg, const SPIRVType *resType,
@@ -75,6 +80,25 @@ private:
                   const MachineInstr &I, MachineIRBuilder &MIRBuilder,
                   unsigned newOpcode) const;
 
+  // Decorate the target RelaxedPrecision if the policy allows it for I, and
+  // the new instruction computes 32-bit floats or is a variable holding them.
+  void handleRelaxedPrecision(const MachineInstr &I, Register target,
+                              const SPIRVType *resType, unsigned newOpcode,
+                              MachineIRBuilder &MIRBuilder) const;
+
+  // Whether the VReg is a specialization constant, or an OpSpecConstantOp (or
+  // a generic instr that will be selected to one) computed from them.
+  bool isSpecConstantExpr(Register reg, const MachineRegisterInfo &MRI) const;
+
+  // Whether a generic instr selecting to newOpcode only uses constants, at
+  // least one of them a specialization constant, so it can be folded into an
+  // OpSpecConstantOp.
+  bool canFoldToSpecConstantOp(const MachineInstr &I, unsigned newOpcode,
+                               const MachineRegisterInfo &MRI) const;
+  bool selectSpecConstantOp(Register resVReg, const SPIRVType *resType,
+                            const MachineInstr &I, MachineIRBuilder &MIRBuilder,
+                            unsigned newOpcode) const;
+
   bool selectAtomicRMW(Register resVReg, const SPIRVType *resType,
                        const MachineInstr &I, MachineIRBuilder &MIRBuilder,
                        unsigned newOpcode) const;
@@ -85,6 +109,12 @@ private:
 
   bool selectFence(const MachineInstr &I, MachineIRBuilder &MIRBuilder) const;
 
+  // Get the storage class semantics of the memory the atomic on ptr accesses
+  unsigned getPointerStorageSemantics(Register ptr) const;
+  // Get the storage class semantics of all the memory F may access, which a
+  // fence in it orders
+  unsigned getFenceStorageSemantics(const Function &F) const;
+
   bool selectAddrSpaceCast(Register resVReg, const SPIRVType *resType,
                            const MachineInstr &I,
                            MachineIRBuilder &MIRBuilder) const;
@@ -93,6 +123,12 @@ private:
                         const MachineInstr &I, MachineIRBuilder &MIRBuilder,
                         unsigned newOpcode) const;
 
+  // Select G_SMULH and G_UMULH to OpenCL.std's mul_hi, or to the high half of
+  // OpSMulExtended or OpUMulExtended
+  bool selectMulHigh(Register resVReg, const SPIRVType *resType,
+                     const MachineInstr &I, MachineIRBuilder &MIRBuilder,
+                     bool isSigned) const;
+
   bool selectCmp(Register resVReg, const SPIRVType *resType,
                  unsigned scalarTypeOpcode, unsigned comparisonOpcode,
                  const MachineInstr &I, MachineIRBuilder &MIRBuilder,
@@ -127,7 +163,14 @@ private:
                           const MachineInstr &I,
                           MachineIRBuilder &MIRBuilder) const;
 
+  bool selectCompositeConstruct(Register resVReg, const SPIRVType *resType,
+                                const MachineInstr &I,
+                                MachineIRBuilder &MIRBuilder) const;
+  bool selectUnmergeValues(const MachineInstr &I,
+                           MachineIRBuilder &MIRBuilder) const;
+
   bool selectFrameIndex(Register resVReg, const SPIRVType *resType,
+                        const MachineInstr &I,
                         MachineIRBuilder &MIRBuilder) const;
 
   bool selectBranch(const MachineInstr &I, MachineIRBuilder &MIRBuilder) const;
@@ -152,6 +195,13 @@ private:
                      const MachineInstr &I, MachineIRBuilder &MIRBuilder,
                      const ExtInstList &extInsts) const;
 
+  // Get the VReg of a constant with the given type and value, reusing an
+  // identical constant from earlier in the function if there is one. If res is
+  // given, it is used as the result of any newly built constant.
+  Register getOrBuildConst(const SPIRVType *resTy, const APInt &imm,
+                           MachineIRBuilder &MIRBuilder,
+                           Register res = Register()) const;
+
   Register buildI32Constant(uint32_t val, MachineIRBuilder &MIRBuilder) const;
 
   Register buildZerosVal(const SPIRVType *resType,
@@ -168,6 +218,15 @@ private:
   const SPIRVRegisterInfo &TRI;
   const SPIRVRegisterBankInfo &RBI;
   SPIRVTypeRegistry &TR;
+
+  // Builder reused for every selected instruction, so only the insertion
+  // point needs updating unless selection moves to a different function.
+  mutable MachineIRBuilder ISelBuilder;
+
+  // The function getFenceStorageSemantics was last computed for, and the
+  // result, reset along with ISelBuilder
+  mutable const Function *FenceFunction = nullptr;
+  mutable unsigned FenceStorageSemantics = 0;
 };
 
 } // end anonymous namespace
@@ -178,31 +237,202 @@ SPIRVInstructionSelector::SPIRVInstructionSelector(
     : InstructionSelector(), TM(TM), ST(ST), TII(*ST.getInstrInfo()),
       TRI(*ST.getRegisterInfo()), RBI(RBI), TR(TR) {}
 
+static bool canUseFastMathFlags(unsigned opCode) {
+  using namespace SPIRV;
+  switch (opCode) {
+  case OpFAdd:
+  case OpFSub:
+  case OpFMul:
+  case OpFDiv:
+  case OpFRem:
+  case OpFMod:
+  case OpFNegate:
+  case OpExtInst:
+  case OpFOrdEqual:
+  case OpFUnordEqual:
+  case OpFOrdNotEqual:
+  case OpFUnordNotEqual:
+  case OpFOrdLessThan:
+  case OpFUnordLessThan:
+  case OpFOrdGreaterThan:
+  case OpFUnordGreaterThan:
+  case OpFOrdLessThanEqual:
+  case OpFUnordLessThanEqual:
+  case OpFOrdGreaterThanEqual:
+  case OpFUnordGreaterThanEqual:
+  case OpOrdered:
+  case OpUnordered:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// NoSignedWrap and NoUnsignedWrap can decorate the same set of instructions
+static bool canUseWrapFlags(unsigned opCode) {
+  using namespace SPIRV;
+  switch (opCode) {
+  case OpIAdd:
+  case OpISub:
+  case OpIMul:
+  case OpShiftLeftLogical:
+  case OpSNegate:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static void decorate(Register target, Decoration::Decoration dec,
+                     MachineIRBuilder &MIRBuilder) {
+  MIRBuilder.buildInstr(SPIRV::OpDecorate).addUse(target).addImm(dec);
+}
+static void decorate(Register target, Decoration::Decoration dec, uint32_t imm,
+                     MachineIRBuilder &MIRBuilder) {
+  MIRBuilder.buildInstr(SPIRV::OpDecorate)
+      .addUse(target)
+      .addImm(dec)
+      .addImm(imm);
+}
+
+static uint32_t getFastMathFlags(const MachineInstr &I) {
+  uint32_t flags = FPFastMathMode::None;
+  if (I.getFlag(MachineInstr::MIFlag::FmNoNans)) {
+    flags |= FPFastMathMode::NotNaN;
+  }
+  if (I.getFlag(MachineInstr::MIFlag::FmNoInfs)) {
+    flags |= FPFastMathMode::NotInf;
+  }
+  if (I.getFlag(MachineInstr::MIFlag::FmNsz)) {
+    flags |= FPFastMathMode::NSZ;
+  }
+  if (I.getFlag(MachineInstr::MIFlag::FmArcp)) {
+    flags |= FPFastMathMode::AllowRecip;
+  }
+  if (I.getFlag(MachineInstr::MIFlag::FmReassoc)) {
+    flags |= FPFastMathMode::Fast;
+  }
+  return flags;
+}
+
+// Decorate the target with the FP fast-math flags of I, if it has any and the
+// new instruction can use them. Duplicates are merged when decorations are
+// hoisted to the global annotations section.
+static void handleFastMathFlags(const MachineInstr &I, Register target,
+                                unsigned newOpcode,
+                                MachineIRBuilder &MIRBuilder) {
+  if (canUseFastMathFlags(newOpcode)) {
+    auto fmFlags = getFastMathFlags(I);
+    if (fmFlags != FPFastMathMode::None) {
+      decorate(target, Decoration::FPFastMathMode, fmFlags, MIRBuilder);
+    }
+  }
+}
+
+static void handleIntegerWrapFlags(const MachineInstr &I, Register target,
+                                   unsigned newOpcode, const SPIRVSubtarget &ST,
+                                   MachineIRBuilder &MIRBuilder) {
+  if (!canUseWrapFlags(newOpcode)) {
+    return;
+  }
+  if (I.getFlag(MachineInstr::MIFlag::NoSWrap)) {
+    if (canUseDecoration(Decoration::NoSignedWrap, ST)) {
+      decorate(target, Decoration::NoSignedWrap, MIRBuilder);
+    }
+  }
+  if (I.getFlag(MachineInstr::MIFlag::NoUWrap)) {
+    if (canUseDecoration(Decoration::NoUnsignedWrap, ST)) {
+      decorate(target, Decoration::NoUnsignedWrap, MIRBuilder);
+    }
+  }
+}
+
+static cl::opt<bool> RelaxedPrecision(
+    "spirv-relaxed-precision", cl::Hidden, cl::init(false),
+    cl::desc("Decorate the 32-bit float arithmetic and variables of shaders "
+             "RelaxedPrecision"));
+
+static bool canUseRelaxedPrecision(unsigned opCode) {
+  using namespace SPIRV;
+  switch (opCode) {
+  case OpFAdd:
+  case OpFSub:
+  case OpFMul:
+  case OpFDiv:
+  case OpFRem:
+  case OpFMod:
+  case OpFNegate:
+  case OpExtInst:
+  case OpVariable:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Whether the type is a 32-bit float or a vector of them
+static bool isFloat32(const SPIRVTypeInfo *info) {
+  if (info && info->opcode == SPIRV::OpTypeVector) {
+    info = info->elemType;
+  }
+  return info && info->opcode == SPIRV::OpTypeFloat && info->scalarWidth == 32;
+}
+
+// Relaxed precision is used for everything with -spirv-relaxed-precision, in
+// functions with the "spirv-relaxed-precision" attribute, and for operations
+// allowed to be approximated by their fast-math flags
+void SPIRVInstructionSelector::handleRelaxedPrecision(
+    const MachineInstr &I, Register target, const SPIRVType *resType,
+    unsigned newOpcode, MachineIRBuilder &MIRBuilder) const {
+  if (!ST.isShader() || !resType || !canUseRelaxedPrecision(newOpcode)) {
+    return;
+  }
+  const Function &F = I.getMF()->getFunction();
+  if (!RelaxedPrecision && !I.getFlag(MachineInstr::MIFlag::FmAfn) &&
+      F.getFnAttribute("spirv-relaxed-precision").getValueAsString() !=
+          "true") {
+    return;
+  }
+  const SPIRVTypeInfo *info = TR.getTypeInfo(resType);
+  if (newOpcode == SPIRV::OpVariable) {
+    info = info ? info->elemType : nullptr;
+  }
+  if (isFloat32(info)) {
+    decorate(target, Decoration::RelaxedPrecision, MIRBuilder);
+  }
+}
+
 bool SPIRVInstructionSelector::select(MachineInstr &I,
                                       CodeGenCoverage &CoverageInfo) const {
   assert(I.getParent() && "Instruction should be in a basic block!");
   assert(I.getParent()->getParent() && "Instruction should be in a function!");
 
-  MachineBasicBlock &MBB = *I.getParent();
-  MachineFunction &MF = *MBB.getParent();
+  MachineFunction &MF = *I.getMF();
 
-  MachineIRBuilder MIRBuilder;
-  MIRBuilder.setMF(MF);
-  MIRBuilder.setMBB(MBB);
+  // All the builder's function-level state is derived from MF, so it only
+  // needs resetting when MF or its MachineRegisterInfo differ from last time.
+  MachineIRBuilder &MIRBuilder = ISelBuilder;
+  if (MIRBuilder.getMRI() != &MF.getRegInfo() || &MIRBuilder.getMF() != &MF) {
+    MIRBuilder.setMF(MF);
+    FenceFunction = nullptr;
+  }
   MIRBuilder.setInstr(I);
+  // Keep the source location of I for the OpLines emitted from it
+  MIRBuilder.setDebugLoc(I.getDebugLoc());
 
   Register Opcode = I.getOpcode();
 
-  // If tablegen patterns get used later, call selectImpl to match them first
-  // if (selectImpl(I, CoverageInfo))
-  // return true;
-
   // If it's not a GMIR instruction, we've selected it already.
   if (!isPreISelGenericOpcode(Opcode)) {
-    if (Opcode == SPIRV::ASSIGN_TYPE) { // These pseudos aren't needed any more
-      I.removeFromParent();
-    } else if (I.getNumDefs() == 1) { // Make all vregs 32 bits (for SPIR-V IDs)
-      MIRBuilder.getMRI()->setType(I.getOperand(0).getReg(), LLT::scalar(32));
+    if (I.getNumDefs() == 1) { // Make all vregs 32 bits (for SPIR-V IDs)
+      Register def = I.getOperand(0).getReg();
+      MIRBuilder.getMRI()->setType(def, LLT::scalar(32));
+      // Builtin calls lowered to OpExtInsts keep the call's fast-math flags
+      if (Opcode == SPIRV::OpExtInst) {
+        handleFastMathFlags(I, def, SPIRV::OpExtInst, MIRBuilder);
+        handleRelaxedPrecision(I, def, TR.getSPIRVTypeForVReg(def),
+                               SPIRV::OpExtInst, MIRBuilder);
+      }
     }
     return true;
   }
@@ -218,8 +448,8 @@ bool SPIRVInstructionSelector::select(MachineInstr &I,
   Register resVReg = hasDefs ? I.getOperand(0).getReg() : Register(0);
   SPIRVType *resType = hasDefs ? TR.getSPIRVTypeForVReg(resVReg) : nullptr;
   if (spvSelect(resVReg, resType, I, MIRBuilder)) {
-    if (hasDefs) { // Make all vregs 32 bits (for SPIR-V IDs)
-      MIRBuilder.getMRI()->setType(resVReg, LLT::scalar(32));
+    for (const auto &def : I.defs()) { // Make all vregs 32 bits (SPIR-V IDs)
+      MIRBuilder.getMRI()->setType(def.getReg(), LLT::scalar(32));
     }
     I.removeFromParent();
     return true;
@@ -227,6 +457,61 @@ bool SPIRVInstructionSelector::select(MachineInstr &I,
   return false;
 }
 
+namespace {
+// A generic opcode which selects to a single SPIR-V instruction, taking the
+// result type followed by the generic instruction's source operands.
+struct SimpleOpPattern {
+  unsigned GenericOpcode;
+  unsigned SPIRVOpcode;
+};
+} // end anonymous namespace
+
+static const SimpleOpPattern SimpleOpPatterns[] = {
+    {TargetOpcode::G_ADD, SPIRV::OpIAdd},
+    {TargetOpcode::G_FADD, SPIRV::OpFAdd},
+    {TargetOpcode::G_SUB, SPIRV::OpISub},
+    {TargetOpcode::G_FSUB, SPIRV::OpFSub},
+    {TargetOpcode::G_MUL, SPIRV::OpIMul},
+    {TargetOpcode::G_FMUL, SPIRV::OpFMul},
+    {TargetOpcode::G_UDIV, SPIRV::OpUDiv},
+    {TargetOpcode::G_SDIV, SPIRV::OpSDiv},
+    {TargetOpcode::G_FDIV, SPIRV::OpFDiv},
+    {TargetOpcode::G_SREM, SPIRV::OpSRem},
+    {TargetOpcode::G_FREM, SPIRV::OpFRem},
+    {TargetOpcode::G_UREM, SPIRV::OpUMod},
+    {TargetOpcode::G_SHL, SPIRV::OpShiftLeftLogical},
+    {TargetOpcode::G_LSHR, SPIRV::OpShiftRightLogical},
+    {TargetOpcode::G_ASHR, SPIRV::OpShiftRightArithmetic},
+    {TargetOpcode::G_FNEG, SPIRV::OpFNegate},
+    {TargetOpcode::G_FPTOSI, SPIRV::OpConvertFToS},
+    {TargetOpcode::G_FPTOUI, SPIRV::OpConvertFToU},
+    {TargetOpcode::G_SITOFP, SPIRV::OpConvertSToF},
+    {TargetOpcode::G_UITOFP, SPIRV::OpConvertUToF},
+    {TargetOpcode::G_CTPOP, SPIRV::OpBitCount},
+    {TargetOpcode::G_FPTRUNC, SPIRV::OpFConvert},
+    {TargetOpcode::G_FPEXT, SPIRV::OpFConvert},
+    {TargetOpcode::G_PTRTOINT, SPIRV::OpConvertPtrToU},
+    {TargetOpcode::G_INTTOPTR, SPIRV::OpConvertUToPtr},
+    {TargetOpcode::G_BITCAST, SPIRV::OpBitcast},
+};
+
+// Get the SPIR-V opcode the given generic opcode selects to via the simple op
+// table, or 0 if it needs custom selection. The table is indexed by generic
+// opcode on first use so each lookup is a single load.
+static unsigned getSimpleOpPatternOpcode(unsigned genericOpcode) {
+  constexpr unsigned FirstOpcode = TargetOpcode::PRE_ISEL_GENERIC_OPCODE_START;
+  constexpr unsigned NumGenericOpcodes =
+      TargetOpcode::PRE_ISEL_GENERIC_OPCODE_END - FirstOpcode + 1;
+  static const auto Table = [] {
+    std::array<unsigned, NumGenericOpcodes> table{};
+    for (const SimpleOpPattern &pattern : SimpleOpPatterns) {
+      table[pattern.GenericOpcode - FirstOpcode] = pattern.SPIRVOpcode;
+    }
+    return table;
+  }();
+  return Table[genericOpcode - FirstOpcode];
+}
+
 bool SPIRVInstructionSelector::spvSelect(Register resVReg,
                                          const SPIRVType *resType,
                                          const MachineInstr &I,
@@ -236,6 +521,14 @@ bool SPIRVInstructionSelector::spvSelect(Register resVReg,
   namespace GL = GLSL_std_450;
 
   const unsigned Opcode = I.getOpcode();
+  if (unsigned newOpcode = getSimpleOpPatternOpcode(Opcode)) {
+    if (canFoldToSpecConstantOp(I, newOpcode, *MIRBuilder.getMRI()))
+      return selectSpecConstantOp(resVReg, resType, I, MIRBuilder, newOpcode);
+    if (I.getNumOperands() == 3)
+      return selectBinOp(resVReg, resType, I, MIRBuilder, newOpcode);
+    return selectUnOp(resVReg, resType, I, MIRBuilder, newOpcode);
+  }
+
   switch (Opcode) {
   case TargetOpcode::G_FCONSTANT: {
     const ConstantFP *imm = I.getOperand(1).getFPImm();
@@ -254,6 +547,11 @@ bool SPIRVInstructionSelector::spvSelect(Register resVReg,
     return selectVectorInsert(resVReg, resType, I, MIRBuilder);
   case TargetOpcode::G_EXTRACT_VECTOR_ELT:
     return selectVectorExtract(resVReg, resType, I, MIRBuilder);
+  case TargetOpcode::G_BUILD_VECTOR:
+  case TargetOpcode::G_CONCAT_VECTORS:
+    return selectCompositeConstruct(resVReg, resType, I, MIRBuilder);
+  case TargetOpcode::G_UNMERGE_VALUES:
+    return selectUnmergeValues(I, MIRBuilder);
 
   case TargetOpcode::G_ICMP:
     return selectICmp(resVReg, resType, I, MIRBuilder);
@@ -261,7 +559,7 @@ bool SPIRVInstructionSelector::spvSelect(Register resVReg,
     return selectFCmp(resVReg, resType, I, MIRBuilder);
 
   case TargetOpcode::G_FRAME_INDEX:
-    return selectFrameIndex(resVReg, resType, MIRBuilder);
+    return selectFrameIndex(resVReg, resType, I, MIRBuilder);
 
   case TargetOpcode::G_BR:
     return selectBranch(I, MIRBuilder);
@@ -274,51 +572,6 @@ bool SPIRVInstructionSelector::spvSelect(Register resVReg,
   case TargetOpcode::G_PHI:
     return selectPhi(resVReg, resType, I, MIRBuilder);
 
-  case TargetOpcode::G_ADD:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpIAdd);
-  case TargetOpcode::G_FADD:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpFAdd);
-
-  case TargetOpcode::G_SUB:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpISub);
-  case TargetOpcode::G_FSUB:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpFSub);
-
-  case TargetOpcode::G_MUL:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpIMul);
-  case TargetOpcode::G_FMUL:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpFMul);
-
-  case TargetOpcode::G_UDIV:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpUDiv);
-  case TargetOpcode::G_SDIV:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpSDiv);
-  case TargetOpcode::G_FDIV:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpFDiv);
-
-  case TargetOpcode::G_SREM:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpSRem);
-  case TargetOpcode::G_FREM:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpFRem);
-  case TargetOpcode::G_UREM:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpUMod);
-
-  case TargetOpcode::G_FNEG:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpFNegate);
-
-  case TargetOpcode::G_FPTOSI:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpConvertFToS);
-  case TargetOpcode::G_FPTOUI:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpConvertFToU);
-
-  case TargetOpcode::G_SITOFP:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpConvertSToF);
-  case TargetOpcode::G_UITOFP:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpConvertUToF);
-
-  case TargetOpcode::G_CTPOP:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpBitCount);
-
   case TargetOpcode::G_UADDO:
     return selectOverflowOp(resVReg, resType, I, MIRBuilder, OpIAddCarry);
   case TargetOpcode::G_USUBO:
@@ -358,6 +611,8 @@ bool SPIRVInstructionSelector::spvSelect(Register resVReg,
 
   case TargetOpcode::G_FABS:
     return selectExtInst(resVReg, resType, I, MIRBuilder, CL::fabs, GL::FAbs);
+  case TargetOpcode::G_FCOPYSIGN:
+    return selectExtInst(resVReg, resType, I, MIRBuilder, CL::copysign);
 
   case TargetOpcode::G_FMINNUM:
     return selectExtInst(resVReg, resType, I, MIRBuilder, CL::fmin, GL::FMin);
@@ -394,9 +649,9 @@ bool SPIRVInstructionSelector::spvSelect(Register resVReg,
                          GL::RoundEven);
 
   case TargetOpcode::G_SMULH:
-    return selectExtInst(resVReg, resType, I, MIRBuilder, CL::s_mul_hi);
+    return selectMulHigh(resVReg, resType, I, MIRBuilder, true);
   case TargetOpcode::G_UMULH:
-    return selectExtInst(resVReg, resType, I, MIRBuilder, CL::u_mul_hi);
+    return selectMulHigh(resVReg, resType, I, MIRBuilder, false);
 
   case TargetOpcode::G_AND: {
     bool isBool = TR.isScalarOrVectorOfType(resVReg, OpTypeBool);
@@ -421,26 +676,9 @@ bool SPIRVInstructionSelector::spvSelect(Register resVReg,
     return selectExt(resVReg, resType, I, false, MIRBuilder);
   case TargetOpcode::G_TRUNC:
     return selectTrunc(resVReg, resType, I, MIRBuilder);
-  case TargetOpcode::G_FPTRUNC:
-  case TargetOpcode::G_FPEXT:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpFConvert);
-
-  case TargetOpcode::G_PTRTOINT:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpConvertPtrToU);
-  case TargetOpcode::G_INTTOPTR:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpConvertUToPtr);
-  case TargetOpcode::G_BITCAST:
-    return selectUnOp(resVReg, resType, I, MIRBuilder, OpBitcast);
   case TargetOpcode::G_ADDRSPACE_CAST:
     return selectAddrSpaceCast(resVReg, resType, I, MIRBuilder);
 
-  case TargetOpcode::G_SHL:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpShiftLeftLogical);
-  case TargetOpcode::G_LSHR:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpShiftRightLogical);
-  case TargetOpcode::G_ASHR:
-    return selectBinOp(resVReg, resType, I, MIRBuilder, OpShiftRightArithmetic);
-
   case TargetOpcode::G_ATOMICRMW_OR:
     return selectAtomicRMW(resVReg, resType, I, MIRBuilder, OpAtomicOr);
   case TargetOpcode::G_ATOMICRMW_ADD:
@@ -514,125 +752,168 @@ bool SPIRVInstructionSelector::selectExtInst(Register resVReg,
       for (unsigned i = 1; i < numOps; ++i) {
         MIB.add(I.getOperand(i));
       }
-      return MIB.constrainAllUses(TII, TRI, RBI);
+      if (!MIB.constrainAllUses(TII, TRI, RBI))
+        return false;
+      handleFastMathFlags(I, resVReg, SPIRV::OpExtInst, MIRBuilder);
+      handleRelaxedPrecision(I, resVReg, resType, SPIRV::OpExtInst,
+                             MIRBuilder);
+      return true;
     }
   }
   return false;
 }
 
-static bool canUseFastMathFlags(unsigned opCode) {
-  using namespace SPIRV;
-  switch (opCode) {
-  case OpFAdd:
-  case OpFSub:
-  case OpFMul:
-  case OpFDiv:
-  case OpFRem:
-  case OpFMod:
-    return true;
-  default:
+bool SPIRVInstructionSelector::selectBinOp(Register resVReg,
+                                           const SPIRVType *resType,
+                                           const MachineInstr &I,
+                                           MachineIRBuilder &MIRBuilder,
+                                           unsigned newOpcode) const {
+  bool success = MIRBuilder.buildInstr(newOpcode)
+      .addDef(resVReg)
+      .addUse(TR.getSPIRVTypeID(resType))
+      .addUse(I.getOperand(1).getReg())
+      .addUse(I.getOperand(2).getReg())
+      .constrainAllUses(TII, TRI, RBI);
+
+  if (!success)
     return false;
-  }
+
+  handleFastMathFlags(I, resVReg, newOpcode, MIRBuilder);
+  handleIntegerWrapFlags(I, resVReg, newOpcode, ST, MIRBuilder);
+  handleRelaxedPrecision(I, resVReg, resType, newOpcode, MIRBuilder);
+  return true;
 }
 
-static bool canUseNSW(unsigned opCode) {
+// The opcodes OpSpecConstantOp can compute, with the capabilities it has
+bool llvm::isSPIRVSpecConstantOpOpcode(unsigned opCode,
+                                       const SPIRVSubtarget &ST) {
   using namespace SPIRV;
   switch (opCode) {
+  case OpSConvert:
+  case OpFConvert:
+  case OpSNegate:
+  case OpNot:
   case OpIAdd:
   case OpISub:
   case OpIMul:
+  case OpUDiv:
+  case OpSDiv:
+  case OpUMod:
+  case OpSRem:
+  case OpSMod:
   case OpShiftLeftLogical:
-  case OpSNegate:
+  case OpShiftRightLogical:
+  case OpShiftRightArithmetic:
+  case OpBitwiseOr:
+  case OpBitwiseXor:
+  case OpBitwiseAnd:
+  case OpVectorShuffle:
+  case OpCompositeExtract:
+  case OpCompositeInsert:
+  case OpLogicalOr:
+  case OpLogicalAnd:
+  case OpLogicalNot:
+  case OpLogicalEqual:
+  case OpLogicalNotEqual:
+  case OpSelect:
+  case OpIEqual:
+  case OpINotEqual:
+  case OpULessThan:
+  case OpSLessThan:
+  case OpUGreaterThan:
+  case OpSGreaterThan:
+  case OpULessThanEqual:
+  case OpSLessThanEqual:
+  case OpUGreaterThanEqual:
+  case OpSGreaterThanEqual:
     return true;
+  case OpUConvert:
+  case OpFAdd:
+  case OpFSub:
+  case OpFMul:
+  case OpFDiv:
+  case OpFRem:
+  case OpFMod:
+  case OpFNegate:
+  case OpConvertFToS:
+  case OpConvertFToU:
+  case OpConvertSToF:
+  case OpConvertUToF:
+  case OpConvertPtrToU:
+  case OpConvertUToPtr:
+  case OpPtrCastToGeneric:
+  case OpGenericCastToPtr:
+  case OpBitcast:
+  case OpAccessChain:
+  case OpInBoundsAccessChain:
+  case OpPtrAccessChain:
+  case OpInBoundsPtrAccessChain:
+    return ST.canUseCapability(Capability::Kernel);
   default:
     return false;
   }
 }
 
-static bool canUseNUW(unsigned opCode) {
-  using namespace SPIRV;
-  switch (opCode) {
-  case OpIAdd:
-  case OpISub:
-  case OpIMul:
-    return true;
-  default:
+bool SPIRVInstructionSelector::isSpecConstantExpr(
+    Register reg, const MachineRegisterInfo &MRI) const {
+  const MachineInstr *def = MRI.getVRegDef(reg);
+  if (!def) {
     return false;
   }
-}
-
-static void decorate(Register target, Decoration::Decoration dec,
-                     MachineIRBuilder &MIRBuilder) {
-  MIRBuilder.buildInstr(SPIRV::OpDecorate).addUse(target).addImm(dec);
-}
-static void decorate(Register target, Decoration::Decoration dec, uint32_t imm,
-                     MachineIRBuilder &MIRBuilder) {
-  MIRBuilder.buildInstr(SPIRV::OpDecorate)
-      .addUse(target)
-      .addImm(dec)
-      .addImm(imm);
-}
-
-static uint32_t getFastMathFlags(const MachineInstr &I) {
-  uint32_t flags = FPFastMathMode::None;
-  if (I.getFlag(MachineInstr::MIFlag::FmNoNans)) {
-    flags |= FPFastMathMode::NotNaN;
-  }
-  if (I.getFlag(MachineInstr::MIFlag::FmNoInfs)) {
-    flags |= FPFastMathMode::NotInf;
-  }
-  if (I.getFlag(MachineInstr::MIFlag::FmNsz)) {
-    flags |= FPFastMathMode::NSZ;
-  }
-  if (I.getFlag(MachineInstr::MIFlag::FmArcp)) {
-    flags |= FPFastMathMode::AllowRecip;
+  switch (def->getOpcode()) {
+  case SPIRV::OpSpecConstant:
+  case SPIRV::OpSpecConstantTrue:
+  case SPIRV::OpSpecConstantFalse:
+  case SPIRV::OpSpecConstantOp:
+    return true;
   }
-  if (I.getFlag(MachineInstr::MIFlag::FmReassoc)) {
-    flags |= FPFastMathMode::Fast;
+  // Selection is bottom-up, so the operands may not have been folded yet
+  if (!isPreISelGenericOpcode(def->getOpcode())) {
+    return false;
   }
-  return flags;
+  unsigned newOpcode = getSimpleOpPatternOpcode(def->getOpcode());
+  return newOpcode && canFoldToSpecConstantOp(*def, newOpcode, MRI);
 }
 
-static void handleIntegerWrapFlags(const MachineInstr &I, Register target,
-                                   unsigned newOpcode, const SPIRVSubtarget &ST,
-                                   MachineIRBuilder &MIRBuilder) {
-  if (I.getFlag(MachineInstr::MIFlag::NoSWrap)) {
-    if (canUseNSW(newOpcode) &&
-        canUseDecoration(Decoration::NoSignedWrap, ST)) {
-      decorate(target, Decoration::NoSignedWrap, MIRBuilder);
-    }
+bool SPIRVInstructionSelector::canFoldToSpecConstantOp(
+    const MachineInstr &I, unsigned newOpcode,
+    const MachineRegisterInfo &MRI) const {
+  if (!isSPIRVSpecConstantOpOpcode(newOpcode, ST)) {
+    return false;
   }
-  if (I.getFlag(MachineInstr::MIFlag::NoUWrap)) {
-    if (canUseNUW(newOpcode) &&
-        canUseDecoration(Decoration::NoUnsignedWrap, ST)) {
-      decorate(target, Decoration::NoUnsignedWrap, MIRBuilder);
+  bool usesSpecConstant = false;
+  for (unsigned i = 1; i < I.getNumOperands(); ++i) {
+    const MachineOperand &op = I.getOperand(i);
+    if (!op.isReg()) {
+      return false;
+    }
+    if (isSpecConstantExpr(op.getReg(), MRI)) {
+      usesSpecConstant = true;
+      continue;
+    }
+    const MachineInstr *def = MRI.getVRegDef(op.getReg());
+    const unsigned defOpcode = def ? def->getOpcode() : 0;
+    if (!def || (defOpcode != TargetOpcode::G_CONSTANT &&
+                 defOpcode != TargetOpcode::G_FCONSTANT &&
+                 (!TII.isConstantInstr(*def) || defOpcode == SPIRV::OpUndef))) {
+      return false;
     }
   }
+  return usesSpecConstant;
 }
 
-bool SPIRVInstructionSelector::selectBinOp(Register resVReg,
-                                           const SPIRVType *resType,
-                                           const MachineInstr &I,
-                                           MachineIRBuilder &MIRBuilder,
-                                           unsigned newOpcode) const {
-  bool success = MIRBuilder.buildInstr(newOpcode)
-      .addDef(resVReg)
-      .addUse(TR.getSPIRVTypeID(resType))
-      .addUse(I.getOperand(1).getReg())
-      .addUse(I.getOperand(2).getReg())
-      .constrainAllUses(TII, TRI, RBI);
-
-  if (!success)
-    return false;
-
-  if (canUseFastMathFlags(newOpcode)) {
-    auto fmFlags = getFastMathFlags(I);
-    if (fmFlags != FPFastMathMode::None) {
-      decorate(resVReg, Decoration::FPFastMathMode, fmFlags, MIRBuilder);
-    }
+bool SPIRVInstructionSelector::selectSpecConstantOp(
+    Register resVReg, const SPIRVType *resType, const MachineInstr &I,
+    MachineIRBuilder &MIRBuilder, unsigned newOpcode) const {
+  // The SPIR-V opcode of the computation is a literal operand
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpSpecConstantOp)
+                 .addDef(resVReg)
+                 .addUse(TR.getSPIRVTypeID(resType))
+                 .addImm(getSPIRVOpcodeEncoding(TII.get(newOpcode).TSFlags));
+  for (unsigned i = 1; i < I.getNumOperands(); ++i) {
+    MIB.addUse(I.getOperand(i).getReg());
   }
-  handleIntegerWrapFlags(I, resVReg, newOpcode, ST, MIRBuilder);
-  return true;
+  return MIB.constrainAllUses(TII, TRI, RBI);
 }
 
 bool SPIRVInstructionSelector::selectUnOp(Register resVReg,
@@ -640,7 +921,9 @@ bool SPIRVInstructionSelector::selectUnOp(Register resVReg,
                                           const MachineInstr &I,
                                           MachineIRBuilder &MIRBuilder,
                                           unsigned newOpcode) const {
+  handleFastMathFlags(I, resVReg, newOpcode, MIRBuilder);
   handleIntegerWrapFlags(I, resVReg, newOpcode, ST, MIRBuilder);
+  handleRelaxedPrecision(I, resVReg, resType, newOpcode, MIRBuilder);
   return MIRBuilder.buildInstr(newOpcode)
       .addDef(resVReg)
       .addUse(TR.getSPIRVTypeID(resType))
@@ -666,15 +949,87 @@ static MemorySemantics::MemorySemantics getMemSemantics(AtomicOrdering ord) {
   }
 }
 
-static Scope::Scope getScope(SyncScope::ID ord) {
-  switch (ord) {
+// Map the LLVM synchronization scope to a SPIR-V scope. The default system
+// scope is Device, the widest without the svm device-sharing overhead, and
+// other scopes are named after the OpenCL ones or the SPIR-V ones.
+static Scope::Scope getScope(SyncScope::ID id, const LLVMContext &ctx) {
+  switch (id) {
   case SyncScope::SingleThread:
     return Scope::Invocation;
   case SyncScope::System:
     return Scope::Device;
   default:
-    llvm_unreachable("Unsupported synchronization scope ID.");
+    break;
+  }
+  SmallVector<StringRef, 8> names;
+  ctx.getSyncScopeNames(names);
+  const StringRef name = id < names.size() ? names[id] : "";
+  const auto scope = StringSwitch<Optional<Scope::Scope>>(name)
+                         .Cases("work_item", "invocation", Scope::Invocation)
+                         .Cases("sub_group", "subgroup", "wavefront",
+                                Scope::Subgroup)
+                         .Cases("work_group", "workgroup", Scope::Workgroup)
+                         .Cases("device", "agent", Scope::Device)
+                         .Cases("all_svm_devices", "crossdevice",
+                                Scope::CrossDevice)
+                         .Default(None);
+  if (!scope) {
+    report_fatal_error("Unsupported synchronization scope: " + name);
+  }
+  return *scope;
+}
+
+// A generic pointer may point to either Workgroup or CrossWorkgroup memory
+static unsigned getStorageSemantics(StorageClass::StorageClass sc) {
+  if (sc == StorageClass::Generic) {
+    return MemorySemantics::WorkgroupMemory |
+           MemorySemantics::CrossWorkgroupMemory;
   }
+  return getMemSemanticsForStorageClass(sc);
+}
+
+unsigned
+SPIRVInstructionSelector::getPointerStorageSemantics(Register ptr) const {
+  return getStorageSemantics(TR.getPointerStorageClass(ptr));
+}
+
+unsigned
+SPIRVInstructionSelector::getFenceStorageSemantics(const Function &F) const {
+  if (FenceFunction == &F) {
+    return FenceStorageSemantics;
+  }
+  unsigned memSem = 0;
+  for (const Instruction &I : instructions(F)) {
+    if (const auto *CB = dyn_cast<CallBase>(&I)) {
+      // Calls may access any memory, but intrinsics only their pointer args
+      const Function *callee = CB->getCalledFunction();
+      if (!callee || !callee->isIntrinsic()) {
+        if (!CB->onlyAccessesInaccessibleMemory() &&
+            !CB->doesNotAccessMemory()) {
+          memSem |= MemorySemantics::WorkgroupMemory |
+                    MemorySemantics::CrossWorkgroupMemory |
+                    MemorySemantics::UniformMemory |
+                    MemorySemantics::ImageMemory;
+        }
+        continue;
+      }
+      for (const Value *arg : CB->args()) {
+        if (auto *PT = dyn_cast<PointerType>(arg->getType())) {
+          memSem |= getStorageSemantics(
+              TR.addressSpaceToStorageClass(PT->getAddressSpace()));
+        }
+      }
+    } else if (isa<LoadInst>(I) || isa<StoreInst>(I) ||
+               isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I)) {
+      // Loads and atomics have the pointer first, and stores second
+      const Value *ptr = isa<StoreInst>(I) ? I.getOperand(1) : I.getOperand(0);
+      memSem |= getStorageSemantics(TR.addressSpaceToStorageClass(
+          ptr->getType()->getPointerAddressSpace()));
+    }
+  }
+  FenceFunction = &F;
+  FenceStorageSemantics = memSem;
+  return memSem;
 }
 
 bool SPIRVInstructionSelector::selectAtomicRMW(Register resVReg,
@@ -685,14 +1040,16 @@ bool SPIRVInstructionSelector::selectAtomicRMW(Register resVReg,
 
   assert(I.hasOneMemOperand());
   auto memOp = *I.memoperands_begin();
-  auto scope = getScope(memOp->getSyncScopeID());
+  auto &ctx = MIRBuilder.getMF().getFunction().getContext();
+  auto scope = getScope(memOp->getSyncScopeID(), ctx);
   Register scopeReg = buildI32Constant(scope, MIRBuilder);
 
   auto ptr = I.getOperand(1).getReg();
-  auto scSem = getMemSemanticsForStorageClass(TR.getPointerStorageClass(ptr));
+  auto scSem = getPointerStorageSemantics(ptr);
 
-  auto memSem = getMemSemantics(memOp->getOrdering());
-  Register memSemReg = buildI32Constant(memSem | scSem, MIRBuilder);
+  auto memSem = ST.getMemSemanticsForMemoryModel(
+      getMemSemantics(memOp->getOrdering()) | scSem);
+  Register memSemReg = buildI32Constant(memSem, MIRBuilder);
 
   return MIRBuilder.buildInstr(newOpcode)
       .addDef(resVReg)
@@ -706,10 +1063,19 @@ bool SPIRVInstructionSelector::selectAtomicRMW(Register resVReg,
 
 bool SPIRVInstructionSelector::selectFence(const MachineInstr &I,
                                            MachineIRBuilder &MIRBuilder) const {
-  auto memSem = getMemSemantics(AtomicOrdering(I.getOperand(0).getImm()));
+  const Function &F = MIRBuilder.getMF().getFunction();
+  auto scope =
+      getScope(SyncScope::ID(I.getOperand(1).getImm()), F.getContext());
+  // A fence orders the memory the function accesses, which is never shared
+  // with other invocations at Invocation scope
+  unsigned scSem = 0;
+  if (scope != Scope::Invocation) {
+    scSem = getFenceStorageSemantics(F);
+  }
+  auto memSem = ST.getMemSemanticsForMemoryModel(
+      getMemSemantics(AtomicOrdering(I.getOperand(0).getImm())) | scSem);
   Register memSemReg = buildI32Constant(memSem, MIRBuilder);
 
-  auto scope = getScope(SyncScope::ID(I.getOperand(1).getImm()));
   Register scopeReg = buildI32Constant(scope, MIRBuilder);
 
   return MIRBuilder.buildInstr(SPIRV::OpMemoryBarrier)
@@ -726,7 +1092,8 @@ bool SPIRVInstructionSelector::selectAtomicCmpXchg(Register resVReg,
   auto MRI = MIRBuilder.getMRI();
   assert(I.hasOneMemOperand());
   auto memOp = *I.memoperands_begin();
-  auto scope = getScope(memOp->getSyncScopeID());
+  auto &ctx = MIRBuilder.getMF().getFunction().getContext();
+  auto scope = getScope(memOp->getSyncScopeID(), ctx);
   Register scopeReg = buildI32Constant(scope, MIRBuilder);
 
   auto ptr = I.getOperand(2).getReg();
@@ -734,12 +1101,14 @@ bool SPIRVInstructionSelector::selectAtomicCmpXchg(Register resVReg,
   auto val = I.getOperand(4).getReg();
 
   auto spvValTy = TR.getSPIRVTypeForVReg(val);
-  auto scSem = getMemSemanticsForStorageClass(TR.getPointerStorageClass(ptr));
+  auto scSem = getPointerStorageSemantics(ptr);
 
-  auto memSemEq = getMemSemantics(memOp->getOrdering()) | scSem;
+  auto memSemEq = ST.getMemSemanticsForMemoryModel(
+      getMemSemantics(memOp->getOrdering()) | scSem);
   Register memSemEqReg = buildI32Constant(memSemEq, MIRBuilder);
 
-  auto memSemNeq = getMemSemantics(memOp->getFailureOrdering()) | scSem;
+  auto memSemNeq = ST.getMemSemanticsForMemoryModel(
+      getMemSemantics(memOp->getFailureOrdering()) | scSem);
   Register memSemNeqReg = memSemEq == memSemNeq
                               ? memSemEqReg
                               : buildI32Constant(memSemNeq, MIRBuilder);
@@ -786,6 +1155,21 @@ static bool isGenericCastablePtr(StorageClass::StorageClass sc) {
   }
 }
 
+// Report a lowering of I which is likely slower than what the kernel's author
+// expects, so it shows up with -pass-remarks-missed and in the remarks file.
+static void emitLoweringRemark(const MachineInstr &I, StringRef remarkName,
+                               StringRef msg) {
+  const auto &MF = *I.getMF();
+  MachineOptimizationRemarkEmitter MORE(const_cast<MachineFunction &>(MF),
+                                        nullptr);
+  MORE.emit([&]() {
+    return MachineOptimizationRemarkMissed(DEBUG_TYPE, remarkName,
+                                           I.getDebugLoc(), I.getParent())
+           << msg << " in kernel "
+           << ore::NV("Kernel", MF.getFunction().getName());
+  });
+}
+
 // In SPIR-V address space casting can only happen to and from the Generic
 // storage class. We can also only case Workgroup, CrossWorkgroup, or Function
 // pointers to and from Generic pointers. As such, we can convert e.g. from
@@ -803,6 +1187,8 @@ bool SPIRVInstructionSelector::selectAddrSpaceCast(
 
   if (dstSC == SC::Generic && isGenericCastablePtr(srcSC)) {
     // We're casting from an eligable pointer to Generic
+    emitLoweringRemark(I, "GenericPointer",
+                       "pointer cast to the Generic storage class");
     return selectUnOp(resVReg, resType, I, MIRBuilder, OpPtrCastToGeneric);
   } else if (srcSC == SC::Generic && isGenericCastablePtr(dstSC)) {
     // We're casting from Generic to an eligable pointer
@@ -825,6 +1211,8 @@ bool SPIRVInstructionSelector::selectAddrSpaceCast(
   } else {
     // TODO Should this case just be disallowed completely?
     // We're casting 2 other arbitrary address spaces, so have to bitcast
+    emitLoweringRemark(I, "AddrSpaceCastBitcast",
+                       "address space cast lowered as a bitcast");
     return selectUnOp(resVReg, resType, I, MIRBuilder, OpBitcast);
   }
 }
@@ -877,6 +1265,35 @@ bool SPIRVInstructionSelector::selectOverflowOp(Register resVReg,
                         .constrainAllUses(TII, TRI, RBI);
 }
 
+bool SPIRVInstructionSelector::selectMulHigh(Register resVReg,
+                                             const SPIRVType *resType,
+                                             const MachineInstr &I,
+                                             MachineIRBuilder &MIRBuilder,
+                                             bool isSigned) const {
+  using namespace SPIRV;
+  if (ST.canUseExtInstSet(ExtInstSet::OpenCL_std)) {
+    return selectExtInst(resVReg, resType, I, MIRBuilder,
+                         isSigned ? CL::s_mul_hi : CL::u_mul_hi);
+  }
+  auto MRI = MIRBuilder.getMRI();
+  auto tmpReg = MRI->createGenericVirtualRegister(LLT::scalar(32));
+  SPIRVType *elemTy = TR.getSPIRVTypeForVReg(resVReg);
+  auto tmpStructTy = TR.getPairStruct(elemTy, elemTy, MIRBuilder);
+  bool success = MIRBuilder
+                     .buildInstr(isSigned ? OpSMulExtended : OpUMulExtended)
+                     .addDef(tmpReg)
+                     .addUse(TR.getSPIRVTypeID(tmpStructTy))
+                     .addUse(I.getOperand(1).getReg())
+                     .addUse(I.getOperand(2).getReg())
+                     .constrainAllUses(TII, TRI, RBI);
+  return success && MIRBuilder.buildInstr(OpCompositeExtract)
+                        .addDef(resVReg)
+                        .addUse(TR.getSPIRVTypeID(resType))
+                        .addUse(tmpReg)
+                        .addImm(1)
+                        .constrainAllUses(TII, TRI, RBI);
+}
+
 static unsigned int getFCmpOpcode(unsigned predNum) {
   auto pred = static_cast<CmpInst::Predicate>(predNum);
   switch (pred) {
@@ -1006,6 +1423,7 @@ bool SPIRVInstructionSelector::selectCmp(Register resVReg,
     llvm_unreachable("Incompatible type for comparison");
   }
 
+  handleFastMathFlags(I, resVReg, cmpOpc, MIRBuilder);
   return MIRBuilder.buildInstr(cmpOpc)
       .addDef(resVReg)
       .addUse(TR.getSPIRVTypeID(resType))
@@ -1041,47 +1459,69 @@ bool SPIRVInstructionSelector::selectICmp(Register resVReg,
 bool SPIRVInstructionSelector::selectConst(Register res, const SPIRVType *resTy,
                                            const APInt &imm,
                                            MachineIRBuilder &MIRBuilder) const {
+  Register constReg = getOrBuildConst(resTy, imm, MIRBuilder, res);
+  if (!constReg.isValid())
+    return false;
+  // An identical constant already exists, so use that one instead.
+  if (constReg != res) {
+    MIRBuilder.getMRI()->replaceRegWith(res, constReg);
+  }
+  return true;
+}
+
+Register SPIRVInstructionSelector::getOrBuildConst(
+    const SPIRVType *resTy, const APInt &imm, MachineIRBuilder &MIRBuilder,
+    Register res) const {
 
   unsigned int OpCode = SPIRV::OpConstant;
   const auto bitwidth = imm.getBitWidth();
-
-  if (bitwidth == 1) {
-    OpCode = imm.isOneValue() ? SPIRV::OpConstantTrue : SPIRV::OpConstantFalse;
-  }
-
-  Register typeID = TR.getSPIRVTypeID(resTy);
-  auto MIB = MIRBuilder.buildInstr(OpCode).addDef(res).addUse(typeID);
+  SmallVector<int64_t, 2> literals;
 
   switch (bitwidth) {
   case 1:
-    break; // Already handled
+    OpCode = imm.isOneValue() ? SPIRV::OpConstantTrue : SPIRV::OpConstantFalse;
+    break;
   case 8:
   case 16:
   case 32:
-    MIB.addImm(imm.getZExtValue());
+    literals.push_back(imm.getZExtValue());
     break;
   case 64: {
     uint64_t fullImm = imm.getZExtValue();
     uint32_t lowBits = fullImm & 0xffffffff;
     uint32_t highBits = (fullImm >> 32) & 0xffffffff;
-    MIB.addImm(lowBits).addImm(highBits);
+    literals.push_back(lowBits);
+    literals.push_back(highBits);
     break;
   }
   default:
     errs() << "Bitwidth = " << bitwidth;
     report_fatal_error("Unsupported constant bitwidth");
   }
-  return constrainSelectedInstRegOperands(*MIB, TII, TRI, RBI);
+
+  if (Register existing = TR.findConstant(OpCode, resTy, literals)) {
+    return existing;
+  }
+
+  if (!res.isValid()) {
+    res = MIRBuilder.getMRI()->createGenericVirtualRegister(LLT::scalar(32));
+  }
+  Register typeID = TR.getSPIRVTypeID(resTy);
+  auto MIB = MIRBuilder.buildInstr(OpCode).addDef(res).addUse(typeID);
+  for (const auto literal : literals) {
+    MIB.addImm(literal);
+  }
+  if (!constrainSelectedInstRegOperands(*MIB, TII, TRI, RBI))
+    return Register();
+  TR.addConstant(OpCode, resTy, literals, res);
+  return res;
 }
 
 Register
 SPIRVInstructionSelector::buildI32Constant(uint32_t val,
                                            MachineIRBuilder &MIRBuilder) const {
-  auto MRI = MIRBuilder.getMRI();
   auto spvI32Ty = TR.getOpTypeInt(32, MIRBuilder);
-  Register newReg = MRI->createGenericVirtualRegister(LLT::scalar(32));
-  selectConst(newReg, spvI32Ty, APInt(32, val), MIRBuilder);
-  return newReg;
+  return getOrBuildConst(spvI32Ty, APInt(32, val), MIRBuilder);
 }
 
 bool SPIRVInstructionSelector::selectFCmp(Register resVReg,
@@ -1095,12 +1535,15 @@ bool SPIRVInstructionSelector::selectFCmp(Register resVReg,
 Register
 SPIRVInstructionSelector::buildZerosVal(const SPIRVType *resType,
                                         MachineIRBuilder &MIRBuilder) const {
+  if (Register existing = TR.findConstant(SPIRV::OpConstantNull, resType, {}))
+    return existing;
   auto MRI = MIRBuilder.getMRI();
   Register zeroReg = MRI->createVirtualRegister(&SPIRV::IDRegClass);
   MIRBuilder.buildInstr(SPIRV::OpConstantNull)
       .addDef(zeroReg)
       .addUse(TR.getSPIRVTypeID(resType))
       .constrainAllUses(TII, TRI, RBI);
+  TR.addConstant(SPIRV::OpConstantNull, resType, {}, zeroReg);
   return zeroReg;
 }
 
@@ -1108,24 +1551,30 @@ Register
 SPIRVInstructionSelector::buildOnesVal(bool allOnes, const SPIRVType *resType,
                                        MachineIRBuilder &MIRBuilder) const {
   auto MRI = MIRBuilder.getMRI();
-  Register oneReg = MRI->createVirtualRegister(&SPIRV::IDRegClass);
   unsigned bitWidth = TR.getScalarOrVectorBitWidth(resType);
   auto one = allOnes ? APInt::getAllOnesValue(bitWidth)
                      : APInt::getOneBitSet(bitWidth, 0);
-  selectConst(oneReg, resType, one, MIRBuilder);
   if (resType->getOpcode() == SPIRV::OpTypeVector) {
+    Register eleTypeReg = resType->getOperand(1).getReg();
+    SPIRVType *eleType = TR.getSPIRVTypeForVReg(eleTypeReg);
+    Register oneReg = getOrBuildConst(eleType, one, MIRBuilder);
     const unsigned numEles = resType->getOperand(2).getImm();
+    SmallVector<int64_t, 4> eles(numEles, oneReg);
+    auto compositeOp = SPIRV::OpConstantComposite;
+    if (Register existing = TR.findConstant(compositeOp, resType, eles))
+      return existing;
     Register oneVec = MRI->createVirtualRegister(&SPIRV::IDRegClass);
-    auto MIB = MIRBuilder.buildInstr(SPIRV::OpConstantComposite)
+    auto MIB = MIRBuilder.buildInstr(compositeOp)
                    .addDef(oneVec)
                    .addUse(TR.getSPIRVTypeID(resType));
     for (unsigned i = 0; i < numEles; ++i) {
       MIB.addUse(oneReg);
     }
     TR.constrainRegOperands(MIB);
+    TR.addConstant(compositeOp, resType, eles, oneVec);
     return oneVec;
   } else {
-    return oneReg;
+    return getOrBuildConst(resType, one, MIRBuilder);
   }
 }
 
@@ -1235,9 +1684,57 @@ bool SPIRVInstructionSelector::selectVectorInsert(
   return MIB.constrainAllUses(TII, TRI, RBI);
 }
 
+// OpCompositeConstruct takes either scalars or smaller vectors to build a
+// vector from, so it covers both G_BUILD_VECTOR and G_CONCAT_VECTORS.
+bool SPIRVInstructionSelector::selectCompositeConstruct(
+    Register resVReg, const SPIRVType *resType, const MachineInstr &I,
+    MachineIRBuilder &MIRBuilder) const {
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpCompositeConstruct)
+                 .addDef(resVReg)
+                 .addUse(TR.getSPIRVTypeID(resType));
+  for (unsigned i = 1; i < I.getNumOperands(); ++i) {
+    MIB.addUse(I.getOperand(i).getReg());
+  }
+  return MIB.constrainAllUses(TII, TRI, RBI);
+}
+
+// The legalizer splits vectors into either scalars or smaller vectors, which
+// are taken from consecutive components of the split vector.
+bool SPIRVInstructionSelector::selectUnmergeValues(
+    const MachineInstr &I, MachineIRBuilder &MIRBuilder) const {
+  unsigned numDefs = I.getNumDefs();
+  Register vec = I.getOperand(numDefs).getReg();
+  for (unsigned i = 0; i < numDefs; ++i) {
+    Register part = I.getOperand(i).getReg();
+    SPIRVType *partType = TR.getSPIRVTypeForVReg(part);
+    bool isVector = partType->getOpcode() == SPIRV::OpTypeVector;
+    auto MIB = MIRBuilder
+                   .buildInstr(isVector ? SPIRV::OpVectorShuffle
+                                        : SPIRV::OpCompositeExtract)
+                   .addDef(part)
+                   .addUse(TR.getSPIRVTypeID(partType))
+                   .addUse(vec);
+    if (isVector) {
+      unsigned numElems = partType->getOperand(2).getImm();
+      MIB.addUse(vec);
+      for (unsigned j = 0; j < numElems; ++j) {
+        MIB.addImm(i * numElems + j);
+      }
+    } else {
+      MIB.addImm(i);
+    }
+    if (!MIB.constrainAllUses(TII, TRI, RBI))
+      return false;
+  }
+  return true;
+}
+
 bool SPIRVInstructionSelector::selectFrameIndex(
-    Register resVReg, const SPIRVType *resType,
+    Register resVReg, const SPIRVType *resType, const MachineInstr &I,
     MachineIRBuilder &MIRBuilder) const {
+  emitLoweringRemark(I, "FunctionVariable",
+                     "stack object lowered as a Function storage OpVariable");
+  handleRelaxedPrecision(I, resVReg, resType, SPIRV::OpVariable, MIRBuilder);
   return MIRBuilder.buildInstr(SPIRV::OpVariable)
       .addDef(resVReg)
       .addUse(TR.getSPIRVTypeID(resType))
@@ -0,0 +1,241 @@
+//===-- SPIRVKernelReflection.cpp - Write kernel reflection -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// With -spirv-reflection, write what runtimes otherwise parse the whole module
+// for at program load to the given file as JSON: each kernel's arguments, with
+// their kind, storage class, size, access and type qualifiers and OpenCL type
+// names, its required and hinted work-group sizes and sub-group size, and the
+// Workgroup memory it uses, plus the specialization constants of the module.
+//
+// Each kernel argument is one OpFunctionParameter of the entry point, so this
+// is read from the IR the entry points are built from.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/SmallSet.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-reflection"
+
+static cl::opt<std::string> ReflectionFile(
+    "spirv-reflection", cl::Hidden, cl::value_desc("filename"),
+    cl::desc("Write the arguments and launch requirements of each kernel, as "
+             "JSON, to the given file"));
+
+namespace {
+struct SPIRVKernelReflection : public ModulePass {
+  static char ID;
+  SPIRVKernelReflection() : ModulePass(ID) {
+    initializeSPIRVKernelReflectionPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<MachineModuleInfo>();
+    AU.setPreservesAll();
+  }
+};
+} // namespace
+
+// Get the string operand of the kernel_arg_* metadata for the argument
+static StringRef getArgMetadataString(const Function &F, StringRef kind,
+                                      unsigned argNo) {
+  const MDNode *node = F.getMetadata(kind);
+  if (!node || argNo >= node->getNumOperands()) {
+    return "";
+  }
+  if (auto *str = dyn_cast<MDString>(node->getOperand(argNo))) {
+    return str->getString();
+  }
+  return "";
+}
+
+static SmallVector<uint64_t, 3> getMDOperandsAsUInts(const MDNode *node) {
+  SmallVector<uint64_t, 3> values;
+  for (const MDOperand &op : node->operands()) {
+    if (auto *C = mdconst::dyn_extract<ConstantInt>(op)) {
+      values.push_back(C->getZExtValue());
+    }
+  }
+  return values;
+}
+
+// Get the kind of argument runtimes set: an image, sampler or pipe object, a
+// pointer to a buffer, a size of Workgroup memory, or a value
+static StringRef getArgKind(const Argument &A, StorageClass::StorageClass sc) {
+  auto *PT = dyn_cast<PointerType>(A.getType());
+  if (!PT) {
+    return "value";
+  }
+  if (A.hasByValAttr()) {
+    return "value";
+  }
+  if (auto *ST = dyn_cast<StructType>(PT->getElementType())) {
+    if (ST->hasName()) {
+      const StringRef name = ST->getName();
+      if (name.startswith("opencl.image")) {
+        return "image";
+      }
+      if (name.startswith("opencl.sampler")) {
+        return "sampler";
+      }
+      if (name.startswith("opencl.pipe")) {
+        return "pipe";
+      }
+    }
+  }
+  return sc == StorageClass::Workgroup ? "local" : "buffer";
+}
+
+static void writeKernel(json::OStream &J, const Function &F,
+                        SPIRVTypeRegistry &TR) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  J.attribute("name", F.getName());
+  J.attributeArray("args", [&] {
+    for (const Argument &A : F.args()) {
+      const unsigned argNo = A.getArgNo();
+      auto *PT = dyn_cast<PointerType>(A.getType());
+      const auto sc = PT ? TR.addressSpaceToStorageClass(PT->getAddressSpace())
+                         : StorageClass::Function;
+      const StringRef kind = getArgKind(A, sc);
+      J.object([&] {
+        StringRef name = getArgMetadataString(F, "kernel_arg_name", argNo);
+        J.attribute("name", name.empty() ? A.getName() : name);
+        J.attribute("kind", kind);
+        if (PT && !A.hasByValAttr()) {
+          J.attribute("storage_class", getStorageClassName(sc));
+        }
+        // The bytes the runtime passes for the argument
+        Type *valueTy = A.hasByValAttr() ? A.getParamByValType() : A.getType();
+        J.attribute("size", DL.getTypeAllocSize(valueTy));
+        for (const char *mdKind :
+             {"kernel_arg_type", "kernel_arg_base_type", "kernel_arg_type_qual",
+              "kernel_arg_access_qual"}) {
+          const StringRef value = getArgMetadataString(F, mdKind, argNo);
+          if (!value.empty() && value != "none") {
+            J.attribute(StringRef(mdKind).drop_front(strlen("kernel_arg_")),
+                        value);
+          }
+        }
+      });
+    }
+  });
+  for (const char *mdKind : {"reqd_work_group_size", "work_group_size_hint"}) {
+    if (const MDNode *node = F.getMetadata(mdKind)) {
+      auto sizes = getMDOperandsAsUInts(node);
+      sizes.resize(3, 1);
+      J.attributeArray(mdKind, [&] {
+        for (uint64_t size : sizes) {
+          J.value(size);
+        }
+      });
+    }
+  }
+  if (const MDNode *node = F.getMetadata("intel_reqd_sub_group_size")) {
+    auto size = getMDOperandsAsUInts(node);
+    if (!size.empty()) {
+      J.attribute("reqd_sub_group_size", size[0]);
+    }
+  }
+  // SPIRVLocalMemoryLayout sums the Workgroup variables of the call graph
+  if (const MDNode *N = F.getMetadata("spirv.workgroup_memory_size")) {
+    auto *size = mdconst::extract<ConstantInt>(N->getOperand(0));
+    J.attribute("local_bytes", size->getZExtValue());
+  }
+}
+
+// The calls to llvm.spirv.spec.constant with the same SpecId are the same
+// specialization constant
+static void writeSpecConstants(json::OStream &J, const Module &M) {
+  SmallSet<uint64_t, 8> seen;
+  J.attributeArray("spec_constants", [&] {
+    for (const Function &F : M) {
+      if (F.getIntrinsicID() != Intrinsic::spirv_spec_constant) {
+        continue;
+      }
+      for (const User *U : F.users()) {
+        const auto *CI = dyn_cast<CallInst>(U);
+        if (!CI || CI->getCalledFunction() != &F) {
+          continue;
+        }
+        const uint64_t id =
+            cast<ConstantInt>(CI->getArgOperand(0))->getZExtValue();
+        if (!seen.insert(id).second) {
+          continue;
+        }
+        const Value *defaultVal = CI->getArgOperand(1);
+        J.object([&] {
+          J.attribute("id", id);
+          J.attribute("size", M.getDataLayout().getTypeStoreSize(
+                                  defaultVal->getType()));
+          if (const auto *C = dyn_cast<ConstantInt>(defaultVal)) {
+            J.attribute("default", C->getSExtValue());
+          } else if (const auto *C = dyn_cast<ConstantFP>(defaultVal)) {
+            J.attribute("default", C->getValueAPF().convertToDouble());
+          }
+        });
+      }
+    }
+  });
+}
+
+bool SPIRVKernelReflection::runOnModule(Module &M) {
+  if (ReflectionFile.empty()) {
+    return false;
+  }
+  std::error_code EC;
+  raw_fd_ostream out(ReflectionFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    report_fatal_error("Can't open the SPIR-V reflection file " +
+                       ReflectionFile + ": " + EC.message());
+  }
+
+  const auto &TM = static_cast<const SPIRVTargetMachine &>(
+      getAnalysis<MachineModuleInfo>().getTarget());
+  SPIRVTypeRegistry &TR = *TM.getSubtargetImpl()->getSPIRVTypeRegistry();
+  json::OStream J(out, 2);
+  J.object([&] {
+    J.attribute("module", M.getModuleIdentifier());
+    J.attributeArray("kernels", [&] {
+      for (const Function &F : M) {
+        if (F.isDeclaration() ||
+            F.getCallingConv() != CallingConv::SPIR_KERNEL) {
+          continue;
+        }
+        J.object([&] { writeKernel(J, F, TR); });
+      }
+    });
+    writeSpecConstants(J, M);
+  });
+  out << '\n';
+  return false;
+}
+
+INITIALIZE_PASS(SPIRVKernelReflection, DEBUG_TYPE,
+                "SPIRV write kernel reflection", false, true)
+
+char SPIRVKernelReflection::ID = 0;
+
+ModulePass *llvm::createSPIRVKernelReflectionPass() {
+  return new SPIRVKernelReflection();
+}
@@ -0,0 +1,306 @@
+//===-- SPIRVKernelResourceReport.cpp - Report kernel costs -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// With -spirv-kernel-report, write a static estimate of the cost of each kernel
+// to the given file as JSON, for schedulers to use before dispatching them.
+// Each kernel gets the number of memory accesses to each storage class,
+// atomics, barriers, transcendental extended instructions and calls in its
+// body, the bytes of its Function storage variables and of the Workgroup ones
+// it and its callees use, and the width of the widest vector it computes.
+//
+// This runs over the selected MIR right before SPIRVGlobalTypesAndRegNum, while
+// types are still defined in each function, so the types of values can be
+// found through their definitions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVExtInsts.h"
+#include "SPIRVSubtarget.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/TargetInstrInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-kernel-report"
+
+static cl::opt<std::string> KernelReportFile(
+    "spirv-kernel-report", cl::Hidden, cl::value_desc("filename"),
+    cl::desc("Write the instruction mix and resource usage of each kernel, as "
+             "JSON, to the given file"));
+
+namespace {
+struct KernelResources {
+  unsigned globalMemoryOps = 0;
+  unsigned localMemoryOps = 0;
+  unsigned genericMemoryOps = 0;
+  unsigned atomics = 0;
+  unsigned barriers = 0;
+  unsigned transcendentals = 0;
+  unsigned calls = 0;
+  uint64_t privateBytes = 0;
+  uint64_t localBytes = 0;
+  uint64_t maxVectorBits = 0;
+};
+
+struct SPIRVKernelResourceReport : public ModulePass {
+  static char ID;
+  SPIRVKernelResourceReport() : ModulePass(ID) {
+    initializeSPIRVKernelResourceReportPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<MachineModuleInfo>();
+    AU.setPreservesAll();
+  }
+};
+} // namespace
+
+// Get the definition of the SPIR-V type of vreg, i.e. the type operand of the
+// instruction defining it, or nullptr for instructions without a result type.
+static const MachineInstr *getTypeDef(const MachineRegisterInfo &MRI,
+                                      Register vreg) {
+  const MachineInstr *def = MRI.getVRegDef(vreg);
+  if (!def || def->getNumOperands() < 2 || !def->getOperand(1).isReg()) {
+    return nullptr;
+  }
+  return MRI.getVRegDef(def->getOperand(1).getReg());
+}
+
+static Optional<StorageClass::StorageClass>
+getStorageClass(const MachineRegisterInfo &MRI, Register ptr) {
+  const MachineInstr *typeDef = getTypeDef(MRI, ptr);
+  if (!typeDef || typeDef->getOpcode() != SPIRV::OpTypePointer) {
+    return None;
+  }
+  return static_cast<StorageClass::StorageClass>(
+      typeDef->getOperand(1).getImm());
+}
+
+// Get the number of bytes a value of the given type takes, not counting the
+// padding between struct members. 3 element vectors take as much as 4 element
+// ones, as in OpenCL.
+static uint64_t getTypeSize(const MachineRegisterInfo &MRI,
+                            const MachineInstr *typeDef, unsigned pointerSize) {
+  if (!typeDef) {
+    return 0;
+  }
+  auto getOperandTypeSize = [&](unsigned i) {
+    return getTypeSize(MRI, MRI.getVRegDef(typeDef->getOperand(i).getReg()),
+                       pointerSize);
+  };
+  switch (typeDef->getOpcode()) {
+  case SPIRV::OpTypeBool:
+    return 1;
+  case SPIRV::OpTypeInt:
+  case SPIRV::OpTypeFloat:
+    return typeDef->getOperand(1).getImm() / 8;
+  case SPIRV::OpTypePointer:
+    return pointerSize / 8;
+  case SPIRV::OpTypeVector: {
+    uint64_t numElems = typeDef->getOperand(2).getImm();
+    return getOperandTypeSize(1) * (numElems == 3 ? 4 : numElems);
+  }
+  case SPIRV::OpTypeArray: {
+    const MachineInstr *len = MRI.getVRegDef(typeDef->getOperand(2).getReg());
+    if (!len || len->getOpcode() != SPIRV::OpConstant ||
+        !len->getOperand(2).isImm()) {
+      return 0;
+    }
+    return getOperandTypeSize(1) * len->getOperand(2).getImm();
+  }
+  case SPIRV::OpTypeStruct: {
+    uint64_t size = 0;
+    for (unsigned i = 1; i < typeDef->getNumOperands(); ++i) {
+      size += getOperandTypeSize(i);
+    }
+    return size;
+  }
+  default:
+    return 0;
+  }
+}
+
+// Whether the extended instruction computes a transcendental function, which
+// is typically much slower than arithmetic, e.g. in special function units.
+static bool isTranscendental(ExtInstSet set, uint32_t inst) {
+  StringRef name = getExtInstName(set, inst);
+  if (set == ExtInstSet::OpenCL_std) {
+    if (!name.consume_front("native_")) {
+      name.consume_front("half_");
+    }
+  } else if (set != ExtInstSet::GLSL_std_450) {
+    return false;
+  }
+  return StringSwitch<bool>(name.lower())
+      .Cases("sin", "cos", "tan", "sincos", "sinh", "cosh", "tanh", true)
+      .Cases("asin", "acos", "atan", "atan2", "asinh", "acosh", "atanh", true)
+      .Cases("sinpi", "cospi", "tanpi", "asinpi", "acospi", "atanpi", true)
+      .Cases("atan2pi", "exp", "exp2", "exp10", "expm1", "pow", "powr", true)
+      .Cases("pown", "rootn", "cbrt", "log", "log2", "log10", "log1p", true)
+      .Cases("erf", "erfc", "lgamma", "lgamma_r", "tgamma", true)
+      .Default(false);
+}
+
+static void countMemoryAccess(const MachineRegisterInfo &MRI, Register ptr,
+                              KernelResources &res) {
+  auto sc = getStorageClass(MRI, ptr);
+  if (!sc.hasValue()) {
+    return;
+  }
+  switch (*sc) {
+  case StorageClass::CrossWorkgroup:
+  case StorageClass::StorageBuffer:
+  case StorageClass::Uniform:
+  case StorageClass::UniformConstant:
+    ++res.globalMemoryOps;
+    break;
+  case StorageClass::Workgroup:
+    ++res.localMemoryOps;
+    break;
+  case StorageClass::Generic:
+    ++res.genericMemoryOps;
+    break;
+  default:
+    break;
+  }
+}
+
+static KernelResources getKernelResources(const MachineFunction &MF) {
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
+  const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+  const auto &ST = static_cast<const SPIRVSubtarget &>(MF.getSubtarget());
+  const unsigned pointerSize = ST.getPointerSize();
+
+  KernelResources res;
+  // SPIRVLocalMemoryLayout sums the Workgroup variables of the call graph
+  if (const MDNode *N =
+          MF.getFunction().getMetadata("spirv.workgroup_memory_size")) {
+    res.localBytes =
+        mdconst::extract<ConstantInt>(N->getOperand(0))->getZExtValue();
+  }
+  for (const MachineBasicBlock &MBB : MF) {
+    for (const MachineInstr &MI : MBB) {
+      const unsigned opcode = MI.getOpcode();
+      switch (opcode) {
+      case SPIRV::OpLoad:
+        countMemoryAccess(MRI, MI.getOperand(2).getReg(), res);
+        break;
+      case SPIRV::OpStore:
+        countMemoryAccess(MRI, MI.getOperand(0).getReg(), res);
+        break;
+      case SPIRV::OpCopyMemory:
+      case SPIRV::OpCopyMemorySized:
+        countMemoryAccess(MRI, MI.getOperand(0).getReg(), res);
+        countMemoryAccess(MRI, MI.getOperand(1).getReg(), res);
+        break;
+      case SPIRV::OpControlBarrier:
+      case SPIRV::OpMemoryBarrier:
+        ++res.barriers;
+        break;
+      case SPIRV::OpFunctionCall:
+        ++res.calls;
+        break;
+      case SPIRV::OpExtInst:
+        if (isTranscendental(ExtInstSet(MI.getOperand(2).getImm()),
+                             MI.getOperand(3).getImm())) {
+          ++res.transcendentals;
+        }
+        break;
+      case SPIRV::OpVariable:
+        if (MI.getOperand(2).getImm() == StorageClass::Function) {
+          const MachineInstr *ptrTy =
+              getTypeDef(MRI, MI.getOperand(0).getReg());
+          if (ptrTy && ptrTy->getOpcode() == SPIRV::OpTypePointer) {
+            const MachineInstr *pointeeTy =
+                MRI.getVRegDef(ptrTy->getOperand(2).getReg());
+            res.privateBytes += getTypeSize(MRI, pointeeTy, pointerSize);
+          }
+        }
+        break;
+      default:
+        if (TII.getName(opcode).startswith("OpAtomic")) {
+          ++res.atomics;
+        }
+        break;
+      }
+
+      // Only look at values, as the operands of types are types too
+      if (MI.getNumExplicitDefs() == 1 && MI.getOperand(0).isReg() &&
+          !TII.getName(opcode).startswith("OpType")) {
+        const MachineInstr *ty = getTypeDef(MRI, MI.getOperand(0).getReg());
+        if (ty && ty->getOpcode() == SPIRV::OpTypeVector) {
+          uint64_t bits = getTypeSize(MRI, ty, pointerSize) * 8;
+          res.maxVectorBits = std::max(res.maxVectorBits, bits);
+        }
+      }
+    }
+  }
+  return res;
+}
+
+bool SPIRVKernelResourceReport::runOnModule(Module &M) {
+  if (KernelReportFile.empty()) {
+    return false;
+  }
+  std::error_code EC;
+  raw_fd_ostream out(KernelReportFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    report_fatal_error("Can't open the SPIR-V kernel report " +
+                       KernelReportFile + ": " + EC.message());
+  }
+
+  MachineModuleInfo &MMI = getAnalysis<MachineModuleInfo>();
+  json::OStream J(out, 2);
+  J.object([&] {
+    J.attribute("module", M.getModuleIdentifier());
+    J.attributeArray("kernels", [&] {
+      for (const Function &F : M) {
+        const MachineFunction *MF = MMI.getMachineFunction(F);
+        if (!MF || F.getCallingConv() != CallingConv::SPIR_KERNEL) {
+          continue;
+        }
+        const KernelResources res = getKernelResources(*MF);
+        J.object([&] {
+          J.attribute("name", F.getName());
+          J.attribute("global_memory_ops", res.globalMemoryOps);
+          J.attribute("local_memory_ops", res.localMemoryOps);
+          J.attribute("generic_memory_ops", res.genericMemoryOps);
+          J.attribute("atomics", res.atomics);
+          J.attribute("barriers", res.barriers);
+          J.attribute("transcendentals", res.transcendentals);
+          J.attribute("calls", res.calls);
+          J.attribute("private_bytes", res.privateBytes);
+          J.attribute("local_bytes", res.localBytes);
+          J.attribute("max_vector_bits", res.maxVectorBits);
+        });
+      }
+    });
+  });
+  out << '\n';
+  return false;
+}
+
+INITIALIZE_PASS(SPIRVKernelResourceReport, DEBUG_TYPE,
+                "SPIRV report kernel resources", false, true)
+
+char SPIRVKernelResourceReport::ID = 0;
+
+ModulePass *llvm::createSPIRVKernelResourceReportPass() {
+  return new SPIRVKernelResourceReport();
+}
@@ -0,0 +1,139 @@
+//===-- SPIRVKernelSpecialization.cpp - Specialize kernel args --*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Clone a kernel for the values some of its arguments take at launch, e.g. the
+// sizes, strides and flags a JIT knows then, so the loops and branches they
+// control are folded away before instruction selection.
+//
+// The arguments given a value are dropped from the clone, along with their
+// entries in the kernel_arg_* metadata. Each use of one becomes the value
+// itself, and what that makes constant is folded, or, when the argument is
+// given a SpecId, an llvm.spirv.spec.constant defaulting to the value, so the
+// binary can still be specialized to other values when it's loaded.
+//
+// The clone is a new entry point, so compiling a module with it caches its
+// binary separately in the compilation cache, whose key hashes the module.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+
+#include "llvm/ADT/SmallBitVector.h"
+#include "llvm/Analysis/InstructionSimplify.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+
+// Drop the entries of the removed arguments from the kernel_arg_* metadata,
+// which has one per argument
+static void dropArgMetadata(Function &F, const Function &kernel,
+                            const SmallBitVector &removed) {
+  SmallVector<std::pair<unsigned, MDNode *>, 8> MDs;
+  F.getAllMetadata(MDs);
+  for (const auto &entry : MDs) {
+    MDNode *node = entry.second;
+    if (node->getNumOperands() != kernel.arg_size()) {
+      continue;
+    }
+    bool isArgMetadata = false;
+    for (StringRef name : {"kernel_arg_addr_space", "kernel_arg_access_qual",
+                           "kernel_arg_type", "kernel_arg_base_type",
+                           "kernel_arg_type_qual", "kernel_arg_name"}) {
+      isArgMetadata |= entry.first == F.getContext().getMDKindID(name);
+    }
+    if (!isArgMetadata) {
+      continue;
+    }
+    SmallVector<Metadata *, 8> kept;
+    for (unsigned i = 0; i < node->getNumOperands(); ++i) {
+      if (!removed[i]) {
+        kept.push_back(node->getOperand(i));
+      }
+    }
+    F.setMetadata(entry.first, MDNode::get(F.getContext(), kept));
+  }
+}
+
+// Fold the instructions made constant, and the branches on them, until
+// nothing changes
+static void foldConstants(Function &F) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    SmallVector<WeakTrackingVH, 64> instrs;
+    for (Instruction &I : instructions(F)) {
+      instrs.push_back(&I);
+    }
+    for (WeakTrackingVH &VH : instrs) {
+      if (auto *I = dyn_cast_or_null<Instruction>(VH)) {
+        changed |= recursivelySimplifyInstruction(I);
+      }
+    }
+    for (BasicBlock &BB : F) {
+      changed |= ConstantFoldTerminator(&BB, /*DeleteDeadConditions=*/true);
+    }
+    changed |= removeUnreachableBlocks(F);
+  }
+}
+
+Function *llvm::specializeSPIRVKernel(Function &Kernel,
+                                      ArrayRef<SPIRVSpecializedArg> Args,
+                                      StringRef Name) {
+  if (Kernel.isDeclaration() ||
+      Kernel.getCallingConv() != CallingConv::SPIR_KERNEL) {
+    return nullptr;
+  }
+  Module &M = *Kernel.getParent();
+  ValueToValueMapTy VMap;
+  SmallBitVector removed(Kernel.arg_size());
+  SmallVector<CallInst *, 4> specConstants;
+  for (const SPIRVSpecializedArg &arg : Args) {
+    if (arg.ArgNo >= Kernel.arg_size() || removed[arg.ArgNo]) {
+      return nullptr;
+    }
+    Argument *A = Kernel.getArg(arg.ArgNo);
+    Type *Ty = A->getType();
+    if (!arg.Value || arg.Value->getType() != Ty) {
+      return nullptr;
+    }
+    removed.set(arg.ArgNo);
+    if (!arg.SpecId.hasValue()) {
+      VMap[A] = arg.Value;
+      continue;
+    }
+    // Specialization constants are scalars, with a literal default value
+    if (!isa<ConstantInt>(arg.Value) && !isa<ConstantFP>(arg.Value)) {
+      return nullptr;
+    }
+    Function *decl =
+        Intrinsic::getDeclaration(&M, Intrinsic::spirv_spec_constant, {Ty});
+    Value *ops[] = {ConstantInt::get(Type::getInt32Ty(M.getContext()),
+                                     arg.SpecId.getValue()),
+                    arg.Value};
+    CallInst *CI = CallInst::Create(decl, ops, A->getName());
+    specConstants.push_back(CI);
+    VMap[A] = CI;
+  }
+
+  Function *F = CloneFunction(&Kernel, VMap);
+  F->setName(Name);
+  // The calls were only mapped to, so insert them once the body exists
+  Instruction *insertPt = &*F->getEntryBlock().getFirstInsertionPt();
+  for (CallInst *CI : specConstants) {
+    CI->insertBefore(insertPt);
+  }
+  dropArgMetadata(*F, Kernel, removed);
+  foldConstants(*F);
+  return F;
+}
@@ -11,7 +11,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "SPIRVLegalizerInfo.h"
+#include "SPIRV.h"
 #include "SPIRVSubtarget.h"
+#include "SPIRVTypeRegistry.h"
 #include "llvm/CodeGen/GlobalISel/LegalizerInfo.h"
 #include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
 #include "llvm/CodeGen/MachineInstr.h"
@@ -25,10 +27,62 @@ using namespace llvm;
 using namespace LegalizeActions;
 using namespace LegalityPredicates;
 
+// SPIR-V vectors have 2, 3 or 4 components, or 8 or 16 with the Vector16
+// capability.
+static bool isLegalNumElements(unsigned numElems) {
+  return numElems == 2 || numElems == 3 || numElems == 4 || numElems == 8 ||
+         numElems == 16;
+}
+
+// Whether the given type index is a vector with too many components, or a
+// number of components SPIR-V has no vector type for. Vectors with more than
+// maxElems components are too wide for the subtarget's vector width policy.
+static LegalityPredicate isIllegalVector(unsigned typeIdx, unsigned maxElems) {
+  return [=](const LegalityQuery &Query) {
+    const LLT ty = Query.Types[typeIdx];
+    return ty.isVector() && (!isLegalNumElements(ty.getNumElements()) ||
+                             ty.getNumElements() > maxElems);
+  };
+}
+
+// Split an illegal vector into the widest legal vectors of at most maxElems
+// components dividing it evenly, so the default legalizer splits it with
+// G_UNMERGE_VALUES and rebuilds it with G_CONCAT_VECTORS. Vectors with no such
+// divisor, like v5, are scalarized.
+static LegalizeMutation splitIllegalVector(unsigned typeIdx,
+                                           unsigned maxElems) {
+  return [=](const LegalityQuery &Query) {
+    const LLT ty = Query.Types[typeIdx];
+    for (unsigned numElems : {16, 8, 4, 3, 2}) {
+      if (numElems < ty.getNumElements() && numElems <= maxElems &&
+          ty.getNumElements() % numElems == 0) {
+        return std::make_pair(typeIdx,
+                              LLT::vector(numElems, ty.getElementType()));
+      }
+    }
+    return std::make_pair(typeIdx, ty.getElementType());
+  };
+}
+
+// The default legalizer only splits conversions between vectors correctly if
+// they're fully scalarized.
+static LegalizeMutation scalarizeIllegalVector(unsigned typeIdx) {
+  return [=](const LegalityQuery &Query) {
+    return std::make_pair(typeIdx, Query.Types[typeIdx].getElementType());
+  };
+}
+
 SPIRVLegalizerInfo::SPIRVLegalizerInfo(const SPIRVSubtarget &ST) {
 
   using namespace TargetOpcode;
 
+  // Vectors wider than the subtarget's policy are split before the legal
+  // types are checked, so each rule set starts with its fewerElementsIf
+  const unsigned maxElems = ST.getMaxVectorElements();
+  const LegalityPredicate illegalVector = isIllegalVector(0, maxElems);
+  const LegalizeMutation splitVector = splitIllegalVector(0, maxElems);
+  const LegalizeMutation scalarizeVector = scalarizeIllegalVector(0);
+
   const LLT s1 = LLT::scalar(1);
   const LLT s8 = LLT::scalar(8);
   const LLT s16 = LLT::scalar(16);
@@ -116,30 +170,41 @@ SPIRVLegalizerInfo::SPIRVLegalizerInfo(const SPIRVSubtarget &ST) {
 
   getActionDefinitionsBuilder(
       {G_ADD, G_SUB, G_MUL, G_SDIV, G_UDIV, G_SREM, G_UREM})
+      .fewerElementsIf(illegalVector, splitVector)
       .legalFor(allIntScalarsAndVectors);
 
   getActionDefinitionsBuilder({G_SHL, G_LSHR, G_ASHR})
+      .fewerElementsIf(illegalVector, splitVector)
       .legalForCartesianProduct(allIntScalarsAndVectors,
                                 allIntScalarsAndVectors);
 
   getActionDefinitionsBuilder({G_AND, G_OR, G_XOR})
+      .fewerElementsIf(illegalVector, splitVector)
       .legalFor(allScalarsAndVectors);
 
   getActionDefinitionsBuilder(
       {G_FADD, G_FSUB, G_FMA, G_FMUL, G_FDIV, G_FREM, G_FNEG})
+      .fewerElementsIf(illegalVector, splitVector)
       .legalFor(allFloatScalarsAndVectors);
 
   getActionDefinitionsBuilder({G_FPTOSI, G_FPTOUI})
+      .fewerElementsIf(illegalVector, scalarizeVector)
       .legalForCartesianProduct(allIntScalarsAndVectors,
                                 allFloatScalarsAndVectors);
 
   getActionDefinitionsBuilder({G_SITOFP, G_UITOFP})
+      .fewerElementsIf(illegalVector, scalarizeVector)
       .legalForCartesianProduct(allFloatScalarsAndVectors,
                                 allIntScalarsAndVectors);
 
   getActionDefinitionsBuilder({G_SMIN, G_SMAX, G_UMIN, G_UMAX})
+      .fewerElementsIf(illegalVector, splitVector)
       .legalFor(allIntScalarsAndVectors);
 
+  // Selected to OpenCL.std's mul_hi, or the high half of OpUMulExtended and
+  // OpSMulExtended, whose struct results can't easily be legalized
+  getActionDefinitionsBuilder({G_SMULH, G_UMULH}).alwaysLegal();
+
   getActionDefinitionsBuilder(G_CTPOP).legalForCartesianProduct(
       allIntScalarsAndVectors, allIntScalarsAndVectors);
 
@@ -166,6 +231,34 @@ SPIRVLegalizerInfo::SPIRVLegalizerInfo(const SPIRVSubtarget &ST) {
                      return Query.Types[1].getElementType() == Query.Types[0];
                    }))));
 
+  // These also rebuild the illegal vectors split below, which exist in the IR
+  getActionDefinitionsBuilder(G_BUILD_VECTOR)
+      .legalIf(all(typeInSet(1, allScalars),
+                   LegalityPredicate([=](const LegalityQuery &Query) {
+                     return Query.Types[0].isVector() &&
+                            Query.Types[0].getElementType() == Query.Types[1];
+                   })));
+
+  getActionDefinitionsBuilder(G_CONCAT_VECTORS)
+      .legalIf(all(typeInSet(1, allVectors),
+                   LegalityPredicate([=](const LegalityQuery &Query) {
+                     return Query.Types[0].isVector() &&
+                            Query.Types[0].getElementType() ==
+                                Query.Types[1].getElementType();
+                   })));
+
+  getActionDefinitionsBuilder(G_UNMERGE_VALUES)
+      .legalIf(LegalityPredicate([=](const LegalityQuery &Query) {
+        const LLT partTy = Query.Types[0];
+        const LLT vecTy = Query.Types[1];
+        if (!vecTy.isVector())
+          return false;
+        if (!partTy.isVector())
+          return partTy == vecTy.getElementType();
+        return isLegalNumElements(partTy.getNumElements()) &&
+               partTy.getElementType() == vecTy.getElementType();
+      }));
+
   getActionDefinitionsBuilder(G_IMPLICIT_DEF).alwaysLegal();
 
   getActionDefinitionsBuilder(G_INTTOPTR)
@@ -222,10 +315,12 @@ SPIRVLegalizerInfo::SPIRVLegalizerInfo(const SPIRVSubtarget &ST) {
 
   // Extensions
   getActionDefinitionsBuilder({G_TRUNC, G_ZEXT, G_SEXT, G_ANYEXT})
+      .fewerElementsIf(illegalVector, scalarizeVector)
       .legalForCartesianProduct(allScalarsAndVectors);
 
   // FP conversions
   getActionDefinitionsBuilder({G_FPTRUNC, G_FPEXT})
+      .fewerElementsIf(illegalVector, scalarizeVector)
       .legalForCartesianProduct(allFloatScalarsAndVectors);
 
   // Select
@@ -243,20 +338,146 @@ SPIRVLegalizerInfo::SPIRVLegalizerInfo(const SPIRVSubtarget &ST) {
                                G_FMINNUM, G_FMAXNUM, G_FCEIL, G_FCOS, G_FSIN,
                                G_FSQRT, G_FFLOOR, G_FRINT, G_FNEARBYINT,
                                G_INTRINSIC_ROUND, G_INTRINSIC_TRUNC})
+      .fewerElementsIf(illegalVector, splitVector)
       .legalFor(allFloatScalarsAndVectors);
 
   if (ST.canUseExtInstSet(ExtInstSet::OpenCL_std)) {
-    getActionDefinitionsBuilder(G_FLOG10).legalFor(allFloatScalarsAndVectors);
+    getActionDefinitionsBuilder({G_FLOG10, G_FCOPYSIGN})
+        .legalFor(allFloatScalarsAndVectors);
 
     getActionDefinitionsBuilder(
         {G_CTTZ, G_CTTZ_ZERO_UNDEF, G_CTLZ, G_CTLZ_ZERO_UNDEF})
         .legalForCartesianProduct(allIntScalarsAndVectors,
                                   allIntScalarsAndVectors);
-
-    // Struct return types become a single scalar, so cannot easily legalize
-    getActionDefinitionsBuilder({G_SMULH, G_UMULH}).alwaysLegal();
   }
 
   computeTables();
   verify(*ST.getInstrInfo());
 }
+
+// Get the scalar type of a SPIR-V scalar or vector type.
+static SPIRVType *getComponentType(SPIRVType *type,
+                                   const MachineRegisterInfo &MRI) {
+  if (type->getOpcode() == SPIRV::OpTypeVector)
+    return MRI.getVRegDef(type->getOperand(1).getReg());
+  return type;
+}
+
+static unsigned getScalarBitWidth(const SPIRVType *type) {
+  switch (type->getOpcode()) {
+  case SPIRV::OpTypeBool:
+    return 1;
+  case SPIRV::OpTypeInt:
+  case SPIRV::OpTypeFloat:
+    return type->getOperand(1).getImm();
+  default:
+    return 0;
+  }
+}
+
+static bool isConversion(unsigned opcode) {
+  switch (opcode) {
+  case TargetOpcode::G_BITCAST:
+  case TargetOpcode::G_FPTOSI:
+  case TargetOpcode::G_FPTOUI:
+  case TargetOpcode::G_SITOFP:
+  case TargetOpcode::G_UITOFP:
+  case TargetOpcode::G_INTTOPTR:
+  case TargetOpcode::G_PTRTOINT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Infer the SPIR-V type of a vreg created by the legalizer from the vector it
+// was split from, the vector it is rebuilt into, or the other operands of an
+// instruction computing the same kind of value. Returns nullptr if none of
+// them have a type yet.
+static SPIRVType *inferVRegType(Register reg, const MachineInstr &def,
+                                SPIRVTypeRegistry &TR,
+                                MachineIRBuilder &MIRBuilder) {
+  const MachineRegisterInfo &MRI = *MIRBuilder.getMRI();
+  const LLT ty = MRI.getType(reg);
+
+  SmallVector<Register, 8> related;
+  if (def.getOpcode() == TargetOpcode::G_UNMERGE_VALUES)
+    related.push_back(def.getOperand(def.getNumOperands() - 1).getReg());
+  for (const auto &use : MRI.use_nodbg_instructions(reg)) {
+    switch (use.getOpcode()) {
+    case TargetOpcode::G_BUILD_VECTOR:
+    case TargetOpcode::G_CONCAT_VECTORS:
+      related.push_back(use.getOperand(0).getReg());
+      break;
+    case TargetOpcode::G_UNMERGE_VALUES:
+      for (const auto &op : use.defs())
+        related.push_back(op.getReg());
+      break;
+    }
+  }
+  if (!isConversion(def.getOpcode())) {
+    for (const auto &op : def.uses()) {
+      if (op.isReg() && MRI.getType(op.getReg()) == ty)
+        related.push_back(op.getReg());
+    }
+  }
+
+  for (Register relatedReg : related) {
+    SPIRVType *relatedTy = TR.getSPIRVTypeForVReg(relatedReg);
+    if (!relatedTy)
+      continue;
+    if (ty.isPointer()) {
+      if (MRI.getType(relatedReg) == ty)
+        return relatedTy;
+      continue;
+    }
+    SPIRVType *componentTy = getComponentType(relatedTy, MRI);
+    if (getScalarBitWidth(componentTy) != ty.getScalarSizeInBits())
+      continue;
+    if (!ty.isVector())
+      return componentTy;
+    return TR.getOpTypeVector(ty.getNumElements(), componentTy, MIRBuilder);
+  }
+  return nullptr;
+}
+
+void llvm::assignLegalizedVRegTypes(MachineFunction &MF, SPIRVTypeRegistry &TR,
+                                    unsigned firstNewVRegIdx) {
+  MachineIRBuilder MIRBuilder(MF);
+
+  SmallVector<std::pair<MachineInstr *, Register>, 8> untyped;
+  for (auto &MBB : MF) {
+    for (auto &MI : MBB) {
+      if (!isPreISelGenericOpcode(MI.getOpcode()))
+        continue;
+      for (const auto &def : MI.defs()) {
+        Register reg = def.getReg();
+        if (Register::virtReg2Index(reg) >= firstNewVRegIdx &&
+            !TR.hasSPIRVTypeForVReg(reg))
+          untyped.push_back({&MI, reg});
+      }
+    }
+  }
+
+  // The parts of a split vector may only be typed from each other, so keep
+  // going while new types are found
+  unsigned numUntyped = 0;
+  while (!untyped.empty() && untyped.size() != numUntyped) {
+    numUntyped = untyped.size();
+    SmallVector<std::pair<MachineInstr *, Register>, 8> stillUntyped;
+    for (const auto &instrAndReg : untyped) {
+      MachineInstr *MI = instrAndReg.first;
+      Register reg = instrAndReg.second;
+      MIRBuilder.setInsertPt(*MI->getParent(), ++MI->getIterator());
+      if (SPIRVType *type = inferVRegType(reg, *MI, TR, MIRBuilder))
+        TR.assignSPIRVTypeToVReg(type, reg, MIRBuilder);
+      else
+        stillUntyped.push_back(instrAndReg);
+    }
+    untyped = std::move(stillUntyped);
+  }
+  if (!untyped.empty()) {
+    errs() << *untyped.front().first;
+    report_fatal_error("Unable to infer the SPIR-V type of a legalized vreg");
+  }
+}
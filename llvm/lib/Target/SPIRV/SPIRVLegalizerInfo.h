@@ -18,12 +18,20 @@
 namespace llvm {
 
 class LLVMContext;
+class MachineFunction;
 class SPIRVSubtarget;
+class SPIRVTypeRegistry;
 
 // This class provides the information for legalizing SPIR-V instructions.
 class SPIRVLegalizerInfo : public LegalizerInfo {
 public:
   SPIRVLegalizerInfo(const SPIRVSubtarget &ST);
 };
+
+// Give a SPIR-V type to every vreg the legalizer created when splitting an
+// illegal vector, which only has an LLT. These are the vregs with an index of
+// at least firstNewVRegIdx.
+void assignLegalizedVRegTypes(MachineFunction &MF, SPIRVTypeRegistry &TR,
+                              unsigned firstNewVRegIdx);
 } // namespace llvm
 #endif
@@ -0,0 +1,258 @@
+//===-- SPIRVLocalMemoryLayout.cpp - Lay out Workgroup memory --*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Compute the Workgroup memory each kernel uses, as the local memory a work
+// group takes decides how many fit on a compute unit. The variables a kernel
+// uses are the ones its body or any function it calls, directly or not, refers
+// to. Local pointer arguments are sized when the kernel is enqueued, so they
+// aren't counted.
+//
+// With physical addressing and optimizations enabled, the Workgroup variables
+// only one kernel uses are first packed into a single struct variable, by
+// decreasing alignment so there's no padding between them, rather than left
+// for the driver to place one by one.
+//
+// Each kernel gets its total as spirv.workgroup_memory_size metadata, which
+// -spirv-kernel-report includes as local_bytes, and an analysis remark, e.g.
+// for -pass-remarks-analysis=spirv-local-memory-layout.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-local-memory-layout"
+
+STATISTIC(NumPackedVariables, "Number of Workgroup variables packed together");
+
+namespace {
+class SPIRVLocalMemoryLayout : public ModulePass {
+public:
+  static char ID;
+  SPIRVLocalMemoryLayout() : ModulePass(ID) {
+    initializeSPIRVLocalMemoryLayoutPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    ModulePass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+// Add the functions with instructions using V, looking through constants
+static void addUsingFunctions(const Value *V,
+                              SmallPtrSetImpl<const Function *> &functions) {
+  for (const User *U : V->users()) {
+    if (const auto *I = dyn_cast<Instruction>(U)) {
+      functions.insert(I->getFunction());
+    } else if (isa<Constant>(U) && !isa<GlobalValue>(U)) {
+      addUsingFunctions(U, functions);
+    }
+  }
+}
+
+// Get the functions F calls, directly or not, including F itself
+static SmallPtrSet<const Function *, 8> getCallGraph(const Function &F) {
+  SmallPtrSet<const Function *, 8> reached;
+  SmallVector<const Function *, 8> worklist = {&F};
+  while (!worklist.empty()) {
+    const Function *cur = worklist.pop_back_val();
+    if (!reached.insert(cur).second) {
+      continue;
+    }
+    for (const Instruction &I : instructions(cur)) {
+      if (const auto *CB = dyn_cast<CallBase>(&I)) {
+        if (const Function *callee = CB->getCalledFunction()) {
+          worklist.push_back(callee);
+        }
+      }
+    }
+  }
+  return reached;
+}
+
+static unsigned getAlignment(const GlobalVariable &GV, const DataLayout &DL) {
+  return DL.getPreferredAlignment(&GV);
+}
+
+// Order the variables by decreasing alignment, so none needs padding before it
+static void sortForPacking(SmallVectorImpl<GlobalVariable *> &vars,
+                           const DataLayout &DL) {
+  std::stable_sort(vars.begin(), vars.end(),
+                   [&](const GlobalVariable *a, const GlobalVariable *b) {
+                     return getAlignment(*a, DL) > getAlignment(*b, DL);
+                   });
+}
+
+// Get the bytes the variables take when laid out one after the other
+static uint64_t getLayoutSize(ArrayRef<GlobalVariable *> vars,
+                              const DataLayout &DL) {
+  uint64_t size = 0;
+  for (const GlobalVariable *GV : vars) {
+    size = alignTo(size, getAlignment(*GV, DL)) +
+           DL.getTypeAllocSize(GV->getValueType());
+  }
+  return size;
+}
+
+// Whether the variable can be moved into a struct with others, i.e. it has no
+// linkage, no initial value, and isn't aligned beyond its type's alignment
+static bool canPack(const GlobalVariable &GV, const DataLayout &DL) {
+  return GV.hasLocalLinkage() && GV.hasInitializer() &&
+         isa<UndefValue>(GV.getInitializer()) &&
+         !GV.isExternallyInitialized() && !GV.isThreadLocal() &&
+         GV.getAlignment() <= DL.getABITypeAlignment(GV.getValueType());
+}
+
+// Replace the variables with the members of a single struct variable
+static void pack(Module &M, StringRef kernelName,
+                 SmallVectorImpl<GlobalVariable *> &vars,
+                 const DataLayout &DL) {
+  sortForPacking(vars, DL);
+  SmallVector<Type *, 8> memberTys;
+  unsigned align = 1;
+  for (const GlobalVariable *GV : vars) {
+    memberTys.push_back(GV->getValueType());
+    align = std::max(align, getAlignment(*GV, DL));
+  }
+  auto *structTy = StructType::create(M.getContext(), memberTys,
+                                      (kernelName + ".local").str());
+  auto *packed = new GlobalVariable(
+      M, structTy, false, GlobalValue::InternalLinkage,
+      UndefValue::get(structTy), kernelName + ".local", nullptr,
+      GlobalValue::NotThreadLocal, vars.front()->getAddressSpace());
+  packed->setAlignment(align);
+
+  Type *i32Ty = Type::getInt32Ty(M.getContext());
+  for (unsigned i = 0; i < vars.size(); ++i) {
+    Constant *indices[] = {ConstantInt::get(i32Ty, 0),
+                           ConstantInt::get(i32Ty, i)};
+    Constant *member =
+        ConstantExpr::getInBoundsGetElementPtr(structTy, packed, indices);
+    vars[i]->replaceAllUsesWith(member);
+    vars[i]->eraseFromParent();
+  }
+  NumPackedVariables += vars.size();
+}
+
+bool SPIRVLocalMemoryLayout::runOnModule(Module &M) {
+  const auto &TPC = getAnalysis<TargetPassConfig>();
+  const auto &TM = TPC.getTM<SPIRVTargetMachine>();
+  const SPIRVSubtarget &ST = *TM.getSubtargetImpl();
+  const unsigned workgroupAS =
+      ST.getSPIRVTypeRegistry()->StorageClassToAddressSpace(
+          StorageClass::Workgroup);
+  const DataLayout &DL = M.getDataLayout();
+
+  SmallVector<const Function *, 8> kernels;
+  DenseMap<const Function *, SmallPtrSet<const Function *, 8>> callGraphs;
+  for (const Function &F : M) {
+    if (!F.isDeclaration() && F.getCallingConv() == CallingConv::SPIR_KERNEL) {
+      kernels.push_back(&F);
+      callGraphs[&F] = getCallGraph(F);
+    }
+  }
+  if (kernels.empty()) {
+    return false;
+  }
+
+  // Find the kernels using each Workgroup variable
+  auto getUsingKernels = [&](const GlobalVariable &GV) {
+    SmallPtrSet<const Function *, 8> users;
+    addUsingFunctions(&GV, users);
+    SmallVector<const Function *, 4> usingKernels;
+    for (const Function *K : kernels) {
+      if (any_of(users, [&](const Function *F) {
+            return callGraphs[K].count(F);
+          })) {
+        usingKernels.push_back(K);
+      }
+    }
+    return usingKernels;
+  };
+
+  bool changed = false;
+  if (!ST.isLogicalAddressing() && !skipModule(M) &&
+      TPC.getOptLevel() != CodeGenOpt::None) {
+    MapVector<const Function *, SmallVector<GlobalVariable *, 8>> packable;
+    for (GlobalVariable &GV : M.globals()) {
+      if (GV.getAddressSpace() != workgroupAS || !canPack(GV, DL)) {
+        continue;
+      }
+      auto usingKernels = getUsingKernels(GV);
+      if (usingKernels.size() == 1) {
+        packable[usingKernels.front()].push_back(&GV);
+      }
+    }
+    for (auto &kernelVars : packable) {
+      if (kernelVars.second.size() > 1) {
+        pack(M, kernelVars.first->getName(), kernelVars.second, DL);
+        changed = true;
+      }
+    }
+  }
+
+  DenseMap<const Function *, SmallVector<GlobalVariable *, 8>> kernelVars;
+  for (GlobalVariable &GV : M.globals()) {
+    if (GV.getAddressSpace() == workgroupAS) {
+      for (const Function *K : getUsingKernels(GV)) {
+        kernelVars[K].push_back(&GV);
+      }
+    }
+  }
+  for (const Function *K : kernels) {
+    auto &vars = kernelVars[K];
+    sortForPacking(vars, DL);
+    const uint64_t size = getLayoutSize(vars, DL);
+
+    Function &F = const_cast<Function &>(*K);
+    LLVMContext &ctx = F.getContext();
+    F.setMetadata("spirv.workgroup_memory_size",
+                  MDNode::get(ctx, ConstantAsMetadata::get(ConstantInt::get(
+                                       Type::getInt64Ty(ctx), size))));
+    OptimizationRemarkEmitter ORE(&F);
+    ORE.emit([&]() {
+      return OptimizationRemarkAnalysis(DEBUG_TYPE, "WorkgroupMemory",
+                                        F.getSubprogram(), &F.getEntryBlock())
+             << ore::NV("Function", &F) << " uses "
+             << ore::NV("WorkgroupBytes", size)
+             << " bytes of Workgroup memory in "
+             << ore::NV("NumVariables", static_cast<unsigned>(vars.size()))
+             << " variables";
+    });
+    changed = true;
+  }
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVLocalMemoryLayout, DEBUG_TYPE,
+                      "SPIRV lay out and report Workgroup memory", false,
+                      false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_END(SPIRVLocalMemoryLayout, DEBUG_TYPE,
+                    "SPIRV lay out and report Workgroup memory", false, false)
+
+char SPIRVLocalMemoryLayout::ID = 0;
+
+ModulePass *llvm::createSPIRVLocalMemoryLayoutPass() {
+  return new SPIRVLocalMemoryLayout();
+}
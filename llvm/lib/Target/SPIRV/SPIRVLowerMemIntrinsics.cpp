@@ -0,0 +1,279 @@
+//===-- SPIRVLowerMemIntrinsics.cpp - Expand memory intrinsics --*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Expand the memory intrinsics which SPIRVIRTranslator can't lower to a single
+// OpCopyMemory or OpCopyMemorySized instruction into loops, before instruction
+// selection:
+// - memmove, as the SPIR-V copy instructions don't allow overlapping memory.
+// - memset, unless the value and length are constant and OpCopyMemorySized is
+//   available (the translator then copies from a constant fill buffer). Where
+//   the length and destination alignment allow it, the loop stores the value
+//   splatted into <N x i8> vectors, rather than single bytes.
+// - memcpy without the Addresses capability, unless it copies a whole object
+//   between pointers to the same type, as OpCopyMemory can do that.
+//
+// The OpenCL vloadn and vstoren builtins whose address is known to be aligned
+// to the whole vector are also replaced with a plain vector load or store, as
+// their OpenCL.std instructions only assume the components' alignment.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVOpenCLBIFs.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Transforms/Utils/LowerMemIntrinsics.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-lower-mem-intrinsics"
+
+STATISTIC(NumMemSetLoops, "Number of memsets expanded into store loops");
+STATISTIC(NumMemCpyLoops, "Number of memcpys and memmoves expanded into loops");
+STATISTIC(NumVectorLoadStores, "Number of aligned vloadns and vstorens");
+
+namespace {
+class SPIRVLowerMemIntrinsics : public FunctionPass {
+public:
+  static char ID;
+  SPIRVLowerMemIntrinsics() : FunctionPass(ID) {
+    initializeSPIRVLowerMemIntrinsicsPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.addRequired<TargetTransformInfoWrapperPass>();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+bool llvm::isSPIRVWholeObjectCopy(const MemCpyInst &MCI,
+                                  const DataLayout &DL) {
+  const auto *len = dyn_cast<ConstantInt>(MCI.getLength());
+  if (!len) {
+    return false;
+  }
+  auto dst = MCI.getRawDest()->stripPointerCastsSameRepresentation();
+  auto src = MCI.getRawSource()->stripPointerCastsSameRepresentation();
+  Type *elemTy = cast<PointerType>(dst->getType())->getElementType();
+  return elemTy == cast<PointerType>(src->getType())->getElementType() &&
+         elemTy->isSized() &&
+         DL.getTypeAllocSize(elemTy) == len->getZExtValue();
+}
+
+// Whether SPIRVIRTranslator can copy the memset's value from a constant. Non-
+// zero fills are built with OpConstantComposite, which must fit in 65535 words.
+static bool canMemSetFromConstant(const MemSetInst &MSI) {
+  const auto *val = dyn_cast<ConstantInt>(MSI.getValue());
+  const auto *len = dyn_cast<ConstantInt>(MSI.getLength());
+  if (!val || !len) {
+    return false;
+  }
+  uint64_t numBytes = len->getZExtValue();
+  return val->isZero() || (numBytes >= 2 && numBytes <= UINT16_MAX - 3);
+}
+
+// Expand a memset into a loop of stores. If the length is constant, each store
+// writes the widest <N x i8> vector splat of the value the length and the
+// destination's alignment allow.
+static void expandMemSetAsVectorLoop(MemSetInst *MSI,
+                                     const SPIRVSubtarget &ST) {
+  Value *len = MSI->getLength();
+  unsigned align = std::max(MSI->getDestAlignment(), 1u);
+  unsigned width = 1;
+  if (const auto *constLen = dyn_cast<ConstantInt>(len)) {
+    unsigned maxWidth = ST.getMaxVectorElements();
+    for (unsigned w = maxWidth; w > 1 && width == 1; w /= 2) {
+      if (w <= align && constLen->getZExtValue() % w == 0) {
+        width = w;
+      }
+    }
+  }
+
+  BasicBlock *origBB = MSI->getParent();
+  BasicBlock *exitBB = origBB->splitBasicBlock(MSI, "memset.exit");
+  BasicBlock *loopBB = BasicBlock::Create(MSI->getContext(), "memset.loop",
+                                          origBB->getParent(), exitBB);
+  origBB->getTerminator()->eraseFromParent();
+
+  // Count the stores, and skip the loop if there are none
+  IRBuilder<> builder(origBB);
+  Type *lenTy = len->getType();
+  Value *val = MSI->getValue();
+  Type *elemTy = val->getType();
+  if (width > 1) {
+    len = builder.CreateUDiv(len, ConstantInt::get(lenTy, width));
+    elemTy = VectorType::get(elemTy, width);
+    val = builder.CreateVectorSplat(width, val);
+  }
+  unsigned addrSpace = MSI->getDestAddressSpace();
+  Value *dst = builder.CreatePointerCast(MSI->getRawDest(),
+                                         PointerType::get(elemTy, addrSpace));
+  Value *zero = ConstantInt::get(lenTy, 0);
+  builder.CreateCondBr(builder.CreateICmpEQ(len, zero), exitBB, loopBB);
+
+  // Store to every element
+  IRBuilder<> loopBuilder(loopBB);
+  PHINode *index = loopBuilder.CreatePHI(lenTy, 2, "memset.index");
+  index->addIncoming(zero, origBB);
+  Value *ptr = loopBuilder.CreateInBoundsGEP(elemTy, dst, index);
+  loopBuilder.CreateAlignedStore(val, ptr, MinAlign(align, width),
+                                 MSI->isVolatile());
+  Value *next = loopBuilder.CreateAdd(index, ConstantInt::get(lenTy, 1));
+  index->addIncoming(next, loopBB);
+  loopBuilder.CreateCondBr(loopBuilder.CreateICmpULT(next, len), loopBB,
+                           exitBB);
+  MSI->eraseFromParent();
+}
+
+// Replace a call to vloadn(offset, p) or vstoren(data, offset, p) with a load
+// or store of the vector at p + offset * n, if that address is aligned enough
+// for the vector type. The translator then gives it an Aligned memory operand.
+static bool lowerAlignedVectorLoadStore(CallInst *CI, const DataLayout &DL) {
+  const Function *callee = CI->getCalledFunction();
+  if (!callee || !callee->isDeclaration()) {
+    return false;
+  }
+  auto builtin = parseOpenCLBuiltinName(callee->getName());
+  if (!builtin) {
+    return false;
+  }
+  StringRef name = builtin->name;
+  const bool isStore = name.consume_front("vstore");
+  unsigned n;
+  if ((!isStore && !name.consume_front("vload")) || name.getAsInteger(10, n)) {
+    return false;
+  }
+
+  const unsigned numArgs = isStore ? 3 : 2;
+  if (CI->getNumArgOperands() != numArgs) {
+    return false;
+  }
+  Value *offset = CI->getArgOperand(numArgs - 2);
+  Value *ptr = CI->getArgOperand(numArgs - 1);
+  Type *vecTy = isStore ? CI->getArgOperand(0)->getType() : CI->getType();
+  auto *ptrTy = dyn_cast<PointerType>(ptr->getType());
+  if (!ptrTy || !vecTy->isVectorTy() || vecTy->getVectorNumElements() != n ||
+      vecTy->getVectorElementType() != ptrTy->getElementType()) {
+    return false;
+  }
+
+  // Offsets are in whole vectors of n components, so unless the offset is
+  // constant, the address is only as aligned as the vector size allows.
+  uint64_t stride = n * DL.getTypeAllocSize(ptrTy->getElementType());
+  uint64_t align = ptr->getPointerAlignment(DL);
+  if (align == 0) {
+    return false;
+  }
+  if (const auto *constOffset = dyn_cast<ConstantInt>(offset)) {
+    if (!constOffset->isZero()) {
+      align = MinAlign(align, constOffset->getZExtValue() * stride);
+    }
+  } else {
+    align = MinAlign(align, stride);
+  }
+  if (align < DL.getABITypeAlignment(vecTy)) {
+    return false;
+  }
+
+  IRBuilder<> builder(CI);
+  Value *idx =
+      builder.CreateMul(offset, ConstantInt::get(offset->getType(), n));
+  Value *elemPtr = builder.CreateInBoundsGEP(ptrTy->getElementType(), ptr, idx);
+  Value *vecPtr = builder.CreatePointerCast(
+      elemPtr, PointerType::get(vecTy, ptrTy->getAddressSpace()));
+  if (isStore) {
+    builder.CreateAlignedStore(CI->getArgOperand(0), vecPtr, align);
+  } else {
+    CI->replaceAllUsesWith(builder.CreateAlignedLoad(vecTy, vecPtr, align));
+  }
+  CI->eraseFromParent();
+  return true;
+}
+
+bool SPIRVLowerMemIntrinsics::runOnFunction(Function &F) {
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  const SPIRVSubtarget &ST = *TM.getSubtargetImpl(F);
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  const bool hasCopySized = ST.canUseCapability(Capability::Addresses);
+
+  // Collect first, as expansion splits blocks
+  SmallVector<MemIntrinsic *, 4> toExpand;
+  SmallVector<CallInst *, 4> vectorLoadStores;
+  for (auto &I : instructions(F)) {
+    auto *MI = dyn_cast<MemIntrinsic>(&I);
+    if (!MI) {
+      if (auto *CI = dyn_cast<CallInst>(&I)) {
+        vectorLoadStores.push_back(CI);
+      }
+      continue;
+    }
+    if (isa<MemMoveInst>(MI)) {
+      toExpand.push_back(MI);
+    } else if (auto *MSI = dyn_cast<MemSetInst>(MI)) {
+      // The translator drops memsets of undef
+      if (!isa<UndefValue>(MSI->getValue()) &&
+          (!hasCopySized || !canMemSetFromConstant(*MSI))) {
+        toExpand.push_back(MI);
+      }
+    } else if (auto *MCI = dyn_cast<MemCpyInst>(MI)) {
+      if (!hasCopySized && !isSPIRVWholeObjectCopy(*MCI, DL)) {
+        toExpand.push_back(MI);
+      }
+    }
+  }
+
+  bool changed = !toExpand.empty();
+  for (CallInst *CI : vectorLoadStores) {
+    if (lowerAlignedVectorLoadStore(CI, DL)) {
+      ++NumVectorLoadStores;
+      changed = true;
+    }
+  }
+
+  for (MemIntrinsic *MI : toExpand) {
+    if (auto *MSI = dyn_cast<MemSetInst>(MI)) {
+      expandMemSetAsVectorLoop(MSI, ST);
+      ++NumMemSetLoops;
+    } else if (auto *MMI = dyn_cast<MemMoveInst>(MI)) {
+      expandMemMoveAsLoop(MMI);
+      MMI->eraseFromParent();
+      ++NumMemCpyLoops;
+    } else {
+      auto *MCI = cast<MemCpyInst>(MI);
+      auto &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+      expandMemCpyAsLoop(MCI, TTI);
+      MCI->eraseFromParent();
+      ++NumMemCpyLoops;
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVLowerMemIntrinsics, DEBUG_TYPE,
+                      "SPIRV lower memory intrinsics", false, false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_DEPENDENCY(TargetTransformInfoWrapperPass)
+INITIALIZE_PASS_END(SPIRVLowerMemIntrinsics, DEBUG_TYPE,
+                    "SPIRV lower memory intrinsics", false, false)
+
+char SPIRVLowerMemIntrinsics::ID = 0;
+
+FunctionPass *llvm::createSPIRVLowerMemIntrinsicsPass() {
+  return new SPIRVLowerMemIntrinsics();
+}
@@ -12,6 +12,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "SPIRVMCInstLower.h"
+#include "SPIRV.h"
+#include "SPIRVStrings.h"
+#include "MCTargetDesc/SPIRVMCTargetDesc.h"
 #include "llvm/CodeGen/MachineInstr.h"
 
 using namespace llvm;
@@ -22,7 +25,9 @@ void SPIRVMCInstLower::Lower(const MachineInstr *MI, MCInst &OutMI) const {
   for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
     const MachineOperand &MO = MI->getOperand(i);
 
-    // At this stage, SPIR-V should only have Register and Immediate operands
+    // At this stage, SPIR-V should only have Register, Immediate, string and
+    // global ID operands (target indices holding the index of a globally
+    // numbered VReg). Strings are packed into a series of immediate words here.
     MCOperand MCOp;
     switch (MO.getType()) {
     default:
@@ -34,8 +39,75 @@ void SPIRVMCInstLower::Lower(const MachineInstr *MI, MCInst &OutMI) const {
     case MachineOperand::MO_Immediate:
       MCOp = MCOperand::createImm(MO.getImm());
       break;
+    case MachineOperand::MO_TargetIndex:
+      assert(MO.getIndex() == SPIRV::TI_GlobalID && "Unexpected target index");
+      MCOp = MCOperand::createReg(Register::index2VirtReg(MO.getOffset()));
+      break;
+    case MachineOperand::MO_ExternalSymbol: {
+      StringRef str = MO.getSymbolName();
+      const unsigned numWords = getStringWordCount(str);
+      for (unsigned w = 0; w < numWords; ++w) {
+        OutMI.addOperand(MCOperand::createImm(getStringWord(str, w)));
+      }
+      continue;
+    }
     }
 
     OutMI.addOperand(MCOp);
   }
 }
+
+// Encode an operand's word, encoding IDs as the index + 1 in the same way as
+// the code emitter, and tracking the largest ID.
+static uint32_t getOperandWord(const MachineOperand &MO, unsigned &IDBound,
+                               ArrayRef<unsigned> IDMap) {
+  switch (MO.getType()) {
+  case MachineOperand::MO_Register:
+  case MachineOperand::MO_TargetIndex: {
+    unsigned index = MO.isReg() ? Register::virtReg2Index(MO.getReg())
+                                : static_cast<unsigned>(MO.getOffset());
+    unsigned ID = (IDMap.empty() ? index : IDMap[index]) + 1;
+    IDBound = std::max(IDBound, ID + 1);
+    return ID;
+  }
+  case MachineOperand::MO_Immediate:
+    return MO.getImm();
+  default:
+    MO.getParent()->print(errs());
+    llvm_unreachable("unknown operand type");
+  }
+}
+
+void llvm::encodeSPIRVInstr(const MachineInstr &MI,
+                            std::vector<uint32_t> &Words, unsigned &IDBound,
+                            ArrayRef<unsigned> IDMap) {
+  const MCInstrDesc &MCDesc = MI.getDesc();
+  const unsigned numOps = MI.getNumOperands();
+  unsigned numWords = 1;
+  for (const MachineOperand &MO : MI.operands()) {
+    numWords += getOperandWordCount(MO);
+  }
+  uint16_t opCode = getSPIRVOpcodeEncoding(MCDesc.TSFlags);
+  Words.push_back((numWords << 16) | opCode);
+
+  // Emit the type in operand 1 before the ID in operand 0 it defines
+  unsigned firstOp = 0;
+  if (hasSPIRVResultType(MCDesc)) {
+    Words.push_back(getOperandWord(MI.getOperand(1), IDBound, IDMap));
+    Words.push_back(getOperandWord(MI.getOperand(0), IDBound, IDMap));
+    firstOp = 2;
+  }
+  for (unsigned i = firstOp; i < numOps; ++i) {
+    const MachineOperand &MO = MI.getOperand(i);
+    if (isStringOperand(MO)) {
+      // Pack the string's chars into words only now it is being encoded
+      StringRef str = MO.getSymbolName();
+      const unsigned numStrWords = getStringWordCount(str);
+      for (unsigned w = 0; w < numStrWords; ++w) {
+        Words.push_back(getStringWord(str, w));
+      }
+    } else {
+      Words.push_back(getOperandWord(MO, IDBound, IDMap));
+    }
+  }
+}
@@ -9,8 +9,12 @@
 #ifndef LLVM_LIB_TARGET_SPIRV_SPIRVMCINSTLOWER_H
 #define LLVM_LIB_TARGET_SPIRV_SPIRVMCINSTLOWER_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/Support/Compiler.h"
 
+#include <cstdint>
+#include <vector>
+
 namespace llvm {
 class MCInst;
 class MachineInstr;
@@ -21,6 +25,13 @@ public:
   SPIRVMCInstLower() {}
   void Lower(const MachineInstr *MI, MCInst &OutMI) const;
 };
+
+// Encode the instruction straight into words appended to Words, in the same
+// way as SPIRVMCCodeEmitter does for the equivalent lowered MCInst, and raise
+// IDBound above every ID it refers to. If IDMap is given, each ID index is
+// replaced by the one it maps to.
+void encodeSPIRVInstr(const MachineInstr &MI, std::vector<uint32_t> &Words,
+                      unsigned &IDBound, ArrayRef<unsigned> IDMap = None);
 } // namespace llvm
 
 #endif
@@ -0,0 +1,210 @@
+//===-- SPIRVMachineCSE.cpp - SPIR-V CSE and DCE ----------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Common subexpression and dead code elimination on the selected SPIR-V
+// instructions. MachineCSE and DeadMachineInstructionElim don't know which
+// SPIR-V instructions have side effects, and see every result as used by its
+// OpName and decorations.
+//
+// An instruction is replaced by an identical one dominating it if it has no
+// side effects, and no decorations which could make the two differ. Loads of
+// the same BuiltIn Input variable are also merged, even though selection
+// builds a separate OpVariable for each of them, as those variables can never
+// be written. Instructions without side effects whose result is only used by
+// annotations are then erased.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVEnums.h"
+#include "SPIRVInstrInfo.h"
+
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineDominators.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+
+#include <map>
+
+using namespace llvm;
+using namespace SPIRV;
+
+#define DEBUG_TYPE "spirv-machine-cse"
+
+STATISTIC(NumCSEd, "Number of instructions replaced by an earlier one");
+STATISTIC(NumDeadInstrs, "Number of dead instructions erased");
+
+namespace {
+class SPIRVMachineCSE : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVMachineCSE() : MachineFunctionPass(ID) {
+    initializeSPIRVMachineCSEPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    AU.addRequired<MachineDominatorTree>();
+    AU.addPreserved<MachineDominatorTree>();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+private:
+  MachineRegisterInfo *MRI;
+  const SPIRVInstrInfo *TII;
+
+  using InstrKey = SmallVector<int64_t, 8>;
+
+  bool isBuiltInInputVar(Register ptr, int64_t &builtIn) const;
+  bool isSideEffectFree(const MachineInstr &MI) const;
+  bool getKey(const MachineInstr &MI, InstrKey &key) const;
+
+  bool runCSE(MachineFunction &MF, MachineDominatorTree &MDT);
+  bool runDCE(MachineFunction &MF);
+};
+} // namespace
+
+// Whether ptr is an OpVariable in the Input storage class decorated as a
+// BuiltIn, and if so which one.
+bool SPIRVMachineCSE::isBuiltInInputVar(Register ptr, int64_t &builtIn) const {
+  const MachineInstr *var = MRI->getVRegDef(ptr);
+  if (!var || var->getOpcode() != OpVariable ||
+      var->getOperand(2).getImm() != StorageClass::Input) {
+    return false;
+  }
+  for (const auto &use : MRI->use_nodbg_instructions(ptr)) {
+    if (use.getOpcode() == OpDecorate &&
+        use.getOperand(1).getImm() == Decoration::BuiltIn) {
+      builtIn = use.getOperand(2).getImm();
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SPIRVMachineCSE::isSideEffectFree(const MachineInstr &MI) const {
+  if (MI.getOpcode() == OpLoad) {
+    // BuiltIn Input variables can't be written, so loading them is pure
+    int64_t builtIn;
+    return isBuiltInInputVar(MI.getOperand(2).getReg(), builtIn);
+  }
+  return TII->isSideEffectFreeInstr(MI);
+}
+
+// Build the key identifying what MI computes: its opcode and all operands but
+// its result. Returns false if MI can't be merged with an identical one.
+bool SPIRVMachineCSE::getKey(const MachineInstr &MI, InstrKey &key) const {
+  if (MI.getNumDefs() != 1 || !isSideEffectFree(MI)) {
+    return false;
+  }
+  // Decorations such as FPFastMathMode or NoSignedWrap could differ
+  Register res = MI.getOperand(0).getReg();
+  for (const auto &use : MRI->use_nodbg_instructions(res)) {
+    if (TII->isDecorationInstr(use)) {
+      return false;
+    }
+  }
+
+  key.push_back(MI.getOpcode());
+  for (unsigned i = 1; i < MI.getNumOperands(); ++i) {
+    const MachineOperand &op = MI.getOperand(i);
+    int64_t builtIn;
+    if (op.isReg() && MI.getOpcode() == OpLoad && i == 2 &&
+        isBuiltInInputVar(op.getReg(), builtIn)) {
+      // Tag BuiltIns so they can't collide with register numbers
+      key.push_back(-1);
+      key.push_back(builtIn);
+    } else if (op.isReg()) {
+      key.push_back(op.getReg());
+    } else if (op.isImm()) {
+      key.push_back(op.getImm());
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SPIRVMachineCSE::runCSE(MachineFunction &MF, MachineDominatorTree &MDT) {
+  // Visit the blocks in dominator tree order, so the instructions which could
+  // replace another are always seen first
+  bool changed = false;
+  std::map<InstrKey, SmallVector<MachineInstr *, 2>> available;
+  for (MachineDomTreeNode *node : depth_first(MDT.getRootNode())) {
+    for (auto &MI : make_early_inc_range(*node->getBlock())) {
+      InstrKey key;
+      if (!getKey(MI, key)) {
+        continue;
+      }
+      auto &candidates = available[key];
+      MachineInstr *replacement = nullptr;
+      for (MachineInstr *candidate : candidates) {
+        if (MDT.dominates(candidate, &MI)) {
+          replacement = candidate;
+          break;
+        }
+      }
+      if (!replacement) {
+        candidates.push_back(&MI);
+        continue;
+      }
+      Register res = MI.getOperand(0).getReg();
+      TII->eraseAnnotations(res, *MRI);
+      MRI->replaceRegWith(res, replacement->getOperand(0).getReg());
+      MI.eraseFromParent();
+      ++NumCSEd;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool SPIRVMachineCSE::runDCE(MachineFunction &MF) {
+  // Visit uses before definitions, so chains of dead instructions go at once
+  bool changed = false;
+  for (MachineBasicBlock *MBB : post_order(&MF)) {
+    for (auto &MI : make_early_inc_range(reverse(*MBB))) {
+      if (MI.getNumDefs() != 1 || !isSideEffectFree(MI)) {
+        continue;
+      }
+      Register res = MI.getOperand(0).getReg();
+      if (TII->getNumRealUses(res, *MRI) == 0) {
+        TII->eraseAnnotations(res, *MRI);
+        MI.eraseFromParent();
+        ++NumDeadInstrs;
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+bool SPIRVMachineCSE::runOnMachineFunction(MachineFunction &MF) {
+  MRI = &MF.getRegInfo();
+  TII = static_cast<const SPIRVInstrInfo *>(MF.getSubtarget().getInstrInfo());
+  auto &MDT = getAnalysis<MachineDominatorTree>();
+  bool changed = runCSE(MF, MDT);
+  changed |= runDCE(MF);
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVMachineCSE, DEBUG_TYPE,
+                      "SPIRV common subexpression elimination", false, false)
+INITIALIZE_PASS_DEPENDENCY(MachineDominatorTree)
+INITIALIZE_PASS_END(SPIRVMachineCSE, DEBUG_TYPE,
+                    "SPIRV common subexpression elimination", false, false)
+
+char SPIRVMachineCSE::ID = 0;
+
+FunctionPass *llvm::createSPIRVMachineCSEPass() {
+  return new SPIRVMachineCSE();
+}
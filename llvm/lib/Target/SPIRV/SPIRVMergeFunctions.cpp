@@ -0,0 +1,115 @@
+//===-- SPIRVMergeFunctions.cpp - Merge identical functions -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Replace the internal functions identical to an earlier one with it. Template
+// instantiations in SYCL or OpenCL C++ code often only differ in types which
+// have the same layout, or in the pointee types of pointers, which SPIR-V
+// code doesn't depend on either. Each copy would otherwise be numbered,
+// emitted, and compiled again by the driver.
+//
+// Functions are compared with the FunctionComparator of MergeFunctions, which
+// already compares pointers by their address space and structs by their
+// elements. Unlike MergeFunctions, only functions with the same signature are
+// merged, so their calls can just call the surviving copy: a thunk would be an
+// extra OpFunctionCall, and SPIR-V has no aliases. Kernels are never merged,
+// as entry points can't be called.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/FunctionComparator.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-merge-functions"
+
+STATISTIC(NumMerged, "Number of functions replaced by an identical one");
+
+static cl::opt<bool>
+    EnableMergeFunctions("spirv-merge-functions", cl::Hidden, cl::init(true),
+                         cl::desc("Replace the internal functions identical "
+                                  "to another one with it"));
+
+namespace {
+class SPIRVMergeFunctions : public ModulePass {
+public:
+  static char ID;
+  SPIRVMergeFunctions() : ModulePass(ID) {
+    initializeSPIRVMergeFunctionsPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+};
+} // namespace
+
+static bool canMerge(const Function &F) {
+  return !F.isDeclaration() && F.hasLocalLinkage() && !F.isVarArg() &&
+         F.getCallingConv() != CallingConv::SPIR_KERNEL &&
+         !F.hasAddressTaken();
+}
+
+// Merge the functions identical to an earlier one in the module, returning
+// whether any were
+static bool mergeOnce(Module &M) {
+  GlobalNumberState globalNumbers;
+  DenseMap<FunctionComparator::FunctionHash, SmallVector<Function *, 2>>
+      survivorsByHash;
+  bool changed = false;
+  for (Function &F : make_early_inc_range(M)) {
+    if (!canMerge(F)) {
+      continue;
+    }
+    auto &survivors = survivorsByHash[FunctionComparator::functionHash(F)];
+    Function *same = nullptr;
+    for (Function *S : survivors) {
+      if (S->getFunctionType() == F.getFunctionType() &&
+          FunctionComparator(S, &F, &globalNumbers).compare() == 0) {
+        same = S;
+        break;
+      }
+    }
+    if (!same) {
+      survivors.push_back(&F);
+      continue;
+    }
+    LLVM_DEBUG(dbgs() << "Replacing " << F.getName() << " with "
+                      << same->getName() << "\n");
+    globalNumbers.erase(&F);
+    F.replaceAllUsesWith(same);
+    F.eraseFromParent();
+    ++NumMerged;
+    changed = true;
+  }
+  return changed;
+}
+
+bool SPIRVMergeFunctions::runOnModule(Module &M) {
+  if (!EnableMergeFunctions || skipModule(M)) {
+    return false;
+  }
+  // The callers of merged functions may have become identical in turn
+  bool changed = false;
+  while (mergeOnce(M)) {
+    changed = true;
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVMergeFunctions, DEBUG_TYPE,
+                "SPIRV merge identical functions", false, false)
+
+char SPIRVMergeFunctions::ID = 0;
+
+ModulePass *llvm::createSPIRVMergeFunctionsPass() {
+  return new SPIRVMergeFunctions();
+}
@@ -0,0 +1,287 @@
+//===-- SPIRVMinMaxCombine.cpp - Combine min/max chains ---------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Peephole optimizations run on the selected SPIR-V instructions, replacing
+// pairs of OpenCL.std or GLSL.std.450 min and max instructions with the single
+// SPV_AMD_shader_trinary_minmax instruction computing the same value:
+// - min(min(a, b), c) becomes min3(a, b, c), and likewise for max.
+// - A clamp to constant bounds lo <= hi, min(max(x, lo), hi) or
+//   max(min(x, hi), lo), becomes mid3(x, lo, hi). Float clamps must not be
+//   given NaNs, as mid3 doesn't define which value it returns for them.
+//
+// This only runs when the extended instruction set can be used, and the
+// OpExtInstImport for it is added with the others when the OpExtInsts are
+// hoisted to the global metadata.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVEnums.h"
+#include "SPIRVExtInsts.h"
+#include "SPIRVInstrInfo.h"
+#include "SPIRVSubtarget.h"
+
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+
+using namespace llvm;
+using namespace SPIRV;
+
+namespace AMD = SPV_AMD_shader_trinary_minmax;
+
+#define DEBUG_TYPE "spirv-min-max-combine"
+
+STATISTIC(NumMin3Max3, "Number of min3 and max3 instructions formed");
+STATISTIC(NumMid3, "Number of clamps combined into mid3");
+
+namespace {
+// The kinds of value, which index the tables of AMD instructions
+enum ValueKind { FloatKind, UnsignedKind, SignedKind };
+
+// An OpenCL.std or GLSL.std.450 min or max on one kind of value
+struct MinMaxInst {
+  ExtInstSet set;
+  uint32_t inst;
+  ValueKind kind;
+  bool isMax;
+};
+} // namespace
+
+static const MinMaxInst minMaxInsts[] = {
+    {ExtInstSet::OpenCL_std, OpenCL_std::fmin, FloatKind, false},
+    {ExtInstSet::OpenCL_std, OpenCL_std::fmax, FloatKind, true},
+    {ExtInstSet::OpenCL_std, OpenCL_std::u_min, UnsignedKind, false},
+    {ExtInstSet::OpenCL_std, OpenCL_std::u_max, UnsignedKind, true},
+    {ExtInstSet::OpenCL_std, OpenCL_std::s_min, SignedKind, false},
+    {ExtInstSet::OpenCL_std, OpenCL_std::s_max, SignedKind, true},
+    {ExtInstSet::GLSL_std_450, GLSL_std_450::FMin, FloatKind, false},
+    {ExtInstSet::GLSL_std_450, GLSL_std_450::FMax, FloatKind, true},
+    {ExtInstSet::GLSL_std_450, GLSL_std_450::UMin, UnsignedKind, false},
+    {ExtInstSet::GLSL_std_450, GLSL_std_450::UMax, UnsignedKind, true},
+    {ExtInstSet::GLSL_std_450, GLSL_std_450::SMin, SignedKind, false},
+    {ExtInstSet::GLSL_std_450, GLSL_std_450::SMax, SignedKind, true}};
+
+static const AMD::SPV_AMD_shader_trinary_minmax min3Insts[] = {
+    AMD::FMin3AMD, AMD::UMin3AMD, AMD::SMin3AMD};
+static const AMD::SPV_AMD_shader_trinary_minmax max3Insts[] = {
+    AMD::FMax3AMD, AMD::UMax3AMD, AMD::SMax3AMD};
+static const AMD::SPV_AMD_shader_trinary_minmax mid3Insts[] = {
+    AMD::FMid3AMD, AMD::UMid3AMD, AMD::SMid3AMD};
+
+namespace {
+class SPIRVMinMaxCombine : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVMinMaxCombine() : MachineFunctionPass(ID) {
+    initializeSPIRVMinMaxCombinePass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  MachineRegisterInfo *MRI;
+  const SPIRVInstrInfo *TII;
+  // Instructions erased so far, so they're skipped if visited later
+  SmallPtrSet<const MachineInstr *, 16> Erased;
+
+  int64_t getFastMathMode(Register reg) const;
+  const MinMaxInst *getMinMaxInst(const MachineInstr &MI) const;
+  bool getConstantBits(Register reg, APInt &bits) const;
+  bool areOrderedBounds(Register lo, Register hi, ValueKind kind) const;
+  void replaceWithAMDInst(MachineInstr &MI, uint32_t inst,
+                          ArrayRef<Register> ops, MachineInstr &inner);
+  bool combine(MachineInstr &MI);
+};
+} // namespace
+
+// Get the FPFastMathMode reg is decorated with, or None.
+int64_t SPIRVMinMaxCombine::getFastMathMode(Register reg) const {
+  for (const auto &use : MRI->use_nodbg_instructions(reg)) {
+    if (use.getOpcode() == OpDecorate &&
+        use.getOperand(1).getImm() == Decoration::FPFastMathMode) {
+      return use.getOperand(2).getImm();
+    }
+  }
+  return FPFastMathMode::None;
+}
+
+// Get the description of MI if it's a min or max of two values.
+const MinMaxInst *
+SPIRVMinMaxCombine::getMinMaxInst(const MachineInstr &MI) const {
+  if (MI.getOpcode() != OpExtInst || MI.getNumOperands() != 6) {
+    return nullptr;
+  }
+  const auto set = static_cast<ExtInstSet>(MI.getOperand(2).getImm());
+  const auto inst = static_cast<uint32_t>(MI.getOperand(3).getImm());
+  for (const MinMaxInst &minMax : minMaxInsts) {
+    if (minMax.set == set && minMax.inst == inst) {
+      return &minMax;
+    }
+  }
+  return nullptr;
+}
+
+// Get the bits of the scalar OpConstant defining reg.
+bool SPIRVMinMaxCombine::getConstantBits(Register reg, APInt &bits) const {
+  const MachineInstr *def = MRI->getVRegDef(reg);
+  if (!def || def->getOpcode() != OpConstant || def->getNumOperands() < 3 ||
+      def->getNumOperands() > 4) {
+    return false;
+  }
+  const MachineInstr *type = MRI->getVRegDef(def->getOperand(1).getReg());
+  if (!type || (type->getOpcode() != OpTypeInt &&
+                type->getOpcode() != OpTypeFloat)) {
+    return false;
+  }
+  const unsigned width = type->getOperand(1).getImm();
+  if (width == 0 || width > 64) {
+    return false;
+  }
+  bits = TII->getConstantBits(*def, width);
+  return true;
+}
+
+// Whether lo and hi are constants with lo <= hi, so each value clamped to them
+// is their median with it.
+bool SPIRVMinMaxCombine::areOrderedBounds(Register lo, Register hi,
+                                          ValueKind kind) const {
+  APInt loBits, hiBits;
+  if (!getConstantBits(lo, loBits) || !getConstantBits(hi, hiBits)) {
+    return false;
+  }
+  if (kind == SignedKind) {
+    return loBits.sle(hiBits);
+  } else if (kind == UnsignedKind) {
+    return loBits.ule(hiBits);
+  }
+  const fltSemantics *sem;
+  switch (loBits.getBitWidth()) {
+  case 16:
+    sem = &APFloat::IEEEhalf();
+    break;
+  case 32:
+    sem = &APFloat::IEEEsingle();
+    break;
+  case 64:
+    sem = &APFloat::IEEEdouble();
+    break;
+  default:
+    return false;
+  }
+  const auto cmp = APFloat(*sem, loBits).compare(APFloat(*sem, hiBits));
+  return cmp == APFloat::cmpLessThan || cmp == APFloat::cmpEqual;
+}
+
+// Build the AMD instruction with the given operands in place of MI, defining
+// the same result with the same type, and erase MI and the min or max inner
+// which only MI used.
+void SPIRVMinMaxCombine::replaceWithAMDInst(MachineInstr &MI, uint32_t inst,
+                                            ArrayRef<Register> ops,
+                                            MachineInstr &inner) {
+  MachineIRBuilder MIRBuilder(MI);
+  auto MIB = MIRBuilder.buildInstr(OpExtInst)
+                 .addDef(MI.getOperand(0).getReg())
+                 .addUse(MI.getOperand(1).getReg())
+                 .addImm(uint32_t(ExtInstSet::SPV_AMD_shader_trinary_minmax))
+                 .addImm(inst);
+  for (Register op : ops) {
+    MIB.addUse(op);
+  }
+  Erased.insert(&MI);
+  MI.eraseFromParent();
+  TII->eraseAnnotations(inner.getOperand(0).getReg(), *MRI, &Erased);
+  Erased.insert(&inner);
+  inner.eraseFromParent();
+}
+
+bool SPIRVMinMaxCombine::combine(MachineInstr &MI) {
+  const MinMaxInst *outer = getMinMaxInst(MI);
+  if (!outer) {
+    return false;
+  }
+  const int64_t fastMath = getFastMathMode(MI.getOperand(0).getReg());
+  for (unsigned i = 4; i <= 5; ++i) {
+    Register op = MI.getOperand(i).getReg();
+    Register other = MI.getOperand(i == 4 ? 5 : 4).getReg();
+    MachineInstr *def = MRI->getVRegDef(op);
+    const MinMaxInst *inner = def ? getMinMaxInst(*def) : nullptr;
+    // The combined instruction can only keep a single FPFastMathMode
+    if (!inner || inner->kind != outer->kind ||
+        def->getOperand(1).getReg() != MI.getOperand(1).getReg() ||
+        TII->getNumRealUses(op, *MRI) != 1 ||
+        getFastMathMode(op) != fastMath) {
+      continue;
+    }
+    Register a = def->getOperand(4).getReg();
+    Register b = def->getOperand(5).getReg();
+    if (inner->isMax == outer->isMax) {
+      const auto *insts = outer->isMax ? max3Insts : min3Insts;
+      replaceWithAMDInst(MI, insts[outer->kind], {a, b, other}, *def);
+      ++NumMin3Max3;
+      return true;
+    }
+
+    if (outer->kind == FloatKind && !(fastMath & FPFastMathMode::NotNaN)) {
+      continue;
+    }
+    // Either operand of the inner instruction can be the bound
+    for (bool swapped : {false, true}) {
+      Register x = swapped ? b : a;
+      Register bound = swapped ? a : b;
+      Register lo = outer->isMax ? other : bound;
+      Register hi = outer->isMax ? bound : other;
+      if (areOrderedBounds(lo, hi, outer->kind)) {
+        replaceWithAMDInst(MI, mid3Insts[outer->kind], {x, lo, hi}, *def);
+        ++NumMid3;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool SPIRVMinMaxCombine::runOnMachineFunction(MachineFunction &MF) {
+  const auto &ST = MF.getSubtarget<SPIRVSubtarget>();
+  if (!ST.canUseExtInstSet(ExtInstSet::SPV_AMD_shader_trinary_minmax)) {
+    return false;
+  }
+  MRI = &MF.getRegInfo();
+  TII = ST.getInstrInfo();
+
+  SmallVector<MachineInstr *, 16> candidates;
+  Erased.clear();
+  for (auto &MBB : MF) {
+    for (auto &MI : MBB) {
+      if (getMinMaxInst(MI)) {
+        candidates.push_back(&MI);
+      }
+    }
+  }
+  // Visit the last instructions first, so chains are matched from their end
+  bool changed = false;
+  for (MachineInstr *MI : reverse(candidates)) {
+    if (!Erased.count(MI)) {
+      changed |= combine(*MI);
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVMinMaxCombine, DEBUG_TYPE,
+                "SPIRV combine min/max chains into AMD trinary instructions",
+                false, false)
+
+char SPIRVMinMaxCombine::ID = 0;
+
+FunctionPass *llvm::createSPIRVMinMaxCombinePass() {
+  return new SPIRVMinMaxCombine();
+}
@@ -0,0 +1,225 @@
+//===-- SPIRVNarrowArithmetic.cpp - Keep narrow arithmetic narrow -*- C++ -*-=//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// With -spirv-narrow-arithmetic, compute the char, short and half arithmetic
+// which C promotion rules widen to int or float in its own width, if the Int8,
+// Int16 or Float16 capability respectively is available. Devices supporting
+// these typically execute narrow vector arithmetic at a multiple of the rate of
+// the 32 bit one.
+//
+// Integer expressions which are truncated back to a narrow type are rewritten
+// in that type when all their leaves are extensions from it or constants, as
+// the low bits of additions, subtractions, multiplications, bitwise operations
+// and left shifts only depend on the low bits of their operands. A single
+// float addition, subtraction, multiplication or division of extended halves
+// which is truncated back to half is computed in half, as float has enough
+// precision for rounding twice to give the same result.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+using namespace PatternMatch;
+
+#define DEBUG_TYPE "spirv-narrow-arithmetic"
+
+STATISTIC(NumNarrowedInts, "Number of integer expressions kept narrow");
+STATISTIC(NumNarrowedHalfs, "Number of half operations kept narrow");
+
+static cl::opt<bool> NarrowArithmetic(
+    "spirv-narrow-arithmetic", cl::Hidden, cl::init(false),
+    cl::desc("Compute promoted char, short and half arithmetic in its own "
+             "width if the subtarget supports it"));
+
+// The depth of the integer expressions to rewrite, to bound the compile time
+static const unsigned MaxNarrowingDepth = 8;
+
+namespace {
+class SPIRVNarrowArithmetic : public FunctionPass {
+public:
+  static char ID;
+  SPIRVNarrowArithmetic() : FunctionPass(ID) {
+    initializeSPIRVNarrowArithmeticPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.setPreservesCFG();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+// Whether the subtarget has arithmetic instructions for the scalar or vector
+// type, rather than just loads and stores.
+static bool hasNativeArithmetic(Type *ty, const SPIRVSubtarget &ST) {
+  Type *scalarTy = ty->getScalarType();
+  if (scalarTy->isHalfTy()) {
+    return ST.canUseCapability(Capability::Float16);
+  } else if (scalarTy->isIntegerTy(8)) {
+    return ST.canUseCapability(Capability::Int8);
+  } else if (scalarTy->isIntegerTy(16)) {
+    return ST.canUseCapability(Capability::Int16);
+  }
+  return false;
+}
+
+// Whether the low bits of V in the width of ty can be computed in ty, the
+// leaves of V being extensions from ty or constants.
+static bool canNarrow(Value *V, Type *ty, unsigned depth) {
+  if (isa<Constant>(V)) {
+    return true;
+  }
+  if (isa<ZExtInst>(V) || isa<SExtInst>(V)) {
+    return cast<CastInst>(V)->getSrcTy() == ty;
+  }
+  auto *BO = dyn_cast<BinaryOperator>(V);
+  if (!BO || !BO->hasOneUse() || depth == MaxNarrowingDepth) {
+    return false;
+  }
+  switch (BO->getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Mul:
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+    return canNarrow(BO->getOperand(0), ty, depth + 1) &&
+           canNarrow(BO->getOperand(1), ty, depth + 1);
+  case Instruction::Shl: {
+    // Shifting by the narrow width or more shifts out all the low bits, which
+    // the narrow shift wouldn't
+    const APInt *amount;
+    return match(BO->getOperand(1), m_APInt(amount)) &&
+           amount->ult(ty->getScalarSizeInBits()) &&
+           canNarrow(BO->getOperand(0), ty, depth + 1);
+  }
+  default:
+    return false;
+  }
+}
+
+static Value *buildNarrowed(Value *V, Type *ty, IRBuilder<> &B) {
+  if (auto *C = dyn_cast<Constant>(V)) {
+    return ConstantExpr::getTrunc(C, ty);
+  }
+  if (isa<ZExtInst>(V) || isa<SExtInst>(V)) {
+    return cast<CastInst>(V)->getOperand(0);
+  }
+  auto *BO = cast<BinaryOperator>(V);
+  Value *lhs = buildNarrowed(BO->getOperand(0), ty, B);
+  Value *rhs = buildNarrowed(BO->getOperand(1), ty, B);
+  return B.CreateBinOp(BO->getOpcode(), lhs, rhs, BO->getName() + ".narrow");
+}
+
+// Get the half value V is an extension of, if any.
+static Value *getExtendedHalf(Value *V, Type *halfTy) {
+  Value *src;
+  if (match(V, m_FPExt(m_Value(src))) && src->getType() == halfTy) {
+    return src;
+  }
+  if (auto *C = dyn_cast<Constant>(V)) {
+    Constant *truncated = ConstantExpr::getFPTrunc(C, halfTy);
+    if (ConstantExpr::getFPExtend(truncated, C->getType()) == C) {
+      return truncated;
+    }
+  }
+  return nullptr;
+}
+
+static Value *narrowInt(TruncInst &T) {
+  auto *src = dyn_cast<BinaryOperator>(T.getOperand(0));
+  if (!src || !canNarrow(src, T.getDestTy(), 0)) {
+    return nullptr;
+  }
+  IRBuilder<> B(&T);
+  ++NumNarrowedInts;
+  return buildNarrowed(src, T.getDestTy(), B);
+}
+
+static Value *narrowHalf(FPTruncInst &T) {
+  auto *src = dyn_cast<BinaryOperator>(T.getOperand(0));
+  if (!src || !src->hasOneUse()) {
+    return nullptr;
+  }
+  switch (src->getOpcode()) {
+  case Instruction::FAdd:
+  case Instruction::FSub:
+  case Instruction::FMul:
+  case Instruction::FDiv:
+    break;
+  default:
+    return nullptr;
+  }
+  // Only float has the precision for rounding twice to be exact
+  if (!src->getType()->getScalarType()->isFloatTy()) {
+    return nullptr;
+  }
+  Value *lhs = getExtendedHalf(src->getOperand(0), T.getDestTy());
+  Value *rhs = getExtendedHalf(src->getOperand(1), T.getDestTy());
+  if (!lhs || !rhs) {
+    return nullptr;
+  }
+  IRBuilder<> B(&T);
+  ++NumNarrowedHalfs;
+  auto *narrowed = B.CreateBinOp(src->getOpcode(), lhs, rhs,
+                                 src->getName() + ".narrow");
+  cast<Instruction>(narrowed)->copyFastMathFlags(src);
+  return narrowed;
+}
+
+bool SPIRVNarrowArithmetic::runOnFunction(Function &F) {
+  if (!NarrowArithmetic || skipFunction(F)) {
+    return false;
+  }
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  const SPIRVSubtarget &ST = *TM.getSubtargetImpl();
+
+  SmallVector<Instruction *, 16> truncs;
+  for (Instruction &I : instructions(F)) {
+    if ((isa<TruncInst>(I) || isa<FPTruncInst>(I)) &&
+        hasNativeArithmetic(I.getType(), ST)) {
+      truncs.push_back(&I);
+    }
+  }
+
+  bool changed = false;
+  for (Instruction *I : truncs) {
+    Value *narrowed = isa<TruncInst>(I) ? narrowInt(*cast<TruncInst>(I))
+                                        : narrowHalf(*cast<FPTruncInst>(I));
+    if (narrowed) {
+      I->replaceAllUsesWith(narrowed);
+      RecursivelyDeleteTriviallyDeadInstructions(I);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVNarrowArithmetic, DEBUG_TYPE,
+                      "SPIRV keep narrow arithmetic narrow", false, false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_END(SPIRVNarrowArithmetic, DEBUG_TYPE,
+                    "SPIRV keep narrow arithmetic narrow", false, false)
+
+char SPIRVNarrowArithmetic::ID = 0;
+
+FunctionPass *llvm::createSPIRVNarrowArithmeticPass() {
+  return new SPIRVNarrowArithmetic();
+}
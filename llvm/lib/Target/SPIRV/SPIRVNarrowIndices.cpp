@@ -0,0 +1,218 @@
+//===-- SPIRVNarrowIndices.cpp - Compute 64 bit indices in 32 bit -*- C++ -*-=//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// On spirv64, size_t and the GEP indices are 64 bit, which most devices
+// compute with several 32 bit instructions. With -spirv-32bit-indices, or in
+// functions with the "spirv-32bit-indices"="true" attribute, which assert that
+// every index fits in a signed 32 bit int (e.g. as the buffers are smaller than
+// 2GB), the index expressions of GEPs are computed in 32 bit and sign extended
+// right before the access chain.
+//
+// An index expression is narrowed when its leaves are extensions from 32 bit
+// ints, constants, or the work-item builtins returning size_t, such as
+// get_global_id, and its inner nodes are integer additions, subtractions,
+// multiplications, bitwise operations or left shifts.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVOpenCLBIFs.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-narrow-indices"
+
+STATISTIC(NumNarrowedIndices, "Number of GEP indices computed in 32 bit");
+
+static cl::opt<bool> Narrow32BitIndices(
+    "spirv-32bit-indices", cl::Hidden, cl::init(false),
+    cl::desc("Compute the 64 bit GEP indices in 32 bit, assuming they all fit "
+             "in a signed 32 bit int"));
+
+// The depth of the index expressions to rewrite, to bound the compile time
+static const unsigned MaxNarrowingDepth = 8;
+
+namespace {
+class SPIRVNarrowIndices : public FunctionPass {
+public:
+  static char ID;
+  SPIRVNarrowIndices() : FunctionPass(ID) {
+    initializeSPIRVNarrowIndicesPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.setPreservesCFG();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+
+private:
+  bool canNarrow(Value *V, unsigned depth) const;
+  Value *buildNarrowed(Value *V);
+
+  Type *int32Ty = nullptr;
+  // The 32 bit values already computed for the 64 bit ones, so expressions
+  // indexing several GEPs are only narrowed once
+  DenseMap<Value *, Value *> narrowedValues;
+};
+} // namespace
+
+// Whether the call is to a work-item builtin returning a size_t smaller than
+// the number of work-items, which the index assumption bounds.
+static bool isWorkItemBuiltinCall(const Value *V) {
+  const auto *CI = dyn_cast<CallInst>(V);
+  const Function *callee = CI ? CI->getCalledFunction() : nullptr;
+  if (!callee || !callee->isDeclaration()) {
+    return false;
+  }
+  auto builtin = parseOpenCLBuiltinName(callee->getName());
+  if (!builtin) {
+    return false;
+  }
+  return StringSwitch<bool>(builtin->name)
+      .Cases("get_global_id", "get_local_id", "get_group_id", true)
+      .Cases("get_global_size", "get_local_size", "get_num_groups", true)
+      .Cases("get_enqueued_local_size", "get_global_offset", true)
+      .Cases("get_global_linear_id", "get_local_linear_id", true)
+      .Default(false);
+}
+
+bool SPIRVNarrowIndices::canNarrow(Value *V, unsigned depth) const {
+  if (isa<ConstantInt>(V) || narrowedValues.count(V)) {
+    return true;
+  }
+  if (isa<SExtInst>(V) || isa<ZExtInst>(V)) {
+    return cast<CastInst>(V)->getSrcTy() == int32Ty;
+  }
+  if (isWorkItemBuiltinCall(V)) {
+    return true;
+  }
+  auto *BO = dyn_cast<BinaryOperator>(V);
+  if (!BO || depth == MaxNarrowingDepth) {
+    return false;
+  }
+  switch (BO->getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Mul:
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+    return canNarrow(BO->getOperand(0), depth + 1) &&
+           canNarrow(BO->getOperand(1), depth + 1);
+  case Instruction::Shl: {
+    auto *amount = dyn_cast<ConstantInt>(BO->getOperand(1));
+    return amount && amount->getValue().ult(32) &&
+           canNarrow(BO->getOperand(0), depth + 1);
+  }
+  default:
+    return false;
+  }
+}
+
+Value *SPIRVNarrowIndices::buildNarrowed(Value *V) {
+  if (auto *C = dyn_cast<ConstantInt>(V)) {
+    return ConstantExpr::getTrunc(C, int32Ty);
+  }
+  auto it = narrowedValues.find(V);
+  if (it != narrowedValues.end()) {
+    return it->second;
+  }
+  // Build the 32 bit value right after the 64 bit one, so it dominates the
+  // same uses
+  auto *I = cast<Instruction>(V);
+  IRBuilder<> B(I->getNextNode());
+  Value *narrowed;
+  if (isa<SExtInst>(I) || isa<ZExtInst>(I)) {
+    narrowed = I->getOperand(0);
+  } else if (isa<CallInst>(I)) {
+    narrowed = B.CreateTrunc(I, int32Ty, I->getName() + ".narrow");
+  } else {
+    auto *BO = cast<BinaryOperator>(I);
+    Value *lhs = buildNarrowed(BO->getOperand(0));
+    Value *rhs = buildNarrowed(BO->getOperand(1));
+    narrowed =
+        B.CreateBinOp(BO->getOpcode(), lhs, rhs, BO->getName() + ".narrow");
+  }
+  narrowedValues[V] = narrowed;
+  return narrowed;
+}
+
+bool SPIRVNarrowIndices::runOnFunction(Function &F) {
+  if (skipFunction(F)) {
+    return false;
+  }
+  if (!Narrow32BitIndices &&
+      F.getFnAttribute("spirv-32bit-indices").getValueAsString() != "true") {
+    return false;
+  }
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  if (TM.getSubtargetImpl()->getPointerSize() != 64) {
+    return false;
+  }
+  int32Ty = Type::getInt32Ty(F.getContext());
+  Type *int64Ty = Type::getInt64Ty(F.getContext());
+  narrowedValues.clear();
+
+  SmallVector<GetElementPtrInst *, 16> GEPs;
+  for (Instruction &I : instructions(F)) {
+    if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+      GEPs.push_back(GEP);
+    }
+  }
+
+  SmallVector<WeakTrackingVH, 16> replacedIndices;
+  for (GetElementPtrInst *GEP : GEPs) {
+    for (Use &index : GEP->indices()) {
+      Value *V = index.get();
+      // Constant indices are already free, and struct indices must stay so
+      if (V->getType() != int64Ty || isa<Constant>(V) || !canNarrow(V, 0)) {
+        continue;
+      }
+      IRBuilder<> B(GEP);
+      Value *narrowed = buildNarrowed(V);
+      index.set(B.CreateSExt(narrowed, int64Ty, V->getName() + ".sext"));
+      replacedIndices.push_back(V);
+      ++NumNarrowedIndices;
+    }
+  }
+
+  // Remove the 64 bit computations which are no longer used. The narrowed
+  // values are kept alive by the GEPs, so none of them is deleted.
+  for (WeakTrackingVH &V : replacedIndices) {
+    if (V) {
+      RecursivelyDeleteTriviallyDeadInstructions(V);
+    }
+  }
+  narrowedValues.clear();
+  return !replacedIndices.empty();
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVNarrowIndices, DEBUG_TYPE,
+                      "SPIRV compute GEP indices in 32 bit", false, false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_END(SPIRVNarrowIndices, DEBUG_TYPE,
+                    "SPIRV compute GEP indices in 32 bit", false, false)
+
+char SPIRVNarrowIndices::ID = 0;
+
+FunctionPass *llvm::createSPIRVNarrowIndicesPass() {
+  return new SPIRVNarrowIndices();
+}
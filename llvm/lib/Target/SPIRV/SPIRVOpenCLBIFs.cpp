@@ -7,7 +7,7 @@
 //===----------------------------------------------------------------------===//
 //
 // Function implementations for lowering OpenCL builtin types and function calls
-// using their demangled names.
+// using their names, parsed from their Itanium mangling.
 //
 //===----------------------------------------------------------------------===//
 
@@ -17,12 +17,16 @@
 #include "SPIRVExtInsts.h"
 #include "SPIRVRegisterInfo.h"
 #include "SPIRVStrings.h"
+#include "SPIRVSubtarget.h"
 
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSwitch.h"
 #include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
 
-#include <map>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #define DEBUG_TYPE "opencl-bifs"
@@ -54,6 +58,7 @@ enum CLMemScope {
   memory_scope_work_group,
   memory_scope_device,
   memory_scope_all_svm_devices,
+  memory_scope_sub_group,
 };
 
 enum CLMemFenceFlags {
@@ -116,14 +121,32 @@ static Scope::Scope getSPIRVScope(CLMemScope clScope) {
     return Scope::Device;
   case memory_scope_all_svm_devices:
     return Scope::CrossDevice;
+  case memory_scope_sub_group:
+    return Scope::Subgroup;
   }
   llvm_unreachable("Unknown CL memory scope");
 }
 
+// Get the memory semantics for an atomic with the given order, accessing memory
+// with the given storage class semantics bit, in the subtarget's memory model.
+// Relaxed atomics don't order any memory, so they don't need the storage class
+// bit either.
+static unsigned getAtomicMemSemantics(MemorySemantics::MemorySemantics order,
+                                      unsigned storageSem,
+                                      const SPIRVSubtarget &ST) {
+  if (order == MemorySemantics::None) {
+    return MemorySemantics::None;
+  }
+  return ST.getMemSemanticsForMemoryModel(order | storageSem);
+}
+
 static unsigned int getSamplerParamFromBitmask(unsigned int bitmask) {
   return (bitmask & CLK_NORMALIZED_COORDS_TRUE) ? 1 : 0;
 }
 
+// Build an OpConstantSampler for the given bitmask into res. The first sampler
+// built for each bitmask is cached in the registry for the rest of the
+// function, and reused by the read_image calls taking the same literal.
 static bool buildSamplerLiteral(uint64_t samplerBitmask, Register res,
                                 SPIRVType *resTy, MachineIRBuilder &MIRBuilder,
                                 SPIRVTypeRegistry *TR) {
@@ -133,6 +156,10 @@ static bool buildSamplerLiteral(uint64_t samplerBitmask, Register res,
                  .addImm(getSamplerAddressingModeFromBitmask(samplerBitmask))
                  .addImm(getSamplerParamFromBitmask(samplerBitmask))
                  .addImm(getSamplerFilterModeFromBitmask(samplerBitmask));
+  const int64_t literal = samplerBitmask;
+  if (!TR->findConstant(SPIRV::OpConstantSampler, resTy, literal)) {
+    TR->addConstant(SPIRV::OpConstantSampler, resTy, literal, res);
+  }
   return TR->constrainRegOperands(MIB);
 }
 
@@ -140,6 +167,11 @@ static Register buildSamplerLiteral(uint64_t samplerBitmask,
                                     MachineIRBuilder &MIRBuilder,
                                     SPIRVTypeRegistry *TR) {
   SPIRVType *sampTy = TR->getSamplerType(MIRBuilder);
+  const int64_t literal = samplerBitmask;
+  if (Register existing =
+          TR->findConstant(SPIRV::OpConstantSampler, sampTy, literal))
+    return existing;
+
   auto sampler = MIRBuilder.getMRI()->createVirtualRegister(&SPIRV::IDRegClass);
   buildSamplerLiteral(samplerBitmask, sampler, sampTy, MIRBuilder, TR);
   return sampler;
@@ -184,12 +216,18 @@ static bool decorateConstant(Register target, MachineIRBuilder &MIRBuilder,
   return decorate(target, Decoration::Constant, MIRBuilder, TR);
 }
 
+// Decorate a builtin variable, and import it where the Linkage capability is
+// available. Shaders can't link, but their entry points still list all the
+// BuiltIn variables they use as interfaces.
 static bool decorateBuiltIn(Register target, BuiltIn::BuiltIn builtInID,
                             MachineIRBuilder &MIRBuilder,
                             SPIRVTypeRegistry *TR) {
   bool succ = decorate(target, Decoration::BuiltIn, builtInID, MIRBuilder, TR);
-  succ = succ && decorateLinkage(target, getLinkStrForBuiltIn(builtInID),
-                                 LinkageType::Import, MIRBuilder, TR);
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  if (canUseDecoration(Decoration::LinkageAttributes, ST)) {
+    succ = succ && decorateLinkage(target, getLinkStrForBuiltIn(builtInID),
+                                   LinkageType::Import, MIRBuilder, TR);
+  }
   return succ;
 }
 
@@ -224,16 +262,57 @@ static Register buildLoad(SPIRVType *baseType, Register ptrVRegToLoadFrom,
   return resVReg;
 }
 
+// Load a builtin vector variable such as GlobalInvocationId. This is done once
+// per function in the entry block, so every query reuses the same load, which
+// is trivially invariant in any loop.
+static Register buildBuiltinVectorLoad(SPIRVType *vecTy,
+                                       BuiltIn::BuiltIn builtIn,
+                                       MachineIRBuilder &MIRBuilder,
+                                       SPIRVTypeRegistry *TR) {
+  if (Register loaded = TR->findConstant(SPIRV::OpLoad, vecTy, {builtIn})) {
+    return loaded;
+  }
+  MachineIRBuilder entryBuilder(MIRBuilder.getMF());
+  entryBuilder.setMBB(MIRBuilder.getMF().front());
+
+  // Set up the global OpVariable with the necessary builtin decorations
+  Register globVar =
+      buildOpVariable(vecTy, StorageClass::Input, entryBuilder, TR);
+  decorateBuiltIn(globVar, builtIn, entryBuilder, TR);
+  decorateConstant(globVar, entryBuilder, TR);
+
+  Register loaded = buildLoad(vecTy, globVar, entryBuilder, TR);
+  const unsigned numElems = vecTy->getOperand(2).getImm();
+  const MachineInstr *elemTy =
+      entryBuilder.getMRI()->getVRegDef(vecTy->getOperand(1).getReg());
+  entryBuilder.getMRI()->setType(
+      loaded, LLT::vector(numElems, elemTy->getOperand(1).getImm()));
+  TR->addConstant(SPIRV::OpLoad, vecTy, {builtIn}, loaded);
+  return loaded;
+}
+
 static uint64_t getLiteralValueForConstant(Register constVReg,
                                            const MachineRegisterInfo *MRI) {
   MachineInstr *constInstr = MRI->getVRegDef(constVReg);
   return constInstr->getOperand(1).getCImm()->getZExtValue();
 }
 
+// Combine image and sampler with an OpSampledImage, reusing an earlier one in
+// the current block if there is one. SPIR-V requires OpSampledImage to be in
+// the same block as its users, so they can't be shared across blocks.
 static Register buildOpSampledImage(Register image, Register sampler,
                                     MachineIRBuilder &MIRBuilder,
                                     SPIRVTypeRegistry *TR) {
   const auto MRI = MIRBuilder.getMRI();
+  for (const auto &use : MRI->use_instructions(image)) {
+    if (use.getOpcode() == SPIRV::OpSampledImage &&
+        use.getParent() == &MIRBuilder.getMBB() &&
+        use.getOperand(2).getReg() == image &&
+        use.getOperand(3).getReg() == sampler) {
+      return use.getOperand(0).getReg();
+    }
+  }
+
   SPIRVType *imageType = TR->getSPIRVTypeForVReg(image);
   SPIRVType *sampImTy = TR->getSampledImageType(imageType, MIRBuilder);
 
@@ -273,6 +352,29 @@ static Register buildIConstant(uint64_t Val, SPIRVType *type,
   return Reg;
 }
 
+// Get the OpConstant of a 32 bit scope or memory semantics operand. The same
+// few values are used by most atomics and barriers, so they are cached in the
+// registry for the rest of the function.
+static Register getOrBuildI32Constant(uint32_t val,
+                                      MachineIRBuilder &MIRBuilder,
+                                      SPIRVTypeRegistry *TR) {
+  SPIRVType *I32Ty = TR->getOpTypeInt(32, MIRBuilder);
+  const int64_t literal = val;
+  if (Register existing = TR->findConstant(SPIRV::OpConstant, I32Ty, literal))
+    return existing;
+
+  const auto MRI = MIRBuilder.getMRI();
+  Register res = MRI->createVirtualRegister(&SPIRV::IDRegClass);
+  TR->assignSPIRVTypeToVReg(I32Ty, res, MIRBuilder);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpConstant)
+                 .addDef(res)
+                 .addUse(TR->getSPIRVTypeID(I32Ty))
+                 .addImm(val);
+  TR->constrainRegOperands(MIB);
+  TR->addConstant(SPIRV::OpConstant, I32Ty, literal, res);
+  return res;
+}
+
 static Register buildConstantFZero(MachineIRBuilder &MIRBuilder,
                                    SPIRVTypeRegistry *TR) {
   const auto MRI = MIRBuilder.getMRI();
@@ -286,6 +388,33 @@ static Register buildConstantFZero(MachineIRBuilder &MIRBuilder,
   return resVReg;
 }
 
+// Get the sizes of the work-groups the kernel being translated is launched
+// with, from its reqd_work_group_size, or an empty list if they can vary. The
+// sizes of the last work-groups can only be smaller than the enqueued ones
+// with non-uniform work-groups, which Vulkan and uniform-work-group-size
+// kernels don't have.
+static SmallVector<uint64_t, 3>
+getRequiredWorkgroupSize(const MachineFunction &MF, bool enqueued) {
+  SmallVector<uint64_t, 3> sizes;
+  const Function &F = MF.getFunction();
+  auto *node = F.getMetadata("reqd_work_group_size");
+  if (!node || F.getCallingConv() != CallingConv::SPIR_KERNEL) {
+    return sizes;
+  }
+  if (!enqueued && !MF.getSubtarget<SPIRVSubtarget>().isShader() &&
+      F.getFnAttribute("uniform-work-group-size").getValueAsString() !=
+          "true") {
+    return sizes;
+  }
+  for (const auto &op : node->operands()) {
+    if (auto *val = mdconst::dyn_extract<ConstantInt>(op)) {
+      sizes.push_back(val->getZExtValue());
+    }
+  }
+  sizes.resize(3, 1);
+  return sizes;
+}
+
 // These queries ask for a single size_t result for a given dimension index, e.g
 // size_t get_global_id(uintt dimindex). In SPIR-V, the builtins corresonding to
 // these values are all vec3 types, so we need to extract the correct index or
@@ -296,6 +425,9 @@ static Register buildConstantFZero(MachineIRBuilder &MIRBuilder,
 // For a constant index >= 3 we generate:
 //  %res = OpConstant %SizeT 0
 //
+// The same goes for the work-group sizes of a kernel with a
+// reqd_work_group_size, for a constant index < 3.
+//
 // For other indices we generate:
 //  %g = OpVariable %ptr_V3_SizeT Input
 //  OpDecorate %g BuiltIn XXX
@@ -321,9 +453,14 @@ static bool genWorkgroupQuery(MachineIRBuilder &MIRBuilder, Register resVReg,
   Register idxVReg = OrigArgs[0];
 
   const unsigned resWidth = retType->getOperand(1).getImm();
-  const unsigned int ptrSize = TR->getPointerSize();
 
-  const auto sizeT = TR->getPtrUIntType(MIRBuilder);
+  // Vulkan requires the builtins to be vectors of 32-bit integers, rather than
+  // of size_t
+  const bool isShader =
+      MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>().isShader();
+  const unsigned int ptrSize = isShader ? 32 : TR->getPointerSize();
+  const auto sizeT = isShader ? TR->getOpTypeInt(32, MIRBuilder)
+                              : TR->getPtrUIntType(MIRBuilder);
 
   const auto MRI = MIRBuilder.getMRI();
   auto idxInstr = MRI->getVRegDef(idxVReg);
@@ -335,27 +472,39 @@ static bool genWorkgroupQuery(MachineIRBuilder &MIRBuilder, Register resVReg,
   bool isConstantIndex = idxInstr->getOpcode() == TargetOpcode::G_CONSTANT;
 
   // If it's out of range (max dimension is 3), we can just return the constant
-  // default value(0 or 1 depending on which query function)
-  if (isConstantIndex && getLiteralValueForConstant(idxVReg, MRI) >= 3) {
-    Register defaultReg = resVReg;
+  // default value(0 or 1 depending on which query function). Sizes required by
+  // the kernel's metadata are constants too.
+  uint64_t constVal = defaultVal;
+  bool isConstantResult = false;
+  if (isConstantIndex) {
+    const uint64_t idx = getLiteralValueForConstant(idxVReg, MRI);
+    SmallVector<uint64_t, 3> reqdSizes;
+    if (builtIn == BuiltIn::WorkgroupSize ||
+        builtIn == BuiltIn::EnqueuedWorkgroupSize) {
+      reqdSizes = getRequiredWorkgroupSize(
+          MIRBuilder.getMF(), builtIn == BuiltIn::EnqueuedWorkgroupSize);
+    }
+    if (idx >= 3) {
+      isConstantResult = true;
+    } else if (!reqdSizes.empty()) {
+      constVal = reqdSizes[idx];
+      isConstantResult = true;
+    }
+  }
+
+  if (isConstantResult) {
+    Register constReg = resVReg;
     if (ptrSize != resWidth) {
-      defaultReg = MRI->createGenericVirtualRegister(LLT::scalar(ptrSize));
-      TR->assignSPIRVTypeToVReg(sizeT, defaultReg, MIRBuilder);
-      toTruncate = defaultReg;
+      constReg = MRI->createGenericVirtualRegister(LLT::scalar(ptrSize));
+      TR->assignSPIRVTypeToVReg(sizeT, constReg, MIRBuilder);
+      toTruncate = constReg;
     }
-    buildIConstant(defaultReg, defaultVal, sizeT, MIRBuilder, TR);
+    buildIConstant(constReg, constVal, sizeT, MIRBuilder, TR);
   } else { // If it could be in range, we need to load from the given builtin
 
+    // Load the Vec3 from the builtin variable, once per function
     auto v3 = TR->getOpTypeVector(3, sizeT, MIRBuilder);
-
-    // Set up the global OpVariable with the necessary builtin decorations
-    Register globVar = buildOpVariable(v3, StorageClass::Input, MIRBuilder, TR);
-    decorateBuiltIn(globVar, builtIn, MIRBuilder, TR);
-    decorateConstant(globVar, MIRBuilder, TR);
-
-    // Load the Vec3 from the global variable
-    Register loadedVector = buildLoad(v3, globVar, MIRBuilder, TR);
-    MRI->setType(loadedVector, LLT::vector(3, ptrSize));
+    Register loadedVector = buildBuiltinVectorLoad(v3, builtIn, MIRBuilder, TR);
 
     // Set up the vreg to extract the result to (possibly a new temporary one)
     Register extr = resVReg;
@@ -364,7 +513,9 @@ static bool genWorkgroupQuery(MachineIRBuilder &MIRBuilder, Register resVReg,
       TR->assignSPIRVTypeToVReg(sizeT, extr, MIRBuilder);
     }
 
-    // Use G_EXTRACT_VECTOR_ELT so dynamic vs static extraction is handled later
+    // Use G_EXTRACT_VECTOR_ELT so dynamic vs static extraction is handled
+    // later. Repeated extractions from the shared load are merged by
+    // SPIRVMachineCSE.
     MIRBuilder.buildExtractVectorElement(extr, loadedVector, idxVReg);
 
     // If the index is dynamic, need check if it's < 3, and then use a select
@@ -405,6 +556,39 @@ static bool genWorkgroupQuery(MachineIRBuilder &MIRBuilder, Register resVReg,
   return true;
 }
 
+// Load a scalar builtin variable, such as SubgroupSize, into resVReg:
+//  %g = OpVariable %ptr_uint Input
+//  OpDecorate %g BuiltIn XXX
+//  OpDecorate %g LinkageAttributes "__spirv_BuiltInXXX"
+//  OpDecorate %g Constant
+//  %res = OpLoad %uint %g
+static bool genBuiltinVariableLoad(MachineIRBuilder &MIRBuilder,
+                                   Register resVReg, SPIRVType *retType,
+                                   SPIRVTypeRegistry *TR,
+                                   BuiltIn::BuiltIn builtIn) {
+  Register globVar =
+      buildOpVariable(retType, StorageClass::Input, MIRBuilder, TR);
+  decorateBuiltIn(globVar, builtIn, MIRBuilder, TR);
+  decorateConstant(globVar, MIRBuilder, TR);
+
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpLoad)
+                 .addDef(resVReg)
+                 .addUse(TR->getSPIRVTypeID(retType))
+                 .addUse(globVar);
+  return TR->constrainRegOperands(MIB);
+}
+
+static bool isMultisampledImage(Register image, SPIRVTypeRegistry *TR) {
+  SPIRVType *imgType = TR->getSPIRVTypeForVReg(image);
+  assert(imgType->getOpcode() == SPIRV::OpTypeImage);
+  return imgType->getOperand(5).getImm() == 1;
+}
+
+// Sampled reads always take an explicit level of detail, as kernels can't use
+// implicit LOD:
+//  read_image(img, smp, coord)               -> Lod 0.0
+//  read_image(img, smp, coord, lod)          -> Lod %lod
+//  read_image(img, smp, coord, gradX, gradY) -> Grad %gradX %gradY
 static bool genSampledReadImage(MachineIRBuilder &MIRBuilder, Register resVReg,
                                 SPIRVType *retType,
                                 const SmallVectorImpl<Register> &OrigArgs,
@@ -423,18 +607,24 @@ static bool genSampledReadImage(MachineIRBuilder &MIRBuilder, Register resVReg,
   Register sampledImage = buildOpSampledImage(image, sampler, MIRBuilder, TR);
 
   Register coord = OrigArgs[2];
-  Register lod = buildConstantFZero(MIRBuilder, TR);
-
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpImageSampleExplicitLod)
                  .addDef(resVReg)
                  .addUse(TR->getSPIRVTypeID(retType))
                  .addUse(sampledImage)
-                 .addUse(coord)
-                 .addImm(ImageOperand::Lod)
-                 .addUse(lod);
+                 .addUse(coord);
+  if (OrigArgs.size() > 4) {
+    MIB.addImm(ImageOperand::Grad).addUse(OrigArgs[3]).addUse(OrigArgs[4]);
+  } else if (OrigArgs.size() > 3) {
+    MIB.addImm(ImageOperand::Lod).addUse(OrigArgs[3]);
+  } else {
+    MIB.addImm(ImageOperand::Lod).addUse(buildConstantFZero(MIRBuilder, TR));
+  }
   return TR->constrainRegOperands(MIB);
 }
 
+// Unsampled reads only take image operands for multisampled images:
+//  read_image(img, coord)         -> no operands
+//  read_image(img, coord, sample) -> Sample %sample
 static bool genReadImage(MachineIRBuilder &MIRBuilder, Register resVReg,
                          SPIRVType *retType,
                          const SmallVectorImpl<Register> &OrigArgs,
@@ -446,12 +636,27 @@ static bool genReadImage(MachineIRBuilder &MIRBuilder, Register resVReg,
                  .addUse(TR->getSPIRVTypeID(retType))
                  .addUse(image)
                  .addUse(coord);
+  if (OrigArgs.size() > 2) {
+    MIB.addImm(ImageOperand::Sample).addUse(OrigArgs[2]);
+  }
   return TR->constrainRegOperands(MIB);
 }
 
+// Writes to a mipmapped image give the level to write:
+//  write_image(img, coord, texel)      -> no operands
+//  write_image(img, coord, lod, texel) -> Lod %lod
 static bool genWriteImage(MachineIRBuilder &MIRBuilder,
                           const SmallVectorImpl<Register> &OrigArgs,
                           SPIRVTypeRegistry *TR) {
+  if (OrigArgs.size() > 3) {
+    auto MIB = MIRBuilder.buildInstr(SPIRV::OpImageWrite)
+                   .addUse(OrigArgs[0]) // Image
+                   .addUse(OrigArgs[1]) // Coord
+                   .addUse(OrigArgs[3]) // Texel to write
+                   .addImm(ImageOperand::Lod)
+                   .addUse(OrigArgs[2]);
+    return TR->constrainRegOperands(MIB);
+  }
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpImageWrite)
                  .addUse(OrigArgs[0])  // Image
                  .addUse(OrigArgs[1])  // Coord vec2
@@ -484,12 +689,53 @@ static unsigned int getNumSizeComponents(SPIRVType *imgType) {
   return arrayed ? numComps + 1 : numComps;
 }
 
+// Query the size of an image with OpImageQuerySize. The sizes of the image
+// arguments are queried once per function in the entry block, so the bounds
+// checks of image kernels reuse the same query, which is trivially invariant
+// in any loop.
+static Register buildImageSizeQuery(Register img, unsigned numComps,
+                                    MachineIRBuilder &MIRBuilder,
+                                    SPIRVTypeRegistry *TR) {
+  const auto MRI = MIRBuilder.getMRI();
+  auto I32Ty = TR->getOpTypeInt(32, MIRBuilder);
+  SPIRVType *sizeVecTy = I32Ty;
+  LLT sizeVecLLT = LLT::scalar(32);
+  if (numComps > 1) {
+    sizeVecTy = TR->getOpTypeVector(numComps, I32Ty, MIRBuilder);
+    sizeVecLLT = LLT::vector(numComps, 32);
+  }
+
+  MachineFunction &MF = MIRBuilder.getMF();
+  const MachineInstr *imgDef = MRI->getVRegDef(img);
+  const bool isEntryImage = imgDef && imgDef->getParent() == &MF.front();
+  const int64_t imgKey = img;
+  if (isEntryImage) {
+    if (Register existing =
+            TR->findConstant(SPIRV::OpImageQuerySize, sizeVecTy, imgKey)) {
+      return existing;
+    }
+  }
+  MachineIRBuilder entryBuilder(MF);
+  entryBuilder.setMBB(MF.front());
+  MachineIRBuilder &queryBuilder = isEntryImage ? entryBuilder : MIRBuilder;
+
+  Register sizeVec = MRI->createGenericVirtualRegister(sizeVecLLT);
+  TR->assignSPIRVTypeToVReg(sizeVecTy, sizeVec, queryBuilder);
+  auto MIB = queryBuilder.buildInstr(SPIRV::OpImageQuerySize)
+                 .addDef(sizeVec)
+                 .addUse(TR->getSPIRVTypeID(sizeVecTy))
+                 .addUse(img);
+  TR->constrainRegOperands(MIB);
+  if (isEntryImage) {
+    TR->addConstant(SPIRV::OpImageQuerySize, sizeVecTy, imgKey, sizeVec);
+  }
+  return sizeVec;
+}
+
 // Used for get_image_width, get_image_dim etc. via OpImageQuerySize
 static bool genImageSizeQuery(MachineIRBuilder &MIRBuilder, Register resVReg,
                               SPIRVType *retType, Register img,
                               unsigned component, SPIRVTypeRegistry *TR) {
-  const auto MRI = MIRBuilder.getMRI();
-
   unsigned numRetComps = 1;
   if (retType->getOpcode() == SPIRV::OpTypeVector) {
     numRetComps = retType->getOperand(2).getImm();
@@ -497,23 +743,15 @@ static bool genImageSizeQuery(MachineIRBuilder &MIRBuilder, Register resVReg,
 
   SPIRVType *imgType = TR->getSPIRVTypeForVReg(img);
   unsigned numTempComps = getNumSizeComponents(imgType);
+  Register sizeVec = buildImageSizeQuery(img, numTempComps, MIRBuilder, TR);
 
-  Register sizeVec = resVReg;
-  SPIRVType *sizeVecTy = retType;
-  if (numTempComps != numRetComps) {
-    sizeVec = MRI->createGenericVirtualRegister(LLT::vector(numTempComps, 32));
-    auto I32Ty = TR->getOpTypeInt(32, MIRBuilder);
-    sizeVecTy = TR->getOpTypeVector(numTempComps, I32Ty, MIRBuilder);
-    TR->assignSPIRVTypeToVReg(sizeVecTy, sizeVec, MIRBuilder);
-  }
-
-  auto MIB = MIRBuilder.buildInstr(SPIRV::OpImageQuerySize)
-                 .addDef(sizeVec)
-                 .addUse(TR->getSPIRVTypeID(sizeVecTy))
-                 .addUse(img);
-  bool success = TR->constrainRegOperands(MIB);
-  if (numTempComps == numRetComps || !success) {
-    return success;
+  if (numTempComps == numRetComps) {
+    // The cached query has its own VReg
+    auto MIB = MIRBuilder.buildInstr(SPIRV::OpCopyObject)
+                   .addDef(resVReg)
+                   .addUse(TR->getSPIRVTypeID(retType))
+                   .addUse(sizeVec);
+    return TR->constrainRegOperands(MIB);
   }
   if (numRetComps == 1) {
     // Need an OpCompositeExtract
@@ -540,6 +778,63 @@ static bool genImageSizeQuery(MachineIRBuilder &MIRBuilder, Register resVReg,
   }
 }
 
+// Compute get_local_linear_id as lid.x + lid.y * X + lid.z * X * Y from the
+// LocalInvocationId and the work-group sizes, whose strides are constants
+// for a kernel with a reqd_work_group_size.
+static bool genLocalLinearId(MachineIRBuilder &MIRBuilder, Register resVReg,
+                             SPIRVType *retType, SPIRVTypeRegistry *TR) {
+  const unsigned resWidth = retType->getOperand(1).getImm();
+  const bool isShader =
+      MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>().isShader();
+  const unsigned int ptrSize = isShader ? 32 : TR->getPointerSize();
+  const auto sizeT = isShader ? TR->getOpTypeInt(32, MIRBuilder)
+                              : TR->getPtrUIntType(MIRBuilder);
+  const auto MRI = MIRBuilder.getMRI();
+
+  auto newSizeTReg = [&]() {
+    Register reg = MRI->createGenericVirtualRegister(LLT::scalar(ptrSize));
+    TR->assignSPIRVTypeToVReg(sizeT, reg, MIRBuilder);
+    return reg;
+  };
+  auto v3 = TR->getOpTypeVector(3, sizeT, MIRBuilder);
+  auto i32Ty = TR->getOpTypeInt(32, MIRBuilder);
+  auto extract = [&](Register vec, unsigned idx) {
+    Register elt = newSizeTReg();
+    Register idxReg = buildIConstant(idx, i32Ty, MIRBuilder, TR);
+    MIRBuilder.buildExtractVectorElement(elt, vec, idxReg);
+    return elt;
+  };
+  auto mul = [&](Register lhs, Register rhs) {
+    return MIRBuilder.buildMul(newSizeTReg(), lhs, rhs).getReg(0);
+  };
+
+  Register ids =
+      buildBuiltinVectorLoad(v3, BuiltIn::LocalInvocationId, MIRBuilder, TR);
+  Register strideY, strideZ;
+  auto reqdSizes = getRequiredWorkgroupSize(MIRBuilder.getMF(), false);
+  if (!reqdSizes.empty()) {
+    strideY = buildIConstant(reqdSizes[0], sizeT, MIRBuilder, TR);
+    strideZ =
+        buildIConstant(reqdSizes[0] * reqdSizes[1], sizeT, MIRBuilder, TR);
+  } else {
+    Register sizes =
+        buildBuiltinVectorLoad(v3, BuiltIn::WorkgroupSize, MIRBuilder, TR);
+    strideY = extract(sizes, 0);
+    strideZ = mul(strideY, extract(sizes, 1));
+  }
+
+  Register xy = MIRBuilder
+                    .buildAdd(newSizeTReg(), extract(ids, 0),
+                              mul(extract(ids, 1), strideY))
+                    .getReg(0);
+  Register linearId = ptrSize == resWidth ? resVReg : newSizeTReg();
+  MIRBuilder.buildAdd(linearId, xy, mul(extract(ids, 2), strideZ));
+  if (ptrSize != resWidth) {
+    MIRBuilder.buildZExtOrTrunc(resVReg, linearId);
+  }
+  return true;
+}
+
 static bool genGlobalLocalQuery(MachineIRBuilder &MIRBuilder,
                                 const StringRef globLocStr, bool global,
                                 Register ret, SPIRVType *retTy,
@@ -551,6 +846,8 @@ static bool genGlobalLocalQuery(MachineIRBuilder &MIRBuilder,
   } else if (globLocStr.startswith("size")) {
     auto BI = global ? BuiltIn::GlobalSize : BuiltIn::WorkgroupSize;
     return genWorkgroupQuery(MIRBuilder, ret, retTy, args, TR, BI, 1);
+  } else if (!global && globLocStr.startswith("linear_id")) {
+    return genLocalLinearId(MIRBuilder, ret, retTy, TR);
   } else if (globLocStr.startswith("linear_id")) {
     // TODO
   } else if (global && globLocStr.startswith("offset")) {
@@ -578,6 +875,13 @@ static bool genImageQuery(MachineIRBuilder &MIRBuilder,
   report_fatal_error("Cannot handle OpenCL img query: get_image_" + queryStr);
 }
 
+// Get the scope of an atomic without an explicit scope argument. OpenCL uses
+// memory_scope_device then, but only the work items of a workgroup can access
+// its Workgroup memory, so atomics on it need no wider scope than that.
+static Scope::Scope getDefaultAtomicScope(StorageClass::StorageClass sc) {
+  return sc == StorageClass::Workgroup ? Scope::Workgroup : Scope::Device;
+}
+
 static bool genAtomicCmpXchg(MachineIRBuilder &MIRBuilder, Register resVReg,
                              SPIRVType *retType, bool isWeak,
                              const SmallVectorImpl<Register> &OrigArgs,
@@ -603,27 +907,30 @@ static bool genAtomicCmpXchg(MachineIRBuilder &MIRBuilder, Register resVReg,
 
   Register memSemEqualReg;
   Register memSemUnequalReg;
-  auto memSemEqual = MemorySemantics::SequentiallyConsistent | memSemStorage;
-  auto memSemUnequal = MemorySemantics::SequentiallyConsistent | memSemStorage;
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  auto memSemEqual = getAtomicMemSemantics(
+      MemorySemantics::SequentiallyConsistent, memSemStorage, ST);
+  auto memSemUnequal = memSemEqual;
   if (OrigArgs.size() >= 4) {
     assert(OrigArgs.size() >= 5 && "Need 5+ args for explicit atomic cmpxchg");
     auto memOrdEq = static_cast<CLMemOrder>(getIConstVal(OrigArgs[3], MRI));
     auto memOrdNeq = static_cast<CLMemOrder>(getIConstVal(OrigArgs[4], MRI));
-    memSemEqual = getSPIRVMemSemantics(memOrdEq) | memSemStorage;
-    memSemUnequal = getSPIRVMemSemantics(memOrdNeq) | memSemStorage;
+    memSemEqual = getAtomicMemSemantics(getSPIRVMemSemantics(memOrdEq),
+                                        memSemStorage, ST);
+    memSemUnequal = getAtomicMemSemantics(getSPIRVMemSemantics(memOrdNeq),
+                                          memSemStorage, ST);
     if (memOrdEq == memSemEqual)
       memSemEqualReg = OrigArgs[3];
-    if (memOrdNeq == memSemEqual)
+    if (memOrdNeq == memSemUnequal)
       memSemUnequalReg = OrigArgs[4];
   }
-  auto I32Ty = TR->getOpTypeInt(32, MIRBuilder);
   if (!memSemEqualReg.isValid())
-    memSemEqualReg = buildIConstant(memSemEqual, I32Ty, MIRBuilder, TR);
+    memSemEqualReg = getOrBuildI32Constant(memSemEqual, MIRBuilder, TR);
   if (!memSemUnequalReg.isValid())
-    memSemUnequalReg = buildIConstant(memSemUnequal, I32Ty, MIRBuilder, TR);
+    memSemUnequalReg = getOrBuildI32Constant(memSemUnequal, MIRBuilder, TR);
 
   Register scopeReg;
-  auto scope = Scope::Device;
+  auto scope = getDefaultAtomicScope(storageClass);
   if (OrigArgs.size() >= 6) {
     assert(OrigArgs.size() == 6 && "Extra args for explicit atomic cmpxchg");
     auto clScope = static_cast<CLMemScope>(getIConstVal(OrigArgs[5], MRI));
@@ -632,7 +939,7 @@ static bool genAtomicCmpXchg(MachineIRBuilder &MIRBuilder, Register resVReg,
       scopeReg = OrigArgs[5];
   }
   if (!scopeReg.isValid())
-    scopeReg = buildIConstant(scope, I32Ty, MIRBuilder, TR);
+    scopeReg = getOrBuildI32Constant(scope, MIRBuilder, TR);
 
   Register expected = buildLoad(spvDesiredTy, expectedPtr, MIRBuilder, TR);
   MRI->setType(expected, desiredLLT);
@@ -652,39 +959,47 @@ static bool genAtomicCmpXchg(MachineIRBuilder &MIRBuilder, Register resVReg,
   return TR->constrainRegOperands(MIB);
 }
 
+// Build an atomic read-modify-write instruction. Without an explicit order
+// argument, the order is relaxed for the OpenCL 1.x atomics (isLegacy), or
+// sequentially consistent for the OpenCL 2.0 ones, and without an explicit
+// scope, the narrowest one the pointer's storage class allows is used.
 static bool genAtomicRMW(Register resVReg, const SPIRVType *resType,
-                         unsigned RMWOpcode, MachineIRBuilder &MIRBuilder,
+                         unsigned RMWOpcode, bool isLegacy,
+                         MachineIRBuilder &MIRBuilder,
                          const SmallVectorImpl<Register> &OrigArgs,
                          SPIRVTypeRegistry *TR) {
   assert(OrigArgs.size() >= 2 && "Need 2+ args to atomic RMW instr");
   const auto MRI = MIRBuilder.getMRI();
-  auto I32Ty = TR->getOpTypeInt(32, MIRBuilder);
+  auto ptr = OrigArgs[0];
+  const auto storageClass = TR->getPointerStorageClass(ptr);
 
   Register scopeReg;
-  auto scope = Scope::Device;
+  auto scope = getDefaultAtomicScope(storageClass);
   if (OrigArgs.size() >= 4) {
     assert(OrigArgs.size() == 4 && "Extra args for explicit atomic RMW");
-    auto clScope = static_cast<CLMemScope>(getIConstVal(OrigArgs[5], MRI));
+    auto clScope = static_cast<CLMemScope>(getIConstVal(OrigArgs[3], MRI));
     scope = getSPIRVScope(clScope);
     if (clScope == static_cast<unsigned>(scope))
-      scopeReg = OrigArgs[5];
+      scopeReg = OrigArgs[3];
   }
   if (!scopeReg.isValid())
-    scopeReg = buildIConstant(scope, I32Ty, MIRBuilder, TR);
+    scopeReg = getOrBuildI32Constant(scope, MIRBuilder, TR);
 
-  auto ptr = OrigArgs[0];
-  auto scSem = getMemSemanticsForStorageClass(TR->getPointerStorageClass(ptr));
+  auto scSem = getMemSemanticsForStorageClass(storageClass);
 
   Register memSemReg;
-  auto memSem = MemorySemantics::SequentiallyConsistent | scSem;
+  auto memOrder = isLegacy ? MemorySemantics::None
+                           : MemorySemantics::SequentiallyConsistent;
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  unsigned memSem = getAtomicMemSemantics(memOrder, scSem, ST);
   if (OrigArgs.size() >= 3) {
     auto memOrd = static_cast<CLMemOrder>(getIConstVal(OrigArgs[2], MRI));
-    memSem = getSPIRVMemSemantics(memOrd) | scSem;
+    memSem = getAtomicMemSemantics(getSPIRVMemSemantics(memOrd), scSem, ST);
     if (memOrd == memSem)
-      memSemReg = OrigArgs[3];
+      memSemReg = OrigArgs[2];
   }
   if (!memSemReg.isValid())
-    memSemReg = buildIConstant(memSem, I32Ty, MIRBuilder, TR);
+    memSemReg = getOrBuildI32Constant(memSem, MIRBuilder, TR);
 
   auto MIB = MIRBuilder.buildInstr(RMWOpcode)
                  .addDef(resVReg)
@@ -696,12 +1011,29 @@ static bool genAtomicRMW(Register resVReg, const SPIRVType *resType,
   return TR->constrainRegOperands(MIB);
 }
 
+// Get the opcode of an atomic float instruction defined by the given extension,
+// reporting an error if the subtarget can't use it.
+static unsigned getAtomicFloatOpcode(unsigned opcode, Extension::Extension ext,
+                                     const StringRef atomicStr,
+                                     MachineIRBuilder &MIRBuilder) {
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  if (!ST.canUseExtension(ext)) {
+    report_fatal_error("OpenCL atomic func atomic_" + atomicStr +
+                       " on floats requires " + getExtensionName(ext));
+  }
+  return opcode;
+}
+
 static bool genAtomicInstr(MachineIRBuilder &MIRBuilder,
-                           const StringRef atomicStr, Register ret,
-                           SPIRVType *retTy,
+                           const StringRef atomicStr, bool isLegacy,
+                           bool isUnsigned, Register ret, SPIRVType *retTy,
                            const SmallVectorImpl<Register> &args,
                            SPIRVTypeRegistry *TR) {
   using namespace SPIRV;
+  // The value operand's type selects float instrs, and the mangled name's
+  // parameter types give the signedness of integers
+  const bool isFloat =
+      args.size() >= 2 && TR->isScalarOfType(args[1], OpTypeFloat);
   if (atomicStr.startswith("compare_exchange_")) {
     const auto cmp_xchg = atomicStr.substr(strlen("compare_exchange_"));
     if (cmp_xchg.startswith("weak")) {
@@ -710,35 +1042,55 @@ static bool genAtomicInstr(MachineIRBuilder &MIRBuilder,
       return genAtomicCmpXchg(MIRBuilder, ret, retTy, false, args, TR);
     }
   } else if (atomicStr.startswith("add")) {
-    return genAtomicRMW(ret, retTy, OpAtomicIAdd, MIRBuilder, args, TR);
+    unsigned opcode = OpAtomicIAdd;
+    if (isFloat) {
+      opcode = getAtomicFloatOpcode(OpAtomicFAddEXT,
+                                    Extension::SPV_EXT_shader_atomic_float_add,
+                                    atomicStr, MIRBuilder);
+    }
+    return genAtomicRMW(ret, retTy, opcode, isLegacy, MIRBuilder, args, TR);
   } else if (atomicStr.startswith("sub")) {
-    return genAtomicRMW(ret, retTy, OpAtomicISub, MIRBuilder, args, TR);
+    return genAtomicRMW(ret, retTy, OpAtomicISub, isLegacy, MIRBuilder, args,
+                        TR);
   } else if (atomicStr.startswith("or")) {
-    return genAtomicRMW(ret, retTy, OpAtomicOr, MIRBuilder, args, TR);
+    return genAtomicRMW(ret, retTy, OpAtomicOr, isLegacy, MIRBuilder, args,
+                        TR);
   } else if (atomicStr.startswith("xor")) {
-    return genAtomicRMW(ret, retTy, OpAtomicXor, MIRBuilder, args, TR);
+    return genAtomicRMW(ret, retTy, OpAtomicXor, isLegacy, MIRBuilder, args,
+                        TR);
   } else if (atomicStr.startswith("and")) {
-    return genAtomicRMW(ret, retTy, OpAtomicAnd, MIRBuilder, args, TR);
-  } else if (atomicStr[0] == 'm') {
-    // TODO check the arg types for signedness
-    // if (atomicStr.startswith("min")) {
-    //   return genAtomicRMW(ret, retTy, OpAtomicUMax, MIRBuilder, args, TR);
-    // } else if (atomicStr.startswith("max")) {
-    //   return genAtomicRMW(ret, retTy, OpAtomicUMax, MIRBuilder, args, TR);
-    // }
+    return genAtomicRMW(ret, retTy, OpAtomicAnd, isLegacy, MIRBuilder, args,
+                        TR);
+  } else if (atomicStr.startswith("min") || atomicStr.startswith("max")) {
+    const bool isMin = atomicStr.startswith("min");
+    unsigned opcode;
+    if (isFloat) {
+      opcode = getAtomicFloatOpcode(
+          isMin ? OpAtomicFMinEXT : OpAtomicFMaxEXT,
+          Extension::SPV_EXT_shader_atomic_float_min_max, atomicStr,
+          MIRBuilder);
+    } else if (isUnsigned) {
+      opcode = isMin ? OpAtomicUMin : OpAtomicUMax;
+    } else {
+      opcode = isMin ? OpAtomicSMin : OpAtomicSMax;
+    }
+    return genAtomicRMW(ret, retTy, opcode, isLegacy, MIRBuilder, args, TR);
   } else if (atomicStr.startswith("exchange")) {
-    return genAtomicRMW(ret, retTy, OpAtomicExchange, MIRBuilder, args, TR);
+    return genAtomicRMW(ret, retTy, OpAtomicExchange, false, MIRBuilder, args,
+                        TR);
   }
 
   report_fatal_error("Cannot handle OpenCL atomic func: atomic_" + atomicStr);
 }
 
-static bool genBarrier(MachineIRBuilder &MIRBuilder,
+// Build an OpControlBarrier for barrier(flags), work_group_barrier(flags[,
+// scope]) or sub_group_barrier(flags[, scope]), which wait for the work-items
+// in execScope. The memory scope defaults to execScope too.
+static bool genBarrier(MachineIRBuilder &MIRBuilder, Scope::Scope execScope,
                        const SmallVectorImpl<Register> &OrigArgs,
                        SPIRVTypeRegistry *TR) {
   assert(OrigArgs.size() >= 1 && "Missing args for OpenCL barrier func");
   const auto MRI = MIRBuilder.getMRI();
-  const auto I32Ty = TR->getOpTypeInt(32, MIRBuilder);
 
   unsigned memFlags = getIConstVal(OrigArgs[0], MRI);
   unsigned memSem = MemorySemantics::None;
@@ -751,15 +1103,22 @@ static bool genBarrier(MachineIRBuilder &MIRBuilder,
   if (memFlags & CLK_IMAGE_MEM_FENCE) {
     memSem |= MemorySemantics::ImageMemory;
   }
+  // OpenCL barriers order the memory they're given implicitly, which the
+  // Vulkan memory model needs explicitly
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  if (ST.usesVulkanMemoryModel() && memSem != MemorySemantics::None) {
+    memSem = ST.getMemSemanticsForMemoryModel(
+        memSem | MemorySemantics::AcquireRelease);
+  }
   Register memSemReg;
   if (memFlags == memSem) {
     memSemReg = OrigArgs[0];
   } else {
-    memSemReg = buildIConstant(memSem, I32Ty, MIRBuilder, TR);
+    memSemReg = getOrBuildI32Constant(memSem, MIRBuilder, TR);
   }
 
   Register scopeReg;
-  auto scope = Scope::Workgroup;
+  auto scope = execScope;
   if (OrigArgs.size() >= 2) {
     assert(OrigArgs.size() == 2 && "Extra args for explicitly scoped barrier");
     auto clScope = static_cast<CLMemScope>(getIConstVal(OrigArgs[1], MRI));
@@ -770,115 +1129,686 @@ static bool genBarrier(MachineIRBuilder &MIRBuilder,
       scopeReg = OrigArgs[1];
   }
   if (!scopeReg.isValid())
-    scopeReg = buildIConstant(scope, I32Ty, MIRBuilder, TR);
+    scopeReg = getOrBuildI32Constant(scope, MIRBuilder, TR);
+
+  Register execScopeReg = scopeReg;
+  if (scope != execScope)
+    execScopeReg = getOrBuildI32Constant(execScope, MIRBuilder, TR);
 
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpControlBarrier)
-                 .addUse(scopeReg)
+                 .addUse(execScopeReg)
                  .addUse(scopeReg)
                  .addUse(memSemReg);
   return TR->constrainRegOperands(MIB);
 }
 
-static bool genConvertInstr(MachineIRBuilder &MIRBuilder,
-                            const StringRef convertStr, Register ret,
-                            SPIRVType *retTy,
+// Build the bool of whether the int val is nonzero.
+static Register buildIntToBool(Register val, MachineIRBuilder &MIRBuilder,
+                               SPIRVTypeRegistry *TR) {
+  auto boolTy = TR->getOpTypeBool(MIRBuilder);
+  auto valTy = TR->getSPIRVTypeForVReg(val);
+  auto MRI = MIRBuilder.getMRI();
+  Register res = MRI->createGenericVirtualRegister(LLT::scalar(1));
+  TR->assignSPIRVTypeToVReg(boolTy, res, MIRBuilder);
+  Register zero = buildIConstant(0, valTy, MIRBuilder, TR);
+  MIRBuilder.buildICmp(CmpInst::ICMP_NE, res, val, zero);
+  return res;
+}
+
+// Build the int res of type resTy as 1 if the bool val is true, else 0.
+static void buildBoolToInt(Register res, SPIRVType *resTy, Register val,
+                           MachineIRBuilder &MIRBuilder,
+                           SPIRVTypeRegistry *TR) {
+  Register one = buildIConstant(1, resTy, MIRBuilder, TR);
+  Register zero = buildIConstant(0, resTy, MIRBuilder, TR);
+  MIRBuilder.buildSelect(res, val, one, zero);
+}
+
+// Lower the sub-group functions of cl_khr_subgroup_non_uniform_vote and
+// cl_khr_subgroup_ballot, named as funcStr follows the sub_group_ prefix, to
+// the GroupNonUniform instructions. If their capability is unavailable, the
+// votes, ballots and broadcasts use the SPV_KHR_subgroup_vote and
+// SPV_KHR_shader_ballot instructions instead, which also only consider the
+// active invocations. Int predicates and results are converted to and from
+// bools.
+static bool genSubgroupVoteBallot(MachineIRBuilder &MIRBuilder,
+                                  StringRef funcStr, Register resVReg,
+                                  SPIRVType *retType,
+                                  const SmallVectorImpl<Register> &OrigArgs,
+                                  SPIRVTypeRegistry *TR) {
+  using namespace SPIRV;
+  using namespace Capability;
+  unsigned opcode;
+  unsigned khrOpcode = 0;
+  Capability::Capability cap = GroupNonUniformBallot;
+  bool hasPredArg = false;
+  bool hasBoolRes = false;
+  Optional<GroupOperation::GroupOperation> groupOp;
+  if (funcStr == "elect") {
+    opcode = OpGroupNonUniformElect;
+    cap = GroupNonUniform;
+    hasBoolRes = true;
+  } else if (funcStr == "non_uniform_all" || funcStr == "non_uniform_any") {
+    const bool isAll = funcStr == "non_uniform_all";
+    opcode = isAll ? OpGroupNonUniformAll : OpGroupNonUniformAny;
+    khrOpcode = isAll ? OpSubgroupAllKHR : OpSubgroupAnyKHR;
+    cap = GroupNonUniformVote;
+    hasPredArg = hasBoolRes = true;
+  } else if (funcStr == "non_uniform_all_equal") {
+    opcode = OpGroupNonUniformAllEqual;
+    khrOpcode = OpSubgroupAllEqualKHR;
+    cap = GroupNonUniformVote;
+    hasBoolRes = true;
+  } else if (funcStr == "non_uniform_broadcast") {
+    opcode = OpGroupNonUniformBroadcast;
+    khrOpcode = OpSubgroupReadInvocationKHR;
+  } else if (funcStr == "broadcast_first") {
+    opcode = OpGroupNonUniformBroadcastFirst;
+    khrOpcode = OpSubgroupFirstInvocationKHR;
+  } else if (funcStr == "ballot") {
+    opcode = OpGroupNonUniformBallot;
+    khrOpcode = OpSubgroupBallotKHR;
+    hasPredArg = true;
+  } else if (funcStr == "inverse_ballot") {
+    opcode = OpGroupNonUniformInverseBallot;
+    hasBoolRes = true;
+  } else if (funcStr == "ballot_bit_extract") {
+    opcode = OpGroupNonUniformBallotBitExtract;
+    hasBoolRes = true;
+  } else if (funcStr == "ballot_bit_count") {
+    opcode = OpGroupNonUniformBallotBitCount;
+    groupOp = GroupOperation::Reduce;
+  } else if (funcStr == "ballot_inclusive_scan") {
+    opcode = OpGroupNonUniformBallotBitCount;
+    groupOp = GroupOperation::InclusiveScan;
+  } else if (funcStr == "ballot_exclusive_scan") {
+    opcode = OpGroupNonUniformBallotBitCount;
+    groupOp = GroupOperation::ExclusiveScan;
+  } else if (funcStr == "ballot_find_lsb") {
+    opcode = OpGroupNonUniformBallotFindLSB;
+  } else if (funcStr == "ballot_find_msb") {
+    opcode = OpGroupNonUniformBallotFindMSB;
+  } else {
+    report_fatal_error("Cannot handle OpenCL func sub_group_" + funcStr);
+  }
+
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  const bool useKHR = !ST.canUseCapability(cap);
+  if (useKHR) {
+    const auto khrCap =
+        cap == GroupNonUniformVote ? SubgroupVoteKHR : SubgroupBallotKHR;
+    if (!khrOpcode || !ST.canUseCapability(khrCap)) {
+      report_fatal_error("OpenCL func sub_group_" + funcStr + " requires " +
+                         getCapabilityName(cap));
+    }
+    opcode = khrOpcode;
+  }
+
+  Register res = resVReg;
+  SPIRVType *resTy = retType;
+  if (hasBoolRes) {
+    resTy = TR->getOpTypeBool(MIRBuilder);
+    res = MIRBuilder.getMRI()->createGenericVirtualRegister(LLT::scalar(1));
+    TR->assignSPIRVTypeToVReg(resTy, res, MIRBuilder);
+  }
+  auto MIB = MIRBuilder.buildInstr(opcode).addDef(res).addUse(
+      TR->getSPIRVTypeID(resTy));
+  // The KHR instructions are always over the sub-group
+  if (!useKHR) {
+    MIB.addUse(getOrBuildI32Constant(Scope::Subgroup, MIRBuilder, TR));
+  }
+  if (groupOp) {
+    MIB.addImm(*groupOp);
+  }
+  for (unsigned i = 0; i < OrigArgs.size(); ++i) {
+    if (i == 0 && hasPredArg) {
+      MIB.addUse(buildIntToBool(OrigArgs[0], MIRBuilder, TR));
+    } else {
+      MIB.addUse(OrigArgs[i]);
+    }
+  }
+  if (hasBoolRes) {
+    buildBoolToInt(resVReg, retType, res, MIRBuilder, TR);
+  }
+  return TR->constrainRegOperands(MIB);
+}
+
+// The OpGroup* instructions for each arithmetic group function, for unsigned,
+// signed and floating point operands respectively.
+static const std::tuple<const char *, unsigned, unsigned, unsigned>
+    groupArithmeticOps[] = {
+        {"add", SPIRV::OpGroupIAdd, SPIRV::OpGroupIAdd, SPIRV::OpGroupFAdd},
+        {"min", SPIRV::OpGroupUMin, SPIRV::OpGroupSMin, SPIRV::OpGroupFMin},
+        {"max", SPIRV::OpGroupUMax, SPIRV::OpGroupSMax, SPIRV::OpGroupFMax}};
+
+// Whether genGroupInstr lowers the group function named as groupStr follows
+// the sub_group_ or work_group_ prefix, so the others can be called instead.
+static bool isLoweredGroupFunc(StringRef groupStr) {
+  if (groupStr == "all" || groupStr == "any" || groupStr == "broadcast") {
+    return true;
+  }
+  if (!groupStr.consume_front("reduce_") &&
+      !groupStr.consume_front("scan_inclusive_") &&
+      !groupStr.consume_front("scan_exclusive_")) {
+    return false;
+  }
+  for (const auto &op : groupArithmeticOps) {
+    if (groupStr == std::get<0>(op)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Lower the collective functions of the given scope, named as groupStr follows
+// the sub_group_ or work_group_ prefix:
+//  - reduce_<op>, scan_inclusive_<op> and scan_exclusive_<op>, for the ops in
+//    groupArithmeticOps, to OpGroup<Op> with the matching GroupOperation.
+//  - broadcast to OpGroupBroadcast, with up to 3 local ids built into a vector.
+//  - all and any to OpGroupAll and OpGroupAny, converting the int predicate
+//    and result to and from bools. Sub-groups without the Groups capability
+//    use the equivalent votes of genSubgroupVoteBallot instead.
+static bool genGroupInstr(MachineIRBuilder &MIRBuilder, StringRef groupStr,
+                          Scope::Scope scope, bool isUnsigned, Register resVReg,
+                          SPIRVType *retType,
+                          const SmallVectorImpl<Register> &OrigArgs,
+                          SPIRVTypeRegistry *TR) {
+  assert(!OrigArgs.empty() && "Missing args for OpenCL group func");
+  using namespace SPIRV;
+  const auto MRI = MIRBuilder.getMRI();
+  Register scopeReg = getOrBuildI32Constant(scope, MIRBuilder, TR);
+
+  if (groupStr == "all" || groupStr == "any") {
+    const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+    if (scope == Scope::Subgroup &&
+        !ST.canUseCapability(Capability::Groups)) {
+      const std::string voteStr = ("non_uniform_" + groupStr).str();
+      return genSubgroupVoteBallot(MIRBuilder, voteStr, resVReg, retType,
+                                   OrigArgs, TR);
+    }
+    auto boolTy = TR->getOpTypeBool(MIRBuilder);
+    Register pred = buildIntToBool(OrigArgs[0], MIRBuilder, TR);
+    Register boolRes = MRI->createGenericVirtualRegister(LLT::scalar(1));
+    TR->assignSPIRVTypeToVReg(boolTy, boolRes, MIRBuilder);
+    unsigned opcode = groupStr == "all" ? OpGroupAll : OpGroupAny;
+    auto MIB = MIRBuilder.buildInstr(opcode)
+                   .addDef(boolRes)
+                   .addUse(TR->getSPIRVTypeID(boolTy))
+                   .addUse(scopeReg)
+                   .addUse(pred);
+    buildBoolToInt(resVReg, retType, boolRes, MIRBuilder, TR);
+    return TR->constrainRegOperands(MIB);
+  }
+
+  if (groupStr == "broadcast") {
+    assert(OrigArgs.size() >= 2 && OrigArgs.size() <= 4 &&
+           "Group broadcasts need a value and 1 to 3 local ids");
+    Register localId = OrigArgs[1];
+    if (OrigArgs.size() > 2) {
+      auto idTy = TR->getSPIRVTypeForVReg(OrigArgs[1]);
+      auto vecTy = TR->getOpTypeVector(OrigArgs.size() - 1, idTy, MIRBuilder);
+      localId = MRI->createVirtualRegister(&SPIRV::IDRegClass);
+      TR->assignSPIRVTypeToVReg(vecTy, localId, MIRBuilder);
+      auto vecMIB = MIRBuilder.buildInstr(OpCompositeConstruct)
+                        .addDef(localId)
+                        .addUse(TR->getSPIRVTypeID(vecTy));
+      for (unsigned i = 1; i < OrigArgs.size(); ++i) {
+        vecMIB.addUse(OrigArgs[i]);
+      }
+      TR->constrainRegOperands(vecMIB);
+    }
+    auto MIB = MIRBuilder.buildInstr(OpGroupBroadcast)
+                   .addDef(resVReg)
+                   .addUse(TR->getSPIRVTypeID(retType))
+                   .addUse(scopeReg)
+                   .addUse(OrigArgs[0])
+                   .addUse(localId);
+    return TR->constrainRegOperands(MIB);
+  }
+
+  GroupOperation::GroupOperation groupOp;
+  if (groupStr.consume_front("reduce_")) {
+    groupOp = GroupOperation::Reduce;
+  } else if (groupStr.consume_front("scan_inclusive_")) {
+    groupOp = GroupOperation::InclusiveScan;
+  } else if (groupStr.consume_front("scan_exclusive_")) {
+    groupOp = GroupOperation::ExclusiveScan;
+  } else {
+    report_fatal_error("Cannot handle OpenCL group func: " + groupStr);
+  }
+  for (const auto &op : groupArithmeticOps) {
+    if (groupStr != std::get<0>(op))
+      continue;
+    unsigned opcode = std::get<1>(op);
+    if (TR->isScalarOrVectorOfType(OrigArgs[0], OpTypeFloat)) {
+      opcode = std::get<3>(op);
+    } else if (!isUnsigned) {
+      opcode = std::get<2>(op);
+    }
+    auto MIB = MIRBuilder.buildInstr(opcode)
+                   .addDef(resVReg)
+                   .addUse(TR->getSPIRVTypeID(retType))
+                   .addUse(scopeReg)
+                   .addImm(groupOp)
+                   .addUse(OrigArgs[0]);
+    return TR->constrainRegOperands(MIB);
+  }
+  report_fatal_error("Cannot handle OpenCL group func op: " + groupStr);
+}
+
+// Lower intel_sub_group_media_block_read/write_{uc|us|ui}[N] from
+// cl_intel_media_block_io, whose image is their last arg, to the SPIR-V
+// instructions taking it first
+static bool genIntelMediaBlockInstr(MachineIRBuilder &MIRBuilder,
+                                    StringRef subgroupStr, Register resVReg,
+                                    SPIRVType *retType,
+                                    const SmallVectorImpl<Register> &OrigArgs,
+                                    SPIRVTypeRegistry *TR) {
+  using namespace SPIRV;
+  const bool isRead = subgroupStr.startswith("media_block_read");
+  if (OrigArgs.size() != (isRead ? 4u : 5u) ||
+      TR->getSPIRVTypeForVReg(OrigArgs.back())->getOpcode() != OpTypeImage) {
+    report_fatal_error("Wrong args for OpenCL func intel_sub_group_" +
+                       subgroupStr);
+  }
+  const unsigned opcode = isRead ? OpSubgroupImageMediaBlockReadINTEL
+                                 : OpSubgroupImageMediaBlockWriteINTEL;
+  auto MIB = MIRBuilder.buildInstr(opcode);
+  if (isRead) {
+    MIB.addDef(resVReg).addUse(TR->getSPIRVTypeID(retType));
+  }
+  MIB.addUse(OrigArgs.back());
+  for (Register arg : makeArrayRef(OrigArgs).drop_back()) {
+    MIB.addUse(arg);
+  }
+  return TR->constrainRegOperands(MIB);
+}
+
+// Lower the cl_intel_subgroups functions intel_sub_group_shuffle[_down|_up|
+// _xor] and intel_sub_group_block_read/write[_us|_uc|_ul][N], whose operands
+// are the builtin's args in order. Block reads and writes take an image rather
+// than a pointer as their first arg for the image variants.
+static bool genIntelSubgroupInstr(MachineIRBuilder &MIRBuilder,
+                                  StringRef subgroupStr, Register resVReg,
+                                  SPIRVType *retType,
+                                  const SmallVectorImpl<Register> &OrigArgs,
+                                  SPIRVTypeRegistry *TR) {
+  using namespace SPIRV;
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  const bool isMedia = subgroupStr.startswith("media_block_");
+  const auto ext = isMedia ? Extension::SPV_INTEL_media_block_io
+                           : Extension::SPV_INTEL_subgroups;
+  if (!ST.canUseExtension(ext)) {
+    report_fatal_error("OpenCL func intel_sub_group_" + subgroupStr +
+                       " requires " + getExtensionName(ext));
+  }
+  if (isMedia) {
+    return genIntelMediaBlockInstr(MIRBuilder, subgroupStr, resVReg, retType,
+                                   OrigArgs, TR);
+  }
+  assert(!OrigArgs.empty() && "Missing args for OpenCL intel subgroup func");
+  const bool isImage =
+      TR->getSPIRVTypeForVReg(OrigArgs[0])->getOpcode() == OpTypeImage;
+  unsigned opcode;
+  unsigned numArgs;
+  if (subgroupStr == "shuffle") {
+    opcode = OpSubgroupShuffleINTEL;
+    numArgs = 2;
+  } else if (subgroupStr == "shuffle_down") {
+    opcode = OpSubgroupShuffleDownINTEL;
+    numArgs = 3;
+  } else if (subgroupStr == "shuffle_up") {
+    opcode = OpSubgroupShuffleUpINTEL;
+    numArgs = 3;
+  } else if (subgroupStr == "shuffle_xor") {
+    opcode = OpSubgroupShuffleXorINTEL;
+    numArgs = 2;
+  } else if (subgroupStr.startswith("block_read")) {
+    opcode = isImage ? OpSubgroupImageBlockReadINTEL : OpSubgroupBlockReadINTEL;
+    numArgs = isImage ? 2 : 1;
+  } else if (subgroupStr.startswith("block_write")) {
+    opcode =
+        isImage ? OpSubgroupImageBlockWriteINTEL : OpSubgroupBlockWriteINTEL;
+    numArgs = isImage ? 3 : 2;
+  } else {
+    report_fatal_error("Cannot handle OpenCL func intel_sub_group_" +
+                       subgroupStr);
+  }
+  if (OrigArgs.size() != numArgs) {
+    report_fatal_error("Wrong number of args for OpenCL func intel_sub_group_" +
+                       subgroupStr);
+  }
+  auto MIB = MIRBuilder.buildInstr(opcode);
+  if (retType) {
+    MIB.addDef(resVReg).addUse(TR->getSPIRVTypeID(retType));
+  }
+  for (Register arg : OrigArgs) {
+    MIB.addUse(arg);
+  }
+  return TR->constrainRegOperands(MIB);
+}
+
+// Lower async_work_group_copy(dst, src, num_elements, event) and its strided
+// variant to OpGroupAsyncCopy, with a stride of 1 for the unstrided copies, and
+// wait_group_events(num_events, event_list) to OpGroupWaitEvents. The
+// work-items copying or waiting are the work-group.
+static bool genAsyncCopyInstr(MachineIRBuilder &MIRBuilder, StringRef name,
+                              Register resVReg, SPIRVType *retType,
+                              const SmallVectorImpl<Register> &OrigArgs,
+                              SPIRVTypeRegistry *TR) {
+  Register scopeReg = getOrBuildI32Constant(Scope::Workgroup, MIRBuilder, TR);
+  if (name == "wait_group_events") {
+    assert(OrigArgs.size() == 2 && "wait_group_events needs 2 args");
+    auto MIB = MIRBuilder.buildInstr(SPIRV::OpGroupWaitEvents)
+                   .addUse(scopeReg)
+                   .addUse(OrigArgs[0])
+                   .addUse(OrigArgs[1]);
+    return TR->constrainRegOperands(MIB);
+  }
+
+  const bool isStrided = name == "async_work_group_strided_copy";
+  assert(OrigArgs.size() == (isStrided ? 5u : 4u) &&
+         "Wrong number of args for async_work_group_copy");
+  Register stride;
+  if (isStrided) {
+    stride = OrigArgs[3];
+  } else {
+    SPIRVType *sizeT = TR->getSPIRVTypeForVReg(OrigArgs[2]);
+    stride = buildIConstant(1, sizeT, MIRBuilder, TR);
+  }
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpGroupAsyncCopy)
+                 .addDef(resVReg)
+                 .addUse(TR->getSPIRVTypeID(retType))
+                 .addUse(scopeReg)
+                 .addUse(OrigArgs[0])
+                 .addUse(OrigArgs[1])
+                 .addUse(OrigArgs[2])
+                 .addUse(stride)
+                 .addUse(OrigArgs.back());
+  return TR->constrainRegOperands(MIB);
+}
+
+// Build a pipe instruction, whose operands are the builtin's arguments in
+// order, after the scope for the work-group and sub-group variants.
+static bool genPipeInstr(MachineIRBuilder &MIRBuilder, unsigned opcode,
+                         Scope::Scope scope, Register resVReg,
+                         SPIRVType *retType,
+                         const SmallVectorImpl<Register> &OrigArgs,
+                         SPIRVTypeRegistry *TR) {
+  using namespace SPIRV;
+  const bool hasResult = opcode != OpCommitReadPipe &&
+                         opcode != OpCommitWritePipe &&
+                         opcode != OpGroupCommitReadPipe &&
+                         opcode != OpGroupCommitWritePipe;
+  const bool isGroup = opcode == OpGroupReserveReadPipePackets ||
+                       opcode == OpGroupReserveWritePipePackets ||
+                       opcode == OpGroupCommitReadPipe ||
+                       opcode == OpGroupCommitWritePipe;
+  if (hasResult && !retType) {
+    report_fatal_error("Pipe builtins with results must return a value");
+  }
+  auto MIB = MIRBuilder.buildInstr(opcode);
+  if (hasResult) {
+    MIB.addDef(resVReg).addUse(TR->getSPIRVTypeID(retType));
+  }
+  if (isGroup) {
+    MIB.addUse(getOrBuildI32Constant(scope, MIRBuilder, TR));
+  }
+  for (Register arg : OrigArgs) {
+    MIB.addUse(arg);
+  }
+  return TR->constrainRegOperands(MIB);
+}
+
+// Build a device enqueue event or queue instruction, whose operands are the
+// builtin's arguments in order.
+static bool genDeviceEnqueueInstr(MachineIRBuilder &MIRBuilder,
+                                  unsigned opcode, Register resVReg,
+                                  SPIRVType *retType,
+                                  const SmallVectorImpl<Register> &OrigArgs,
+                                  SPIRVTypeRegistry *TR) {
+  auto MIB = MIRBuilder.buildInstr(opcode);
+  if (retType) {
+    MIB.addDef(resVReg).addUse(TR->getSPIRVTypeID(retType));
+  }
+  for (Register arg : OrigArgs) {
+    MIB.addUse(arg);
+  }
+  return TR->constrainRegOperands(MIB);
+}
+
+// Build a SPV_NV_cooperative_matrix instruction from the __spirv_ function of
+// the same name, as the SPIR-V friendly IR of the SPIRV-LLVM-Translator names
+// them. The loads and stores take the pointer, the stride and whether the
+// matrix is column major, which may be an int. The length query takes a
+// matrix of the type to query.
+static bool genCooperativeMatrixInstr(MachineIRBuilder &MIRBuilder,
+                                      StringRef name, unsigned opcode,
+                                      Register resVReg, SPIRVType *retType,
+                                      const SmallVectorImpl<Register> &OrigArgs,
+                                      SPIRVTypeRegistry *TR) {
+  using namespace SPIRV;
+  const unsigned numArgs = opcode == OpCooperativeMatrixLoadNV     ? 3
+                           : opcode == OpCooperativeMatrixStoreNV  ? 4
+                           : opcode == OpCooperativeMatrixMulAddNV ? 3
+                                                                    : 1;
+  const bool hasResult = opcode != OpCooperativeMatrixStoreNV;
+  if (OrigArgs.size() != numArgs || (hasResult && !retType)) {
+    report_fatal_error("Invalid call to " + name);
+  }
+  auto MIB = MIRBuilder.buildInstr(opcode);
+  if (hasResult) {
+    MIB.addDef(resVReg).addUse(TR->getSPIRVTypeID(retType));
+  }
+  if (opcode == OpCooperativeMatrixLengthNV) {
+    MIB.addUse(TR->getSPIRVTypeID(TR->getSPIRVTypeForVReg(OrigArgs[0])));
+    return TR->constrainRegOperands(MIB);
+  }
+  for (unsigned i = 0; i < numArgs; ++i) {
+    const bool isColumnMajor = opcode != OpCooperativeMatrixMulAddNV &&
+                               i == numArgs - 1 &&
+                               !TR->isScalarOrVectorOfType(OrigArgs[i],
+                                                           OpTypeBool);
+    MIB.addUse(isColumnMajor ? buildIntToBool(OrigArgs[i], MIRBuilder, TR)
+                             : OrigArgs[i]);
+  }
+  return TR->constrainRegOperands(MIB);
+}
+
+// Build the OpBuildNDRange of ndrange_1D, ndrange_2D or ndrange_3D, and store
+// it to the ndrange_t the first argument points to. The sizes of 2D and 3D
+// ranges are pointers to arrays of them, and the local size and offset
+// default to zero.
+static bool genNDRange(MachineIRBuilder &MIRBuilder, StringRef name,
+                       const SmallVectorImpl<Register> &OrigArgs,
+                       SPIRVTypeRegistry *TR) {
+  using namespace SPIRV;
+  if (OrigArgs.size() < 2 || OrigArgs.size() > 4) {
+    report_fatal_error("Wrong number of args for " + name);
+  }
+  const auto MRI = MIRBuilder.getMRI();
+  auto buildTypedInstr = [&](unsigned opcode, SPIRVType *type) {
+    Register res = MRI->createVirtualRegister(&IDRegClass);
+    TR->assignSPIRVTypeToVReg(type, res, MIRBuilder);
+    return MIRBuilder.buildInstr(opcode).addDef(res).addUse(
+        TR->getSPIRVTypeID(type));
+  };
+  const unsigned dims = name[strlen("ndrange_")] - '0';
+  SmallVector<Register, 3> sizes;
+  for (unsigned i = 1; i < OrigArgs.size(); ++i) {
+    Register size = OrigArgs[i];
+    if (dims > 1) {
+      SPIRVType *ptrTy = TR->getSPIRVTypeForVReg(size);
+      SPIRVType *sizeTy =
+          TR->getSPIRVTypeForVReg(ptrTy->getOperand(2).getReg());
+      SPIRVType *arrTy = TR->getOpTypeArray(dims, sizeTy, MIRBuilder);
+      const auto sc = TR->getPointerStorageClass(size);
+      SPIRVType *arrPtrTy = TR->getOpTypePointer(sc, arrTy, MIRBuilder);
+      auto castMIB = buildTypedInstr(OpBitcast, arrPtrTy).addUse(size);
+      TR->constrainRegOperands(castMIB);
+      Register arrPtr = castMIB->getOperand(0).getReg();
+      auto loadMIB = buildTypedInstr(OpLoad, arrTy).addUse(arrPtr);
+      TR->constrainRegOperands(loadMIB);
+      size = loadMIB->getOperand(0).getReg();
+    }
+    sizes.push_back(size);
+  }
+  Register zero;
+  if (sizes.size() < 3) {
+    auto zeroMIB =
+        buildTypedInstr(OpConstantNull, TR->getSPIRVTypeForVReg(sizes[0]));
+    TR->constrainRegOperands(zeroMIB);
+    zero = zeroMIB->getOperand(0).getReg();
+  }
+  Register globalSize = sizes[sizes.size() == 3 ? 1 : 0];
+  Register localSize = sizes.size() == 1 ? zero : sizes.back();
+  Register offset = sizes.size() == 3 ? sizes[0] : zero;
+
+  SPIRVType *retPtrTy = TR->getSPIRVTypeForVReg(OrigArgs[0]);
+  SPIRVType *ndrangeTy =
+      TR->getSPIRVTypeForVReg(retPtrTy->getOperand(2).getReg());
+  auto MIB = buildTypedInstr(OpBuildNDRange, ndrangeTy)
+                 .addUse(globalSize)
+                 .addUse(localSize)
+                 .addUse(offset);
+  TR->constrainRegOperands(MIB);
+  auto storeMIB = MIRBuilder.buildInstr(OpStore)
+                      .addUse(OrigArgs[0])
+                      .addUse(MIB->getOperand(0).getReg());
+  return TR->constrainRegOperands(storeMIB);
+}
+
+// Cast a generic pointer to the storage class the to_* builtin names. Unlike
+// OpGenericCastToPtr, the result is null if the pointer is not in that
+// storage class.
+static bool genGenericCastToPtr(MachineIRBuilder &MIRBuilder, StringRef name,
+                                Register resVReg, SPIRVType *retType,
+                                const SmallVectorImpl<Register> &OrigArgs,
+                                SPIRVTypeRegistry *TR) {
+  assert(OrigArgs.size() == 1 && "Address space casts need 1 arg");
+  const auto storage = StringSwitch<StorageClass::StorageClass>(
+                           name.drop_while([](char c) { return c == '_'; }))
+                           .Case("to_global", StorageClass::CrossWorkgroup)
+                           .Case("to_local", StorageClass::Workgroup)
+                           .Default(StorageClass::Function);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpGenericCastToPtrExplicit)
+                 .addDef(resVReg)
+                 .addUse(TR->getSPIRVTypeID(retType))
+                 .addUse(OrigArgs[0])
+                 .addImm(storage);
+  return TR->constrainRegOperands(MIB);
+}
+
+// Build the single conversion instruction a convert_* builtin needs, with
+// the saturation and rounding mode its name gives as decorations.
+static bool genConvertInstr(MachineIRBuilder &MIRBuilder, StringRef name,
+                            bool srcSign, bool dstSign, bool isSat,
+                            int roundingMode, Register ret, SPIRVType *retTy,
                             const SmallVectorImpl<Register> &args,
                             SPIRVTypeRegistry *TR) {
   using namespace SPIRV;
   Register src = args[0];
-  bool isFromInt = TR->isScalarOrVectorOfType(src, OpTypeInt);
-  bool isFromFloat = !isFromInt && TR->isScalarOrVectorOfType(src, OpTypeFloat);
-
-  bool isToInt = TR->isScalarOrVectorOfType(ret, OpTypeInt);
-  bool isToFloat = !isToInt && TR->isScalarOrVectorOfType(ret, OpTypeFloat);
-
-  bool dstSign = convertStr[0] != 'u';
-
-  auto braceIdx = convertStr.find_first_of('(');
-  bool srcSign = convertStr[braceIdx + 1] != 'u';
-
-  bool isSat = false;
-  bool isRounded = false;
-  auto roundingMode = FPRoundingMode::RTE;
-
-  auto underscore0 = convertStr.find_first_of('_');
-  if (underscore0 != convertStr.npos) {
-    auto tok = convertStr.substr(underscore0 + 1, braceIdx - underscore0 - 1);
-    auto underscore1 = tok.find_first_of('_');
-    if (underscore1 != convertStr.npos) {
-      auto tok0 = tok.substr(0, underscore1);
-      auto tok1 = tok.substr(underscore1 + 1);
-      assert(tok0 == "sat");
-      isSat = true;
-      tok = tok1;
-    }
-    if (tok == "sat") {
-      isSat = true;
-    } else if (tok.startswith("rt")) {
-      using namespace FPRoundingMode;
-      isRounded = true;
-      char r = tok[2]; // rtz, rtp, rtn, rte
-      roundingMode = r == 'z' ? RTZ : r == 'p' ? RTP : r == 'n' ? RTN : RTE;
+  const bool isFromInt = TR->isScalarOrVectorOfType(src, OpTypeInt);
+  const bool isFromFloat =
+      !isFromInt && TR->isScalarOrVectorOfType(src, OpTypeFloat);
+  const bool isToInt = TR->isScalarOrVectorOfType(ret, OpTypeInt);
+  const bool isToFloat =
+      !isToInt && TR->isScalarOrVectorOfType(ret, OpTypeFloat);
+
+  unsigned opcode = 0;
+  if (isFromInt && isToInt) {
+    // Extend by the sign of the source, and convert straight between the
+    // widths, so narrow conversions don't go through 32 bits. Only changing
+    // the signedness needs a dedicated instruction to saturate.
+    opcode = srcSign ? OpSConvert : OpUConvert;
+    if (isSat && srcSign != dstSign) {
+      opcode = srcSign ? OpSatConvertSToU : OpSatConvertUToS;
     }
+  } else if (isFromInt && isToFloat) {
+    opcode = srcSign ? OpConvertSToF : OpConvertUToF;
+  } else if (isFromFloat && isToInt) {
+    opcode = dstSign ? OpConvertFToS : OpConvertFToU;
+  } else if (isFromFloat && isToFloat) {
+    opcode = OpFConvert;
+  } else {
+    report_fatal_error("Convert instr not implemented yet: " + name);
   }
 
   namespace Dec = Decoration;
-  bool success = true;
-  if (isSat)
-    success &= decorate(ret, Dec::SaturatedConversion, MIRBuilder, TR);
-  if (isRounded && success)
-    success &= decorate(ret, Dec::FPRoundingMode, roundingMode, MIRBuilder, TR);
-  if (!success)
+  if (isSat && !decorate(ret, Dec::SaturatedConversion, MIRBuilder, TR)) {
+    return false;
+  }
+  // Rounding modes only affect conversions to or from floats
+  if (roundingMode >= 0 && (isFromFloat || isToFloat) &&
+      !decorate(ret, Dec::FPRoundingMode, roundingMode, MIRBuilder, TR)) {
     return false;
+  }
+  auto MIB = MIRBuilder.buildInstr(opcode)
+                 .addDef(ret)
+                 .addUse(TR->getSPIRVTypeID(retTy))
+                 .addUse(src);
+  return TR->constrainRegOperands(MIB);
+}
 
-  if (isFromInt) {
-    if (isToInt) { // I -> I
-      auto op = dstSign ? OpUConvert : OpSConvert;
-      op = !isSat ? op : (dstSign ? OpSatConvertUToS : OpSatConvertSToU);
-      auto MIB = MIRBuilder.buildInstr(dstSign ? OpUConvert : OpSConvert)
-                     .addDef(ret)
-                     .addUse(TR->getSPIRVTypeID(retTy))
-                     .addUse(src);
-      return TR->constrainRegOperands(MIB);
-    } else if (isToFloat) { // I -> F
-      auto MIB = MIRBuilder.buildInstr(srcSign ? OpConvertSToF : OpConvertUToF)
-                     .addDef(ret)
-                     .addUse(TR->getSPIRVTypeID(retTy))
-                     .addUse(src);
-      return TR->constrainRegOperands(MIB);
-    }
-  } else if (isFromFloat) {
-    if (isToInt) { // F -> I
-      auto MIB = MIRBuilder.buildInstr(dstSign ? OpConvertFToS : OpConvertFToU)
-                     .addDef(ret)
-                     .addUse(TR->getSPIRVTypeID(retTy))
-                     .addUse(src);
-      return TR->constrainRegOperands(MIB);
-    } else if (isToFloat) { // F -> F
-      auto MIB = MIRBuilder.buildInstr(OpFConvert)
-                     .addDef(ret)
-                     .addUse(TR->getSPIRVTypeID(retTy))
-                     .addUse(src);
-      return TR->constrainRegOperands(MIB);
+// Get the format named by the suffix of an image type name, matched without
+// case against the SPIR-V names, e.g. "rgba8" in opencl.image2d_ro_t.rgba8
+static ImageFormat::ImageFormat getImageFormatFromName(StringRef name) {
+  for (unsigned i = ImageFormat::Rgba32f; i <= ImageFormat::R8ui; ++i) {
+    auto format = static_cast<ImageFormat::ImageFormat>(i);
+    if (name.equals_lower(getImageFormatName(format))) {
+      return format;
     }
   }
+  report_fatal_error("Unknown image format: " + name);
+}
 
-  report_fatal_error("Convert instr not implemented yet: " + convertStr);
+// Get the component type of the texels of images with the format. Integer
+// texels are read and written as i32 either way, so both integer kinds share
+// the type.
+static SPIRVType *getImageFormatSampledType(ImageFormat::ImageFormat format,
+                                            MachineIRBuilder &MIRBuilder,
+                                            SPIRVTypeRegistry *TR) {
+  const StringRef name = getImageFormatName(format);
+  if (name.endswith("i")) {
+    return TR->getOpTypeInt(32, MIRBuilder);
+  }
+  return TR->getOpTypeFloat(32, MIRBuilder);
 }
 
+// Shaders reading or writing images of Unknown format need the
+// StorageImage{Read,Write}WithoutFormat capabilities, and drivers take generic
+// paths for them, so images whose type name gives their format get it, and
+// the matching sampled type. The OpenCL environment requires Unknown formats
+// and void sampled types, as the format is only known when the kernel runs.
 static SPIRVType *buildOpTypeImageCL(Dim::Dim dim, AQ::AccessQualifier access,
+                                     StringRef formatName,
                                      MachineIRBuilder &MIRBuilder,
                                      SPIRVTypeRegistry *TR) {
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  if (ST.isShader() && !formatName.empty()) {
+    ImageFormat::ImageFormat format = getImageFormatFromName(formatName);
+    SPIRVType *sampledTy = getImageFormatSampledType(format, MIRBuilder, TR);
+    return TR->getOpTypeImage(MIRBuilder, sampledTy, dim, 0, 0, 0, 0, format,
+                              access);
+  }
   SPIRVType *voidTy = TR->getOpTypeVoid(MIRBuilder);
   return TR->getOpTypeImage(MIRBuilder, voidTy, dim, 0, 0, 0, 0,
                             ImageFormat::Unknown, access);
 }
 
-static bool genOpenCLExtInst(OpenCL_std::OpenCL_std extInstID,
-                             MachineIRBuilder &MIRBuilder, Register ret,
-                             const SPIRVType *retTy,
-                             const SmallVectorImpl<Register> &args,
-                             SPIRVTypeRegistry *TR) {
+// Build an OpenCL.std instruction with the given args. Builtins returning void,
+// such as prefetch, still need a result, of the void type.
+static MachineInstrBuilder
+buildOpenCLExtInst(OpenCL_std::OpenCL_std extInstID,
+                   MachineIRBuilder &MIRBuilder, Register ret,
+                   const SPIRVType *retTy,
+                   const SmallVectorImpl<Register> &args,
+                   SPIRVTypeRegistry *TR) {
+  if (!retTy) {
+    retTy = TR->getOpTypeVoid(MIRBuilder);
+    ret = MIRBuilder.getMRI()->createVirtualRegister(&SPIRV::IDRegClass);
+    TR->assignSPIRVTypeToVReg(retTy, ret, MIRBuilder);
+  }
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpExtInst)
                  .addDef(ret)
                  .addUse(TR->getSPIRVTypeID(retTy))
@@ -887,6 +1817,176 @@ static bool genOpenCLExtInst(OpenCL_std::OpenCL_std extInstID,
   for (const auto &arg : args) {
     MIB.addUse(arg);
   }
+  return MIB;
+}
+
+// Whether the function's float math may use approximate functions, as it's
+// built with -cl-fast-relaxed-math or -cl-unsafe-math-optimizations.
+static bool allowsApproxFuncs(const Function &F) {
+  return F.getFnAttribute("approx-func").getValueAsString() == "true" ||
+         F.getFnAttribute("unsafe-fp-math").getValueAsString() == "true";
+}
+
+// Get the native_ variant of a precise or half_ math instruction if the
+// function allows approximate functions, and the args are all 32 bit floats,
+// the only type native functions take. Otherwise return the given instruction.
+static OpenCL_std::OpenCL_std
+getRelaxedExtInst(OpenCL_std::OpenCL_std extInstID,
+                  MachineIRBuilder &MIRBuilder,
+                  const SmallVectorImpl<Register> &args,
+                  SPIRVTypeRegistry *TR) {
+  namespace CL = OpenCL_std;
+  static const std::tuple<CL::OpenCL_std, CL::OpenCL_std, CL::OpenCL_std>
+      nativeExtInsts[] = {{CL::cos, CL::half_cos, CL::native_cos},
+                          {CL::exp, CL::half_exp, CL::native_exp},
+                          {CL::exp2, CL::half_exp2, CL::native_exp2},
+                          {CL::exp10, CL::half_exp10, CL::native_exp10},
+                          {CL::log, CL::half_log, CL::native_log},
+                          {CL::log2, CL::half_log2, CL::native_log2},
+                          {CL::log10, CL::half_log10, CL::native_log10},
+                          {CL::powr, CL::half_powr, CL::native_powr},
+                          {CL::rsqrt, CL::half_rsqrt, CL::native_rsqrt},
+                          {CL::sin, CL::half_sin, CL::native_sin},
+                          {CL::sqrt, CL::half_sqrt, CL::native_sqrt},
+                          {CL::tan, CL::half_tan, CL::native_tan},
+                          {CL::half_divide, CL::half_divide, CL::native_divide},
+                          {CL::half_recip, CL::half_recip, CL::native_recip}};
+  if (!allowsApproxFuncs(MIRBuilder.getMF().getFunction())) {
+    return extInstID;
+  }
+  for (const auto &arg : args) {
+    if (!TR->isScalarOrVectorOfType(arg, SPIRV::OpTypeFloat) ||
+        TR->getScalarOrVectorBitWidth(TR->getSPIRVTypeForVReg(arg)) != 32) {
+      return extInstID;
+    }
+  }
+  for (const auto &native : nativeExtInsts) {
+    if (extInstID == std::get<0>(native) || extInstID == std::get<1>(native)) {
+      return std::get<2>(native);
+    }
+  }
+  return extInstID;
+}
+
+// Build an OpenCL.std instruction returning a vector wider than the
+// subtarget's vector width policy once per component, from the components of
+// the vector args, and rebuild the result with G_BUILD_VECTOR. Returns false if
+// the instruction takes pointers, whose pointees can't be split this way, or
+// doesn't compute each component on its own.
+static bool buildScalarizedOpenCLExtInst(OpenCL_std::OpenCL_std extInstID,
+                                         MachineIRBuilder &MIRBuilder,
+                                         Register ret, const SPIRVType *retTy,
+                                         const SmallVectorImpl<Register> &args,
+                                         SPIRVTypeRegistry *TR) {
+  namespace CL = OpenCL_std;
+  switch (extInstID) {
+  case CL::cross:
+  case CL::normalize:
+  case CL::fast_normalize:
+  case CL::shuffle:
+  case CL::shuffle2:
+    return false;
+  default:
+    break;
+  }
+  const auto MRI = MIRBuilder.getMRI();
+  const unsigned numElems = retTy->getOperand(2).getImm();
+  for (const auto &arg : args) {
+    SPIRVType *argTy = TR->getSPIRVTypeForVReg(arg);
+    if (!argTy || argTy->getOpcode() == SPIRV::OpTypePointer ||
+        (argTy->getOpcode() == SPIRV::OpTypeVector &&
+         argTy->getOperand(2).getImm() != numElems)) {
+      return false;
+    }
+  }
+
+  SPIRVType *elemTy = MRI->getVRegDef(retTy->getOperand(1).getReg());
+  const LLT elemLLT = LLT::scalar(TR->getScalarOrVectorBitWidth(elemTy));
+  SPIRVType *i32Ty = TR->getOpTypeInt(32, MIRBuilder);
+  SmallVector<Register, 16> elems;
+  for (unsigned i = 0; i < numElems; ++i) {
+    Register idx = buildIConstant(i, i32Ty, MIRBuilder, TR);
+    SmallVector<Register, 4> elemArgs;
+    for (const auto &arg : args) {
+      SPIRVType *argTy = TR->getSPIRVTypeForVReg(arg);
+      if (argTy->getOpcode() != SPIRV::OpTypeVector) {
+        elemArgs.push_back(arg);
+        continue;
+      }
+      SPIRVType *argElemTy = MRI->getVRegDef(argTy->getOperand(1).getReg());
+      Register argElem = MRI->createGenericVirtualRegister(
+          LLT::scalar(TR->getScalarOrVectorBitWidth(argElemTy)));
+      TR->assignSPIRVTypeToVReg(argElemTy, argElem, MIRBuilder);
+      MIRBuilder.buildExtractVectorElement(argElem, arg, idx);
+      elemArgs.push_back(argElem);
+    }
+    Register elem = MRI->createGenericVirtualRegister(elemLLT);
+    TR->assignSPIRVTypeToVReg(elemTy, elem, MIRBuilder);
+    auto MIB =
+        buildOpenCLExtInst(extInstID, MIRBuilder, elem, elemTy, elemArgs, TR);
+    TR->constrainRegOperands(MIB);
+    elems.push_back(elem);
+  }
+  MIRBuilder.buildBuildVector(ret, elems);
+  return true;
+}
+
+static bool genOpenCLExtInst(OpenCL_std::OpenCL_std extInstID,
+                             MachineIRBuilder &MIRBuilder, Register ret,
+                             const SPIRVType *retTy,
+                             const SmallVectorImpl<Register> &args,
+                             SPIRVTypeRegistry *TR) {
+  // Follow the legalizer's vector width policy, scalarizing the builtins on
+  // wider vectors, as they're single instructions with no narrower variants
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  if (retTy && retTy->getOpcode() == SPIRV::OpTypeVector &&
+      retTy->getOperand(2).getImm() > ST.getMaxVectorElements() &&
+      buildScalarizedOpenCLExtInst(extInstID, MIRBuilder, ret, retTy, args,
+                                   TR)) {
+    return true;
+  }
+  auto MIB = buildOpenCLExtInst(extInstID, MIRBuilder, ret, retTy, args, TR);
+  return TR->constrainRegOperands(MIB);
+}
+
+// Build the OpenCL.std instruction for a vloadn, vstoren, vload_half etc.
+// builtin. The loads also take the number of components as a literal, and the
+// rounding mode variants of the half stores take the mode given by the name's
+// suffix (e.g. "rte").
+static bool genVectorLoadStore(OpenCL_std::OpenCL_std extInstID,
+                               StringRef roundingStr,
+                               MachineIRBuilder &MIRBuilder, Register ret,
+                               const SPIRVType *retTy,
+                               const SmallVectorImpl<Register> &args,
+                               SPIRVTypeRegistry *TR) {
+  namespace CL = OpenCL_std;
+  auto MIB = buildOpenCLExtInst(extInstID, MIRBuilder, ret, retTy, args, TR);
+  switch (extInstID) {
+  case CL::vloadn:
+  case CL::vload_halfn:
+  case CL::vloada_halfn:
+    assert(retTy->getOpcode() == SPIRV::OpTypeVector && "Expected vector");
+    MIB.addImm(retTy->getOperand(2).getImm());
+    break;
+  case CL::vstore_half_r:
+  case CL::vstore_halfn_r:
+  case CL::vstorea_halfn_r: {
+    auto mode = StringSwitch<int>(roundingStr)
+                    .Case("rte", FPRoundingMode::RTE)
+                    .Case("rtz", FPRoundingMode::RTZ)
+                    .Case("rtp", FPRoundingMode::RTP)
+                    .Case("rtn", FPRoundingMode::RTN)
+                    .Default(-1);
+    if (mode < 0) {
+      report_fatal_error("Unknown rounding mode for a half store: " +
+                         roundingStr);
+    }
+    MIB.addImm(mode);
+    break;
+  }
+  default:
+    break;
+  }
   return TR->constrainRegOperands(MIB);
 }
 
@@ -899,6 +1999,14 @@ SPIRVType *llvm::generateOpenCLOpaqueType(const StringRef name,
   auto typeName = name.substr(strlen("opencl."));
 
   if (typeName.startswith("image")) {
+    // A frontend may give the format as a suffix, e.g. image2d_wo_t.rgba32f,
+    // while numeric suffixes are only added by the IR to keep names unique
+    StringRef formatName;
+    std::tie(typeName, formatName) = typeName.split('.');
+    formatName = formatName.split('.').first;
+    if (all_of(formatName, isDigit)) {
+      formatName = "";
+    }
     if (typeName.endswith("_ro_t")) {
       accessQual = AQ::ReadOnly;
     } else if (typeName.endswith("_wo_t")) {
@@ -909,39 +2017,215 @@ SPIRVType *llvm::generateOpenCLOpaqueType(const StringRef name,
     char dimC = typeName[strlen("image")];
     if (dimC >= '1' && dimC <= '3') {
       auto dim = dimC == '1' ? DIM_1D : dimC == '2' ? DIM_2D : DIM_3D;
-      return buildOpTypeImageCL(dim, accessQual, MIRBuilder, TR);
+      return buildOpTypeImageCL(dim, accessQual, formatName, MIRBuilder, TR);
     }
   } else if (typeName.startswith("sampler_t")) {
     return TR->getSamplerType(MIRBuilder);
+  } else if (typeName.startswith("event_t")) {
+    return TR->getOpTypeEvent(MIRBuilder);
+  } else if (typeName.startswith("pipe_")) {
+    if (typeName.startswith("pipe_ro_t")) {
+      accessQual = AQ::ReadOnly;
+    } else if (typeName.startswith("pipe_wo_t")) {
+      accessQual = AQ::WriteOnly;
+    }
+    return TR->getOpTypePipe(accessQual, MIRBuilder);
+  } else if (typeName.startswith("reserve_id_t")) {
+    return TR->getOpTypeReserveId(MIRBuilder);
+  } else if (typeName.startswith("queue_t")) {
+    return TR->getOpTypeQueue(MIRBuilder);
+  } else if (typeName.startswith("clk_event_t")) {
+    return TR->getOpTypeDeviceEvent(MIRBuilder);
   }
   report_fatal_error("Cannot generate OpenCL type: " + name);
 }
 
-bool llvm::generateOpenCLBuiltinCall(const StringRef demangledName,
-                                     MachineIRBuilder &MIRBuilder, Register ret,
-                                     const Type *OrigRetTy,
-                                     const SmallVectorImpl<Register> &args,
-                                     SPIRVTypeRegistry *TR) {
+// Parse an Itanium builtin type's mangling (e.g. "i" or "Dh") into code.
+static bool parseBuiltinType(StringRef &str, std::string &code) {
+  if (str.empty())
+    return false;
+  size_t len = 1;
+  if (str.front() == 'D') {
+    if (str.size() < 2 || !StringRef("acdefhinsu").contains(str[1]))
+      return false;
+    len = 2;
+  } else if (!StringRef("abcdefghijlmnostvwxyz").contains(str.front())) {
+    return false;
+  }
+  code = str.take_front(len);
+  str = str.drop_front(len);
+  return true;
+}
 
-  LLVM_DEBUG(dbgs() << "Generating OpenCL Builtin: " << demangledName << "\n");
+// Parse a substitution reference S_, S0_, S1_ etc. into its index.
+static bool parseSubstitution(StringRef &str, unsigned &idx) {
+  if (!str.consume_front("S"))
+    return false;
+  idx = 0;
+  if (str.consume_front("_"))
+    return true;
+  // Sequence IDs are base 36, using digits then upper case letters
+  unsigned seqID = 0;
+  while (!str.empty() && (isDigit(str.front()) || isAlpha(str.front()))) {
+    char c = str.front();
+    if (!isDigit(c) && (c < 'A' || c > 'Z'))
+      return false;
+    seqID = seqID * 36 + (isDigit(c) ? c - '0' : c - 'A' + 10);
+    str = str.drop_front();
+  }
+  idx = seqID + 1;
+  return str.consume_front("_");
+}
 
-  SPIRVType *retTy = nullptr;
-  if (OrigRetTy && !OrigRetTy->isVoidTy()) {
-    retTy = TR->assignTypeToVReg(OrigRetTy, ret, MIRBuilder);
+// Parse one parameter type from the front of the string, recording it in the
+// list of types any later substitutions can refer to if it isn't a builtin.
+static bool parseParamType(StringRef &str, OpenCLBuiltinParam &param,
+                           SmallVectorImpl<OpenCLBuiltinParam> &substitutions) {
+  if (str.startswith("S")) {
+    unsigned idx;
+    if (!parseSubstitution(str, idx) || idx >= substitutions.size())
+      return false;
+    param = substitutions[idx];
+    return true;
   }
 
-  auto firstBraceIdx = demangledName.find_first_of('(');
-  auto nameNoArgs = demangledName.substr(0, firstBraceIdx);
+  if (str.consume_front("P")) {
+    if (!parseParamType(str, param, substitutions))
+      return false;
+    param.isPointer = true;
+  } else if (str.front() == 'U' || str.front() == 'K' || str.front() == 'V' ||
+             str.front() == 'r') {
+    // Skip vendor qualifiers (e.g. U3AS1 for address spaces) and CV qualifiers,
+    // which together form a single qualified type.
+    while (str.consume_front("U")) {
+      unsigned len;
+      if (str.consumeInteger(10, len) || len > str.size())
+        return false;
+      str = str.drop_front(len);
+    }
+    while (!str.empty() && StringRef("rVK").contains(str.front()))
+      str = str.drop_front();
+    if (!parseParamType(str, param, substitutions))
+      return false;
+  } else if (str.consume_front("Dv")) {
+    unsigned width;
+    if (str.consumeInteger(10, width) || !str.consume_front("_") ||
+        !parseBuiltinType(str, param.elemType))
+      return false;
+    param.vectorWidth = width;
+  } else if (!str.empty() && isDigit(str.front())) {
+    // A class type such as ocl_image2d_ro, given by its length and name
+    unsigned len;
+    if (str.consumeInteger(10, len) || len > str.size())
+      return false;
+    param.elemType = str.take_front(len);
+    str = str.drop_front(len);
+  } else {
+    // Builtin types aren't substitution candidates
+    return parseBuiltinType(str, param.elemType);
+  }
+  substitutions.push_back(param);
+  return true;
+}
 
-  auto extInstIDOpt = getOpenCL_stdFromName(nameNoArgs);
-  if (extInstIDOpt.hasValue()) {
-    auto extInstID = extInstIDOpt.getValue();
-    return genOpenCLExtInst(extInstID, MIRBuilder, ret, retTy, args, TR);
+Optional<OpenCLBuiltinName>
+llvm::parseOpenCLBuiltinName(StringRef mangledName) {
+  StringRef str = mangledName;
+  unsigned nameLen;
+  if (!str.consume_front("_Z") || str.empty() || !isDigit(str.front()) ||
+      str.consumeInteger(10, nameLen) || nameLen > str.size())
+    return None;
+
+  OpenCLBuiltinName builtin;
+  builtin.name = str.take_front(nameLen);
+  str = str.drop_front(nameLen);
+
+  // Stop at constructs we don't need to handle, leaving later params unknown
+  SmallVector<OpenCLBuiltinParam, 4> substitutions;
+  while (!str.empty()) {
+    OpenCLBuiltinParam param;
+    if (!parseParamType(str, param, substitutions))
+      break;
+    builtin.params.push_back(std::move(param));
   }
 
+  // A lone void parameter means there are no parameters
+  if (builtin.params.size() == 1 && builtin.params[0].elemType == "v" &&
+      !builtin.params[0].isPointer)
+    builtin.params.clear();
+  return builtin;
+}
+
+namespace {
+// The different ways an OpenCL builtin call can be lowered.
+enum class BuiltinGroup {
+  ExtInst,              // An OpenCL.std instruction with the builtin's name
+  TypeDependantExtInst, // An OpenCL.std instruction chosen by argument type
+  Atomic,
+  Barrier,
+  BuiltinVariable, // A load from a scalar builtin variable
+  Convert,
+  AsyncCopy,
+  VectorLoadStore,    // An OpenCL.std vector load or store, with its literals
+  Group,              // A collective function of a work-group or sub-group
+  IntelSubgroup,      // A cl_intel_subgroups shuffle or block read/write
+  SubgroupVoteBallot, // A sub-group vote or ballot over active invocations
+  Pipe,               // A pipe read, write, reservation or query
+  DeviceEnqueue,      // An ndrange, event or queue function of device enqueue
+  CooperativeMatrix,  // A SPV_NV_cooperative_matrix load, store or multiply
+  GenericCastToPtr,   // A to_global, to_local or to_private pointer cast
+  GlobalLocalQuery,
+  ImageQuery,
+  WorkgroupQuery,
+  ReadImage,
+  WriteImage,
+  SamplerInitializer
+};
+
+// Describes how to lower all calls to builtins with a given name or prefix.
+struct BuiltinLowering {
+  BuiltinGroup group;
+  // For ExtInst and VectorLoadStore, the instruction to use. For
+  // TypeDependantExtInst, the
+  // unsigned, signed and (if valid) float variants respectively.
+  SmallVector<OpenCL_std::OpenCL_std, 3> extInsts;
+  // For WorkgroupQuery, the variable to load and the value for invalid dims.
+  // For BuiltinVariable, only the variable to load.
+  BuiltIn::BuiltIn builtIn = BuiltIn::WorkgroupId;
+  unsigned defaultVal = 0;
+  // For Barrier and Group, the scope of the work-items involved.
+  Scope::Scope scope = Scope::Workgroup;
+  // For GlobalLocalQuery, whether to query global rather than local values.
+  bool global = false;
+  // For Pipe, DeviceEnqueue and CooperativeMatrix, the instruction to build.
+  unsigned opcode = 0;
+  // For Convert, the signedness of integer results, whether they saturate,
+  // and the FPRoundingMode, or -1 for the default.
+  bool dstUnsigned = false;
+  bool saturate = false;
+  int roundingMode = -1;
+
+  BuiltinLowering(BuiltinGroup group = BuiltinGroup::ExtInst)
+      : group(group) {}
+};
+} // namespace
+
+// Build the table mapping every builtin name (or name prefix ending in '_')
+// to how calls to it should be lowered.
+static StringMap<BuiltinLowering> buildBuiltinLoweringTable() {
+  StringMap<BuiltinLowering> table;
+
   namespace CL = OpenCL_std;
-  static const std::map<std::string, std::vector<CL::OpenCL_std>>
-      typeDependantExtInstMap = {
+  static const std::pair<const char *, CL::OpenCL_std> extInsts[] = {
+      DEF_OpenCL_std(OpenCL_std, MAKE_EXT_INST_NAME_TO_ID)};
+  for (const auto &extInst : extInsts) {
+    BuiltinLowering lowering(BuiltinGroup::ExtInst);
+    lowering.extInsts.push_back(extInst.second);
+    table.try_emplace(extInst.first, std::move(lowering));
+  }
+
+  static const std::pair<const char *, std::vector<CL::OpenCL_std>>
+      typeDependantExtInsts[] = {
           {"clamp", {CL::u_clamp, CL::s_clamp, CL::fclamp}},
           {"max", {CL::u_max, CL::s_max, CL::fmax_common}},
           {"min", {CL::u_min, CL::s_min, CL::fmin_common}},
@@ -956,98 +2240,523 @@ bool llvm::generateOpenCLBuiltinCall(const StringRef demangledName,
           {"rhadd", {CL::u_rhadd, CL::s_rhadd}},
           {"sub_sat", {CL::u_sub_sat, CL::s_sub_sat}},
           {"upsample", {CL::u_upsample, CL::s_upsample}}};
+  for (const auto &extInst : typeDependantExtInsts) {
+    BuiltinLowering lowering(BuiltinGroup::TypeDependantExtInst);
+    lowering.extInsts.append(extInst.second.begin(), extInst.second.end());
+    table.try_emplace(extInst.first, std::move(lowering));
+  }
 
-  auto extInstMatch = typeDependantExtInstMap.find(nameNoArgs);
-  if (extInstMatch != typeDependantExtInstMap.end()) {
-    char typeChar = demangledName[firstBraceIdx + 1];
-    int idx = -1;
-    if (typeChar == 'u') {
-      idx = 0;
-    } else if (typeChar == 'i') {
-      idx = 1;
-    } else if (typeChar == 'f' || typeChar == 'd') {
-      idx = 2;
+  // The vector loads and stores have the number of components at the end of
+  // their name, and the half stores may have a rounding mode suffix after it.
+  // Their instructions need literals the builtins don't have, so they replace
+  // the plain ExtInst entries for the names they share.
+  static const std::pair<const char *, CL::OpenCL_std> vectorLoadStores[] = {
+      {"vload_half", CL::vload_half},
+      {"vloada_half", CL::vload_half},
+      {"vstore_half", CL::vstore_half},
+      {"vstorea_half", CL::vstore_half},
+      {"vstore_half_", CL::vstore_half_r},
+      {"vstorea_half_", CL::vstore_half_r}};
+  for (const auto &vecLoadStore : vectorLoadStores) {
+    BuiltinLowering &lowering = table[vecLoadStore.first];
+    lowering.group = BuiltinGroup::VectorLoadStore;
+    lowering.extInsts.assign({vecLoadStore.second});
+  }
+  static const std::tuple<const char *, const char *, CL::OpenCL_std>
+      vectorNLoadStores[] = {{"vload", "", CL::vloadn},
+                             {"vstore", "", CL::vstoren},
+                             {"vload_half", "", CL::vload_halfn},
+                             {"vloada_half", "", CL::vloada_halfn},
+                             {"vstore_half", "", CL::vstore_halfn},
+                             {"vstorea_half", "", CL::vstorea_halfn},
+                             {"vstore_half", "_", CL::vstore_halfn_r},
+                             {"vstorea_half", "_", CL::vstorea_halfn_r}};
+  for (const char *n : {"2", "3", "4", "8", "16"}) {
+    for (const auto &vecLoadStore : vectorNLoadStores) {
+      BuiltinLowering lowering(BuiltinGroup::VectorLoadStore);
+      lowering.extInsts.push_back(std::get<2>(vecLoadStore));
+      table.try_emplace(std::string(std::get<0>(vecLoadStore)) + n +
+                            std::get<1>(vecLoadStore),
+                        std::move(lowering));
     }
-    if (idx != -1) {
-      assert(unsigned(idx) < extInstMatch->second.size());
-      CL::OpenCL_std extInstId = extInstMatch->second[idx];
-      return genOpenCLExtInst(extInstId, MIRBuilder, ret, retTy, args, TR);
+  }
+
+  // Handle atom_add, atomic_add, and atomic_fetch_add etc.
+  table.try_emplace("atom_", BuiltinGroup::Atomic);
+  table.try_emplace("atomic_", BuiltinGroup::Atomic);
+  table.try_emplace("atomic_fetch_", BuiltinGroup::Atomic);
+  table.try_emplace("barrier", BuiltinGroup::Barrier);
+  table.try_emplace("work_group_barrier", BuiltinGroup::Barrier);
+  table.try_emplace("sub_group_barrier", BuiltinGroup::Barrier)
+      .first->getValue()
+      .scope = Scope::Subgroup;
+  // Both scopes share the group function names after their prefix
+  table.try_emplace("work_group_", BuiltinGroup::Group);
+  table.try_emplace("sub_group_", BuiltinGroup::Group)
+      .first->getValue()
+      .scope = Scope::Subgroup;
+  table.try_emplace("intel_sub_group_", BuiltinGroup::IntelSubgroup);
+  for (const char *name :
+       {"sub_group_elect", "sub_group_non_uniform_all",
+        "sub_group_non_uniform_any", "sub_group_non_uniform_all_equal",
+        "sub_group_non_uniform_broadcast", "sub_group_broadcast_first",
+        "sub_group_ballot", "sub_group_inverse_ballot",
+        "sub_group_ballot_bit_extract", "sub_group_ballot_bit_count",
+        "sub_group_ballot_inclusive_scan", "sub_group_ballot_exclusive_scan",
+        "sub_group_ballot_find_lsb", "sub_group_ballot_find_msb"}) {
+    table.try_emplace(name, BuiltinGroup::SubgroupVoteBallot);
+  }
+  // Clang lowers the pipe builtins to these unmangled functions, with the
+  // packet size and alignment as extra arguments
+  static const std::tuple<const char *, unsigned, Scope::Scope> pipes[] = {
+      {"__read_pipe_2", SPIRV::OpReadPipe, Scope::Workgroup},
+      {"__write_pipe_2", SPIRV::OpWritePipe, Scope::Workgroup},
+      {"__read_pipe_4", SPIRV::OpReservedReadPipe, Scope::Workgroup},
+      {"__write_pipe_4", SPIRV::OpReservedWritePipe, Scope::Workgroup},
+      {"__reserve_read_pipe", SPIRV::OpReserveReadPipePackets,
+       Scope::Workgroup},
+      {"__reserve_write_pipe", SPIRV::OpReserveWritePipePackets,
+       Scope::Workgroup},
+      {"__commit_read_pipe", SPIRV::OpCommitReadPipe, Scope::Workgroup},
+      {"__commit_write_pipe", SPIRV::OpCommitWritePipe, Scope::Workgroup},
+      {"__work_group_reserve_read_pipe", SPIRV::OpGroupReserveReadPipePackets,
+       Scope::Workgroup},
+      {"__work_group_reserve_write_pipe",
+       SPIRV::OpGroupReserveWritePipePackets, Scope::Workgroup},
+      {"__work_group_commit_read_pipe", SPIRV::OpGroupCommitReadPipe,
+       Scope::Workgroup},
+      {"__work_group_commit_write_pipe", SPIRV::OpGroupCommitWritePipe,
+       Scope::Workgroup},
+      {"__sub_group_reserve_read_pipe", SPIRV::OpGroupReserveReadPipePackets,
+       Scope::Subgroup},
+      {"__sub_group_reserve_write_pipe", SPIRV::OpGroupReserveWritePipePackets,
+       Scope::Subgroup},
+      {"__sub_group_commit_read_pipe", SPIRV::OpGroupCommitReadPipe,
+       Scope::Subgroup},
+      {"__sub_group_commit_write_pipe", SPIRV::OpGroupCommitWritePipe,
+       Scope::Subgroup},
+      {"__get_pipe_num_packets_ro", SPIRV::OpGetNumPipePackets,
+       Scope::Workgroup},
+      {"__get_pipe_num_packets_wo", SPIRV::OpGetNumPipePackets,
+       Scope::Workgroup},
+      {"__get_pipe_max_packets_ro", SPIRV::OpGetMaxPipePackets,
+       Scope::Workgroup},
+      {"__get_pipe_max_packets_wo", SPIRV::OpGetMaxPipePackets,
+       Scope::Workgroup},
+      {"is_valid_reserve_id", SPIRV::OpIsValidReserveId, Scope::Workgroup}};
+  for (const auto &pipe : pipes) {
+    BuiltinLowering lowering(BuiltinGroup::Pipe);
+    lowering.opcode = std::get<1>(pipe);
+    lowering.scope = std::get<2>(pipe);
+    table.try_emplace(std::get<0>(pipe), std::move(lowering));
+  }
+  // The enqueue_kernel and kernel query builtins take blocks, which only
+  // SPIRVIRTranslator can resolve to their invoke functions
+  static const std::pair<const char *, unsigned> deviceEnqueues[] = {
+      {"ndrange_1D", SPIRV::OpBuildNDRange},
+      {"ndrange_2D", SPIRV::OpBuildNDRange},
+      {"ndrange_3D", SPIRV::OpBuildNDRange},
+      {"enqueue_marker", SPIRV::OpEnqueueMarker},
+      {"retain_event", SPIRV::OpRetainEvent},
+      {"release_event", SPIRV::OpReleaseEvent},
+      {"create_user_event", SPIRV::OpCreateUserEvent},
+      {"is_valid_event", SPIRV::OpIsValidEvent},
+      {"set_user_event_status", SPIRV::OpSetUserEventStatus},
+      {"capture_event_profiling_info", SPIRV::OpCaptureEventProfilingInfo},
+      {"get_default_queue", SPIRV::OpGetDefaultQueue}};
+  for (const auto &deviceEnqueue : deviceEnqueues) {
+    BuiltinLowering lowering(BuiltinGroup::DeviceEnqueue);
+    lowering.opcode = deviceEnqueue.second;
+    table.try_emplace(deviceEnqueue.first, std::move(lowering));
+  }
+  // The SPIR-V friendly IR names of the cooperative matrix instructions
+  static const std::pair<const char *, unsigned> cooperativeMatrixOps[] = {
+      {"__spirv_CooperativeMatrixLoadNV", SPIRV::OpCooperativeMatrixLoadNV},
+      {"__spirv_CooperativeMatrixStoreNV", SPIRV::OpCooperativeMatrixStoreNV},
+      {"__spirv_CooperativeMatrixMulAddNV", SPIRV::OpCooperativeMatrixMulAddNV},
+      {"__spirv_CooperativeMatrixLengthNV",
+       SPIRV::OpCooperativeMatrixLengthNV}};
+  for (const auto &op : cooperativeMatrixOps) {
+    BuiltinLowering lowering(BuiltinGroup::CooperativeMatrix);
+    lowering.opcode = op.second;
+    table.try_emplace(op.first, std::move(lowering));
+  }
+  // Clang calls the unmangled versions of the address space casts
+  for (const char *name : {"to_global", "to_local", "to_private",
+                           "__to_global", "__to_local", "__to_private"}) {
+    table.try_emplace(name, BuiltinGroup::GenericCastToPtr);
+  }
+  // Every convert_<type><n>[_sat][_<rounding>] gets its own entry, so calls
+  // don't reparse their names. Only integer results can saturate.
+  static const std::pair<const char *, bool> convertTypes[] = {
+      {"char", false}, {"uchar", true}, {"short", false}, {"ushort", true},
+      {"int", false},  {"uint", true},  {"long", false},  {"ulong", true},
+      {"half", false}, {"float", false}, {"double", false}};
+  static const std::pair<const char *, int> roundingModes[] = {
+      {"", -1},
+      {"_rte", FPRoundingMode::RTE},
+      {"_rtz", FPRoundingMode::RTZ},
+      {"_rtp", FPRoundingMode::RTP},
+      {"_rtn", FPRoundingMode::RTN}};
+  for (const auto &type : convertTypes) {
+    const StringRef typeName = type.first;
+    const bool isFloat =
+        typeName == "half" || typeName == "float" || typeName == "double";
+    for (const char *n : {"", "2", "3", "4", "8", "16"}) {
+      for (const bool sat : {false, true}) {
+        if (sat && isFloat) {
+          continue;
+        }
+        for (const auto &rounding : roundingModes) {
+          BuiltinLowering lowering(BuiltinGroup::Convert);
+          lowering.dstUnsigned = type.second;
+          lowering.saturate = sat;
+          lowering.roundingMode = rounding.second;
+          table.try_emplace(std::string("convert_") + type.first + n +
+                                (sat ? "_sat" : "") + rounding.first,
+                            std::move(lowering));
+        }
+      }
     }
   }
+  table.try_emplace("async_work_group_copy", BuiltinGroup::AsyncCopy);
+  table.try_emplace("async_work_group_strided_copy", BuiltinGroup::AsyncCopy);
+  table.try_emplace("wait_group_events", BuiltinGroup::AsyncCopy);
+  table.try_emplace("get_local_", BuiltinGroup::GlobalLocalQuery);
+  table.try_emplace("get_global_", BuiltinGroup::GlobalLocalQuery)
+      .first->getValue()
+      .global = true;
+  table.try_emplace("get_image_", BuiltinGroup::ImageQuery);
+
+  static const std::tuple<const char *, BuiltIn::BuiltIn, unsigned>
+      workgroupQueries[] = {
+          {"get_group_id", BuiltIn::WorkgroupId, 0},
+          {"get_enqueued_local_size", BuiltIn::EnqueuedWorkgroupSize, 1},
+          {"get_num_groups", BuiltIn::NumWorkGroups, 1}};
+  for (const auto &query : workgroupQueries) {
+    BuiltinLowering lowering(BuiltinGroup::WorkgroupQuery);
+    lowering.builtIn = std::get<1>(query);
+    lowering.defaultVal = std::get<2>(query);
+    table.try_emplace(std::get<0>(query), std::move(lowering));
+  }
+  // TODO: get_work_dim
+
+  static const std::pair<const char *, BuiltIn::BuiltIn> builtinVariables[] = {
+      {"get_sub_group_size", BuiltIn::SubgroupSize},
+      {"get_max_sub_group_size", BuiltIn::SubgroupMaxSize},
+      {"get_num_sub_groups", BuiltIn::NumSubgroups},
+      {"get_enqueued_num_sub_groups", BuiltIn::NumEnqueuedSubgroups},
+      {"get_sub_group_id", BuiltIn::SubgroupId},
+      {"get_sub_group_local_id", BuiltIn::SubgroupLocalInvocationId}};
+  for (const auto &var : builtinVariables) {
+    BuiltinLowering lowering(BuiltinGroup::BuiltinVariable);
+    lowering.builtIn = var.second;
+    table.try_emplace(var.first, std::move(lowering));
+  }
+
+  for (const char *suffix : {"f", "i", "ui", "h"}) {
+    table.try_emplace(std::string("read_image") + suffix,
+                      BuiltinGroup::ReadImage);
+    table.try_emplace(std::string("write_image") + suffix,
+                      BuiltinGroup::WriteImage);
+  }
+  table.try_emplace("__translate_sampler_initializer",
+                    BuiltinGroup::SamplerInitializer);
+  return table;
+}
 
-  char firstChar = nameNoArgs[0];
-  switch (firstChar) {
-  case 'a':
-    if (nameNoArgs.startswith("atom")) {
-      // Handle atom_add, atomic_add, and atomic_fetch_add etc.
-      auto idx = strlen("atom_");
-      if (nameNoArgs.startswith("atomic_")) {
-        idx = nameNoArgs.startswith("atomic_fetch_") ? strlen("atomic_fetch_")
-                                                     : strlen("atomic_");
+// Find the table entry for the given builtin name, trying the whole name
+// first, then each prefix ending in '_' from longest to shortest. Only the
+// first lookup is needed for the common case of math builtins. The group
+// function prefixes only match the names genGroupInstr models.
+static const StringMapEntry<BuiltinLowering> *
+findBuiltinLowering(StringRef name) {
+  static const StringMap<BuiltinLowering> table = buildBuiltinLoweringTable();
+  StringRef prefix = name;
+  while (!prefix.empty()) {
+    auto found = table.find(prefix);
+    if (found != table.end()) {
+      if (found->getValue().group == BuiltinGroup::Group &&
+          !isLoweredGroupFunc(name.drop_front(prefix.size()))) {
+        return nullptr;
       }
-      const auto atomic = nameNoArgs.substr(idx);
-      return genAtomicInstr(MIRBuilder, atomic, ret, retTy, args, TR);
+      return &*found;
     }
-    break;
-  case 'b':
-    if (nameNoArgs.startswith("barrier")) {
-      return genBarrier(MIRBuilder, args, TR);
+    auto underscoreIdx = prefix.drop_back().rfind('_');
+    if (underscoreIdx == StringRef::npos) {
+      break;
     }
-    break;
-  case 'c':
-    if (nameNoArgs.startswith("convert_")) {
-      const auto convTy = demangledName.substr(strlen("convert_"));
-      return genConvertInstr(MIRBuilder, convTy, ret, retTy, args, TR);
+    prefix = prefix.take_front(underscoreIdx + 1);
+  }
+  return nullptr;
+}
+
+bool llvm::isLoweredOpenCLBuiltin(const OpenCLBuiltinName &builtin) {
+  return findBuiltinLowering(builtin.name) != nullptr;
+}
+
+bool llvm::isVaryingOpenCLBuiltin(const OpenCLBuiltinName &builtin,
+                                  bool accessesMemory) {
+  const StringRef name = builtin.name;
+  if (name.contains("scan")) {
+    return true;
+  }
+  if (name.startswith("sub_group_reduce_") ||
+      name.startswith("work_group_reduce_")) {
+    return false;
+  }
+  return StringSwitch<bool>(name)
+      .Cases("get_global_id", "get_local_id", "get_global_linear_id",
+             "get_local_linear_id", "get_sub_group_local_id",
+             "sub_group_elect", true)
+      .Cases("get_group_id", "get_num_groups", "get_global_size",
+             "get_local_size", "get_enqueued_local_size", "get_work_dim",
+             "get_global_offset", false)
+      .Cases("get_sub_group_size", "get_max_sub_group_size",
+             "get_num_sub_groups", "get_enqueued_num_sub_groups",
+             "get_sub_group_id", false)
+      .Cases("sub_group_broadcast", "sub_group_all", "sub_group_any",
+             "work_group_broadcast", "work_group_all", "work_group_any", false)
+      .Cases("sub_group_ballot", "sub_group_ballot_bit_count",
+             "sub_group_ballot_find_lsb", "sub_group_ballot_find_msb", false)
+      .Cases("sub_group_non_uniform_broadcast", "sub_group_broadcast_first",
+             "sub_group_non_uniform_all", "sub_group_non_uniform_any",
+             "sub_group_non_uniform_all_equal", false)
+      .Default(accessesMemory);
+}
+
+bool llvm::isShaderOpenCLBuiltin(const OpenCLBuiltinName &builtin) {
+  return StringSwitch<bool>(builtin.name)
+      .Cases("get_global_id", "get_local_id", "get_group_id", "get_num_groups",
+             true)
+      .Cases("barrier", "work_group_barrier", true)
+      .Cases("sub_group_elect", "sub_group_ballot",
+             "sub_group_ballot_bit_count", "sub_group_ballot_exclusive_scan",
+             "sub_group_broadcast_first", true)
+      .StartsWith("__spirv_CooperativeMatrix", true)
+      .Default(false);
+}
+
+bool llvm::generateOpenCLBuiltinCall(const OpenCLBuiltinName &builtin,
+                                     MachineIRBuilder &MIRBuilder, Register ret,
+                                     const Type *OrigRetTy,
+                                     const SmallVectorImpl<Register> &args,
+                                     SPIRVTypeRegistry *TR) {
+  const StringRef name = builtin.name;
+  LLVM_DEBUG(dbgs() << "Generating OpenCL Builtin: " << name << "\n");
+
+  SPIRVType *retTy = nullptr;
+  if (OrigRetTy && !OrigRetTy->isVoidTy()) {
+    retTy = TR->assignTypeToVReg(OrigRetTy, ret, MIRBuilder);
+  }
+
+  const auto *entry = findBuiltinLowering(name);
+  if (!entry) {
+    report_fatal_error("Cannot translate OpenCL built-in func: " + name);
+  }
+  const BuiltinLowering &lowering = entry->getValue();
+  const auto prefixLen = entry->getKey().size();
+  // Integer signedness is only given by the mangled name, not the SPIR-V types
+  const bool firstArgUnsigned =
+      !builtin.params.empty() && builtin.params[0].isUnsigned();
+
+  switch (lowering.group) {
+  case BuiltinGroup::ExtInst:
+    return genOpenCLExtInst(
+        getRelaxedExtInst(lowering.extInsts[0], MIRBuilder, args, TR),
+        MIRBuilder, ret, retTy, args, TR);
+  case BuiltinGroup::TypeDependantExtInst: {
+    unsigned idx = lowering.extInsts.size();
+    if (args.empty()) {
+      break;
+    } else if (TR->isScalarOrVectorOfType(args[0], SPIRV::OpTypeInt)) {
+      idx = firstArgUnsigned ? 0 : 1;
+    } else if (TR->isScalarOrVectorOfType(args[0], SPIRV::OpTypeFloat)) {
+      idx = 2;
     }
-    break;
-  case 'g': {
-    bool local = nameNoArgs.startswith("get_local_");
-    bool global = !local && nameNoArgs.startswith("get_global_");
-    if (local || global) {
-      auto subIdx = global ? strlen("get_global_") : strlen("get_local_");
-      const auto str = nameNoArgs.substr(subIdx);
-      return genGlobalLocalQuery(MIRBuilder, str, global, ret, retTy, args, TR);
-    } else if (nameNoArgs.startswith("get_image_")) {
-      const auto imgStr = nameNoArgs.substr(strlen("get_image_"));
-      return genImageQuery(MIRBuilder, imgStr, ret, retTy, args, TR);
-    } else if (nameNoArgs.startswith("get_group_id")) {
-      return genWorkgroupQuery(MIRBuilder, ret, retTy, args, TR,
-                               BuiltIn::WorkgroupId, 0);
-    } else if (nameNoArgs.startswith("get_enqueued_local_size")) {
-      return genWorkgroupQuery(MIRBuilder, ret, retTy, args, TR,
-                               BuiltIn::EnqueuedWorkgroupSize, 1);
-    } else if (nameNoArgs.startswith("get_num_groups")) {
-      return genWorkgroupQuery(MIRBuilder, ret, retTy, args, TR,
-                               BuiltIn::NumWorkGroups, 1);
-    } else if (nameNoArgs.startswith("get_work_dim")) {
-      // TODO
+    if (idx < lowering.extInsts.size()) {
+      return genOpenCLExtInst(lowering.extInsts[idx], MIRBuilder, ret, retTy,
+                              args, TR);
     }
     break;
   }
-  case 'r':
-    if (nameNoArgs.startswith("read_image")) {
-      if (args.size() > 2) {
-        return genSampledReadImage(MIRBuilder, ret, retTy, args, TR);
-      } else {
-        return genReadImage(MIRBuilder, ret, retTy, args, TR);
-      }
+  case BuiltinGroup::Atomic: {
+    // The OpenCL 2.0 atomics are atomic_fetch_<op> rather than atomic_<op>
+    const bool isLegacy = entry->getKey() != "atomic_fetch_";
+    return genAtomicInstr(MIRBuilder, name.substr(prefixLen), isLegacy,
+                          firstArgUnsigned, ret, retTy, args, TR);
+  }
+  case BuiltinGroup::Barrier:
+    return genBarrier(MIRBuilder, lowering.scope, args, TR);
+  case BuiltinGroup::BuiltinVariable:
+    return genBuiltinVariableLoad(MIRBuilder, ret, retTy, TR, lowering.builtIn);
+  case BuiltinGroup::Convert:
+    return genConvertInstr(MIRBuilder, name, !firstArgUnsigned,
+                           !lowering.dstUnsigned, lowering.saturate,
+                           lowering.roundingMode, ret, retTy, args, TR);
+  case BuiltinGroup::AsyncCopy:
+    return genAsyncCopyInstr(MIRBuilder, name, ret, retTy, args, TR);
+  case BuiltinGroup::VectorLoadStore:
+    return genVectorLoadStore(lowering.extInsts[0], name.substr(prefixLen),
+                              MIRBuilder, ret, retTy, args, TR);
+  case BuiltinGroup::Group:
+    return genGroupInstr(MIRBuilder, name.substr(prefixLen), lowering.scope,
+                         firstArgUnsigned, ret, retTy, args, TR);
+  case BuiltinGroup::SubgroupVoteBallot:
+    return genSubgroupVoteBallot(MIRBuilder, name.substr(strlen("sub_group_")),
+                                 ret, retTy, args, TR);
+  case BuiltinGroup::Pipe:
+    return genPipeInstr(MIRBuilder, lowering.opcode, lowering.scope, ret, retTy,
+                        args, TR);
+  case BuiltinGroup::DeviceEnqueue:
+    if (lowering.opcode == SPIRV::OpBuildNDRange) {
+      return genNDRange(MIRBuilder, name, args, TR);
     }
-    break;
-  case 'w':
-    if (nameNoArgs.startswith("write_image")) {
-      return genWriteImage(MIRBuilder, args, TR);
-    } else if (nameNoArgs.startswith("work_group_barrier")) {
-      return genBarrier(MIRBuilder, args, TR);
+    return genDeviceEnqueueInstr(MIRBuilder, lowering.opcode, ret, retTy, args,
+                                 TR);
+  case BuiltinGroup::CooperativeMatrix:
+    return genCooperativeMatrixInstr(MIRBuilder, name, lowering.opcode, ret,
+                                     retTy, args, TR);
+  case BuiltinGroup::GenericCastToPtr:
+    return genGenericCastToPtr(MIRBuilder, name, ret, retTy, args, TR);
+  case BuiltinGroup::IntelSubgroup:
+    return genIntelSubgroupInstr(MIRBuilder, name.substr(prefixLen), ret, retTy,
+                                 args, TR);
+  case BuiltinGroup::GlobalLocalQuery:
+    return genGlobalLocalQuery(MIRBuilder, name.substr(prefixLen),
+                               lowering.global, ret, retTy, args, TR);
+  case BuiltinGroup::ImageQuery:
+    return genImageQuery(MIRBuilder, name.substr(prefixLen), ret, retTy, args,
+                         TR);
+  case BuiltinGroup::WorkgroupQuery:
+    return genWorkgroupQuery(MIRBuilder, ret, retTy, args, TR,
+                             lowering.builtIn, lowering.defaultVal);
+  case BuiltinGroup::ReadImage:
+    // Multisampled images take a sample index rather than a sampler
+    if (args.size() > 2 && !isMultisampledImage(args[0], TR)) {
+      return genSampledReadImage(MIRBuilder, ret, retTy, args, TR);
+    } else {
+      return genReadImage(MIRBuilder, ret, retTy, args, TR);
     }
-    break;
-  case '_':
-    if (nameNoArgs.startswith("__translate_sampler_initializer")) {
-      return buildSamplerLiteral(args[0], ret, retTy, MIRBuilder, TR);
+  case BuiltinGroup::WriteImage:
+    return genWriteImage(MIRBuilder, args, TR);
+  case BuiltinGroup::SamplerInitializer:
+    return buildSamplerLiteral(args[0], ret, retTy, MIRBuilder, TR);
+  }
+  report_fatal_error("Cannot translate OpenCL built-in func: " + name);
+}
+
+// Get the opcode among the given ones with the given SPIR-V encoding, or 0
+static unsigned getOpcodeWithEncoding(uint64_t encoding,
+                                      ArrayRef<unsigned> opcodes,
+                                      MachineIRBuilder &MIRBuilder) {
+  const TargetInstrInfo &TII = MIRBuilder.getTII();
+  for (unsigned opcode : opcodes) {
+    if (getSPIRVOpcodeEncoding(TII.get(opcode).TSFlags) == encoding) {
+      return opcode;
     }
-    break;
+  }
+  return 0;
+}
+
+bool llvm::generateSPIRVIntrinsicCall(Intrinsic::ID ID,
+                                      MachineIRBuilder &MIRBuilder,
+                                      Register ret,
+                                      const SmallVectorImpl<Register> &args,
+                                      SPIRVTypeRegistry *TR) {
+  using namespace SPIRV;
+  const auto MRI = MIRBuilder.getMRI();
+  const auto &ST = MIRBuilder.getMF().getSubtarget<SPIRVSubtarget>();
+  SPIRVType *retTy = ret.isValid() ? TR->getSPIRVTypeForVReg(ret) : nullptr;
+
+  switch (ID) {
+  case Intrinsic::spirv_builtin: {
+    auto builtIn = static_cast<BuiltIn::BuiltIn>(getIConstVal(args[0], MRI));
+    return genBuiltinVariableLoad(MIRBuilder, ret, retTy, TR, builtIn);
+  }
+  case Intrinsic::spirv_control_barrier: {
+    auto MIB = MIRBuilder.buildInstr(OpControlBarrier)
+                   .addUse(args[0])
+                   .addUse(args[1])
+                   .addUse(args[2]);
+    return TR->constrainRegOperands(MIB);
+  }
+  case Intrinsic::spirv_memory_barrier: {
+    auto MIB =
+        MIRBuilder.buildInstr(OpMemoryBarrier).addUse(args[0]).addUse(args[1]);
+    return TR->constrainRegOperands(MIB);
+  }
+  case Intrinsic::spirv_atomic: {
+    const uint64_t encoding = getIConstVal(args[0], MRI);
+    const unsigned opcode = getOpcodeWithEncoding(
+        encoding,
+        {OpAtomicExchange, OpAtomicIAdd, OpAtomicISub, OpAtomicSMin,
+         OpAtomicUMin, OpAtomicSMax, OpAtomicUMax, OpAtomicAnd, OpAtomicOr,
+         OpAtomicXor, OpAtomicFAddEXT, OpAtomicFMinEXT, OpAtomicFMaxEXT},
+        MIRBuilder);
+    if (!opcode) {
+      report_fatal_error("llvm.spirv.atomic can't use SPIR-V opcode " +
+                         Twine(encoding));
+    }
+    if (opcode == OpAtomicFAddEXT || opcode == OpAtomicFMinEXT ||
+        opcode == OpAtomicFMaxEXT) {
+      const auto ext = opcode == OpAtomicFAddEXT
+                           ? Extension::SPV_EXT_shader_atomic_float_add
+                           : Extension::SPV_EXT_shader_atomic_float_min_max;
+      if (!ST.canUseExtension(ext)) {
+        report_fatal_error(Twine("llvm.spirv.atomic on floats requires ") +
+                           getExtensionName(ext));
+      }
+    }
+    auto MIB = MIRBuilder.buildInstr(opcode)
+                   .addDef(ret)
+                   .addUse(TR->getSPIRVTypeID(retTy))
+                   .addUse(args[1])
+                   .addUse(args[2])
+                   .addUse(args[3])
+                   .addUse(args[4]);
+    return TR->constrainRegOperands(MIB);
+  }
+  case Intrinsic::spirv_atomic_cmpxchg: {
+    auto MIB = MIRBuilder.buildInstr(OpAtomicCompareExchange)
+                   .addDef(ret)
+                   .addUse(TR->getSPIRVTypeID(retTy))
+                   .addUse(args[0])
+                   .addUse(args[1])
+                   .addUse(args[2])
+                   .addUse(args[3])
+                   .addUse(args[4])
+                   .addUse(args[5]);
+    return TR->constrainRegOperands(MIB);
+  }
+  case Intrinsic::spirv_group: {
+    const uint64_t encoding = getIConstVal(args[0], MRI);
+    const unsigned opcode = getOpcodeWithEncoding(
+        encoding,
+        {OpGroupIAdd, OpGroupFAdd, OpGroupFMin, OpGroupUMin, OpGroupSMin,
+         OpGroupFMax, OpGroupUMax, OpGroupSMax},
+        MIRBuilder);
+    if (!opcode) {
+      report_fatal_error("llvm.spirv.group can't use SPIR-V opcode " +
+                         Twine(encoding));
+    }
+    auto MIB = MIRBuilder.buildInstr(opcode)
+                   .addDef(ret)
+                   .addUse(TR->getSPIRVTypeID(retTy))
+                   .addUse(args[1])
+                   .addImm(getIConstVal(args[2], MRI))
+                   .addUse(args[3]);
+    return TR->constrainRegOperands(MIB);
+  }
+  case Intrinsic::spirv_image_read:
+    return genReadImage(MIRBuilder, ret, retTy, args, TR);
+  case Intrinsic::spirv_image_write:
+    return genWriteImage(MIRBuilder, args, TR);
+  case Intrinsic::spirv_image_sample_lod:
+    return genSampledReadImage(MIRBuilder, ret, retTy, args, TR);
   default:
     break;
   }
-  report_fatal_error("Cannot translate OpenCL built-in func: " + demangledName);
+  report_fatal_error("Cannot translate SPIR-V intrinsic: " +
+                     Intrinsic::getName(ID));
 }
-
@@ -7,7 +7,7 @@
 //===----------------------------------------------------------------------===//
 //
 // Functions for lowering OpenCL builtin types and function calls using their
-// demangled names
+// names, parsed from their Itanium mangling
 //
 //===----------------------------------------------------------------------===//
 
@@ -16,16 +16,65 @@
 
 #include "SPIRVTypeRegistry.h"
 #include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
+#include "llvm/IR/Intrinsics.h"
 
 namespace AQ = AccessQualifier;
 
 namespace llvm {
-bool generateOpenCLBuiltinCall(const StringRef demangledName,
+// A parameter type of an OpenCL builtin, as given by its mangled name.
+struct OpenCLBuiltinParam {
+  // The Itanium mangling of the scalar or vector element type (e.g. "i", "j",
+  // "f" or "Dh"), or the name of a class type (e.g. "ocl_image2d_ro").
+  std::string elemType;
+  // The number of vector elements, or 0 for non-vector types.
+  unsigned vectorWidth = 0;
+  bool isPointer = false;
+
+  // Whether the element type is one of the unsigned integer types.
+  bool isUnsigned() const {
+    return elemType == "h" || elemType == "t" || elemType == "j" ||
+           elemType == "m" || elemType == "y";
+  }
+};
+
+// The name and parameter types of an OpenCL builtin function.
+struct OpenCLBuiltinName {
+  std::string name;
+  // As many of the parameter types as could be parsed, in order.
+  SmallVector<OpenCLBuiltinParam, 4> params;
+};
+
+// Parse a function name mangled as _Z<length><name><parameter types>, or
+// return None if the name isn't mangled like this.
+Optional<OpenCLBuiltinName> parseOpenCLBuiltinName(StringRef mangledName);
+
+// Whether generateOpenCLBuiltinCall has a native lowering for the builtin.
+bool isLoweredOpenCLBuiltin(const OpenCLBuiltinName &builtin);
+
+// Whether a call to the builtin can return different values to the work-items
+// of a sub-group passing it the same arguments, such as the work-item ids and
+// scans. Otherwise, builtins accessing memory are assumed to.
+bool isVaryingOpenCLBuiltin(const OpenCLBuiltinName &builtin,
+                            bool accessesMemory);
+
+// Whether the builtin is lowered without OpenCL.std or the kernel-only
+// builtin variables, so GLCompute shaders can call it.
+bool isShaderOpenCLBuiltin(const OpenCLBuiltinName &builtin);
+
+bool generateOpenCLBuiltinCall(const OpenCLBuiltinName &builtin,
                                MachineIRBuilder &MIRBuilder, Register OrigRet,
                                const Type *OrigRetTy,
                                const SmallVectorImpl<Register> &OrigArgs,
                                SPIRVTypeRegistry *TR);
 
+// Lower a call to one of the llvm.spirv.* intrinsics standing for a SPIR-V
+// instruction, given the VRegs of the result, if any, and of the arguments,
+// including the constant ones.
+bool generateSPIRVIntrinsicCall(Intrinsic::ID ID, MachineIRBuilder &MIRBuilder,
+                                Register ret,
+                                const SmallVectorImpl<Register> &args,
+                                SPIRVTypeRegistry *TR);
+
 SPIRVType *generateOpenCLOpaqueType(const StringRef name,
                                     MachineIRBuilder &MIRBuilder,
                                     SPIRVTypeRegistry *TR,
@@ -0,0 +1,240 @@
+//===-- SPIRVPreEmitScheduler.cpp - Order instrs for pressure ---*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Reorder the selected instructions to shorten the live ranges drivers see, as
+// they mostly keep the order of the SPIR-V module. The IRTranslator and
+// selection build address computations, conversions and the like far from
+// their uses, often in the entry block, and every value kept alive that long
+// occupies a register in the driver compiler.
+//
+// An instruction without side effects whose result has a single use, names
+// and decorations aside, is first sunk into the block of that use, unless it
+// would then run in a loop it wasn't in. Then, in each block, the trees such
+// instructions form under the instruction using them are emitted right before
+// it, each subtree in decreasing order of the registers it needs, like
+// Sethi-Ullman numbering does, so fewer values are live at once.
+//
+// Instructions are only ever moved later, after their operands, and never
+// past a use, so OpPhis and OpVariables stay first in their blocks.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVInstrInfo.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineDominators.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+
+using namespace llvm;
+using namespace SPIRV;
+
+#define DEBUG_TYPE "spirv-pre-emit-scheduler"
+
+STATISTIC(NumSunk, "Number of instructions sunk into the block of their use");
+STATISTIC(NumScheduled, "Number of instructions reordered in their block");
+
+namespace {
+class SPIRVPreEmitScheduler : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVPreEmitScheduler() : MachineFunctionPass(ID) {
+    initializeSPIRVPreEmitSchedulerPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    AU.addRequired<MachineDominatorTree>();
+    AU.addRequired<MachineLoopInfo>();
+    AU.addPreserved<MachineDominatorTree>();
+    AU.addPreserved<MachineLoopInfo>();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+private:
+  MachineRegisterInfo *MRI;
+  const SPIRVInstrInfo *TII;
+  // The instructions of the block being scheduled only used later in it
+  SmallPtrSet<MachineInstr *, 32> treeInstrs;
+
+  using NeedMap = DenseMap<MachineInstr *, unsigned>;
+
+  // The single instruction using the result of MI, if it can be moved there
+  MachineInstr *getSingleUser(MachineInstr &MI) const;
+  unsigned getNeed(MachineInstr &MI, NeedMap &need,
+                   SmallVectorImpl<MachineInstr *> &operands) const;
+  void emitTree(MachineInstr &MI, MachineBasicBlock::iterator pos,
+                NeedMap &need);
+
+  bool sinkIntoUseBlocks();
+  bool scheduleBlock(MachineBasicBlock &MBB);
+};
+} // namespace
+
+MachineInstr *SPIRVPreEmitScheduler::getSingleUser(MachineInstr &MI) const {
+  if (MI.getNumDefs() != 1 || !TII->isSideEffectFreeInstr(MI)) {
+    return nullptr;
+  }
+  MachineInstr *user = nullptr;
+  for (auto &use : MRI->use_nodbg_operands(MI.getOperand(0).getReg())) {
+    MachineInstr *useMI = use.getParent();
+    if (TII->isDecorationInstr(*useMI) || useMI->getOpcode() == OpName) {
+      continue;
+    }
+    if (user) {
+      return nullptr;
+    }
+    user = useMI;
+  }
+  // Values used by OpPhis are live on the incoming edge, not in a block
+  if (!user || user->getOpcode() == OpPhi) {
+    return nullptr;
+  }
+  return user;
+}
+
+// Sink into the block of their use, visiting the blocks below in the dominator
+// tree first, so chains of instructions follow the one at their end
+bool SPIRVPreEmitScheduler::sinkIntoUseBlocks() {
+  auto &MDT = getAnalysis<MachineDominatorTree>();
+  auto &MLI = getAnalysis<MachineLoopInfo>();
+  bool changed = false;
+  for (MachineDomTreeNode *node : post_order(MDT.getRootNode())) {
+    MachineBasicBlock *MBB = node->getBlock();
+    for (auto I = MBB->rbegin(); I != MBB->rend();) {
+      MachineInstr &MI = *I++;
+      MachineInstr *user = getSingleUser(MI);
+      if (!user || user->getParent() == MBB) {
+        continue;
+      }
+      const MachineLoop *useLoop = MLI.getLoopFor(user->getParent());
+      if (useLoop && !useLoop->contains(MBB)) {
+        continue;
+      }
+      user->getParent()->splice(user, MBB, MI);
+      ++NumSunk;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Compute how many registers evaluating the tree of MI needs, filling operands
+// with the roots of its subtrees in the order they should be emitted
+unsigned SPIRVPreEmitScheduler::getNeed(
+    MachineInstr &MI, NeedMap &need,
+    SmallVectorImpl<MachineInstr *> &operands) const {
+  for (const MachineOperand &op : MI.uses()) {
+    if (!op.isReg() || !op.getReg().isVirtual()) {
+      continue;
+    }
+    MachineInstr *def = MRI->getVRegDef(op.getReg());
+    if (def && treeInstrs.count(def)) {
+      operands.push_back(def);
+    }
+  }
+  std::stable_sort(operands.begin(), operands.end(),
+                   [&](MachineInstr *a, MachineInstr *b) {
+                     return need[a] > need[b];
+                   });
+  unsigned res = 1;
+  for (unsigned i = 0; i < operands.size(); ++i) {
+    res = std::max(res, need[operands[i]] + i);
+  }
+  return res;
+}
+
+// Emit the tree of instructions MI uses right before pos, then MI itself
+void SPIRVPreEmitScheduler::emitTree(MachineInstr &MI,
+                                     MachineBasicBlock::iterator pos,
+                                     NeedMap &need) {
+  SmallVector<MachineInstr *, 4> operands;
+  getNeed(MI, need, operands);
+  for (MachineInstr *op : operands) {
+    emitTree(*op, pos, need);
+  }
+  if (treeInstrs.count(&MI)) {
+    MI.getParent()->splice(pos, MI.getParent(), MI);
+  }
+}
+
+bool SPIRVPreEmitScheduler::scheduleBlock(MachineBasicBlock &MBB) {
+  // The instructions only used later in the block are part of the tree of
+  // their user, and the others are the roots of the trees
+  treeInstrs.clear();
+  SmallVector<MachineInstr *, 32> roots;
+  for (MachineInstr &MI : MBB) {
+    MachineInstr *user = getSingleUser(MI);
+    if (user && user->getParent() == &MBB) {
+      treeInstrs.insert(&MI);
+    } else {
+      roots.push_back(&MI);
+    }
+  }
+  if (treeInstrs.empty()) {
+    return false;
+  }
+
+  // Compute the needs in order, as the operands of each instruction come
+  // before it
+  NeedMap need;
+  for (MachineInstr &MI : MBB) {
+    SmallVector<MachineInstr *, 4> operands;
+    const unsigned res = getNeed(MI, need, operands);
+    need[&MI] = res;
+  }
+  SmallVector<MachineInstr *, 32> oldOrder;
+  for (MachineInstr &MI : MBB) {
+    oldOrder.push_back(&MI);
+  }
+  for (MachineInstr *root : roots) {
+    emitTree(*root, root->getIterator(), need);
+  }
+  unsigned numMoved = 0;
+  auto oldI = oldOrder.begin();
+  for (MachineInstr &MI : MBB) {
+    numMoved += &MI != *oldI++;
+  }
+  NumScheduled += numMoved;
+  return numMoved != 0;
+}
+
+bool SPIRVPreEmitScheduler::runOnMachineFunction(MachineFunction &MF) {
+  if (skipFunction(MF.getFunction())) {
+    return false;
+  }
+  MRI = &MF.getRegInfo();
+  TII = static_cast<const SPIRVInstrInfo *>(MF.getSubtarget().getInstrInfo());
+
+  bool changed = sinkIntoUseBlocks();
+  for (MachineBasicBlock &MBB : MF) {
+    changed |= scheduleBlock(MBB);
+  }
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVPreEmitScheduler, DEBUG_TYPE,
+                      "SPIRV order instructions for register pressure", false,
+                      false)
+INITIALIZE_PASS_DEPENDENCY(MachineDominatorTree)
+INITIALIZE_PASS_DEPENDENCY(MachineLoopInfo)
+INITIALIZE_PASS_END(SPIRVPreEmitScheduler, DEBUG_TYPE,
+                    "SPIRV order instructions for register pressure", false,
+                    false)
+
+char SPIRVPreEmitScheduler::ID = 0;
+
+FunctionPass *llvm::createSPIRVPreEmitSchedulerPass() {
+  return new SPIRVPreEmitScheduler();
+}
@@ -0,0 +1,186 @@
+//===-- SPIRVPromoteConstantGlobals.cpp - Read-only globals ----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Move the initialized globals of kernels which are never written from the
+// CrossWorkgroup and Function storage classes to UniformConstant, so drivers
+// can place them in constant memory and read them through its cache.
+//
+// A global is promoted when it's constant, or has local linkage and is never
+// written, and all its uses are non-volatile loads, through any chain of GEPs
+// and bitcasts. The uses are then rebuilt on a copy of the global in the
+// UniformConstant address space, as UniformConstant pointers can't be cast to
+// any other storage class.
+//
+// Only the OpenCL environment allows data in UniformConstant variables, so
+// shaders are left alone.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-promote-constant-globals"
+
+STATISTIC(NumPromotedGlobals, "Number of globals moved to UniformConstant");
+
+namespace {
+class SPIRVPromoteConstantGlobals : public ModulePass {
+public:
+  static char ID;
+  SPIRVPromoteConstantGlobals() : ModulePass(ID) {
+    initializeSPIRVPromoteConstantGlobalsPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    ModulePass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+// Whether the pointer is only ever loaded from, directly or through GEPs and
+// bitcasts, so its uses can be rebuilt in another address space.
+static bool isOnlyLoaded(const Value *ptr) {
+  for (const User *U : ptr->users()) {
+    if (const auto *LI = dyn_cast<LoadInst>(U)) {
+      if (LI->isVolatile()) {
+        return false;
+      }
+    } else if (isa<GEPOperator>(U) || isa<BitCastOperator>(U)) {
+      if (cast<Operator>(U)->getOperand(0) != ptr || !isOnlyLoaded(U)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Rebuild the uses of oldPtr on newPtr, which points to the same type in
+// another address space. The uses must satisfy isOnlyLoaded.
+static void rebuildUses(Value *oldPtr, Value *newPtr) {
+  SmallVector<User *, 8> users(oldPtr->users());
+  for (User *U : users) {
+    if (auto *LI = dyn_cast<LoadInst>(U)) {
+      LI->setOperand(LI->getPointerOperandIndex(), newPtr);
+      continue;
+    }
+    auto *op = cast<Operator>(U);
+    SmallVector<Value *, 4> indices(op->op_begin() + 1, op->op_end());
+    Value *rebuilt;
+    if (auto *GEP = dyn_cast<GEPOperator>(op)) {
+      Type *srcTy = GEP->getSourceElementType();
+      if (auto *C = dyn_cast<Constant>(newPtr)) {
+        rebuilt = ConstantExpr::getGetElementPtr(srcTy, C, indices,
+                                                 GEP->isInBounds());
+      } else {
+        auto *newGEP =
+            GetElementPtrInst::Create(srcTy, newPtr, indices, GEP->getName(),
+                                      cast<Instruction>(GEP));
+        newGEP->setIsInBounds(GEP->isInBounds());
+        rebuilt = newGEP;
+      }
+    } else {
+      const unsigned addrSpace = newPtr->getType()->getPointerAddressSpace();
+      Type *newTy =
+          PointerType::get(op->getType()->getPointerElementType(), addrSpace);
+      if (auto *C = dyn_cast<Constant>(newPtr)) {
+        rebuilt = ConstantExpr::getBitCast(C, newTy);
+      } else {
+        rebuilt = new BitCastInst(newPtr, newTy, op->getName(),
+                                  cast<Instruction>(op));
+      }
+    }
+    rebuildUses(op, rebuilt);
+    if (auto *I = dyn_cast<Instruction>(op)) {
+      I->eraseFromParent();
+    } else {
+      cast<Constant>(op)->destroyConstant();
+    }
+  }
+}
+
+static bool canPromote(const GlobalVariable &GV, SPIRVTypeRegistry &TR) {
+  if (GV.isDeclaration() || !GV.hasInitializer() ||
+      GV.isExternallyInitialized() || GV.isThreadLocal() ||
+      GV.getName().startswith("llvm.")) {
+    return false;
+  }
+  const auto storage = TR.addressSpaceToStorageClass(GV.getAddressSpace());
+  if (storage != StorageClass::CrossWorkgroup &&
+      storage != StorageClass::Function) {
+    return false;
+  }
+  // Only this module can write a non-constant global with local linkage
+  if (!GV.isConstant() && !GV.hasLocalLinkage()) {
+    return false;
+  }
+  return isOnlyLoaded(&GV);
+}
+
+bool SPIRVPromoteConstantGlobals::runOnModule(Module &M) {
+  if (skipModule(M)) {
+    return false;
+  }
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  const SPIRVSubtarget &ST = *TM.getSubtargetImpl();
+  if (!ST.isKernel()) {
+    return false;
+  }
+  SPIRVTypeRegistry &TR = *ST.getSPIRVTypeRegistry();
+  const unsigned constantAddrSpace =
+      TR.StorageClassToAddressSpace(StorageClass::UniformConstant);
+
+  SmallVector<GlobalVariable *, 8> promoted;
+  for (GlobalVariable &GV : M.globals()) {
+    if (canPromote(GV, TR)) {
+      promoted.push_back(&GV);
+    }
+  }
+  for (GlobalVariable *GV : promoted) {
+    auto *newGV = new GlobalVariable(
+        M, GV->getValueType(), true, GV->getLinkage(), GV->getInitializer(),
+        "", GV, GlobalValue::NotThreadLocal, constantAddrSpace);
+    newGV->copyAttributesFrom(GV);
+    newGV->takeName(GV);
+    SmallVector<DIGlobalVariableExpression *, 1> debugInfo;
+    GV->getDebugInfo(debugInfo);
+    for (DIGlobalVariableExpression *GVE : debugInfo) {
+      newGV->addDebugInfo(GVE);
+    }
+    rebuildUses(GV, newGV);
+    GV->eraseFromParent();
+    ++NumPromotedGlobals;
+  }
+  return !promoted.empty();
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVPromoteConstantGlobals, DEBUG_TYPE,
+                      "SPIRV move read-only globals to UniformConstant", false,
+                      false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_END(SPIRVPromoteConstantGlobals, DEBUG_TYPE,
+                    "SPIRV move read-only globals to UniformConstant", false,
+                    false)
+
+char SPIRVPromoteConstantGlobals::ID = 0;
+
+ModulePass *llvm::createSPIRVPromoteConstantGlobalsPass() {
+  return new SPIRVPromoteConstantGlobals();
+}
@@ -15,6 +15,8 @@
 
 #include "llvm/CodeGen/TargetRegisterInfo.h"
 
+#include <limits>
+
 #define GET_REGINFO_HEADER
 #include "SPIRVGenRegisterInfo.inc"
 
@@ -38,6 +40,14 @@ struct SPIRVRegisterInfo : public SPIRVGenRegisterInfo {
   Register getFrameRegister(const MachineFunction &MF) const override {
     return 0;
   }
+
+  // Every vreg gets its own id, and drivers allocate the actual registers, so
+  // don't let the single dummy register make passes like MachineLICM see the
+  // pressure as always high
+  unsigned getRegPressureSetLimit(const MachineFunction &MF,
+                                  unsigned Idx) const override {
+    return std::numeric_limits<uint16_t>::max();
+  }
 };
 } // namespace llvm
 
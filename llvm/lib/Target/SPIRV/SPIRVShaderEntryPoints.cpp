@@ -0,0 +1,374 @@
+//===-- SPIRVShaderEntryPoints.cpp - GLCompute entry points ----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Give the kernels of shader targets the GLCompute entry points Vulkan can
+// dispatch. Their OpFunctions can't have parameters, so each kernel is replaced
+// by one without any, which reads its arguments from buffers and inlines the
+// original body:
+//
+//  - Global pointers become the runtime array of a StorageBuffer block.
+//  - Scalars, vectors and byval structs become members of the entry point's
+//    PushConstant block, in order, as long as they fit in
+//    -spirv-push-constant-limit bytes. This saves a descriptor update and a
+//    uniform buffer fetch per argument on each dispatch. The others become
+//    the only member of a Uniform block. Byval structs are then copied to a
+//    private variable.
+//
+// The buffers are in descriptor set 0, and bound in order of the arguments
+// using them. Each one gets spirv.descriptor_binding metadata, which
+// SPIRVIRTranslator turns into its DescriptorSet and Binding decorations.
+// With -spirv-arg-map, the binding or push constant offset of each argument is
+// written as JSON for the host runtime to set them.
+//
+// Local pointers are sized when OpenCL kernels are enqueued, which Vulkan has
+// no equivalent of, so they and the opaque image and sampler arguments aren't
+// supported.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-shader-entry-points"
+
+STATISTIC(NumBufferArgs, "Number of kernel arguments read from buffers");
+STATISTIC(NumPushConstantArgs,
+          "Number of kernel arguments read from push constants");
+
+static cl::opt<bool> PushConstantArgs(
+    "spirv-push-constant-args", cl::Hidden, cl::init(true),
+    cl::desc("Pass the scalar, vector and byval struct kernel arguments of "
+             "shaders as push constants rather than uniform buffers"));
+
+static cl::opt<unsigned> PushConstantLimit(
+    "spirv-push-constant-limit", cl::Hidden, cl::init(128),
+    cl::desc("Bytes of push constants the device supports, which Vulkan "
+             "guarantees to be at least 128"));
+
+static cl::opt<std::string> ArgMapFile(
+    "spirv-arg-map", cl::Hidden, cl::value_desc("filename"),
+    cl::desc("Write where the host is to put each kernel argument of shaders, "
+             "as JSON, to the given file"));
+
+namespace {
+class SPIRVShaderEntryPoints : public ModulePass {
+public:
+  static char ID;
+  SPIRVShaderEntryPoints() : ModulePass(ID) {
+    initializeSPIRVShaderEntryPointsPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnModule(Module &M) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    ModulePass::getAnalysisUsage(AU);
+  }
+};
+
+// Where the host puts the value of a kernel argument
+struct KernelArgLocation {
+  bool isPushConstant = false;
+  // For push constants, the bytes the argument takes in the block
+  uint64_t offset = 0;
+  uint64_t size = 0;
+  // For buffers, whether it's Uniform rather than StorageBuffer, and its
+  // binding in descriptor set 0
+  bool isUniform = false;
+  unsigned binding = 0;
+};
+
+struct KernelArgs {
+  uint64_t pushConstantSize = 0;
+  SmallVector<KernelArgLocation, 8> args;
+};
+
+using KernelArgMap = MapVector<StringRef, KernelArgs>;
+} // namespace
+
+// Get the type of an argument passed by value, i.e. a scalar, a vector or a
+// byval struct, or null for the pointers
+static Type *getByValueType(const Argument &Arg) {
+  Type *argTy = Arg.getType();
+  if (Arg.hasByValAttr()) {
+    return argTy->getPointerElementType();
+  } else if (argTy->isIntegerTy() || argTy->isFloatingPointTy() ||
+             argTy->isVectorTy()) {
+    return argTy;
+  } else if (!argTy->isPointerTy()) {
+    report_fatal_error("Unsupported kernel argument type in shaders");
+  }
+  return nullptr;
+}
+
+static std::string getArgName(StringRef kernelName, const Argument &Arg) {
+  if (Arg.hasName()) {
+    return (kernelName + "." + Arg.getName()).str();
+  }
+  return (kernelName + "." + Twine(Arg.getArgNo())).str();
+}
+
+// Build a block variable with the given members
+static GlobalVariable *buildBlock(Module &M, const Twine &name,
+                                  ArrayRef<Type *> memberTys,
+                                  unsigned addrSpace) {
+  auto *blockTy =
+      StructType::create(M.getContext(), memberTys, (name + ".block").str());
+  return new GlobalVariable(M, blockTy, false, GlobalValue::ExternalLinkage,
+                            nullptr, name, nullptr, GlobalValue::NotThreadLocal,
+                            addrSpace);
+}
+
+// Build the block variable holding an argument of the kernel, with the given
+// binding
+static GlobalVariable *buildArgBuffer(Module &M, StringRef kernelName,
+                                      const Argument &Arg, Type *memberTy,
+                                      unsigned addrSpace, unsigned binding) {
+  LLVMContext &ctx = M.getContext();
+  GlobalVariable *GV =
+      buildBlock(M, getArgName(kernelName, Arg), memberTy, addrSpace);
+  Type *i32Ty = Type::getInt32Ty(ctx);
+  Metadata *setAndBinding[] = {
+      ConstantAsMetadata::get(ConstantInt::get(i32Ty, 0)),
+      ConstantAsMetadata::get(ConstantInt::get(i32Ty, binding))};
+  GV->setMetadata("spirv.descriptor_binding", MDNode::get(ctx, setAndBinding));
+  ++NumBufferArgs;
+  return GV;
+}
+
+// Load an argument passed by value from a member of a block, copying byval
+// structs to a private variable
+static Value *buildMemberLoad(const Argument &Arg, GlobalVariable *GV,
+                              unsigned memberIdx, IRBuilder<> &B) {
+  Type *valueTy = getByValueType(Arg);
+  Value *member = B.CreateStructGEP(GV->getValueType(), GV, memberIdx);
+  Value *loaded = B.CreateLoad(valueTy, member);
+  if (!Arg.hasByValAttr()) {
+    return loaded;
+  }
+  Value *copy = B.CreateAlloca(valueTy);
+  B.CreateStore(loaded, copy);
+  return copy;
+}
+
+// Get the value of an argument of the kernel from a new buffer, in the entry
+// block of the function replacing it
+static Value *buildArgLoad(Module &M, StringRef kernelName,
+                           const Argument &Arg, unsigned binding,
+                           SPIRVTypeRegistry &TR, IRBuilder<> &B) {
+  if (Type *valueTy = getByValueType(Arg)) {
+    GlobalVariable *GV = buildArgBuffer(
+        M, kernelName, Arg, valueTy,
+        TR.StorageClassToAddressSpace(StorageClass::Uniform), binding);
+    return buildMemberLoad(Arg, GV, 0, B);
+  }
+  auto *ptrTy = cast<PointerType>(Arg.getType());
+  const auto sc = TR.addressSpaceToStorageClass(ptrTy->getAddressSpace());
+  if (sc != StorageClass::StorageBuffer) {
+    report_fatal_error("Only global pointer kernel arguments can be bound to "
+                       "buffers in shaders");
+  }
+  Type *arrayTy = ArrayType::get(ptrTy->getElementType(), 0);
+  GlobalVariable *GV = buildArgBuffer(M, kernelName, Arg, arrayTy,
+                                      ptrTy->getAddressSpace(), binding);
+  Value *member = B.CreateStructGEP(GV->getValueType(), GV, 0);
+  return B.CreateConstInBoundsGEP2_32(arrayTy, member, 0, 0);
+}
+
+// Choose the arguments passed by value which fit in the push constants, in
+// order, and find their offsets in the block, as its Offset decorations give
+static void layOutPushConstants(const Function &F, const SPIRVTypeRegistry &TR,
+                                SmallVectorImpl<const Argument *> &pushed,
+                                SmallVectorImpl<uint64_t> &offsets,
+                                uint64_t &size) {
+  size = 0;
+  if (!PushConstantArgs) {
+    return;
+  }
+  for (const Argument &Arg : F.args()) {
+    Type *valueTy = getByValueType(Arg);
+    if (!valueTy) {
+      continue;
+    }
+    const auto layout =
+        TR.getExplicitLayout(valueTy, StorageClass::PushConstant);
+    const uint64_t offset = alignTo(size, layout.second);
+    if (offset + layout.first > PushConstantLimit) {
+      continue;
+    }
+    pushed.push_back(&Arg);
+    offsets.push_back(offset);
+    size = offset + layout.first;
+  }
+}
+
+// Replace the kernel by one without parameters, which inlines it
+static void buildEntryPoint(Module &M, Function &F, SPIRVTypeRegistry &TR,
+                            KernelArgMap &argMap) {
+  LLVMContext &ctx = M.getContext();
+  auto *entry = Function::Create(FunctionType::get(Type::getVoidTy(ctx), false),
+                                 F.getLinkage(), F.getAddressSpace(), "", &M);
+  entry->takeName(&F);
+  entry->setCallingConv(CallingConv::SPIR_KERNEL);
+  entry->setAttributes(AttributeList::get(
+      ctx, F.getAttributes().getFnAttributes(), AttributeSet(), {}));
+  SmallVector<std::pair<unsigned, MDNode *>, 8> MDs;
+  F.getAllMetadata(MDs);
+  for (const auto &MD : MDs) {
+    entry->setMetadata(MD.first, MD.second);
+  }
+  F.clearMetadata();
+  F.setLinkage(GlobalValue::InternalLinkage);
+  F.setCallingConv(CallingConv::SPIR_FUNC);
+  const StringRef kernelName = entry->getName();
+
+  // An entry point can only use one PushConstant block
+  SmallVector<const Argument *, 8> pushed;
+  SmallVector<uint64_t, 8> offsets;
+  uint64_t pushConstantSize;
+  layOutPushConstants(F, TR, pushed, offsets, pushConstantSize);
+  GlobalVariable *pushConstants = nullptr;
+  if (!pushed.empty()) {
+    SmallVector<Type *, 8> memberTys;
+    for (const Argument *Arg : pushed) {
+      memberTys.push_back(getByValueType(*Arg));
+    }
+    pushConstants = buildBlock(
+        M, kernelName + ".push_constants", memberTys,
+        TR.StorageClassToAddressSpace(StorageClass::PushConstant));
+    NumPushConstantArgs += pushed.size();
+  }
+
+  KernelArgs &kernelArgs = argMap[kernelName];
+  kernelArgs.pushConstantSize = pushConstantSize;
+  IRBuilder<> B(BasicBlock::Create(ctx, "entry", entry));
+  SmallVector<Value *, 8> args;
+  unsigned binding = 0;
+  for (const Argument &Arg : F.args()) {
+    KernelArgLocation loc;
+    auto pushedIt = find(pushed, &Arg);
+    if (pushedIt != pushed.end()) {
+      const unsigned memberIdx = pushedIt - pushed.begin();
+      args.push_back(buildMemberLoad(Arg, pushConstants, memberIdx, B));
+      loc.isPushConstant = true;
+      loc.offset = offsets[memberIdx];
+      loc.size = TR.getExplicitLayout(getByValueType(Arg),
+                                      StorageClass::PushConstant)
+                     .first;
+    } else {
+      loc.isUniform = getByValueType(Arg) != nullptr;
+      loc.binding = binding;
+      args.push_back(buildArgLoad(M, kernelName, Arg, binding++, TR, B));
+    }
+    kernelArgs.args.push_back(loc);
+  }
+  CallInst *call = B.CreateCall(&F, args);
+  call->setCallingConv(CallingConv::SPIR_FUNC);
+  if (DISubprogram *SP = entry->getSubprogram()) {
+    call->setDebugLoc(DILocation::get(ctx, SP->getLine(), 0, SP));
+  }
+  B.CreateRetVoid();
+
+  InlineFunctionInfo IFI;
+  if (!InlineFunction(call, IFI)) {
+    report_fatal_error("Unable to inline kernel " + kernelName +
+                       " into its entry point");
+  }
+  if (F.use_empty()) {
+    F.eraseFromParent();
+  }
+}
+
+// Write where each kernel argument is to be given to the -spirv-arg-map file
+static void writeArgMap(const Module &M, const KernelArgMap &argMap) {
+  std::error_code EC;
+  raw_fd_ostream out(ArgMapFile, EC, sys::fs::OF_Text);
+  if (EC) {
+    report_fatal_error("Can't open the SPIR-V argument map " + ArgMapFile +
+                       ": " + EC.message());
+  }
+
+  json::OStream J(out, 2);
+  J.object([&] {
+    J.attribute("module", M.getModuleIdentifier());
+    J.attributeArray("kernels", [&] {
+      for (const auto &kernel : argMap) {
+        J.object([&] {
+          J.attribute("name", kernel.first);
+          J.attribute("push_constant_size", kernel.second.pushConstantSize);
+          J.attributeArray("args", [&] {
+            for (const KernelArgLocation &loc : kernel.second.args) {
+              J.object([&] {
+                if (loc.isPushConstant) {
+                  J.attribute("kind", "push_constant");
+                  J.attribute("offset", loc.offset);
+                  J.attribute("size", loc.size);
+                } else {
+                  J.attribute("kind",
+                              loc.isUniform ? "uniform" : "storage_buffer");
+                  J.attribute("descriptor_set", 0);
+                  J.attribute("binding", loc.binding);
+                }
+              });
+            }
+          });
+        });
+      }
+    });
+  });
+  out << '\n';
+}
+
+bool SPIRVShaderEntryPoints::runOnModule(Module &M) {
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  const SPIRVSubtarget &ST = *TM.getSubtargetImpl();
+  if (ST.isKernel()) {
+    return false;
+  }
+  SmallVector<Function *, 8> kernels;
+  for (Function &F : M) {
+    if (!F.isDeclaration() && F.getCallingConv() == CallingConv::SPIR_KERNEL &&
+        !F.arg_empty()) {
+      kernels.push_back(&F);
+    }
+  }
+  KernelArgMap argMap;
+  for (Function *F : kernels) {
+    buildEntryPoint(M, *F, *ST.getSPIRVTypeRegistry(), argMap);
+  }
+  if (!ArgMapFile.empty()) {
+    writeArgMap(M, argMap);
+  }
+  return !kernels.empty();
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVShaderEntryPoints, DEBUG_TYPE,
+                      "SPIRV build GLCompute entry points", false, false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_END(SPIRVShaderEntryPoints, DEBUG_TYPE,
+                    "SPIRV build GLCompute entry points", false, false)
+
+char SPIRVShaderEntryPoints::ID = 0;
+
+ModulePass *llvm::createSPIRVShaderEntryPointsPass() {
+  return new SPIRVShaderEntryPoints();
+}
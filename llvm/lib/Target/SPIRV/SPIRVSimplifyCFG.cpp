@@ -0,0 +1,259 @@
+//===-- SPIRVSimplifyCFG.cpp - Simplify SPIR-V CFGs -------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// A replacement for BranchFolder and MachineBlockPlacement, which can't be used
+// as they don't know about OpPhi. This removes the blocks which only branch to
+// another block, by sending their predecessors straight to the target, and
+// merges each block with a single predecessor into that predecessor, if it's
+// the predecessor's only successor. OpPhis in the affected blocks' successors
+// are updated to refer to the new incoming blocks.
+//
+// This must run before SPIRVBlockLabeler replaces MBB operands with OpLabel
+// IDs, and isn't run for shaders, where the empty blocks may be the merge or
+// continue targets of structured control flow.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVInstrInfo.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+
+using namespace llvm;
+using namespace SPIRV;
+
+#define DEBUG_TYPE "spirv-simplify-cfg"
+
+STATISTIC(NumForwardingBlocks, "Number of forwarding blocks removed");
+STATISTIC(NumMergedBlocks, "Number of blocks merged into their predecessor");
+
+namespace {
+class SPIRVSimplifyCFG : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVSimplifyCFG() : MachineFunctionPass(ID) {
+    initializeSPIRVSimplifyCFGPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  const SPIRVInstrInfo *TII;
+
+  void makeFallthroughsExplicit(MachineFunction &MF);
+  MachineBasicBlock *getForwardingTarget(MachineBasicBlock &MBB) const;
+  bool redirectBranches(MachineBasicBlock &pred, MachineBasicBlock &from,
+                        MachineBasicBlock &to);
+  bool removeForwardingBlock(MachineBasicBlock &MBB);
+  bool mergeIntoPredecessor(MachineBasicBlock &MBB);
+};
+} // namespace
+
+static bool hasPhis(const MachineBasicBlock &MBB) {
+  for (const auto &MI : MBB) {
+    if (MI.getOpcode() == OpPhi) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Make every OpPhi in MBB taking a value from the block from take it from the
+// block to instead.
+static void replacePhiBlock(MachineBasicBlock &MBB, MachineBasicBlock *from,
+                            MachineBasicBlock *to) {
+  for (auto &MI : MBB) {
+    if (MI.getOpcode() != OpPhi) {
+      continue;
+    }
+    for (unsigned i = 3; i < MI.getNumOperands(); i += 2) {
+      if (MI.getOperand(i).getMBB() == from) {
+        MI.getOperand(i).setMBB(to);
+      }
+    }
+  }
+}
+
+// Blocks ending without a terminator, or with an OpBranchConditional missing
+// its false target, fall through to the next block. Make those branches
+// explicit, so blocks can be removed without changing where they go.
+void SPIRVSimplifyCFG::makeFallthroughsExplicit(MachineFunction &MF) {
+  for (auto &MBB : MF) {
+    MachineBasicBlock *next = MBB.getNextNode();
+    auto lastInstr = MBB.getLastNonDebugInstr();
+    if (lastInstr == MBB.end() || !lastInstr->isTerminator()) {
+      if (next) {
+        BuildMI(&MBB, DebugLoc(), TII->get(OpBranch)).addMBB(next);
+      }
+    } else if (lastInstr->getOpcode() == OpBranchConditional &&
+               lastInstr->getNumOperands() < 3 && next) {
+      lastInstr->addOperand(MachineOperand::CreateMBB(next));
+    }
+  }
+}
+
+// Get the block MBB branches to, if branching there is all it does.
+MachineBasicBlock *
+SPIRVSimplifyCFG::getForwardingTarget(MachineBasicBlock &MBB) const {
+  if (&MBB == &MBB.getParent()->front()) {
+    return nullptr;
+  }
+  auto lastInstr = MBB.getLastNonDebugInstr();
+  if (lastInstr == MBB.end() || lastInstr->getOpcode() != OpBranch) {
+    return nullptr;
+  }
+  for (const auto &MI : MBB) {
+    if (!MI.isDebugInstr() && &MI != &*lastInstr) {
+      return nullptr;
+    }
+  }
+  MachineBasicBlock *target = lastInstr->getOperand(0).getMBB();
+  return target == &MBB ? nullptr : target;
+}
+
+// Make the branches at the end of pred which go to the block from go to the
+// block to instead. Returns false if pred ends with an unexpected terminator.
+bool SPIRVSimplifyCFG::redirectBranches(MachineBasicBlock &pred,
+                                        MachineBasicBlock &from,
+                                        MachineBasicBlock &to) {
+  auto term = pred.getLastNonDebugInstr();
+  if (term == pred.end() || (term->getOpcode() != OpBranch &&
+                             term->getOpcode() != OpBranchConditional)) {
+    return false;
+  }
+  for (auto &op : term->operands()) {
+    if (op.isMBB() && op.getMBB() == &from) {
+      op.setMBB(&to);
+    }
+  }
+  // A conditional branch with both targets the same is an OpBranch
+  if (term->getOpcode() == OpBranchConditional &&
+      term->getOperand(1).getMBB() == term->getOperand(2).getMBB()) {
+    BuildMI(pred, term, term->getDebugLoc(), TII->get(OpBranch)).addMBB(&to);
+    term->eraseFromParent();
+  }
+  pred.replaceSuccessor(&from, &to);
+  return true;
+}
+
+// Send the predecessors of a block which only branches elsewhere straight to
+// its target, and remove it once it has no predecessors left.
+bool SPIRVSimplifyCFG::removeForwardingBlock(MachineBasicBlock &MBB) {
+  MachineBasicBlock *target = getForwardingTarget(MBB);
+  if (!target) {
+    return false;
+  }
+
+  // An OpPhi can't have two incoming values from the same block, so keep the
+  // forwarding block for predecessors already branching to a target with
+  // OpPhis
+  bool targetHasPhis = hasPhis(*target);
+  bool changed = false;
+  SmallVector<MachineBasicBlock *, 4> preds(MBB.pred_begin(), MBB.pred_end());
+  for (MachineBasicBlock *pred : preds) {
+    if (targetHasPhis && pred->isSuccessor(target)) {
+      continue;
+    }
+    if (!redirectBranches(*pred, MBB, *target)) {
+      continue;
+    }
+    // The target now gets the forwarded values straight from pred
+    for (auto &MI : *target) {
+      if (MI.getOpcode() != OpPhi) {
+        continue;
+      }
+      for (unsigned i = 3; i < MI.getNumOperands(); i += 2) {
+        if (MI.getOperand(i).getMBB() == &MBB) {
+          Register val = MI.getOperand(i - 1).getReg();
+          MachineInstrBuilder(*MBB.getParent(), MI).addUse(val).addMBB(pred);
+          break;
+        }
+      }
+    }
+    changed = true;
+  }
+  if (!MBB.pred_empty()) {
+    return changed;
+  }
+
+  // Drop the forwarding block's incoming values, and the block itself
+  for (auto &MI : *target) {
+    if (MI.getOpcode() != OpPhi) {
+      continue;
+    }
+    for (unsigned i = MI.getNumOperands() - 1; i >= 3; i -= 2) {
+      if (MI.getOperand(i).getMBB() == &MBB) {
+        MI.RemoveOperand(i);
+        MI.RemoveOperand(i - 1);
+      }
+    }
+  }
+  MBB.removeSuccessor(target);
+  MBB.eraseFromParent();
+  ++NumForwardingBlocks;
+  return true;
+}
+
+// Move the contents of MBB to the end of its only predecessor, if MBB is the
+// only block that predecessor branches to.
+bool SPIRVSimplifyCFG::mergeIntoPredecessor(MachineBasicBlock &MBB) {
+  if (&MBB == &MBB.getParent()->front() || MBB.pred_size() != 1 ||
+      hasPhis(MBB)) {
+    return false;
+  }
+  MachineBasicBlock *pred = *MBB.pred_begin();
+  if (pred == &MBB || pred->succ_size() != 1) {
+    return false;
+  }
+  auto term = pred->getLastNonDebugInstr();
+  if (term == pred->end() || term->getOpcode() != OpBranch ||
+      term->getOperand(0).getMBB() != &MBB) {
+    return false;
+  }
+
+  term->eraseFromParent();
+  pred->splice(pred->end(), &MBB, MBB.begin(), MBB.end());
+  pred->removeSuccessor(&MBB);
+  for (MachineBasicBlock *succ : MBB.successors()) {
+    replacePhiBlock(*succ, &MBB, pred);
+  }
+  pred->transferSuccessors(&MBB);
+  MBB.eraseFromParent();
+  ++NumMergedBlocks;
+  return true;
+}
+
+bool SPIRVSimplifyCFG::runOnMachineFunction(MachineFunction &MF) {
+  TII = static_cast<const SPIRVInstrInfo *>(MF.getSubtarget().getInstrInfo());
+  makeFallthroughsExplicit(MF);
+
+  // Removing a block can make its neighbours simplifiable, so repeat until
+  // nothing changes
+  bool changed = false;
+  bool changedThisIter = true;
+  while (changedThisIter) {
+    changedThisIter = false;
+    for (auto &MBB : make_early_inc_range(MF)) {
+      if (removeForwardingBlock(MBB) || mergeIntoPredecessor(MBB)) {
+        changedThisIter = true;
+      }
+    }
+    changed |= changedThisIter;
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVSimplifyCFG, DEBUG_TYPE, "SPIRV simplify CFG", false,
+                false)
+
+char SPIRVSimplifyCFG::ID = 0;
+
+FunctionPass *llvm::createSPIRVSimplifyCFGPass() {
+  return new SPIRVSimplifyCFG();
+}
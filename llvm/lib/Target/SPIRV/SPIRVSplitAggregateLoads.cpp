@@ -0,0 +1,141 @@
+//===-- SPIRVSplitAggregateLoads.cpp - Load used fields only ----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Replace the loads of whole structs and arrays which are only used through
+// extractvalues by loads of the fields extracted. Aggregates aren't flattened
+// during translation, so such a load becomes an OpLoad of the whole aggregate
+// and OpCompositeExtracts of its fields, and drivers read all of it from
+// memory, e.g. when a kernel only uses a few fields of a large struct of
+// parameters in global memory.
+//
+// Each field extracted is instead loaded on its own, through an inbounds GEP
+// translated to an OpInBoundsAccessChain, at the position of the original
+// load. Loads where every element is extracted are kept, as they read the
+// same memory either way.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallBitVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-split-aggregate-loads"
+
+STATISTIC(NumLoadsSplit, "Number of aggregate loads split into field loads");
+STATISTIC(NumFieldLoads, "Number of field loads created");
+
+namespace {
+class SPIRVSplitAggregateLoads : public FunctionPass {
+public:
+  static char ID;
+  SPIRVSplitAggregateLoads() : FunctionPass(ID) {
+    initializeSPIRVSplitAggregateLoadsPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+} // namespace
+
+static unsigned getNumElements(Type *Ty) {
+  if (auto *ST = dyn_cast<StructType>(Ty)) {
+    return ST->getNumElements();
+  }
+  return cast<ArrayType>(Ty)->getNumElements();
+}
+
+// Split the load into loads of the fields its extractvalues use, if not all
+// of its elements are used
+static bool splitLoad(LoadInst &LI, const DataLayout &DL) {
+  Type *Ty = LI.getType();
+  if (!LI.isSimple() || LI.use_empty() ||
+      (!Ty->isStructTy() && !Ty->isArrayTy())) {
+    return false;
+  }
+  // The extractvalues of each field, by the indices of the field
+  MapVector<ArrayRef<unsigned>, SmallVector<ExtractValueInst *, 2>> fields;
+  SmallBitVector usedElements(getNumElements(Ty));
+  for (User *U : LI.users()) {
+    auto *EVI = dyn_cast<ExtractValueInst>(U);
+    if (!EVI) {
+      return false;
+    }
+    fields[EVI->getIndices()].push_back(EVI);
+    usedElements.set(EVI->getIndices()[0]);
+  }
+  if (usedElements.all()) {
+    return false;
+  }
+
+  IRBuilder<> builder(&LI);
+  Type *I32Ty = builder.getInt32Ty();
+  Value *ptr = LI.getPointerOperand();
+  const uint64_t align = LI.getAlignment();
+  for (const auto &field : fields) {
+    SmallVector<Value *, 4> indices{ConstantInt::get(I32Ty, 0)};
+    for (unsigned idx : field.first) {
+      indices.push_back(ConstantInt::get(I32Ty, idx));
+    }
+    Value *fieldPtr = builder.CreateInBoundsGEP(Ty, ptr, indices);
+    ExtractValueInst *first = field.second.front();
+    LoadInst *fieldLoad =
+        builder.CreateLoad(first->getType(), fieldPtr, first->getName());
+    // The field is as aligned as the aggregate, up to its offset in it
+    const uint64_t offset = DL.getIndexedOffsetInType(Ty, indices);
+    if (align) {
+      fieldLoad->setAlignment(MinAlign(align, offset));
+    }
+    for (ExtractValueInst *EVI : field.second) {
+      EVI->replaceAllUsesWith(fieldLoad);
+      EVI->eraseFromParent();
+    }
+    ++NumFieldLoads;
+  }
+  LI.eraseFromParent();
+  ++NumLoadsSplit;
+  return true;
+}
+
+bool SPIRVSplitAggregateLoads::runOnFunction(Function &F) {
+  if (skipFunction(F)) {
+    return false;
+  }
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  SmallVector<LoadInst *, 8> loads;
+  for (Instruction &I : instructions(F)) {
+    if (auto *LI = dyn_cast<LoadInst>(&I)) {
+      loads.push_back(LI);
+    }
+  }
+  bool changed = false;
+  for (LoadInst *LI : loads) {
+    changed |= splitLoad(*LI, DL);
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVSplitAggregateLoads, DEBUG_TYPE,
+                "SPIRV load the used fields of aggregates", false, false)
+
+char SPIRVSplitAggregateLoads::ID = 0;
+
+FunctionPass *llvm::createSPIRVSplitAggregateLoadsPass() {
+  return new SPIRVSplitAggregateLoads();
+}
@@ -0,0 +1,318 @@
+//===-- SPIRVStackColoring.cpp - Share private arrays ----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Merge the static allocas whose lifetimes, as given by llvm.lifetime.start and
+// llvm.lifetime.end, never overlap, like StackColoring does for the frame
+// indices of other targets. Each alloca becomes a Function storage OpVariable,
+// and the private memory they take per work item limits the occupancy of GPUs,
+// so kernels with several temporary arrays benefit the most.
+//
+// The liveness of each alloca is propagated through the CFG from its markers,
+// and allocas are then assigned greedily, largest first, to the first slot
+// with no live range overlapping theirs. The other allocas of a slot are
+// replaced by bitcasts of its first one, so this only runs with physical
+// addressing, and the slot gets the largest alignment of them. The markers of
+// merged allocas are removed, as they'd now overlap.
+//
+// Each function with merged allocas gets a remark with the private memory it
+// uses before and after, e.g. for -pass-remarks=spirv-stack-coloring.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-stack-coloring"
+
+STATISTIC(NumMergedAllocas, "Number of allocas merged into another");
+STATISTIC(NumBytesSaved, "Number of bytes of private memory saved");
+
+namespace {
+class SPIRVStackColoring : public FunctionPass {
+public:
+  static char ID;
+  SPIRVStackColoring() : FunctionPass(ID) {
+    initializeSPIRVStackColoringPass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<TargetPassConfig>();
+    AU.addRequired<OptimizationRemarkEmitterWrapperPass>();
+    AU.setPreservesCFG();
+    FunctionPass::getAnalysisUsage(AU);
+  }
+};
+
+// The ranges of instruction numbers, inclusive, in which an alloca is live
+using LiveRanges = SmallVector<std::pair<unsigned, unsigned>, 4>;
+
+// The candidates whose markers start or end their lifetime last in a block,
+// and the ones live on entry and exit, indexed like the candidates
+struct BlockLiveness {
+  BitVector begin;
+  BitVector end;
+  BitVector liveIn;
+  BitVector liveOut;
+};
+
+// Allocas sharing the storage of the first one
+struct Slot {
+  SmallVector<AllocaInst *, 4> allocas;
+  LiveRanges ranges;
+};
+} // namespace
+
+// Get the alloca whose lifetime the instruction starts or ends, or null if it's
+// not a lifetime marker
+static AllocaInst *getMarkedAlloca(const Instruction &I, bool &isStart) {
+  const auto *II = dyn_cast<IntrinsicInst>(&I);
+  if (!II || (II->getIntrinsicID() != Intrinsic::lifetime_start &&
+              II->getIntrinsicID() != Intrinsic::lifetime_end)) {
+    return nullptr;
+  }
+  isStart = II->getIntrinsicID() == Intrinsic::lifetime_start;
+  return dyn_cast<AllocaInst>(II->getArgOperand(1)->stripPointerCasts());
+}
+
+static uint64_t getAllocaSize(const AllocaInst &AI, const DataLayout &DL) {
+  const auto *arraySize = cast<ConstantInt>(AI.getArraySize());
+  return DL.getTypeAllocSize(AI.getAllocatedType()) * arraySize->getZExtValue();
+}
+
+static bool overlap(const LiveRanges &lhs, const LiveRanges &rhs) {
+  for (const auto &l : lhs) {
+    for (const auto &r : rhs) {
+      if (l.first <= r.second && r.first <= l.second) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool SPIRVStackColoring::runOnFunction(Function &F) {
+  if (skipFunction(F)) {
+    return false;
+  }
+  const auto &TM = getAnalysis<TargetPassConfig>().getTM<SPIRVTargetMachine>();
+  if (TM.getSubtargetImpl()->isLogicalAddressing()) {
+    return false;
+  }
+  const DataLayout &DL = F.getParent()->getDataLayout();
+
+  // The candidates are the static allocas with lifetime.starts, as the others
+  // are live throughout the function
+  SmallVector<AllocaInst *, 8> candidates;
+  DenseMap<const AllocaInst *, unsigned> candidateIdx;
+  SmallVector<IntrinsicInst *, 16> markers;
+  uint64_t privateBytes = 0;
+  for (Instruction &I : F.getEntryBlock()) {
+    if (auto *AI = dyn_cast<AllocaInst>(&I)) {
+      if (AI->isStaticAlloca()) {
+        privateBytes += getAllocaSize(*AI, DL);
+      }
+    }
+  }
+  for (BasicBlock &BB : F) {
+    for (Instruction &I : BB) {
+      bool isStart;
+      AllocaInst *AI = getMarkedAlloca(I, isStart);
+      if (!AI || !AI->isStaticAlloca()) {
+        continue;
+      }
+      markers.push_back(cast<IntrinsicInst>(&I));
+      if (isStart && candidateIdx.try_emplace(AI, candidates.size()).second) {
+        candidates.push_back(AI);
+      }
+    }
+  }
+  if (candidates.size() < 2) {
+    return false;
+  }
+
+  // Number the instructions, and find the last marker of each candidate in
+  // each block
+  const unsigned numCandidates = candidates.size();
+  DenseMap<const BasicBlock *, BlockLiveness> liveness;
+  DenseMap<const Instruction *, unsigned> instrIdx;
+  unsigned idx = 0;
+  for (BasicBlock &BB : F) {
+    BlockLiveness &BL = liveness[&BB];
+    BL.begin.resize(numCandidates);
+    BL.end.resize(numCandidates);
+    BL.liveIn.resize(numCandidates);
+    BL.liveOut.resize(numCandidates);
+    for (Instruction &I : BB) {
+      instrIdx[&I] = idx++;
+      bool isStart;
+      AllocaInst *AI = getMarkedAlloca(I, isStart);
+      auto it = AI ? candidateIdx.find(AI) : candidateIdx.end();
+      if (it == candidateIdx.end()) {
+        continue;
+      }
+      BL.begin[it->second] = isStart;
+      BL.end[it->second] = !isStart;
+    }
+  }
+
+  // An alloca is live where a path from one of its lifetime.starts reaches
+  // without going through a lifetime.end
+  ReversePostOrderTraversal<Function *> RPOT(&F);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (BasicBlock *BB : RPOT) {
+      BlockLiveness &BL = liveness[BB];
+      BitVector liveIn(numCandidates);
+      for (BasicBlock *pred : predecessors(BB)) {
+        liveIn |= liveness[pred].liveOut;
+      }
+      BitVector liveOut = liveIn;
+      liveOut.reset(BL.end);
+      liveOut |= BL.begin;
+      if (liveIn != BL.liveIn || liveOut != BL.liveOut) {
+        BL.liveIn = std::move(liveIn);
+        BL.liveOut = std::move(liveOut);
+        changed = true;
+      }
+    }
+  }
+
+  SmallVector<LiveRanges, 8> ranges(numCandidates);
+  for (BasicBlock &BB : F) {
+    BitVector live = liveness[&BB].liveIn;
+    SmallVector<unsigned, 8> rangeStart(numCandidates, instrIdx[&BB.front()]);
+    for (Instruction &I : BB) {
+      bool isStart;
+      AllocaInst *AI = getMarkedAlloca(I, isStart);
+      auto it = AI ? candidateIdx.find(AI) : candidateIdx.end();
+      if (it == candidateIdx.end()) {
+        continue;
+      }
+      const unsigned c = it->second;
+      if (isStart && !live[c]) {
+        rangeStart[c] = instrIdx[&I];
+        live.set(c);
+      } else if (!isStart && live[c]) {
+        ranges[c].push_back({rangeStart[c], instrIdx[&I]});
+        live.reset(c);
+      }
+    }
+    for (unsigned c : live.set_bits()) {
+      ranges[c].push_back({rangeStart[c], instrIdx[&BB.back()]});
+    }
+  }
+
+  // Give the largest allocas a slot first, so each slot's first alloca is its
+  // largest
+  SmallVector<unsigned, 8> order;
+  for (unsigned c = 0; c < numCandidates; ++c) {
+    order.push_back(c);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+    return getAllocaSize(*candidates[a], DL) >
+           getAllocaSize(*candidates[b], DL);
+  });
+  SmallVector<Slot, 8> slots;
+  for (unsigned c : order) {
+    auto it = find_if(slots, [&](const Slot &slot) {
+      return !overlap(slot.ranges, ranges[c]);
+    });
+    if (it == slots.end()) {
+      slots.emplace_back();
+      it = std::prev(slots.end());
+    }
+    it->allocas.push_back(candidates[c]);
+    it->ranges.append(ranges[c].begin(), ranges[c].end());
+  }
+
+  SmallPtrSet<const AllocaInst *, 8> merged;
+  for (const Slot &slot : slots) {
+    if (slot.allocas.size() > 1) {
+      merged.insert(slot.allocas.begin(), slot.allocas.end());
+    }
+  }
+  if (merged.empty()) {
+    return false;
+  }
+
+  for (IntrinsicInst *II : markers) {
+    bool isStart;
+    if (merged.count(getMarkedAlloca(*II, isStart))) {
+      auto *ptr = dyn_cast<Instruction>(II->getArgOperand(1));
+      II->eraseFromParent();
+      if (ptr && !isa<AllocaInst>(ptr) && ptr->use_empty()) {
+        ptr->eraseFromParent();
+      }
+    }
+  }
+
+  uint64_t bytesSaved = 0;
+  unsigned numMerged = 0;
+  for (const Slot &slot : slots) {
+    AllocaInst *storage = slot.allocas.front();
+    unsigned align = 0;
+    for (AllocaInst *AI : slot.allocas) {
+      align = std::max({align, AI->getAlignment(),
+                        DL.getABITypeAlignment(AI->getAllocatedType())});
+    }
+    for (AllocaInst *AI : drop_begin(slot.allocas, 1)) {
+      auto *alias = new BitCastInst(storage, AI->getType(), "",
+                                    storage->getNextNode());
+      alias->takeName(AI);
+      AI->replaceAllUsesWith(alias);
+      bytesSaved += getAllocaSize(*AI, DL);
+      AI->eraseFromParent();
+      ++numMerged;
+    }
+    if (slot.allocas.size() > 1) {
+      storage->setAlignment(align);
+    }
+  }
+  NumMergedAllocas += numMerged;
+  NumBytesSaved += bytesSaved;
+
+  auto &ORE = getAnalysis<OptimizationRemarkEmitterWrapperPass>().getORE();
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "MergedAllocas", F.getSubprogram(),
+                              &F.getEntryBlock())
+           << "merged " << ore::NV("NumMerged", numMerged)
+           << " private arrays of " << ore::NV("Function", &F)
+           << " into others, which now takes "
+           << ore::NV("PrivateBytes", privateBytes - bytesSaved)
+           << " bytes of private memory, down from "
+           << ore::NV("OriginalPrivateBytes", privateBytes);
+  });
+  return true;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVStackColoring, DEBUG_TYPE,
+                      "SPIRV merge allocas with disjoint lifetimes", false,
+                      false)
+INITIALIZE_PASS_DEPENDENCY(TargetPassConfig)
+INITIALIZE_PASS_DEPENDENCY(OptimizationRemarkEmitterWrapperPass)
+INITIALIZE_PASS_END(SPIRVStackColoring, DEBUG_TYPE,
+                    "SPIRV merge allocas with disjoint lifetimes", false,
+                    false)
+
+char SPIRVStackColoring::ID = 0;
+
+FunctionPass *llvm::createSPIRVStackColoringPass() {
+  return new SPIRVStackColoring();
+}
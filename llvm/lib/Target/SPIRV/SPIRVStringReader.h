@@ -17,31 +17,36 @@
 #ifndef LLVM_LIB_TARGET_SPIRV_SPIRVSTRINGREADER_H
 #define LLVM_LIB_TARGET_SPIRV_SPIRVSTRINGREADER_H
 
+#include <cstdint>
 #include <string>
 
-// Return a string representation of the operands from startIndex onwards.
+// Call fn on each character of the string in the operands from startIndex
+// onwards, and return the number of operands the string takes.
 // Templated to allow both MachineInstr and MCInst to use the same logic.
-template <class InstType>
-std::string getSPIRVStringOperand(const InstType &MI, unsigned int startIndex) {
-  std::string s = ""; // Iteratively append to this string
-
+template <class InstType, class CharFn>
+unsigned forEachSPIRVStringChar(const InstType &MI, unsigned int startIndex,
+                                CharFn fn) {
   const unsigned int numOps = MI.getNumOperands();
-  bool isFinished = false;
-  for (unsigned int i = startIndex; i < numOps && !isFinished; ++i) {
+  for (unsigned int i = startIndex; i < numOps; ++i) {
     const auto &Op = MI.getOperand(i);
     if (!Op.isImm()) // Stop if we hit a register operand
-      break;
+      return i - startIndex;
     uint32_t imm = Op.getImm(); // Each i32 word is up to 4 characters
     for (unsigned shiftAmount = 0; shiftAmount < 32; shiftAmount += 8) {
       char c = (imm >> shiftAmount) & 0xff;
-      if (c == 0) { // Stop if we hit a null-terminator character
-        isFinished = true;
-        break;
-      } else {
-        s += c; // Otherwise, append the character to the result string
-      }
+      if (c == 0) // Stop if we hit a null-terminator character
+        return i - startIndex + 1;
+      fn(c);
     }
   }
+  return numOps - startIndex;
+}
+
+// Return a string representation of the operands from startIndex onwards.
+template <class InstType>
+std::string getSPIRVStringOperand(const InstType &MI, unsigned int startIndex) {
+  std::string s;
+  forEachSPIRVStringChar(MI, startIndex, [&s](char c) { s += c; });
   return s;
 }
 
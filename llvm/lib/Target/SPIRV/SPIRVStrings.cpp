@@ -6,9 +6,9 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// The methods here are used to add these string literals as a series of 32-bit
-// integer operands with the correct format, and unpack them if necessary when
-// making string comparisons in compiler passes.
+// The methods here are used to add string literals to machine instructions as
+// a single external symbol operand, and to pack them into 32-bit words with the
+// correct format when they are finally encoded.
 //
 // SPIR-V requires null-terminated UTF-8 strings padded to 32-bit alignment.
 //
@@ -16,41 +16,60 @@
 
 #include "SPIRVStrings.h"
 #include "SPIRV.h"
-#include "SPIRVStringReader.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/Support/CommandLine.h"
 
 using namespace llvm;
 
-// Add the given string as a series of integer operands, inserting null
-// terminators and padding to make sure the operands all have 32-bit
-// little-endian words
-void addStringImm(const StringRef &str, MachineInstrBuilder &MIB) {
-  // Get length including padding and null terminator
-  const size_t len = str.size() + 1;
-  const size_t paddedLen = (len % 4 == 0) ? len : len + (4 - (len % 4));
-  for (unsigned i = 0; i < paddedLen; i += 4) {
-    uint32_t word = 0u; // Build up this 32-bit word from 4 8-bit chars
-    for (unsigned wordIndex = 0; wordIndex < 4; ++wordIndex) {
-      unsigned strIndex = i + wordIndex;
-      uint8_t charToAdd = 0; // Initilize char as padding/null
-      if (strIndex < (len - 1)) { // If it's within the string, get a real char
-        charToAdd = str[strIndex];
-      }
-      word |= (charToAdd << (wordIndex * 8));
+static cl::opt<bool> StripNames(
+    "spirv-strip-names", cl::Hidden, cl::init(false),
+    cl::desc("Only emit OpName instructions for entry points and functions "
+             "with linkage, skipping names of blocks, values and types"));
+
+// Get the number of 32-bit words needed for the string's chars, null
+// terminator and padding
+unsigned getStringWordCount(const StringRef &str) {
+  return str.size() / 4 + 1;
+}
+
+// Get the 32-bit little-endian word of chars or padding at the given index
+uint32_t getStringWord(const StringRef &str, unsigned wordIndex) {
+  uint32_t word = 0u; // Build up this 32-bit word from 4 8-bit chars
+  for (unsigned charIndex = 0; charIndex < 4; ++charIndex) {
+    unsigned strIndex = wordIndex * 4 + charIndex;
+    uint8_t charToAdd = 0; // Initilize char as padding/null
+    if (strIndex < str.size()) { // If it's within the string, get a real char
+      charToAdd = str[strIndex];
     }
-    MIB.addImm(word); // Add an operand for the 32-bits of chars or padding
+    word |= (charToAdd << (charIndex * 8));
   }
+  return word;
+}
+
+// Add the given string as a single external symbol operand. The name must be
+// copied into the function's storage, as the given StringRef may not outlive
+// the instruction.
+void addStringImm(const StringRef &str, MachineInstrBuilder &MIB) {
+  MachineFunction &MF = *MIB->getMF();
+  MIB.addExternalSymbol(MF.createExternalSymbolName(str));
+}
+
+bool isStringOperand(const MachineOperand &op) { return op.isSymbol(); }
+
+StringRef getStringImm(const MachineInstr &MI, unsigned int index) {
+  const MachineOperand &op = MI.getOperand(index);
+  assert(isStringOperand(op) && "Expected a string operand");
+  return op.getSymbolName();
 }
 
-// Read the series of integer operands back as a null-terminated string using
-// the reverse of the logic in addStringImm
-std::string getStringImm(const MachineInstr &MI, unsigned int startIndex) {
-  return getSPIRVStringOperand(MI, startIndex);
+unsigned getOperandWordCount(const MachineOperand &op) {
+  return isStringOperand(op) ? getStringWordCount(op.getSymbolName()) : 1;
 }
 
 // Add an OpName instruction for the given target register
 void buildOpName(Register target, const StringRef &name,
-                 MachineIRBuilder &MIRBuilder) {
-  if (!name.empty()) {
+                 MachineIRBuilder &MIRBuilder, bool isEntryPointOrLinkage) {
+  if (!name.empty() && (isEntryPointOrLinkage || !StripNames)) {
     auto MIB = MIRBuilder.buildInstr(SPIRV::OpName).addUse(target);
     addStringImm(name, MIB);
   }
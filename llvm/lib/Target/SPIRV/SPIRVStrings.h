@@ -6,9 +6,11 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// The methods here are used to add these string literals as a series of 32-bit
-// integer operands with the correct format, and unpack them if necessary when
-// making string comparisons in compiler passes.
+// The methods here are used to add string literals to machine instructions as
+// a single external symbol operand, with the name owned by the function. The
+// string is only packed into 32-bit integer words when the instruction is
+// lowered to an MCInst or encoded, so passes can compare and copy strings with
+// a single operand instead of unpacking them word by word.
 //
 // SPIR-V requires null-terminated UTF-8 strings padded to 32-bit alignment.
 //
@@ -20,19 +22,32 @@
 #include "llvm/ADT/StringRef.h"
 #include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
-#include <string>
 
-// Add the given string as a series of integer operand, inserting null
-// terminators and padding to make sure the operands all have 32-bit
-// little-endian words
+// Add the given string as a single string operand, copying it into storage
+// owned by the instruction's function. MIB's instruction must be inserted.
 void addStringImm(const llvm::StringRef &str, llvm::MachineInstrBuilder &MIB);
 
-// Read the series of integer operands back as a null-terminated string using
-// the reverse of the logic in addStringImm
-std::string getStringImm(const llvm::MachineInstr &MI, unsigned int startIndex);
+// Get the number of 32-bit words the string uses once encoded, including the
+// null terminator and padding
+unsigned getStringWordCount(const llvm::StringRef &str);
 
-// Add an OpName instruction for the given target register
+// Get the given 32-bit little-endian word of the encoded string
+uint32_t getStringWord(const llvm::StringRef &str, unsigned wordIndex);
+
+// Check if the operand is a string operand added by addStringImm
+bool isStringOperand(const llvm::MachineOperand &op);
+
+// Get the string held by the string operand at the given index
+llvm::StringRef getStringImm(const llvm::MachineInstr &MI, unsigned int index);
+
+// Get the number of 32-bit words the operand uses once encoded
+unsigned getOperandWordCount(const llvm::MachineOperand &op);
+
+// Add an OpName instruction for the given target register. When names are
+// stripped (-spirv-strip-names), only the names of entry points and functions
+// with linkage are kept, which must be flagged with isEntryPointOrLinkage.
 void buildOpName(llvm::Register target, const llvm::StringRef &name,
-                 llvm::MachineIRBuilder &MIRBuilder);
+                 llvm::MachineIRBuilder &MIRBuilder,
+                 bool isEntryPointOrLinkage = false);
 
 #endif
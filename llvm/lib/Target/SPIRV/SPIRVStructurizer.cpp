@@ -0,0 +1,342 @@
+//===-- SPIRVStructurizer.cpp - Emit SPIR-V merge instructions --*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Emit OpLoopMerge and OpSelectionMerge instructions declaring the structured
+// control flow constructs of each function.
+//
+// For targets requiring structured control flow (Vulkan and logical
+// addressing), the IR CFG has already been structurized by StructurizeCFG
+// before instruction selection (see SPIRVPassConfig::addISelPrepare), so every
+// loop and conditional branch here is given a merge instruction. Kernels don't
+// require structured control flow, so only loops with llvm.loop hints (e.g.
+// from #pragma unroll) get an OpLoopMerge carrying the matching LoopControl
+// operands, so the driver compiler can act on them. With
+// SPV_INTEL_unstructured_loop_controls they get an OpLoopControlINTEL instead,
+// which needs no merge block, so loops with several exits keep their hints too.
+// The FPGA hints (initiation interval, max concurrency, coalescing, etc.) map
+// to the SPV_INTEL_fpga_loop_controls bits.
+//
+// Each merge instruction must immediately precede its header's branch:
+// - OpLoopMerge names the loop's single dedicated exit block as the merge block
+//   and its single latch as the continue target.
+// - OpSelectionMerge names the immediate post-dominator of the header as the
+//   merge block. Conditional branches which break out of, or continue, their
+//   innermost loop don't start a selection construct, so need no merge.
+// A block can only be the merge block of a single header. Constructs which
+// can't satisfy these rules are left without a merge instruction, and counted
+// in the statistics.
+//
+// All the analyses used are (almost) linear in the size of the function, and
+// blocks are never moved, so the dominance order of SPIRVBasicBlockDominance is
+// preserved.
+//
+// The merge and continue operands are MBB references, which are replaced with
+// label IDs by SPIRVBlockLabeler, so this pass must run before it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVEnumRequirements.h"
+#include "SPIRVSubtarget.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/CodeGen/MachineDominators.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachinePostDominators.h"
+#include "llvm/CodeGen/TargetInstrInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/PassSupport.h"
+#include "llvm/Support/Debug.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-structurizer"
+
+STATISTIC(NumLoopMerges, "Number of OpLoopMerges added");
+STATISTIC(NumSelectionMerges, "Number of OpSelectionMerges added");
+STATISTIC(NumLoopControls, "Number of OpLoopControlINTELs added");
+STATISTIC(NumUnstructurableLoops,
+          "Number of loops which couldn't be given an OpLoopMerge");
+STATISTIC(NumUnstructurableSelections,
+          "Number of conditional branches which couldn't be given an "
+          "OpSelectionMerge");
+
+namespace {
+class SPIRVStructurizer : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVStructurizer() : MachineFunctionPass(ID) {
+    initializeSPIRVStructurizerPass(*PassRegistry::getPassRegistry());
+  }
+  // Add OpLoopMerge and OpSelectionMerge instructions to construct headers
+  bool runOnMachineFunction(MachineFunction &MF) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    AU.addRequired<MachineDominatorTree>();
+    AU.addRequired<MachinePostDominatorTree>();
+    AU.addRequired<MachineLoopInfo>();
+    AU.addPreserved<MachineDominatorTree>();
+    AU.addPreserved<MachinePostDominatorTree>();
+    AU.addPreserved<MachineLoopInfo>();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+private:
+  // Blocks already used as the merge block of a construct
+  SmallPtrSet<const MachineBasicBlock *, 16> mergeBlocks;
+
+  bool addLoopMerge(MachineLoop *ML, bool structured,
+                    const SPIRVSubtarget &ST);
+  bool addSelectionMerge(MachineBasicBlock &MBB, MachineLoopInfo &MLI,
+                         MachineDominatorTree &MDT,
+                         MachinePostDominatorTree &MPDT,
+                         const SPIRVSubtarget &ST);
+};
+} // namespace
+
+// Get the llvm.loop metadata attached to the IR terminator of the latch
+static MDNode *getLoopID(const MachineBasicBlock &latch) {
+  const BasicBlock *BB = latch.getBasicBlock();
+  if (!BB || !BB->getTerminator()) {
+    return nullptr;
+  }
+  return BB->getTerminator()->getMetadata(LLVMContext::MD_loop);
+}
+
+static bool hasLoopOption(MDNode *loopID, StringRef name) {
+  return findOptionMDForLoopID(loopID, name) != nullptr;
+}
+
+// Get the integer value of an llvm.loop option such as llvm.loop.unroll.count,
+// or 0 if it's missing.
+static uint64_t getLoopOptionValue(MDNode *loopID, StringRef name) {
+  MDNode *option = findOptionMDForLoopID(loopID, name);
+  if (!option || option->getNumOperands() < 2) {
+    return 0;
+  }
+  auto *val = mdconst::dyn_extract<ConstantInt>(option->getOperand(1));
+  return val ? val->getZExtValue() : 0;
+}
+
+// Compute the LoopControl mask and its literal parameters (in mask bit order)
+// for the given llvm.loop metadata, dropping any unsupported by the subtarget.
+static uint32_t getLoopControl(MDNode *loopID, const SPIRVSubtarget &ST,
+                               SmallVectorImpl<uint32_t> &params) {
+  using namespace LoopControl;
+  uint32_t lc = LoopControl::None;
+  if (!loopID) {
+    return lc;
+  }
+  uint32_t dependencyLength = 0;
+  uint32_t partialCount = 0;
+
+  uint64_t unrollCount = getLoopOptionValue(loopID, "llvm.loop.unroll.count");
+  if (hasLoopOption(loopID, "llvm.loop.unroll.disable") || unrollCount == 1) {
+    lc |= DontUnroll;
+  } else if (hasLoopOption(loopID, "llvm.loop.unroll.enable") ||
+             hasLoopOption(loopID, "llvm.loop.unroll.full")) {
+    lc |= Unroll;
+  } else if (unrollCount > 1) {
+    lc |= Unroll;
+    if (canUseLoopControl(PartialCount, ST)) {
+      lc |= PartialCount;
+      partialCount = unrollCount;
+    }
+  }
+
+  // Loops marked as parallel (e.g. #pragma clang loop vectorize(assume_safety))
+  // carry no loop-carried dependencies. A safe length only bounds the distance
+  // of any dependency.
+  if (hasLoopOption(loopID, "llvm.loop.parallel_accesses") ||
+      hasLoopOption(loopID, "llvm.loop.ivdep.enable")) {
+    if (canUseLoopControl(DependencyInfinite, ST)) {
+      lc |= DependencyInfinite;
+    }
+  } else if (uint64_t len =
+                 getLoopOptionValue(loopID, "llvm.loop.ivdep.safelen")) {
+    if (canUseLoopControl(DependencyLength, ST)) {
+      lc |= DependencyLength;
+      dependencyLength = len;
+    }
+  }
+
+  if (lc & DependencyLength) {
+    params.push_back(dependencyLength);
+  }
+  if (lc & PartialCount) {
+    params.push_back(partialCount);
+  }
+
+  // The FPGA hints, each with its single parameter, in mask bit order
+  static const struct {
+    const char *name;
+    LoopControl::LoopControl bit;
+  } fpgaHints[] = {
+      {"llvm.loop.ii.count", InitiationIntervalINTEL},
+      {"llvm.loop.max_concurrency.count", MaxConcurrencyINTEL},
+      {"llvm.loop.intel.pipelining.enable", PipelineEnableINTEL},
+      {"llvm.loop.coalesce.count", LoopCoalesceINTEL},
+      {"llvm.loop.coalesce.enable", LoopCoalesceINTEL},
+      {"llvm.loop.max_interleaving.count", MaxInterleavingINTEL},
+      {"llvm.loop.intel.speculated.iterations.count",
+       SpeculatedIterationsINTEL},
+  };
+  for (const auto &hint : fpgaHints) {
+    if ((lc & hint.bit) || !hasLoopOption(loopID, hint.name) ||
+        !canUseLoopControl(hint.bit, ST)) {
+      continue;
+    }
+    lc |= hint.bit;
+    // A coalesce without a count lets the compiler pick the depth
+    params.push_back(getLoopOptionValue(loopID, hint.name));
+  }
+  if (hasLoopOption(loopID, "llvm.loop.fusion.disable") &&
+      canUseLoopControl(NoFusionINTEL, ST)) {
+    lc |= NoFusionINTEL;
+  }
+  return lc;
+}
+
+// Add an OpLoopMerge, or an OpLoopControlINTEL, to the loop header, if the loop
+// needs one. Return true if the loop was given one.
+bool SPIRVStructurizer::addLoopMerge(MachineLoop *ML, bool structured,
+                                     const SPIRVSubtarget &ST) {
+  MachineBasicBlock *latch = ML->getLoopLatch();
+  SmallVector<uint32_t, 2> params;
+  uint32_t lc = getLoopControl(latch ? getLoopID(*latch) : nullptr, ST, params);
+  if (!structured && lc == LoopControl::None) {
+    return false;
+  }
+
+  MachineBasicBlock *header = ML->getHeader();
+  const auto *TII = ST.getInstrInfo();
+  if (!structured && ST.canUseCapability(
+                         Capability::UnstructuredLoopControlsINTEL)) {
+    auto MIB = BuildMI(*header, header->getFirstTerminator(), DebugLoc(),
+                       TII->get(SPIRV::OpLoopControlINTEL))
+                   .addImm(lc);
+    for (auto param : params) {
+      MIB.addImm(param);
+    }
+    ++NumLoopControls;
+    return true;
+  }
+
+  MachineBasicBlock *merge = ML->getExitBlock();
+  if (!latch || !merge || !ML->hasDedicatedExits() ||
+      !mergeBlocks.insert(merge).second) {
+    LLVM_DEBUG(dbgs() << "Can't add OpLoopMerge to loop at "
+                      << printMBBReference(*header) << "\n");
+    ++NumUnstructurableLoops;
+    return false;
+  }
+
+  // Insert right before the header's branch. If the header falls through,
+  // SPIRVBlockLabeler will add the OpBranch after the OpLoopMerge.
+  auto MIB = BuildMI(*header, header->getFirstTerminator(), DebugLoc(),
+                     TII->get(SPIRV::OpLoopMerge))
+                 .addMBB(merge)
+                 .addMBB(latch)
+                 .addImm(lc);
+  for (auto param : params) {
+    MIB.addImm(param);
+  }
+  ++NumLoopMerges;
+  return true;
+}
+
+// Add an OpSelectionMerge before the block's conditional branch, if it starts
+// a selection construct. Return true if a merge instruction was added.
+bool SPIRVStructurizer::addSelectionMerge(MachineBasicBlock &MBB,
+                                          MachineLoopInfo &MLI,
+                                          MachineDominatorTree &MDT,
+                                          MachinePostDominatorTree &MPDT,
+                                          const SPIRVSubtarget &ST) {
+  auto term = MBB.getFirstTerminator();
+  if (term == MBB.end() || term->getOpcode() != SPIRV::OpBranchConditional ||
+      MBB.succ_size() < 2) {
+    return false;
+  }
+
+  // Loop headers already have an OpLoopMerge, and branches to the innermost
+  // loop's header or exit are continues or breaks.
+  if (MachineLoop *ML = MLI.getLoopFor(&MBB)) {
+    if (ML->getHeader() == &MBB) {
+      return false;
+    }
+    MachineBasicBlock *loopMerge = ML->getExitBlock();
+    for (auto succ : MBB.successors()) {
+      if (succ == ML->getHeader() || succ == loopMerge) {
+        return false;
+      }
+    }
+  }
+
+  auto node = MPDT.getNode(&MBB);
+  MachineBasicBlock *merge =
+      node && node->getIDom() ? node->getIDom()->getBlock() : nullptr;
+  MachineLoop *ML = MLI.getLoopFor(&MBB);
+  if (!merge || !MDT.properlyDominates(&MBB, merge) ||
+      (ML && !ML->contains(merge)) || !mergeBlocks.insert(merge).second) {
+    LLVM_DEBUG(dbgs() << "Can't add OpSelectionMerge to "
+                      << printMBBReference(MBB) << "\n");
+    ++NumUnstructurableSelections;
+    return false;
+  }
+
+  const auto *TII = ST.getInstrInfo();
+  BuildMI(MBB, term, DebugLoc(), TII->get(SPIRV::OpSelectionMerge))
+      .addMBB(merge)
+      .addImm(SelectionControl::None);
+  ++NumSelectionMerges;
+  return true;
+}
+
+bool SPIRVStructurizer::runOnMachineFunction(MachineFunction &MF) {
+  const auto &ST = MF.getSubtarget<SPIRVSubtarget>();
+  const bool structured = MF.getTarget().requiresStructuredCFG();
+  auto &MLI = getAnalysis<MachineLoopInfo>();
+  mergeBlocks.clear();
+  bool changed = false;
+
+  // Loops first, so their merge blocks take priority over selections
+  SmallVector<MachineLoop *, 8> worklist(MLI.begin(), MLI.end());
+  while (!worklist.empty()) {
+    MachineLoop *ML = worklist.pop_back_val();
+    worklist.append(ML->begin(), ML->end());
+    changed |= addLoopMerge(ML, structured, ST);
+  }
+
+  if (structured) {
+    auto &MDT = getAnalysis<MachineDominatorTree>();
+    auto &MPDT = getAnalysis<MachinePostDominatorTree>();
+    for (MachineBasicBlock &MBB : MF) {
+      changed |= addSelectionMerge(MBB, MLI, MDT, MPDT, ST);
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS_BEGIN(SPIRVStructurizer, DEBUG_TYPE,
+                      "SPIRV structured control flow", false, false)
+INITIALIZE_PASS_DEPENDENCY(MachineDominatorTree)
+INITIALIZE_PASS_DEPENDENCY(MachinePostDominatorTree)
+INITIALIZE_PASS_DEPENDENCY(MachineLoopInfo)
+INITIALIZE_PASS_END(SPIRVStructurizer, DEBUG_TYPE,
+                    "SPIRV structured control flow", false, false)
+
+char SPIRVStructurizer::ID = 0;
+
+FunctionPass *llvm::createSPIRVStructurizerPass() {
+  return new SPIRVStructurizer();
+}
@@ -16,13 +16,33 @@
 #include "SPIRVLegalizerInfo.h"
 #include "SPIRVTargetMachine.h"
 #include "SPIRVTypeRegistry.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Mutex.h"
 #include "llvm/Support/TargetRegistry.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "spirv-subtarget"
 
+static cl::opt<unsigned> IfConversionThreshold(
+    "spirv-if-conversion-threshold", cl::Hidden,
+    cl::desc("The number of instructions if/else diamonds can speculate to be "
+             "converted to OpSelect, rather than the subtarget's default"));
+
+static cl::opt<bool> ExpandDivByConstant(
+    "spirv-expand-div-by-constant", cl::Hidden,
+    cl::desc("Expand integer divisions by constants into multiplies and "
+             "shifts, rather than the subtarget's default"));
+
+static cl::opt<unsigned> MaxVectorElements(
+    "spirv-max-vector-elements", cl::Hidden,
+    cl::desc("Split the vector arithmetic and conversions into vectors of at "
+             "most this many components, or scalarize them for 1, rather "
+             "than keeping the widest vectors the subtarget allows"));
+
 #define GET_SUBTARGETINFO_TARGET_DESC
 #define GET_SUBTARGETINFO_CTOR
 #include "SPIRVGenSubtargetInfo.inc"
@@ -42,8 +62,12 @@ static unsigned computePointerSize(const Triple &TT) {
   return arch == Triple::spirv32 ? 32 : arch == Triple::spirv64 ? 64 : 8;
 }
 
-// TODO use command line args for this rather than defaulting to 1.4
-static uint32_t computeTargetSPIRVVersion(const Triple &TT) {
+// Use the version given by the +spirv1.x features, or default to 1.4
+static uint32_t computeTargetSPIRVVersion(const Triple &TT,
+                                          uint32_t requestedVersion) {
+  if (requestedVersion != 0) {
+    return requestedVersion;
+  }
   return v(1, 4); // TODO - remove this as it's just here for the ptrcmp.ll test
   // if (TT.isVulkanEnvironment()) {
   //   return v(1, 0);
@@ -85,22 +109,61 @@ SPIRVSubtarget::SPIRVSubtarget(const Triple &TT, const std::string &CPU,
       usesLogicalAddressing(TT.isSPIRVLogical()),
       usesVulkanEnv(TT.isVulkanEnvironment()),
       usesOpenCLEnv(TT.isOpenCLEnvironment()),
-      targetSPIRVVersion(computeTargetSPIRVVersion(TT)),
+      targetSPIRVVersion(
+          computeTargetSPIRVVersion(TT, requestedSPIRVVersion)),
       targetOpenCLVersion(computeTargetOpenCLVersion(TT)),
       targetVulkanVersion(computeTargetVulkanVersion(TT)),
       openCLFullProfile(computeOpenCLFullProfile(TT)),
       openCLImageSupport(computeOpenCLImageSupport(TT)),
-      TR(new SPIRVTypeRegistry(pointerSize)),
+      TR(new SPIRVTypeRegistry(pointerSize, !isKernel())),
       CallLoweringInfo(new SPIRVCallLowering(TLInfo, TR.get())),
       RegBankInfo(new SPIRVRegisterBankInfo()) {
 
+  initSharedComponents(TT, CPU, FS);
+  InstSelector.reset(
+      createSPIRVInstructionSelector(TM, *this, *RegBankInfo.get()));
+}
+
+namespace {
+// The parts of a subtarget which only depend on its triple, CPU and features.
+struct SharedSubtargetComponents {
+  ExtensionSet availableExtensions;
+  std::bitset<NumExtInstSets> availableExtInstSets;
+  CapabilitySet availableCaps;
+  std::shared_ptr<const LegalizerInfo> Legalizer;
+};
+} // namespace
+
+// Runtimes create a target machine for each program they build, so keep the
+// components of every configuration seen so far rather than rebuilding the
+// legalizer tables each time.
+static ManagedStatic<StringMap<SharedSubtargetComponents>> SharedComponents;
+static ManagedStatic<sys::Mutex> SharedComponentsMutex;
+
+void SPIRVSubtarget::initSharedComponents(const Triple &TT, StringRef CPU,
+                                          StringRef FS) {
+  std::string key = (TT.str() + "|" + CPU + "|" + FS).str();
+  sys::ScopedLock lock(*SharedComponentsMutex);
+  auto found = SharedComponents->find(key);
+  if (found != SharedComponents->end()) {
+    const SharedSubtargetComponents &shared = found->second;
+    availableExtensions = shared.availableExtensions;
+    availableExtInstSets = shared.availableExtInstSets;
+    availableCaps = shared.availableCaps;
+    Legalizer = shared.Legalizer;
+    return;
+  }
+
   initAvailableExtensions(TT);
   initAvailableExtInstSets(TT);
   initAvailableCapabilities(TT);
+  Legalizer = std::make_shared<SPIRVLegalizerInfo>(*this);
 
-  Legalizer.reset(new SPIRVLegalizerInfo(*this));
-  InstSelector.reset(
-      createSPIRVInstructionSelector(TM, *this, *RegBankInfo.get()));
+  SharedSubtargetComponents &shared = (*SharedComponents)[key];
+  shared.availableExtensions = availableExtensions;
+  shared.availableExtInstSets = availableExtInstSets;
+  shared.availableCaps = availableCaps;
+  shared.Legalizer = Legalizer;
 }
 
 SPIRVSubtarget &SPIRVSubtarget::initSubtargetDependencies(StringRef CPU,
@@ -110,18 +173,15 @@ SPIRVSubtarget &SPIRVSubtarget::initSubtargetDependencies(StringRef CPU,
 }
 
 bool SPIRVSubtarget::canUseCapability(Capability::Capability c) const {
-  const auto &caps = availableCaps;
-  return std::find(caps.begin(), caps.end(), c) != caps.end();
+  return availableCaps[getCapabilityIndex(c)];
 }
 
 bool SPIRVSubtarget::canUseExtension(Extension::Extension e) const {
-  const auto &exts = availableExtensions;
-  return std::find(exts.begin(), exts.end(), e) != exts.end();
+  return availableExtensions[getExtensionIndex(e)];
 }
 
 bool SPIRVSubtarget::canUseExtInstSet(ExtInstSet e) const {
-  const auto &sets = availableExtInstSets;
-  return std::find(sets.begin(), sets.end(), e) != sets.end();
+  return availableExtInstSets[static_cast<unsigned>(e)];
 }
 
 bool SPIRVSubtarget::isLogicalAddressing() const {
@@ -136,41 +196,143 @@ bool SPIRVSubtarget::isShader() const {
   return usesVulkanEnv || usesLogicalAddressing;
 }
 
+bool SPIRVSubtarget::usesVulkanMemoryModel() const {
+  return !isKernel() && canUseCapability(Capability::VulkanMemoryModelKHR);
+}
+
+MemoryModel::MemoryModel SPIRVSubtarget::getMemoryModel() const {
+  if (usesVulkanMemoryModel()) {
+    return MemoryModel::VulkanKHR;
+  }
+  return isKernel() ? MemoryModel::OpenCL : MemoryModel::GLSL450;
+}
+
+unsigned SPIRVSubtarget::getMemSemanticsForMemoryModel(unsigned memSem) const {
+  using namespace MemorySemantics;
+  if (!usesVulkanMemoryModel()) {
+    return memSem;
+  }
+  const unsigned storageMask = UniformMemory | SubgroupMemory |
+                               WorkgroupMemory | CrossWorkgroupMemory |
+                               AtomicCounterMemory | ImageMemory |
+                               OutputMemoryKHR;
+  if (memSem & SequentiallyConsistent) {
+    memSem = (memSem & ~SequentiallyConsistent) | AcquireRelease;
+  }
+  if (memSem & (Acquire | Release | AcquireRelease)) {
+    // Fences order all the memory shaders can share
+    if (!(memSem & storageMask)) {
+      memSem |= UniformMemory | WorkgroupMemory | ImageMemory;
+    }
+    if (memSem & (Release | AcquireRelease)) {
+      memSem |= MakeAvailableKHR;
+    }
+    if (memSem & (Acquire | AcquireRelease)) {
+      memSem |= MakeVisibleKHR;
+    }
+  }
+  return memSem;
+}
+
+// Shaders need a selection construct with its own merge block for each branch
+// they keep, so speculating is worth more instructions than in kernels.
+unsigned SPIRVSubtarget::getIfConversionThreshold() const {
+  if (IfConversionThreshold.getNumOccurrences()) {
+    return IfConversionThreshold;
+  }
+  return isShader() ? 8 : 4;
+}
+
+// Drivers can't be relied on to strength-reduce divisions by constants,
+// which are slow on GPUs. The expansion needs a multiply-high, which the
+// Kernel environment has as OpenCL.std's mul_hi, and shaders as the high half
+// of OpUMulExtended and OpSMulExtended.
+bool SPIRVSubtarget::expandsDivByConstant() const {
+  if (ExpandDivByConstant.getNumOccurrences()) {
+    return ExpandDivByConstant;
+  }
+  return true;
+}
+
+// Vectors with over 4 components need the Vector16 capability. Drivers for
+// CPUs and FPGAs prefer native vectors, so they're kept by default, but those
+// for scalar SIMT GPUs may do better with narrower vectors or scalars.
+unsigned SPIRVSubtarget::getMaxVectorElements() const {
+  const unsigned nativeElems = canUseCapability(Capability::Vector16) ? 16 : 4;
+  if (MaxVectorElements.getNumOccurrences()) {
+    return std::max(1u, std::min<unsigned>(MaxVectorElements, nativeElems));
+  }
+  return nativeElems;
+}
+
 // If the SPIR-V version is >= 1.4 we can call OpPtrEqual and OpPtrNotEqual
 bool SPIRVSubtarget::canDirectlyComparePointers() const {
   return isAtLeastVer(targetSPIRVVersion, v(1, 4));
 }
 
-// TODO use command line args for this rather than defaults
+// If the SPIR-V version is >= 1.4, OpCopyMemory and OpCopyMemorySized can have
+// a second memory operand for their source
+bool SPIRVSubtarget::canUseSourceMemoryOperands() const {
+  return isAtLeastVer(targetSPIRVVersion, v(1, 4));
+}
+
+// Enable the extensions given by the +ext-* features, and the defaults.
 void SPIRVSubtarget::initAvailableExtensions(const Triple &TT) {
   using namespace Extension;
-  if (TT.isVulkanEnvironment()) {
-    availableExtensions = {};
-  } else {
+  availableExtensions = requestedExtensions;
+  if (!TT.isVulkanEnvironment()) {
     // A default extension for testing - should use command line args
-    availableExtensions = {SPV_KHR_no_integer_wrap_decoration};
+    availableExtensions.set(
+        getExtensionIndex(SPV_KHR_no_integer_wrap_decoration));
   }
 }
 
-// Add the given capabilities and all their implicitly defined capabilities too
-static void addCaps(std::unordered_set<Capability::Capability> &caps,
+// Add the given capabilities and all their implicitly defined capabilities too,
+// using the precomputed closure of each one.
+static void addCaps(CapabilitySet &caps,
                     const std::vector<Capability::Capability> &toAdd) {
   for (const auto cap : toAdd) {
-    if (caps.insert(cap).second) {
-      addCaps(caps, getCapabilityCapabilities(cap));
-    }
+    caps.set(getCapabilityIndex(cap));
+    caps |= getImplicitCapabilities(cap);
   }
 }
 
-// TODO use command line args for this rather than defaults
-// Must have called initAvailableExtensions first.
+// Enable the capabilities given by the +cap-* features, and the minimum ones
+// of the environment. Must have called initAvailableExtensions first.
 void SPIRVSubtarget::initAvailableCapabilities(const Triple &TT) {
   using namespace Capability;
+  for (unsigned i = 0; i < CapabilityIndex::NumCaps; ++i) {
+    if (requestedCaps[i]) {
+      addCaps(availableCaps, {getCapabilityFromIndex(i)});
+    }
+  }
   if (TT.isVulkanEnvironment()) {
     // These are the min requirements
     addCaps(availableCaps,
             {Matrix, Shader, InputAttachment, Sampled1D, Image1D, SampledBuffer,
              ImageBuffer, ImageQuery, DerivativeControl});
+    if (isAtLeastVer(targetSPIRVVersion, v(1, 5)) ||
+        canUseExtension(Extension::SPV_KHR_vulkan_memory_model)) {
+      addCaps(availableCaps,
+              {VulkanMemoryModelKHR, VulkanMemoryModelDeviceScopeKHR});
+    }
+    // Vulkan 1.1 requires the basic non-uniform operations
+    if (isAtLeastVer(targetSPIRVVersion, v(1, 3))) {
+      addCaps(availableCaps, {GroupNonUniform});
+    }
+    if (canUseExtension(Extension::SPV_KHR_16bit_storage)) {
+      addCaps(availableCaps,
+              {StorageBuffer16BitAccess, StorageUniform16,
+               StoragePushConstant16, StorageInputOutput16});
+    }
+    if (canUseExtension(Extension::SPV_KHR_8bit_storage)) {
+      addCaps(availableCaps,
+              {StorageBuffer8BitAccess, UniformAndStorageBuffer8BitAccess,
+               StoragePushConstant8});
+    }
+    if (canUseExtension(Extension::SPV_NV_cooperative_matrix)) {
+      addCaps(availableCaps, {CooperativeMatrixNV});
+    }
   } else {
     // Add the min requirements for different OpenCL and SPIR-V versions
     addCaps(availableCaps,
@@ -185,6 +347,11 @@ void SPIRVSubtarget::initAvailableCapabilities(const Triple &TT) {
         addCaps(availableCaps, {ImageReadWrite});
       }
     }
+    // Work-group and sub-group collective functions need OpGroup* instrs, and
+    // pipes and device enqueue are core OpenCL 2.0 features
+    if (isAtLeastVer(targetOpenCLVersion, v(2, 0))) {
+      addCaps(availableCaps, {Groups, Pipes, DeviceEnqueue});
+    }
     if (isAtLeastVer(targetSPIRVVersion, v(1, 1)) &&
         isAtLeastVer(targetOpenCLVersion, v(2, 2))) {
       addCaps(availableCaps, {SubgroupDispatch, PipeStorage});
@@ -193,21 +360,58 @@ void SPIRVSubtarget::initAvailableCapabilities(const Triple &TT) {
     // TODO Remove this - it's only here because the tests assume it's supported
     addCaps(availableCaps, {Float16, Float64});
 
+    if (canUseExtension(Extension::SPV_EXT_shader_atomic_float_add)) {
+      addCaps(availableCaps, {AtomicFloat32AddEXT, AtomicFloat64AddEXT});
+    }
+    if (canUseExtension(Extension::SPV_EXT_shader_atomic_float_min_max)) {
+      addCaps(availableCaps, {AtomicFloat16MinMaxEXT, AtomicFloat32MinMaxEXT,
+                              AtomicFloat64MinMaxEXT});
+    }
+    if (canUseExtension(Extension::SPV_INTEL_subgroups)) {
+      addCaps(availableCaps, {SubgroupShuffleINTEL, SubgroupBufferBlockIOINTEL,
+                              SubgroupImageBlockIOINTEL});
+    }
+    if (canUseExtension(Extension::SPV_INTEL_media_block_io)) {
+      addCaps(availableCaps, {SubgroupImageMediaBlockIOINTEL});
+    }
+    if (canUseExtension(Extension::SPV_INTEL_unstructured_loop_controls)) {
+      addCaps(availableCaps, {UnstructuredLoopControlsINTEL});
+    }
+    if (canUseExtension(Extension::SPV_INTEL_fpga_loop_controls)) {
+      addCaps(availableCaps, {FPGALoopControlsINTEL});
+    }
+    if (canUseExtension(Extension::SPV_INTEL_fpga_memory_attributes)) {
+      addCaps(availableCaps, {FPGAMemoryAttributesINTEL});
+    }
+
     // TODO add OpenCL extensions
   }
+
+  if (canUseExtension(Extension::SPV_KHR_subgroup_vote)) {
+    addCaps(availableCaps, {SubgroupVoteKHR});
+  }
+  if (canUseExtension(Extension::SPV_KHR_shader_ballot)) {
+    addCaps(availableCaps, {SubgroupBallotKHR});
+  }
+  if (canUseExtension(Extension::SPV_KHR_integer_dot_product)) {
+    addCaps(availableCaps,
+            {DotProductInputAllKHR, DotProductInput4x8BitKHR,
+             DotProductInput4x8BitPackedKHR, DotProductKHR});
+  }
 }
 
 // TODO use command line args for this rather than just defaults
 // Must have called initAvailableExtensions first.
 void SPIRVSubtarget::initAvailableExtInstSets(const Triple &TT) {
   if (usesVulkanEnv) {
-    availableExtInstSets.insert(ExtInstSet::GLSL_std_450);
+    availableExtInstSets.set(static_cast<unsigned>(ExtInstSet::GLSL_std_450));
   } else {
-    availableExtInstSets.insert(ExtInstSet::OpenCL_std);
+    availableExtInstSets.set(static_cast<unsigned>(ExtInstSet::OpenCL_std));
   }
 
   // Handle extended instruction sets from extensions.
   if (canUseExtension(Extension::SPV_AMD_shader_trinary_minmax)) {
-    availableExtInstSets.insert(ExtInstSet::SPV_AMD_shader_trinary_minmax);
+    availableExtInstSets.set(
+        static_cast<unsigned>(ExtInstSet::SPV_AMD_shader_trinary_minmax));
   }
 }
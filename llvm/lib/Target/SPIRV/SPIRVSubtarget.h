@@ -26,12 +26,13 @@
 #include "llvm/Target/TargetMachine.h"
 
 #include "SPIRVCallLowering.h"
+#include "SPIRVCapabilityUtils.h"
 #include "SPIRVEnums.h"
 #include "SPIRVExtInsts.h"
 #include "SPIRVExtensions.h"
 #include "SPIRVRegisterBankInfo.h"
 
-#include <unordered_set>
+#include <bitset>
 
 #define GET_SUBTARGETINFO_HEADER
 #include "SPIRVGenSubtargetInfo.inc"
@@ -44,6 +45,13 @@ class SPIRVTypeRegistry;
 
 class SPIRVSubtarget : public SPIRVGenSubtargetInfo {
 private:
+  // The version, extensions and capabilities given by the +spirv1.x, +ext-*
+  // and +cap-* features in SPIRV.td. ParseSubtargetFeatures sets them while
+  // FrameLowering is initialised, so they must be declared before it.
+  uint32_t requestedSPIRVVersion = 0;
+  ExtensionSet requestedExtensions;
+  CapabilitySet requestedCaps;
+
   SPIRVInstrInfo InstrInfo;
   SPIRVFrameLowering FrameLowering;
   SPIRVTargetLowering TLInfo;
@@ -68,13 +76,17 @@ private:
   std::unique_ptr<SPIRVCallLowering> CallLoweringInfo;
   std::unique_ptr<SPIRVRegisterBankInfo> RegBankInfo;
 
-  std::unordered_set<Extension::Extension> availableExtensions;
-  std::unordered_set<ExtInstSet> availableExtInstSets;
-  std::unordered_set<Capability::Capability> availableCaps;
+  // Available capabilities include all the ones they implicitly declare, so
+  // all the canUseXXX queries are single bit tests.
+  ExtensionSet availableExtensions;
+  std::bitset<NumExtInstSets> availableExtInstSets;
+  CapabilitySet availableCaps;
 
   // The legalizer and instruction selector both rely on the set of available
-  // extensions, capabilities, register bank information, and so on.
-  std::unique_ptr<LegalizerInfo> Legalizer;
+  // extensions, capabilities, register bank information, and so on. The
+  // legalizer's rules only depend on the triple, CPU and features, so its
+  // tables are built once and shared by all the subtargets using the same ones.
+  std::shared_ptr<const LegalizerInfo> Legalizer;
   std::unique_ptr<InstructionSelector> InstSelector;
 
 private:
@@ -88,6 +100,10 @@ private:
   void initAvailableExtInstSets(const Triple &TT);
   void initAvailableCapabilities(const Triple &TT);
 
+  // Reuse the availability sets and legalizer of a previous subtarget with the
+  // same triple, CPU and features, or compute and record them for later ones.
+  void initSharedComponents(const Triple &TT, StringRef CPU, StringRef FS);
+
 protected:
   // DummyFeature defined in SPIRV.td. This is for illustration purpose only
   // and isn't used in practice.
@@ -108,11 +124,37 @@ public:
 
   unsigned int getPointerSize() const { return pointerSize; }
   bool canDirectlyComparePointers() const;
+  bool canUseSourceMemoryOperands() const;
 
   bool isLogicalAddressing() const;
   bool isKernel() const;
   bool isShader() const;
 
+  // Shaders use the Vulkan memory model if the VulkanMemoryModelKHR capability
+  // is available, and the GLSL450 one otherwise. Kernels use the OpenCL one.
+  MemoryModel::MemoryModel getMemoryModel() const;
+  bool usesVulkanMemoryModel() const;
+
+  // Adapt memory semantics built for the OpenCL memory model to the one of the
+  // module. The Vulkan memory model has no sequential consistency, and only
+  // makes writes available and visible when asked to, for the storage classes
+  // given, so drivers needn't make all memory coherent at each atomic.
+  unsigned getMemSemanticsForMemoryModel(unsigned memSem) const;
+
+  // The number of instructions SPIRVIfConversion may speculate to replace a
+  // small if/else diamond with OpSelects, overridden by
+  // -spirv-if-conversion-threshold.
+  unsigned getIfConversionThreshold() const;
+
+  // Whether SPIRVDivByConstantCombine expands divisions by constants into
+  // multiplies and shifts, overridden by -spirv-expand-div-by-constant.
+  bool expandsDivByConstant() const;
+
+  // The most components of the vectors the legalizer keeps for arithmetic and
+  // conversions, wider ones being split, or scalarized for 1. Overridden by
+  // -spirv-max-vector-elements.
+  unsigned getMaxVectorElements() const;
+
   uint32_t getTargetSPIRVVersion() const { return targetSPIRVVersion; };
 
   bool canUseCapability(Capability::Capability c) const;
@@ -17,6 +17,7 @@
 #include "SPIRVIRTranslator.h"
 #include "SPIRVLegalizerInfo.h"
 #include "SPIRVRegisterBankInfo.h"
+#include "SPIRVTargetTransformInfo.h"
 #include "llvm/CodeGen/GlobalISel/InstructionSelect.h"
 #include "llvm/CodeGen/GlobalISel/Legalizer.h"
 #include "llvm/CodeGen/GlobalISel/RegBankSelect.h"
@@ -27,14 +28,23 @@
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/FunctionAttrs.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils.h"
+#include "llvm/Transforms/Utils/UnifyFunctionExitNodes.h"
+#include "llvm/Transforms/Vectorize.h"
 
 #include "SPIRVSubtarget.h"
 #include "SPIRVTypeRegistry.h"
 
 #include <string>
 
+#include "llvm-c/SPIRV.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
 #include "llvm/PassSupport.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 using namespace llvm;
 InstructionSelector *
@@ -52,8 +62,38 @@ extern "C" void LLVMInitializeSPIRVTarget() {
   PassRegistry &PR = *PassRegistry::getPassRegistry();
   initializeGlobalISel(PR);
   initializeSPIRVBlockLabelerPass(PR);
+  initializeSPIRVLowerMemIntrinsicsPass(PR);
   initializeSPIRVGlobalTypesAndRegNumPass(PR);
-  initializeSPIRVAddRequirementsPass(PR);
+  initializeSPIRVStructurizerPass(PR);
+  initializeSPIRVVectorCombinePass(PR);
+  initializeSPIRVMinMaxCombinePass(PR);
+  initializeSPIRVSimplifyCFGPass(PR);
+  initializeSPIRVMachineCSEPass(PR);
+  initializeSPIRVPreEmitSchedulerPass(PR);
+  initializeSPIRVGenericAccessRemarksPass(PR);
+  initializeSPIRVCoalescingRemarksPass(PR);
+  initializeSPIRVBlockProfilingPass(PR);
+  initializeSPIRVKernelResourceReportPass(PR);
+  initializeSPIRVKernelReflectionPass(PR);
+  initializeSPIRVNarrowArithmeticPass(PR);
+  initializeSPIRVDemoteFP64Pass(PR);
+  initializeSPIRVNarrowIndicesPass(PR);
+  initializeSPIRVDebugLinesPass(PR);
+  initializeSPIRVIfConversionPass(PR);
+  initializeSPIRVBarrierEliminationPass(PR);
+  initializeSPIRVPromoteConstantGlobalsPass(PR);
+  initializeSPIRVDivByConstantCombinePass(PR);
+  initializeSPIRVStackColoringPass(PR);
+  initializeSPIRVAtomicOptimizerPass(PR);
+  initializeSPIRVAnnotateUniformValuesPass(PR);
+  initializeSPIRVEntryPointSubsetPass(PR);
+  initializeSPIRVInlineSmallFunctionsPass(PR);
+  initializeSPIRVMergeFunctionsPass(PR);
+  initializeSPIRVConstantFoldingPass(PR);
+  initializeSPIRVByValCopyEliminationPass(PR);
+  initializeSPIRVSplitAggregateLoadsPass(PR);
+  initializeSPIRVLocalMemoryLayoutPass(PR);
+  initializeSPIRVShaderEntryPointsPass(PR);
 }
 
 // DataLayout: little or big endian
@@ -88,13 +128,20 @@ SPIRVTargetMachine::SPIRVTargetMachine(const Target &T, const Triple &TT,
                         getEffectiveRelocModel(RM),
                         getEffectiveCodeModel(CM, CodeModel::Small), OL),
       TLOF(make_unique<TargetLoweringObjectFileELF>()),
-      Subtarget(TT, CPU, FS, *this) {
+      Subtarget(TT, CPU, FS, *this), EmitOS(EmitBuffer) {
   initAsmInfo();
   setGlobalISel(true);
   setGlobalISelAbort(GlobalISelAbortMode::Enable);
   setFastISel(false);
   setO0WantsFastISel(false);
-  setRequiresStructuredCFG(TT.isVulkanEnvironment());
+  setRequiresStructuredCFG(TT.isVulkanEnvironment() || TT.isSPIRVLogical());
+}
+
+SPIRVTargetMachine::~SPIRVTargetMachine() = default;
+
+TargetTransformInfo
+SPIRVTargetMachine::getTargetTransformInfo(const Function &F) {
+  return TargetTransformInfo(SPIRVTTIImpl(this, F));
 }
 
 namespace {
@@ -107,9 +154,11 @@ public:
   SPIRVTargetMachine &getSPIRVTargetMachine() const {
     return getTM<SPIRVTargetMachine>();
   }
+  void addIRPasses() override;
   void addISelPrepare() override;
 
   bool addIRTranslator() override;
+  void addPreLegalizeMachineIR() override;
   bool addLegalizeMachineIR() override;
   bool addRegBankSelect() override;
   bool addGlobalInstructionSelect() override;
@@ -118,6 +167,7 @@ public:
   void addFastRegAlloc() override {}
   void addOptimizedRegAlloc() override {}
 
+  void addMachineSSAOptimization() override;
   void addPostRegAlloc() override;
 
   void addPreEmitPass2() override;
@@ -130,6 +180,26 @@ FunctionPass *SPIRVPassConfig::createTargetRegisterAllocator(bool) {
   return nullptr;
 }
 
+// Combine the selected vector arithmetic and min/max chains into the dedicated
+// SPIR-V instructions before the generic optimizations, then remove the
+// redundant barriers, fold the instructions on constants and remove the
+// redundant instructions they don't recognize
+void SPIRVPassConfig::addMachineSSAOptimization() {
+  addPass(createSPIRVVectorCombinePass());
+  addPass(createSPIRVMinMaxCombinePass());
+
+  // MachineCSE would merge instructions with different decorations, which
+  // SPIRVMachineCSE accounts for, and MachineSinking doesn't know OpPhi uses
+  // are on the incoming edges, so SPIRVPreEmitScheduler sinks instead.
+  // EarlyMachineLICM runs, now the instructions without side effects say so.
+  disablePass(&MachineCSEID);
+  disablePass(&MachineSinkingID);
+  TargetPassConfig::addMachineSSAOptimization();
+  addPass(createSPIRVBarrierEliminationPass());
+  addPass(createSPIRVConstantFoldingPass());
+  addPass(createSPIRVMachineCSEPass());
+}
+
 // Disable passes that break from assuming no virtual registers exist
 void SPIRVPassConfig::addPostRegAlloc() {
   // Do not work with vregs instead of physical regs
@@ -142,7 +212,7 @@ void SPIRVPassConfig::addPostRegAlloc() {
   disablePass(&ShrinkWrapID);
   disablePass(&LiveDebugValuesID);
 
-  // Do not work with OpPhi
+  // Do not work with OpPhi, so SPIRVSimplifyCFG is run instead
   disablePass(&BranchFolderPassID);
   disablePass(&MachineBlockPlacementID);
 
@@ -153,23 +223,203 @@ TargetPassConfig *SPIRVTargetMachine::createPassConfig(PassManagerBase &PM) {
   return new SPIRVPassConfig(*this, PM);
 }
 
+// With -spirv-cache-dir, the cache pass runs before the whole pipeline, and the
+// object file is emitted into its buffer so it can be copied into the cache.
+// With -spirv-entry-points, the other kernels are removed even before that, so
+// the cache key only covers what's compiled, as are the functions no longer
+// referenced once -spirv-executable internalizes them.
+bool SPIRVTargetMachine::addPassesToEmitFile(
+    PassManagerBase &PM, raw_pwrite_stream &Out, raw_pwrite_stream *DwoOut,
+    CodeGenFileType FileType, bool DisableVerify, MachineModuleInfo *MMI) {
+  EmittingObjectFile = FileType == CGFT_ObjectFile;
+  if (isSPIRVEntryPointSubsetEnabled() || isSPIRVExecutableModule()) {
+    PM.add(createSPIRVEntryPointSubsetPass());
+    PM.add(createGlobalDCEPass());
+  }
+  if (FileType != CGFT_ObjectFile || !isSPIRVCompilationCacheEnabled()) {
+    return LLVMTargetMachine::addPassesToEmitFile(PM, Out, DwoOut, FileType,
+                                                  DisableVerify, MMI);
+  }
+  raw_pwrite_stream *codeGenOut = nullptr;
+  PM.add(createSPIRVCompilationCachePass(Out, *this, codeGenOut));
+  return LLVMTargetMachine::addPassesToEmitFile(PM, *codeGenOut, DwoOut,
+                                                FileType, DisableVerify, MMI);
+}
+
+// Running a legacy pass manager again on another module is supported, as
+// llc's -run-twice checks, so the pipeline is only built once. The object file
+// is emitted into a buffer cleared before each run.
+bool SPIRVTargetMachine::emitSPIRVWords(
+    Module &M, std::vector<uint32_t> &Words,
+    std::vector<SPIRVEntryPointImage> *EntryPointImages) {
+  if (EntryPointImages && isSPIRVCompilationCacheEnabled()) {
+    return true;
+  }
+  if (!EmitPM) {
+    auto PM = make_unique<legacy::PassManager>();
+    if (addPassesToEmitFile(*PM, EmitOS, nullptr, CGFT_ObjectFile)) {
+      return true;
+    }
+    EmitPM = std::move(PM);
+  }
+  EmitBuffer.clear();
+  SPIRVTypeRegistry *TR = Subtarget.getSPIRVTypeRegistry();
+  TR->setBuildEntryPointImages(EntryPointImages != nullptr);
+  EmitPM->run(M);
+  TR->setBuildEntryPointImages(false);
+  if (EntryPointImages) {
+    *EntryPointImages = TR->takeEntryPointImages();
+  }
+
+  Words.resize(EmitBuffer.size() / sizeof(uint32_t));
+  for (size_t i = 0; i < Words.size(); ++i) {
+    Words[i] = support::endian::read32le(&EmitBuffer[i * sizeof(uint32_t)]);
+  }
+  return false;
+}
+
+// The SPIR-V consumer may not optimize much, so clean up what the frontend
+// leaves before the default codegen IR passes.
+void SPIRVPassConfig::addIRPasses() {
+  // Compute the double arithmetic of floats and double constants in float
+  // with -spirv-demote-fp64, even without optimizations, as it's how devices
+  // without Float64 can run such code.
+  addPass(createSPIRVDemoteFP64Pass());
+  if (getOptLevel() != CodeGenOpt::None) {
+    // Replace the identical internal functions, such as template instances on
+    // types with the same layout, with a single copy.
+    addPass(createSPIRVMergeFunctionsPass());
+    // Inline the tiny internal helpers many drivers would keep as calls, so
+    // the passes below see through them.
+    addPass(createSPIRVInlineSmallFunctionsPass());
+    // Read the byval kernel arguments in place rather than through the
+    // private copy each work item would make.
+    addPass(createSPIRVByValCopyEliminationPass());
+    // Load only the fields used of the structs and arrays loaded whole.
+    addPass(createSPIRVSplitAggregateLoadsPass());
+    // Promote private arrays and structs to SSA values, as any left in memory
+    // become Function storage class OpVariables.
+    addPass(createSROAPass());
+    // Hoist the builtin queries and loads which don't change in loops.
+    addPass(createLICMPass());
+    // Split the constant offsets out of GEPs, so the address computations of
+    // nearby accesses share their variable part, then rewrite the remaining
+    // ones in terms of each other.
+    addPass(createSeparateConstOffsetFromGEPPass());
+    addPass(createStraightLineStrengthReducePass());
+    addPass(createEarlyCSEPass());
+    // Replace the small diamonds left with selects, so subgroups don't diverge
+    // on them.
+    addPass(createSPIRVIfConversionPass());
+    // Compute the promoted char, short and half arithmetic in its own width
+    // with -spirv-narrow-arithmetic.
+    addPass(createSPIRVNarrowArithmeticPass());
+    // Compute the GEP indices in 32 bit on spirv64 with -spirv-32bit-indices.
+    addPass(createSPIRVNarrowIndicesPass());
+    // Merge adjacent loads and stores into vector ones. This goes through
+    // integer casts of pointers, which logical addressing doesn't allow.
+    if (!getSPIRVTargetMachine().getSubtargetImpl()->isLogicalAddressing()) {
+      addPass(createLoadStoreVectorizerPass());
+    }
+  }
+  TargetPassConfig::addIRPasses();
+}
+
 void SPIRVPassConfig::addISelPrepare() {
+  // Shader entry points can't have parameters, so read the kernel arguments
+  // from buffers instead
+  addPass(createSPIRVShaderEntryPointsPass());
+  // Count the executions of the optimized blocks with -spirv-profile
+  addPass(createSPIRVBlockProfilingPass());
+  // Replace Generic pointers with pointers to the storage class they're known
+  // to point into, as drivers must dispatch on the actual storage class of
+  // every access through a Generic pointer at runtime. Then report the ones
+  // which remain. Read-only kernel globals are first moved to UniformConstant,
+  // so they're read through the constant cache.
+  if (getOptLevel() != CodeGenOpt::None) {
+    addPass(createSPIRVPromoteConstantGlobalsPass());
+    addPass(createInferAddressSpacesPass());
+  }
+  addPass(createSPIRVGenericAccessRemarksPass());
+  // Report the global accesses adjacent work-items don't make to adjacent
+  // addresses, which drivers can't coalesce
+  addPass(createSPIRVCoalescingRemarksPass());
+  // Pack the Workgroup variables of each kernel and report their total size
+  addPass(createSPIRVLocalMemoryLayoutPass());
+  // Share the Function storage variables of private arrays with disjoint
+  // lifetimes, as private memory per work item limits occupancy
+  if (getOptLevel() != CodeGenOpt::None) {
+    addPass(createSPIRVStackColoringPass());
+    // Make the atomics a whole subgroup makes on one address with one value
+    // a single atomic, as they're serialized in memory
+    addPass(createSPIRVAtomicOptimizerPass());
+  }
   TargetPassConfig::addISelPrepare();
+  // Infer which functions don't write memory, so their OpFunctions get the
+  // Const or Pure function control even if the frontend didn't mark them
+  if (getOptLevel() != CodeGenOpt::None) {
+    addPass(createPostOrderFunctionAttrsLegacyPass());
+  }
+  // Expand the memory intrinsics which can't be a single copy instruction
+  addPass(createSPIRVLowerMemIntrinsicsPass());
+  // Shaders need structured control flow, so structurize the CFG into
+  // single-entry single-exit regions, which SPIRVStructurizer later declares
+  // with merge instructions. StructurizeCFG doesn't handle switches, and needs
+  // a single return block for every branch to have a post-dominator.
+  if (TM->requiresStructuredCFG()) {
+    addPass(createLowerSwitchPass());
+    addPass(createUnifyFunctionExitNodesPass());
+    addPass(createStructurizeCFGPass());
+  }
   addPass(createSPIRVBasicBlockDominancePass());
+  // Tell the driver which values are the same across the subgroup, once the
+  // CFG their divergence depends on is final
+  if (getOptLevel() != CodeGenOpt::None) {
+    addPass(createSPIRVAnnotateUniformValuesPass());
+  }
 }
 
 // Add custom passes right before emitting asm/obj files. Global VReg numbering
 // is added here, as it emits invalid MIR, so no subsequent passes would work
 void SPIRVPassConfig::addPreEmitPass2() {
+  // Remove forwarding blocks and merge straight-line blocks, which must happen
+  // before they're labeled. Shaders keep their blocks for structured control
+  // flow. Unoptimized code keeps the blocks of the source.
+  if (!TM->requiresStructuredCFG() && getOptLevel() != CodeGenOpt::None)
+    addPass(createSPIRVSimplifyCFGPass());
+
+  // Move instructions next to their uses to shorten live ranges in drivers,
+  // once the blocks are final
+  if (getOptLevel() != CodeGenOpt::None)
+    addPass(createSPIRVPreEmitSchedulerPass());
+
+  // Add OpLoopMerge and OpSelectionMerge instructions. This needs loop and
+  // dominance info and MBB references, so must run before OpLabels are added
+  addPass(createSPIRVStructurizerPass());
+
   // Insert missing block labels and terminators. Fix instrs with MBB references
   addPass(createSPIRVBlockLabelerPass());
 
-  // Add all required OpCapability instructions locally (to be hoisted later)
-  addPass(createSPIRVAddRequirementsPass());
+  // Attribute the instructions to their source location with OpLines, which
+  // go after the OpLabels
+  addPass(createSPIRVDebugLinesPass());
+
+  // Estimate the cost of each kernel with -spirv-kernel-report, while types
+  // are still defined in each function
+  addPass(createSPIRVKernelResourceReportPass(), false);
+  // Write the kernels' arguments and launch requirements with
+  // -spirv-reflection, so runtimes don't need to parse the module for them
+  addPass(createSPIRVKernelReflectionPass(), false);
 
   // Hoist all global instructions, and number VRegs globally.
-  // We disable verification after this, as global VRegs are invalid in MIR
-  addPass(createSPIRVGlobalTypesAndRegNumPass(), false);
+  // We disable verification after this, as global VRegs are invalid in MIR.
+  // When encoding object files directly, the function bodies are encoded and
+  // freed as soon as they're numbered, so only the global instructions stay
+  // as MIR until they're emitted.
+  const auto &SPIRVTM = getTM<SPIRVTargetMachine>();
+  const bool encodeFunctions =
+      isSPIRVDirectEmissionEnabled() && SPIRVTM.isEmittingObjectFile();
+  addPass(createSPIRVGlobalTypesAndRegNumPass(encodeFunctions), false);
 }
 
 // Use a customized subclass of IRTranslator, which avoids flattening aggregates
@@ -179,9 +429,34 @@ bool SPIRVPassConfig::addIRTranslator() {
   return false;
 }
 
-// Use a default legalizer
+// Expand the divisions by constants before they're legalized
+void SPIRVPassConfig::addPreLegalizeMachineIR() {
+  if (getOptLevel() != CodeGenOpt::None) {
+    addPass(createSPIRVDivByConstantCombinePass());
+  }
+}
+
+namespace {
+// A custom subclass of Legalizer, which gives SPIR-V types to the vregs the
+// default legalization rules create, as they are only given LLTs.
+class SPIRVLegalizer : public Legalizer {
+  bool runOnMachineFunction(MachineFunction &MF) override {
+    const auto *ST = static_cast<const SPIRVSubtarget *>(&MF.getSubtarget());
+    auto *TR = ST->getSPIRVTypeRegistry();
+    TR->checkFunction(MF);
+
+    unsigned firstNewVRegIdx = MF.getRegInfo().getNumVirtRegs();
+    bool changed = Legalizer::runOnMachineFunction(MF);
+    if (changed)
+      assignLegalizedVRegTypes(MF, *TR, firstNewVRegIdx);
+    return changed;
+  }
+};
+} // namespace
+
+// Use the custom SPIRVLegalizer from above
 bool SPIRVPassConfig::addLegalizeMachineIR() {
-  addPass(new Legalizer());
+  addPass(new SPIRVLegalizer());
   return false;
 }
 
@@ -193,8 +468,9 @@ bool SPIRVPassConfig::addRegBankSelect() {
 
 namespace {
 // A custom subclass of InstructionSelect, which is mostly the same except from
-// not requiring RegBankSelect to occur previously, and making sure a
-// SPIRVTypeRegistry is initialized before and reset after each run.
+// not requiring RegBankSelect to occur previously, and making sure the
+// SPIRVTypeRegistry holds the function's types before and is reset after each
+// run.
 class SPIRVInstructionSelect : public InstructionSelect {
 
   // We don't use register banks, so unset the requirement for them
@@ -203,11 +479,12 @@ class SPIRVInstructionSelect : public InstructionSelect {
         MachineFunctionProperties::Property::RegBankSelected);
   }
 
-  // Init a SPIRVTypeRegistry before and reset it after the default parent code
+  // Check the SPIRVTypeRegistry holds the function's types before, and reset
+  // it after the default parent code
   bool runOnMachineFunction(MachineFunction &MF) override {
     const auto *ST = static_cast<const SPIRVSubtarget *>(&MF.getSubtarget());
     auto *TR = ST->getSPIRVTypeRegistry();
-    TR->rebuildTypeTablesForFunction(MF);
+    TR->checkFunction(MF);
 
     bool success = InstructionSelect::runOnMachineFunction(MF);
 
@@ -222,3 +499,29 @@ bool SPIRVPassConfig::addGlobalInstructionSelect() {
   addPass(new SPIRVInstructionSelect());
   return false;
 }
+
+LLVMBool
+LLVMSPIRVTargetMachineEmitToMemoryBuffer(LLVMTargetMachineRef T,
+                                         LLVMModuleRef M, char **ErrorMessage,
+                                         LLVMMemoryBufferRef *OutMemBuf) {
+  auto *TM = reinterpret_cast<TargetMachine *>(T);
+  if (!TM->getTargetTriple().isSPIRV()) {
+    *ErrorMessage = strdup("Target machine isn't a SPIR-V target machine");
+    return true;
+  }
+  Module *Mod = unwrap(M);
+  Mod->setDataLayout(TM->createDataLayout());
+
+  std::vector<uint32_t> words;
+  if (static_cast<SPIRVTargetMachine *>(TM)->emitSPIRVWords(*Mod, words)) {
+    *ErrorMessage = strdup("SPIR-V target machine can't emit object files");
+    return true;
+  }
+  SmallVector<char, 0> binary;
+  raw_svector_ostream binaryOS(binary);
+  support::endian::write<uint32_t>(binaryOS, words, support::little);
+  *OutMemBuf = wrap(MemoryBuffer::getMemBufferCopy(
+                        StringRef(binary.data(), binary.size()), "")
+                        .release());
+  return false;
+}
@@ -14,17 +14,35 @@
 #define LLVM_LIB_TARGET_SPIRV_SPIRVTARGETMACHINE_H
 
 #include "SPIRVSubtarget.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 
+#include <vector>
+
 namespace llvm {
+namespace legacy {
+class PassManager;
+} // namespace legacy
+struct SPIRVEntryPointImage;
+
 class SPIRVTargetMachine : public LLVMTargetMachine {
   std::unique_ptr<TargetLoweringObjectFile> TLOF;
   SPIRVSubtarget Subtarget;
+
+  // The buffer emitSPIRVWords emits into, and the pipeline it reuses
+  SmallVector<char, 0> EmitBuffer;
+  raw_svector_ostream EmitOS;
+  std::unique_ptr<legacy::PassManager> EmitPM;
+
+  // Whether the pipeline being built emits an object file
+  bool EmittingObjectFile = false;
+
 public:
   SPIRVTargetMachine(const Target &T, const Triple &TT, StringRef CPU,
                      StringRef FS, const TargetOptions &Options,
                      Optional<Reloc::Model> RM, Optional<CodeModel::Model> CM,
                      CodeGenOpt::Level OL, bool JIT);
+  ~SPIRVTargetMachine() override;
 
   const SPIRVSubtarget *getSubtargetImpl() const { return &Subtarget; }
 
@@ -33,8 +51,29 @@ public:
   }
 
   TargetPassConfig *createPassConfig(PassManagerBase &PM) override;
+
+  // Emit object files through the compilation cache if it is enabled.
+  bool addPassesToEmitFile(PassManagerBase &PM, raw_pwrite_stream &Out,
+                           raw_pwrite_stream *DwoOut, CodeGenFileType FileType,
+                           bool DisableVerify = true,
+                           MachineModuleInfo *MMI = nullptr) override;
   bool usesPhysRegsForPEI() const override { return false; }
 
+  // Whether the last pipeline built by addPassesToEmitFile emits an object
+  // file rather than assembly, for the passes it adds to depend on.
+  bool isEmittingObjectFile() const { return EmittingObjectFile; }
+
+  TargetTransformInfo getTargetTransformInfo(const Function &F) override;
+
+  // Compile M straight to the words of its SPIR-V binary, without an output
+  // stream. The pipeline is built by the first call and reused by later ones,
+  // so calls must not run concurrently. If EntryPointImages is given, it also
+  // gets a binary for each entry point of M from the same compilation, which
+  // the compilation cache can't provide. Returns true on failure.
+  bool emitSPIRVWords(Module &M, std::vector<uint32_t> &Words,
+                      std::vector<SPIRVEntryPointImage> *EntryPointImages =
+                          nullptr);
+
   TargetLoweringObjectFile *getObjFileLowering() const override {
     return TLOF.get();
   }
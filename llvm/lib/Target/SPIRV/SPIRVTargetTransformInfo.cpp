@@ -0,0 +1,131 @@
+//===- SPIRVTargetTransformInfo.cpp - SPIR-V specific TTI -------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the cost queries of the SPIR-V specific
+// TargetTransformInfo, which don't go through the SelectionDAG legalization
+// costs of the default implementation, as no MVT is legal for SPIR-V.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRVTargetTransformInfo.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "spirv-tti"
+
+static cl::opt<unsigned> InlineThresholdMultiplier(
+    "spirv-inline-threshold-multiplier", cl::Hidden, cl::init(11),
+    cl::desc("Multiply the inlining threshold by this for SPIR-V, as calls "
+             "are expensive on GPUs"));
+
+static cl::opt<unsigned>
+    UnrollThreshold("spirv-unroll-threshold", cl::Hidden, cl::init(300),
+                    cl::desc("The cost of the loops SPIR-V unrolls"));
+
+// How many times a load or store through a Generic pointer costs one through
+// a pointer to a known storage class, as drivers dispatch on the actual
+// storage class at runtime
+static const unsigned GenericAccessCostFactor = 4;
+
+unsigned SPIRVTTIImpl::getNumVectorParts(Type *Ty) const {
+  if (!Ty->isVectorTy()) {
+    return 1;
+  }
+  return divideCeil(Ty->getVectorNumElements(), ST->getMaxVectorElements());
+}
+
+unsigned SPIRVTTIImpl::getArithmeticInstrCost(
+    unsigned Opcode, Type *Ty, TTI::OperandValueKind Opd1Info,
+    TTI::OperandValueKind Opd2Info, TTI::OperandValueProperties Opd1PropInfo,
+    TTI::OperandValueProperties Opd2PropInfo, ArrayRef<const Value *> Args) {
+  const unsigned parts = getNumVectorParts(Ty);
+  switch (Opcode) {
+  case Instruction::SDiv:
+  case Instruction::UDiv:
+  case Instruction::SRem:
+  case Instruction::URem:
+  case Instruction::FDiv:
+  case Instruction::FRem:
+    return parts * 4 * TTI::TCC_Basic;
+  default:
+    return parts * TTI::TCC_Basic;
+  }
+}
+
+unsigned SPIRVTTIImpl::getMemoryOpCost(unsigned Opcode, Type *Src,
+                                       unsigned Alignment,
+                                       unsigned AddressSpace,
+                                       const Instruction *I) {
+  const unsigned cost = getNumVectorParts(Src) * TTI::TCC_Basic;
+  if (AddressSpace == getFlatAddressSpace()) {
+    return cost * GenericAccessCostFactor;
+  }
+  return cost;
+}
+
+unsigned SPIRVTTIImpl::getIntrinsicInstrCost(Intrinsic::ID IID, Type *RetTy,
+                                             ArrayRef<Type *> Tys,
+                                             FastMathFlags FMF,
+                                             unsigned ScalarizationCostPassed) {
+  // These are single OpenCL.std or GLSL.std.450 instructions, for vectors too
+  switch (IID) {
+  case Intrinsic::sqrt:
+  case Intrinsic::sin:
+  case Intrinsic::cos:
+  case Intrinsic::exp:
+  case Intrinsic::exp2:
+  case Intrinsic::log:
+  case Intrinsic::log2:
+  case Intrinsic::log10:
+  case Intrinsic::pow:
+  case Intrinsic::fma:
+  case Intrinsic::fmuladd:
+  case Intrinsic::fabs:
+  case Intrinsic::floor:
+  case Intrinsic::ceil:
+  case Intrinsic::trunc:
+  case Intrinsic::rint:
+  case Intrinsic::round:
+  case Intrinsic::copysign:
+  case Intrinsic::minnum:
+  case Intrinsic::maxnum:
+    return getNumVectorParts(RetTy) * TTI::TCC_Basic;
+  default:
+    return BaseT::getIntrinsicInstrCost(IID, RetTy, Tys, FMF,
+                                        ScalarizationCostPassed);
+  }
+}
+
+bool SPIRVTTIImpl::isLoweredToCall(const Function *F) {
+  if (auto builtin = parseOpenCLBuiltinName(F->getName())) {
+    if (F->isDeclaration() && isLoweredOpenCLBuiltin(*builtin)) {
+      return false;
+    }
+  }
+  return BaseT::isLoweredToCall(F);
+}
+
+// Calls become OpFunctionCalls, which drivers may keep, breaking up the
+// kernel they'd otherwise schedule and allocate registers for as a whole
+unsigned SPIRVTTIImpl::getInliningThresholdMultiplier() const {
+  return InlineThresholdMultiplier;
+}
+
+// Unrolling lets drivers schedule the loads of several iterations together,
+// and turns the accesses indexed by the induction variable into constant
+// offsets, so allow bigger and partially unrolled loops than for CPUs
+void SPIRVTTIImpl::getUnrollingPreferences(Loop *L, ScalarEvolution &SE,
+                                           TTI::UnrollingPreferences &UP) {
+  UP.Threshold = UnrollThreshold;
+  UP.PartialThreshold = UnrollThreshold;
+  UP.Partial = true;
+  UP.MaxCount = std::numeric_limits<unsigned>::max();
+}
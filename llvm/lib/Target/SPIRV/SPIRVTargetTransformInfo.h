@@ -0,0 +1,144 @@
+//===- SPIRVTargetTransformInfo.h - SPIR-V specific TTI ---------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the SPIR-V specific TargetTransformInfo, which answers the
+// queries the target independent implementation can't, such as which address
+// space is the Generic storage class, and which values differ between the
+// work-items of a sub-group.
+//
+// The costs it gives the IR passes model a GPU rather than a scalar CPU:
+// vectors are legal up to the widest the environment allows, the math builtins
+// and intrinsics are single OpExtInsts rather than library calls, accesses
+// through Generic pointers cost more, and register files are left to drivers.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LIB_TARGET_SPIRV_SPIRVTARGETTRANSFORMINFO_H
+#define LLVM_LIB_TARGET_SPIRV_SPIRVTARGETTRANSFORMINFO_H
+
+#include "SPIRVOpenCLBIFs.h"
+#include "SPIRVSubtarget.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/CodeGen/BasicTTIImpl.h"
+#include "llvm/IR/Instructions.h"
+
+namespace llvm {
+class SPIRVTTIImpl : public BasicTTIImplBase<SPIRVTTIImpl> {
+  using BaseT = BasicTTIImplBase<SPIRVTTIImpl>;
+  using TTI = TargetTransformInfo;
+  friend BaseT;
+
+  const SPIRVSubtarget *ST;
+  const SPIRVTargetLowering *TLI;
+
+  const SPIRVSubtarget *getST() const { return ST; }
+  const SPIRVTargetLowering *getTLI() const { return TLI; }
+
+public:
+  explicit SPIRVTTIImpl(const SPIRVTargetMachine *TM, const Function &F)
+      : BaseT(TM, F.getParent()->getDataLayout()), ST(TM->getSubtargetImpl()),
+        TLI(ST->getTargetLowering()) {}
+
+  // Vregs become SPIR-V IDs, which drivers allocate registers for after
+  // optimizing the module themselves, so there's no register file to fit
+  unsigned getNumberOfRegisters(bool Vector) const { return 256; }
+
+  // Vectors of 32 bit components are kept up to the subtarget's vector width
+  // policy, so the vectorizers don't build vectors the legalizer splits
+  unsigned getRegisterBitWidth(bool Vector) const {
+    if (!Vector) {
+      return 32;
+    }
+    return ST->getMaxVectorElements() * 32;
+  }
+
+  // Get the number of vector instructions needed for a value of type Ty, or
+  // 1 for scalars.
+  unsigned getNumVectorParts(Type *Ty) const;
+
+  unsigned getArithmeticInstrCost(
+      unsigned Opcode, Type *Ty,
+      TTI::OperandValueKind Opd1Info = TTI::OK_AnyValue,
+      TTI::OperandValueKind Opd2Info = TTI::OK_AnyValue,
+      TTI::OperandValueProperties Opd1PropInfo = TTI::OP_None,
+      TTI::OperandValueProperties Opd2PropInfo = TTI::OP_None,
+      ArrayRef<const Value *> Args = ArrayRef<const Value *>());
+
+  unsigned getMemoryOpCost(unsigned Opcode, Type *Src, unsigned Alignment,
+                           unsigned AddressSpace,
+                           const Instruction *I = nullptr);
+
+  using BaseT::getIntrinsicInstrCost;
+  unsigned getIntrinsicInstrCost(
+      Intrinsic::ID IID, Type *RetTy, ArrayRef<Type *> Tys, FastMathFlags FMF,
+      unsigned ScalarizationCostPassed = std::numeric_limits<unsigned>::max());
+
+  // The OpenCL builtins lowered to instructions aren't calls
+  bool isLoweredToCall(const Function *F);
+
+  unsigned getInliningThresholdMultiplier() const;
+
+  void getUnrollingPreferences(Loop *L, ScalarEvolution &SE,
+                               TTI::UnrollingPreferences &UP);
+
+  // Pointers to the Generic storage class can point into any other one, so
+  // InferAddressSpaces replaces them with the specific storage class they're
+  // known to point into.
+  unsigned getFlatAddressSpace() const {
+    return ST->getSPIRVTypeRegistry()->StorageClassToAddressSpace(
+        StorageClass::Generic);
+  }
+
+  // The work-items of a sub-group run together, so LegacyDivergenceAnalysis
+  // can tell which values they all share
+  bool hasBranchDivergence() const { return true; }
+
+  // The values differing between work-items from the start are the work-item
+  // ids, and the results of functions and memory accesses which can depend on
+  // them in ways the IR doesn't show: loads from private memory, atomics, and
+  // calls to functions accessing memory. The other ones only diverge if their
+  // operands do.
+  bool isSourceOfDivergence(const Value *V) const {
+    if (const auto *arg = dyn_cast<Argument>(V)) {
+      // All work-items get the same kernel arguments, but helper functions
+      // can be called with divergent ones
+      return arg->getParent()->getCallingConv() != CallingConv::SPIR_KERNEL;
+    }
+    if (const auto *load = dyn_cast<LoadInst>(V)) {
+      const auto sc = ST->getSPIRVTypeRegistry()->addressSpaceToStorageClass(
+          load->getPointerAddressSpace());
+      return sc == StorageClass::Function || sc == StorageClass::Generic;
+    }
+    if (isa<AtomicRMWInst>(V) || isa<AtomicCmpXchgInst>(V)) {
+      return true;
+    }
+    if (const auto *call = dyn_cast<CallBase>(V)) {
+      const Function *callee = call->getCalledFunction();
+      if (!callee) {
+        return true;
+      }
+      // Builtin variables such as the ids, and scans, differ between
+      // work-items without accessing memory
+      if (callee->getIntrinsicID() == Intrinsic::spirv_builtin ||
+          callee->getIntrinsicID() == Intrinsic::spirv_group) {
+        return true;
+      }
+      const bool accessesMemory = !call->doesNotAccessMemory();
+      if (auto builtin = parseOpenCLBuiltinName(callee->getName())) {
+        return isVaryingOpenCLBuiltin(*builtin, accessesMemory);
+      }
+      return accessesMemory;
+    }
+    return false;
+  }
+};
+} // namespace llvm
+
+#endif
@@ -9,17 +9,15 @@
 // This file contains the implementation of the SPIRVTypeRegistry class,
 // which is used to maintain rich type information required for SPIR-V even
 // after lowering from LLVM IR to GMIR. It can convert an llvm::Type into
-// an OpTypeXXX instruction, and map it to a virtual register using and
-// ASSIGN_TYPE pseudo instruction.
-//
-// Passes requiring type info can reconstruct the vreg->OpTypeXXX mapping
-// by calling rebuildTypeTablesForFunction(MF) at the start. They must also
-// call reset() when the function ends to avoid maintaining invalid state
-// between function passes.
+// an OpTypeXXX instruction, and map it to a virtual register in a side table
+// kept from the IRTranslator to the end of instruction selection, so vregs
+// don't need a pseudo instruction each to be typed.
 //
 // Type info from this class can only be used before it gets stripped out by the
 // InstructionSelector stage. All type info is function-local until the final
 // SPIRVGlobalTypesAndRegNums pass hoists it globally and deduplicates it all.
+// Identical types are recognized there via the module-wide type IDs interned
+// here whenever a new OpTypeXXX instruction is built.
 //
 //===----------------------------------------------------------------------===//
 
@@ -37,49 +35,255 @@
 
 #include "SPIRVOpenCLBIFs.h"
 
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/CommandLine.h"
+
 using namespace llvm;
 
-SPIRVTypeRegistry::SPIRVTypeRegistry(unsigned int pointerSize)
-    : pointerSize(pointerSize) {}
-
-void SPIRVTypeRegistry::rebuildTypeTablesForFunction(MachineFunction &MF) {
-  const auto TII = MF.getSubtarget().getInstrInfo();
-  const auto spvTII = static_cast<const SPIRVInstrInfo *>(TII);
-  for (const auto &MBB : MF) {
-    for (const auto &MI : MBB) {
-      if (MI.getOpcode() == SPIRV::ASSIGN_TYPE) {
-        Register typeVReg = MI.getOperand(0).getReg();
-        Register idVReg = MI.getOperand(1).getReg();
-
-        SPIRVType *type = VRegToTypeMap[typeVReg];
-        VRegToTypeMap[idVReg] = type;
-      } else if (spvTII->isTypeDeclInstr(MI)) {
-        VRegToTypeMap.insert({getSPIRVTypeID(&MI), &MI});
-        getExistingTypesForOpcode(MI.getOpcode())->push_back(&MI);
-      }
+#define DEBUG_TYPE "spirv-type-registry"
+
+STATISTIC(NumTypesCreated, "Number of SPIR-V type instructions created");
+STATISTIC(NumTypesReused, "Number of SPIR-V type requests reusing a type");
+
+static cl::opt<bool> ScalarBlockLayout(
+    "spirv-scalar-block-layout", cl::Hidden, cl::init(false),
+    cl::desc("Lay out Vulkan buffers with the scalar alignment rules of "
+             "VK_EXT_scalar_block_layout, so vectors of 3 and arrays of "
+             "scalars or small vectors aren't padded"));
+
+SPIRVTypeRegistry::SPIRVTypeRegistry(unsigned int pointerSize,
+                                     bool globalIsStorageBuffer)
+    : pointerSize(pointerSize), globalIsStorageBuffer(globalIsStorageBuffer) {}
+
+void SPIRVTypeRegistry::startFunction(const MachineFunction &MF) {
+  reset();
+  TypedMF = &MF;
+}
+
+void SPIRVTypeRegistry::checkFunction(const MachineFunction &MF) const {
+  if (TypedMF != &MF) {
+    report_fatal_error("The SPIR-V types of " + MF.getName() +
+                       " were dropped before instruction selection");
+  }
+}
+
+// The function-local tables are cleared rather than freed, so the next
+// function reuses their buckets and the type info arena's slabs.
+void SPIRVTypeRegistry::reset() {
+  TypedMF = nullptr;
+  VRegToTypeMap.clear();
+  TypeInfos.clear();
+  TypeInfoAllocator.DestroyAll();
+  TypeToSPIRVTypeMap.clear();
+  LocalTypeMap.clear();
+  ConstantCache.clear();
+}
+
+void SPIRVTypeRegistry::resetModuleTypes() {
+  ModuleTypeIDs.shrink_and_clear();
+  TypeInstrToModuleTypeID.shrink_and_clear();
+  DeclaredExternalFuncs.clear();
+  GlobalVarInstrs.shrink_and_clear();
+}
+
+bool SPIRVTypeRegistry::addExternalFunctionDecl(const Function *F) {
+  return DeclaredExternalFuncs.insert(F).second;
+}
+
+void SPIRVTypeRegistry::addGlobalVariable(const MachineInstr *varInstr,
+                                          const GlobalVariable *GV) {
+  GlobalVarInstrs.insert({varInstr, GV});
+}
+
+const GlobalVariable *
+SPIRVTypeRegistry::getGlobalVariable(const MachineInstr *varInstr) const {
+  return GlobalVarInstrs.lookup(varInstr);
+}
+
+void SPIRVTypeRegistry::setEncodedFunctions(std::vector<uint32_t> &&words,
+                                            unsigned idBound) {
+  EncodedFunctionWords = std::move(words);
+  EncodedFunctionsIDBound = idBound;
+}
+
+std::vector<uint32_t>
+SPIRVTypeRegistry::takeEncodedFunctions(unsigned &idBound) {
+  idBound = EncodedFunctionsIDBound;
+  EncodedFunctionsIDBound = 0;
+  std::vector<uint32_t> words;
+  words.swap(EncodedFunctionWords);
+  return words;
+}
+
+void SPIRVTypeRegistry::setEntryPointImages(
+    std::vector<SPIRVEntryPointImage> &&images) {
+  EntryPointImages = std::move(images);
+}
+
+std::vector<SPIRVEntryPointImage> SPIRVTypeRegistry::takeEntryPointImages() {
+  std::vector<SPIRVEntryPointImage> images;
+  images.swap(EntryPointImages);
+  return images;
+}
+
+Optional<unsigned>
+SPIRVTypeRegistry::getModuleTypeID(const SPIRVType *spirvType) const {
+  auto found = TypeInstrToModuleTypeID.find(spirvType);
+  if (found == TypeInstrToModuleTypeID.end())
+    return None;
+  return found->second;
+}
+
+namespace {
+// Helper to build SPIRVTypeKeys operand by operand, similar to using a
+// MachineInstrBuilder to build the OpTypeXXX instruction itself.
+class TypeKeyBuilder {
+  // Operand kinds used in SPIRVTypeKeys.
+  enum OperandKind { TK_Imm, TK_Type, TK_Const };
+
+  SPIRVTypeKey key;
+
+public:
+  explicit TypeKeyBuilder(unsigned opcode) { key.push_back(opcode); }
+
+  TypeKeyBuilder &addImm(int64_t imm) {
+    key.push_back(TK_Imm);
+    key.push_back(imm);
+    return *this;
+  }
+
+  // Add a type operand, either as a function-local VReg or a module type ID.
+  TypeKeyBuilder &addType(uint64_t typeID) {
+    key.push_back(TK_Type);
+    key.push_back(typeID);
+    return *this;
+  }
+
+  TypeKeyBuilder &addConst(uint64_t val) {
+    key.push_back(TK_Const);
+    key.push_back(val);
+    return *this;
+  }
+
+  TypeKeyBuilder &addString(StringRef str) {
+    const unsigned numWords = getStringWordCount(str);
+    for (unsigned i = 0; i < numWords; ++i) {
+      addImm(getStringWord(str, i));
     }
+    return *this;
+  }
+
+  SPIRVTypeKey &getKey() { return key; }
+};
+} // end anonymous namespace
+
+SPIRVType *SPIRVTypeRegistry::getExistingType(const SPIRVTypeKey &key) const {
+  auto found = LocalTypeMap.find(key);
+  if (found == LocalTypeMap.end()) {
+    ++NumTypesCreated; // The caller builds a new type when none is found
+    return nullptr;
   }
+  ++NumTypesReused;
+  return found->second;
 }
 
-std::vector<SPIRVType *> *
-SPIRVTypeRegistry::getExistingTypesForOpcode(unsigned opcode) {
-  auto found = OpcodeToSPIRVTypeMap.find(opcode);
-  if (found == OpcodeToSPIRVTypeMap.end()) {
-    auto types = new std::vector<SPIRVType *>;
-    OpcodeToSPIRVTypeMap.insert({opcode, types});
-    return types;
-  } else {
-    return found->second;
+const SPIRVTypeInfo *
+SPIRVTypeRegistry::createTypeInfo(SPIRVType *spirvType,
+                                  const MachineRegisterInfo &MRI) {
+  SPIRVTypeInfo *info = new (TypeInfoAllocator.Allocate()) SPIRVTypeInfo();
+  info->typeInstr = spirvType;
+  info->id = getSPIRVTypeID(spirvType);
+  info->opcode = spirvType->getOpcode();
+  info->scalarWidth = 0;
+  info->isSigned = false;
+  info->numElements = 0;
+  info->elemType = nullptr;
+  info->storageClass = StorageClass::Function;
+
+  // Operand types are always created first, so their info already exists
+  auto getOperandInfo = [&](unsigned opIdx) -> const SPIRVTypeInfo * {
+    const MachineInstr *opDef =
+        MRI.getVRegDef(spirvType->getOperand(opIdx).getReg());
+    return opDef ? TypeInfos.lookup(opDef) : nullptr;
+  };
+  switch (info->opcode) {
+  case SPIRV::OpTypeInt:
+    info->scalarWidth = spirvType->getOperand(1).getImm();
+    info->isSigned = spirvType->getOperand(2).getImm() != 0;
+    break;
+  case SPIRV::OpTypeFloat:
+    info->scalarWidth = spirvType->getOperand(1).getImm();
+    break;
+  case SPIRV::OpTypeVector:
+    info->elemType = getOperandInfo(1);
+    info->numElements = spirvType->getOperand(2).getImm();
+    if (info->elemType) {
+      info->scalarWidth = info->elemType->scalarWidth;
+      info->isSigned = info->elemType->isSigned;
+    }
+    break;
+  case SPIRV::OpTypePointer:
+    info->storageClass = static_cast<StorageClass::StorageClass>(
+        spirvType->getOperand(1).getImm());
+    info->elemType = getOperandInfo(2);
+    break;
+  default:
+    break;
   }
+  TypeInfos.insert({spirvType, info});
+  return info;
 }
 
-void SPIRVTypeRegistry::reset() {
-  VRegToTypeMap.shrink_and_clear();
-  TypeToSPIRVTypeMap.shrink_and_clear();
-  for (const auto &t : OpcodeToSPIRVTypeMap) {
-    delete t.second;
+SPIRVType *SPIRVTypeRegistry::addNewType(SPIRVType *spirvType) {
+  // Build both the function-local key, and the function-independent key using
+  // the module type IDs of any operand types (which are always created first).
+  const auto &MRI = spirvType->getMF()->getRegInfo();
+  createTypeInfo(spirvType, MRI);
+  TypeKeyBuilder localKey(spirvType->getOpcode());
+  TypeKeyBuilder moduleKey(spirvType->getOpcode());
+  bool canIntern = true;
+  for (const auto &op : spirvType->uses()) {
+    if (op.isImm()) {
+      localKey.addImm(op.getImm());
+      moduleKey.addImm(op.getImm());
+    } else if (op.isReg()) {
+      const MachineInstr *opDef = MRI.getVRegDef(op.getReg());
+      assert(opDef && "No definition found for type operand vreg");
+      if (opDef->getOpcode() == TargetOpcode::G_CONSTANT) {
+        auto val = opDef->getOperand(1).getCImm()->getZExtValue();
+        localKey.addConst(val);
+        moduleKey.addConst(val);
+        continue;
+      }
+      localKey.addType(op.getReg());
+      auto opTypeID = TypeInstrToModuleTypeID.find(opDef);
+      if (opTypeID != TypeInstrToModuleTypeID.end()) {
+        moduleKey.addType(opTypeID->second);
+      } else {
+        // Can't describe this operand independently of the function, so leave
+        // the type un-interned and let the hoisting pass compare it instead.
+        canIntern = false;
+      }
+    } else if (isStringOperand(op)) {
+      localKey.addString(op.getSymbolName());
+      moduleKey.addString(op.getSymbolName());
+    } else {
+      errs() << *spirvType;
+      llvm_unreachable("Unexpected operand type in type instruction");
+    }
   }
-  OpcodeToSPIRVTypeMap.shrink_and_clear();
+  LocalTypeMap.insert({std::move(localKey.getKey()), spirvType});
+  if (canIntern) {
+    unsigned newID = ModuleTypeIDs.size();
+    auto &key = moduleKey.getKey();
+    auto typeID = ModuleTypeIDs.insert({std::move(key), newID}).first->second;
+    TypeInstrToModuleTypeID[spirvType] = typeID;
+  } else {
+    // An erased type instruction may have had the same address
+    TypeInstrToModuleTypeID.erase(spirvType);
+  }
+  return spirvType;
 }
 
 SPIRVType *SPIRVTypeRegistry::assignTypeToVReg(const Type *type, Register VReg,
@@ -94,11 +298,8 @@ SPIRVType *SPIRVTypeRegistry::assignTypeToVReg(const Type *type, Register VReg,
 void SPIRVTypeRegistry::assignSPIRVTypeToVReg(SPIRVType *spirvType,
                                              Register VReg,
                                              MachineIRBuilder &MIRBuilder) {
-  VRegToTypeMap[VReg] = spirvType;
-  auto MIB = MIRBuilder.buildInstr(SPIRV::ASSIGN_TYPE)
-                 .addUse(getSPIRVTypeID(spirvType))
-                 .addUse(VReg);
-  constrainRegOperands(MIB);
+  assert(TypedMF == &MIRBuilder.getMF() && "Types of another function");
+  VRegToTypeMap[VReg] = getTypeInfo(spirvType);
 }
 
 static Register createTypeVReg(MachineIRBuilder &MIRBuilder) {
@@ -107,66 +308,55 @@ static Register createTypeVReg(MachineIRBuilder &MIRBuilder) {
 }
 
 SPIRVType *SPIRVTypeRegistry::getOpTypeBool(MachineIRBuilder &MIRBuilder) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeBool);
-  if (tys->empty()) {
-    tys->push_back(MIRBuilder.buildInstr(SPIRV::OpTypeBool)
-                       .addDef(createTypeVReg(MIRBuilder)));
-  }
-  return tys->at(0);
+  TypeKeyBuilder key(SPIRV::OpTypeBool);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  return addNewType(MIRBuilder.buildInstr(SPIRV::OpTypeBool)
+                        .addDef(createTypeVReg(MIRBuilder)));
 }
 
 SPIRVType *SPIRVTypeRegistry::getOpTypeInt(uint32_t width,
                                           MachineIRBuilder &MIRBuilder,
                                           bool isSigned) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeInt);
-  for (const auto &ty : *tys) {
-    if (ty->getOperand(1).getImm() == width &&
-        ty->getOperand(2).getImm() == isSigned) {
-      return ty;
-    }
-  }
+  TypeKeyBuilder key(SPIRV::OpTypeInt);
+  key.addImm(width).addImm(isSigned ? 1 : 0);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeInt)
                  .addDef(createTypeVReg(MIRBuilder))
                  .addImm(width)
                  .addImm(isSigned ? 1 : 0);
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
 }
 
 SPIRVType *SPIRVTypeRegistry::getOpTypeFloat(uint32_t width,
                                             MachineIRBuilder &MIRBuilder) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeFloat);
-  for (const auto &ty : *tys) {
-    if (ty->getOperand(1).getImm() == width)
-      return ty;
-  }
+  TypeKeyBuilder key(SPIRV::OpTypeFloat);
+  key.addImm(width);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeFloat)
                  .addDef(createTypeVReg(MIRBuilder))
                  .addImm(width);
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
 }
 
 SPIRVType *SPIRVTypeRegistry::getOpTypeVoid(MachineIRBuilder &MIRBuilder) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeVoid);
-  if (tys->empty()) {
-    tys->push_back(MIRBuilder.buildInstr(SPIRV::OpTypeVoid)
-                       .addDef(createTypeVReg(MIRBuilder)));
-  }
-  return tys->at(0);
+  TypeKeyBuilder key(SPIRV::OpTypeVoid);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  return addNewType(MIRBuilder.buildInstr(SPIRV::OpTypeVoid)
+                        .addDef(createTypeVReg(MIRBuilder)));
 }
 
 SPIRVType *SPIRVTypeRegistry::getOpTypeVector(uint32_t numElems,
                                              SPIRVType *elemType,
                                              MachineIRBuilder &MIRBuilder) {
   using namespace SPIRV;
-  auto tys = getExistingTypesForOpcode(OpTypeVector);
-  for (const auto &ty : *tys) {
-    if (ty->getOperand(2).getImm() == numElems &&
-        ty->getOperand(1).getReg() == getSPIRVTypeID(elemType)) {
-      return ty;
-    }
-  }
+  TypeKeyBuilder key(OpTypeVector);
+  key.addType(getSPIRVTypeID(elemType)).addImm(numElems);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   auto eleOpc = elemType->getOpcode();
   if (eleOpc != OpTypeInt && eleOpc != OpTypeFloat && eleOpc != OpTypeBool) {
     errs() << *elemType;
@@ -176,8 +366,7 @@ SPIRVType *SPIRVTypeRegistry::getOpTypeVector(uint32_t numElems,
                  .addDef(createTypeVReg(MIRBuilder))
                  .addUse(getSPIRVTypeID(elemType))
                  .addImm(numElems);
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
 }
 
 static Register buildConstantI32(uint32_t val, MachineIRBuilder &MIRBuilder,
@@ -194,17 +383,10 @@ static Register buildConstantI32(uint32_t val, MachineIRBuilder &MIRBuilder,
 SPIRVType *SPIRVTypeRegistry::getOpTypeArray(uint32_t numElems,
                                             SPIRVType *elemType,
                                             MachineIRBuilder &MIRBuilder) {
-  const auto MRI = MIRBuilder.getMRI();
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeArray);
-  for (const auto &ty : *tys) {
-    if (ty->getOperand(1).getReg() == getSPIRVTypeID(elemType)) {
-      auto cInst = MRI->getVRegDef(ty->getOperand(2).getReg());
-      auto cVal = cInst->getOperand(1).getCImm()->getValue().getZExtValue();
-      if (cVal == numElems) {
-        return ty;
-      }
-    }
-  }
+  TypeKeyBuilder key(SPIRV::OpTypeArray);
+  key.addType(getSPIRVTypeID(elemType)).addConst(numElems);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   if (elemType->getOpcode() == SPIRV::OpTypeVoid) {
     errs() << *elemType;
     report_fatal_error("Invalid array element type");
@@ -214,46 +396,63 @@ SPIRVType *SPIRVTypeRegistry::getOpTypeArray(uint32_t numElems,
                  .addDef(createTypeVReg(MIRBuilder))
                  .addUse(getSPIRVTypeID(elemType))
                  .addUse(numElementsVReg);
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
+}
+
+SPIRVType *SPIRVTypeRegistry::getOpTypeCooperativeMatrixNV(
+    SPIRVType *compType, Scope::Scope scope, uint32_t rows, uint32_t cols,
+    MachineIRBuilder &MIRBuilder) {
+  TypeKeyBuilder key(SPIRV::OpTypeCooperativeMatrixNV);
+  key.addType(getSPIRVTypeID(compType))
+      .addConst(scope)
+      .addConst(rows)
+      .addConst(cols);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeCooperativeMatrixNV)
+                 .addDef(createTypeVReg(MIRBuilder))
+                 .addUse(getSPIRVTypeID(compType))
+                 .addUse(buildConstantI32(scope, MIRBuilder, this))
+                 .addUse(buildConstantI32(rows, MIRBuilder, this))
+                 .addUse(buildConstantI32(cols, MIRBuilder, this));
+  return addNewType(MIB);
+}
+
+SPIRVType *SPIRVTypeRegistry::getOpTypeRuntimeArray(
+    SPIRVType *elemType, MachineIRBuilder &MIRBuilder) {
+  TypeKeyBuilder key(SPIRV::OpTypeRuntimeArray);
+  key.addType(getSPIRVTypeID(elemType));
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeRuntimeArray)
+                 .addDef(createTypeVReg(MIRBuilder))
+                 .addUse(getSPIRVTypeID(elemType));
+  return addNewType(MIB);
 }
 
 SPIRVType *SPIRVTypeRegistry::getOpTypeOpaque(const StringRef name,
                                              MachineIRBuilder &MIRBuilder) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeOpaque);
-  for (const auto &ty : *tys) {
-    if (name.equals(getStringImm(*ty, 1)))
-      return ty;
-  }
+  TypeKeyBuilder key(SPIRV::OpTypeOpaque);
+  key.addString(name);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   Register resVReg = createTypeVReg(MIRBuilder);
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeOpaque).addDef(resVReg);
   addStringImm(name, MIB);
   buildOpName(resVReg, name, MIRBuilder);
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
 }
 
 SPIRVType *
 SPIRVTypeRegistry::getOpTypeStruct(const SmallVectorImpl<SPIRVType *> &elems,
                                   MachineIRBuilder &MIRBuilder,
                                   StringRef name) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeStruct);
-  const unsigned numExpectedOps = elems.size() + 1;
-  for (const auto &ty : *tys) {
-    if (ty->getNumOperands() == numExpectedOps) {
-      bool allMatch = true;
-      for (unsigned i = 1; i < numExpectedOps; ++i) {
-        auto elem = elems[i - 1];
-        auto op = ty->getOperand(i).getReg();
-        if (getSPIRVTypeID(elem) != op) {
-          allMatch = false;
-          break;
-        }
-      }
-      if (allMatch)
-        return ty;
-    }
+  TypeKeyBuilder key(SPIRV::OpTypeStruct);
+  for (const auto &elementType : elems) {
+    key.addType(getSPIRVTypeID(elementType));
   }
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
 
   Register resVReg = createTypeVReg(MIRBuilder);
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeStruct).addDef(resVReg);
@@ -265,8 +464,7 @@ SPIRVTypeRegistry::getOpTypeStruct(const SmallVectorImpl<SPIRVType *> &elems,
     MIB.addUse(getSPIRVTypeID(elementType));
   }
   buildOpName(resVReg, name, MIRBuilder);
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
 }
 
 static bool isOpenCLBuiltinType(const StructType *stype) {
@@ -286,53 +484,247 @@ static SPIRVType *handleOpenCLBuiltin(const StringRef name,
   return resTy;
 }
 
+// Cooperative matrices are pointers to opaque structs named
+// spirv.CooperativeMatrixNV.<component>.<scope>.<rows>.<cols>, the component
+// type being given by its OpenCL C name, e.g. for a subgroup's 16x16 matrix of
+// halves, %spirv.CooperativeMatrixNV.half.3.16.16*
+static bool isCooperativeMatrixType(const StructType *stype) {
+  return stype->isOpaque() && stype->hasName() &&
+         stype->getName().startswith("spirv.CooperativeMatrixNV.");
+}
+
+static SPIRVType *handleCooperativeMatrixType(const StringRef name,
+                                              MachineIRBuilder &MIRBuilder,
+                                              SPIRVTypeRegistry *TR) {
+  SmallVector<StringRef, 6> fields;
+  name.split(fields, '.');
+  unsigned scope, rows, cols;
+  if (fields.size() != 6 || fields[3].getAsInteger(10, scope) ||
+      fields[4].getAsInteger(10, rows) || fields[5].getAsInteger(10, cols)) {
+    report_fatal_error("Invalid cooperative matrix type: " + name);
+  }
+  const StringRef comp = fields[2];
+  const unsigned width = StringSwitch<unsigned>(comp)
+                             .Cases("char", "uchar", 8)
+                             .Cases("short", "ushort", "half", 16)
+                             .Cases("int", "uint", "float", 32)
+                             .Cases("long", "ulong", "double", 64)
+                             .Default(0);
+  if (!width) {
+    report_fatal_error("Invalid cooperative matrix component type: " + comp);
+  }
+  SPIRVType *compType =
+      comp == "half" || comp == "float" || comp == "double"
+          ? TR->getOpTypeFloat(width, MIRBuilder)
+          : TR->getOpTypeInt(width, MIRBuilder, !comp.startswith("u"));
+  unsigned numStartingVRegs = MIRBuilder.getMRI()->getNumVirtRegs();
+  auto resTy = TR->getOpTypeCooperativeMatrixNV(
+      compType, static_cast<Scope::Scope>(scope), rows, cols, MIRBuilder);
+  if (numStartingVRegs < MIRBuilder.getMRI()->getNumVirtRegs()) {
+    buildOpName(TR->getSPIRVTypeID(resTy), name, MIRBuilder);
+  }
+  return resTy;
+}
+
+namespace {
+// The alignment rules of explicitly laid out storage classes: std140 rounds
+// the alignment of arrays and structs up to 16, std430 doesn't, and the scalar
+// layout aligns vectors to their components rather than to 2 or 4 of them.
+enum class LayoutRules { Std140, Std430, Scalar };
+
+// The size and base alignment of a type in an explicitly laid out block
+struct TypeLayout {
+  uint64_t size;
+  uint64_t align;
+};
+} // namespace
+
+static bool isExplicitlyLaidOut(StorageClass::StorageClass sc) {
+  return sc == StorageClass::StorageBuffer || sc == StorageClass::Uniform ||
+         sc == StorageClass::PushConstant ||
+         sc == StorageClass::PhysicalStorageBufferEXT;
+}
+
+// Buffers are laid out in std140 if they're Uniform, and std430 otherwise,
+// unless -spirv-scalar-block-layout packs them tightly
+static LayoutRules getLayoutRules(StorageClass::StorageClass sc) {
+  if (ScalarBlockLayout) {
+    return LayoutRules::Scalar;
+  }
+  return sc == StorageClass::Uniform ? LayoutRules::Std140
+                                     : LayoutRules::Std430;
+}
+
+static uint64_t getArrayLength(const MachineInstr &arrayType,
+                               const MachineRegisterInfo &MRI) {
+  const MachineInstr *len = MRI.getVRegDef(arrayType.getOperand(2).getReg());
+  if (len && len->getOpcode() == TargetOpcode::G_CONSTANT) {
+    return len->getOperand(1).getCImm()->getZExtValue();
+  }
+  if (len && len->getOpcode() == SPIRV::OpConstant &&
+      len->getOperand(2).isImm()) {
+    return len->getOperand(2).getImm();
+  }
+  report_fatal_error("Array length of an explicitly laid out type unknown");
+}
+
+// Decorate the struct members and arrays in the type with the Offsets and
+// ArrayStrides of the given rules, and return its layout. Types shared by
+// several buffers are decorated again for each, which the identical
+// decorations are merged with once hoisted to the module's annotations.
+static TypeLayout decorateExplicitLayout(const MachineInstr &type,
+                                         LayoutRules rules,
+                                         const MachineRegisterInfo &MRI,
+                                         MachineIRBuilder &MIRBuilder) {
+  auto layOutOperand = [&](unsigned i) {
+    const MachineInstr *opType = MRI.getVRegDef(type.getOperand(i).getReg());
+    return decorateExplicitLayout(*opType, rules, MRI, MIRBuilder);
+  };
+  switch (type.getOpcode()) {
+  case SPIRV::OpTypeInt:
+  case SPIRV::OpTypeFloat: {
+    const uint64_t size = type.getOperand(1).getImm() / 8;
+    return {size, size};
+  }
+  case SPIRV::OpTypeBool:
+    return {4, 4};
+  case SPIRV::OpTypePointer:
+    return {8, 8};
+  case SPIRV::OpTypeVector: {
+    const TypeLayout elem = layOutOperand(1);
+    const uint64_t numElems = type.getOperand(2).getImm();
+    if (rules == LayoutRules::Scalar) {
+      return {elem.size * numElems, elem.align};
+    }
+    return {elem.size * numElems, elem.align * (numElems == 2 ? 2 : 4)};
+  }
+  case SPIRV::OpTypeArray: {
+    const TypeLayout elem = layOutOperand(1);
+    const uint64_t align =
+        rules == LayoutRules::Std140 ? alignTo(elem.align, 16) : elem.align;
+    const uint64_t stride = alignTo(elem.size, align);
+    MIRBuilder.buildInstr(SPIRV::OpDecorate)
+        .addUse(type.getOperand(0).getReg())
+        .addImm(Decoration::ArrayStride)
+        .addImm(stride);
+    return {stride * getArrayLength(type, MRI), align};
+  }
+  case SPIRV::OpTypeRuntimeArray: {
+    // Only the last member of a buffer can be unsized, so it takes no space
+    const TypeLayout elem = layOutOperand(1);
+    const uint64_t align =
+        rules == LayoutRules::Std140 ? alignTo(elem.align, 16) : elem.align;
+    MIRBuilder.buildInstr(SPIRV::OpDecorate)
+        .addUse(type.getOperand(0).getReg())
+        .addImm(Decoration::ArrayStride)
+        .addImm(alignTo(elem.size, align));
+    return {0, align};
+  }
+  case SPIRV::OpTypeStruct: {
+    uint64_t offset = 0;
+    uint64_t align = 1;
+    for (unsigned i = 1; i < type.getNumOperands(); ++i) {
+      const TypeLayout member = layOutOperand(i);
+      offset = alignTo(offset, member.align);
+      MIRBuilder.buildInstr(SPIRV::OpMemberDecorate)
+          .addUse(type.getOperand(0).getReg())
+          .addImm(i - 1)
+          .addImm(Decoration::Offset)
+          .addImm(offset);
+      offset += member.size;
+      align = std::max(align, member.align);
+    }
+    if (rules == LayoutRules::Std140) {
+      align = alignTo(align, 16);
+    }
+    return {alignTo(offset, align), align};
+  }
+  default:
+    errs() << type;
+    report_fatal_error("Type can't be explicitly laid out");
+  }
+}
+
+// Get the layout decorateExplicitLayout gives the SPIR-V type of an IR type
+static TypeLayout getExplicitLayout(const Type *Ty, LayoutRules rules) {
+  if (Ty->isIntegerTy(1)) {
+    return {4, 4};
+  } else if (Ty->isIntegerTy() || Ty->isFloatingPointTy()) {
+    const uint64_t size = Ty->getPrimitiveSizeInBits() / 8;
+    return {size, size};
+  } else if (Ty->isPointerTy()) {
+    return {8, 8};
+  } else if (Ty->isVectorTy()) {
+    const TypeLayout elem =
+        getExplicitLayout(Ty->getVectorElementType(), rules);
+    const uint64_t numElems = Ty->getVectorNumElements();
+    if (rules == LayoutRules::Scalar) {
+      return {elem.size * numElems, elem.align};
+    }
+    return {elem.size * numElems, elem.align * (numElems == 2 ? 2 : 4)};
+  } else if (Ty->isArrayTy()) {
+    const TypeLayout elem = getExplicitLayout(Ty->getArrayElementType(), rules);
+    const uint64_t align =
+        rules == LayoutRules::Std140 ? alignTo(elem.align, 16) : elem.align;
+    return {alignTo(elem.size, align) * Ty->getArrayNumElements(), align};
+  } else if (const auto *structTy = dyn_cast<StructType>(Ty)) {
+    uint64_t offset = 0;
+    uint64_t align = 1;
+    for (const Type *memberTy : structTy->elements()) {
+      const TypeLayout member = getExplicitLayout(memberTy, rules);
+      offset = alignTo(offset, member.align) + member.size;
+      align = std::max(align, member.align);
+    }
+    if (rules == LayoutRules::Std140) {
+      align = alignTo(align, 16);
+    }
+    return {alignTo(offset, align), align};
+  }
+  report_fatal_error("Type can't be explicitly laid out");
+}
+
+std::pair<uint64_t, uint64_t>
+SPIRVTypeRegistry::getExplicitLayout(const Type *Ty,
+                                     StorageClass::StorageClass sc) const {
+  const TypeLayout layout = ::getExplicitLayout(Ty, getLayoutRules(sc));
+  return {layout.size, layout.align};
+}
+
 SPIRVType *SPIRVTypeRegistry::getOpTypePointer(StorageClass::StorageClass sc,
                                               SPIRVType *elemType,
                                               MachineIRBuilder &MIRBuilder) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypePointer);
-  for (const auto &ty : *tys) {
-    if (ty->getOperand(1).getImm() == sc &&
-        ty->getOperand(2).getReg() == getSPIRVTypeID(elemType)) {
-      return ty;
-    }
-  }
+  TypeKeyBuilder key(SPIRV::OpTypePointer);
+  key.addImm(sc).addType(getSPIRVTypeID(elemType));
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypePointer)
                  .addDef(createTypeVReg(MIRBuilder))
                  .addImm(sc)
                  .addUse(getSPIRVTypeID(elemType));
-  tys->push_back(MIB);
-  return MIB;
+  if (isExplicitlyLaidOut(sc)) {
+    decorateExplicitLayout(*elemType, getLayoutRules(sc), *MIRBuilder.getMRI(),
+                           MIRBuilder);
+  }
+  return addNewType(MIB);
 }
 
 SPIRVType *SPIRVTypeRegistry::getOpTypeFunction(
     SPIRVType *retType, const SmallVectorImpl<SPIRVType *> &argTypes,
     MachineIRBuilder &MIRBuilder) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeFunction);
-  const unsigned numExpectedOps = argTypes.size() + 2;
-  for (const auto &ty : *tys) {
-    if (ty->getNumOperands() == numExpectedOps &&
-        ty->getOperand(1).getReg() == getSPIRVTypeID(retType)) {
-      bool allMatch = true;
-      for (unsigned i = 2; i < numExpectedOps; ++i) {
-        auto arg = argTypes[i - 2];
-        auto op = ty->getOperand(i).getReg();
-        if (getSPIRVTypeID(arg) != op) {
-          allMatch = false;
-          break;
-        }
-      }
-      if (allMatch)
-        return ty;
-    }
+  TypeKeyBuilder key(SPIRV::OpTypeFunction);
+  key.addType(getSPIRVTypeID(retType));
+  for (const auto &argType : argTypes) {
+    key.addType(getSPIRVTypeID(argType));
   }
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeFunction)
                  .addDef(createTypeVReg(MIRBuilder))
                  .addUse(getSPIRVTypeID(retType));
   for (const auto &argType : argTypes) {
     MIB.addUse(getSPIRVTypeID(argType));
   }
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
 }
 
 SPIRVType *SPIRVTypeRegistry::createSPIRVType(const Type *Ty,
@@ -351,11 +743,17 @@ SPIRVType *SPIRVTypeRegistry::createSPIRVType(const Type *Ty,
     return getOpTypeVector(Ty->getVectorNumElements(), el, MIRBuilder);
   } else if (Ty->isArrayTy()) {
     auto *el = getOrCreateSPIRVType(Ty->getArrayElementType(), MIRBuilder);
+    // Zero-length arrays are the unsized arrays ending buffers
+    if (Ty->getArrayNumElements() == 0 && globalIsStorageBuffer) {
+      return getOpTypeRuntimeArray(el, MIRBuilder);
+    }
     return getOpTypeArray(Ty->getArrayNumElements(), el, MIRBuilder);
   } else if (auto stype = dyn_cast<StructType>(Ty)) {
     const StringRef name = stype->hasName() ? stype->getName() : "";
     if (isOpenCLBuiltinType(stype)) {
       return handleOpenCLBuiltin(name, MIRBuilder, this, aq);
+    } else if (isCooperativeMatrixType(stype)) {
+      return handleCooperativeMatrixType(name, MIRBuilder, this);
     } else if (stype->isOpaque()) {
       return getOpTypeOpaque(name, MIRBuilder);
     } else {
@@ -382,6 +780,9 @@ SPIRVType *SPIRVTypeRegistry::createSPIRVType(const Type *Ty,
         const StringRef name = stype->hasName() ? stype->getName() : "";
         return handleOpenCLBuiltin(name, MIRBuilder, this, aq);
       }
+      if (isCooperativeMatrixType(stype)) {
+        return handleCooperativeMatrixType(stype->getName(), MIRBuilder, this);
+      }
     }
 
     // Otherwise, treat it as a regular pointer type
@@ -395,8 +796,8 @@ SPIRVType *SPIRVTypeRegistry::createSPIRVType(const Type *Ty,
 }
 
 SPIRVType *SPIRVTypeRegistry::getSPIRVTypeForVReg(Register VReg) {
-  auto t = VRegToTypeMap.find(VReg);
-  return t == VRegToTypeMap.end() ? nullptr : t->second;
+  const SPIRVTypeInfo *info = getTypeInfoForVReg(VReg);
+  return info ? info->typeInstr : nullptr;
 }
 
 SPIRVType *
@@ -409,12 +810,37 @@ SPIRVTypeRegistry::getOrCreateSPIRVType(const Type *type,
     return SPIRVTypeIt->second;
   } else {
     SPIRVType *spirvType = createSPIRVType(type, MIRBuilder, accessQual);
-    VRegToTypeMap[getSPIRVTypeID(spirvType)] = spirvType;
+    VRegToTypeMap[getSPIRVTypeID(spirvType)] = getTypeInfo(spirvType);
     TypeToSPIRVTypeMap.insert({type, spirvType});
     return spirvType;
   }
 }
 
+// Build the key used to cache constants in a function.
+static SPIRVTypeKey getConstantKey(unsigned opcode, Register typeVReg,
+                                   ArrayRef<int64_t> ops) {
+  SPIRVTypeKey key;
+  key.push_back(opcode);
+  key.push_back(typeVReg);
+  key.append(ops.begin(), ops.end());
+  return key;
+}
+
+Register SPIRVTypeRegistry::findConstant(unsigned opcode,
+                                         const SPIRVType *type,
+                                         ArrayRef<int64_t> ops) const {
+  auto key = getConstantKey(opcode, getSPIRVTypeID(type), ops);
+  auto found = ConstantCache.find(key);
+  return found == ConstantCache.end() ? Register(0) : found->second;
+}
+
+void SPIRVTypeRegistry::addConstant(unsigned opcode, const SPIRVType *type,
+                                    ArrayRef<int64_t> ops,
+                                    Register constVReg) {
+  auto key = getConstantKey(opcode, getSPIRVTypeID(type), ops);
+  ConstantCache.insert({std::move(key), constVReg});
+}
+
 SPIRVType *SPIRVTypeRegistry::getPtrUIntType(MachineIRBuilder &MIRBuilder) {
   return getOpTypeInt(pointerSize, MIRBuilder, false);
 }
@@ -426,54 +852,44 @@ SPIRVType *SPIRVTypeRegistry::getPairStruct(SPIRVType *elem0, SPIRVType *elem1,
 }
 
 bool SPIRVTypeRegistry::isScalarOfType(Register vreg, unsigned int typeOpcode) {
-  SPIRVType *type = getSPIRVTypeForVReg(vreg);
-  assert(type && "isScalarOfType vreg has no type assigned");
-  return type->getOpcode() == typeOpcode;
+  const SPIRVTypeInfo *info = getTypeInfoForVReg(vreg);
+  assert(info && "isScalarOfType vreg has no type assigned");
+  return info->opcode == typeOpcode;
 }
 
 bool SPIRVTypeRegistry::isScalarOrVectorOfType(Register vreg,
                                               unsigned int typeOpcode) {
-  SPIRVType *type = getSPIRVTypeForVReg(vreg);
-  assert(type && "isScalarOrVectorOfType vreg has no type assigned");
-  if (type->getOpcode() == typeOpcode) {
-    return true;
-  } else if (type->getOpcode() == SPIRV::OpTypeVector) {
-    Register scalarTypeVReg = type->getOperand(1).getReg();
-    SPIRVType *scalarType = getSPIRVTypeForVReg(scalarTypeVReg);
-    return scalarType->getOpcode() == typeOpcode;
+  const SPIRVTypeInfo *info = getTypeInfoForVReg(vreg);
+  assert(info && "isScalarOrVectorOfType vreg has no type assigned");
+  if (info->opcode == SPIRV::OpTypeVector && info->elemType) {
+    info = info->elemType;
   }
-  return false;
+  return info->opcode == typeOpcode;
 }
 
 unsigned SPIRVTypeRegistry::getScalarOrVectorBitWidth(const SPIRVType *type) {
-  if (type && type->getOpcode() == SPIRV::OpTypeVector) {
-    auto eleTypeReg = type->getOperand(1).getReg();
-    type = getSPIRVTypeForVReg(eleTypeReg);
-  }
-  if (type && (type->getOpcode() == SPIRV::OpTypeInt ||
-               type->getOpcode() == SPIRV::OpTypeFloat)) {
-    return type->getOperand(1).getImm();
+  if (type && getTypeInfo(type)->scalarWidth) {
+    return getTypeInfo(type)->scalarWidth;
   }
   llvm_unreachable("Attempting to get bit width of non-integer/float type.");
 }
 
 bool SPIRVTypeRegistry::isScalarOrVectorSigned(const SPIRVType *type) {
-  if (type && type->getOpcode() == SPIRV::OpTypeVector) {
-    auto eleTypeReg = type->getOperand(1).getReg();
-    type = getSPIRVTypeForVReg(eleTypeReg);
+  const SPIRVTypeInfo *info = type ? getTypeInfo(type) : nullptr;
+  if (info && info->opcode == SPIRV::OpTypeVector) {
+    info = info->elemType;
   }
-  if (type && type->getOpcode() == SPIRV::OpTypeInt) {
-    return type->getOperand(2).getImm() != 0;
+  if (info && info->opcode == SPIRV::OpTypeInt) {
+    return info->isSigned;
   }
   llvm_unreachable("Attempting to get sign of non-integer type.");
 }
 
 StorageClass::StorageClass
 SPIRVTypeRegistry::getPointerStorageClass(Register vreg) {
-  SPIRVType *type = getSPIRVTypeForVReg(vreg);
-  if (type && type->getOpcode() == SPIRV::OpTypePointer) {
-    auto scOp = type->getOperand(1).getImm();
-    return static_cast<StorageClass::StorageClass>(scOp);
+  const SPIRVTypeInfo *info = getTypeInfoForVReg(vreg);
+  if (info && info->opcode == SPIRV::OpTypePointer) {
+    return info->storageClass;
   }
   llvm_unreachable("Attempting to get storage class of non-pointer type.");
 }
@@ -498,19 +914,17 @@ SPIRVType *SPIRVTypeRegistry::getOpTypeImage(
     uint32_t depth, uint32_t arrayed, uint32_t multisampled, uint32_t sampled,
     ImageFormat::ImageFormat imageFormat, AQ::AccessQualifier accessQualifier) {
 
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeImage);
-  for (const auto &ty : *tys) {
-    if (ty->getOperand(1).getReg() == getSPIRVTypeID(sampledType) &&
-        ty->getOperand(2).getImm() == dim &&
-        ty->getOperand(8).getImm() == accessQualifier &&
-        ty->getOperand(3).getImm() == arrayed &&
-        ty->getOperand(6).getImm() == sampled &&
-        ty->getOperand(5).getImm() == multisampled &&
-        ty->getOperand(3).getImm() == depth &&
-        ty->getOperand(7).getImm() == imageFormat) {
-      return ty;
-    }
-  }
+  TypeKeyBuilder key(SPIRV::OpTypeImage);
+  key.addType(getSPIRVTypeID(sampledType))
+      .addImm(dim)
+      .addImm(depth)
+      .addImm(arrayed)
+      .addImm(multisampled)
+      .addImm(sampled)
+      .addImm(imageFormat)
+      .addImm(accessQualifier);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   Register resVReg = createTypeVReg(MIRBuilder);
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeImage)
                  .addDef(resVReg)
@@ -522,37 +936,86 @@ SPIRVType *SPIRVTypeRegistry::getOpTypeImage(
                  .addImm(sampled)      // Sampled (0 = usage known at runtime)
                  .addImm(imageFormat)
                  .addImm(accessQualifier);
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
 }
 
-
 SPIRVType *SPIRVTypeRegistry::getSamplerType(MachineIRBuilder &MIRBuilder) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeSampler);
-  if (tys->empty()) {
-    Register resVReg = createTypeVReg(MIRBuilder);
-    auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeSampler).addDef(resVReg);
-    constrainRegOperands(MIB);
-    tys->push_back(MIB);
-  }
-  return tys->at(0);
+  TypeKeyBuilder key(SPIRV::OpTypeSampler);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  Register resVReg = createTypeVReg(MIRBuilder);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeSampler).addDef(resVReg);
+  constrainRegOperands(MIB);
+  return addNewType(MIB);
+}
+
+SPIRVType *SPIRVTypeRegistry::getOpTypeEvent(MachineIRBuilder &MIRBuilder) {
+  TypeKeyBuilder key(SPIRV::OpTypeEvent);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  Register resVReg = createTypeVReg(MIRBuilder);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeEvent).addDef(resVReg);
+  constrainRegOperands(MIB);
+  return addNewType(MIB);
+}
+
+SPIRVType *SPIRVTypeRegistry::getOpTypePipe(AQ::AccessQualifier accessQual,
+                                           MachineIRBuilder &MIRBuilder) {
+  TypeKeyBuilder key(SPIRV::OpTypePipe);
+  key.addImm(accessQual);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  Register resVReg = createTypeVReg(MIRBuilder);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypePipe)
+                 .addDef(resVReg)
+                 .addImm(accessQual);
+  constrainRegOperands(MIB);
+  return addNewType(MIB);
+}
+
+SPIRVType *SPIRVTypeRegistry::getOpTypeReserveId(MachineIRBuilder &MIRBuilder) {
+  TypeKeyBuilder key(SPIRV::OpTypeReserveId);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  Register resVReg = createTypeVReg(MIRBuilder);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeReserveId).addDef(resVReg);
+  constrainRegOperands(MIB);
+  return addNewType(MIB);
+}
+
+SPIRVType *SPIRVTypeRegistry::getOpTypeQueue(MachineIRBuilder &MIRBuilder) {
+  TypeKeyBuilder key(SPIRV::OpTypeQueue);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  Register resVReg = createTypeVReg(MIRBuilder);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeQueue).addDef(resVReg);
+  constrainRegOperands(MIB);
+  return addNewType(MIB);
+}
+
+SPIRVType *
+SPIRVTypeRegistry::getOpTypeDeviceEvent(MachineIRBuilder &MIRBuilder) {
+  TypeKeyBuilder key(SPIRV::OpTypeDeviceEvent);
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
+  Register resVReg = createTypeVReg(MIRBuilder);
+  auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeDeviceEvent).addDef(resVReg);
+  constrainRegOperands(MIB);
+  return addNewType(MIB);
 }
 
 SPIRVType *SPIRVTypeRegistry::getSampledImageType(SPIRVType *imageType,
                                                  MachineIRBuilder &MIRBuilder) {
-  auto tys = getExistingTypesForOpcode(SPIRV::OpTypeSampledImage);
-  for (const auto &ty : *tys) {
-    if (ty->getOperand(1).getReg() == getSPIRVTypeID(imageType)) {
-      return ty;
-    }
-  }
+  TypeKeyBuilder key(SPIRV::OpTypeSampledImage);
+  key.addType(getSPIRVTypeID(imageType));
+  if (auto ty = getExistingType(key.getKey()))
+    return ty;
   Register resVReg = createTypeVReg(MIRBuilder);
   auto MIB = MIRBuilder.buildInstr(SPIRV::OpTypeSampledImage)
                  .addDef(resVReg)
                  .addUse(getSPIRVTypeID(imageType));
   constrainRegOperands(MIB);
-  tys->push_back(MIB);
-  return MIB;
+  return addNewType(MIB);
 }
 
 unsigned int
@@ -572,6 +1035,12 @@ SPIRVTypeRegistry::StorageClassToAddressSpace(StorageClass::StorageClass sc) {
     return 4;
   case StorageClass::Input:
     return 5;
+  case StorageClass::StorageBuffer:
+    return 6;
+  case StorageClass::Uniform:
+    return 7;
+  case StorageClass::PushConstant:
+    return 8;
   default:
     errs() << getStorageClassName(sc) << "\n";
     llvm_unreachable("Unable to get address space id");
@@ -586,7 +1055,8 @@ SPIRVTypeRegistry::addressSpaceToStorageClass(unsigned int addressSpace) {
   case 0:
     return StorageClass::Function;
   case 1:
-    return StorageClass::CrossWorkgroup;
+    return globalIsStorageBuffer ? StorageClass::StorageBuffer
+                                 : StorageClass::CrossWorkgroup;
   case 2:
     return StorageClass::UniformConstant;
   case 3:
@@ -595,6 +1065,12 @@ SPIRVTypeRegistry::addressSpaceToStorageClass(unsigned int addressSpace) {
     return StorageClass::Generic;
   case 5:
     return StorageClass::Input;
+  case 6:
+    return StorageClass::StorageBuffer;
+  case 7:
+    return StorageClass::Uniform;
+  case 8:
+    return StorageClass::PushConstant;
   default:
     llvm_unreachable("Unknown address space");
   }
@@ -8,71 +8,234 @@
 //
 // SPIRVTypeRegistry is used to maintain rich type information required for
 // SPIR-V even after lowering from LLVM IR to GMIR. It can convert an llvm::Type
-// into an OpTypeXXX instruction, and map it to a virtual register using and
-// ASSIGN_TYPE pseudo instruction.
+// into an OpTypeXXX instruction, and map it to a virtual register in a side
+// table.
 //
-// Passes requiring type info can reconstruct the vreg->OpTypeXXX mapping
-// by calling rebuildTypeTablesForFunction(MF) at the start. They must also
-// call reset() when the function ends to avoid maintaining invalid state
-// between function passes.
+// The side table, like the rest of the function-local state, belongs to the
+// function the IRTranslator last started with startFunction(MF). It is kept
+// as the legalizer and instruction selector, which run on that function in
+// turn, type the vregs they create, and passes using it check it belongs to
+// their function with checkFunction(MF). The instruction selector calls
+// reset() once the function is selected.
 //
 // Type info from this class can only be used before it gets stripped out by the
 // InstructionSelector stage. All type info is function-local until the final
 // SPIRVGlobalTypesAndRegNums pass hoists it globally and deduplicates it all.
 //
+// Every OpTypeXXX instruction the registry creates is also interned by its
+// structure into a module-wide type ID, which survives reset(). The final
+// hoisting pass uses these IDs to merge identical types across functions
+// directly, and calls resetModuleTypes() once the module is finished.
+//
+// Alongside each OpTypeXXX instruction, the registry keeps a SPIRVTypeInfo
+// summarizing the properties most type queries need, so they are answered by
+// loading a field rather than decoding the instruction's operands and looking
+// up its element type again.
+//
 //===----------------------------------------------------------------------===//
 
 #ifndef LLVM_LIB_TARGET_SPIRV_SPIRVTYPEMANAGER_H
 #define LLVM_LIB_TARGET_SPIRV_SPIRVTYPEMANAGER_H
 
 #include "SPIRVEnums.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
+#include "llvm/Support/Allocator.h"
+#include <string>
+#include <vector>
 
 namespace AQ = AccessQualifier;
 
 namespace llvm {
 using SPIRVType = const MachineInstr;
 
+// A complete SPIR-V binary holding a single entry point of a module, and only
+// the functions, types, constants and variables it can reach.
+struct SPIRVEntryPointImage {
+  // The name the entry point is declared with.
+  std::string Name;
+  // The words of the binary, starting with its header.
+  std::vector<uint32_t> Words;
+};
+
+// The properties of an OpTypeXXX instruction needed by most type queries.
+struct SPIRVTypeInfo {
+  SPIRVType *typeInstr;
+  // The VReg holding the result of typeInstr.
+  Register id;
+  unsigned opcode;
+  // Bitwidth of an int or float, or of the elements of a vector of them.
+  unsigned scalarWidth;
+  // Signedness of an int, or of the elements of a vector of them.
+  bool isSigned;
+  // Number of elements of a vector.
+  unsigned numElements;
+  // Element type of a vector or pointer, if known.
+  const SPIRVTypeInfo *elemType;
+  // Storage class of a pointer.
+  StorageClass::StorageClass storageClass;
+};
+
+// Function-independent structural description of a SPIR-V type: the opcode,
+// then a (kind, value) pair for each operand, where operands referring to other
+// types use their module-wide type IDs, and constants use their values.
+using SPIRVTypeKey = SmallVector<int64_t, 8>;
+
+struct SPIRVTypeKeyInfo {
+  static inline SPIRVTypeKey getEmptyKey() { return {-1}; }
+  static inline SPIRVTypeKey getTombstoneKey() { return {-2}; }
+  static unsigned getHashValue(const SPIRVTypeKey &key) {
+    return hash_combine_range(key.begin(), key.end());
+  }
+  static bool isEqual(const SPIRVTypeKey &lhs, const SPIRVTypeKey &rhs) {
+    return lhs == rhs;
+  }
+};
+
 class SPIRVTypeRegistry {
 
 private:
   // Registers holding values which have types associated with them.
-  // Initialized upon VReg definition in IRTranslator.
-  // Reconstituted from ASSIGN_TYPE machineInstrs in subsequent passes.
-  DenseMap<Register, SPIRVType *> VRegToTypeMap;
+  // Initialized upon VReg definition in IRTranslator, and extended by the
+  // later GlobalISel passes creating vregs.
+  DenseMap<Register, const SPIRVTypeInfo *> VRegToTypeMap;
+
+  // The function the function-local state belongs to.
+  const MachineFunction *TypedMF = nullptr;
+
+  // The info of each OpTypeXXX instr in the function, allocated in the arena.
+  DenseMap<const SPIRVType *, const SPIRVTypeInfo *> TypeInfos;
+  SpecificBumpPtrAllocator<SPIRVTypeInfo> TypeInfoAllocator;
 
   // Maps LLVM IR types to SPIR-V types (only used in IRTranslator pass)
   DenseMap<const Type *, SPIRVType *> TypeToSPIRVTypeMap;
 
-  // Maps OpTypeXXX opcode to a list of OpTypeXXX instrs (for deduplication).
-  DenseMap<unsigned, std::vector<SPIRVType *> *> OpcodeToSPIRVTypeMap;
+  // Maps the function-local structure of each OpTypeXXX instr (opcode, then
+  // its immediates, operand type VRegs and constant values) to the instr, so
+  // existing types can be found in constant time (for deduplication).
+  DenseMap<SPIRVTypeKey, SPIRVType *, SPIRVTypeKeyInfo> LocalTypeMap;
+
+  // Maps the structure of every type created in the module to a unique
+  // module-wide type ID. Not cleared by reset().
+  DenseMap<SPIRVTypeKey, unsigned, SPIRVTypeKeyInfo> ModuleTypeIDs;
+
+  // Maps each OpTypeXXX instr created in any function of the module to the
+  // module-wide ID of its type. Not cleared by reset().
+  DenseMap<const MachineInstr *, unsigned> TypeInstrToModuleTypeID;
+
+  // The external functions a declaration was already built for in some
+  // function of the module. Not cleared by reset().
+  DenseSet<const Function *> DeclaredExternalFuncs;
+
+  // The global variable each global OpVariable created in any function of the
+  // module declares. Not cleared by reset().
+  DenseMap<const MachineInstr *, const GlobalVariable *> GlobalVarInstrs;
+
+  // The words of the function bodies SPIRVGlobalTypesAndRegNum encoded once
+  // their IDs were final, and one more than the largest ID they refer to.
+  // Taken by the AsmPrinter, which emits them after the global instructions.
+  std::vector<uint32_t> EncodedFunctionWords;
+  unsigned EncodedFunctionsIDBound = 0;
+
+  // Whether SPIRVGlobalTypesAndRegNum should also build a binary for each entry
+  // point of the module, and the binaries it built.
+  bool BuildEntryPointImages = false;
+  std::vector<SPIRVEntryPointImage> EntryPointImages;
+
+  // Maps the opcode, type VReg and operands of each constant built during
+  // instruction selection to its VReg, so it can be reused in the function.
+  DenseMap<SPIRVTypeKey, Register, SPIRVTypeKeyInfo> ConstantCache;
 
   // Number of bits pointers and size_t integers require.
   const unsigned int pointerSize;
 
+  // Whether the global address space is StorageBuffer memory rather than
+  // CrossWorkgroup, as Vulkan has no CrossWorkgroup storage.
+  const bool globalIsStorageBuffer;
+
   // Add a new OpTypeXXX instruction without checking for duplicates
   SPIRVType *createSPIRVType(const Type *type, MachineIRBuilder &MIRBuilder,
                              AQ::AccessQualifier accessQual = AQ::ReadWrite);
 
+  // Record a newly built or rediscovered OpTypeXXX instruction in the
+  // function-local tables and intern its structure into a module-wide type ID.
+  SPIRVType *addNewType(SPIRVType *spirvType);
+
+  // Build the SPIRVTypeInfo of a new OpTypeXXX instruction.
+  const SPIRVTypeInfo *createTypeInfo(SPIRVType *spirvType,
+                                      const MachineRegisterInfo &MRI);
+
+  // Return the existing OpTypeXXX instr with the given function-local key, or
+  // nullptr if no such type exists yet.
+  SPIRVType *getExistingType(const SPIRVTypeKey &key) const;
+
 public:
-  SPIRVTypeRegistry(unsigned int pointerSize);
+  SPIRVTypeRegistry(unsigned int pointerSize, bool globalIsStorageBuffer);
+
+  // Drop the function-local state of the previous function, and start that
+  // of MF. Run by the IRTranslator.
+  void startFunction(const MachineFunction &MF);
 
-  // Run at the start of any pass requiring this to read all ASSIGN_TYPE
-  // instructions to rebuild the VReg -> Type map.
-  void rebuildTypeTablesForFunction(MachineFunction &MF);
+  // Check the function-local state is that of MF, as the GlobalISel passes
+  // after the IRTranslator must run on each function in turn.
+  void checkFunction(const MachineFunction &MF) const;
 
-  // Erase the VReg -> Type map and any other internal state.
-  // Call after every function pass using this type system.
+  // Erase the VReg -> Type map and any other function-local state.
+  // Call once instruction selection no longer needs the types.
   void reset();
 
+  // Erase all module-wide type IDs, declared external functions and global
+  // variables. Call once the module has been hoisted.
+  void resetModuleTypes();
+
+  // Record that a declaration of the external function F is being built, and
+  // return false if one was already built for it in the module, so each
+  // external function is only declared once however often it's called.
+  bool addExternalFunctionDecl(const Function *F);
+
+  // Record that the given OpVariable declares GV, so the OpVariables each
+  // function builds for it can be merged whatever names and decorations they
+  // have.
+  void addGlobalVariable(const MachineInstr *varInstr,
+                         const GlobalVariable *GV);
+
+  // Return the global variable the given OpVariable declares, or nullptr if
+  // it wasn't built for one.
+  const GlobalVariable *getGlobalVariable(const MachineInstr *varInstr) const;
+
+  // Hold the encoded function bodies of the module until they're emitted.
+  void setEncodedFunctions(std::vector<uint32_t> &&words, unsigned idBound);
+
+  // Take the encoded function bodies, which are empty unless
+  // SPIRVGlobalTypesAndRegNum encoded them, setting idBound to their ID bound.
+  std::vector<uint32_t> takeEncodedFunctions(unsigned &idBound);
+
+  // Ask SPIRVGlobalTypesAndRegNum to build a binary for each entry point of
+  // the modules it finishes from now on, alongside the whole module.
+  void setBuildEntryPointImages(bool build) { BuildEntryPointImages = build; }
+  bool shouldBuildEntryPointImages() const { return BuildEntryPointImages; }
+
+  // Hold the binaries built for each entry point until they're taken.
+  void setEntryPointImages(std::vector<SPIRVEntryPointImage> &&images);
+
+  // Take the binaries built for each entry point of the last module, in the
+  // order of its OpEntryPoints.
+  std::vector<SPIRVEntryPointImage> takeEntryPointImages();
+
+  // Return the module-wide ID of the given OpTypeXXX instruction's type, or
+  // None if it was not created by this registry. Instructions with the same ID
+  // are structurally identical, even when they belong to different functions.
+  Optional<unsigned> getModuleTypeID(const SPIRVType *spirvType) const;
+
   // Get or create a SPIR-V type corresponding the given LLVM IR type,
-  // and map it to the given VReg by creating an ASSIGN_TYPE instruction.
+  // and map it to the given VReg.
   SPIRVType *assignTypeToVReg(const Type *type, Register VReg,
                               MachineIRBuilder &MIRBuilder,
                               AQ::AccessQualifier accessQual = AQ::ReadWrite);
 
   // In cases where the SPIR-V type is already known, this function can be
-  // used to map it to the given VReg via an ASSIGN_TYPE instruction.
+  // used to map it to the given VReg.
   void assignSPIRVTypeToVReg(SPIRVType *type, Register VReg,
                              MachineIRBuilder &MIRBuilder);
 
@@ -86,6 +249,20 @@ public:
   // nullptr if no such type instruction exists.
   SPIRVType *getSPIRVTypeForVReg(Register VReg);
 
+  // Return the info of the SPIR-V type mapped to the given VReg, or nullptr if
+  // it has no type.
+  const SPIRVTypeInfo *getTypeInfoForVReg(Register VReg) const {
+    auto t = VRegToTypeMap.find(VReg);
+    return t == VRegToTypeMap.end() ? nullptr : t->second;
+  }
+
+  // Return the info of an OpTypeXXX instruction created by this registry.
+  const SPIRVTypeInfo *getTypeInfo(const SPIRVType *spirvType) const {
+    auto info = TypeInfos.find(spirvType);
+    assert(info != TypeInfos.end() && "Type not created by the registry");
+    return info->second;
+  }
+
   // Whether the given VReg has a SPIR-V type mapped to it yet.
   bool hasSPIRVTypeForVReg(Register VReg) {
     return getSPIRVTypeForVReg(VReg) != nullptr;
@@ -122,9 +299,34 @@ public:
   SPIRVType *getGenericPtrType(SPIRVType *origPtrType,
                                MachineIRBuilder &MIRBuilder);
 
+  // Return the VReg of a constant built earlier in the function with the given
+  // opcode, type and immediate or VReg operands, or 0 if there isn't one.
+  Register findConstant(unsigned opcode, const SPIRVType *type,
+                        ArrayRef<int64_t> ops) const;
+
+  // Record a newly built constant so identical constants can reuse its VReg.
+  void addConstant(unsigned opcode, const SPIRVType *type,
+                   ArrayRef<int64_t> ops, Register constVReg);
+
   // Get or create an OpTypeSampler instruction.
   SPIRVType *getSamplerType(MachineIRBuilder &MIRBuilder);
 
+  // Get or create an OpTypeEvent instruction.
+  SPIRVType *getOpTypeEvent(MachineIRBuilder &MIRBuilder);
+
+  // Get or create an OpTypePipe instruction with the given access qualifier.
+  SPIRVType *getOpTypePipe(AQ::AccessQualifier accessQual,
+                           MachineIRBuilder &MIRBuilder);
+
+  // Get or create an OpTypeReserveId instruction.
+  SPIRVType *getOpTypeReserveId(MachineIRBuilder &MIRBuilder);
+
+  // Get or create an OpTypeQueue instruction.
+  SPIRVType *getOpTypeQueue(MachineIRBuilder &MIRBuilder);
+
+  // Get or create an OpTypeDeviceEvent instruction.
+  SPIRVType *getOpTypeDeviceEvent(MachineIRBuilder &MIRBuilder);
+
   // Get or create an OpTypeSampledImage of for the given image type.
   SPIRVType *getSampledImageType(SPIRVType *imageType,
                                  MachineIRBuilder &MIRBuilder);
@@ -144,6 +346,16 @@ public:
   SPIRVType *getOpTypeArray(uint32_t numElems, SPIRVType *elemType,
                             MachineIRBuilder &MIRBuilder);
 
+  SPIRVType *getOpTypeRuntimeArray(SPIRVType *elemType,
+                                   MachineIRBuilder &MIRBuilder);
+
+  // Get or create an OpTypeCooperativeMatrixNV of rows x cols components,
+  // shared by the invocations of the given scope.
+  SPIRVType *getOpTypeCooperativeMatrixNV(SPIRVType *compType,
+                                          Scope::Scope scope, uint32_t rows,
+                                          uint32_t cols,
+                                          MachineIRBuilder &MIRBuilder);
+
   SPIRVType *getOpTypeOpaque(const StringRef name,
                              MachineIRBuilder &MIRBuilder);
 
@@ -173,7 +385,10 @@ public:
                             ImageFormat::ImageFormat imageFormat,
                             AQ::AccessQualifier accessQualifier);
 
-  std::vector<SPIRVType *> *getExistingTypesForOpcode(unsigned opcode);
+  // Get the size and base alignment of an LLVM IR type in a buffer of the
+  // given storage class, as laid out by the decorations of its SPIR-V type.
+  std::pair<uint64_t, uint64_t>
+  getExplicitLayout(const Type *Ty, StorageClass::StorageClass sc) const;
 
   // Convert a SPIR-V storage class to the corresponding LLVM IR address space.
   unsigned int StorageClassToAddressSpace(StorageClass::StorageClass sc);
@@ -0,0 +1,692 @@
+//===-- SPIRVVectorCombine.cpp - Combine vector arithmetic ------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Peephole optimizations run on the selected SPIR-V instructions, replacing
+// vector arithmetic built from several instructions with the single
+// instruction SPIR-V has for it:
+// - A chain of OpCompositeInserts into OpUndef writing every component of a
+//   vector becomes one OpCompositeConstruct.
+// - A chain of OpCompositeInserts of components extracted from at most two
+//   vectors, such as a swizzle, becomes one OpVectorShuffle.
+// - An OpFMul of a vector by a splatted scalar becomes OpVectorTimesScalar.
+// - Adding together every component of an OpFMul of two vectors becomes an
+//   OpDot, if all the adds allow reassociation.
+// - Adding together the products of the widened components of two integer
+//   vectors becomes an OpSDot, OpUDot or OpSUDot, if the
+//   SPV_KHR_integer_dot_product extension is available. Quantized inference
+//   kernels do this, e.g. with the products of two char4 vectors as ints.
+//
+// This runs after instruction selection, once the operands of every
+// instruction are explicitly typed, so the combines only need to match SPIR-V
+// instructions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SPIRV.h"
+#include "SPIRVEnums.h"
+#include "SPIRVInstrInfo.h"
+#include "SPIRVSubtarget.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/GlobalISel/MachineIRBuilder.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+
+using namespace llvm;
+using namespace SPIRV;
+
+#define DEBUG_TYPE "spirv-vector-combine"
+
+STATISTIC(NumCompositeConstructs, "Number of insert chains combined");
+STATISTIC(NumVectorShuffles, "Number of swizzle chains combined");
+STATISTIC(NumVectorTimesScalars, "Number of OpVectorTimesScalars formed");
+STATISTIC(NumDots, "Number of OpDots formed");
+STATISTIC(NumIntegerDots, "Number of integer dot products formed");
+
+namespace {
+class SPIRVVectorCombine : public MachineFunctionPass {
+public:
+  static char ID;
+  SPIRVVectorCombine() : MachineFunctionPass(ID) {
+    initializeSPIRVVectorCombinePass(*PassRegistry::getPassRegistry());
+  }
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+private:
+  MachineRegisterInfo *MRI;
+  const SPIRVInstrInfo *TII;
+  const SPIRVSubtarget *ST;
+  // Instructions erased so far, so they're skipped if visited later
+  SmallPtrSet<const MachineInstr *, 16> Erased;
+
+  bool hasFastMathMode(Register reg, uint32_t flag) const;
+  void eraseAnnotations(Register reg, bool arithmeticOnly);
+  void eraseIfDead(MachineInstr *MI);
+  unsigned getNumComponents(Register typeReg) const;
+  Register getSplatScalar(Register vec) const;
+  MachineInstr *replaceInstr(MachineInstr &MI, unsigned newOpcode,
+                             ArrayRef<Register> ops);
+
+  bool combineInsertChain(MachineInstr &MI);
+  bool combineShuffleChain(MachineInstr &MI, ArrayRef<Register> components,
+                           Register base, bool baseIsUndef,
+                           MachineInstr *oldBase);
+  bool combineVectorTimesScalar(MachineInstr &MI);
+  bool getAddTreeLeaves(const MachineInstr &MI,
+                        SmallVectorImpl<const MachineInstr *> &leaves) const;
+  MachineInstr *getReducedProduct(ArrayRef<const MachineInstr *> leaves,
+                                  unsigned mulOpcode) const;
+  void replaceWithDot(MachineInstr &MI, unsigned dotOpcode, Register vec1,
+                      Register vec2);
+  bool combineDot(MachineInstr &MI);
+  unsigned getIntWidth(Register typeReg) const;
+  Register getWidenedSource(Register reg, bool &isSigned) const;
+  bool getWidenedDotOperands(ArrayRef<const MachineInstr *> leaves,
+                             Register vecs[2], bool isSigned[2]) const;
+  bool combineIntegerDot(MachineInstr &MI);
+};
+} // namespace
+
+// Whether reg is decorated with an FPFastMathMode including the given flag.
+bool SPIRVVectorCombine::hasFastMathMode(Register reg, uint32_t flag) const {
+  for (const auto &use : MRI->use_nodbg_instructions(reg)) {
+    if (use.getOpcode() == OpDecorate &&
+        use.getOperand(1).getImm() == Decoration::FPFastMathMode &&
+        (use.getOperand(2).getImm() & flag)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether the decoration only applies to the arithmetic instructions defining
+// the decorated result.
+static bool isArithmeticDecoration(int64_t dec) {
+  return dec == Decoration::FPFastMathMode || dec == Decoration::NoSignedWrap ||
+         dec == Decoration::NoUnsignedWrap;
+}
+
+// Remove the names and decorations of reg, or only its FPFastMathMode and
+// wrap decorations if the new instruction defining it can't have them.
+void SPIRVVectorCombine::eraseAnnotations(Register reg, bool arithmeticOnly) {
+  if (!arithmeticOnly) {
+    TII->eraseAnnotations(reg, *MRI, &Erased);
+    return;
+  }
+  for (auto &use : make_early_inc_range(MRI->use_nodbg_instructions(reg))) {
+    if (use.getOpcode() == OpDecorate &&
+        isArithmeticDecoration(use.getOperand(1).getImm())) {
+      Erased.insert(&use);
+      use.eraseFromParent();
+    }
+  }
+}
+
+// Erase an instruction of the kinds the combines leave behind if nothing but
+// annotations use its result, and then any operands which become dead too.
+void SPIRVVectorCombine::eraseIfDead(MachineInstr *MI) {
+  switch (MI->getOpcode()) {
+  case OpCompositeInsert:
+  case OpCompositeExtract:
+  case OpVectorShuffle:
+  case OpFMul:
+  case OpFAdd:
+  case OpIMul:
+  case OpIAdd:
+  case OpSConvert:
+  case OpUConvert:
+    break;
+  default:
+    return;
+  }
+  Register def = MI->getOperand(0).getReg();
+  if (TII->getNumRealUses(def, *MRI) != 0) {
+    return;
+  }
+  eraseAnnotations(def, false);
+  SmallVector<MachineInstr *, 4> opDefs;
+  for (const auto &op : MI->explicit_uses()) {
+    if (op.isReg()) {
+      if (MachineInstr *opDef = MRI->getVRegDef(op.getReg())) {
+        opDefs.push_back(opDef);
+      }
+    }
+  }
+  Erased.insert(MI);
+  MI->eraseFromParent();
+  for (MachineInstr *opDef : opDefs) {
+    if (!Erased.count(opDef)) {
+      eraseIfDead(opDef);
+    }
+  }
+}
+
+// Get the number of components of the OpTypeVector with the given vreg, or 0
+// if it isn't a vector type.
+unsigned SPIRVVectorCombine::getNumComponents(Register typeReg) const {
+  const MachineInstr *typeDef = MRI->getVRegDef(typeReg);
+  if (!typeDef || typeDef->getOpcode() != OpTypeVector) {
+    return 0;
+  }
+  return typeDef->getOperand(2).getImm();
+}
+
+// Get the scalar in every component of the given vector, if it's built as a
+// splat by an OpCompositeConstruct of one value, or an OpVectorShuffle of one
+// component of an OpCompositeConstruct or OpCompositeInsert.
+Register SPIRVVectorCombine::getSplatScalar(Register vec) const {
+  const MachineInstr *def = MRI->getVRegDef(vec);
+  if (!def) {
+    return Register();
+  }
+  if (def->getOpcode() == OpCompositeConstruct) {
+    Register scalar = def->getOperand(2).getReg();
+    for (unsigned i = 3; i < def->getNumOperands(); ++i) {
+      if (def->getOperand(i).getReg() != scalar) {
+        return Register();
+      }
+    }
+    return scalar;
+  }
+  if (def->getOpcode() != OpVectorShuffle || def->getNumOperands() < 5) {
+    return Register();
+  }
+
+  // Every component must come from the same component of the inputs
+  int64_t idx = def->getOperand(4).getImm();
+  for (unsigned i = 5; i < def->getNumOperands(); ++i) {
+    if (def->getOperand(i).getImm() != idx) {
+      return Register();
+    }
+  }
+  const MachineInstr *srcDef = MRI->getVRegDef(def->getOperand(2).getReg());
+  if (!srcDef || srcDef->getNumOperands() < 2) {
+    return Register();
+  }
+  unsigned srcComponents = getNumComponents(srcDef->getOperand(1).getReg());
+  if (idx < 0 || srcComponents == 0) {
+    return Register();
+  }
+  if (idx >= srcComponents) {
+    idx -= srcComponents;
+    srcDef = MRI->getVRegDef(def->getOperand(3).getReg());
+  }
+
+  // Find the last write of the component
+  while (srcDef && srcDef->getOpcode() == OpCompositeInsert &&
+         srcDef->getNumOperands() == 5) {
+    if (srcDef->getOperand(4).getImm() == idx) {
+      return srcDef->getOperand(2).getReg();
+    }
+    srcDef = MRI->getVRegDef(srcDef->getOperand(3).getReg());
+  }
+  if (srcDef && srcDef->getOpcode() == OpCompositeConstruct &&
+      srcDef->getNumOperands() == srcComponents + 2) {
+    return srcDef->getOperand(idx + 2).getReg();
+  }
+  return Register();
+}
+
+// Build an instruction with the given opcode and operands in place of MI,
+// defining the same result with the same type, and erase MI.
+MachineInstr *SPIRVVectorCombine::replaceInstr(MachineInstr &MI,
+                                               unsigned newOpcode,
+                                               ArrayRef<Register> ops) {
+  MachineIRBuilder MIRBuilder(MI);
+  auto MIB = MIRBuilder.buildInstr(newOpcode)
+                 .addDef(MI.getOperand(0).getReg())
+                 .addUse(MI.getOperand(1).getReg());
+  for (Register op : ops) {
+    MIB.addUse(op);
+  }
+  Erased.insert(&MI);
+  MI.eraseFromParent();
+  return MIB;
+}
+
+bool SPIRVVectorCombine::combineInsertChain(MachineInstr &MI) {
+  Register res = MI.getOperand(0).getReg();
+  Register resTy = MI.getOperand(1).getReg();
+  unsigned numComponents = getNumComponents(resTy);
+  if (numComponents == 0) {
+    return false;
+  }
+  // Only start from the end of a chain
+  for (const auto &use : MRI->use_nodbg_instructions(res)) {
+    if (use.getOpcode() == OpCompositeInsert &&
+        use.getOperand(3).getReg() == res) {
+      return false;
+    }
+  }
+
+  SmallVector<Register, 4> components(numComponents);
+  unsigned numWritten = 0;
+  const MachineInstr *cur = &MI;
+  Register base;
+  while (cur->getOpcode() == OpCompositeInsert && cur->getNumOperands() == 5) {
+    int64_t idx = cur->getOperand(4).getImm();
+    if (idx < 0 || idx >= numComponents) {
+      return false;
+    }
+    // Later inserts overwrite earlier ones
+    if (!components[idx].isValid()) {
+      components[idx] = cur->getOperand(2).getReg();
+      ++numWritten;
+    }
+    base = cur->getOperand(3).getReg();
+    cur = MRI->getVRegDef(base);
+    if (!cur || (cur->getOpcode() == OpCompositeInsert &&
+                 TII->getNumRealUses(base, *MRI) != 1)) {
+      return false;
+    }
+  }
+
+  MachineInstr *oldBase = MRI->getVRegDef(MI.getOperand(3).getReg());
+  if (cur->getOpcode() == OpUndef && numWritten == numComponents) {
+    replaceInstr(MI, OpCompositeConstruct, components);
+    eraseIfDead(oldBase);
+    ++NumCompositeConstructs;
+    return true;
+  }
+  return combineShuffleChain(MI, components, base,
+                             cur->getOpcode() == OpUndef, oldBase);
+}
+
+// Replace the end MI of a chain of inserts into base with an OpVectorShuffle,
+// if every inserted component is extracted from base or from a single other
+// vector with the same component type.
+bool SPIRVVectorCombine::combineShuffleChain(MachineInstr &MI,
+                                             ArrayRef<Register> components,
+                                             Register base, bool baseIsUndef,
+                                             MachineInstr *oldBase) {
+  Register resTy = MI.getOperand(1).getReg();
+  Register elemTy = MRI->getVRegDef(resTy)->getOperand(1).getReg();
+  unsigned numBaseComponents = components.size();
+  Register src;
+  SmallVector<int64_t, 4> mask;
+  for (unsigned i = 0; i < components.size(); ++i) {
+    if (!components[i].isValid()) {
+      // Undefined components can take any value
+      mask.push_back(baseIsUndef ? 0xFFFFFFFF : i);
+      continue;
+    }
+    const MachineInstr *extract = MRI->getVRegDef(components[i]);
+    if (!extract || extract->getOpcode() != OpCompositeExtract ||
+        extract->getNumOperands() != 4) {
+      return false;
+    }
+    Register vec = extract->getOperand(2).getReg();
+    int64_t idx = extract->getOperand(3).getImm();
+    if (!baseIsUndef && vec == base) {
+      mask.push_back(idx);
+      continue;
+    }
+    if (src.isValid() && vec != src) {
+      return false;
+    }
+    if (!src.isValid()) {
+      const MachineInstr *vecDef = MRI->getVRegDef(vec);
+      if (!vecDef || vecDef->getNumOperands() < 2) {
+        return false;
+      }
+      Register vecTy = vecDef->getOperand(1).getReg();
+      if (getNumComponents(vecTy) == 0 ||
+          MRI->getVRegDef(vecTy)->getOperand(1).getReg() != elemTy) {
+        return false;
+      }
+      src = vec;
+    }
+    // With an undefined base, the source is shuffled with itself
+    mask.push_back(baseIsUndef ? idx : numBaseComponents + idx);
+  }
+  if (!src.isValid()) {
+    if (baseIsUndef) {
+      return false;
+    }
+    src = base;
+  }
+
+  SmallVector<MachineInstr *, 4> oldOps = {oldBase};
+  oldOps.push_back(MRI->getVRegDef(MI.getOperand(2).getReg()));
+  MachineInstr *shuffle =
+      replaceInstr(MI, OpVectorShuffle, {baseIsUndef ? src : base, src});
+  MachineInstrBuilder MIB(*shuffle->getMF(), shuffle);
+  for (int64_t idx : mask) {
+    MIB.addImm(idx);
+  }
+  for (MachineInstr *op : oldOps) {
+    if (op && !Erased.count(op)) {
+      eraseIfDead(op);
+    }
+  }
+  ++NumVectorShuffles;
+  return true;
+}
+
+bool SPIRVVectorCombine::combineVectorTimesScalar(MachineInstr &MI) {
+  if (getNumComponents(MI.getOperand(1).getReg()) == 0) {
+    return false;
+  }
+  Register lhs = MI.getOperand(2).getReg();
+  Register rhs = MI.getOperand(3).getReg();
+  Register scalar = getSplatScalar(rhs);
+  Register vec = lhs;
+  if (!scalar.isValid()) {
+    scalar = getSplatScalar(lhs);
+    vec = rhs;
+  }
+  if (!scalar.isValid()) {
+    return false;
+  }
+
+  MachineInstr *splat = MRI->getVRegDef(vec == lhs ? rhs : lhs);
+  Register res = MI.getOperand(0).getReg();
+  replaceInstr(MI, OpVectorTimesScalar, {vec, scalar});
+  eraseAnnotations(res, true);
+  eraseIfDead(splat);
+  ++NumVectorTimesScalars;
+  return true;
+}
+
+// Collect the leaves of the tree of adds rooted at MI, i.e. the instructions
+// defining its operands which aren't adds of the same kind themselves. The
+// dot products don't add the products in any particular order, so float adds
+// must allow reassociation, while integer adds wrap and always do.
+bool SPIRVVectorCombine::getAddTreeLeaves(
+    const MachineInstr &MI,
+    SmallVectorImpl<const MachineInstr *> &leaves) const {
+  const unsigned addOpcode = MI.getOpcode();
+  SmallVector<const MachineInstr *, 8> worklist = {&MI};
+  while (!worklist.empty()) {
+    const MachineInstr *add = worklist.pop_back_val();
+    if (addOpcode == OpFAdd &&
+        !hasFastMathMode(add->getOperand(0).getReg(), FPFastMathMode::Fast)) {
+      return false;
+    }
+    for (unsigned i = 2; i <= 3; ++i) {
+      Register op = add->getOperand(i).getReg();
+      const MachineInstr *opDef = MRI->getVRegDef(op);
+      if (!opDef || TII->getNumRealUses(op, *MRI) != 1) {
+        return false;
+      }
+      if (opDef->getOpcode() == addOpcode) {
+        worklist.push_back(opDef);
+      } else {
+        leaves.push_back(opDef);
+      }
+    }
+  }
+  return true;
+}
+
+// Get the vector multiply with the given opcode whose every component is
+// extracted once by the leaves, and used nowhere else, or null.
+MachineInstr *
+SPIRVVectorCombine::getReducedProduct(ArrayRef<const MachineInstr *> leaves,
+                                      unsigned mulOpcode) const {
+  Register product;
+  SmallVector<bool, 4> extracted;
+  for (const MachineInstr *leaf : leaves) {
+    if (leaf->getOpcode() != OpCompositeExtract || leaf->getNumOperands() != 4)
+      return nullptr;
+    Register vec = leaf->getOperand(2).getReg();
+    if (!product.isValid()) {
+      product = vec;
+      const MachineInstr *mul = MRI->getVRegDef(vec);
+      if (!mul || mul->getOpcode() != mulOpcode) {
+        return nullptr;
+      }
+      extracted.resize(getNumComponents(mul->getOperand(1).getReg()));
+    }
+    int64_t idx = leaf->getOperand(3).getImm();
+    if (vec != product || idx < 0 || idx >= (int64_t)extracted.size() ||
+        extracted[idx]) {
+      return nullptr;
+    }
+    extracted[idx] = true;
+  }
+  if (extracted.empty() || leaves.size() != extracted.size() ||
+      TII->getNumRealUses(product, *MRI) != extracted.size()) {
+    return nullptr;
+  }
+  return MRI->getVRegDef(product);
+}
+
+// Replace the root MI of a tree of adds with a dot product of the two vectors,
+// and erase the instructions it no longer needs.
+void SPIRVVectorCombine::replaceWithDot(MachineInstr &MI, unsigned dotOpcode,
+                                        Register vec1, Register vec2) {
+  SmallVector<MachineInstr *, 4> oldOps;
+  for (unsigned i = 2; i <= 3; ++i) {
+    oldOps.push_back(MRI->getVRegDef(MI.getOperand(i).getReg()));
+  }
+  Register res = MI.getOperand(0).getReg();
+  replaceInstr(MI, dotOpcode, {vec1, vec2});
+  eraseAnnotations(res, true);
+  for (MachineInstr *op : oldOps) {
+    if (!Erased.count(op)) {
+      eraseIfDead(op);
+    }
+  }
+}
+
+bool SPIRVVectorCombine::combineDot(MachineInstr &MI) {
+  const MachineInstr *resTy = MRI->getVRegDef(MI.getOperand(1).getReg());
+  if (!resTy || resTy->getOpcode() != OpTypeFloat) {
+    return false;
+  }
+  SmallVector<const MachineInstr *, 8> leaves;
+  if (!getAddTreeLeaves(MI, leaves)) {
+    return false;
+  }
+  MachineInstr *mul = getReducedProduct(leaves, OpFMul);
+  if (!mul) {
+    return false;
+  }
+  replaceWithDot(MI, OpDot, mul->getOperand(2).getReg(),
+                 mul->getOperand(3).getReg());
+  ++NumDots;
+  return true;
+}
+
+// Get the integer width of the given scalar type or vector component type, or
+// 0 if it isn't an integer type.
+unsigned SPIRVVectorCombine::getIntWidth(Register typeReg) const {
+  const MachineInstr *type = MRI->getVRegDef(typeReg);
+  if (type && type->getOpcode() == OpTypeVector) {
+    type = MRI->getVRegDef(type->getOperand(1).getReg());
+  }
+  if (!type || type->getOpcode() != OpTypeInt) {
+    return 0;
+  }
+  return type->getOperand(1).getImm();
+}
+
+// Get the value an OpSConvert or OpUConvert widens into reg, and whether it's
+// sign extended.
+Register SPIRVVectorCombine::getWidenedSource(Register reg,
+                                              bool &isSigned) const {
+  const MachineInstr *convert = MRI->getVRegDef(reg);
+  if (!convert || (convert->getOpcode() != OpSConvert &&
+                   convert->getOpcode() != OpUConvert)) {
+    return Register();
+  }
+  Register src = convert->getOperand(2).getReg();
+  const MachineInstr *srcDef = MRI->getVRegDef(src);
+  if (!srcDef || srcDef->getNumOperands() < 2 ||
+      !srcDef->getOperand(1).isReg()) {
+    return Register();
+  }
+  unsigned srcWidth = getIntWidth(srcDef->getOperand(1).getReg());
+  if (srcWidth == 0 ||
+      srcWidth >= getIntWidth(convert->getOperand(1).getReg())) {
+    return Register();
+  }
+  isSigned = convert->getOpcode() == OpSConvert;
+  return src;
+}
+
+// Find the vectors whose widened components are multiplied together in each
+// leaf, either as an OpIMul of two widened vectors whose components are all
+// extracted, or as OpIMuls of widened components extracted from two vectors.
+// The leaves must add up the product of every pair of components once.
+bool SPIRVVectorCombine::getWidenedDotOperands(
+    ArrayRef<const MachineInstr *> leaves, Register vecs[2],
+    bool isSigned[2]) const {
+  if (const MachineInstr *mul = getReducedProduct(leaves, OpIMul)) {
+    for (unsigned i = 0; i < 2; ++i) {
+      vecs[i] = getWidenedSource(mul->getOperand(i + 2).getReg(), isSigned[i]);
+      if (!vecs[i].isValid()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  SmallVector<bool, 4> multiplied;
+  for (const MachineInstr *leaf : leaves) {
+    if (leaf->getOpcode() != OpIMul) {
+      return false;
+    }
+    Register leafVecs[2];
+    bool leafSigned[2];
+    int64_t idx[2];
+    for (unsigned i = 0; i < 2; ++i) {
+      Register component =
+          getWidenedSource(leaf->getOperand(i + 2).getReg(), leafSigned[i]);
+      const MachineInstr *extract =
+          component.isValid() ? MRI->getVRegDef(component) : nullptr;
+      if (!extract || extract->getOpcode() != OpCompositeExtract ||
+          extract->getNumOperands() != 4 ||
+          TII->getNumRealUses(leaf->getOperand(i + 2).getReg(), *MRI) != 1) {
+        return false;
+      }
+      leafVecs[i] = extract->getOperand(2).getReg();
+      idx[i] = extract->getOperand(3).getImm();
+    }
+    if (idx[0] != idx[1]) {
+      return false;
+    }
+    if (!vecs[0].isValid()) {
+      const MachineInstr *vecDef = MRI->getVRegDef(leafVecs[0]);
+      if (!vecDef || vecDef->getNumOperands() < 2) {
+        return false;
+      }
+      multiplied.resize(getNumComponents(vecDef->getOperand(1).getReg()));
+      for (unsigned i = 0; i < 2; ++i) {
+        vecs[i] = leafVecs[i];
+        isSigned[i] = leafSigned[i];
+      }
+    } else if (leafVecs[0] != vecs[0] || leafSigned[0] != isSigned[0]) {
+      // The multiply may have its operands the other way around
+      std::swap(leafVecs[0], leafVecs[1]);
+      std::swap(leafSigned[0], leafSigned[1]);
+    }
+    if (leafVecs[0] != vecs[0] || leafVecs[1] != vecs[1] ||
+        leafSigned[0] != isSigned[0] || leafSigned[1] != isSigned[1] ||
+        idx[0] < 0 || idx[0] >= (int64_t)multiplied.size() ||
+        multiplied[idx[0]]) {
+      return false;
+    }
+    multiplied[idx[0]] = true;
+  }
+  return !multiplied.empty() && leaves.size() == multiplied.size();
+}
+
+bool SPIRVVectorCombine::combineIntegerDot(MachineInstr &MI) {
+  const unsigned width = getIntWidth(MI.getOperand(1).getReg());
+  if (width == 0 || getNumComponents(MI.getOperand(1).getReg()) != 0) {
+    return false;
+  }
+  SmallVector<const MachineInstr *, 8> leaves;
+  Register vecs[2];
+  bool isSigned[2];
+  if (!getAddTreeLeaves(MI, leaves) ||
+      !getWidenedDotOperands(leaves, vecs, isSigned)) {
+    return false;
+  }
+
+  // Both vectors must have the same number and width of components
+  Register vecTys[2];
+  for (unsigned i = 0; i < 2; ++i) {
+    const MachineInstr *vecDef = MRI->getVRegDef(vecs[i]);
+    if (!vecDef || vecDef->getNumOperands() < 2) {
+      return false;
+    }
+    vecTys[i] = vecDef->getOperand(1).getReg();
+  }
+  const unsigned numComponents = getNumComponents(vecTys[0]);
+  if (numComponents == 0 || numComponents != getNumComponents(vecTys[1]) ||
+      getIntWidth(vecTys[0]) != getIntWidth(vecTys[1])) {
+    return false;
+  }
+
+  // OpSUDot takes the signed vector first
+  unsigned dotOpcode = isSigned[0] ? OpSDot : OpUDot;
+  if (isSigned[0] != isSigned[1]) {
+    dotOpcode = OpSUDot;
+    if (!isSigned[0]) {
+      std::swap(vecs[0], vecs[1]);
+    }
+  }
+  replaceWithDot(MI, dotOpcode, vecs[0], vecs[1]);
+  ++NumIntegerDots;
+  return true;
+}
+
+bool SPIRVVectorCombine::runOnMachineFunction(MachineFunction &MF) {
+  MRI = &MF.getRegInfo();
+  TII = static_cast<const SPIRVInstrInfo *>(MF.getSubtarget().getInstrInfo());
+  ST = &MF.getSubtarget<SPIRVSubtarget>();
+  const bool canUseIntegerDot =
+      ST->canUseExtension(Extension::SPV_KHR_integer_dot_product);
+
+  // Form the OpCompositeConstructs first, as splats may be built from them
+  bool changed = false;
+  for (unsigned opcode : {OpCompositeInsert, OpFMul, OpFAdd, OpIAdd}) {
+    if (opcode == OpIAdd && !canUseIntegerDot) {
+      continue;
+    }
+    SmallVector<MachineInstr *, 16> candidates;
+    Erased.clear();
+    for (auto &MBB : MF) {
+      for (auto &MI : MBB) {
+        if (MI.getOpcode() == opcode) {
+          candidates.push_back(&MI);
+        }
+      }
+    }
+    // Visit the last instructions first, so chains are matched from their end
+    for (MachineInstr *MI : reverse(candidates)) {
+      if (Erased.count(MI)) {
+        continue;
+      }
+      if (opcode == OpCompositeInsert) {
+        changed |= combineInsertChain(*MI);
+      } else if (opcode == OpFMul) {
+        changed |= combineVectorTimesScalar(*MI);
+      } else if (opcode == OpFAdd) {
+        changed |= combineDot(*MI);
+      } else {
+        changed |= combineIntegerDot(*MI);
+      }
+    }
+  }
+  return changed;
+}
+
+INITIALIZE_PASS(SPIRVVectorCombine, DEBUG_TYPE,
+                "SPIRV combine vector arithmetic", false, false)
+
+char SPIRVVectorCombine::ID = 0;
+
+FunctionPass *llvm::createSPIRVVectorCombinePass() {
+  return new SPIRVVectorCombine();
+}
@@ -8,6 +8,12 @@
 //
 // Tool to fuzz instruction selection using libFuzzer.
 //
+// Besides crashes, -max-us-per-inst reports the inputs whose compile time is
+// more than a fixed budget per IR instruction, which catches the passes whose
+// time grows superlinearly with the input along with libFuzzer's -timeout and
+// -rss_limit_mb budgets. The target is chosen with -mtriple or the name of the
+// binary, e.g. llvm-isel-fuzzer--spirv64-O2 for the SPIR-V backend.
+//
 //===----------------------------------------------------------------------===//
 
 #include "llvm/ADT/StringRef.h"
@@ -30,6 +36,7 @@
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
+#include <chrono>
 
 #define DEBUG_TYPE "isel-fuzzer"
 
@@ -46,6 +53,13 @@ OptLevel("O",
 static cl::opt<std::string>
 TargetTriple("mtriple", cl::desc("Override target triple for module"));
 
+static cl::opt<unsigned> MaxMicrosecondsPerInst(
+    "max-us-per-inst",
+    cl::desc("Abort when compiling an input takes more than this many "
+             "microseconds per IR instruction, plus one second (default: no "
+             "limit)"),
+    cl::init(0));
+
 static std::unique_ptr<TargetMachine> TM;
 static std::unique_ptr<IRMutator> Mutator;
 
@@ -99,8 +113,23 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
   PM.add(new TargetLibraryInfoWrapperPass(TLII));
   raw_null_ostream OS;
   TM->addPassesToEmitFile(PM, OS, nullptr, TargetMachine::CGFT_Null);
+  const unsigned NumInsts = M->getInstructionCount();
+  const auto Start = std::chrono::steady_clock::now();
   PM.run(*M);
 
+  if (MaxMicrosecondsPerInst) {
+    const auto Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - Start)
+                             .count();
+    const uint64_t Budget =
+        1000000 + uint64_t(MaxMicrosecondsPerInst) * NumInsts;
+    if (uint64_t(Elapsed) > Budget) {
+      dbgs() << "Compiling " << NumInsts << " instructions took " << Elapsed
+             << "us, more than the budget of " << Budget << "us.\n"
+             << "Aborting to trigger fuzzer exit handling.\n";
+      abort();
+    }
+  }
   return 0;
 }
 
@@ -0,0 +1,373 @@
+//===-- llvm-spirv-batch: compile many modules to SPIR-V ------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This program compiles a list of IR files to SPIR-V binaries concurrently in
+// a single process, so a build with many small modules, e.g. one per kernel,
+// doesn't pay for starting llc and setting up the target once per module.
+//
+// A target machine compiles one module at a time, as it reuses its pipeline
+// and type registry from one compilation to the next. Each thread thus takes
+// one from a pool kept for each triple, CPU and features, creating it only if
+// none is free, and the subtargets they create share their tables. Errors are
+// reported in the order of the inputs, whatever the order they're found in.
+//
+// With -verify-determinism, each module is compiled a second time in a new
+// context with a new target machine, and the two binaries must be identical,
+// so the output doesn't depend on addresses or on the modules compiled before.
+//
+// With -split-entry-points, each entry point of a module is written to its own
+// <input stem>.<entry point>.spv instead, with only what it uses, for runtimes
+// loading a whole binary to launch any of its kernels. The module is compiled
+// once, and the binaries are cut from it by the final SPIR-V pass.
+//
+// With -compress, the binaries are written in the compact container of
+// SPIRVCompression instead, as .spvz files.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/SPIRVCompression.h"
+#include "SPIRV.h"
+#include "SPIRVTargetMachine.h"
+#include "SPIRVTypeRegistry.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <mutex>
+
+using namespace llvm;
+
+extern "C" void LLVMInitializeSPIRVTargetInfo();
+extern "C" void LLVMInitializeSPIRVTarget();
+extern "C" void LLVMInitializeSPIRVTargetMC();
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::ZeroOrMore,
+                                            cl::desc("<input IR files>"));
+
+static cl::opt<std::string>
+    InputList("input-list",
+              cl::desc("Read the input files from <file>, one per line"),
+              cl::value_desc("file"));
+
+static cl::opt<std::string>
+    OutputDirectory("o", cl::desc("Directory to write the SPIR-V binaries to"),
+                    cl::init("."), cl::value_desc("directory"));
+
+static cl::opt<unsigned>
+    Threads("j", cl::Prefix, cl::init(0),
+            cl::desc("Number of modules to compile at once (default: the "
+                     "number of hardware threads)"));
+
+static cl::opt<std::string>
+    TargetTriple("mtriple",
+                 cl::desc("Override the target triple of the modules"));
+
+static cl::opt<std::string> CPU("mcpu", cl::desc("Target CPU"),
+                                cl::value_desc("cpu-name"), cl::init(""));
+
+static cl::opt<std::string> Features("mattr",
+                                     cl::desc("Target features, e.g. +v1.3"),
+                                     cl::value_desc("a1,+a2,-a3,..."),
+                                     cl::init(""));
+
+static cl::opt<bool> VerifyDeterminism(
+    "verify-determinism",
+    cl::desc("Compile each module twice, the second time with a new target "
+             "machine, and fail if the binaries differ"));
+
+static cl::opt<bool> SplitEntryPoints(
+    "split-entry-points",
+    cl::desc("Write the binary of each entry point on its own to "
+             "<input stem>.<entry point>.spv"));
+
+static cl::opt<bool>
+    Compress("compress",
+             cl::desc("Write compressed SPIR-V binaries, as .spvz files"));
+
+static int reportError(const Twine &msg) {
+  WithColor::error(errs(), "llvm-spirv-batch") << msg << '\n';
+  return 1;
+}
+
+namespace {
+// The target machines not compiling a module, for each configuration
+class TargetMachinePool {
+  std::mutex lock;
+  StringMap<std::vector<std::unique_ptr<TargetMachine>>> freeTMs;
+
+public:
+  // Take a free target machine for the triple, or create one
+  std::unique_ptr<TargetMachine> acquire(const Triple &TT,
+                                         std::string &error) {
+    const std::string key = TT.str() + "|" + CPU + "|" + Features;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto &free = freeTMs[key];
+      if (!free.empty()) {
+        auto TM = std::move(free.back());
+        free.pop_back();
+        return TM;
+      }
+    }
+    return create(TT, error);
+  }
+
+  // Create a target machine no module was compiled with yet
+  static std::unique_ptr<TargetMachine> create(const Triple &TT,
+                                               std::string &error) {
+    const Target *target = TargetRegistry::lookupTarget(TT.str(), error);
+    if (!target) {
+      return nullptr;
+    }
+    return std::unique_ptr<TargetMachine>(target->createTargetMachine(
+        TT.str(), CPU, Features, TargetOptions(), None));
+  }
+
+  void release(std::unique_ptr<TargetMachine> TM) {
+    const std::string key =
+        TM->getTargetTriple().str() + "|" + CPU + "|" + Features;
+    std::lock_guard<std::mutex> guard(lock);
+    freeTMs[key].push_back(std::move(TM));
+  }
+};
+} // namespace
+
+// Parse the module in filename into M, or return why it failed
+static std::string parseModule(StringRef filename, LLVMContext &context,
+                               std::unique_ptr<Module> &M) {
+  SMDiagnostic diag;
+  M = parseIRFile(filename, diag, context);
+  if (!M) {
+    std::string msg;
+    raw_string_ostream OS(msg);
+    diag.print("llvm-spirv-batch", OS, /*ShowColors=*/false);
+    return OS.str();
+  }
+  return "";
+}
+
+// Compile M, parsed from filename, to words, and to the binary of each entry
+// point if images is given, with a target machine from the pool or a new one,
+// or return why it failed
+static std::string compileToWords(TargetMachinePool &pool, StringRef filename,
+                                  Module &M, bool newTM,
+                                  std::vector<uint32_t> &words,
+                                  std::vector<SPIRVEntryPointImage> *images) {
+  Triple TT(TargetTriple.empty() ? M.getTargetTriple() : TargetTriple);
+  if (!TT.isSPIRV()) {
+    return (filename + ": not a SPIR-V target triple: " + TT.str()).str();
+  }
+
+  std::string error;
+  std::unique_ptr<TargetMachine> TM =
+      newTM ? TargetMachinePool::create(TT, error) : pool.acquire(TT, error);
+  if (!TM) {
+    return (filename + ": " + error).str();
+  }
+  M.setTargetTriple(TT.str());
+  M.setDataLayout(TM->createDataLayout());
+  const bool failed = static_cast<SPIRVTargetMachine *>(TM.get())
+                          ->emitSPIRVWords(M, words, images);
+  if (!newTM) {
+    pool.release(std::move(TM));
+  }
+  if (failed) {
+    return (filename + ": can't emit a SPIR-V binary").str();
+  }
+  return "";
+}
+
+// Check the binaries of what of filename two compilations gave are identical,
+// or return where they differ
+static std::string compareBinaries(const Twine &what,
+                                   const std::vector<uint32_t> &words,
+                                   const std::vector<uint32_t> &otherWords) {
+  if (words == otherWords) {
+    return "";
+  }
+  auto mismatch = std::mismatch(words.begin(), words.end(),
+                                otherWords.begin(), otherWords.end());
+  return (what + ": the binaries of two compilations differ from word " +
+          Twine(mismatch.first - words.begin()))
+      .str();
+}
+
+// Write the binary to outputFilename, or return why it failed
+static std::string writeBinary(const std::vector<uint32_t> &words,
+                               StringRef outputFilename) {
+  std::error_code EC;
+  ToolOutputFile out(outputFilename, EC, sys::fs::OF_None);
+  if (EC) {
+    return (outputFilename + ": " + EC.message()).str();
+  }
+  if (Compress) {
+    SmallVector<char, 0> compressed;
+    compressSPIRV(words, compressed);
+    out.os().write(compressed.data(), compressed.size());
+  } else {
+    support::endian::write<uint32_t>(out.os(), words, support::little);
+  }
+  out.keep();
+  return "";
+}
+
+// Compile the module in filename to outputFilename, or each of its entry points
+// next to it with -split-entry-points, or return why it failed
+static std::string compileModule(TargetMachinePool &pool,
+                                 StringRef filename,
+                                 StringRef outputFilename) {
+  LLVMContext context;
+  std::unique_ptr<Module> M;
+  std::string error = parseModule(filename, context, M);
+  if (!error.empty()) {
+    return error;
+  }
+  std::vector<uint32_t> words;
+  std::vector<SPIRVEntryPointImage> images;
+  error = compileToWords(pool, filename, *M, false, words,
+                         SplitEntryPoints ? &images : nullptr);
+  if (!error.empty()) {
+    return error;
+  }
+
+  if (VerifyDeterminism) {
+    LLVMContext otherContext;
+    std::unique_ptr<Module> otherM;
+    error = parseModule(filename, otherContext, otherM);
+    if (!error.empty()) {
+      return error;
+    }
+    std::vector<uint32_t> otherWords;
+    std::vector<SPIRVEntryPointImage> otherImages;
+    error = compileToWords(pool, filename, *otherM, true, otherWords,
+                           SplitEntryPoints ? &otherImages : nullptr);
+    if (!error.empty()) {
+      return error;
+    }
+    error = compareBinaries(filename, words, otherWords);
+    if (!error.empty()) {
+      return error;
+    }
+    if (images.size() != otherImages.size()) {
+      return (filename + ": two compilations have different entry points")
+          .str();
+    }
+    for (size_t i = 0; i < images.size(); ++i) {
+      if (images[i].Name != otherImages[i].Name) {
+        return (filename + ": two compilations have different entry points")
+            .str();
+      }
+      error = compareBinaries(filename + ": " + images[i].Name,
+                              images[i].Words, otherImages[i].Words);
+      if (!error.empty()) {
+        return error;
+      }
+    }
+  }
+
+  if (!SplitEntryPoints) {
+    return writeBinary(words, outputFilename);
+  }
+  if (images.empty()) {
+    return (filename + ": no entry points to split the module into").str();
+  }
+  for (const SPIRVEntryPointImage &image : images) {
+    SmallString<128> imageOutput(outputFilename);
+    sys::path::replace_extension(imageOutput,
+                                 image.Name +
+                                     sys::path::extension(outputFilename));
+    error = writeBinary(image.Words, imageOutput);
+    if (!error.empty()) {
+      return error;
+    }
+  }
+  return "";
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  LLVMInitializeSPIRVTargetInfo();
+  LLVMInitializeSPIRVTarget();
+  LLVMInitializeSPIRVTargetMC();
+  cl::ParseCommandLineOptions(argc, argv, "SPIR-V batch compiler\n");
+
+  std::vector<std::string> inputs(InputFilenames.begin(),
+                                  InputFilenames.end());
+  if (!InputList.empty()) {
+    auto list = MemoryBuffer::getFileOrSTDIN(InputList);
+    if (!list) {
+      return reportError(InputList + ": " + list.getError().message());
+    }
+    SmallVector<StringRef, 16> lines;
+    (*list)->getBuffer().split(lines, '\n', -1, false);
+    for (StringRef line : lines) {
+      line = line.trim();
+      if (!line.empty()) {
+        inputs.push_back(line);
+      }
+    }
+  }
+  if (inputs.empty()) {
+    return reportError("no input files");
+  }
+
+  // Name each output after its input, so the same inputs always give the
+  // same files whatever thread compiles each one
+  std::vector<std::string> outputs;
+  StringMap<StringRef> outputOwners;
+  for (const std::string &input : inputs) {
+    SmallString<128> output(OutputDirectory);
+    sys::path::append(output,
+                      sys::path::stem(input) + (Compress ? ".spvz" : ".spv"));
+    auto inserted = outputOwners.try_emplace(output, input);
+    if (!inserted.second) {
+      return reportError(input + " and " + inserted.first->second +
+                         " would both be compiled to " + output);
+    }
+    outputs.push_back(output.str());
+  }
+  if (std::error_code EC = sys::fs::create_directories(OutputDirectory)) {
+    return reportError(OutputDirectory + ": " + EC.message());
+  }
+
+  TargetMachinePool pool;
+  std::vector<std::string> errors(inputs.size());
+  {
+    ThreadPool threads(Threads ? Threads : hardware_concurrency());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      threads.async([&, i]() {
+        errors[i] = compileModule(pool, inputs[i], outputs[i]);
+      });
+    }
+    threads.wait();
+  }
+
+  int ret = 0;
+  for (const std::string &error : errors) {
+    if (!error.empty()) {
+      ret = reportError(StringRef(error).rtrim());
+    }
+  }
+  return ret;
+}
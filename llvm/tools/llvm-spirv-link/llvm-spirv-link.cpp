@@ -0,0 +1,98 @@
+//===-- llvm-spirv-link: link SPIR-V binaries -----------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This program links the SPIR-V binaries emitted by the SPIR-V backend, e.g.
+// for each translation unit, into a single module, resolving the symbols they
+// import and export through LinkageAttributes decorations. Inputs compressed
+// by SPIRVCompression, e.g. by llvm-spirv-batch -compress, are decompressed
+// first.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MCTargetDesc/SPIRVCompression.h"
+#include "MCTargetDesc/SPIRVLinker.h"
+
+#include "llvm/MC/MCInstrInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+extern "C" void LLVMInitializeSPIRVTargetInfo();
+extern "C" void LLVMInitializeSPIRVTargetMC();
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::OneOrMore,
+                                            cl::desc("<input SPIR-V files>"));
+
+static cl::opt<std::string> OutputFilename("o",
+                                           cl::desc("Override output filename"),
+                                           cl::init("-"),
+                                           cl::value_desc("filename"));
+
+static int reportError(const Twine &msg) {
+  WithColor::error(errs(), "llvm-spirv-link") << msg << '\n';
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  LLVMInitializeSPIRVTargetInfo();
+  LLVMInitializeSPIRVTargetMC();
+  cl::ParseCommandLineOptions(argc, argv, "SPIR-V linker\n");
+
+  std::string error;
+  const Target *target = TargetRegistry::lookupTarget("spirv32", error);
+  if (!target) {
+    return reportError(error);
+  }
+  std::unique_ptr<MCInstrInfo> MCII(target->createMCInstrInfo());
+
+  std::vector<std::unique_ptr<MemoryBuffer>> buffers;
+  std::vector<MemoryBufferRef> inputs;
+  for (const std::string &filename : InputFilenames) {
+    auto buffer = MemoryBuffer::getFileOrSTDIN(
+        filename, /*FileSize=*/-1, /*RequiresNullTerminator=*/false);
+    if (!buffer) {
+      return reportError(filename + ": " + buffer.getError().message());
+    }
+    if (isCompressedSPIRV((*buffer)->getBuffer())) {
+      SmallVector<uint32_t, 0> words;
+      if (Error E = decompressSPIRV((*buffer)->getBuffer(), words)) {
+        return reportError(filename + ": " + toString(std::move(E)));
+      }
+      SmallVector<char, 0> binary;
+      raw_svector_ostream binaryOS(binary);
+      support::endian::write<uint32_t>(binaryOS, words, support::little);
+      *buffer = MemoryBuffer::getMemBufferCopy(
+          StringRef(binary.data(), binary.size()), filename);
+    }
+    inputs.push_back((*buffer)->getMemBufferRef());
+    buffers.push_back(std::move(*buffer));
+  }
+
+  SmallVector<uint32_t, 0> linked;
+  if (Error E = linkSPIRVModules(*MCII, inputs, linked)) {
+    return reportError(toString(std::move(E)));
+  }
+
+  std::error_code EC;
+  ToolOutputFile out(OutputFilename, EC, sys::fs::OF_None);
+  if (EC) {
+    return reportError(OutputFilename + ": " + EC.message());
+  }
+  support::endian::write<uint32_t>(out.os(), linked, support::little);
+  out.keep();
+  return 0;
+}
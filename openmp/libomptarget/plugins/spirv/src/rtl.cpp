@@ -0,0 +1,589 @@
+//===----RTLs/spirv/src/rtl.cpp - Target RTLs Implementation ------ C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// RTL for SPIR-V devices, driven through an OpenCL 2.1 ICD
+//
+// Device images are SPIR-V modules, as produced by the SPIR-V backend, and
+// every offload entry without a size is a kernel of the module. Data lives in
+// shared virtual memory so that the pointers the host passes, offsets
+// included, are the ones the kernels see.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <list>
+#include <string>
+#include <vector>
+
+#define CL_TARGET_OPENCL_VERSION 210
+#include <CL/cl.h>
+
+#include "omptargetplugin.h"
+
+#ifndef TARGET_NAME
+#define TARGET_NAME SPIRV
+#endif
+
+#ifdef OMPTARGET_DEBUG
+static int DebugLevel = 0;
+
+#define GETNAME2(name) #name
+#define GETNAME(name) GETNAME2(name)
+#define DP(...) \
+  do { \
+    if (DebugLevel > 0) { \
+      DEBUGP("Target " GETNAME(TARGET_NAME) " RTL", __VA_ARGS__); \
+    } \
+  } while (false)
+
+// Utility for printing OpenCL error codes.
+#define CL_ERR_STRING(err) \
+  do { \
+    if (DebugLevel > 0) { \
+      DEBUGP("Target " GETNAME(TARGET_NAME) " RTL", "OpenCL error is: %d\n", \
+             (int)(err)); \
+    } \
+  } while (false)
+#else // OMPTARGET_DEBUG
+#define DP(...) {}
+#define CL_ERR_STRING(err) {}
+#endif // OMPTARGET_DEBUG
+
+// The first word of every SPIR-V module.
+static const uint32_t SPIRVMagicNumber = 0x07230203;
+
+/// Keep entries table per device.
+struct FuncOrGblEntryTy {
+  __tgt_target_table Table;
+  std::vector<__tgt_offload_entry> Entries;
+};
+
+/// Use a single entity to encode a kernel and the device it was built for
+struct KernelTy {
+  cl_kernel Kernel;
+  int32_t DeviceId;
+
+  KernelTy(cl_kernel _Kernel, int32_t _DeviceId)
+      : Kernel(_Kernel), DeviceId(_DeviceId) {}
+};
+
+/// List that contains all the kernels.
+/// FIXME: we may need this to be per device and per library.
+std::list<KernelTy> KernelsList;
+
+/// Class containing all the device information.
+class RTLDeviceInfoTy {
+  std::vector<std::list<FuncOrGblEntryTy>> FuncGblEntries;
+
+public:
+  int NumberOfDevices;
+  std::vector<cl_device_id> Devices;
+  std::vector<cl_context> Contexts;
+  std::vector<cl_command_queue> Queues;
+  std::vector<cl_program> Programs;
+
+  // Device properties
+  std::vector<int> ThreadsPerBlock;
+  std::vector<int> BlocksPerGrid;
+
+  // OpenMP properties
+  std::vector<int> NumTeams;
+  std::vector<int> NumThreads;
+
+  // OpenMP Environment properties
+  int EnvNumTeams;
+  int EnvTeamLimit;
+
+  // OpenMP Requires Flags
+  int64_t RequiresFlags;
+
+  static const int HardTeamLimit = 1<<16; // 64k
+  static const int HardThreadLimit = 1024;
+  static const int DefaultNumTeams = 128;
+  static const int DefaultNumThreads = 128;
+
+  // Record entry point associated with device
+  void addOffloadEntry(int32_t device_id, __tgt_offload_entry entry) {
+    assert(device_id < (int32_t)FuncGblEntries.size() &&
+           "Unexpected device id!");
+    FuncOrGblEntryTy &E = FuncGblEntries[device_id].back();
+
+    E.Entries.push_back(entry);
+  }
+
+  // Return the pointer to the target entries table
+  __tgt_target_table *getOffloadEntriesTable(int32_t device_id) {
+    assert(device_id < (int32_t)FuncGblEntries.size() &&
+           "Unexpected device id!");
+    FuncOrGblEntryTy &E = FuncGblEntries[device_id].back();
+
+    int32_t size = E.Entries.size();
+
+    // Table is empty
+    if (!size)
+      return 0;
+
+    __tgt_offload_entry *begin = &E.Entries[0];
+    __tgt_offload_entry *end = &E.Entries[size - 1];
+
+    // Update table info according to the entries and return the pointer
+    E.Table.EntriesBegin = begin;
+    E.Table.EntriesEnd = ++end;
+
+    return &E.Table;
+  }
+
+  // Clear entries table for a device
+  void clearOffloadEntriesTable(int32_t device_id) {
+    assert(device_id < (int32_t)FuncGblEntries.size() &&
+           "Unexpected device id!");
+    FuncGblEntries[device_id].emplace_back();
+    FuncOrGblEntryTy &E = FuncGblEntries[device_id].back();
+    E.Entries.clear();
+    E.Table.EntriesBegin = E.Table.EntriesEnd = 0;
+  }
+
+  // Whether the device takes SPIR-V modules and supports shared virtual memory
+  static bool isSupportedDevice(cl_device_id device) {
+    size_t size = 0;
+    if (clGetDeviceInfo(device, CL_DEVICE_IL_VERSION, 0, NULL, &size) !=
+            CL_SUCCESS ||
+        size == 0)
+      return false;
+    std::vector<char> ILVersion(size);
+    clGetDeviceInfo(device, CL_DEVICE_IL_VERSION, size, &ILVersion[0], NULL);
+    if (!strstr(&ILVersion[0], "SPIR-V"))
+      return false;
+
+    cl_device_svm_capabilities SVMCaps = 0;
+    if (clGetDeviceInfo(device, CL_DEVICE_SVM_CAPABILITIES, sizeof(SVMCaps),
+                        &SVMCaps, NULL) != CL_SUCCESS)
+      return false;
+    return SVMCaps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER;
+  }
+
+  RTLDeviceInfoTy() {
+#ifdef OMPTARGET_DEBUG
+    if (char *envStr = getenv("LIBOMPTARGET_DEBUG")) {
+      DebugLevel = std::stoi(envStr);
+    }
+#endif // OMPTARGET_DEBUG
+
+    DP("Start initializing OpenCL\n");
+
+    NumberOfDevices = 0;
+
+    cl_uint NumPlatforms = 0;
+    cl_int err = clGetPlatformIDs(0, NULL, &NumPlatforms);
+    if (err != CL_SUCCESS || NumPlatforms == 0) {
+      DP("There are no OpenCL platforms.\n");
+      CL_ERR_STRING(err);
+      return;
+    }
+    std::vector<cl_platform_id> Platforms(NumPlatforms);
+    clGetPlatformIDs(NumPlatforms, &Platforms[0], NULL);
+
+    // Only GPUs and accelerators, the host is already served by its own RTL.
+    const cl_device_type DeviceTypes =
+        CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR;
+    for (cl_platform_id Platform : Platforms) {
+      cl_uint NumPlatformDevices = 0;
+      if (clGetDeviceIDs(Platform, DeviceTypes, 0, NULL,
+                         &NumPlatformDevices) != CL_SUCCESS ||
+          NumPlatformDevices == 0)
+        continue;
+      std::vector<cl_device_id> PlatformDevices(NumPlatformDevices);
+      clGetDeviceIDs(Platform, DeviceTypes, NumPlatformDevices,
+                     &PlatformDevices[0], NULL);
+      for (cl_device_id Device : PlatformDevices)
+        if (isSupportedDevice(Device))
+          Devices.push_back(Device);
+    }
+
+    NumberOfDevices = Devices.size();
+    if (NumberOfDevices == 0) {
+      DP("There are no devices supporting SPIR-V and shared virtual "
+         "memory.\n");
+      return;
+    }
+
+    FuncGblEntries.resize(NumberOfDevices);
+    Contexts.resize(NumberOfDevices);
+    Queues.resize(NumberOfDevices);
+    ThreadsPerBlock.resize(NumberOfDevices);
+    BlocksPerGrid.resize(NumberOfDevices);
+    NumTeams.resize(NumberOfDevices);
+    NumThreads.resize(NumberOfDevices);
+
+    // Get environment variables regarding teams
+    char *envStr = getenv("OMP_TEAM_LIMIT");
+    if (envStr) {
+      // OMP_TEAM_LIMIT has been set
+      EnvTeamLimit = std::stoi(envStr);
+      DP("Parsed OMP_TEAM_LIMIT=%d\n", EnvTeamLimit);
+    } else {
+      EnvTeamLimit = -1;
+    }
+    envStr = getenv("OMP_NUM_TEAMS");
+    if (envStr) {
+      // OMP_NUM_TEAMS has been set
+      EnvNumTeams = std::stoi(envStr);
+      DP("Parsed OMP_NUM_TEAMS=%d\n", EnvNumTeams);
+    } else {
+      EnvNumTeams = -1;
+    }
+
+    // Default state.
+    RequiresFlags = OMP_REQ_UNDEFINED;
+  }
+
+  ~RTLDeviceInfoTy() {
+    for (auto &kernel : KernelsList)
+      clReleaseKernel(kernel.Kernel);
+
+    for (auto &program : Programs)
+      clReleaseProgram(program);
+
+    for (auto &queue : Queues)
+      if (queue)
+        clReleaseCommandQueue(queue);
+
+    for (auto &ctx : Contexts)
+      if (ctx)
+        clReleaseContext(ctx);
+  }
+};
+
+static RTLDeviceInfoTy DeviceInfo;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int32_t __tgt_rtl_is_valid_binary(__tgt_device_image *image) {
+  size_t size = (char *)image->ImageEnd - (char *)image->ImageStart;
+  if (size < 5 * sizeof(uint32_t) || size % sizeof(uint32_t))
+    return 0;
+  return *(uint32_t *)image->ImageStart == SPIRVMagicNumber;
+}
+
+int32_t __tgt_rtl_number_of_devices() { return DeviceInfo.NumberOfDevices; }
+
+int64_t __tgt_rtl_init_requires(int64_t RequiresFlags) {
+  DP("Init requires flags to %ld\n", RequiresFlags);
+  DeviceInfo.RequiresFlags = RequiresFlags;
+  return RequiresFlags;
+}
+
+int32_t __tgt_rtl_init_device(int32_t device_id) {
+  cl_device_id Device = DeviceInfo.Devices[device_id];
+
+  cl_int err;
+  DeviceInfo.Contexts[device_id] =
+      clCreateContext(NULL, 1, &Device, NULL, NULL, &err);
+  if (err != CL_SUCCESS) {
+    DP("Error when creating an OpenCL context\n");
+    CL_ERR_STRING(err);
+    return OFFLOAD_FAIL;
+  }
+
+  DeviceInfo.Queues[device_id] = clCreateCommandQueueWithProperties(
+      DeviceInfo.Contexts[device_id], Device, NULL, &err);
+  if (err != CL_SUCCESS) {
+    DP("Error when creating an OpenCL command queue\n");
+    CL_ERR_STRING(err);
+    return OFFLOAD_FAIL;
+  }
+
+  // OpenCL does not bound the number of work-groups, so use the hard limit.
+  DeviceInfo.BlocksPerGrid[device_id] = RTLDeviceInfoTy::HardTeamLimit;
+
+  size_t maxWorkGroupSize;
+  err = clGetDeviceInfo(Device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                        sizeof(maxWorkGroupSize), &maxWorkGroupSize, NULL);
+  if (err != CL_SUCCESS) {
+    DP("Error getting max work-group size, use default\n");
+    DeviceInfo.ThreadsPerBlock[device_id] = RTLDeviceInfoTy::DefaultNumThreads;
+  } else if (maxWorkGroupSize <= RTLDeviceInfoTy::HardThreadLimit) {
+    DeviceInfo.ThreadsPerBlock[device_id] = maxWorkGroupSize;
+    DP("Using %zu work-items per work-group\n", maxWorkGroupSize);
+  } else {
+    DeviceInfo.ThreadsPerBlock[device_id] = RTLDeviceInfoTy::HardThreadLimit;
+    DP("Max work-group size %zu exceeds the hard thread limit %d, capping "
+       "at the hard limit\n",
+       maxWorkGroupSize, RTLDeviceInfoTy::HardThreadLimit);
+  }
+
+  // Adjust teams to the env variables
+  if (DeviceInfo.EnvTeamLimit > 0 &&
+      DeviceInfo.BlocksPerGrid[device_id] > DeviceInfo.EnvTeamLimit) {
+    DeviceInfo.BlocksPerGrid[device_id] = DeviceInfo.EnvTeamLimit;
+    DP("Capping max work-groups to OMP_TEAM_LIMIT=%d\n",
+       DeviceInfo.EnvTeamLimit);
+  }
+
+  // Set default number of teams
+  if (DeviceInfo.EnvNumTeams > 0) {
+    DeviceInfo.NumTeams[device_id] = DeviceInfo.EnvNumTeams;
+    DP("Default number of teams set according to environment %d\n",
+       DeviceInfo.EnvNumTeams);
+  } else {
+    DeviceInfo.NumTeams[device_id] = RTLDeviceInfoTy::DefaultNumTeams;
+    DP("Default number of teams set according to library's default %d\n",
+       RTLDeviceInfoTy::DefaultNumTeams);
+  }
+  if (DeviceInfo.NumTeams[device_id] > DeviceInfo.BlocksPerGrid[device_id]) {
+    DeviceInfo.NumTeams[device_id] = DeviceInfo.BlocksPerGrid[device_id];
+    DP("Default number of teams exceeds device limit, capping at %d\n",
+       DeviceInfo.BlocksPerGrid[device_id]);
+  }
+
+  // Set default number of threads
+  DeviceInfo.NumThreads[device_id] = RTLDeviceInfoTy::DefaultNumThreads;
+  DP("Default number of threads set according to library's default %d\n",
+     RTLDeviceInfoTy::DefaultNumThreads);
+  if (DeviceInfo.NumThreads[device_id] >
+      DeviceInfo.ThreadsPerBlock[device_id]) {
+    DeviceInfo.NumThreads[device_id] = DeviceInfo.ThreadsPerBlock[device_id];
+    DP("Default number of threads exceeds device limit, capping at %d\n",
+       DeviceInfo.ThreadsPerBlock[device_id]);
+  }
+
+  return OFFLOAD_SUCCESS;
+}
+
+__tgt_target_table *__tgt_rtl_load_binary(int32_t device_id,
+    __tgt_device_image *image) {
+  // Clear the offload table as we are going to create a new one.
+  DeviceInfo.clearOffloadEntriesTable(device_id);
+
+  // Create the program and extract the kernels.
+  size_t size = (char *)image->ImageEnd - (char *)image->ImageStart;
+  DP("Load data from image " DPxMOD "\n", DPxPTR(image->ImageStart));
+  cl_int err;
+  cl_program program = clCreateProgramWithIL(DeviceInfo.Contexts[device_id],
+                                             image->ImageStart, size, &err);
+  if (err != CL_SUCCESS) {
+    DP("Error when creating an OpenCL program from SPIR-V\n");
+    CL_ERR_STRING(err);
+    return NULL;
+  }
+  DeviceInfo.Programs.push_back(program);
+
+  err = clBuildProgram(program, 1, &DeviceInfo.Devices[device_id], NULL, NULL,
+                       NULL);
+  if (err != CL_SUCCESS) {
+    DP("Error when building the OpenCL program\n");
+    CL_ERR_STRING(err);
+    return NULL;
+  }
+
+  DP("SPIR-V program successfully built!\n");
+
+  // Find the kernels in the program by name.
+  __tgt_offload_entry *HostBegin = image->EntriesBegin;
+  __tgt_offload_entry *HostEnd = image->EntriesEnd;
+
+  for (__tgt_offload_entry *e = HostBegin; e != HostEnd; ++e) {
+
+    if (!e->addr) {
+      // We return NULL when something like this happens, the host should have
+      // always something in the address to uniquely identify the target region.
+      DP("Invalid binary: host entry '<null>' (size = %zd)...\n", e->size);
+
+      return NULL;
+    }
+
+    if (e->size) {
+      // OpenCL has no way to get the address of a program scope variable.
+      DP("Loading global '%s' (Failed): declare target variables are not "
+         "supported\n", e->name);
+      return NULL;
+    }
+
+    cl_kernel kernel = clCreateKernel(program, e->name, &err);
+    if (err != CL_SUCCESS) {
+      DP("Loading '%s' (Failed)\n", e->name);
+      CL_ERR_STRING(err);
+      return NULL;
+    }
+
+    DP("Entry point " DPxMOD " maps to %s (" DPxMOD ")\n",
+       DPxPTR(e - HostBegin), e->name, DPxPTR(kernel));
+
+    KernelsList.push_back(KernelTy(kernel, device_id));
+
+    __tgt_offload_entry entry = *e;
+    entry.addr = (void *)&KernelsList.back();
+    DeviceInfo.addOffloadEntry(device_id, entry);
+  }
+
+  return DeviceInfo.getOffloadEntriesTable(device_id);
+}
+
+void *__tgt_rtl_data_alloc(int32_t device_id, int64_t size, void *hst_ptr) {
+  if (size == 0) {
+    return NULL;
+  }
+
+  void *ptr = clSVMAlloc(DeviceInfo.Contexts[device_id], CL_MEM_READ_WRITE,
+                         size, 0);
+  if (!ptr) {
+    DP("Error while trying to allocate %" PRId64 " bytes\n", size);
+    return NULL;
+  }
+  return ptr;
+}
+
+int32_t __tgt_rtl_data_submit(int32_t device_id, void *tgt_ptr, void *hst_ptr,
+    int64_t size) {
+  cl_int err = clEnqueueSVMMemcpy(DeviceInfo.Queues[device_id], CL_TRUE,
+                                  tgt_ptr, hst_ptr, size, 0, NULL, NULL);
+  if (err != CL_SUCCESS) {
+    DP("Error when copying data from host to device. Pointers: host = " DPxMOD
+       ", device = " DPxMOD ", size = %" PRId64 "\n", DPxPTR(hst_ptr),
+       DPxPTR(tgt_ptr), size);
+    CL_ERR_STRING(err);
+    return OFFLOAD_FAIL;
+  }
+  return OFFLOAD_SUCCESS;
+}
+
+int32_t __tgt_rtl_data_retrieve(int32_t device_id, void *hst_ptr, void *tgt_ptr,
+    int64_t size) {
+  cl_int err = clEnqueueSVMMemcpy(DeviceInfo.Queues[device_id], CL_TRUE,
+                                  hst_ptr, tgt_ptr, size, 0, NULL, NULL);
+  if (err != CL_SUCCESS) {
+    DP("Error when copying data from device to host. Pointers: host = " DPxMOD
+       ", device = " DPxMOD ", size = %" PRId64 "\n", DPxPTR(hst_ptr),
+       DPxPTR(tgt_ptr), size);
+    CL_ERR_STRING(err);
+    return OFFLOAD_FAIL;
+  }
+  return OFFLOAD_SUCCESS;
+}
+
+int32_t __tgt_rtl_data_delete(int32_t device_id, void *tgt_ptr) {
+  // Kernels that still use the memory may be running.
+  cl_int err = clFinish(DeviceInfo.Queues[device_id]);
+  if (err != CL_SUCCESS) {
+    DP("Error when waiting for the OpenCL command queue\n");
+    CL_ERR_STRING(err);
+    return OFFLOAD_FAIL;
+  }
+
+  clSVMFree(DeviceInfo.Contexts[device_id], tgt_ptr);
+  return OFFLOAD_SUCCESS;
+}
+
+int32_t __tgt_rtl_run_target_team_region(int32_t device_id, void *tgt_entry_ptr,
+    void **tgt_args, ptrdiff_t *tgt_offsets, int32_t arg_num, int32_t team_num,
+    int32_t thread_limit, uint64_t loop_tripcount) {
+  KernelTy *KernelInfo = (KernelTy *)tgt_entry_ptr;
+  assert(KernelInfo->DeviceId == device_id && "Kernel of another device!");
+
+  // All args are references, into shared virtual memory.
+  for (int32_t i = 0; i < arg_num; ++i) {
+    void *ptr = (void *)((intptr_t)tgt_args[i] + tgt_offsets[i]);
+    cl_int err = clSetKernelArgSVMPointer(KernelInfo->Kernel, i, ptr);
+    if (err != CL_SUCCESS) {
+      DP("Error when setting kernel argument %d\n", i);
+      CL_ERR_STRING(err);
+      return OFFLOAD_FAIL;
+    }
+  }
+
+  size_t threadsPerBlock;
+
+  if (thread_limit > 0) {
+    threadsPerBlock = thread_limit;
+    DP("Setting work-group size to requested %d\n", thread_limit);
+  } else {
+    threadsPerBlock = DeviceInfo.NumThreads[device_id];
+    DP("Setting work-group size to default %d\n",
+       DeviceInfo.NumThreads[device_id]);
+  }
+
+  if (threadsPerBlock > (size_t)DeviceInfo.ThreadsPerBlock[device_id]) {
+    threadsPerBlock = DeviceInfo.ThreadsPerBlock[device_id];
+    DP("Work-group size capped at device limit %d\n",
+       DeviceInfo.ThreadsPerBlock[device_id]);
+  }
+
+  size_t kernel_limit;
+  cl_int err = clGetKernelWorkGroupInfo(
+      KernelInfo->Kernel, DeviceInfo.Devices[device_id],
+      CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_limit), &kernel_limit, NULL);
+  if (err == CL_SUCCESS && kernel_limit < threadsPerBlock) {
+    threadsPerBlock = kernel_limit;
+    DP("Work-group size capped at kernel limit %zu\n", kernel_limit);
+  }
+
+  size_t blocksPerGrid;
+  if (team_num <= 0) {
+    if (loop_tripcount > 0 && DeviceInfo.EnvNumTeams < 0) {
+      // Launch so many teams that each work-item runs one iteration.
+      blocksPerGrid = ((loop_tripcount - 1) / threadsPerBlock) + 1;
+      DP("Using %zu teams due to loop trip count %" PRIu64 " and work-group "
+         "size %zu\n", blocksPerGrid, loop_tripcount, threadsPerBlock);
+    } else {
+      blocksPerGrid = DeviceInfo.NumTeams[device_id];
+      DP("Using default number of teams %d\n", DeviceInfo.NumTeams[device_id]);
+    }
+  } else if (team_num > DeviceInfo.BlocksPerGrid[device_id]) {
+    blocksPerGrid = DeviceInfo.BlocksPerGrid[device_id];
+    DP("Capping number of teams to team limit %d\n",
+       DeviceInfo.BlocksPerGrid[device_id]);
+  } else {
+    blocksPerGrid = team_num;
+    DP("Using requested number of teams %d\n", team_num);
+  }
+
+  // Run on the device.
+  DP("Launch kernel with %zu work-groups of %zu work-items\n", blocksPerGrid,
+     threadsPerBlock);
+
+  size_t globalSize = blocksPerGrid * threadsPerBlock;
+  err = clEnqueueNDRangeKernel(DeviceInfo.Queues[device_id],
+                               KernelInfo->Kernel, 1, NULL, &globalSize,
+                               &threadsPerBlock, 0, NULL, NULL);
+  if (err != CL_SUCCESS) {
+    DP("Device kernel launch failed!\n");
+    CL_ERR_STRING(err);
+    return OFFLOAD_FAIL;
+  }
+
+  DP("Launch of entry point at " DPxMOD " successful!\n",
+     DPxPTR(tgt_entry_ptr));
+
+  cl_int sync_err = clFinish(DeviceInfo.Queues[device_id]);
+  if (sync_err != CL_SUCCESS) {
+    DP("Kernel execution error at " DPxMOD "!\n", DPxPTR(tgt_entry_ptr));
+    CL_ERR_STRING(sync_err);
+    return OFFLOAD_FAIL;
+  } else {
+    DP("Kernel execution at " DPxMOD " successful!\n", DPxPTR(tgt_entry_ptr));
+  }
+
+  return OFFLOAD_SUCCESS;
+}
+
+int32_t __tgt_rtl_run_target_region(int32_t device_id, void *tgt_entry_ptr,
+    void **tgt_args, ptrdiff_t *tgt_offsets, int32_t arg_num) {
+  // The region is sequential, so use one team of a single work-item.
+  const int32_t team_num = 1;
+  const int32_t thread_limit = 1;
+  return __tgt_rtl_run_target_team_region(device_id, tgt_entry_ptr, tgt_args,
+      tgt_offsets, arg_num, team_num, thread_limit, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -15,7 +15,7 @@
 #define POLLY_PPCGCODEGENERATION_H
 
 /// The GPU Architecture to target.
-enum GPUArch { NVPTX64, SPIR32, SPIR64 };
+enum GPUArch { NVPTX64, SPIR32, SPIR64, SPIRV32, SPIRV64 };
 
 /// The GPU Runtime implementation to use.
 enum GPURuntime { CUDA, OpenCL };
@@ -574,6 +574,13 @@ private:
   /// @param SizeTypeIs64Bit Whether size_t of the openCl device is 64bit.
   void insertKernelCallsSPIR(ppcg_kernel *Kernel, bool SizeTypeIs64bit);
 
+  /// Insert calls to the OpenCL get_group_id/get_local_id builtins, which the
+  /// SPIR-V backend lowers to the WorkgroupId/LocalInvocationId builtins.
+  ///
+  /// @param Kernel The kernel to generate the function calls for.
+  /// @param SizeTypeIs64Bit Whether size_t of the OpenCL device is 64bit.
+  void insertKernelCallsSPIRV(ppcg_kernel *Kernel, bool SizeTypeIs64bit);
+
   /// Setup the creation of functions referenced by the GPU kernel.
   ///
   /// 1. Create new function declarations in GPUModule which are the same as
@@ -715,6 +722,15 @@ private:
   /// @returns A pointer to a kernel object
   Value *createCallGetKernel(Value *Buffer, Value *Entry);
 
+  /// Create a call to get a kernel from a SPIR-V binary.
+  ///
+  /// @param Buffer The SPIR-V module of the kernel.
+  /// @param Size   The size of the module in bytes.
+  /// @param Entry  The name of the kernel function to call.
+  ///
+  /// @returns A pointer to a kernel object
+  Value *createCallGetKernelIL(Value *Buffer, Value *Size, Value *Entry);
+
   /// Create a call to free a GPU kernel.
   ///
   /// @param GPUKernel THe kernel to free.
@@ -874,6 +890,26 @@ Value *GPUNodeBuilder::createCallGetKernel(Value *Buffer, Value *Entry) {
   return Builder.CreateCall(F, {Buffer, Entry});
 }
 
+Value *GPUNodeBuilder::createCallGetKernelIL(Value *Buffer, Value *Size,
+                                             Value *Entry) {
+  const char *Name = "polly_getKernelIL";
+  Module *M = Builder.GetInsertBlock()->getParent()->getParent();
+  Function *F = M->getFunction(Name);
+
+  // If F is not available, declare it.
+  if (!F) {
+    GlobalValue::LinkageTypes Linkage = Function::ExternalLinkage;
+    std::vector<Type *> Args;
+    Args.push_back(Builder.getInt8PtrTy());
+    Args.push_back(Builder.getInt64Ty());
+    Args.push_back(Builder.getInt8PtrTy());
+    FunctionType *Ty = FunctionType::get(Builder.getInt8PtrTy(), Args, false);
+    F = Function::Create(Ty, Linkage, Name, M);
+  }
+
+  return Builder.CreateCall(F, {Buffer, Size, Entry});
+}
+
 Value *GPUNodeBuilder::createCallGetDevicePtr(Value *Allocation) {
   const char *Name = "polly_getDevicePtr";
   Module *M = Builder.GetInsertBlock()->getParent()->getParent();
@@ -1320,8 +1356,10 @@ void GPUNodeBuilder::createScopStmt(isl_ast_expr *Expr,
 void GPUNodeBuilder::createKernelSync() {
   Module *M = Builder.GetInsertBlock()->getParent()->getParent();
   const char *SpirName = "__gen_ocl_barrier_global";
+  const char *SpirvName = "_Z7barrierj";
 
   Function *Sync;
+  std::vector<Value *> SyncArgs;
 
   switch (Arch) {
   case GPUArch::SPIR64:
@@ -1337,12 +1375,30 @@ void GPUNodeBuilder::createKernelSync() {
       Sync->setCallingConv(CallingConv::SPIR_FUNC);
     }
     break;
+  case GPUArch::SPIRV64:
+  case GPUArch::SPIRV32: {
+    Sync = M->getFunction(SpirvName);
+
+    // If Sync is not available, declare it.
+    if (!Sync) {
+      GlobalValue::LinkageTypes Linkage = Function::ExternalLinkage;
+      FunctionType *Ty = FunctionType::get(Builder.getVoidTy(),
+                                           {Builder.getInt32Ty()}, false);
+      Sync = Function::Create(Ty, Linkage, SpirvName, M);
+      Sync->setCallingConv(CallingConv::SPIR_FUNC);
+    }
+    // Order both the shared and the global memory accesses, like bar.sync
+    const int LocalAndGlobalMemFence = 0x1 | 0x2;
+    SyncArgs.push_back(Builder.getInt32(LocalAndGlobalMemFence));
+    break;
+  }
   case GPUArch::NVPTX64:
     Sync = Intrinsic::getDeclaration(M, Intrinsic::nvvm_barrier0);
     break;
   }
 
-  Builder.CreateCall(Sync, {});
+  CallInst *SyncCall = Builder.CreateCall(Sync, SyncArgs);
+  SyncCall->setCallingConv(Sync->getCallingConv());
 }
 
 /// Collect llvm::Values referenced from @p Node
@@ -1852,7 +1908,12 @@ void GPUNodeBuilder::createKernel(__isl_take isl_ast_node *KernelStmt) {
   std::string Name = getKernelFuncName(Kernel->id);
   Value *KernelString = Builder.CreateGlobalStringPtr(ASMString, Name);
   Value *NameString = Builder.CreateGlobalStringPtr(Name, Name + "_name");
-  Value *GPUKernel = createCallGetKernel(KernelString, NameString);
+  Value *GPUKernel;
+  if (Arch == GPUArch::SPIRV32 || Arch == GPUArch::SPIRV64)
+    GPUKernel = createCallGetKernelIL(
+        KernelString, Builder.getInt64(ASMString.size()), NameString);
+  else
+    GPUKernel = createCallGetKernel(KernelString, NameString);
 
   Value *GridDimX, *GridDimY;
   std::tie(GridDimX, GridDimY) = getGridSizes(Kernel);
@@ -1907,6 +1968,15 @@ static std::string computeSPIRDataLayout(bool is64Bit) {
   return Ret;
 }
 
+/// Compute the DataLayout string for the SPIR-V backend.
+///
+/// @param is64Bit Are we looking for a 64 bit architecture?
+static std::string computeSPIRVDataLayout(bool is64Bit) {
+  if (!is64Bit)
+    return "e-m:e-p:32:32";
+  return "e-m:e-p:64:64";
+}
+
 Function *
 GPUNodeBuilder::createKernelFunctionDecl(ppcg_kernel *Kernel,
                                          SetVector<Value *> &SubtreeValues) {
@@ -1989,6 +2059,8 @@ GPUNodeBuilder::createKernelFunctionDecl(ppcg_kernel *Kernel,
     break;
   case GPUArch::SPIR32:
   case GPUArch::SPIR64:
+  case GPUArch::SPIRV32:
+  case GPUArch::SPIRV64:
     FN->setCallingConv(CallingConv::SPIR_KERNEL);
     break;
   }
@@ -2059,6 +2131,9 @@ void GPUNodeBuilder::insertKernelIntrinsics(ppcg_kernel *Kernel) {
   case GPUArch::SPIR64:
   case GPUArch::SPIR32:
     llvm_unreachable("Cannot generate NVVM intrinsics for SPIR");
+  case GPUArch::SPIRV64:
+  case GPUArch::SPIRV32:
+    llvm_unreachable("Cannot generate NVVM intrinsics for SPIR-V");
   case GPUArch::NVPTX64:
     IntrinsicsBID[0] = Intrinsic::nvvm_read_ptx_sreg_ctaid_x;
     IntrinsicsBID[1] = Intrinsic::nvvm_read_ptx_sreg_ctaid_y;
@@ -2130,6 +2205,43 @@ void GPUNodeBuilder::insertKernelCallsSPIR(ppcg_kernel *Kernel,
     createFunc(LocalName[i], isl_id_list_get_id(Kernel->thread_ids, i), SizeT);
 }
 
+void GPUNodeBuilder::insertKernelCallsSPIRV(ppcg_kernel *Kernel,
+                                            bool SizeTypeIs64bit) {
+  const char *GroupName = "_Z12get_group_idj";
+  const char *LocalName = "_Z12get_local_idj";
+  IntegerType *SizeT =
+      SizeTypeIs64bit ? Builder.getInt64Ty() : Builder.getInt32Ty();
+
+  auto createFunc = [this](const char *Name, int Dim, __isl_take isl_id *Id,
+                           IntegerType *SizeT) mutable {
+    Module *M = Builder.GetInsertBlock()->getParent()->getParent();
+    Function *FN = M->getFunction(Name);
+
+    // If FN is not available, declare it.
+    if (!FN) {
+      GlobalValue::LinkageTypes Linkage = Function::ExternalLinkage;
+      FunctionType *Ty =
+          FunctionType::get(SizeT, {Builder.getInt32Ty()}, false);
+      FN = Function::Create(Ty, Linkage, Name, M);
+      FN->setCallingConv(CallingConv::SPIR_FUNC);
+    }
+
+    CallInst *Call = Builder.CreateCall(FN, {Builder.getInt32(Dim)});
+    Call->setCallingConv(CallingConv::SPIR_FUNC);
+    Value *Val = Call;
+    if (SizeT == Builder.getInt32Ty())
+      Val = Builder.CreateIntCast(Val, Builder.getInt64Ty(), false, Name);
+    IDToValue[Id] = Val;
+    KernelIDs.insert(std::unique_ptr<isl_id, IslIdDeleter>(Id));
+  };
+
+  for (int i = 0; i < Kernel->n_grid; ++i)
+    createFunc(GroupName, i, isl_id_list_get_id(Kernel->block_ids, i), SizeT);
+
+  for (int i = 0; i < Kernel->n_block; ++i)
+    createFunc(LocalName, i, isl_id_list_get_id(Kernel->thread_ids, i), SizeT);
+}
+
 void GPUNodeBuilder::prepareKernelArguments(ppcg_kernel *Kernel, Function *FN) {
   auto Arg = FN->arg_begin();
   for (long i = 0; i < Kernel->n_array; i++) {
@@ -2282,6 +2394,14 @@ void GPUNodeBuilder::createKernelFunction(
     GPUModule->setTargetTriple(Triple::normalize("spir64-unknown-unknown"));
     GPUModule->setDataLayout(computeSPIRDataLayout(true /* is64Bit */));
     break;
+  case GPUArch::SPIRV32:
+    GPUModule->setTargetTriple(Triple::normalize("spirv32-unknown-unknown"));
+    GPUModule->setDataLayout(computeSPIRVDataLayout(false /* is64Bit */));
+    break;
+  case GPUArch::SPIRV64:
+    GPUModule->setTargetTriple(Triple::normalize("spirv64-unknown-unknown"));
+    GPUModule->setDataLayout(computeSPIRVDataLayout(true /* is64Bit */));
+    break;
   }
 
   Function *FN = createKernelFunctionDecl(Kernel, SubtreeValues);
@@ -2310,6 +2430,12 @@ void GPUNodeBuilder::createKernelFunction(
   case GPUArch::SPIR64:
     insertKernelCallsSPIR(Kernel, true);
     break;
+  case GPUArch::SPIRV32:
+    insertKernelCallsSPIRV(Kernel, false);
+    break;
+  case GPUArch::SPIRV64:
+    insertKernelCallsSPIRV(Kernel, true);
+    break;
   }
 }
 
@@ -2334,6 +2460,12 @@ std::string GPUNodeBuilder::createKernelASM() {
     IROstream << *GPUModule;
     IROstream.flush();
     return SPIRAssembly;
+  case GPUArch::SPIRV32:
+    GPUTriple = llvm::Triple(Triple::normalize("spirv32-unknown-unknown"));
+    break;
+  case GPUArch::SPIRV64:
+    GPUTriple = llvm::Triple(Triple::normalize("spirv64-unknown-unknown"));
+    break;
   }
 
   std::string ErrMsg;
@@ -2348,6 +2480,7 @@ std::string GPUNodeBuilder::createKernelASM() {
   Options.UnsafeFPMath = FastMath;
 
   std::string subtarget;
+  auto FileType = TargetMachine::CGFT_AssemblyFile;
 
   switch (Arch) {
   case GPUArch::NVPTX64:
@@ -2356,6 +2489,11 @@ std::string GPUNodeBuilder::createKernelASM() {
   case GPUArch::SPIR32:
   case GPUArch::SPIR64:
     llvm_unreachable("No subtarget for SPIR architecture");
+  case GPUArch::SPIRV32:
+  case GPUArch::SPIRV64:
+    // The OpenCL runtime takes the SPIR-V binary, not its disassembly.
+    FileType = TargetMachine::CGFT_ObjectFile;
+    break;
   }
 
   std::unique_ptr<TargetMachine> TargetM(GPUTarget->createTargetMachine(
@@ -2367,8 +2505,7 @@ std::string GPUNodeBuilder::createKernelASM() {
 
   PM.add(createTargetTransformInfoWrapperPass(TargetM->getTargetIRAnalysis()));
 
-  if (TargetM->addPassesToEmitFile(PM, ASMStream, nullptr,
-                                   TargetMachine::CGFT_AssemblyFile,
+  if (TargetM->addPassesToEmitFile(PM, ASMStream, nullptr, FileType,
                                    true /* verify */)) {
     errs() << "The target does not support generation of this file type!\n";
     return "";
@@ -2468,7 +2605,8 @@ std::string GPUNodeBuilder::finalizeKernelFunction() {
 
   std::string Assembly = createKernelASM();
 
-  if (DumpKernelASM)
+  // A SPIR-V kernel is a binary module, which is not worth printing.
+  if (DumpKernelASM && Arch != GPUArch::SPIRV32 && Arch != GPUArch::SPIRV64)
     outs() << Assembly << "\n";
 
   GPUModule.release();
@@ -121,7 +121,11 @@ static cl::opt<GPUArch>
                              clEnumValN(GPUArch::SPIR32, "spir32",
                                         "target SPIR 32-bit architecture"),
                              clEnumValN(GPUArch::SPIR64, "spir64",
-                                        "target SPIR 64-bit architecture")),
+                                        "target SPIR 64-bit architecture"),
+                             clEnumValN(GPUArch::SPIRV32, "spirv32",
+                                        "target SPIR-V 32-bit architecture"),
+                             clEnumValN(GPUArch::SPIRV64, "spirv64",
+                                        "target SPIR-V 64-bit architecture")),
                   cl::init(GPUArch::NVPTX64), cl::ZeroOrMore,
                   cl::cat(PollyCategory));
 #endif
@@ -156,6 +156,11 @@ typedef cl_program clCreateProgramWithBinaryFcnTy(
     cl_int *ErrcodeRet);
 static clCreateProgramWithBinaryFcnTy *clCreateProgramWithBinaryFcnPtr;
 
+typedef cl_program clCreateProgramWithILFcnTy(cl_context Context,
+                                              const void *IL, size_t Length,
+                                              cl_int *ErrcodeRet);
+static clCreateProgramWithILFcnTy *clCreateProgramWithILFcnPtr;
+
 typedef cl_int clBuildProgramFcnTy(
     cl_program Program, cl_uint NumDevices, const cl_device_id *DeviceList,
     const char *Options,
@@ -289,6 +294,12 @@ static int initialDeviceAPIsCL() {
       (clCreateProgramWithBinaryFcnTy *)getAPIHandleCL(
           Handle, "clCreateProgramWithBinary");
 
+  // Only OpenCL 2.1 drivers take SPIR-V modules, so its absence isn't an error
+  // until a SPIR-V kernel is loaded.
+  if (!HandleOpenCLBeignet)
+    clCreateProgramWithILFcnPtr =
+        (clCreateProgramWithILFcnTy *)dlsym(Handle, "clCreateProgramWithIL");
+
   clBuildProgramFcnPtr =
       (clBuildProgramFcnTy *)getAPIHandleCL(Handle, "clBuildProgram");
 
@@ -464,7 +475,9 @@ static void freeKernelCL(PollyGPUFunction *Kernel) {
     free(Kernel);
 }
 
-static PollyGPUFunction *getKernelCL(const char *BinaryBuffer,
+/* Load the kernel @p KernelName from @p BinaryBuffer. If @p ILSize is nonzero,
+ * BinaryBuffer holds a SPIR-V module of that many bytes. */
+static PollyGPUFunction *getKernelCL(const char *BinaryBuffer, long ILSize,
                                      const char *KernelName) {
   dump_function();
 
@@ -506,7 +519,16 @@ static PollyGPUFunction *getKernelCL(const char *BinaryBuffer,
 
   cl_int Ret;
 
-  if (HandleOpenCLBeignet) {
+  if (ILSize) {
+    if (!clCreateProgramWithILFcnPtr) {
+      fprintf(stderr, "The OpenCL runtime does not support SPIR-V kernels.\n");
+      exit(-1);
+    }
+    ((OpenCLKernel *)Function->Kernel)->Program = clCreateProgramWithILFcnPtr(
+        ((OpenCLContext *)GlobalContext->Context)->Context, BinaryBuffer,
+        ILSize, &Ret);
+    checkOpenCLError(Ret, "Failed to create program from SPIR-V.\n");
+  } else if (HandleOpenCLBeignet) {
     // This is a workaround, since clCreateProgramWithLLVMIntel only
     // accepts a filename to a valid llvm-ir file as an argument, instead
     // of accepting the BinaryBuffer directly.
@@ -1631,7 +1653,7 @@ PollyGPUFunction *polly_getKernel(const char *BinaryBuffer,
 #endif /* HAS_LIBCUDART */
 #ifdef HAS_LIBOPENCL
   case RUNTIME_CL:
-    Function = getKernelCL(BinaryBuffer, KernelName);
+    Function = getKernelCL(BinaryBuffer, 0, KernelName);
     break;
 #endif /* HAS_LIBOPENCL */
   default:
@@ -1641,6 +1663,26 @@ PollyGPUFunction *polly_getKernel(const char *BinaryBuffer,
   return Function;
 }
 
+PollyGPUFunction *polly_getKernelIL(const char *ILBuffer, long ILSize,
+                                    const char *KernelName) {
+  dump_function();
+
+  PollyGPUFunction *Function;
+
+  switch (Runtime) {
+#ifdef HAS_LIBOPENCL
+  case RUNTIME_CL:
+    Function = getKernelCL(ILBuffer, ILSize, KernelName);
+    break;
+#endif /* HAS_LIBOPENCL */
+  default:
+    fprintf(stderr, "SPIR-V kernels need the OpenCL runtime.\n");
+    exit(-1);
+  }
+
+  return Function;
+}
+
 void polly_copyFromHostToDevice(void *HostData, PollyGPUDevicePtr *DevData,
                                 long MemSize) {
   dump_function();
@@ -99,6 +99,10 @@ PollyGPUContext *polly_initContextCUDA();
 PollyGPUContext *polly_initContextCL();
 PollyGPUFunction *polly_getKernel(const char *BinaryBuffer,
                                   const char *KernelName);
+/* Like polly_getKernel, for the SPIR-V binary of @p ILSize bytes at
+ * @p ILBuffer, which may hold null bytes. Needs the OpenCL runtime. */
+PollyGPUFunction *polly_getKernelIL(const char *ILBuffer, long ILSize,
+                                    const char *KernelName);
 void polly_freeKernel(PollyGPUFunction *Kernel);
 void polly_copyFromHostToDevice(void *HostData, PollyGPUDevicePtr *DevData,
                                 long MemSize);